@@ -1720,8 +1720,8 @@ cmd_clone(int argc, char *argv[])
 	error = got_fetch_pack(&pack_hash, &refs, &symrefs,
 	    GOT_FETCH_DEFAULT_REMOTE_NAME, mirror_references,
 	    fetch_all_branches, &wanted_branches, &wanted_refs,
-	    list_refs_only, verbosity, fetchfd, repo, NULL, NULL, bflag,
-	    fetch_progress, &fpa);
+	    list_refs_only, verbosity, fetchfd, proto, repo, NULL, NULL, bflag,
+	    0, NULL, fetch_progress, &fpa);
 	if (error)
 		goto done;
 
@@ -2907,8 +2907,8 @@ cmd_update(int argc, char *argv[])
 
 	error = got_fetch_pack(&pack_hash, &refs, &symrefs, remote->name,
 	    remote->mirror_references, 0, &wanted_branches, &wanted_refs,
-	    0, verbosity, fetchfd, repo, worktree_branch, remote_head,
-	    0, fetch_progress, &fpa);
+	    0, verbosity, fetchfd, proto, repo, worktree_branch, remote_head,
+	    0, 0, NULL, fetch_progress, &fpa);
 	if (error)
 		goto done;
 
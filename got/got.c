@@ -1074,8 +1074,8 @@ done:
 __dead static void
 usage_clone(void)
 {
-	fprintf(stderr, "usage: %s clone [-almqv] [-b branch] "
-	    "[-i identity-file] [-J jumphost] [-R reference] "
+	fprintf(stderr, "usage: %s clone [-almqv] [-b branch] [-D depth] "
+	    "[-F filter] [-i identity-file] [-J jumphost] [-R reference] "
 	    "repository-URL [directory]\n", getprogname());
 	exit(1);
 }
@@ -1099,6 +1099,7 @@ struct got_fetch_progress_arg {
 		const char *port;
 		const char *remote_repo_path;
 		const char *git_url;
+		const char *filter;
 		int fetch_all_branches;
 		int mirror_references;
 	} config_info;
@@ -1107,8 +1108,9 @@ struct got_fetch_progress_arg {
 /* XXX forward declaration */
 static const struct got_error *
 create_config_files(const char *proto, const char *host, const char *port,
-    const char *remote_repo_path, const char *git_url, int fetch_all_branches,
-    int mirror_references, struct got_pathlist_head *symrefs,
+    const char *remote_repo_path, const char *git_url, const char *filter,
+    int fetch_all_branches, int mirror_references,
+    struct got_pathlist_head *symrefs,
     struct got_pathlist_head *wanted_branches,
     struct got_pathlist_head *wanted_refs, struct got_repository *repo);
 
@@ -1133,7 +1135,7 @@ fetch_progress(void *arg, const char *message, off_t packfile_size,
 		err = create_config_files(a->config_info.proto,
 		    a->config_info.host, a->config_info.port,
 		    a->config_info.remote_repo_path,
-		    a->config_info.git_url,
+		    a->config_info.git_url, a->config_info.filter,
 		    a->config_info.fetch_all_branches,
 		    a->config_info.mirror_references,
 		    a->config_info.symrefs,
@@ -1433,8 +1435,9 @@ done:
 }
 
 static const struct got_error *
-create_gitconfig(const char *git_url, const char *default_branch,
-    int fetch_all_branches, struct got_pathlist_head *wanted_branches,
+create_gitconfig(const char *git_url, const char *filter,
+    const char *default_branch, int fetch_all_branches,
+    struct got_pathlist_head *wanted_branches,
     struct got_pathlist_head *wanted_refs, int mirror_references,
     struct got_repository *repo)
 {
@@ -1442,17 +1445,39 @@ create_gitconfig(const char *git_url, const char *default_branch,
 	char *gitconfig_path = NULL;
 	char *gitconfig = NULL;
 	FILE *gitconfig_file = NULL;
-	char *branches = NULL, *refs = NULL;
+	char *branches = NULL, *refs = NULL, *core = NULL, *promisor = NULL;
 	const char *branchname;
 	ssize_t n;
 
+	/*
+	 * A partial clone requires repository format version 1. Git reads
+	 * the last core settings while we read the first, so rewrite them.
+	 */
+	if (filter) {
+		if (asprintf(&core, "[core]\n"
+		    "\trepositoryformatversion = 1\n"
+		    "\tfilemode = true\n"
+		    "\tbare = true\n"
+		    "[extensions]\n"
+		    "\tpartialclone = %s\n",
+		    GOT_FETCH_DEFAULT_REMOTE_NAME) == -1) {
+			err = got_error_from_errno("asprintf");
+			goto done;
+		}
+		if (asprintf(&promisor, "\tpromisor = true\n"
+		    "\tpartialclonefilter = %s\n", filter) == -1) {
+			err = got_error_from_errno("asprintf");
+			goto done;
+		}
+	}
+
 	/* Create a config file Git can understand. */
 	gitconfig_path = got_repo_get_path_gitconfig(repo);
 	if (gitconfig_path == NULL) {
 		err = got_error_from_errno("got_repo_get_path_gitconfig");
 		goto done;
 	}
-	gitconfig_file = fopen(gitconfig_path, "ae");
+	gitconfig_file = fopen(gitconfig_path, filter ? "we" : "ae");
 	if (gitconfig_file == NULL) {
 		err = got_error_from_errno2("fopen", gitconfig_path);
 		goto done;
@@ -1550,12 +1575,15 @@ create_gitconfig(const char *git_url, const char *default_branch,
 	}
 
 	if (asprintf(&gitconfig,
+	    "%s"
 	    "[remote \"%s\"]\n"
 	    "\turl = %s\n"
 	    "%s"
 	    "%s"
+	    "%s"
 	    "\tfetch = refs/tags/*:refs/tags/*\n",
-	    GOT_FETCH_DEFAULT_REMOTE_NAME, git_url, branches ? branches : "",
+	    core ? core : "", GOT_FETCH_DEFAULT_REMOTE_NAME, git_url,
+	    promisor ? promisor : "", branches ? branches : "",
 	    refs ? refs : "") == -1) {
 		err = got_error_from_errno("asprintf");
 		goto done;
@@ -1570,13 +1598,16 @@ done:
 		err = got_error_from_errno2("fclose", gitconfig_path);
 	free(gitconfig_path);
 	free(branches);
+	free(core);
+	free(promisor);
 	return err;
 }
 
 static const struct got_error *
 create_config_files(const char *proto, const char *host, const char *port,
-    const char *remote_repo_path, const char *git_url, int fetch_all_branches,
-    int mirror_references, struct got_pathlist_head *symrefs,
+    const char *remote_repo_path, const char *git_url, const char *filter,
+    int fetch_all_branches, int mirror_references,
+    struct got_pathlist_head *symrefs,
     struct got_pathlist_head *wanted_branches,
     struct got_pathlist_head *wanted_refs, struct got_repository *repo)
 {
@@ -1613,8 +1644,9 @@ create_config_files(const char *proto, const char *host, const char *port,
 		return err;
 
 	/* Create a config file Git can understand. */
-	return create_gitconfig(git_url, default_branch, fetch_all_branches,
-	    wanted_branches, wanted_refs, mirror_references, repo);
+	return create_gitconfig(git_url, filter, default_branch,
+	    fetch_all_branches, wanted_branches, wanted_refs,
+	    mirror_references, repo);
 }
 
 static const struct got_error *
@@ -1635,15 +1667,16 @@ cmd_clone(int argc, char *argv[])
 	char *git_url = NULL;
 	const char *jumphost = NULL, *identity_file = NULL;
 	int verbosity = 0, fetch_all_branches = 0, mirror_references = 0;
-	int bflag = 0, list_refs_only = 0;
+	int bflag = 0, list_refs_only = 0, depth = 0;
 	int *pack_fds = NULL;
+	const char *errstr, *filter = NULL;
 
 	RB_INIT(&refs);
 	RB_INIT(&symrefs);
 	RB_INIT(&wanted_branches);
 	RB_INIT(&wanted_refs);
 
-	while ((ch = getopt(argc, argv, "ab:i:J:lmqR:v")) != -1) {
+	while ((ch = getopt(argc, argv, "ab:D:F:i:J:lmqR:v")) != -1) {
 		switch (ch) {
 		case 'a':
 			fetch_all_branches = 1;
@@ -1655,6 +1688,14 @@ cmd_clone(int argc, char *argv[])
 				return error;
 			bflag = 1;
 			break;
+		case 'D':
+			depth = strtonum(optarg, 1, INT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "depth is %s: %s", errstr, optarg);
+			break;
+		case 'F':
+			filter = optarg;
+			break;
 		case 'i':
 			identity_file = optarg;
 			break;
@@ -1701,6 +1742,10 @@ cmd_clone(int argc, char *argv[])
 			option_conflict('l', 'm');
 		if (!RB_EMPTY(&wanted_refs))
 			option_conflict('l', 'R');
+		if (depth)
+			option_conflict('l', 'D');
+		if (filter)
+			option_conflict('l', 'F');
 	}
 
 	uri = argv[0];
@@ -1815,13 +1860,14 @@ cmd_clone(int argc, char *argv[])
 	fpa.config_info.port = port;
 	fpa.config_info.remote_repo_path = server_path;
 	fpa.config_info.git_url = git_url;
+	fpa.config_info.filter = filter;
 	fpa.config_info.fetch_all_branches = fetch_all_branches;
 	fpa.config_info.mirror_references = mirror_references;
 	error = got_fetch_pack(&pack_hash, &refs, &symrefs,
 	    GOT_FETCH_DEFAULT_REMOTE_NAME, mirror_references,
 	    fetch_all_branches, &wanted_branches, &wanted_refs,
-	    list_refs_only, verbosity, fetchfd, repo, NULL, NULL, bflag,
-	    fetch_progress, &fpa);
+	    list_refs_only, verbosity, fetchfd, proto, repo, NULL, NULL, bflag,
+	    depth, filter, fetch_progress, &fpa);
 	if (error)
 		goto done;
 
@@ -1972,7 +2018,7 @@ cmd_clone(int argc, char *argv[])
 			error = create_config_files(fpa.config_info.proto,
 			    fpa.config_info.host, fpa.config_info.port,
 			    fpa.config_info.remote_repo_path,
-			    fpa.config_info.git_url,
+			    fpa.config_info.git_url, fpa.config_info.filter,
 			    fpa.config_info.fetch_all_branches,
 			    fpa.config_info.mirror_references,
 			    fpa.config_info.symrefs,
@@ -2141,8 +2187,8 @@ done:
 __dead static void
 usage_fetch(void)
 {
-	fprintf(stderr, "usage: %s fetch [-adlqtvX] [-b branch] "
-	    "[-i identity-file] [-J jumphost] [-R reference] "
+	fprintf(stderr, "usage: %s fetch [-adlqtvX] [-b branch] [-D depth] "
+	    "[-F filter] [-i identity-file] [-J jumphost] [-R reference] "
 	    "[-r repository-path] [remote-repository]\n", getprogname());
 	exit(1);
 }
@@ -2395,9 +2441,10 @@ cmd_fetch(int argc, char *argv[])
 	struct got_fetch_progress_arg fpa;
 	int verbosity = 0, fetch_all_branches = 0, list_refs_only = 0;
 	int delete_refs = 0, replace_tags = 0, delete_remote = 0;
-	int *pack_fds = NULL, have_bflag = 0;
+	int *pack_fds = NULL, have_bflag = 0, depth = 0;
 	const char *remote_head = NULL, *worktree_branch = NULL;
 	const char *jumphost = NULL, *identity_file = NULL;
+	const char *errstr, *filter = NULL;
 
 	RB_INIT(&refs);
 	RB_INIT(&symrefs);
@@ -2405,7 +2452,7 @@ cmd_fetch(int argc, char *argv[])
 	RB_INIT(&wanted_branches);
 	RB_INIT(&wanted_refs);
 
-	while ((ch = getopt(argc, argv, "ab:di:J:lqR:r:tvX")) != -1) {
+	while ((ch = getopt(argc, argv, "ab:D:dF:i:J:lqR:r:tvX")) != -1) {
 		switch (ch) {
 		case 'a':
 			fetch_all_branches = 1;
@@ -2417,9 +2464,17 @@ cmd_fetch(int argc, char *argv[])
 				return error;
 			have_bflag = 1;
 			break;
+		case 'D':
+			depth = strtonum(optarg, 1, INT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "depth is %s: %s", errstr, optarg);
+			break;
 		case 'd':
 			delete_refs = 1;
 			break;
+		case 'F':
+			filter = optarg;
+			break;
 		case 'i':
 			identity_file = optarg;
 			break;
@@ -2476,6 +2531,10 @@ cmd_fetch(int argc, char *argv[])
 			option_conflict('l', 'd');
 		if (delete_remote)
 			option_conflict('l', 'X');
+		if (depth)
+			option_conflict('l', 'D');
+		if (filter)
+			option_conflict('l', 'F');
 	}
 	if (delete_remote) {
 		if (fetch_all_branches)
@@ -2488,6 +2547,10 @@ cmd_fetch(int argc, char *argv[])
 			option_conflict('X', 't');
 		if (!RB_EMPTY(&wanted_refs))
 			option_conflict('X', 'R');
+		if (depth)
+			option_conflict('X', 'D');
+		if (filter)
+			option_conflict('X', 'F');
 	}
 
 	if (argc == 0) {
@@ -2607,6 +2670,24 @@ cmd_fetch(int argc, char *argv[])
 				goto done;
 		}
 	}
+	if (filter == NULL && !list_refs_only) {
+		const char *promisor = got_repo_get_promisor_remote(repo);
+
+		/*
+		 * Keep omitting objects from a partial clone. The filter
+		 * is only stored in Git's configuration file.
+		 */
+		if (promisor && strcmp(promisor, remote->name) == 0) {
+			got_repo_get_gitconfig_remotes(&nremotes, &remotes,
+			    repo);
+			for (i = 0; i < nremotes; i++) {
+				if (strcmp(remotes[i].name, remote->name) == 0) {
+					filter = remotes[i].fetch_filter;
+					break;
+				}
+			}
+		}
+	}
 
 	error = got_dial_parse_uri(&proto, &host, &port, &server_path,
 	    &repo_name, remote->fetch_url);
@@ -2725,8 +2806,9 @@ cmd_fetch(int argc, char *argv[])
 
 	error = got_fetch_pack(&pack_hash, &refs, &symrefs, remote->name,
 	    remote->mirror_references, fetch_all_branches, &wanted_branches,
-	    &wanted_refs, list_refs_only, verbosity, fetchfd, repo,
-	    worktree_branch, remote_head, have_bflag, fetch_progress, &fpa);
+	    &wanted_refs, list_refs_only, verbosity, fetchfd, proto, repo,
+	    worktree_branch, remote_head, have_bflag, depth, filter,
+	    fetch_progress, &fpa);
 	if (error)
 		goto done;
 
@@ -3092,6 +3174,237 @@ checkout_ancestry_error(struct got_reference *ref, const char *commit_id_str)
 	return got_error_msg(GOT_ERR_ANCESTRY, msg);
 }
 
+struct got_promisor_arg {
+	struct got_remote_repo *remote;
+	char *proto;
+	char *host;
+	char *port;
+	char *server_path;
+	char *repo_name;
+	int verbosity;
+};
+
+/*
+ * If the repository is a partial clone, look up its promisor remote such
+ * that missing objects can be fetched on demand. This must happen before
+ * unveil(2) and pledge(2) restrictions get tightened.
+ */
+static const struct got_error *
+open_promisor_remote(struct got_promisor_arg *a,
+    struct got_repository *repo, int verbosity)
+{
+	const struct got_error *err;
+	const struct got_gotconfig *repo_conf;
+	const struct got_remote_repo *remotes;
+	const char *remote_name;
+	int i, nremotes;
+
+	memset(a, 0, sizeof(*a));
+	a->verbosity = verbosity;
+
+	remote_name = got_repo_get_promisor_remote(repo);
+	if (remote_name == NULL)
+		return NULL;
+
+	repo_conf = got_repo_get_gotconfig(repo);
+	if (repo_conf) {
+		got_gotconfig_get_remotes(&nremotes, &remotes, repo_conf);
+		for (i = 0; i < nremotes; i++) {
+			if (strcmp(remotes[i].name, remote_name) == 0) {
+				err = got_repo_remote_repo_dup(&a->remote,
+				    &remotes[i]);
+				if (err)
+					return err;
+				break;
+			}
+		}
+	}
+	if (a->remote == NULL) {
+		got_repo_get_gitconfig_remotes(&nremotes, &remotes, repo);
+		for (i = 0; i < nremotes; i++) {
+			if (strcmp(remotes[i].name, remote_name) == 0) {
+				err = got_repo_remote_repo_dup(&a->remote,
+				    &remotes[i]);
+				if (err)
+					return err;
+				break;
+			}
+		}
+	}
+	if (a->remote == NULL)
+		return got_error_path(remote_name, GOT_ERR_NO_REMOTE);
+
+	err = got_dial_parse_uri(&a->proto, &a->host, &a->port,
+	    &a->server_path, &a->repo_name, a->remote->fetch_url);
+	if (err)
+		return err;
+
+	return got_dial_apply_unveil(a->proto);
+}
+
+static void
+close_promisor_remote(struct got_promisor_arg *a)
+{
+	if (a->remote) {
+		got_repo_free_remote_repo_data(a->remote);
+		free(a->remote);
+	}
+	free(a->proto);
+	free(a->host);
+	free(a->port);
+	free(a->server_path);
+	free(a->repo_name);
+	memset(a, 0, sizeof(*a));
+}
+
+static const struct got_error *
+fetch_missing_objects(void *arg, struct got_repository *repo,
+    struct got_object_id *ids, int nids)
+{
+	const struct got_error *err, *close_err;
+	struct got_promisor_arg *a = arg;
+	struct got_fetch_progress_arg fpa;
+	struct got_object_id *pack_hash = NULL;
+	int fetchfd = -1, fetchstatus;
+	pid_t fetchpid = -1;
+
+	if (a->remote == NULL)
+		return got_error_no_obj(&ids[0]);
+
+	if (a->verbosity >= 0) {
+		printf("Fetching %d missing object%s from \"%s\"\n", nids,
+		    nids == 1 ? "" : "s", a->remote->name);
+	}
+
+	err = got_fetch_connect(&fetchpid, &fetchfd, a->proto, a->host,
+	    a->port, a->server_path, NULL, NULL, a->verbosity);
+	if (err)
+		return err;
+
+	memset(&fpa, 0, sizeof(fpa));
+	fpa.last_p_indexed = -1;
+	fpa.last_p_resolved = -1;
+	fpa.verbosity = -1;
+	fpa.repo = repo;
+
+	/*
+	 * Like Git, send a filter such that servers accept want-lines for
+	 * blobs. Objects we want explicitly are always sent.
+	 */
+	err = got_fetch_objects(&pack_hash, ids, nids, "blob:none",
+	    a->verbosity, fetchfd, a->proto, repo, fetch_progress, &fpa);
+	if (err == NULL && pack_hash == NULL)
+		err = got_error_fmt(GOT_ERR_FETCH_FAILED, "%s",
+		    "server sent an empty pack file");
+
+	if (fetchfd != -1 && close(fetchfd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (fetchpid > 0) {
+		if (kill(fetchpid, SIGTERM) == -1)
+			close_err = got_error_from_errno("kill");
+		else
+			close_err = NULL;
+		if (waitpid(fetchpid, &fetchstatus, 0) == -1 &&
+		    close_err == NULL)
+			close_err = got_error_from_errno("waitpid");
+		if (err == NULL)
+			err = close_err;
+	}
+	free(pack_hash);
+	return err;
+}
+
+static const struct got_error *
+collect_missing_blobs(struct got_object_id **ids, int *nids, int *nalloc,
+    struct got_object_id *tree_id, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_tree_object *tree;
+	struct got_tree_entry *te;
+	struct got_object_id *id;
+	int i, nentries, obj_type;
+
+	err = got_object_open_as_tree(&tree, repo, tree_id);
+	if (err)
+		return err;
+
+	nentries = got_object_tree_get_nentries(tree);
+	for (i = 0; i < nentries; i++) {
+		te = got_object_tree_get_entry(tree, i);
+		id = got_tree_entry_get_id(te);
+
+		if (got_object_tree_entry_is_submodule(te))
+			continue;
+		if (S_ISDIR(got_tree_entry_get_mode(te))) {
+			err = collect_missing_blobs(ids, nids, nalloc, id,
+			    repo);
+			if (err)
+				break;
+			continue;
+		}
+
+		err = got_object_get_type(&obj_type, repo, id);
+		if (err == NULL)
+			continue;
+		if (err->code != GOT_ERR_NO_OBJ)
+			break;
+		err = NULL;
+
+		if (*nids == *nalloc) {
+			struct got_object_id *p;
+
+			p = reallocarray(*ids, *nalloc + 64, sizeof(**ids));
+			if (p == NULL) {
+				err = got_error_from_errno("reallocarray");
+				break;
+			}
+			*ids = p;
+			*nalloc += 64;
+		}
+		memcpy(&(*ids)[(*nids)++], id, sizeof(**ids));
+	}
+
+	got_object_tree_close(tree);
+	return err;
+}
+
+/*
+ * Fetch all blobs of a partial clone which are required to check out
+ * the given commit. This is cheaper than fetching blobs one by one.
+ */
+static const struct got_error *
+fetch_missing_blobs(struct got_promisor_arg *a, struct got_object_id *commit_id,
+    const char *path_prefix, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_commit_object *commit = NULL;
+	struct got_object_id *tree_id = NULL, *ids = NULL;
+	int obj_type, nids = 0, nalloc = 0;
+
+	if (a->remote == NULL)
+		return NULL;
+
+	err = got_object_open_as_commit(&commit, repo, commit_id);
+	if (err)
+		return err;
+
+	err = got_object_id_by_path(&tree_id, repo, commit, path_prefix);
+	if (err)
+		goto done;
+	err = got_object_get_type(&obj_type, repo, tree_id);
+	if (err || obj_type != GOT_OBJ_TYPE_TREE)
+		goto done;
+
+	err = collect_missing_blobs(&ids, &nids, &nalloc, tree_id, repo);
+	if (err == NULL && nids > 0)
+		err = fetch_missing_objects(a, repo, ids, nids);
+done:
+	got_object_commit_close(commit);
+	free(tree_id);
+	free(ids);
+	return err;
+}
+
 static const struct got_error *
 cmd_checkout(int argc, char *argv[])
 {
@@ -3109,13 +3422,16 @@ cmd_checkout(int argc, char *argv[])
 	int ch, same_path_prefix, allow_nonempty = 0, verbosity = 0;
 	struct got_pathlist_head paths;
 	struct got_checkout_progress_arg cpa;
+	struct got_promisor_arg pa;
 	int *pack_fds = NULL;
 
 	RB_INIT(&paths);
+	memset(&pa, 0, sizeof(pa));
 
+	/* Network access is needed to fetch blobs missing from a repository. */
 #ifndef PROFILE
 	if (pledge("stdio rpath wpath cpath fattr flock proc exec sendfd "
-	    "unveil", NULL) == -1)
+	    "dns inet unveil", NULL) == -1)
 		err(1, "pledge");
 #endif
 
@@ -3230,6 +3546,18 @@ cmd_checkout(int argc, char *argv[])
 		}
 	}
 
+	error = open_promisor_remote(&pa, repo, verbosity);
+	if (error)
+		goto done;
+#ifndef PROFILE
+	if (pa.remote == NULL || strcmp(pa.proto, "git") != 0) {
+		if (pledge("stdio rpath wpath cpath fattr flock proc exec "
+		    "sendfd unveil", NULL) == -1)
+			err(1, "pledge");
+	}
+#endif
+	got_repo_set_fetch_missing_cb(repo, fetch_missing_objects, &pa);
+
 	error = apply_unveil(got_repo_get_path(repo), 0, worktree_path);
 	if (error)
 		goto done;
@@ -3317,6 +3645,11 @@ cmd_checkout(int argc, char *argv[])
 			goto done;
 	}
 
+	error = fetch_missing_blobs(&pa, commit_id,
+	    got_worktree_get_path_prefix(worktree), repo);
+	if (error)
+		goto done;
+
 	error = got_pathlist_insert(NULL, &paths, "", NULL);
 	if (error)
 		goto done;
@@ -3361,6 +3694,7 @@ done:
 			error = close_err;
 	}
 	got_pathlist_free(&paths, GOT_PATHLIST_FREE_NONE);
+	close_promisor_remote(&pa);
 	free(commit_id_str);
 	free(commit_id);
 	free(repo_path);
@@ -3629,13 +3963,16 @@ cmd_update(int argc, char *argv[])
 	struct got_pathlist_entry *pe;
 	int ch, verbosity = 0;
 	struct got_update_progress_arg upa;
+	struct got_promisor_arg pa;
 	int *pack_fds = NULL;
 
 	RB_INIT(&paths);
+	memset(&pa, 0, sizeof(pa));
 
+	/* Network access is needed to fetch blobs missing from a repository. */
 #ifndef PROFILE
 	if (pledge("stdio rpath wpath cpath fattr flock proc exec sendfd "
-	    "unveil", NULL) == -1)
+	    "dns inet unveil", NULL) == -1)
 		err(1, "pledge");
 #endif
 
@@ -3689,6 +4026,18 @@ cmd_update(int argc, char *argv[])
 	if (error != NULL)
 		goto done;
 
+	error = open_promisor_remote(&pa, repo, verbosity);
+	if (error)
+		goto done;
+#ifndef PROFILE
+	if (pa.remote == NULL || strcmp(pa.proto, "git") != 0) {
+		if (pledge("stdio rpath wpath cpath fattr flock proc exec "
+		    "sendfd unveil", NULL) == -1)
+			err(1, "pledge");
+	}
+#endif
+	got_repo_set_fetch_missing_cb(repo, fetch_missing_objects, &pa);
+
 	error = apply_unveil(got_repo_get_path(repo), 0,
 	    got_worktree_get_root_path(worktree));
 	if (error)
@@ -3790,6 +4139,11 @@ cmd_update(int argc, char *argv[])
 			goto done;
 	}
 
+	error = fetch_missing_blobs(&pa, commit_id,
+	    got_worktree_get_path_prefix(worktree), repo);
+	if (error)
+		goto done;
+
 	memset(&upa, 0, sizeof(upa));
 	upa.verbosity = verbosity;
 	error = got_worktree_checkout_files(worktree, &paths, repo,
@@ -3825,6 +4179,7 @@ done:
 		got_ref_close(head_ref);
 	free(worktree_path);
 	got_pathlist_free(&paths, GOT_PATHLIST_FREE_PATH);
+	close_promisor_remote(&pa);
 	free(commit_id);
 	free(commit_id_str);
 	return error;
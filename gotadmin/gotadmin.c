@@ -23,6 +23,7 @@
 #include <getopt.h>
 #include <err.h>
 #include <errno.h>
+#include <limits.h>
 #include <locale.h>
 #include <inttypes.h>
 #include <stdio.h>
@@ -474,8 +475,9 @@ done:
 __dead static void
 usage_pack(void)
 {
-	fprintf(stderr, "usage: %s pack [-aDq] [-r repository-path] "
-	    "[-x reference] [reference ...]\n", getprogname());
+	fprintf(stderr, "usage: %s pack [-aDq] [-d depth] [-m memory] "
+	    "[-r repository-path] [-w window] [-x reference] "
+	    "[reference ...]\n", getprogname());
 	exit(1);
 }
 
@@ -728,7 +730,10 @@ cmd_pack(int argc, char *argv[])
 	struct got_reflist_head exclude_refs;
 	struct got_reflist_head include_refs;
 	struct got_reflist_entry *re, *new;
+	struct got_pack_delta_params delta_params;
 	int *pack_fds = NULL;
+	long long memsize;
+	const char *errstr;
 
 	RB_INIT(&exclude_args);
 	TAILQ_INIT(&exclude_refs);
@@ -740,7 +745,9 @@ cmd_pack(int argc, char *argv[])
 		err(1, "pledge");
 #endif
 
-	while ((ch = getopt(argc, argv, "aDqr:x:")) != -1) {
+	memset(&delta_params, 0, sizeof(delta_params));
+
+	while ((ch = getopt(argc, argv, "aDd:m:qr:w:x:")) != -1) {
 		switch (ch) {
 		case 'a':
 			loose_obj_only = 0;
@@ -748,6 +755,20 @@ cmd_pack(int argc, char *argv[])
 		case 'D':
 			force_refdelta = 1;
 			break;
+		case 'd':
+			delta_params.depth = strtonum(optarg, 1,
+			    GOT_PACK_DELTA_DEPTH_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "delta chain depth is %s: %s",
+				    errstr, optarg);
+			break;
+		case 'm':
+			if (scan_scaled(optarg, &memsize) == -1 ||
+			    memsize < 1 ||
+			    (unsigned long long)memsize > SIZE_MAX)
+				errx(1, "invalid delta memory size: %s", optarg);
+			delta_params.memsize = memsize;
+			break;
 		case 'q':
 			verbosity = -1;
 			break;
@@ -758,6 +779,13 @@ cmd_pack(int argc, char *argv[])
 				    optarg);
 			got_path_strip_trailing_slashes(repo_path);
 			break;
+		case 'w':
+			delta_params.window = strtonum(optarg, 1,
+			    GOT_PACK_DELTA_WINDOW_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "delta window size is %s: %s",
+				    errstr, optarg);
+			break;
 		case 'x':
 			got_path_strip_trailing_slashes(optarg);
 			error = got_pathlist_insert(NULL, &exclude_args,
@@ -832,7 +860,8 @@ cmd_pack(int argc, char *argv[])
 
 	error = got_repo_pack_objects(&packfile, &pack_hash,
 	    &include_refs, &exclude_refs, repo, loose_obj_only,
-	    force_refdelta, pack_progress, &ppa, check_cancelled, NULL);
+	    force_refdelta, &delta_params, pack_progress, &ppa,
+	    check_cancelled, NULL);
 	if (error) {
 		if (ppa.printed_something)
 			printf("\n");
@@ -845,12 +874,25 @@ cmd_pack(int argc, char *argv[])
 	if (verbosity >= 0)
 		printf("\nWrote %s.pack\n", id_str);
 
-	error = got_repo_index_pack(&idxpath, packfile, pack_hash, repo,
+	error = got_repo_index_pack(&idxpath, packfile, pack_hash, repo, 0,
 	    pack_index_progress, &ppa, check_cancelled, NULL);
 	if (error)
 		goto done;
 	if (verbosity >= 0)
 		printf("\nIndexed %s.pack\n", id_str);
+
+	if (!loose_obj_only && TAILQ_EMPTY(&exclude_refs)) {
+		error = got_repo_write_pack_bitmap(repo, pack_hash,
+		    &include_refs, check_cancelled, NULL);
+		if (error)
+			goto done;
+	}
+
+	error = got_repo_write_multi_pack_index(repo, check_cancelled, NULL);
+	if (error)
+		goto done;
+
+	error = got_repo_write_commit_graph(repo, check_cancelled, NULL);
 done:
 	if (repo)
 		got_repo_close(repo);
@@ -873,7 +915,7 @@ done:
 __dead static void
 usage_indexpack(void)
 {
-	fprintf(stderr, "usage: %s indexpack packfile-path\n",
+	fprintf(stderr, "usage: %s indexpack [-j threads] packfile-path\n",
 	    getprogname());
 	exit(1);
 }
@@ -890,9 +932,17 @@ cmd_indexpack(int argc, char *argv[])
 	struct got_pack_progress_arg ppa;
 	FILE *packfile = NULL;
 	int *pack_fds = NULL;
+	int nthreads = 0;
+	const char *errstr;
 
-	while ((ch = getopt(argc, argv, "")) != -1) {
+	while ((ch = getopt(argc, argv, "j:")) != -1) {
 		switch (ch) {
+		case 'j':
+			nthreads = strtonum(optarg, 1, INT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "number of threads is %s: %s",
+				    errstr, optarg);
+			break;
 		default:
 			usage_indexpack();
 			/* NOTREACHED */
@@ -942,10 +992,12 @@ cmd_indexpack(int argc, char *argv[])
 		goto done;
 
 	error = got_repo_index_pack(&idxpath, packfile, pack_hash, repo,
-	    pack_index_progress, &ppa, check_cancelled, NULL);
+	    nthreads, pack_index_progress, &ppa, check_cancelled, NULL);
 	if (error)
 		goto done;
 	printf("\nIndexed %s.pack\n", id_str);
+
+	error = got_repo_write_multi_pack_index(repo, check_cancelled, NULL);
 done:
 	if (repo)
 		got_repo_close(repo);
@@ -976,12 +1028,14 @@ struct gotadmin_list_pack_cb_args {
 	int ntags;
 	int noffdeltas;
 	int nrefdeltas;
+	off_t packed_size;
 	int human_readable;
 };
 
 static const struct got_error *
 list_pack_cb(void *arg, struct got_object_id *id, int type, off_t offset,
-    off_t size, off_t base_offset, struct got_object_id *base_id)
+    off_t size, off_t packed_size, off_t base_offset,
+    struct got_object_id *base_id)
 {
 	const struct got_error *err;
 	struct gotadmin_list_pack_cb_args *a = arg;
@@ -1035,21 +1089,28 @@ list_pack_cb(void *arg, struct got_object_id *id, int type, off_t offset,
 	}
 	if (a->human_readable) {
 		char scaled[FMT_SCALED_STRSIZE];
-		char *s;;
-		if (fmt_scaled(size, scaled) == -1) {
+		char packed_scaled[FMT_SCALED_STRSIZE];
+		char *s, *ps;
+		if (fmt_scaled(size, scaled) == -1 ||
+		    fmt_scaled(packed_size, packed_scaled) == -1) {
 			err = got_error_from_errno("fmt_scaled");
 			goto done;
 		}
 		s = scaled;
 		while (isspace((unsigned char)*s))
 			s++;
-		printf("%s %s at %lld size %s%s\n", id_str, type_str,
-		    (long long)offset, s, delta_str ? delta_str : "");
-	} else {
-		printf("%s %s at %lld size %lld%s\n", id_str, type_str,
-		    (long long)offset, (long long)size,
+		ps = packed_scaled;
+		while (isspace((unsigned char)*ps))
+			ps++;
+		printf("%s %s at %lld size %s packed-size %s%s\n", id_str,
+		    type_str, (long long)offset, s, ps,
 		    delta_str ? delta_str : "");
+	} else {
+		printf("%s %s at %lld size %lld packed-size %lld%s\n", id_str,
+		    type_str, (long long)offset, (long long)size,
+		    (long long)packed_size, delta_str ? delta_str : "");
 	}
+	a->packed_size += packed_size;
 done:
 	free(id_str);
 	free(base_id_str);
@@ -1132,11 +1193,12 @@ cmd_listpack(int argc, char *argv[])
 		goto done;
 	if (show_stats) {
 		printf("objects: %d\n  blobs: %d\n  trees: %d\n  commits: %d\n"
-		    "  tags: %d\n  offset-deltas: %d\n  ref-deltas: %d\n",
+		    "  tags: %d\n  offset-deltas: %d\n  ref-deltas: %d\n"
+		    "packed size: %lld\n",
 		    lpa.nblobs + lpa.ntrees + lpa.ncommits + lpa.ntags +
 		    lpa.noffdeltas + lpa.nrefdeltas,
 		    lpa.nblobs, lpa.ntrees, lpa.ncommits, lpa.ntags,
-		    lpa.noffdeltas, lpa.nrefdeltas);
+		    lpa.noffdeltas, lpa.nrefdeltas, (long long)lpa.packed_size);
 	}
 done:
 	if (repo)
@@ -1371,6 +1433,17 @@ cmd_cleanup(int argc, char *argv[])
 	if (error)
 		goto done;
 
+	if (!dry_run) {
+		error = got_repo_write_multi_pack_index(repo, check_cancelled,
+		    NULL);
+		if (error)
+			goto done;
+		error = got_repo_write_commit_graph(repo, check_cancelled,
+		    NULL);
+		if (error)
+			goto done;
+	}
+
 	total_size = (loose_before - loose_after) + (pack_before - pack_after);
 
 	if (cpa.printed_something) {
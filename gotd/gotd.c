@@ -65,6 +65,7 @@
 #include "repo_read.h"
 #include "repo_write.h"
 #include "notify.h"
+#include "pack_cache.h"
 #include "secrets.h"
 
 #ifndef nitems
@@ -1970,8 +1971,11 @@ start_auth_child(struct gotd_client *client, int required_auth,
 }
 
 static void
-apply_unveil_repo_readonly(const char *repo_path, int need_tmpdir)
+apply_unveil_repo_readonly(const char *repo_path, int need_tmpdir,
+    int need_pack_cache)
 {
+	char *cache_path;
+
 	if (need_tmpdir) {
 		if (unveil(GOT_TMPDIR_STR, "rwc") == -1)
 			fatal("unveil %s", GOT_TMPDIR_STR);
@@ -1980,6 +1984,15 @@ apply_unveil_repo_readonly(const char *repo_path, int need_tmpdir)
 	if (unveil(repo_path, "r") == -1)
 		fatal("unveil %s", repo_path);
 
+	if (need_pack_cache) {
+		if (asprintf(&cache_path, "%s/%s", repo_path,
+		    GOTD_PACK_CACHE_DIR) == -1)
+			fatal("asprintf");
+		if (unveil(cache_path, "rwc") == -1)
+			fatal("unveil %s", cache_path);
+		free(cache_path);
+	}
+
 	if (unveil(NULL, NULL) == -1)
 		fatal("unveil");
 }
@@ -2351,7 +2364,7 @@ main(int argc, char **argv)
 			err(1, "pledge");
 #endif
 		if (proc_id == PROC_SESSION_READ)
-			apply_unveil_repo_readonly(repo_path, 1);
+			apply_unveil_repo_readonly(repo_path, 1, 1);
 		else {
 			apply_unveil_repo_readwrite(repo_path);
 			repo = gotd_find_repo_by_path(repo_path, &gotd);
@@ -2375,7 +2388,7 @@ main(int argc, char **argv)
 		if (pledge("stdio rpath recvfd unveil", NULL) == -1)
 			err(1, "pledge");
 #endif
-		apply_unveil_repo_readonly(repo_path, 0);
+		apply_unveil_repo_readonly(repo_path, 0, 0);
 
 		if (enter_chroot(repo_path)) {
 			log_info("change repo path %s", repo_path);
@@ -2409,7 +2422,7 @@ main(int argc, char **argv)
 		if (pledge("stdio rpath recvfd unveil", NULL) == -1)
 			err(1, "pledge");
 #endif
-		apply_unveil_repo_readonly(repo_path, 0);
+		apply_unveil_repo_readonly(repo_path, 0, 0);
 		repo = gotd_find_repo_by_path(repo_path, &gotd);
 		if (repo == NULL)
 			fatalx("no repository for path %s", repo_path);
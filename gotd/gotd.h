@@ -210,6 +210,11 @@ enum gotd_imsg_type {
 	GOTD_IMSG_REF_DELETE,	/* The client wants to delete a reference. */
 	GOTD_IMSG_FLUSH,	/* The client sent a flush packet. */
 	GOTD_IMSG_DONE,		/* The client is done chatting. */
+	GOTD_IMSG_SHALLOW,	/* A commit is, or becomes, shallow. */
+	GOTD_IMSG_UNSHALLOW,	/* A shallow commit gains its parents. */
+	GOTD_IMSG_DEEPEN,	/* The client wants a shallow history. */
+	GOTD_IMSG_DEEPEN_DONE,	/* All shallow commits have been sent. */
+	GOTD_IMSG_FILTER,	/* The client wants a filtered pack file. */
 
 	/* Sending or receiving a pack file. */
 	GOTD_IMSG_SEND_PACKFILE, /* The server is sending a pack file. */
@@ -357,6 +362,22 @@ struct gotd_imsg_nak {
 	uint8_t object_id[SHA1_DIGEST_LENGTH];
 } __attribute__((__packed__));
 
+/* Structure for GOTD_IMSG_SHALLOW and GOTD_IMSG_UNSHALLOW data. */
+struct gotd_imsg_shallow {
+	uint8_t object_id[SHA1_DIGEST_LENGTH];
+} __attribute__((__packed__));
+
+/* Structure for GOTD_IMSG_DEEPEN data. */
+struct gotd_imsg_deepen {
+	int depth; /* number of commits to send per wanted commit */
+} __attribute__((__packed__));
+
+/* Structure for GOTD_IMSG_FILTER data. */
+struct gotd_imsg_filter {
+	size_t spec_len;
+	/* Followed by spec_len bytes of filter specification. */
+} __attribute__((__packed__));
+
 /* Structure for GOTD_IMSG_PACKFILE_STATUS data. */
 struct gotd_imsg_packfile_status {
 	size_t reason_len;
@@ -406,6 +427,7 @@ struct gotd_imsg_ref_update_ng {
 /* Structure for GOTD_IMSG_SEND_PACKFILE data. */
 struct gotd_imsg_send_packfile {
 	int report_progress;
+	int thin;
 
 	/* delta cache file is sent as a file descriptor */
 
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "got_compat.h"
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "got_error.h"
+#include "got_object.h"
+#include "got_opentemp.h"
+#include "got_path.h"
+
+#include "got_lib_hash.h"
+
+#include "pack_cache.h"
+
+#define GOTD_PACK_CACHE_SUFFIX	".pack"
+#define GOTD_PACK_CACHE_TEMP	"packing"
+
+/* Unlocked temporary files this recently modified may still be in use. */
+#define GOTD_PACK_CACHE_TEMP_GRACE	60	/* seconds */
+
+static int
+id_cmp(const void *pa, const void *pb)
+{
+	return got_object_id_cmp(pa, pb);
+}
+
+const struct got_error *
+gotd_pack_cache_get_key(char **key, struct got_object_id *ids, size_t nids,
+    enum got_hash_algorithm algo, int flags, const char *filter)
+{
+	struct got_hash ctx;
+	uint8_t digest[GOT_HASH_DIGEST_MAXLEN];
+	char hex[GOT_HASH_DIGEST_STRING_MAXLEN];
+	size_t digest_len = got_hash_digest_length(algo);
+	uint8_t a = algo, f = flags;
+	size_t i;
+
+	*key = NULL;
+
+	if (digest_len == 0)
+		return got_error(GOT_ERR_OBJECT_FORMAT);
+	for (i = 0; i < nids; i++) {
+		if (ids[i].algo != algo)
+			return got_error(GOT_ERR_OBJECT_FORMAT);
+	}
+
+	qsort(ids, nids, sizeof(ids[0]), id_cmp);
+
+	/*
+	 * The key is a hash computed with the repository's hash algorithm,
+	 * and the algorithm is part of the hashed data as well.
+	 */
+	got_hash_init(&ctx, algo);
+	got_hash_update(&ctx, &a, sizeof(a));
+	got_hash_update(&ctx, &f, sizeof(f));
+	if (filter)
+		got_hash_update(&ctx, filter, strlen(filter) + 1);
+	for (i = 0; i < nids; i++) {
+		if (i > 0 && got_object_id_cmp(&ids[i - 1], &ids[i]) == 0)
+			continue;
+		got_hash_update(&ctx, ids[i].hash, digest_len);
+	}
+	got_hash_final(&ctx, digest);
+
+	if (got_hash_digest_to_str(digest, hex, sizeof(hex), algo) == NULL)
+		return got_error(GOT_ERR_BAD_OBJ_ID_STR);
+
+	*key = strdup(hex);
+	if (*key == NULL)
+		return got_error_from_errno("strdup");
+
+	return NULL;
+}
+
+const struct got_error *
+gotd_pack_cache_open(int *fd, const char *repo_path, const char *key)
+{
+	const struct got_error *err = NULL;
+	char *path;
+
+	*fd = -1;
+
+	if (asprintf(&path, "%s/%s/%s%s", repo_path, GOTD_PACK_CACHE_DIR,
+	    key, GOTD_PACK_CACHE_SUFFIX) == -1)
+		return got_error_from_errno("asprintf");
+
+	*fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (*fd == -1 && errno != ENOENT)
+		err = got_error_from_errno2("open", path);
+
+	free(path);
+	return err;
+}
+
+const struct got_error *
+gotd_pack_cache_create_temp(int *fd, char **path, const char *repo_path)
+{
+	const struct got_error *err = NULL;
+	char *dir, *basepath = NULL;
+
+	*fd = -1;
+	*path = NULL;
+
+	if (asprintf(&dir, "%s/%s", repo_path, GOTD_PACK_CACHE_DIR) == -1)
+		return got_error_from_errno("asprintf");
+
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		err = got_error_from_errno2("mkdir", dir);
+		goto done;
+	}
+
+	if (asprintf(&basepath, "%s/%s", dir, GOTD_PACK_CACHE_TEMP) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	err = got_opentemp_named_fd(path, fd, basepath, "");
+	if (err)
+		goto done;
+
+	/*
+	 * The lock is held until the file is closed, even if the session
+	 * process crashes. This tells remove_stale_temp_files() which
+	 * temporary files are still being written.
+	 */
+	if (flock(*fd, LOCK_EX | LOCK_NB) == -1) {
+		err = got_error_from_errno2("flock", *path);
+		if (unlink(*path) == -1 && errno != ENOENT)
+			err = got_error_from_errno2("unlink", *path);
+		close(*fd);
+		*fd = -1;
+		free(*path);
+		*path = NULL;
+	}
+done:
+	free(dir);
+	free(basepath);
+	return err;
+}
+
+static int
+is_cached_pack(const char *name)
+{
+	size_t len = strlen(name);
+	size_t suffixlen = strlen(GOTD_PACK_CACHE_SUFFIX);
+
+	/* Keys are SHA1 or SHA256 hashes, depending on the repository. */
+	if (len != SHA1_DIGEST_STRING_LENGTH - 1 + suffixlen &&
+	    len != SHA256_DIGEST_STRING_LENGTH - 1 + suffixlen)
+		return 0;
+
+	return strcmp(name + len - suffixlen, GOTD_PACK_CACHE_SUFFIX) == 0;
+}
+
+/*
+ * Remove a temporary file left behind by a session process which exited
+ * before the file could be moved into the cache.
+ */
+static const struct got_error *
+remove_stale_temp_file(int dfd, const char *name)
+{
+	const struct got_error *err = NULL;
+	struct stat sb;
+	int fd;
+
+	if (strncmp(name, GOTD_PACK_CACHE_TEMP,
+	    strlen(GOTD_PACK_CACHE_TEMP)) != 0)
+		return NULL;
+
+	fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return NULL;
+		return got_error_from_errno2("openat", name);
+	}
+
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		if (errno != EWOULDBLOCK)
+			err = got_error_from_errno2("flock", name);
+		goto done;
+	}
+
+	/* The file might have been created but not yet locked. */
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno2("fstat", name);
+		goto done;
+	}
+	if (sb.st_mtime + GOTD_PACK_CACHE_TEMP_GRACE > time(NULL))
+		goto done;
+
+	if (unlinkat(dfd, name, 0) == -1 && errno != ENOENT)
+		err = got_error_from_errno2("unlinkat", name);
+done:
+	if (close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", name);
+	return err;
+}
+
+/* Remove the least recently created pack files beyond the cache limit. */
+static const struct got_error *
+evict_packs(DIR *d)
+{
+	const struct got_error *err;
+	struct dirent *dent;
+	struct stat sb;
+	char oldest[NAME_MAX + 1];
+	struct timespec oldest_mtime = { 0, 0 };
+	int npacks;
+
+	for (;;) {
+		npacks = 0;
+		oldest[0] = '\0';
+
+		rewinddir(d);
+		while ((dent = readdir(d)) != NULL) {
+			if (!is_cached_pack(dent->d_name)) {
+				err = remove_stale_temp_file(dirfd(d),
+				    dent->d_name);
+				if (err)
+					return err;
+				continue;
+			}
+			if (fstatat(dirfd(d), dent->d_name, &sb,
+			    AT_SYMLINK_NOFOLLOW) == -1) {
+				if (errno == ENOENT)
+					continue;
+				return got_error_from_errno2("fstatat",
+				    dent->d_name);
+			}
+			npacks++;
+			if (oldest[0] == '\0' ||
+			    timespeccmp(&sb.st_mtim, &oldest_mtime, <)) {
+				strlcpy(oldest, dent->d_name, sizeof(oldest));
+				oldest_mtime = sb.st_mtim;
+			}
+		}
+
+		if (npacks <= GOTD_PACK_CACHE_MAX_PACKS)
+			break;
+
+		if (unlinkat(dirfd(d), oldest, 0) == -1 && errno != ENOENT)
+			return got_error_from_errno2("unlinkat", oldest);
+	}
+
+	return NULL;
+}
+
+const struct got_error *
+gotd_pack_cache_install(const char *tmppath, const char *repo_path,
+    const char *key)
+{
+	const struct got_error *err = NULL;
+	char *dir, *path = NULL;
+	DIR *d = NULL;
+
+	if (asprintf(&dir, "%s/%s", repo_path, GOTD_PACK_CACHE_DIR) == -1)
+		return got_error_from_errno("asprintf");
+
+	if (asprintf(&path, "%s/%s%s", dir, key,
+	    GOTD_PACK_CACHE_SUFFIX) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+
+	d = opendir(dir);
+	if (d == NULL) {
+		err = got_error_from_errno2("opendir", dir);
+		goto done;
+	}
+
+	err = evict_packs(d);
+done:
+	if (d && closedir(d) == -1 && err == NULL)
+		err = got_error_from_errno2("closedir", dir);
+	free(dir);
+	free(path);
+	return err;
+}
+
+const struct got_error *
+gotd_pack_cache_invalidate(const char *repo_path)
+{
+	const struct got_error *err = NULL;
+	char *dir;
+	DIR *d = NULL;
+	struct dirent *dent;
+
+	if (asprintf(&dir, "%s/%s", repo_path, GOTD_PACK_CACHE_DIR) == -1)
+		return got_error_from_errno("asprintf");
+
+	d = opendir(dir);
+	if (d == NULL) {
+		if (errno != ENOENT)
+			err = got_error_from_errno2("opendir", dir);
+		goto done;
+	}
+
+	while ((dent = readdir(d)) != NULL) {
+		if (!is_cached_pack(dent->d_name)) {
+			err = remove_stale_temp_file(dirfd(d), dent->d_name);
+			if (err)
+				break;
+			continue;
+		}
+		if (unlinkat(dirfd(d), dent->d_name, 0) == -1 &&
+		    errno != ENOENT) {
+			err = got_error_from_errno2("unlinkat", dent->d_name);
+			break;
+		}
+	}
+done:
+	if (d && closedir(d) == -1 && err == NULL)
+		err = got_error_from_errno2("closedir", dir);
+	free(dir);
+	return err;
+}
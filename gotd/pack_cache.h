@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Pack files sent to clients which did not send any have-lines depend
+ * only on the set of wanted objects and on the object filter, if any.
+ * Such pack files are kept in a per-repository cache and sent again to
+ * clients making the same request.
+ */
+
+/* Cache directory, relative to the repository path. */
+#define GOTD_PACK_CACHE_DIR		"gotd-pack-cache"
+
+/* Maximum number of pack files cached per repository. */
+#define GOTD_PACK_CACHE_MAX_PACKS	8
+
+/* Pack file content depends on the thin-pack capability. */
+#define GOTD_PACK_CACHE_F_THIN		0x01
+
+/*
+ * Compute the cache key for a request which wants the given object IDs,
+ * optionally filtered by the given object filter specification.
+ * The object IDs must use the given hash algorithm, which is also used
+ * to compute the key. The array of object IDs will be sorted.
+ */
+const struct got_error *gotd_pack_cache_get_key(char **,
+    struct got_object_id *, size_t, enum got_hash_algorithm, int,
+    const char *);
+
+/* Open a cached pack file, or return -1 if the cache has no such file. */
+const struct got_error *gotd_pack_cache_open(int *, const char *,
+    const char *);
+
+/*
+ * Create a temporary file in the cache directory. The file is locked
+ * until it is closed. Unlocked temporary files are removed as stale.
+ */
+const struct got_error *gotd_pack_cache_create_temp(int *, char **,
+    const char *);
+
+/*
+ * Move a temporary file into the cache under the given key.
+ * Remove the oldest pack files if the cache is full, as well as
+ * stale temporary files.
+ */
+const struct got_error *gotd_pack_cache_install(const char *, const char *,
+    const char *);
+
+/* Remove all cached pack files and stale temporary files of a repository. */
+const struct got_error *gotd_pack_cache_invalidate(const char *);
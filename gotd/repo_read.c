@@ -71,9 +71,14 @@ static struct repo_read_client {
 	int				 fd;
 	int				 delta_cache_fd;
 	int				 report_progress;
+	int				 thin;
 	int				 pack_pipe;
 	struct got_object_idset		*want_ids;
 	struct got_object_idset		*have_ids;
+	struct got_object_idset		*shallow_ids;
+	struct got_pack_filter		 filter;
+	int				 bad_filter;
+	int				 want_non_commits;
 } repo_read_client;
 
 static volatile sig_atomic_t sigint_received;
@@ -427,9 +432,14 @@ recv_want(struct imsg *imsg)
 	if (err)
 		return err;
 
+	/*
+	 * Partial clones may want objects such as blobs which were omitted
+	 * from pack files sent earlier. Such requests are only valid if the
+	 * client also sends a filter-line, which follows the want-lines.
+	 */
 	if (obj_type != GOT_OBJ_TYPE_COMMIT &&
 	    obj_type != GOT_OBJ_TYPE_TAG)
-		return got_error(GOT_ERR_OBJ_TYPE);
+		client->want_non_commits = 1;
 
 	if (!got_object_idset_contains(client->want_ids, &id)) {
 		err = got_object_idset_add(client->want_ids, &id, NULL);
@@ -499,6 +509,270 @@ done:
 	return err;
 }
 
+static const struct got_error *
+recv_shallow(struct imsg *imsg)
+{
+	struct repo_read_client *client = &repo_read_client;
+	struct gotd_imsg_shallow ishallow;
+	size_t datalen;
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	struct got_object_id id;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != sizeof(ishallow))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ishallow, imsg->data, sizeof(ishallow));
+
+	memset(&id, 0, sizeof(id));
+	memcpy(id.hash, ishallow.object_id, SHA1_DIGEST_LENGTH);
+	id.algo = GOT_HASH_SHA1;
+
+	if (log_getverbose() > 0 &&
+	    got_object_id_hex(&id, hex, sizeof(hex)))
+		log_debug("client has shallow commit %s", hex);
+
+	/* Commits unknown to us cannot be reached while packing. */
+	if (got_object_idset_contains(client->shallow_ids, &id))
+		return NULL;
+	return got_object_idset_add(client->shallow_ids, &id, NULL);
+}
+
+static const struct got_error *
+send_shallow(int imsg_type, struct got_object_id *id, struct imsgbuf *ibuf)
+{
+	struct gotd_imsg_shallow ishallow;
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+
+	if (log_getverbose() > 0 &&
+	    got_object_id_hex(id, hex, sizeof(hex)))
+		log_debug("sending %s for %s",
+		    imsg_type == GOTD_IMSG_SHALLOW ? "shallow" : "unshallow",
+		    hex);
+
+	memset(&ishallow, 0, sizeof(ishallow));
+	memcpy(ishallow.object_id, id->hash, SHA1_DIGEST_LENGTH);
+
+	if (imsg_compose(ibuf, imsg_type, PROC_REPO_READ, repo_read.pid, -1,
+	    &ishallow, sizeof(ishallow)) == -1)
+		return got_error_from_errno("imsg_compose SHALLOW");
+
+	return gotd_imsg_flush(ibuf);
+}
+
+/* Find the commit a wanted object refers to, peeling tags as needed. */
+static const struct got_error *
+queue_wanted_commit(struct got_object_id *id, void *data, void *arg)
+{
+	const struct got_error *err;
+	struct got_object_id_queue *ids = arg;
+	struct got_object_qid *qid;
+	struct got_tag_object *tag;
+	struct got_object_id commit_id;
+	int obj_type;
+
+	memcpy(&commit_id, id, sizeof(commit_id));
+	for (;;) {
+		err = got_object_get_type(&obj_type, repo_read.repo,
+		    &commit_id);
+		if (err)
+			return err;
+		if (obj_type != GOT_OBJ_TYPE_TAG)
+			break;
+		err = got_object_open_as_tag(&tag, repo_read.repo,
+		    &commit_id);
+		if (err)
+			return err;
+		memcpy(&commit_id, got_object_tag_get_object_id(tag),
+		    sizeof(commit_id));
+		got_object_tag_close(tag);
+	}
+
+	if (obj_type != GOT_OBJ_TYPE_COMMIT)
+		return NULL;
+
+	STAILQ_FOREACH(qid, ids, entry) {
+		if (got_object_id_cmp(&qid->id, &commit_id) == 0)
+			return NULL;
+	}
+
+	err = got_object_qid_alloc(&qid, &commit_id);
+	if (err)
+		return err;
+	STAILQ_INSERT_TAIL(ids, qid, entry);
+	return NULL;
+}
+
+/*
+ * Limit the history sent to the client to the given number of commits
+ * along each path from a wanted commit. Tell the client which commits
+ * become shallow, and which of its shallow commits gain their parents.
+ * Commits which become shallow are added to the set of shallow commits
+ * the pack file will be limited by.
+ */
+static const struct got_error *
+deepen(struct imsg *imsg)
+{
+	const struct got_error *err = NULL;
+	struct repo_read_client *client = &repo_read_client;
+	struct gotd_imsg_deepen ideepen;
+	struct got_object_id_queue level, next;
+	struct got_object_idset *seen = NULL;
+	struct got_object_qid *qid, *pid;
+	struct got_commit_object *commit;
+	const struct got_object_id_queue *parent_ids;
+	struct imsgbuf ibuf;
+	size_t datalen;
+	int depth;
+
+	STAILQ_INIT(&level);
+	STAILQ_INIT(&next);
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != sizeof(ideepen))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ideepen, imsg->data, sizeof(ideepen));
+	if (ideepen.depth <= 0)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	log_debug("client wants history of depth %d", ideepen.depth);
+
+	if (imsgbuf_init(&ibuf, client->fd) == -1)
+		return got_error_from_errno("imsgbuf_init");
+	imsgbuf_allow_fdpass(&ibuf);
+
+	seen = got_object_idset_alloc();
+	if (seen == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+
+	err = got_object_idset_for_each(client->want_ids, queue_wanted_commit,
+	    &level);
+	if (err)
+		goto done;
+	STAILQ_FOREACH(qid, &level, entry) {
+		err = got_object_idset_add(seen, &qid->id, NULL);
+		if (err)
+			goto done;
+	}
+
+	for (depth = 1; !STAILQ_EMPTY(&level); depth++) {
+		while ((qid = STAILQ_FIRST(&level)) != NULL) {
+			STAILQ_REMOVE_HEAD(&level, entry);
+
+			err = got_object_open_as_commit(&commit,
+			    repo_read.repo, &qid->id);
+			if (err)
+				goto done;
+			parent_ids = got_object_commit_get_parent_ids(commit);
+
+			if (depth >= ideepen.depth) {
+				if (!STAILQ_EMPTY(parent_ids) &&
+				    !got_object_idset_contains(
+				    client->shallow_ids, &qid->id)) {
+					err = send_shallow(GOTD_IMSG_SHALLOW,
+					    &qid->id, &ibuf);
+					if (err == NULL)
+						err = got_object_idset_add(
+						    client->shallow_ids,
+						    &qid->id, NULL);
+				}
+				got_object_commit_close(commit);
+				got_object_qid_free(qid);
+				if (err)
+					goto done;
+				continue;
+			}
+
+			if (got_object_idset_contains(client->shallow_ids,
+			    &qid->id)) {
+				/*
+				 * The client lacks the parents of this
+				 * commit. They must be sent even if they
+				 * are reachable from the client's haves.
+				 */
+				err = send_shallow(GOTD_IMSG_UNSHALLOW,
+				    &qid->id, &ibuf);
+				STAILQ_FOREACH(pid, parent_ids, entry) {
+					if (err)
+						break;
+					if (got_object_idset_contains(
+					    client->want_ids, &pid->id))
+						continue;
+					err = got_object_idset_add(
+					    client->want_ids, &pid->id, NULL);
+				}
+			}
+
+			STAILQ_FOREACH(pid, parent_ids, entry) {
+				struct got_object_qid *new;
+
+				if (err)
+					break;
+				if (got_object_idset_contains(seen, &pid->id))
+					continue;
+				err = got_object_idset_add(seen, &pid->id,
+				    NULL);
+				if (err)
+					break;
+				err = got_object_qid_alloc(&new, &pid->id);
+				if (err)
+					break;
+				STAILQ_INSERT_TAIL(&next, new, entry);
+			}
+
+			got_object_commit_close(commit);
+			got_object_qid_free(qid);
+			if (err)
+				goto done;
+		}
+
+		STAILQ_CONCAT(&level, &next);
+	}
+
+	if (imsg_compose(&ibuf, GOTD_IMSG_DEEPEN_DONE, PROC_REPO_READ,
+	    repo_read.pid, -1, NULL, 0) == -1) {
+		err = got_error_from_errno("imsg_compose DEEPEN_DONE");
+		goto done;
+	}
+	err = gotd_imsg_flush(&ibuf);
+done:
+	got_object_id_queue_free(&level);
+	got_object_id_queue_free(&next);
+	if (seen)
+		got_object_idset_free(seen);
+	imsgbuf_clear(&ibuf);
+	return err;
+}
+
+static const struct got_error *
+recv_filter(struct imsg *imsg)
+{
+	const struct got_error *err;
+	struct repo_read_client *client = &repo_read_client;
+	struct gotd_imsg_filter ifilter;
+	size_t datalen;
+	char *spec;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen < sizeof(ifilter))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ifilter, imsg->data, sizeof(ifilter));
+	if (datalen != sizeof(ifilter) + ifilter.spec_len)
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+
+	spec = strndup(imsg->data + sizeof(ifilter), ifilter.spec_len);
+	if (spec == NULL)
+		return got_error_from_errno("strndup");
+
+	log_debug("client wants objects filtered by %s", spec);
+	err = got_pack_parse_filter(&client->filter, spec);
+	free(spec);
+	if (err)
+		client->bad_filter = 1;
+	return err;
+}
+
 struct repo_read_pack_progress_arg {
 	int report_progress;
 	struct imsgbuf *ibuf;
@@ -516,7 +790,13 @@ pack_progress(void *arg, int ncolored, int nfound, int ntrees,
 
 	if (!a->report_progress)
 		return NULL;
-	if (packfile_size > 0 && a->sent_ready)
+	/*
+	 * Pack data is streamed while the delta search is still running.
+	 * The reader of our progress reports stops listening once pack
+	 * data is ready, so all later reports are dropped. This means gotd
+	 * clients intentionally no longer see delta search progress.
+	 */
+	if (a->sent_ready)
 		return NULL;
 
 	memset(&iprog, 0, sizeof(iprog));
@@ -573,6 +853,7 @@ receive_delta_cache_fd(struct imsg *imsg,
 		return got_error(GOT_ERR_PRIVSEP_NO_FD);
 
 	client->report_progress = ireq.report_progress;
+	client->thin = ireq.thin;
 	return NULL;
 }
 
@@ -622,6 +903,12 @@ send_packfile(struct imsg *imsg, struct gotd_imsgev *iev)
 	if (client->delta_cache_fd == -1 || client->pack_pipe == -1)
 		return got_error(GOT_ERR_PRIVSEP_NO_FD);
 
+	/* Never send an unfiltered pack file if filtering failed. */
+	if (client->bad_filter)
+		return got_error(GOT_ERR_BAD_FILTER);
+	if (client->want_non_commits && client->filter.type == 0)
+		return got_error(GOT_ERR_OBJ_TYPE);
+
 	if (imsgbuf_init(&ibuf, client->fd) == -1)
 		return got_error_from_errno("imsgbuf_init");
 	imsgbuf_allow_fdpass(&ibuf);
@@ -648,8 +935,16 @@ send_packfile(struct imsg *imsg, struct gotd_imsgev *iev)
 
 	err = got_pack_create(&packhash, client->pack_pipe, delta_cache,
 	    have_ids.ids, have_ids.nids, want_ids.ids, want_ids.nids,
-	    repo_read.repo, 0, 1, 0, pack_progress, &pa, &rl,
-	    check_cancelled, NULL);
+	    repo_read.repo, 0, 1, 0, client->thin, client->shallow_ids,
+	    client->filter.type != 0 ? &client->filter : NULL, NULL, 0,
+	    pack_progress, &pa, &rl, check_cancelled, NULL);
+	if (err)
+		goto done;
+
+	/* Signal the end of pack data to the reader of the pack pipe. */
+	if (close(client->pack_pipe) == -1)
+		err = got_error_from_errno("close");
+	client->pack_pipe = -1;
 	if (err)
 		goto done;
 
@@ -726,6 +1021,21 @@ repo_read_dispatch_session(int fd, short event, void *arg)
 			if (err)
 				log_warnx("have-line: %s", err->msg);
 			break;
+		case GOTD_IMSG_SHALLOW:
+			err = recv_shallow(&imsg);
+			if (err)
+				log_warnx("shallow-line: %s", err->msg);
+			break;
+		case GOTD_IMSG_DEEPEN:
+			err = deepen(&imsg);
+			if (err)
+				log_warnx("deepen: %s", err->msg);
+			break;
+		case GOTD_IMSG_FILTER:
+			err = recv_filter(&imsg);
+			if (err)
+				log_warnx("filter-line: %s", err->msg);
+			break;
 		case GOTD_IMSG_SEND_PACKFILE:
 			err = receive_delta_cache_fd(&imsg, iev);
 			if (err)
@@ -873,6 +1183,11 @@ repo_read_main(const char *title, const char *repo_path,
 		err = got_error_from_errno("got_object_idset_alloc");
 		goto done;
 	}
+	client->shallow_ids = got_object_idset_alloc();
+	if (client->shallow_ids == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
 
 	repo_read.title = title;
 	repo_read.pid = getpid();
@@ -936,6 +1251,8 @@ repo_read_shutdown(void)
 		got_object_idset_free(client->have_ids);
 	if (client->want_ids)
 		got_object_idset_free(client->want_ids);
+	if (client->shallow_ids)
+		got_object_idset_free(client->shallow_ids);
 	if (client->fd != -1)
 		close(client->fd);
 	if (client->delta_cache_fd != -1)
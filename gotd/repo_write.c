@@ -52,11 +52,13 @@
 #include "got_lib_object_cache.h"
 #include "got_lib_object_idset.h"
 #include "got_lib_object_parse.h"
+#include "got_lib_object_qid.h"
 #include "got_lib_ratelimit.h"
 #include "got_lib_pack.h"
 #include "got_lib_pack_index.h"
 #include "got_lib_repository.h"
 #include "got_lib_poll.h"
+#include "got_lib_commit_graph_file.h"
 
 #include "log.h"
 #include "gotd.h"
@@ -422,7 +424,9 @@ protect_require_yca(struct got_object_id *tip_id,
 	struct got_object_id_queue ids;
 	struct got_object_qid *pid, *qid;
 	struct got_object_idset *traversed_set = NULL;
-	int found_yca = 0, obj_type;
+	struct got_commit_graph_file *cg;
+	uint32_t pos, yca_gen = 0, *parents = NULL;
+	int found_yca = 0, obj_type, i, nparents;
 
 	STAILQ_INIT(&ids);
 
@@ -430,6 +434,21 @@ protect_require_yca(struct got_object_id *tip_id,
 	if (err)
 		return err;
 
+	err = got_repo_get_commit_graph_file(&cg, repo_write.repo);
+	if (err)
+		goto done;
+
+	/*
+	 * Commits listed in the commit-graph file with a generation number
+	 * not larger than that of the expected YCA cannot be descendants
+	 * of the expected YCA. Their parents need not be traversed.
+	 */
+	if (cg && got_commit_graph_file_lookup(&pos, cg, expected_yca_id)) {
+		yca_gen = got_commit_graph_file_get_generation(cg, pos);
+		if (yca_gen >= GOT_COMMIT_GRAPH_GENERATION_MAX)
+			yca_gen = 0;
+	}
+
 	err = got_object_get_type(&obj_type, repo_write.repo, expected_yca_id);
 	if (err)
 		goto done;
@@ -476,6 +495,36 @@ protect_require_yca(struct got_object_id *tip_id,
 		if (err)
 			goto done;
 
+		if (cg && got_commit_graph_file_lookup(&pos, cg, &qid->id)) {
+			STAILQ_REMOVE_HEAD(&ids, entry);
+			got_object_qid_free(qid);
+			qid = NULL;
+
+			if (yca_gen > 0 &&
+			    got_commit_graph_file_get_generation(cg, pos) <=
+			    yca_gen)
+				continue;
+
+			err = got_commit_graph_file_get_parents(&parents,
+			    &nparents, cg, pos);
+			if (err)
+				goto done;
+			if (nparents == 0)
+				break;
+			for (i = 0; i < nparents; i++) {
+				err = got_object_qid_alloc_partial(&qid);
+				if (err)
+					goto done;
+				got_commit_graph_file_get_id(&qid->id, cg,
+				    parents[i]);
+				STAILQ_INSERT_TAIL(&ids, qid, entry);
+				qid = NULL;
+			}
+			free(parents);
+			parents = NULL;
+			continue;
+		}
+
 		err = got_object_open(&obj, repo_write.repo, &qid->id);
 		if (err && err->code != GOT_ERR_NO_OBJ)
 			goto done;
@@ -553,8 +602,10 @@ protect_require_yca(struct got_object_id *tip_id,
 		    got_ref_get_name(ref));
 	}
 done:
-	got_object_idset_free(traversed_set);
+	if (traversed_set)
+		got_object_idset_free(traversed_set);
 	got_object_id_queue_free(&ids);
+	free(parents);
 	free(buf);
 	if (obj)
 		got_object_close(obj);
@@ -725,6 +776,61 @@ done:
 	return err;
 }
 
+/* Provide delta bases which are missing from a thin pack file. */
+static const struct got_error *
+get_delta_base(void *arg, int *obj_type, off_t *size, FILE *outfile,
+    struct got_object_id *id)
+{
+	const struct got_error *err;
+	struct got_raw_object *raw = NULL;
+	uint8_t buf[8192];
+	off_t remain;
+	size_t n;
+	int outfd = -1;
+
+	err = got_object_get_type(obj_type, repo_write.repo, id);
+	if (err)
+		return err;
+	err = got_object_raw_open(&raw, &outfd, repo_write.repo, id);
+	if (err)
+		goto done;
+
+	if (raw->f == NULL) {
+		if (fwrite(raw->data + raw->hdrlen, 1, raw->size,
+		    outfile) != raw->size) {
+			err = got_ferror(outfile, GOT_ERR_IO);
+			goto done;
+		}
+	} else {
+		if (fseeko(raw->f, raw->hdrlen, SEEK_SET) == -1) {
+			err = got_error_from_errno("fseeko");
+			goto done;
+		}
+		remain = raw->size;
+		while (remain > 0) {
+			n = fread(buf, 1, remain < sizeof(buf) ?
+			    remain : sizeof(buf), raw->f);
+			if (n == 0) {
+				err = got_ferror(raw->f, GOT_ERR_IO);
+				goto done;
+			}
+			if (fwrite(buf, 1, n, outfile) != n) {
+				err = got_ferror(outfile, GOT_ERR_IO);
+				goto done;
+			}
+			remain -= n;
+		}
+	}
+
+	*size = raw->size;
+done:
+	if (raw)
+		got_object_raw_close(raw);
+	if (outfd != -1 && close(outfd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	return err;
+}
+
 static const struct got_error *
 pack_index_progress(void *arg, uint32_t nobj_total, uint32_t nobj_indexed,
     uint32_t nobj_loose, uint32_t nobj_resolved)
@@ -1243,7 +1349,8 @@ recv_packfile(int *have_packfile, struct imsg *imsg)
 		goto done;
 	}
 
-	err = got_delta_cache_alloc(&pack->delta_cache);
+	err = got_delta_cache_alloc(&pack->delta_cache,
+	    GOT_DELTA_CACHE_DEFAULT_SIZE);
 	if (err)
 		goto done;
 
@@ -1330,11 +1437,14 @@ recv_packfile(int *have_packfile, struct imsg *imsg)
 	    (long long)pack->filesize);
 	err = got_pack_index(pack, client->packidx_fd,
 	    tempfiles[0], tempfiles[1], tempfiles[2], &id,
-	    pack_index_progress, NULL, &rl);
+	    get_delta_base, NULL, pack_index_progress, NULL, &rl, 1);
 	if (err)
 		goto done;
 	log_debug("done indexing pack");
 
+	/* Completing a thin pack file changes its hash. */
+	memcpy(client->pack_sha1, id.hash, SHA1_DIGEST_LENGTH);
+
 	if (fsync(client->packidx_fd) == -1) {
 		err = got_error_from_errno("fsync");
 		goto done;
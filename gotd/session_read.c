@@ -34,7 +34,9 @@
 #include <unistd.h>
 
 #include "got_error.h"
+#include "got_cancel.h"
 #include "got_repository.h"
+#include "got_repository_admin.h"
 #include "got_object.h"
 #include "got_path.h"
 #include "got_reference.h"
@@ -45,11 +47,15 @@
 #include "got_lib_object.h"
 #include "got_lib_object_cache.h"
 #include "got_lib_pack.h"
+#include "got_lib_ratelimit.h"
+#include "got_lib_pack_create.h"
 #include "got_lib_repository.h"
 #include "got_lib_gitproto.h"
+#include "got_lib_poll.h"
 
 #include "gotd.h"
 #include "log.h"
+#include "pack_cache.h"
 #include "session_read.h"
 
 enum gotd_session_read_state {
@@ -73,6 +79,10 @@ static struct gotd_session_read {
 	enum gotd_session_read_state state;
 	struct gotd_imsgev repo_child_iev;
 	int repo_child_packfd;
+	int pack_relay_fd;
+	int pack_relay_outfd;
+	struct event pack_relay_ev;
+	int packfile_done;
 } gotd_session;
 
 static struct gotd_session_client {
@@ -92,6 +102,19 @@ static struct gotd_session_client {
 	int				 nref_updates;
 	int				 accept_flush_pkt;
 	int				 flush_disconnect;
+	struct got_object_id		*want_ids;
+	size_t				 nwant_ids;
+	size_t				 nwant_ids_alloc;
+	int				 nhaves;
+	int				 nshallow;
+	int				 depth;
+	char				*filter;
+	char				*pack_cache_key;
+	char				*pack_cache_path;
+	int				 pack_cache_fd;
+	int				 pack_cache_hit;
+	int				 pack_cache_nobj;
+	off_t				 pack_cache_size;
 } gotd_session_client;
 
 static void session_read_shutdown(void);
@@ -122,6 +145,8 @@ disconnect(struct gotd_session_client *client)
 		free(client->packidx_path);
 	}
 	free(client->capabilities);
+	free(client->want_ids);
+	free(client->filter);
 
 	session_read_shutdown();
 }
@@ -179,6 +204,110 @@ session_read_sighdlr(int sig, short event, void *arg)
 	}
 }
 
+static void
+discard_cached_packfile(struct gotd_session_client *client)
+{
+	if (client->pack_cache_fd != -1) {
+		close(client->pack_cache_fd);
+		client->pack_cache_fd = -1;
+	}
+	if (client->pack_cache_path) {
+		if (unlink(client->pack_cache_path) == -1 && errno != ENOENT)
+			log_warn("unlink %s: ", client->pack_cache_path);
+		free(client->pack_cache_path);
+		client->pack_cache_path = NULL;
+	}
+	free(client->pack_cache_key);
+	client->pack_cache_key = NULL;
+}
+
+static void
+install_cached_packfile(struct gotd_session_client *client)
+{
+	const struct got_error *err = NULL;
+
+	if (client->pack_cache_fd == -1)
+		return;
+
+	/* Keep the temporary file locked until it has been renamed. */
+	err = gotd_pack_cache_install(client->pack_cache_path,
+	    got_repo_get_path(gotd_session.repo), client->pack_cache_key);
+	if (close(client->pack_cache_fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	client->pack_cache_fd = -1;
+	if (err) {
+		log_warnx("uid %d: could not cache pack file: %s",
+		    client->euid, err->msg);
+		discard_cached_packfile(client);
+		return;
+	}
+
+	log_debug("uid %d: cached pack file %s", client->euid,
+	    client->pack_cache_key);
+	free(client->pack_cache_path);
+	client->pack_cache_path = NULL;
+}
+
+static void
+close_pack_relay(void)
+{
+	if (gotd_session.pack_relay_fd == -1)
+		return;
+
+	event_del(&gotd_session.pack_relay_ev);
+	close(gotd_session.pack_relay_fd);
+	gotd_session.pack_relay_fd = -1;
+	if (gotd_session.pack_relay_outfd != -1) {
+		close(gotd_session.pack_relay_outfd);
+		gotd_session.pack_relay_outfd = -1;
+	}
+}
+
+/*
+ * Copy pack data written by the repo_read process to gotsh(1),
+ * and to the pack cache if the pack file is being cached.
+ */
+static void
+relay_pack_data(int fd, short event, void *arg)
+{
+	const struct got_error *err = NULL;
+	struct gotd_session_client *client = &gotd_session_client;
+	char buf[65536];
+	ssize_t r;
+
+	r = read(fd, buf, sizeof(buf));
+	if (r == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		disconnect_on_error(client, got_error_from_errno("read"));
+		return;
+	}
+	if (r == 0) {
+		/* EOF; gotsh(1) will see EOF once we close our end. */
+		close_pack_relay();
+		if (gotd_session.packfile_done) {
+			install_cached_packfile(client);
+			disconnect(client);
+		}
+		return;
+	}
+
+	err = got_poll_write_full(gotd_session.pack_relay_outfd, buf, r);
+	if (err) {
+		disconnect_on_error(client, err);
+		return;
+	}
+
+	if (client->pack_cache_fd != -1) {
+		err = got_poll_write_full(client->pack_cache_fd, buf, r);
+		if (err) {
+			log_warnx("uid %d: could not cache pack file: %s",
+			    client->euid, err->msg);
+			discard_cached_packfile(client);
+		}
+	}
+}
+
 static const struct got_error *
 recv_packfile_done(struct imsg *imsg)
 {
@@ -236,8 +365,18 @@ session_dispatch_repo_child(int fd, short event, void *arg)
 			err = gotd_imsg_recv_error(&client_id, &imsg);
 			break;
 		case GOTD_IMSG_PACKFILE_DONE:
-			do_disconnect = 1;
 			err = recv_packfile_done(&imsg);
+			if (err) {
+				do_disconnect = 1;
+				break;
+			}
+			/* Wait for the relay to pass on all pack data. */
+			if (gotd_session.pack_relay_fd != -1) {
+				gotd_session.packfile_done = 1;
+				break;
+			}
+			install_cached_packfile(client);
+			do_disconnect = 1;
 			break;
 		default:
 			log_debug("unexpected imsg %d", imsg.hdr.type);
@@ -342,6 +481,7 @@ forward_want(struct gotd_session_client *client, struct imsg *imsg)
 {
 	struct gotd_imsg_want ireq;
 	struct gotd_imsg_want iwant;
+	struct got_object_id *id;
 	size_t datalen;
 
 	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
@@ -353,6 +493,21 @@ forward_want(struct gotd_session_client *client, struct imsg *imsg)
 	memset(&iwant, 0, sizeof(iwant));
 	memcpy(iwant.object_id, ireq.object_id, SHA1_DIGEST_LENGTH);
 
+	if (client->nwant_ids >= client->nwant_ids_alloc) {
+		struct got_object_id *new;
+		size_t newalloc = client->nwant_ids_alloc + 16;
+
+		new = reallocarray(client->want_ids, newalloc, sizeof(*new));
+		if (new == NULL)
+			return got_error_from_errno("reallocarray");
+		client->want_ids = new;
+		client->nwant_ids_alloc = newalloc;
+	}
+	id = &client->want_ids[client->nwant_ids++];
+	memset(id, 0, sizeof(*id));
+	memcpy(id->hash, ireq.object_id, SHA1_DIGEST_LENGTH);
+	id->algo = GOT_HASH_SHA1;
+
 	if (gotd_imsg_compose_event(&gotd_session.repo_child_iev,
 	    GOTD_IMSG_WANT, PROC_SESSION_READ, -1,
 	    &iwant, sizeof(iwant)) == -1)
@@ -382,6 +537,103 @@ forward_have(struct gotd_session_client *client, struct imsg *imsg)
 	    &ihave, sizeof(ihave)) == -1)
 		return got_error_from_errno("imsg compose HAVE");
 
+	client->nhaves++;
+	return NULL;
+}
+
+static const struct got_error *
+forward_shallow(struct gotd_session_client *client, struct imsg *imsg)
+{
+	struct gotd_imsg_shallow ireq;
+	struct gotd_imsg_shallow ishallow;
+	size_t datalen;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != sizeof(ireq))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+
+	memcpy(&ireq, imsg->data, datalen);
+
+	memset(&ishallow, 0, sizeof(ishallow));
+	memcpy(ishallow.object_id, ireq.object_id, SHA1_DIGEST_LENGTH);
+
+	if (gotd_imsg_compose_event(&gotd_session.repo_child_iev,
+	    GOTD_IMSG_SHALLOW, PROC_SESSION_READ, -1,
+	    &ishallow, sizeof(ishallow)) == -1)
+		return got_error_from_errno("imsg compose SHALLOW");
+
+	client->nshallow++;
+	return NULL;
+}
+
+static const struct got_error *
+recv_deepen(struct gotd_session_client *client, struct imsg *imsg)
+{
+	struct gotd_imsg_deepen ideepen;
+	size_t datalen;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != sizeof(ideepen))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+
+	memcpy(&ideepen, imsg->data, datalen);
+	if (ideepen.depth <= 0 || client->depth > 0)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	/* The deepen request is forwarded along with the flush packet. */
+	client->depth = ideepen.depth;
+	return NULL;
+}
+
+static const struct got_error *
+forward_deepen(struct gotd_session_client *client)
+{
+	struct gotd_imsg_deepen ideepen;
+
+	memset(&ideepen, 0, sizeof(ideepen));
+	ideepen.depth = client->depth;
+
+	if (gotd_imsg_compose_event(&gotd_session.repo_child_iev,
+	    GOTD_IMSG_DEEPEN, PROC_SESSION_READ, -1,
+	    &ideepen, sizeof(ideepen)) == -1)
+		return got_error_from_errno("imsg compose DEEPEN");
+
+	return NULL;
+}
+
+static const struct got_error *
+forward_filter(struct gotd_session_client *client, struct imsg *imsg)
+{
+	const struct got_error *err;
+	struct gotd_imsg_filter ifilter;
+	struct got_pack_filter filter;
+	size_t datalen;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen < sizeof(ifilter))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ifilter, imsg->data, sizeof(ifilter));
+	if (ifilter.spec_len == 0 ||
+	    datalen != sizeof(ifilter) + ifilter.spec_len)
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	if (client->filter != NULL)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	client->filter = strndup(imsg->data + sizeof(ifilter),
+	    ifilter.spec_len);
+	if (client->filter == NULL)
+		return got_error_from_errno("strndup");
+
+	/* Report filters we cannot apply to the client. */
+	err = got_pack_parse_filter(&filter, client->filter);
+	if (err)
+		return err;
+
+	if (gotd_imsg_compose_event(&gotd_session.repo_child_iev,
+	    GOTD_IMSG_FILTER, PROC_SESSION_READ, -1,
+	    imsg->data, datalen) == -1)
+		return got_error_from_errno("imsg compose FILTER");
+
 	return NULL;
 }
 
@@ -403,20 +655,147 @@ client_has_capability(struct gotd_session_client *client, const char *capastr)
 	return 0;
 }
 
+static const struct got_error *
+open_cached_packfile(struct gotd_session_client *client, int fd)
+{
+	struct got_packfile_hdr hdr;
+	struct stat sb;
+	ssize_t r;
+
+	if (fstat(fd, &sb) == -1)
+		return got_error_from_errno("fstat");
+
+	r = pread(fd, &hdr, sizeof(hdr), 0);
+	if (r == -1)
+		return got_error_from_errno("pread");
+	if (r != sizeof(hdr))
+		return got_error_msg(GOT_ERR_BAD_PACKFILE, "short pack file");
+	if (hdr.signature != htobe32(GOT_PACKFILE_SIGNATURE))
+		return got_error_msg(GOT_ERR_BAD_PACKFILE,
+		    "bad packfile signature");
+	if (hdr.version != htobe32(GOT_PACKFILE_VERSION))
+		return got_error_msg(GOT_ERR_BAD_PACKFILE,
+		    "bad packfile version");
+
+	client->pack_cache_fd = fd;
+	client->pack_cache_hit = 1;
+	client->pack_cache_nobj = be32toh(hdr.nobjects);
+	client->pack_cache_size = sb.st_size;
+	return NULL;
+}
+
+/*
+ * Pack files sent in response to requests without have-lines can be
+ * cached, unless the pack file is limited to a shallow history.
+ * Look for a cached pack file matching the client's request,
+ * or prepare a temporary file in the cache if none is found.
+ */
+static const struct got_error *
+lookup_pack_cache(struct gotd_session_client *client, int thin)
+{
+	const struct got_error *err;
+	const char *repo_path = got_repo_get_path(gotd_session.repo);
+	int fd;
+
+	if (client->nhaves > 0 || client->nwant_ids == 0 ||
+	    client->nshallow > 0 || client->depth > 0)
+		return NULL;
+
+	err = gotd_pack_cache_get_key(&client->pack_cache_key,
+	    client->want_ids, client->nwant_ids,
+	    got_repo_get_object_format(gotd_session.repo),
+	    thin ? GOTD_PACK_CACHE_F_THIN : 0, client->filter);
+	if (err)
+		return err;
+
+	err = gotd_pack_cache_open(&fd, repo_path, client->pack_cache_key);
+	if (err)
+		return err;
+	if (fd != -1) {
+		err = open_cached_packfile(client, fd);
+		if (err == NULL) {
+			log_debug("uid %d: sending cached pack file %s",
+			    client->euid, client->pack_cache_key);
+			return NULL;
+		}
+		log_warnx("uid %d: cached pack file %s: %s", client->euid,
+		    client->pack_cache_key, err->msg);
+		close(fd);
+	}
+
+	err = gotd_pack_cache_create_temp(&client->pack_cache_fd,
+	    &client->pack_cache_path, repo_path);
+	if (err) {
+		log_warnx("uid %d: could not cache pack file: %s",
+		    client->euid, err->msg);
+		discard_cached_packfile(client);
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+send_cached_packfile(struct gotd_session_client *client)
+{
+	/* Send the cached pack file to gotsh(1) in place of a pack pipe. */
+	if (gotd_imsg_compose_event(&client->iev,
+	    GOTD_IMSG_PACKFILE_PIPE, PROC_GOTD, client->pack_cache_fd,
+	    NULL, 0) == -1)
+		return got_error_from_errno("imsg compose PACKFILE_PIPE");
+
+	client->pack_cache_fd = -1;
+	return NULL;
+}
+
+static const struct got_error *
+send_cached_packfile_ready(struct gotd_session_client *client)
+{
+	struct gotd_imsg_packfile_progress iprog;
+
+	if (!client_has_capability(client, GOT_CAPA_SIDE_BAND_64K)) {
+		disconnect(client);
+		return NULL;
+	}
+
+	/* gotsh(1) expects a progress report before pack data. */
+	memset(&iprog, 0, sizeof(iprog));
+	iprog.nfound = client->pack_cache_nobj;
+	iprog.packfile_size = client->pack_cache_size;
+	iprog.nobj_total = client->pack_cache_nobj;
+	iprog.nobj_deltify = client->pack_cache_nobj;
+	iprog.nobj_written = client->pack_cache_nobj;
+
+	if (gotd_imsg_compose_event(&client->iev,
+	    GOTD_IMSG_PACKFILE_READY, PROC_SESSION_READ, -1,
+	    &iprog, sizeof(iprog)) == -1)
+		return got_error_from_errno("imsg compose PACKFILE_READY");
+
+	client->flush_disconnect = 1;
+	return NULL;
+}
+
 static const struct got_error *
 send_packfile(struct gotd_session_client *client)
 {
 	const struct got_error *err = NULL;
 	struct gotd_imsg_send_packfile ipack;
-	int pipe[2];
-
-	if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, pipe) == -1)
-		return got_error_from_errno("socketpair");
+	int pipe[2], relay[2];
 
 	memset(&ipack, 0, sizeof(ipack));
 
 	if (client_has_capability(client, GOT_CAPA_SIDE_BAND_64K))
 		ipack.report_progress = 1;
+	if (client_has_capability(client, GOT_CAPA_THIN_PACK))
+		ipack.thin = 1;
+
+	err = lookup_pack_cache(client, ipack.thin);
+	if (err)
+		return err;
+	if (client->pack_cache_hit)
+		return send_cached_packfile(client);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, pipe) == -1)
+		return got_error_from_errno("socketpair");
 
 	client->delta_cache_fd = got_opentempfd();
 	if (client->delta_cache_fd == -1)
@@ -447,7 +826,29 @@ send_packfile(struct gotd_session_client *client)
 		return err;
 	}
 
-	gotd_session.repo_child_packfd = pipe[1];
+	if (client->pack_cache_fd == -1) {
+		gotd_session.repo_child_packfd = pipe[1];
+		return NULL;
+	}
+
+	/*
+	 * The pack file will be cached. Relay pack data written by the
+	 * repo_read process to gotsh(1) and into the cache.
+	 */
+	if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, relay) == -1) {
+		err = got_error_from_errno("socketpair");
+		close(pipe[1]);
+		return err;
+	}
+
+	gotd_session.pack_relay_fd = relay[0];
+	gotd_session.pack_relay_outfd = pipe[1];
+	gotd_session.repo_child_packfd = relay[1];
+	event_set(&gotd_session.pack_relay_ev, gotd_session.pack_relay_fd,
+	    EV_READ | EV_PERSIST, relay_pack_data, NULL);
+	if (event_add(&gotd_session.pack_relay_ev, NULL) == -1)
+		return got_error_from_errno("event_add");
+
 	return NULL;
 }
 
@@ -549,6 +950,39 @@ session_dispatch_client(int fd, short events, void *arg)
 				break;
 			client->accept_flush_pkt = 1;
 			break;
+		case GOTD_IMSG_SHALLOW:
+			if (gotd_session.state != GOTD_STATE_EXPECT_WANT ||
+			    client->nwant_ids == 0) {
+				err = got_error_msg(GOT_ERR_BAD_REQUEST,
+				    "unexpected shallow-line received");
+				break;
+			}
+			log_debug("received shallow-line from uid %d",
+			    client->euid);
+			err = forward_shallow(client, &imsg);
+			break;
+		case GOTD_IMSG_DEEPEN:
+			if (gotd_session.state != GOTD_STATE_EXPECT_WANT ||
+			    client->nwant_ids == 0) {
+				err = got_error_msg(GOT_ERR_BAD_REQUEST,
+				    "unexpected deepen-line received");
+				break;
+			}
+			log_debug("received deepen-line from uid %d",
+			    client->euid);
+			err = recv_deepen(client, &imsg);
+			break;
+		case GOTD_IMSG_FILTER:
+			if (gotd_session.state != GOTD_STATE_EXPECT_WANT ||
+			    client->nwant_ids == 0) {
+				err = got_error_msg(GOT_ERR_BAD_REQUEST,
+				    "unexpected filter-line received");
+				break;
+			}
+			log_debug("received filter-line from uid %d",
+			    client->euid);
+			err = forward_filter(client, &imsg);
+			break;
 		case GOTD_IMSG_FLUSH:
 			if (gotd_session.state != GOTD_STATE_EXPECT_WANT &&
 			    gotd_session.state !=
@@ -573,6 +1007,11 @@ session_dispatch_client(int fd, short events, void *arg)
 			log_debug("received flush-pkt from uid %d",
 			    client->euid);
 			if (gotd_session.state == GOTD_STATE_EXPECT_WANT) {
+				if (client->depth > 0) {
+					err = forward_deepen(client);
+					if (err)
+						break;
+				}
 				gotd_session.state =
 				    GOTD_STATE_EXPECT_HAVE_OR_DONE;
 				log_debug("uid %d: expecting have-lines "
@@ -603,6 +1042,10 @@ session_dispatch_client(int fd, short events, void *arg)
 			err = send_packfile(client);
 			break;
 		case GOTD_IMSG_PACKFILE_READY:
+			if (client->pack_cache_hit) {
+				err = send_cached_packfile_ready(client);
+				break;
+			}
 			if (gotd_session.repo_child_packfd == -1) {
 				err = got_error(GOT_ERR_PRIVSEP_MSG);
 				break;
@@ -855,6 +1298,8 @@ session_read_main(const char *title, const char *repo_path,
 	    sizeof(gotd_session.request_timeout));
 	gotd_session.repo_cfg = repo_cfg;
 	gotd_session.repo_child_packfd = -1;
+	gotd_session.pack_relay_fd = -1;
+	gotd_session.pack_relay_outfd = -1;
 
 	if (imsgbuf_init(&gotd_session.notifier_iev.ibuf, -1) == -1) {
 		err = got_error_from_errno("imsgbuf_init");
@@ -894,6 +1339,7 @@ session_read_main(const char *title, const char *repo_path,
 	gotd_session_client.fd = -1;
 	gotd_session_client.nref_updates = -1;
 	gotd_session_client.delta_cache_fd = -1;
+	gotd_session_client.pack_cache_fd = -1;
 	gotd_session_client.accept_flush_pkt = 1;
 
 	if (imsgbuf_init(&gotd_session.parent_iev.ibuf, GOTD_FILENO_MSG_PIPE)
@@ -933,5 +1379,7 @@ session_read_shutdown(void)
 	free(gotd_session_client.username);
 	if (gotd_session.repo_child_packfd != -1)
 		close(gotd_session.repo_child_packfd);
+	close_pack_relay();
+	discard_cached_packfile(&gotd_session_client);
 	exit(0);
 }
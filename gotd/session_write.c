@@ -51,6 +51,7 @@
 
 #include "gotd.h"
 #include "log.h"
+#include "pack_cache.h"
 #include "session_write.h"
 
 struct gotd_session_notif {
@@ -320,6 +321,7 @@ install_pack(struct gotd_session_client *client, const char *repo_path,
 {
 	const struct got_error *err = NULL;
 	struct gotd_imsg_packfile_install inst;
+	struct got_object_id pack_hash;
 	char hex[SHA1_DIGEST_STRING_LENGTH];
 	size_t datalen;
 	char *packfile_path = NULL, *packidx_path = NULL;
@@ -373,6 +375,16 @@ install_pack(struct gotd_session_client *client, const char *repo_path,
 
 	free(client->packidx_path);
 	client->packidx_path = NULL;
+
+	memset(&pack_hash, 0, sizeof(pack_hash));
+	memcpy(pack_hash.hash, inst.pack_sha1, SHA1_DIGEST_LENGTH);
+	pack_hash.algo = GOT_HASH_SHA1;
+	err = got_repo_write_packidx_bloom_filter(gotd_session.repo,
+	    &pack_hash);
+	if (err)
+		goto done;
+	err = got_repo_write_packidx_reverse_index(gotd_session.repo,
+	    &pack_hash);
 done:
 	free(packfile_path);
 	free(packidx_path);
@@ -818,7 +830,14 @@ done:
 	if (client->nref_updates > 0) {
 		client->nref_updates--;
 		if (client->nref_updates == 0) {
+			const struct got_error *cache_err;
+
 			send_refs_updated(client);
+			cache_err = gotd_pack_cache_invalidate(repo_path);
+			if (cache_err) {
+				log_warnx("could not invalidate pack cache: "
+				    "%s", cache_err->msg);
+			}
 			notif = STAILQ_FIRST(&notifications);
 			if (notif) {
 				gotd_session.state = GOTD_STATE_NOTIFY;
@@ -65,6 +65,30 @@ apply_unveil(const char *unix_socket_path)
 	return NULL;
 }
 
+/*
+ * Clients may request a protocol version via the GIT_PROTOCOL environment
+ * variable, which contains a colon-separated list of parameters.
+ */
+static int
+get_protocol_version(void)
+{
+	const char *env, *p;
+	size_t len = strlen(GOT_DIAL_PROTOCOL_V2);
+
+	env = getenv(GOT_DIAL_PROTOCOL_ENV);
+	if (env == NULL)
+		return 0;
+
+	for (p = env; *p != '\0'; p++) {
+		if ((p == env || p[-1] == ':') &&
+		    strncmp(p, GOT_DIAL_PROTOCOL_V2, len) == 0 &&
+		    (p[len] == '\0' || p[len] == ':'))
+			return 2;
+	}
+
+	return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -120,7 +144,7 @@ main(int argc, char *argv[])
 		err(1, "pledge");
 #endif
 	error = got_serve(STDIN_FILENO, STDOUT_FILENO, command, repo_path,
-	    gotd_sock, chattygot);
+	    gotd_sock, get_protocol_version(), chattygot);
 done:
 	free(gitcmd);
 	free(command);
@@ -788,8 +788,16 @@ gotweb_free_transport(struct transport *t)
 			free(t->repos[i]);
 		free(t->repos);
 	}
-	if (t->repo)
+	if (t->repo) {
+		struct got_object_cache_stats stats;
+
+		got_repo_get_object_cache_stats(&stats, t->repo);
+		log_debug("%s: object cache: %d objects, %zu/%zu bytes, "
+		    "%d searches, %d hits, %d misses, %d evicted", __func__,
+		    stats.nelem, stats.size, stats.maxsize, stats.searches,
+		    stats.hits, stats.misses, stats.evicted);
 		got_repo_close(t->repo);
+	}
 	free(t);
 }
 
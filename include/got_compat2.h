@@ -208,6 +208,28 @@ void uuid_to_string(uuid_t *, char **, uint32_t *);
 #include <siphash.h>
 #endif
 
+#ifdef USE_LIBCRYPTO_HASH
+/*
+ * libcrypto picks SHA-1 and SHA-256 code suited to the CPU at run-time.
+ * The low-level digest API is deprecated in OpenSSL 3 in favour of EVP,
+ * which would require heap-allocated hash contexts.
+ */
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+#define SHA1_DIGEST_LENGTH		SHA_DIGEST_LENGTH
+#define SHA1_DIGEST_STRING_LENGTH	(SHA1_DIGEST_LENGTH * 2 + 1)
+
+#define SHA1_CTX	SHA_CTX
+#define SHA1Init	SHA1_Init
+#define SHA1Update	SHA1_Update
+#define SHA1Final	SHA1_Final
+
+#define SHA2_CTX	SHA256_CTX
+#define SHA256Init	SHA256_Init
+#define SHA256Update	SHA256_Update
+#define SHA256Final	SHA256_Final
+#else
 /* Include Apple-specific headers.  Mostly for crypto.*/
 #if defined(__APPLE__)
 #define COMMON_DIGEST_FOR_OPENSSL
@@ -235,6 +257,7 @@ void uuid_to_string(uuid_t *, char **, uint32_t *);
 #    include <sha256.h>
 #endif
 #endif
+#endif /* USE_LIBCRYPTO_HASH */
 
 /* Catch-all for systems where the header files don't exist and/or the below
  * still are not defined.
@@ -190,6 +190,10 @@
 #define GOT_ERR_UNKNOWN_CAPA	173
 #define GOT_ERR_REF_DUP_ENTRY	174
 #define GOT_ERR_DIFF_NOCHANGES	175
+#define GOT_ERR_BAD_COMMIT_GRAPH 176
+#define GOT_ERR_BAD_BITMAP	177
+#define GOT_ERR_BAD_MIDX	178
+#define GOT_ERR_BAD_FILTER	179
 
 struct got_error {
         int code;
@@ -44,9 +44,26 @@ typedef const struct got_error *(*got_fetch_progress_cb)(void *,
  * objects which that are not yet contained in the provided repository.
  * Return the hash of the packfile (in form of an object ID) and lists of
  * references and symbolic references learned from the server.
+ * If depth is non-zero, history is truncated to the given number of commits
+ * and the repository's list of shallow commits is updated accordingly.
+ * If an object filter specification such as "blob:none" is provided, the
+ * server omits objects which do not match the filter and the new pack file
+ * is marked as a promisor pack. This creates a partial clone.
+ * The protocol scheme which was passed to got_fetch_connect() must be
+ * provided as well.
  */
 const struct got_error *got_fetch_pack(struct got_object_id **,
 	struct got_pathlist_head *, struct got_pathlist_head *, const char *,
 	int, int, struct got_pathlist_head *, struct got_pathlist_head *,
-	int, int, int, struct got_repository *, const char *, const char *,
-	int, got_fetch_progress_cb, void *);
+	int, int, int, const char *, struct got_repository *, const char *,
+	const char *,
+	int, int, const char *, got_fetch_progress_cb, void *);
+
+/*
+ * Attempt to fetch a packfile which contains the specified objects.
+ * This is used to obtain objects which are missing from a partial clone.
+ * References are neither listed nor updated.
+ */
+const struct got_error *got_fetch_objects(struct got_object_id **,
+	struct got_object_id *, int, const char *, int, int, const char *,
+	struct got_repository *, got_fetch_progress_cb, void *);
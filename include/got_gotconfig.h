@@ -53,3 +53,13 @@ got_gotconfig_get_revoked_signers_file(const struct got_gotconfig *);
  */
 const char *
 got_gotconfig_get_signer_id(const struct got_gotconfig *);
+
+/*
+ * Obtain the delta window size, maximum delta chain depth, and the memory
+ * budget for deltas used when creating pack files.
+ * Return 0 if no configuration file is found or the setting is not
+ * configured.
+ */
+int got_gotconfig_get_pack_window(const struct got_gotconfig *);
+int got_gotconfig_get_pack_depth(const struct got_gotconfig *);
+size_t got_gotconfig_get_pack_memsize(const struct got_gotconfig *);
@@ -35,6 +35,29 @@ const char *got_repo_get_path_git_dir(struct got_repository *);
 /* Obtain the file descriptor of the repository's .git directory. */
 int got_repo_get_fd(struct got_repository *);
 
+/* Statistics about in-memory object caches of a repository. */
+struct got_object_cache_stats {
+	int nelem;		/* number of cached objects */
+	size_t size;		/* memory used by cached objects, in bytes */
+	size_t maxsize;		/* memory limit, in bytes */
+	int searches;
+	int hits;
+	int misses;
+	int evicted;
+	int toolarge;		/* objects which were too large to cache */
+};
+
+/*
+ * Set the maximum amount of memory, in bytes, which may be used for caching
+ * objects, trees, commits, and tags read from the repository. Least recently
+ * used objects are evicted from the cache to stay within this limit.
+ */
+void got_repo_set_object_cache_size(struct got_repository *, size_t);
+
+/* Obtain statistics about the repository's in-memory object caches. */
+void got_repo_get_object_cache_stats(struct got_object_cache_stats *,
+    struct got_repository *);
+
 /* Obtain the object format */
 enum got_hash_algorithm got_repo_get_object_format(struct got_repository *);
 
@@ -56,6 +79,26 @@ const char *got_repo_get_gitconfig_owner(struct got_repository *);
 /* Query if a given Git extension is enabled in gitconfig. */
 int got_repo_has_extension(struct got_repository *, const char *);
 
+/*
+ * Obtain the name of the remote repository which provides objects missing
+ * from a partial clone, or NULL if the repository is not a partial clone.
+ */
+const char *got_repo_get_promisor_remote(struct got_repository *);
+
+/*
+ * A callback function which attempts to add the specified objects to the
+ * repository, typically by fetching them from the promisor remote.
+ */
+typedef const struct got_error *(*got_repo_fetch_missing_cb)(void *,
+    struct got_repository *, struct got_object_id *, int);
+
+/*
+ * Set a callback which gets invoked when a blob is missing from a
+ * partial clone. Opening the blob is retried once the callback returns.
+ */
+void got_repo_set_fetch_missing_cb(struct got_repository *,
+    got_repo_fetch_missing_cb, void *);
+
 /* Information about one remote repository. */
 struct got_remote_repo {
 	char *name;
@@ -85,6 +128,9 @@ struct got_remote_repo {
 	/* Other arbitrary references to fetch by default. */
 	int nfetch_refs;
 	char **fetch_refs;
+
+	/* Object filter used when fetching from a promisor remote. */
+	char *fetch_filter;
 };
 
 /*
@@ -19,6 +19,26 @@ typedef const struct got_error *(*got_pack_progress_cb)(void *arg,
     int ncolored, int nfound, int ntrees, off_t packfile_size, int ncommits,
     int nobj_total, int obj_deltify, int nobj_written, int pack_done);
 
+/*
+ * Parameters for the search for deltas while creating a pack file.
+ * Larger windows and deeper delta chains result in smaller pack files,
+ * at the cost of more CPU time while packing and, for deep delta chains,
+ * slower reading of objects from the pack file.
+ * Fields which are zero take their value from got.conf(5), if set there,
+ * or use the built-in default.
+ */
+struct got_pack_delta_params {
+	int window;	/* number of delta base candidates tried per object */
+	int depth;	/* maximum length of delta chains */
+	size_t memsize;	/* maximum size of deltas kept in memory, in bytes */
+};
+
+#define GOT_PACK_DELTA_WINDOW_DEFAULT	3
+#define GOT_PACK_DELTA_WINDOW_MAX	256
+#define GOT_PACK_DELTA_DEPTH_DEFAULT	128
+#define GOT_PACK_DELTA_DEPTH_MAX	256
+#define GOT_PACK_DELTA_MEMSIZE_DEFAULT	(32 * 1024 * 1024)
+
 /*
  * Attempt to pack objects reachable via 'include_refs' into a new packfile.
  * If 'excluded_refs' is not an empty list, do not pack any objects
@@ -26,6 +46,8 @@ typedef const struct got_error *(*got_pack_progress_cb)(void *arg,
  * If loose_obj_only is zero, pack reachable objects even if they are
  * already packed in another packfile. Otherwise, add only loose
  * objects to the new pack file.
+ * If delta_params is not NULL, it overrides the delta search parameters
+ * configured in got.conf(5).
  * Return an open file handle for the generated pack file.
  * Return the hash digest of the resulting pack file in pack_hash which
  * must freed by the caller when done.
@@ -35,6 +57,7 @@ got_repo_pack_objects(FILE **packfile, struct got_object_id **pack_hash,
     struct got_reflist_head *include_refs,
     struct got_reflist_head *exclude_refs, struct got_repository *repo,
     int loose_obj_only, int force_refdelta,
+    const struct got_pack_delta_params *delta_params,
     got_pack_progress_cb progress_cb, void *progress_arg,
     got_cancel_cb cancel_cb, void *cancel_arg);
 
@@ -51,16 +74,20 @@ typedef const struct got_error *(*got_pack_index_progress_cb)(void *arg,
     off_t packfile_size, int nobj_total, int nobj_indexed,
     int nobj_loose, int nobj_resolved, int indexing_done);
 
-/* (Re-)Index the pack file identified by the given hash. */
+/*
+ * (Re-)Index the pack file identified by the given hash.
+ * Deltas are resolved with the given number of threads, or with one thread
+ * per online CPU if nthreads is zero.
+ */
 const struct got_error *
 got_repo_index_pack(char **idxpath, FILE *packfile,
-    struct got_object_id *pack_hash, struct got_repository *repo,
+    struct got_object_id *pack_hash, struct got_repository *repo, int nthreads,
     got_pack_index_progress_cb progress_cb, void *progress_arg,
     got_cancel_cb cancel_cb, void *cancel_arg);
 
 typedef const struct got_error *(*got_pack_list_cb)(void *arg,
     struct got_object_id *id, int type, off_t offset, off_t size,
-    off_t base_offset, struct got_object_id *base_id);
+    off_t packed_size, off_t base_offset, struct got_object_id *base_id);
 
 /* List the pack file identified by the given hash. */
 const struct got_error *
@@ -96,6 +123,36 @@ got_repo_cleanup(struct got_repository *repo,
     got_pack_index_progress_cb index_progress_cb, void *index_progress_arg,
     got_cancel_cb cancel_cb, void *cancel_arg);
 
+/*
+ * Write a commit-graph file which covers all commits reachable via
+ * references. The commit-graph file allows history traversal without
+ * reading commit objects.
+ */
+const struct got_error *
+got_repo_write_commit_graph(struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg);
+
+/*
+ * Write a reachability bitmap file for the pack file with the given hash.
+ * The pack file must contain all objects reachable from the given
+ * references. The bitmap file allows the set of objects to be sent to
+ * a client to be computed without traversing history.
+ */
+const struct got_error *
+got_repo_write_pack_bitmap(struct got_repository *repo,
+    struct got_object_id *pack_hash, struct got_reflist_head *refs,
+    got_cancel_cb cancel_cb, void *cancel_arg);
+
+/*
+ * Write a multi-pack-index file which covers all pack files in the
+ * repository, or remove this file if the repository has no pack files.
+ * The multi-pack-index file allows packed objects to be found without
+ * searching every pack index file.
+ */
+const struct got_error *
+got_repo_write_multi_pack_index(struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg);
+
 /* A callback function which gets invoked with cleanup information to print. */
 typedef const struct got_error *(*got_lonely_packidx_progress_cb)(void *arg,
     const char *path);
@@ -15,4 +15,5 @@
  */
 
 const struct got_error *got_serve(int infd, int outfd, const char *command,
-    const char *repo_path, int gotd_sock, int chattygot);
+    const char *repo_path, int gotd_sock, int protocol_version,
+    int chattygot);
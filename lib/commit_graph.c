@@ -35,9 +35,14 @@
 
 #include "got_lib_delta.h"
 #include "got_lib_inflate.h"
+#include "got_lib_hash.h"
 #include "got_lib_object.h"
 #include "got_lib_object_idset.h"
 #include "got_lib_object_qid.h"
+#include "got_lib_object_cache.h"
+#include "got_lib_pack.h"
+#include "got_lib_repository.h"
+#include "got_lib_commit_graph_file.h"
 
 #ifndef nitems
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
@@ -97,6 +102,14 @@ struct got_commit_graph {
 	/* Path of tree entry of interest to the API user. */
 	char *path;
 
+	/*
+	 * IDs of commits not traversed yet which are known to contain the
+	 * path because a child commit did not change the path. Changed-path
+	 * bloom filters can only be trusted for such commits since history
+	 * traversal must stop where the path does not exist.
+	 */
+	struct got_object_idset *path_ids;
+
 	/*
 	 * Nodes which will be passed to the API user next, sorted by
 	 * commit timestamp. Sorted in topological order only if topological
@@ -105,15 +118,53 @@ struct got_commit_graph {
 	struct got_commit_graph_iter_list iter_list;
 };
 
+/*
+ * Open a commit for the purpose of history traversal.
+ * If the repository has a commit-graph file which contains the commit
+ * then return a partial commit object read from the commit-graph file.
+ * This avoids inflating and parsing the commit object.
+ */
 static const struct got_error *
-detect_changed_path(int *changed, struct got_commit_object *commit,
-    struct got_object_id *commit_id, const char *path,
+open_commit(struct got_commit_object **commit, struct got_object_id *id,
     struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_commit_graph_file *cg;
+	uint32_t pos;
+
+	err = got_repo_get_commit_graph_file(&cg, repo);
+	if (err)
+		return err;
+
+	if (cg && got_commit_graph_file_lookup(&pos, cg, id)) {
+		err = got_commit_graph_file_get_commit(commit, cg, pos);
+		if (err)
+			return err;
+		/*
+		 * Commits listed in the commit-graph file are usually packed.
+		 * If not, got_traverse_packed_commits() will not find this
+		 * commit in a pack file and we will fall back to regular
+		 * traversal.
+		 */
+		(*commit)->flags |= GOT_COMMIT_FLAG_PACKED;
+		return NULL;
+	}
+
+	return got_object_open_as_commit(commit, repo, id);
+}
+
+static const struct got_error *
+detect_changed_path(int *changed, struct got_commit_graph *graph,
+    struct got_commit_object *commit, struct got_object_id *commit_id,
+    const char *path, struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
 	struct got_commit_object *pcommit = NULL;
 	struct got_tree_object *tree = NULL, *ptree = NULL;
 	struct got_object_qid *pid;
+	struct got_commit_graph_file *cg;
+	uint32_t pos;
+	int shallow;
 
 	if (got_path_is_root_dir(path)) {
 		*changed = 1;
@@ -122,7 +173,32 @@ detect_changed_path(int *changed, struct got_commit_object *commit,
 
 	*changed = 0;
 
-	pid = STAILQ_FIRST(&commit->parent_ids);
+	/* The parents of a shallow commit are not in the repository. */
+	err = got_repo_is_shallow_commit(&shallow, repo, commit_id);
+	if (err)
+		return err;
+	pid = shallow ? NULL : STAILQ_FIRST(&commit->parent_ids);
+
+	if (got_object_idset_contains(graph->path_ids, commit_id)) {
+		err = got_object_idset_remove(NULL, graph->path_ids,
+		    commit_id);
+		if (err)
+			return err;
+
+		/* Avoid comparing trees if a bloom filter rules out changes. */
+		err = got_repo_get_commit_graph_file(&cg, repo);
+		if (err)
+			return err;
+		if (cg && got_commit_graph_file_lookup(&pos, cg, commit_id) &&
+		    !got_commit_graph_file_path_maybe_changed(cg, pos, path)) {
+			if (pid == NULL || got_object_idset_contains(
+			    graph->path_ids, &pid->id))
+				return NULL;
+			return got_object_idset_add(graph->path_ids,
+			    &pid->id, NULL);
+		}
+	}
+
 	if (pid == NULL) {
 		struct got_object_id *obj_id;
 		err = got_object_id_by_path(&obj_id, repo, commit, path);
@@ -139,7 +215,7 @@ detect_changed_path(int *changed, struct got_commit_object *commit,
 	if (err)
 		return err;
 
-	err = got_object_open_as_commit(&pcommit, repo, &pid->id);
+	err = open_commit(&pcommit, &pid->id, repo);
 	if (err)
 		goto done;
 
@@ -148,6 +224,9 @@ detect_changed_path(int *changed, struct got_commit_object *commit,
 		goto done;
 
 	err = got_object_tree_path_changed(changed, tree, ptree, path, repo);
+	if (err == NULL && !*changed &&
+	    !got_object_idset_contains(graph->path_ids, &pid->id))
+		err = got_object_idset_add(graph->path_ids, &pid->id, NULL);
 done:
 	if (tree)
 		got_object_tree_close(tree);
@@ -268,11 +347,18 @@ advance_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
 	const struct got_error *err;
 	struct got_object_qid *qid;
 	struct got_object_id *merged_id = NULL;
+	struct got_object_idset *shallow;
 
 	err = close_branch(graph, commit_id);
 	if (err)
 		return err;
 
+	err = got_repo_get_shallow_commits(&shallow, repo);
+	if (err)
+		return err;
+	if (shallow && got_object_idset_contains(shallow, commit_id))
+		return NULL;
+
 	if (graph->flags & GOT_COMMIT_GRAPH_FIRST_PARENT_TRAVERSAL) {
 		qid = STAILQ_FIRST(&commit->parent_ids);
 		if (qid == NULL ||
@@ -287,7 +373,8 @@ advance_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
 		 * only fetch their IDs. This speeds up 'got blame'.
 		 */
 		if (!got_path_is_root_dir(graph->path) &&
-		    (commit->flags & GOT_COMMIT_FLAG_PACKED)) {
+		    (commit->flags & GOT_COMMIT_FLAG_PACKED) &&
+		    shallow == NULL) {
 			int ncommits = 0;
 			err = packed_first_parent_traversal(&ncommits,
 			    graph, &qid->id, repo);
@@ -322,8 +409,7 @@ advance_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
 			    &qid->id))
 				continue;
 
-			err = got_object_open_as_commit(&pcommit, repo,
-			    &qid->id);
+			err = open_commit(&pcommit, &qid->id, repo);
 			if (err) {
 				free(merged_id);
 				free(prev_id);
@@ -432,6 +518,12 @@ got_commit_graph_open(struct got_commit_graph **graph,
 		goto done;
 	}
 
+	(*graph)->path_ids = got_object_idset_alloc();
+	if ((*graph)->path_ids == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+
 	if (first_parent_traversal)
 		(*graph)->flags |= GOT_COMMIT_GRAPH_FIRST_PARENT_TRAVERSAL;
 done:
@@ -457,7 +549,7 @@ add_branch_tip(struct got_object_id *commit_id, void *data, void *arg)
 	struct got_commit_graph_node *new_node;
 	struct got_commit_object *commit;
 
-	err = got_object_open_as_commit(&commit, a->repo, commit_id);
+	err = open_commit(&commit, commit_id, a->repo);
 	if (err)
 		return err;
 
@@ -522,8 +614,8 @@ fetch_commits_from_open_branches(struct got_commit_graph *graph,
 		commit = arg.tips[i].commit;
 		new_node = arg.tips[i].new_node;
 
-		err = detect_changed_path(&changed, commit, commit_id,
-		    graph->path, repo);
+		err = detect_changed_path(&changed, graph, commit,
+		    commit_id, graph->path, repo);
 		if (err) {
 			if (err->code != GOT_ERR_NO_OBJ)
 				break;
@@ -568,6 +660,8 @@ got_commit_graph_close(struct got_commit_graph *graph)
 		got_object_idset_free(graph->open_branches);
 	if (graph->node_ids)
 		got_object_idset_free(graph->node_ids);
+	if (graph->path_ids)
+		got_object_idset_free(graph->path_ids);
 	free(graph->tips);
 	free(graph->path);
 	free(graph);
@@ -694,6 +788,325 @@ find_yca_add_id(struct got_object_id **yca_id, struct got_commit_graph *graph,
 	return got_object_idset_add(commit_ids, &id, NULL);
 }
 
+/*
+ * A commit which is queued during a youngest common ancestor search
+ * based on generation numbers.
+ */
+struct yca_entry {
+	struct got_object_id id;
+	uint32_t pos;		/* position in commit-graph file */
+#define YCA_POS_NONE	0xffffffff
+	uint32_t generation;
+	time_t timestamp;
+};
+
+struct yca_search {
+	struct got_commit_graph_file *cg;
+
+	/*
+	 * Per-commit flags, indexed by commit-graph position. Commits
+	 * which are not listed in the commit-graph file have their flags
+	 * stored in the extra set instead.
+	 */
+	uint8_t *flags;
+#define YCA_PARENT1	0x01	/* reachable from first commit */
+#define YCA_PARENT2	0x02	/* reachable from second commit */
+#define YCA_QUEUED	0x04
+	struct got_object_idset *extra;
+
+	/*
+	 * Commits yet to be visited, stored as a binary heap ordered by
+	 * generation number and commit timestamp. Only the frontier of
+	 * the search is kept here.
+	 */
+	struct yca_entry *queue;
+	size_t nqueued;
+	size_t queue_size;
+};
+
+static int
+yca_entry_cmp(struct yca_entry *e1, struct yca_entry *e2)
+{
+	if (e1->generation != e2->generation)
+		return e1->generation < e2->generation ? -1 : 1;
+	if (e1->timestamp != e2->timestamp)
+		return e1->timestamp < e2->timestamp ? -1 : 1;
+	return 0;
+}
+
+static const struct got_error *
+yca_push(struct yca_search *s, struct yca_entry *e)
+{
+	struct yca_entry tmp;
+	size_t i, parent;
+
+	if (s->nqueued == s->queue_size) {
+		struct yca_entry *new;
+		size_t new_size = s->queue_size ? s->queue_size * 2 : 64;
+
+		new = reallocarray(s->queue, new_size, sizeof(*new));
+		if (new == NULL)
+			return got_error_from_errno("reallocarray");
+		s->queue = new;
+		s->queue_size = new_size;
+	}
+
+	i = s->nqueued++;
+	memcpy(&s->queue[i], e, sizeof(s->queue[i]));
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (yca_entry_cmp(&s->queue[parent], &s->queue[i]) >= 0)
+			break;
+		memcpy(&tmp, &s->queue[parent], sizeof(tmp));
+		memcpy(&s->queue[parent], &s->queue[i], sizeof(tmp));
+		memcpy(&s->queue[i], &tmp, sizeof(tmp));
+		i = parent;
+	}
+
+	return NULL;
+}
+
+static void
+yca_pop(struct yca_entry *e, struct yca_search *s)
+{
+	struct yca_entry tmp;
+	size_t i, child;
+
+	memcpy(e, &s->queue[0], sizeof(*e));
+	if (--s->nqueued == 0)
+		return;
+
+	memcpy(&s->queue[0], &s->queue[s->nqueued], sizeof(s->queue[0]));
+	i = 0;
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= s->nqueued)
+			break;
+		if (child + 1 < s->nqueued &&
+		    yca_entry_cmp(&s->queue[child + 1], &s->queue[child]) > 0)
+			child++;
+		if (yca_entry_cmp(&s->queue[i], &s->queue[child]) >= 0)
+			break;
+		memcpy(&tmp, &s->queue[child], sizeof(tmp));
+		memcpy(&s->queue[child], &s->queue[i], sizeof(tmp));
+		memcpy(&s->queue[i], &tmp, sizeof(tmp));
+		i = child;
+	}
+}
+
+static const struct got_error *
+yca_get_flags(uint8_t **flags, struct yca_search *s, struct got_object_id *id,
+    uint32_t pos)
+{
+	const struct got_error *err;
+
+	if (pos != YCA_POS_NONE) {
+		*flags = &s->flags[pos];
+		return NULL;
+	}
+
+	*flags = got_object_idset_get(s->extra, id);
+	if (*flags)
+		return NULL;
+
+	*flags = calloc(1, sizeof(**flags));
+	if (*flags == NULL)
+		return got_error_from_errno("calloc");
+	err = got_object_idset_add(s->extra, id, *flags);
+	if (err) {
+		free(*flags);
+		*flags = NULL;
+	}
+	return err;
+}
+
+static const struct got_error *
+free_yca_flags(struct got_object_id *id, void *data, void *arg)
+{
+	free(data);
+	return NULL;
+}
+
+/*
+ * Mark a commit as reachable from one or both commits of interest and
+ * queue it for traversal unless it has already been queued.
+ */
+static const struct got_error *
+yca_add_commit(struct yca_search *s, struct got_object_id *id, uint32_t pos,
+    uint8_t new_flags, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_commit_object *commit;
+	struct yca_entry e;
+	uint8_t *flags;
+
+	err = yca_get_flags(&flags, s, id, pos);
+	if (err)
+		return err;
+
+	/* Only traverse this commit again if it becomes reachable anew. */
+	if ((*flags & new_flags) == new_flags)
+		return NULL;
+	*flags |= new_flags;
+	if (*flags & YCA_QUEUED)
+		return NULL;
+
+	memcpy(&e.id, id, sizeof(e.id));
+	e.pos = pos;
+	if (pos != YCA_POS_NONE) {
+		e.generation = got_commit_graph_file_get_generation(s->cg,
+		    pos);
+		e.timestamp = got_commit_graph_file_get_committer_time(s->cg,
+		    pos);
+	} else {
+		err = got_object_open_as_commit(&commit, repo, id);
+		if (err)
+			return err;
+		e.generation = GOT_COMMIT_GRAPH_GENERATION_INFINITY;
+		e.timestamp = got_object_commit_get_committer_time(commit);
+		got_object_commit_close(commit);
+	}
+
+	*flags |= YCA_QUEUED;
+	return yca_push(s, &e);
+}
+
+static uint32_t
+yca_lookup(struct got_commit_graph_file *cg, struct got_object_id *id)
+{
+	uint32_t pos;
+
+	if (got_commit_graph_file_lookup(&pos, cg, id))
+		return pos;
+	return YCA_POS_NONE;
+}
+
+/*
+ * Find the youngest common ancestor with the help of generation numbers
+ * stored in the commit-graph file.
+ *
+ * Commits are visited in order of decreasing generation number, such that
+ * all descendants of a commit are visited before the commit itself. The
+ * first commit found to be reachable from both commits of interest is
+ * therefore a common ancestor which is not an ancestor of any other common
+ * ancestor. Ancestors of this commit are never visited.
+ *
+ * Commits missing from the commit-graph file are assigned an infinite
+ * generation number and are visited in order of commit timestamps.
+ */
+static const struct got_error *
+find_yca_by_generation(struct got_object_id **yca_id,
+    struct got_object_id *commit_id, struct got_object_id *commit_id2,
+    int first_parent_traversal, struct got_commit_graph_file *cg,
+    struct got_repository *repo, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_commit_object *commit = NULL;
+	const struct got_object_id_queue *parent_ids;
+	struct got_object_qid *pid;
+	struct got_object_id id;
+	struct yca_search s;
+	struct yca_entry e;
+	uint32_t *parents = NULL;
+	uint8_t *flags, pflags;
+	int i, nparents, shallow;
+
+	*yca_id = NULL;
+
+	memset(&s, 0, sizeof(s));
+	s.cg = cg;
+	s.flags = calloc(cg->ncommits, sizeof(*s.flags));
+	if (s.flags == NULL)
+		return got_error_from_errno("calloc");
+	s.extra = got_object_idset_alloc();
+	if (s.extra == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+
+	err = yca_add_commit(&s, commit_id, yca_lookup(cg, commit_id),
+	    YCA_PARENT1, repo);
+	if (err)
+		goto done;
+	err = yca_add_commit(&s, commit_id2, yca_lookup(cg, commit_id2),
+	    YCA_PARENT2, repo);
+	if (err)
+		goto done;
+
+	while (s.nqueued > 0) {
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		yca_pop(&e, &s);
+		err = yca_get_flags(&flags, &s, &e.id, e.pos);
+		if (err)
+			goto done;
+		*flags &= ~YCA_QUEUED;
+
+		pflags = *flags & (YCA_PARENT1 | YCA_PARENT2);
+		if (pflags == (YCA_PARENT1 | YCA_PARENT2)) {
+			*yca_id = got_object_id_dup(&e.id);
+			if (*yca_id == NULL)
+				err = got_error_from_errno("got_object_id_dup");
+			goto done;
+		}
+
+		err = got_repo_is_shallow_commit(&shallow, repo, &e.id);
+		if (err)
+			goto done;
+		if (shallow)
+			continue;
+
+		if (e.pos != YCA_POS_NONE) {
+			err = got_commit_graph_file_get_parents(&parents,
+			    &nparents, cg, e.pos);
+			if (err)
+				goto done;
+			for (i = 0; i < nparents; i++) {
+				got_commit_graph_file_get_id(&id, cg,
+				    parents[i]);
+				err = yca_add_commit(&s, &id, parents[i],
+				    pflags, repo);
+				if (err || first_parent_traversal)
+					break;
+			}
+			free(parents);
+			parents = NULL;
+			if (err)
+				goto done;
+		} else {
+			err = got_object_open_as_commit(&commit, repo, &e.id);
+			if (err)
+				goto done;
+			parent_ids = got_object_commit_get_parent_ids(commit);
+			STAILQ_FOREACH(pid, parent_ids, entry) {
+				err = yca_add_commit(&s, &pid->id,
+				    yca_lookup(cg, &pid->id), pflags, repo);
+				if (err || first_parent_traversal)
+					break;
+			}
+			got_object_commit_close(commit);
+			commit = NULL;
+			if (err)
+				goto done;
+		}
+	}
+
+	err = got_error(GOT_ERR_ANCESTRY);
+done:
+	if (s.extra) {
+		got_object_idset_for_each(s.extra, free_yca_flags, NULL);
+		got_object_idset_free(s.extra);
+	}
+	free(s.flags);
+	free(s.queue);
+	free(parents);
+	return err;
+}
+
 /*
  * Sets *yca_id to the youngest common ancestor of commit_id and
  * commit_id2. Returns got_error(GOT_ERR_ANCESTRY) if they have no
@@ -702,6 +1115,10 @@ find_yca_add_id(struct got_object_id **yca_id, struct got_commit_graph *graph,
  * If first_parent_traversal is nonzero, only linear history is considered.
  * If toposort is set then sort commits in topological order before
  * traversing them.
+ *
+ * If the repository has a commit-graph file with generation numbers then
+ * commits are always traversed in topological order, and only commits
+ * which are younger than the youngest common ancestor will be traversed.
  */
 const struct got_error *
 got_commit_graph_find_youngest_common_ancestor(struct got_object_id **yca_id,
@@ -713,9 +1130,21 @@ got_commit_graph_find_youngest_common_ancestor(struct got_object_id **yca_id,
 	struct got_commit_graph *graph = NULL, *graph2 = NULL;
 	int completed = 0, completed2 = 0;
 	struct got_object_idset *commit_ids;
+	struct got_commit_graph_file *cg;
 
 	*yca_id = NULL;
 
+	err = got_repo_get_commit_graph_file(&cg, repo);
+	if (err)
+		return err;
+
+	/* Files written by old versions of Git lack generation numbers. */
+	if (cg && cg->ncommits > 0 && got_commit_graph_file_get_generation(cg,
+	    0) != GOT_COMMIT_GRAPH_GENERATION_ZERO) {
+		return find_yca_by_generation(yca_id, commit_id, commit_id2,
+		    first_parent_traversal, cg, repo, cancel_cb, cancel_arg);
+	}
+
 	commit_ids = got_object_idset_alloc();
 	if (commit_ids == NULL)
 		return got_error_from_errno("got_object_idset_alloc");
@@ -830,7 +1259,7 @@ got_commit_graph_toposort(struct got_commit_graph *graph,
 	struct got_object_id_queue commits;
 	const struct got_object_id_queue *parent_ids;
 	struct got_object_qid *qid = NULL, *pid;
-	int i;
+	int i, shallow;
 
 	STAILQ_INIT(&commits);
 
@@ -870,7 +1299,10 @@ got_commit_graph_toposort(struct got_commit_graph *graph,
 
 		qid = STAILQ_FIRST(&commits);
 		STAILQ_REMOVE_HEAD(&commits, entry);
-		err = got_object_open_as_commit(&commit, repo, &qid->id);
+		err = open_commit(&commit, &qid->id, repo);
+		if (err)
+			break;
+		err = got_repo_is_shallow_commit(&shallow, repo, &qid->id);
 		if (err)
 			break;
 
@@ -889,7 +1321,8 @@ got_commit_graph_toposort(struct got_commit_graph *graph,
 			continue;
 
 		if (node->nparents == -1) {
-			node->nparents = got_object_commit_get_nparents(commit);
+			node->nparents = shallow ? 0 :
+			    got_object_commit_get_nparents(commit);
 			if (node->nparents > nitems(node->parents)) {
 				node->more_parents = calloc(node->nparents,
 				    sizeof(*node->more_parents));
@@ -902,6 +1335,11 @@ got_commit_graph_toposort(struct got_commit_graph *graph,
 		}
 
 		node->timestamp = got_object_commit_get_committer_time(commit);
+		if (shallow) {
+			got_object_commit_close(commit);
+			commit = NULL;
+			continue;
+		}
 		parent_ids = got_object_commit_get_parent_ids(commit);
 		i = 0;
 		STAILQ_FOREACH(pid, parent_ids, entry) {
@@ -0,0 +1,1074 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <sys/tree.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "got_compat.h"
+
+#include "got_error.h"
+#include "got_object.h"
+#include "got_path.h"
+
+#include "got_lib_delta.h"
+#include "got_lib_hash.h"
+#include "got_lib_object.h"
+#include "got_lib_object_qid.h"
+#include "got_lib_object_parse.h"
+#include "got_lib_commit_graph_file.h"
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+
+static uint32_t
+get_be32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be32toh(val);
+}
+
+static uint64_t
+get_be64(const uint8_t *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be64toh(val);
+}
+
+static const struct got_error *
+read_commit_graph(uint8_t **buf, int fd, size_t len)
+{
+	ssize_t r;
+	size_t off = 0;
+
+	*buf = malloc(len);
+	if (*buf == NULL)
+		return got_error_from_errno("malloc");
+
+	if (lseek(fd, 0, SEEK_SET) == -1) {
+		free(*buf);
+		*buf = NULL;
+		return got_error_from_errno("lseek");
+	}
+
+	while (off < len) {
+		r = read(fd, *buf + off, len - off);
+		if (r == -1) {
+			free(*buf);
+			*buf = NULL;
+			return got_error_from_errno("read");
+		}
+		if (r == 0) {
+			free(*buf);
+			*buf = NULL;
+			return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+		}
+		off += r;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+parse_chunks(struct got_commit_graph_file *cg)
+{
+	size_t digest_len = got_hash_digest_length(cg->algo);
+	uint8_t hash_version, nchunks;
+	uint64_t oidl_size = 0, cdat_size = 0, edge_size = 0;
+	uint64_t bidx_size = 0, bdat_size = 0;
+	uint8_t *p, *bdat = NULL;
+	int i;
+
+	if (cg->len < GOT_COMMIT_GRAPH_HDR_SIZE + digest_len)
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+
+	p = cg->map;
+	if (get_be32(p) != GOT_COMMIT_GRAPH_SIGNATURE)
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+	if (p[4] != GOT_COMMIT_GRAPH_VERSION)
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+
+	hash_version = p[5];
+	switch (cg->algo) {
+	case GOT_HASH_SHA1:
+		if (hash_version != GOT_COMMIT_GRAPH_HASH_SHA1)
+			return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+		break;
+	case GOT_HASH_SHA256:
+		if (hash_version != GOT_COMMIT_GRAPH_HASH_SHA256)
+			return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+		break;
+	default:
+		return got_error(GOT_ERR_OBJECT_FORMAT);
+	}
+
+	nchunks = p[6];
+
+	/* We do not support split commit-graph chains. */
+	if (p[7] != 0)
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+
+	if (cg->len < GOT_COMMIT_GRAPH_HDR_SIZE +
+	    (nchunks + 1) * GOT_COMMIT_GRAPH_CHUNK_ENTRY_SIZE + digest_len)
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+
+	p = cg->map + GOT_COMMIT_GRAPH_HDR_SIZE;
+	for (i = 0; i < nchunks; i++) {
+		uint32_t chunk_id = get_be32(p);
+		uint64_t offset = get_be64(p + 4);
+		uint64_t next_offset;
+		uint64_t size;
+
+		p += GOT_COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+		next_offset = get_be64(p + 4);
+		if (offset > next_offset || next_offset > cg->len - digest_len)
+			return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+		size = next_offset - offset;
+
+		switch (chunk_id) {
+		case GOT_COMMIT_GRAPH_CHUNK_OIDF:
+			if (size != 256 * sizeof(uint32_t))
+				return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+			cg->fanout = (uint32_t *)(cg->map + offset);
+			break;
+		case GOT_COMMIT_GRAPH_CHUNK_OIDL:
+			cg->oids = cg->map + offset;
+			oidl_size = size;
+			break;
+		case GOT_COMMIT_GRAPH_CHUNK_CDAT:
+			cg->cdat = cg->map + offset;
+			cdat_size = size;
+			break;
+		case GOT_COMMIT_GRAPH_CHUNK_EDGE:
+			cg->edges = (uint32_t *)(cg->map + offset);
+			edge_size = size;
+			break;
+		case GOT_COMMIT_GRAPH_CHUNK_BIDX:
+			cg->bloom_idx = (uint32_t *)(cg->map + offset);
+			bidx_size = size;
+			break;
+		case GOT_COMMIT_GRAPH_CHUNK_BDAT:
+			bdat = cg->map + offset;
+			bdat_size = size;
+			break;
+		default:
+			/* Ignore chunks we do not know about. */
+			break;
+		}
+	}
+
+	if (cg->fanout == NULL || cg->oids == NULL || cg->cdat == NULL)
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+
+	for (i = 1; i < 256; i++) {
+		if (get_be32((uint8_t *)&cg->fanout[i]) <
+		    get_be32((uint8_t *)&cg->fanout[i - 1]))
+			return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+	}
+
+	cg->ncommits = get_be32((uint8_t *)&cg->fanout[0xff]);
+	if (oidl_size != (uint64_t)cg->ncommits * digest_len ||
+	    cdat_size != (uint64_t)cg->ncommits *
+	    (digest_len + GOT_COMMIT_GRAPH_CDAT_SIZE))
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+
+	if (edge_size % sizeof(uint32_t))
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+	cg->nedges = edge_size / sizeof(uint32_t);
+
+	/*
+	 * Bloom filters are optional. Ignore them unless both chunks
+	 * are present and look sane, and unless we know the hash version.
+	 */
+	if (cg->bloom_idx && bdat &&
+	    bidx_size == (uint64_t)cg->ncommits * sizeof(uint32_t) &&
+	    bdat_size >= GOT_COMMIT_GRAPH_BLOOM_HDR_SIZE) {
+		cg->bloom_version = get_be32(bdat);
+		cg->bloom_nhashes = get_be32(bdat + 4);
+		cg->bloom_bits_per_entry = get_be32(bdat + 8);
+		cg->bloom_data = bdat + GOT_COMMIT_GRAPH_BLOOM_HDR_SIZE;
+		cg->bloom_data_len = bdat_size - GOT_COMMIT_GRAPH_BLOOM_HDR_SIZE;
+		if ((cg->bloom_version != 1 && cg->bloom_version != 2) ||
+		    cg->bloom_nhashes == 0 || cg->bloom_nhashes > 32) {
+			cg->bloom_idx = NULL;
+			cg->bloom_data = NULL;
+			cg->bloom_data_len = 0;
+		}
+	} else
+		cg->bloom_idx = NULL;
+
+	return NULL;
+}
+
+const struct got_error *
+got_commit_graph_file_open(struct got_commit_graph_file **cgp, int fd,
+    enum got_hash_algorithm algo)
+{
+	const struct got_error *err = NULL;
+	struct got_commit_graph_file *cg;
+	struct got_hash ctx;
+	struct stat sb;
+	uint8_t csum[GOT_HASH_DIGEST_MAXLEN];
+	size_t digest_len = got_hash_digest_length(algo);
+
+	*cgp = NULL;
+
+	cg = calloc(1, sizeof(*cg));
+	if (cg == NULL) {
+		err = got_error_from_errno("calloc");
+		close(fd);
+		return err;
+	}
+	cg->fd = fd;
+	cg->algo = algo;
+
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno("fstat");
+		goto done;
+	}
+	if (sb.st_size <= 0 || (uintmax_t)sb.st_size > SIZE_MAX) {
+		err = got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+		goto done;
+	}
+	cg->len = sb.st_size;
+
+#ifndef GOT_PACK_NO_MMAP
+	cg->map = mmap(NULL, cg->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (cg->map == MAP_FAILED) {
+		if (errno != ENOMEM) {
+			cg->map = NULL;
+			err = got_error_from_errno("mmap");
+			goto done;
+		}
+		cg->map = NULL; /* fall back to read(2) */
+	} else
+		cg->mapped = 1;
+#endif
+	if (cg->map == NULL) {
+		err = read_commit_graph(&cg->map, fd, cg->len);
+		if (err)
+			goto done;
+	}
+
+	err = parse_chunks(cg);
+	if (err)
+		goto done;
+
+	/*
+	 * History traversal trusts parent and generation data from this
+	 * file. Reject it unless its trailing checksum matches.
+	 */
+	got_hash_init(&ctx, algo);
+	got_hash_update(&ctx, cg->map, cg->len - digest_len);
+	got_hash_final(&ctx, csum);
+	if (memcmp(cg->map + cg->len - digest_len, csum, digest_len) != 0)
+		err = got_error_msg(GOT_ERR_BAD_COMMIT_GRAPH,
+		    "commit-graph file checksum mismatch");
+done:
+	if (err)
+		got_commit_graph_file_close(cg);
+	else
+		*cgp = cg;
+	return err;
+}
+
+const struct got_error *
+got_commit_graph_file_close(struct got_commit_graph_file *cg)
+{
+	const struct got_error *err = NULL;
+
+	if (cg->map) {
+		if (cg->mapped) {
+			if (munmap(cg->map, cg->len) == -1)
+				err = got_error_from_errno("munmap");
+		} else
+			free(cg->map);
+	}
+	if (cg->fd != -1 && close(cg->fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	free(cg);
+	return err;
+}
+
+int
+got_commit_graph_file_lookup(uint32_t *pos, struct got_commit_graph_file *cg,
+    struct got_object_id *id)
+{
+	size_t digest_len = got_hash_digest_length(cg->algo);
+	uint8_t id0 = id->hash[0];
+	int64_t left = 0, right, i;
+	int cmp;
+
+	if (id->algo != cg->algo)
+		return 0;
+
+	right = (int64_t)get_be32((uint8_t *)&cg->fanout[id0]) - 1;
+	if (id0 > 0)
+		left = get_be32((uint8_t *)&cg->fanout[id0 - 1]);
+
+	while (left <= right) {
+		i = left + (right - left) / 2;
+		cmp = memcmp(cg->oids + i * digest_len, id->hash, digest_len);
+		if (cmp == 0) {
+			*pos = i;
+			return 1;
+		}
+		if (cmp < 0)
+			left = i + 1;
+		else
+			right = i - 1;
+	}
+
+	return 0;
+}
+
+void
+got_commit_graph_file_get_id(struct got_object_id *id,
+    struct got_commit_graph_file *cg, uint32_t pos)
+{
+	size_t digest_len = got_hash_digest_length(cg->algo);
+
+	memset(id, 0, sizeof(*id));
+	id->algo = cg->algo;
+	memcpy(id->hash, cg->oids + pos * digest_len, digest_len);
+}
+
+static uint8_t *
+get_cdat(struct got_commit_graph_file *cg, uint32_t pos)
+{
+	size_t digest_len = got_hash_digest_length(cg->algo);
+
+	return cg->cdat + (size_t)pos * (digest_len + GOT_COMMIT_GRAPH_CDAT_SIZE);
+}
+
+uint32_t
+got_commit_graph_file_get_generation(struct got_commit_graph_file *cg,
+    uint32_t pos)
+{
+	size_t digest_len = got_hash_digest_length(cg->algo);
+	uint8_t *cdat = get_cdat(cg, pos);
+
+	return get_be32(cdat + digest_len + 8) >> 2;
+}
+
+time_t
+got_commit_graph_file_get_committer_time(struct got_commit_graph_file *cg,
+    uint32_t pos)
+{
+	size_t digest_len = got_hash_digest_length(cg->algo);
+	uint8_t *cdat = get_cdat(cg, pos);
+	uint64_t t;
+
+	t = ((uint64_t)(get_be32(cdat + digest_len + 8) & 0x3) << 32) |
+	    get_be32(cdat + digest_len + 12);
+	return (time_t)t;
+}
+
+const struct got_error *
+got_commit_graph_file_get_parents(uint32_t **parents, int *nparents,
+    struct got_commit_graph_file *cg, uint32_t pos)
+{
+	size_t digest_len = got_hash_digest_length(cg->algo);
+	uint8_t *cdat = get_cdat(cg, pos);
+	uint32_t p1, p2, edge;
+	size_t i, n;
+
+	*parents = NULL;
+	*nparents = 0;
+
+	p1 = get_be32(cdat + digest_len);
+	p2 = get_be32(cdat + digest_len + 4);
+
+	if (p1 == GOT_COMMIT_GRAPH_PARENT_NONE)
+		return NULL;
+	if (p1 >= cg->ncommits)
+		return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+
+	if (p2 == GOT_COMMIT_GRAPH_PARENT_NONE) {
+		*parents = malloc(sizeof(**parents));
+		if (*parents == NULL)
+			return got_error_from_errno("malloc");
+		(*parents)[0] = p1;
+		*nparents = 1;
+		return NULL;
+	}
+
+	if ((p2 & GOT_COMMIT_GRAPH_PARENT_OCTOPUS) == 0) {
+		if (p2 >= cg->ncommits)
+			return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+		*parents = calloc(2, sizeof(**parents));
+		if (*parents == NULL)
+			return got_error_from_errno("calloc");
+		(*parents)[0] = p1;
+		(*parents)[1] = p2;
+		*nparents = 2;
+		return NULL;
+	}
+
+	/* Octopus merge; additional parents are stored in the EDGE chunk. */
+	i = p2 & GOT_COMMIT_GRAPH_PARENT_POS_MASK;
+	n = 0;
+	do {
+		if (cg->edges == NULL || i + n >= cg->nedges)
+			return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+		edge = get_be32((uint8_t *)&cg->edges[i + n]);
+		n++;
+	} while ((edge & GOT_COMMIT_GRAPH_PARENT_LAST) == 0);
+
+	*parents = calloc(n + 1, sizeof(**parents));
+	if (*parents == NULL)
+		return got_error_from_errno("calloc");
+	(*parents)[0] = p1;
+	for (n = 0; ; n++) {
+		edge = get_be32((uint8_t *)&cg->edges[i + n]);
+		if ((edge & GOT_COMMIT_GRAPH_PARENT_POS_MASK) >= cg->ncommits) {
+			free(*parents);
+			*parents = NULL;
+			return got_error(GOT_ERR_BAD_COMMIT_GRAPH);
+		}
+		(*parents)[n + 1] = edge & GOT_COMMIT_GRAPH_PARENT_POS_MASK;
+		if (edge & GOT_COMMIT_GRAPH_PARENT_LAST)
+			break;
+	}
+	*nparents = n + 2;
+	return NULL;
+}
+
+const struct got_error *
+got_commit_graph_file_get_commit(struct got_commit_object **commit,
+    struct got_commit_graph_file *cg, uint32_t pos)
+{
+	const struct got_error *err = NULL;
+	size_t digest_len = got_hash_digest_length(cg->algo);
+	uint32_t *parents = NULL;
+	int i, nparents;
+
+	*commit = got_object_commit_alloc_partial();
+	if (*commit == NULL)
+		return got_error_from_errno("got_object_commit_alloc_partial");
+
+	memset((*commit)->tree_id, 0, sizeof(*(*commit)->tree_id));
+	(*commit)->tree_id->algo = cg->algo;
+	memcpy((*commit)->tree_id->hash, get_cdat(cg, pos), digest_len);
+	(*commit)->committer_time =
+	    got_commit_graph_file_get_committer_time(cg, pos);
+	(*commit)->author_time = (*commit)->committer_time;
+	(*commit)->flags |= GOT_COMMIT_FLAG_PARTIAL;
+
+	err = got_commit_graph_file_get_parents(&parents, &nparents, cg, pos);
+	if (err)
+		goto done;
+
+	for (i = 0; i < nparents; i++) {
+		struct got_object_qid *qid;
+
+		err = got_object_qid_alloc_partial(&qid);
+		if (err)
+			goto done;
+		got_commit_graph_file_get_id(&qid->id, cg, parents[i]);
+		STAILQ_INSERT_TAIL(&(*commit)->parent_ids, qid, entry);
+		(*commit)->nparents++;
+	}
+done:
+	free(parents);
+	if (err) {
+		got_object_commit_close(*commit);
+		*commit = NULL;
+	}
+	return err;
+}
+
+static uint32_t
+rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+/*
+ * The 32-bit variant of MurmurHash3, as used by Git's changed-path bloom
+ * filters. Version 1 filters were computed with path bytes sign-extended
+ * to int, as a result of a bug in Git which must be reproduced here.
+ */
+static uint32_t
+murmur3_32(uint32_t seed, const char *data, size_t len, int version)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	uint32_t h = seed, k;
+	uint32_t b[4];
+	size_t i, j;
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		for (j = 0; j < 4; j++) {
+			if (version == 1)
+				b[j] = (uint32_t)(int)(signed char)data[i + j];
+			else
+				b[j] = (uint8_t)data[i + j];
+		}
+		k = b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+		h = rotl32(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	for (j = 0; j < len - i; j++) {
+		if (version == 1)
+			b[j] = (uint32_t)(int)(signed char)data[i + j];
+		else
+			b[j] = (uint8_t)data[i + j];
+	}
+	k = 0;
+	switch (len - i) {
+	case 3:
+		k ^= b[2] << 16;
+		/* FALLTHROUGH */
+	case 2:
+		k ^= b[1] << 8;
+		/* FALLTHROUGH */
+	case 1:
+		k ^= b[0];
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+	}
+
+	h ^= len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+ * Map a path to its bloom filter bits and either set these bits or
+ * check whether they are all set. Return 1 if all bits were set.
+ */
+static int
+bloom_filter_key(uint8_t *filter, size_t len, const char *path,
+    size_t pathlen, uint32_t nhashes, int version, int add)
+{
+	uint32_t h0, h1, bit, i;
+	uint64_t nbits = (uint64_t)len * 8;
+	int found = 1;
+
+	h0 = murmur3_32(0x293ae76f, path, pathlen, version);
+	h1 = murmur3_32(0x7e646e2c, path, pathlen, version);
+
+	for (i = 0; i < nhashes; i++) {
+		bit = (h0 + i * h1) % nbits;
+		if (add)
+			filter[bit / 8] |= 1 << (bit % 8);
+		else if ((filter[bit / 8] & (1 << (bit % 8))) == 0) {
+			found = 0;
+			break;
+		}
+	}
+
+	return found;
+}
+
+static int
+get_bloom_filter(uint8_t **filter, size_t *len,
+    struct got_commit_graph_file *cg, uint32_t pos)
+{
+	uint32_t start = 0, end;
+
+	*filter = NULL;
+	*len = 0;
+
+	if (cg->bloom_idx == NULL || pos >= cg->ncommits)
+		return 0;
+
+	if (pos > 0)
+		start = get_be32((uint8_t *)&cg->bloom_idx[pos - 1]);
+	end = get_be32((uint8_t *)&cg->bloom_idx[pos]);
+	if (start >= end || end > cg->bloom_data_len)
+		return 0; /* no filter was computed for this commit */
+
+	*filter = cg->bloom_data + start;
+	*len = end - start;
+	return 1;
+}
+
+int
+got_commit_graph_file_path_maybe_changed(struct got_commit_graph_file *cg,
+    uint32_t pos, const char *path)
+{
+	uint8_t *filter;
+	size_t len, pathlen;
+
+	if (!get_bloom_filter(&filter, &len, cg, pos))
+		return 1;
+
+	while (path[0] == '/')
+		path++;
+	pathlen = strlen(path);
+	while (pathlen > 0 && path[pathlen - 1] == '/')
+		pathlen--;
+	if (pathlen == 0)
+		return 1;
+
+	/*
+	 * Leading directories of changed paths are in the filter as well.
+	 * Checking them reduces the probability of false positives.
+	 */
+	for (;;) {
+		if (!bloom_filter_key(filter, len, path, pathlen,
+		    cg->bloom_nhashes, cg->bloom_version, 0))
+			return 0;
+		while (pathlen > 0 && path[pathlen - 1] != '/')
+			pathlen--;
+		if (pathlen <= 1)
+			break;
+		pathlen--; /* strip trailing slash */
+	}
+
+	return 1;
+}
+
+int
+got_commit_graph_file_get_bloom_filter(const uint8_t **filter, size_t *len,
+    struct got_commit_graph_file *cg, uint32_t pos)
+{
+	uint8_t *f;
+
+	*filter = NULL;
+	*len = 0;
+
+	if (cg->bloom_version != GOT_COMMIT_GRAPH_BLOOM_VERSION ||
+	    cg->bloom_nhashes != GOT_COMMIT_GRAPH_BLOOM_NHASHES ||
+	    cg->bloom_bits_per_entry != GOT_COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY)
+		return 0;
+
+	if (!get_bloom_filter(&f, len, cg, pos))
+		return 0;
+
+	*filter = f;
+	return 1;
+}
+
+const struct got_error *
+got_commit_graph_file_create_bloom_filter(uint8_t **filter, size_t *len,
+    struct got_pathlist_head *paths)
+{
+	struct got_pathlist_entry *pe;
+	size_t npaths = 0;
+
+	*filter = NULL;
+	*len = 0;
+
+	if (paths == NULL) {
+		*filter = malloc(1);
+		if (*filter == NULL)
+			return got_error_from_errno("malloc");
+		(*filter)[0] = 0xff;
+		*len = 1;
+		return NULL;
+	}
+
+	RB_FOREACH(pe, got_pathlist_head, paths)
+		npaths++;
+
+	*len = (npaths * GOT_COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY + 7) / 8;
+	if (*len == 0)
+		*len = 1;
+	*filter = calloc(*len, 1);
+	if (*filter == NULL) {
+		*len = 0;
+		return got_error_from_errno("calloc");
+	}
+
+	RB_FOREACH(pe, got_pathlist_head, paths) {
+		bloom_filter_key(*filter, *len, pe->path, pe->path_len,
+		    GOT_COMMIT_GRAPH_BLOOM_NHASHES,
+		    GOT_COMMIT_GRAPH_BLOOM_VERSION, 1);
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+hwrite(int fd, const void *buf, size_t len, struct got_hash *ctx)
+{
+	ssize_t w;
+
+	got_hash_update(ctx, buf, len);
+
+	w = write(fd, buf, len);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if (w != len)
+		return got_error(GOT_ERR_IO);
+
+	return NULL;
+}
+
+static const struct got_error *
+hwrite_be32(int fd, uint32_t val, struct got_hash *ctx)
+{
+	val = htobe32(val);
+	return hwrite(fd, &val, sizeof(val), ctx);
+}
+
+static const struct got_error *
+hwrite_be64(int fd, uint64_t val, struct got_hash *ctx)
+{
+	val = htobe64(val);
+	return hwrite(fd, &val, sizeof(val), ctx);
+}
+
+static int
+entry_cmp(const void *pa, const void *pb)
+{
+	const struct got_commit_graph_file_entry *a = pa, *b = pb;
+
+	return got_object_id_cmp(&a->id, &b->id);
+}
+
+static int
+lookup_entry(uint32_t *pos, struct got_commit_graph_file_entry *entries,
+    size_t nentries, struct got_object_id *id)
+{
+	struct got_commit_graph_file_entry key, *e;
+
+	memcpy(&key.id, id, sizeof(key.id));
+	e = bsearch(&key, entries, nentries, sizeof(entries[0]), entry_cmp);
+	if (e == NULL)
+		return 0;
+
+	*pos = e - entries;
+	return 1;
+}
+
+/*
+ * Compute generation numbers of all commits. Use an explicit stack instead
+ * of recursion since histories can be arbitrarily deep.
+ */
+static const struct got_error *
+compute_generations(struct got_commit_graph_file_entry *entries,
+    size_t nentries)
+{
+	const struct got_error *err = NULL;
+	uint32_t *stack = NULL, pos;
+	size_t i, nstack = 0, nalloc = 0;
+	int j;
+
+	for (i = 0; i < nentries; i++)
+		entries[i].generation = 0;
+
+	for (i = 0; i < nentries; i++) {
+		if (entries[i].generation != 0)
+			continue;
+
+		if (nstack >= nalloc) {
+			uint32_t *new;
+			size_t newalloc = nalloc ? nalloc * 2 : 1024;
+
+			new = reallocarray(stack, newalloc, sizeof(*stack));
+			if (new == NULL) {
+				err = got_error_from_errno("reallocarray");
+				goto done;
+			}
+			stack = new;
+			nalloc = newalloc;
+		}
+		stack[nstack++] = i;
+
+		while (nstack > 0) {
+			struct got_commit_graph_file_entry *e;
+			uint32_t max_gen = 0;
+			int pending = 0;
+
+			e = &entries[stack[nstack - 1]];
+			if (e->generation != 0) {
+				nstack--;
+				continue;
+			}
+
+			for (j = 0; j < e->nparents; j++) {
+				struct got_commit_graph_file_entry *pe;
+
+				if (!lookup_entry(&pos, entries, nentries,
+				    &e->parent_ids[j])) {
+					err = got_error_no_obj(
+					    &e->parent_ids[j]);
+					goto done;
+				}
+				pe = &entries[pos];
+				if (pe->generation == 0) {
+					if (nstack >= nalloc) {
+						uint32_t *new;
+						size_t newalloc = nalloc * 2;
+
+						new = reallocarray(stack,
+						    newalloc, sizeof(*stack));
+						if (new == NULL) {
+							err = got_error_from_errno(
+							    "reallocarray");
+							goto done;
+						}
+						stack = new;
+						nalloc = newalloc;
+					}
+					stack[nstack++] = pos;
+					pending = 1;
+				} else if (pe->generation > max_gen)
+					max_gen = pe->generation;
+			}
+
+			if (pending)
+				continue;
+
+			if (max_gen >= GOT_COMMIT_GRAPH_GENERATION_MAX)
+				e->generation = GOT_COMMIT_GRAPH_GENERATION_MAX;
+			else
+				e->generation = max_gen + 1;
+			nstack--;
+		}
+	}
+done:
+	free(stack);
+	return err;
+}
+
+const struct got_error *
+got_commit_graph_file_write(int fd, struct got_commit_graph_file_entry *entries,
+    size_t nentries, enum got_hash_algorithm algo)
+{
+	const struct got_error *err;
+	struct got_hash ctx;
+	uint8_t hdr[GOT_COMMIT_GRAPH_HDR_SIZE];
+	uint8_t digest[GOT_HASH_DIGEST_MAXLEN];
+	size_t digest_len = got_hash_digest_length(algo);
+	uint32_t chunk_ids[6], fanout[256], pos, nedges = 0, edge_idx;
+	uint64_t chunk_sizes[6], offset, bloom_size = 0;
+	size_t i;
+	int j, nchunks, have_bloom = 1;
+
+	if (nentries >= GOT_COMMIT_GRAPH_PARENT_NONE)
+		return got_error(GOT_ERR_NO_SPACE);
+
+	qsort(entries, nentries, sizeof(entries[0]), entry_cmp);
+
+	err = compute_generations(entries, nentries);
+	if (err)
+		return err;
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < nentries; i++) {
+		fanout[entries[i].id.hash[0]]++;
+		if (entries[i].nparents > 2)
+			nedges += entries[i].nparents - 1;
+		if (entries[i].bloom == NULL)
+			have_bloom = 0;
+		bloom_size += entries[i].bloom_len;
+	}
+	if (bloom_size > UINT32_MAX)
+		have_bloom = 0;
+	for (i = 1; i < nitems(fanout); i++)
+		fanout[i] += fanout[i - 1];
+
+	nchunks = 0;
+	chunk_ids[nchunks] = GOT_COMMIT_GRAPH_CHUNK_OIDF;
+	chunk_sizes[nchunks++] = sizeof(fanout);
+	chunk_ids[nchunks] = GOT_COMMIT_GRAPH_CHUNK_OIDL;
+	chunk_sizes[nchunks++] = (uint64_t)nentries * digest_len;
+	chunk_ids[nchunks] = GOT_COMMIT_GRAPH_CHUNK_CDAT;
+	chunk_sizes[nchunks++] = (uint64_t)nentries *
+	    (digest_len + GOT_COMMIT_GRAPH_CDAT_SIZE);
+	if (nedges > 0) {
+		chunk_ids[nchunks] = GOT_COMMIT_GRAPH_CHUNK_EDGE;
+		chunk_sizes[nchunks++] = (uint64_t)nedges * sizeof(uint32_t);
+	}
+	if (have_bloom && nentries > 0) {
+		chunk_ids[nchunks] = GOT_COMMIT_GRAPH_CHUNK_BIDX;
+		chunk_sizes[nchunks++] = (uint64_t)nentries * sizeof(uint32_t);
+		chunk_ids[nchunks] = GOT_COMMIT_GRAPH_CHUNK_BDAT;
+		chunk_sizes[nchunks++] = GOT_COMMIT_GRAPH_BLOOM_HDR_SIZE +
+		    bloom_size;
+	} else
+		have_bloom = 0;
+
+	got_hash_init(&ctx, algo);
+
+	hdr[0] = 'C';
+	hdr[1] = 'G';
+	hdr[2] = 'P';
+	hdr[3] = 'H';
+	hdr[4] = GOT_COMMIT_GRAPH_VERSION;
+	hdr[5] = (algo == GOT_HASH_SHA256) ? GOT_COMMIT_GRAPH_HASH_SHA256 :
+	    GOT_COMMIT_GRAPH_HASH_SHA1;
+	hdr[6] = nchunks;
+	hdr[7] = 0; /* no base graphs */
+	err = hwrite(fd, hdr, sizeof(hdr), &ctx);
+	if (err)
+		return err;
+
+	/* Chunk table of contents, terminated by a zero ID. */
+	offset = GOT_COMMIT_GRAPH_HDR_SIZE +
+	    (nchunks + 1) * GOT_COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+	for (j = 0; j < nchunks; j++) {
+		err = hwrite_be32(fd, chunk_ids[j], &ctx);
+		if (err)
+			return err;
+		err = hwrite_be64(fd, offset, &ctx);
+		if (err)
+			return err;
+		offset += chunk_sizes[j];
+	}
+	err = hwrite_be32(fd, 0, &ctx);
+	if (err)
+		return err;
+	err = hwrite_be64(fd, offset, &ctx);
+	if (err)
+		return err;
+
+	/* OIDF */
+	for (i = 0; i < nitems(fanout); i++) {
+		err = hwrite_be32(fd, fanout[i], &ctx);
+		if (err)
+			return err;
+	}
+
+	/* OIDL */
+	for (i = 0; i < nentries; i++) {
+		err = hwrite(fd, entries[i].id.hash, digest_len, &ctx);
+		if (err)
+			return err;
+	}
+
+	/* CDAT */
+	edge_idx = 0;
+	for (i = 0; i < nentries; i++) {
+		struct got_commit_graph_file_entry *e = &entries[i];
+		uint32_t p1 = GOT_COMMIT_GRAPH_PARENT_NONE;
+		uint32_t p2 = GOT_COMMIT_GRAPH_PARENT_NONE;
+		uint64_t t;
+
+		err = hwrite(fd, e->tree_id.hash, digest_len, &ctx);
+		if (err)
+			return err;
+
+		if (e->nparents > 0) {
+			if (!lookup_entry(&p1, entries, nentries,
+			    &e->parent_ids[0]))
+				return got_error_no_obj(&e->parent_ids[0]);
+		}
+		if (e->nparents == 2) {
+			if (!lookup_entry(&p2, entries, nentries,
+			    &e->parent_ids[1]))
+				return got_error_no_obj(&e->parent_ids[1]);
+		} else if (e->nparents > 2) {
+			p2 = GOT_COMMIT_GRAPH_PARENT_OCTOPUS | edge_idx;
+			edge_idx += e->nparents - 1;
+		}
+		err = hwrite_be32(fd, p1, &ctx);
+		if (err)
+			return err;
+		err = hwrite_be32(fd, p2, &ctx);
+		if (err)
+			return err;
+
+		if (e->committer_time < 0)
+			t = 0;
+		else if (e->committer_time > GOT_COMMIT_GRAPH_TIME_MAX)
+			t = GOT_COMMIT_GRAPH_TIME_MAX;
+		else
+			t = e->committer_time;
+		err = hwrite_be32(fd, (e->generation << 2) | (t >> 32), &ctx);
+		if (err)
+			return err;
+		err = hwrite_be32(fd, t & 0xffffffff, &ctx);
+		if (err)
+			return err;
+	}
+
+	/* EDGE */
+	for (i = 0; nedges > 0 && i < nentries; i++) {
+		struct got_commit_graph_file_entry *e = &entries[i];
+
+		if (e->nparents <= 2)
+			continue;
+
+		for (j = 1; j < e->nparents; j++) {
+			if (!lookup_entry(&pos, entries, nentries,
+			    &e->parent_ids[j]))
+				return got_error_no_obj(&e->parent_ids[j]);
+			if (j == e->nparents - 1)
+				pos |= GOT_COMMIT_GRAPH_PARENT_LAST;
+			err = hwrite_be32(fd, pos, &ctx);
+			if (err)
+				return err;
+		}
+	}
+
+	if (have_bloom) {
+		uint32_t bloom_offset = 0;
+
+		/* BIDX */
+		for (i = 0; i < nentries; i++) {
+			bloom_offset += entries[i].bloom_len;
+			err = hwrite_be32(fd, bloom_offset, &ctx);
+			if (err)
+				return err;
+		}
+
+		/* BDAT */
+		err = hwrite_be32(fd, GOT_COMMIT_GRAPH_BLOOM_VERSION, &ctx);
+		if (err)
+			return err;
+		err = hwrite_be32(fd, GOT_COMMIT_GRAPH_BLOOM_NHASHES, &ctx);
+		if (err)
+			return err;
+		err = hwrite_be32(fd, GOT_COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY,
+		    &ctx);
+		if (err)
+			return err;
+		for (i = 0; i < nentries; i++) {
+			err = hwrite(fd, entries[i].bloom, entries[i].bloom_len,
+			    &ctx);
+			if (err)
+				return err;
+		}
+	}
+
+	got_hash_final(&ctx, digest);
+	if (write(fd, digest, digest_len) != digest_len)
+		return got_error_from_errno("write");
+
+	return NULL;
+}
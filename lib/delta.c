@@ -275,6 +275,10 @@ got_delta_apply_in_mem(uint8_t *base_buf, size_t base_bufsz,
 	if (err)
 		return err;
 
+	/* Copy instructions must not exceed the declared result size. */
+	if (result_size < maxoutsize)
+		maxoutsize = result_size;
+
 	/* Decode and execute copy instructions from the delta stream. */
 	err = next_delta_byte(&p, &remain);
 	while (err == NULL && remain > 0) {
@@ -286,6 +290,7 @@ got_delta_apply_in_mem(uint8_t *base_buf, size_t base_bufsz,
 				break;
 			if (SIZE_MAX - offset < len || offset + len < 0 ||
 			    base_bufsz < offset + len ||
+			    SIZE_MAX - *outsize < len ||
 			    *outsize + len > maxoutsize)
 				return got_error_msg(GOT_ERR_BAD_DELTA,
 				    "bad delta copy length");
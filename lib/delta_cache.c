@@ -35,18 +35,18 @@
 #include "got_lib_object.h"
 #include "got_lib_delta_cache.h"
 
-#ifndef nitems
-#define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
-#endif
-
 #define GOT_DELTA_CACHE_MIN_BUCKETS		64
-#define GOT_DELTA_CACHE_MAX_BUCKETS		2048
-#define GOT_DELTA_CACHE_MAX_CHAIN		2
-#define GOT_DELTA_CACHE_MAX_DELTA_SIZE		1024
-#define GOT_DELTA_CACHE_MAX_FULLTEXT_SIZE	524288
 
+/*
+ * Single deltas or fulltexts larger than this fraction of the total cache
+ * size are not cached. This prevents a single large object from flushing
+ * all other entries out of the cache.
+ */
+#define GOT_DELTA_CACHE_MAX_ENTRY_DIVISOR	8
 
 struct got_cached_delta {
+	LIST_ENTRY(got_cached_delta) hash_entry;
+	TAILQ_ENTRY(got_cached_delta) lru_entry;
 	off_t offset;
 	uint8_t *data;
 	size_t len;
@@ -54,15 +54,17 @@ struct got_cached_delta {
 	size_t fulltext_len;
 };
 
-struct got_delta_cache_head {
-	struct got_cached_delta entries[GOT_DELTA_CACHE_MAX_CHAIN];
-	unsigned int nchain;
-};
+LIST_HEAD(got_delta_cache_head, got_cached_delta);
+TAILQ_HEAD(got_delta_cache_lru, got_cached_delta);
 
 struct got_delta_cache {
 	struct got_delta_cache_head *buckets;
 	unsigned int nbuckets;
 	unsigned int totelem;
+	struct got_delta_cache_lru lru;
+	size_t size;
+	size_t maxsize;
+	size_t max_entry_size;
 	int cache_search;
 	int cache_hit;
 	int cache_hit_fulltext;
@@ -78,10 +80,11 @@ struct got_delta_cache {
 };
 
 const struct got_error *
-got_delta_cache_alloc(struct got_delta_cache **new)
+got_delta_cache_alloc(struct got_delta_cache **new, size_t maxsize)
 {
 	const struct got_error *err;
 	struct got_delta_cache *cache;
+	unsigned int i;
 
 	*new = NULL;
 
@@ -97,6 +100,11 @@ got_delta_cache_alloc(struct got_delta_cache **new)
 		return err;
 	}
 	cache->nbuckets = GOT_DELTA_CACHE_MIN_BUCKETS;
+	for (i = 0; i < cache->nbuckets; i++)
+		LIST_INIT(&cache->buckets[i]);
+	TAILQ_INIT(&cache->lru);
+	cache->maxsize = maxsize;
+	cache->max_entry_size = maxsize / GOT_DELTA_CACHE_MAX_ENTRY_DIVISOR;
 
 	arc4random_buf(&cache->key, sizeof(cache->key));
 	*new = cache;
@@ -107,27 +115,24 @@ void
 got_delta_cache_free(struct got_delta_cache *cache)
 {
 	struct got_cached_delta *delta;
-	unsigned int i;
 
 #ifdef GOT_DELTA_CACHE_DEBUG
-	fprintf(stderr, "%s: delta cache: %u elements, %d searches, %d hits, "
+	fprintf(stderr, "%s: delta cache: %u elements, %zu bytes, "
+	    "%d searches, %d hits, "
 	    "%d fulltext hits, %d missed, %d evicted, %d too large (max %d), "
 	    "%d too large fulltext (max %d)\n",
-	    getprogname(), cache->totelem, cache->cache_search,
+	    getprogname(), cache->totelem, cache->size, cache->cache_search,
 	    cache->cache_hit, cache->cache_hit_fulltext,
 	    cache->cache_miss, cache->cache_evict, cache->cache_toolarge,
 	    cache->cache_maxtoolarge,
 	    cache->cache_toolarge_fulltext,
 	    cache->cache_maxtoolarge_fulltext);
 #endif
-	for (i = 0; i < cache->nbuckets; i++) {
-		struct got_delta_cache_head *head;
-		int j;
-		head = &cache->buckets[i];
-		for (j = 0; j < head->nchain; j++) {
-			delta = &head->entries[j];
-			free(delta->data);
-		}
+	while ((delta = TAILQ_FIRST(&cache->lru)) != NULL) {
+		TAILQ_REMOVE(&cache->lru, delta, lru_entry);
+		free(delta->data);
+		free(delta->fulltext);
+		free(delta);
 	}
 	free(cache->buckets);
 	free(cache);
@@ -139,12 +144,30 @@ delta_cache_hash(struct got_delta_cache *cache, off_t delta_offset)
 	return SipHash24(&cache->key, &delta_offset, sizeof(delta_offset));
 }
 
+static struct got_cached_delta *
+delta_cache_lookup(struct got_delta_cache *cache, off_t delta_data_offset)
+{
+	struct got_delta_cache_head *head;
+	struct got_cached_delta *delta;
+	uint64_t idx;
+
+	idx = delta_cache_hash(cache, delta_data_offset) % cache->nbuckets;
+	head = &cache->buckets[idx];
+	LIST_FOREACH(delta, head, hash_entry) {
+		if (delta->offset == delta_data_offset)
+			return delta;
+	}
+
+	return NULL;
+}
+
 #ifndef GOT_NO_DELTA_CACHE
 static const struct got_error *
 delta_cache_resize(struct got_delta_cache *cache, unsigned int nbuckets)
 {
 	struct got_delta_cache_head *buckets;
-	size_t i;
+	struct got_cached_delta *delta;
+	unsigned int i;
 
 	buckets = calloc(nbuckets, sizeof(buckets[0]));
 	if (buckets == NULL) {
@@ -154,28 +177,16 @@ delta_cache_resize(struct got_delta_cache *cache, unsigned int nbuckets)
 		cache->flags |= GOT_DELTA_CACHE_F_NOMEM;
 		return NULL;
 	}
+	for (i = 0; i < nbuckets; i++)
+		LIST_INIT(&buckets[i]);
 
 	arc4random_buf(&cache->key, sizeof(cache->key));
 
-	for (i = 0; i < cache->nbuckets; i++) {
-		unsigned int j;
-		for (j = 0; j < cache->buckets[i].nchain; j++) {
-			struct got_delta_cache_head *head;
-			struct got_cached_delta *delta;
-			uint64_t idx;
-			delta = &cache->buckets[i].entries[j];
-			idx = delta_cache_hash(cache, delta->offset) % nbuckets;
-			head = &buckets[idx];
-			if (head->nchain < nitems(head->entries)) {
-				struct got_cached_delta *new_delta;
-				new_delta = &head->entries[head->nchain];
-				memcpy(new_delta, delta, sizeof(*new_delta));
-				head->nchain++;
-			} else {
-				free(delta->data);
-				cache->totelem--;
-			}
-		}
+	TAILQ_FOREACH(delta, &cache->lru, lru_entry) {
+		uint64_t idx;
+
+		idx = delta_cache_hash(cache, delta->offset) % nbuckets;
+		LIST_INSERT_HEAD(&buckets[idx], delta, hash_entry);
 	}
 
 	free(cache->buckets);
@@ -187,18 +198,73 @@ delta_cache_resize(struct got_delta_cache *cache, unsigned int nbuckets)
 static const struct got_error *
 delta_cache_grow(struct got_delta_cache *cache)
 {
-	unsigned int nbuckets;
-
 	if ((cache->flags & GOT_DELTA_CACHE_F_NOMEM) ||
-	    cache->nbuckets == GOT_DELTA_CACHE_MAX_BUCKETS)
+	    cache->nbuckets > UINT_MAX / 2)
 		return NULL;
 
-	if (cache->nbuckets >= GOT_DELTA_CACHE_MAX_BUCKETS / 2)
-		nbuckets = GOT_DELTA_CACHE_MAX_BUCKETS;
-	else
-		nbuckets = cache->nbuckets * 2;
+	return delta_cache_resize(cache, cache->nbuckets * 2);
+}
+
+static size_t
+delta_cache_entry_size(struct got_cached_delta *delta)
+{
+	return sizeof(*delta) + delta->len + delta->fulltext_len;
+}
+
+/*
+ * Evict least recently used entries until the cache fits within its
+ * size limit again. The entry which was most recently used is never
+ * evicted since callers may still be holding pointers to its data.
+ */
+static void
+delta_cache_evict(struct got_delta_cache *cache)
+{
+	struct got_cached_delta *delta;
+
+	while (cache->size > cache->maxsize) {
+		delta = TAILQ_LAST(&cache->lru, got_delta_cache_lru);
+		if (delta == NULL || delta == TAILQ_FIRST(&cache->lru))
+			break;
+		TAILQ_REMOVE(&cache->lru, delta, lru_entry);
+		LIST_REMOVE(delta, hash_entry);
+		cache->size -= delta_cache_entry_size(delta);
+		free(delta->data);
+		free(delta->fulltext);
+		free(delta);
+		cache->totelem--;
+		cache->cache_evict++;
+	}
+}
+
+static const struct got_error *
+delta_cache_insert(struct got_cached_delta **new,
+    struct got_delta_cache *cache, off_t delta_data_offset)
+{
+	const struct got_error *err;
+	struct got_cached_delta *delta;
+	uint64_t idx;
+
+	*new = NULL;
+
+	if (cache->nbuckets * 3 < cache->totelem * 4) {
+		err = delta_cache_grow(cache);
+		if (err)
+			return err;
+	}
+
+	delta = calloc(1, sizeof(*delta));
+	if (delta == NULL)
+		return got_error_from_errno("calloc");
+	delta->offset = delta_data_offset;
 
-	return delta_cache_resize(cache, nbuckets);
+	idx = delta_cache_hash(cache, delta_data_offset) % cache->nbuckets;
+	LIST_INSERT_HEAD(&cache->buckets[idx], delta, hash_entry);
+	TAILQ_INSERT_HEAD(&cache->lru, delta, lru_entry);
+	cache->size += sizeof(*delta);
+	cache->totelem++;
+
+	*new = delta;
+	return NULL;
 }
 #endif
 
@@ -211,43 +277,30 @@ got_delta_cache_add(struct got_delta_cache *cache,
 #else
 	const struct got_error *err = NULL;
 	struct got_cached_delta *delta;
-	struct got_delta_cache_head *head;
-	uint64_t idx;
 
-	if (delta_len > GOT_DELTA_CACHE_MAX_DELTA_SIZE) {
+	if (delta_len > cache->max_entry_size) {
 		cache->cache_toolarge++;
 		if (delta_len > cache->cache_maxtoolarge)
 			cache->cache_maxtoolarge = delta_len;
 		return got_error(GOT_ERR_NO_SPACE);
 	}
 
-	if (cache->nbuckets * 3 < cache->totelem * 4) {
-		err = delta_cache_grow(cache);
+	delta = delta_cache_lookup(cache, delta_data_offset);
+	if (delta) {
+		if (delta->data)
+			return got_error(GOT_ERR_NO_SPACE);
+		TAILQ_REMOVE(&cache->lru, delta, lru_entry);
+		TAILQ_INSERT_HEAD(&cache->lru, delta, lru_entry);
+	} else {
+		err = delta_cache_insert(&delta, cache, delta_data_offset);
 		if (err)
 			return err;
 	}
 
-	idx = delta_cache_hash(cache, delta_data_offset) % cache->nbuckets;
-	head = &cache->buckets[idx];
-	if (head->nchain >= nitems(head->entries)) {
-		delta = &head->entries[head->nchain - 1];
-		free(delta->data);
-		free(delta->fulltext);
-		memset(delta, 0, sizeof(*delta));
-		head->nchain--;
-		cache->totelem--;
-		cache->cache_evict++;
-	}
-
-	delta = &head->entries[head->nchain];
-	delta->offset = delta_data_offset;
 	delta->data = delta_data;
 	delta->len = delta_len;
-	delta->fulltext = NULL;
-	delta->fulltext_len = 0;
-	head->nchain++;
-	cache->totelem++;
-
+	cache->size += delta_len;
+	delta_cache_evict(cache);
 	return NULL;
 #endif
 }
@@ -259,43 +312,42 @@ got_delta_cache_add_fulltext(struct got_delta_cache *cache,
 #ifdef GOT_NO_DELTA_CACHE
 	return got_error(GOT_ERR_NO_SPACE);
 #else
+	const struct got_error *err = NULL;
 	struct got_cached_delta *delta;
-	struct got_delta_cache_head *head;
-	uint64_t idx;
-	int i;
+	uint8_t *p;
 
-	if (fulltext_len > GOT_DELTA_CACHE_MAX_FULLTEXT_SIZE) {
+	if (fulltext_len > cache->max_entry_size) {
 		cache->cache_toolarge_fulltext++;
-		if (fulltext_len > cache->cache_maxtoolarge)
+		if (fulltext_len > cache->cache_maxtoolarge_fulltext)
 			cache->cache_maxtoolarge_fulltext = fulltext_len;
 		return got_error(GOT_ERR_NO_SPACE);
 	}
 
-	idx = delta_cache_hash(cache, delta_data_offset) % cache->nbuckets;
-	head = &cache->buckets[idx];
+	p = malloc(fulltext_len);
+	if (p == NULL)
+		return got_error_from_errno("malloc");
+	memcpy(p, fulltext, fulltext_len);
 
-	for (i = 0; i < head->nchain; i++) {
-		delta = &head->entries[i];
-		if (delta->offset != delta_data_offset)
-			continue;
-		if (i > 0) {
-			struct got_cached_delta tmp;
-
-			memcpy(&tmp, &head->entries[0], sizeof(tmp));
-			memcpy(&head->entries[0], &head->entries[i],
-			    sizeof(head->entries[0]));
-			memcpy(&head->entries[i], &tmp,
-			    sizeof(head->entries[i]));
-			delta = &head->entries[0];
+	delta = delta_cache_lookup(cache, delta_data_offset);
+	if (delta) {
+		if (delta->fulltext) {
+			free(p);
+			return NULL;
+		}
+		TAILQ_REMOVE(&cache->lru, delta, lru_entry);
+		TAILQ_INSERT_HEAD(&cache->lru, delta, lru_entry);
+	} else {
+		err = delta_cache_insert(&delta, cache, delta_data_offset);
+		if (err) {
+			free(p);
+			return err;
 		}
-		delta->fulltext = malloc(fulltext_len);
-		if (delta->fulltext == NULL)
-			return got_error_from_errno("malloc");
-		memcpy(delta->fulltext, fulltext, fulltext_len);
-		delta->fulltext_len = fulltext_len;
-		break;
 	}
 
+	delta->fulltext = p;
+	delta->fulltext_len = fulltext_len;
+	cache->size += fulltext_len;
+	delta_cache_evict(cache);
 	return NULL;
 #endif
 }
@@ -305,13 +357,7 @@ got_delta_cache_get(uint8_t **delta_data, size_t *delta_len,
     uint8_t **fulltext, size_t *fulltext_len,
     struct got_delta_cache *cache, off_t delta_data_offset)
 {
-	uint64_t idx;
-	struct got_delta_cache_head *head;
 	struct got_cached_delta *delta;
-	int i;
-
-	idx = delta_cache_hash(cache, delta_data_offset) % cache->nbuckets;
-	head = &cache->buckets[idx];
 
 	cache->cache_search++;
 	*delta_data = NULL;
@@ -320,31 +366,25 @@ got_delta_cache_get(uint8_t **delta_data, size_t *delta_len,
 		*fulltext = NULL;
 	if (fulltext_len)
 		*fulltext_len = 0;
-	for (i = 0; i < head->nchain; i++) {
-		delta = &head->entries[i];
-		if (delta->offset != delta_data_offset)
-			continue;
-		cache->cache_hit++;
-		if (i > 0) {
-			struct got_cached_delta tmp;
-			memcpy(&tmp, &head->entries[0], sizeof(tmp));
-			memcpy(&head->entries[0], &head->entries[i],
-			    sizeof(head->entries[0]));
-			memcpy(&head->entries[i], &tmp,
-			    sizeof(head->entries[i]));
-			delta = &head->entries[0];
-		}
-		*delta_data = delta->data;
-		*delta_len = delta->len;
-		if (fulltext && fulltext_len &&
-		    delta->fulltext && delta->fulltext_len) {
-			*fulltext = delta->fulltext;
-			*fulltext_len = delta->fulltext_len;
-			cache->cache_hit_fulltext++;
-		}
 
+	delta = delta_cache_lookup(cache, delta_data_offset);
+	if (delta == NULL) {
+		cache->cache_miss++;
 		return;
 	}
 
-	cache->cache_miss++;
+	cache->cache_hit++;
+	if (delta != TAILQ_FIRST(&cache->lru)) {
+		TAILQ_REMOVE(&cache->lru, delta, lru_entry);
+		TAILQ_INSERT_HEAD(&cache->lru, delta, lru_entry);
+	}
+
+	*delta_data = delta->data;
+	*delta_len = delta->len;
+	if (fulltext && fulltext_len &&
+	    delta->fulltext && delta->fulltext_len) {
+		*fulltext = delta->fulltext;
+		*fulltext_len = delta->fulltext_len;
+		cache->cache_hit_fulltext++;
+	}
 }
@@ -19,6 +19,8 @@
 
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -91,6 +93,34 @@ static const uint32_t geartab[256] = {
 static const struct got_error *addblk(struct got_delta_table *, FILE *,
     uint8_t *, off_t, off_t, off_t, uint32_t);
 
+/*
+ * Map the first size bytes of a file into memory, such that blocks can
+ * be found and compared without seeking and reading via stdio.
+ * Return NULL if the file cannot be mapped; callers then fall back
+ * to stdio.
+ */
+static uint8_t *
+map_file(FILE *f, off_t size)
+{
+#ifndef GOT_PACK_NO_MMAP
+	struct stat sb;
+	uint8_t *data;
+
+	if (size <= 0 || (uintmax_t)size > SIZE_MAX)
+		return NULL;
+	if (fstat(fileno(f), &sb) == -1 || !S_ISREG(sb.st_mode) ||
+	    sb.st_size < size)
+		return NULL;
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	if (data == MAP_FAILED)
+		return NULL;
+	return data;
+#else
+	return NULL;
+#endif
+}
+
 static uint32_t
 hashblk(const unsigned char *p, off_t n, uint32_t seed)
 {
@@ -157,16 +187,14 @@ lookup_mem(int *n, struct got_delta_table *dt, uint8_t *basedata,
 }
 
 static const struct got_error *
-resizeht(struct got_delta_table *dt, FILE *f, off_t offset0, uint8_t *data,
-    off_t len)
+resizeht(struct got_delta_table *dt)
 {
-	const struct got_error *err;
 	struct got_delta_block *b;
 	size_t newsize, oldsize;
 	int i, n;
 
 	if (dt->nblocks == dt->nalloc) {
-		newsize = dt->nalloc + 256;
+		newsize = dt->nalloc * 2;
 		b = reallocarray(dt->blocks, newsize, sizeof(*dt->blocks));
 		if (b == NULL)
 			return got_error_from_errno("reallocarray");
@@ -184,21 +212,15 @@ resizeht(struct got_delta_table *dt, FILE *f, off_t offset0, uint8_t *data,
 			return got_error_from_errno("calloc");
 		}
 
+		/*
+		 * Blocks in the table are known to be distinct, so
+		 * their contents need not be compared while rehashing.
+		 */
 		for (i = 0; i < dt->nblocks; ++i) {
 			b = &dt->blocks[i];
-			if (f)
-				err = lookup(&n, dt, f, offset0, b->len,
-				    b->offset, b->hash);
-			else
-				err = lookup_mem(&n, dt, data, offset0,
-				    data + b->offset, b->len, b->hash);
-			if (err) {
-				free(dt->offs);
-				dt->offs = NULL;
-				dt->size = oldsize;
-				return err;
-			}
-			assert(dt->offs[n] == 0);
+			for (n = b->hash % dt->size; dt->offs[n] != 0;
+			    n = (n + 1) % dt->size)
+				;
 			dt->offs[n] = i + 1;
 		}
 	}
@@ -217,15 +239,15 @@ addblk(struct got_delta_table *dt, FILE *f, uint8_t *data, off_t file_offset0,
 	if (len == 0)
 		return NULL;
 
-	err = resizeht(dt, f, file_offset0, data, len);
+	err = resizeht(dt);
 	if (err)
 		return err;
 
 	if (f)
 		err = lookup(&i, dt, f, file_offset0, len, offset, h);
 	else
-		err = lookup_mem(&i, dt, data, file_offset0, data + offset,
-		    len, h);
+		err = lookup_mem(&i, dt, data, file_offset0,
+		    data + file_offset0 + offset, len, h);
 	if (err)
 		return err;
 
@@ -360,6 +382,20 @@ got_deltify_init(struct got_delta_table **dt, FILE *f, off_t fileoffset,
 	const struct got_error *err = NULL;
 	uint32_t h;
 	const off_t offset0 = fileoffset;
+	uint8_t *data;
+
+	data = map_file(f, filesize);
+	if (data != NULL) {
+		err = got_deltify_init_mem(dt, data, fileoffset, filesize,
+		    seed);
+		if (err) {
+			munmap(data, filesize);
+			return err;
+		}
+		(*dt)->data = data;
+		(*dt)->mapsize = filesize;
+		return NULL;
+	}
 
 	*dt = calloc(1, sizeof(**dt));
 	if (*dt == NULL)
@@ -466,6 +502,8 @@ got_deltify_free(struct got_delta_table *dt)
 {
 	if (dt == NULL)
 		return;
+	if (dt->data)
+		munmap(dt->data, dt->mapsize);
 	free(dt->blocks);
 	free(dt->offs);
 	free(dt);
@@ -630,11 +668,22 @@ stretchblk_mem_mem(uint8_t *basedata, off_t base_offset0, off_t basefile_size,
 	p = data + fileoffset;
 	q = basedata + base_offset;
 	maxlen = MIN(basefile_size - base_offset, filesize - fileoffset);
-	for (i = 0; i < maxlen && *blocklen < (1 << 24) - 1; i++) {
-		if (p[i] != q[i])
+	maxlen = MIN(maxlen, (1 << 24) - 1 - *blocklen);
+
+	/* Compare a word at a time until the first mismatching word. */
+	i = 0;
+	while (maxlen - i >= (off_t)sizeof(uint64_t)) {
+		uint64_t a, b;
+
+		memcpy(&a, p + i, sizeof(a));
+		memcpy(&b, q + i, sizeof(b));
+		if (a != b)
 			break;
-		(*blocklen)++;
+		i += sizeof(a);
 	}
+	while (i < maxlen && p[i] == q[i])
+		i++;
+	*blocklen += i;
 
 	return NULL;
 }
@@ -649,10 +698,26 @@ got_deltify(struct got_delta_instruction **deltas, int *ndeltas,
 	const off_t offset0 = fileoffset;
 	size_t nalloc = 0;
 	const size_t alloc_chunk_size = 64;
+	uint8_t *data;
 
 	*deltas = NULL;
 	*ndeltas = 0;
 
+	if (dt->data != NULL) {
+		return got_deltify_file_mem(deltas, ndeltas, f, fileoffset,
+		    filesize, seed, dt, dt->data, basefile_offset0,
+		    basefile_size);
+	}
+
+	data = map_file(f, filesize);
+	if (data != NULL) {
+		err = got_deltify_mem_file(deltas, ndeltas, data, fileoffset,
+		    filesize, seed, dt, basefile, basefile_offset0,
+		    basefile_size);
+		munmap(data, filesize);
+		return err;
+	}
+
 	/*
 	 * offset0 indicates where data to be deltified begins.
 	 * For example, we want to avoid deltifying a Git object header at
@@ -736,10 +801,20 @@ got_deltify_file_mem(struct got_delta_instruction **deltas, int *ndeltas,
 	const off_t offset0 = fileoffset;
 	size_t nalloc = 0;
 	const size_t alloc_chunk_size = 64;
+	uint8_t *data;
 
 	*deltas = NULL;
 	*ndeltas = 0;
 
+	data = map_file(f, filesize);
+	if (data != NULL) {
+		err = got_deltify_mem_mem(deltas, ndeltas, data, fileoffset,
+		    filesize, seed, dt, basedata, basefile_offset0,
+		    basefile_size);
+		munmap(data, filesize);
+		return err;
+	}
+
 	/*
 	 * offset0 indicates where data to be deltified begins.
 	 * For example, we want to avoid deltifying a Git object header at
@@ -827,6 +902,12 @@ got_deltify_mem_file(struct got_delta_instruction **deltas, int *ndeltas,
 	*deltas = NULL;
 	*ndeltas = 0;
 
+	if (dt->data != NULL) {
+		return got_deltify_mem_mem(deltas, ndeltas, data, fileoffset,
+		    filesize, seed, dt, dt->data, basefile_offset0,
+		    basefile_size);
+	}
+
 	*deltas = reallocarray(NULL, alloc_chunk_size,
 	    sizeof(struct got_delta_instruction));
 	if (*deltas == NULL)
@@ -270,8 +270,8 @@ got_dial_ssh(pid_t *newpid, int *newfd, const char *host,
 	int pid, pfd[2];
 	char cmd[64];
 	char escaped_path[PATH_MAX];
-	const char *argv[15];
-	int i = 0, j;
+	const char *argv[17];
+	int i = 0, j, v2;
 
 	*newpid = -1;
 	*newfd = -1;
@@ -280,7 +280,14 @@ got_dial_ssh(pid_t *newpid, int *newfd, const char *host,
 	if (error)
 		return error;
 
+	/* Protocol version 2 is only defined for fetching. */
+	v2 = (strcmp(command, GOT_DIAL_CMD_FETCH) == 0);
+
 	argv[i++] = GOT_DIAL_PATH_SSH;
+	if (v2) {
+		argv[i++] = "-o";
+		argv[i++] = "SendEnv=" GOT_DIAL_PROTOCOL_ENV;
+	}
 	if (port != NULL) {
 		argv[i++] = "-p";
 		argv[i++] = (char *)port;
@@ -325,6 +332,9 @@ got_dial_ssh(pid_t *newpid, int *newfd, const char *host,
 			err(1, "dup2");
 		if (strlcpy(cmd, command, sizeof(cmd)) >= sizeof(cmd))
 			err(1, "snprintf");
+		if (v2 && setenv(GOT_DIAL_PROTOCOL_ENV, GOT_DIAL_PROTOCOL_V2,
+		    1) == -1)
+			err(1, "setenv");
 		if (execv(GOT_DIAL_PATH_SSH, (char *const *)argv) == -1)
 			err(1, "execv %s", GOT_DIAL_PATH_SSH);
 		abort(); /* not reached */
@@ -382,7 +392,14 @@ got_dial_git(int *newfd, const char *host, const char *port,
 		goto done;
 	}
 	len = 4 + strlen(cmd) + 1 + strlen("host=") + strlen(host) + 1;
-	r = dprintf(fd, "%04x%s%chost=%s%c", len, cmd, '\0', host, '\0');
+	if (strcmp(command, GOT_DIAL_CMD_FETCH) == 0) {
+		/* Request protocol version 2 as an extra parameter. */
+		len += 1 + strlen(GOT_DIAL_PROTOCOL_V2) + 1;
+		r = dprintf(fd, "%04x%s%chost=%s%c%c%s%c", len, cmd, '\0',
+		    host, '\0', '\0', GOT_DIAL_PROTOCOL_V2, '\0');
+	} else
+		r = dprintf(fd, "%04x%s%chost=%s%c", len, cmd, '\0', host,
+		    '\0');
 	if (r < 0)
 		err = got_error_from_errno("dprintf");
 done:
@@ -961,6 +961,65 @@ done:
 	return err;
 }
 
+/*
+ * Add the ID of a subtree to ids if got_diff_tree() will descend into it,
+ * i.e. if the corresponding entry in the other tree is missing or differs.
+ */
+static void
+add_changed_subtree(struct got_object_id **ids, int *nids,
+    struct got_tree_entry *te, struct got_tree_object *other_tree)
+{
+	struct got_tree_entry *other_te = NULL;
+
+	if (got_object_tree_entry_is_submodule(te) || !S_ISDIR(te->mode))
+		return;
+
+	if (other_tree)
+		other_te = got_object_tree_find_entry(other_tree, te->name);
+	if (other_te &&
+	    (got_object_tree_entry_is_submodule(other_te) ||
+	    got_object_id_cmp(&te->id, &other_te->id) == 0))
+		return;
+
+	ids[(*nids)++] = &te->id;
+}
+
+/*
+ * Load all subtrees which will be compared in one batch, rather than
+ * requesting them one at a time while the trees are being walked.
+ */
+static const struct got_error *
+prefetch_changed_subtrees(struct got_tree_object *tree1,
+    struct got_tree_object *tree2, struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_object_id **ids;
+	int i, nentries1 = 0, nentries2 = 0, nids = 0;
+
+	if (tree1)
+		nentries1 = got_object_tree_get_nentries(tree1);
+	if (tree2)
+		nentries2 = got_object_tree_get_nentries(tree2);
+	if (nentries1 + nentries2 < 2)
+		return NULL;
+
+	ids = calloc(nentries1 + nentries2, sizeof(*ids));
+	if (ids == NULL)
+		return got_error_from_errno("calloc");
+
+	for (i = 0; i < nentries1; i++)
+		add_changed_subtree(ids, &nids,
+		    got_object_tree_get_entry(tree1, i), tree2);
+	for (i = 0; i < nentries2; i++)
+		add_changed_subtree(ids, &nids,
+		    got_object_tree_get_entry(tree2, i), tree1);
+
+	if (nids > 1)
+		err = got_object_prefetch_trees(repo, ids, nids);
+	free(ids);
+	return err;
+}
+
 const struct got_error *
 got_diff_tree(struct got_tree_object *tree1, struct got_tree_object *tree2,
     FILE *f1, FILE *f2, int fd1, int fd2,
@@ -974,6 +1033,10 @@ got_diff_tree(struct got_tree_object *tree1, struct got_tree_object *tree2,
 	char *l1 = NULL, *l2 = NULL;
 	int tidx1 = 0, tidx2 = 0;
 
+	err = prefetch_changed_subtrees(tree1, tree2, repo);
+	if (err)
+		return err;
+
 	if (tree1) {
 		te1 = got_object_tree_get_entry(tree1, 0);
 		if (te1 && asprintf(&l1, "%s%s%s", label1, label1[0] ? "/" : "",
@@ -34,14 +34,18 @@
 #include "got_repository_admin.h" /* XXX for pack_progress */
 #include "got_object.h"
 #include "got_opentemp.h"
+#include "got_path.h"
 #include "got_repository_dump.h"
 
 #include "got_lib_delta.h"
 #include "got_lib_hash.h"
 #include "got_lib_object.h"
+#include "got_lib_object_cache.h"
 #include "got_lib_object_idset.h"
+#include "got_lib_pack.h"
 #include "got_lib_ratelimit.h"
 #include "got_lib_pack_create.h"
+#include "got_lib_repository.h"
 
 #define GIT_BUNDLE_SIGNATURE_V2 "# v2 git bundle"
 #define GIT_BUNDLE_SIGNATURE_V3 "# v3 git bundle"
@@ -95,6 +99,7 @@ got_repo_dump(FILE *out, struct got_reflist_head *include_refs,
 	struct got_object_id *id = NULL;
 	struct got_commit_object *commit = NULL;
 	struct idvec ours, theirs;
+	struct got_object_idset *shallow;
 	char *nl, *s, *hex, *logmsg = NULL;
 	const char *refname, *signature;
 	enum got_hash_algorithm algo;
@@ -190,10 +195,14 @@ got_repo_dump(FILE *out, struct got_reflist_head *include_refs,
 		goto done;
 	}
 
+	err = got_repo_get_shallow_commits(&shallow, repo);
+	if (err)
+		goto done;
+
 	err = got_pack_create(&packhash, fileno(out), delta_cache,
 	    theirs.ids, theirs.len, ours.ids, ours.len,
-	    repo, 0, 0, 0, progress_cb, progress_arg, &rl,
-	    cancel_cb, cancel_arg);
+	    repo, 0, 0, 0, 0, shallow, NULL, NULL, 0, progress_cb,
+	    progress_arg, &rl, cancel_cb, cancel_arg);
 
  done:
 	idvec_free(&ours);
@@ -249,6 +249,10 @@ static const struct got_error got_errors[] = {
 	{ GOT_ERR_UNKNOWN_CAPA, "unknown capability" },
 	{ GOT_ERR_REF_DUP_ENTRY, "duplicate reference entry" },
 	{ GOT_ERR_DIFF_NOCHANGES, "no changes match the requested diff" },
+	{ GOT_ERR_BAD_COMMIT_GRAPH, "bad commit-graph file" },
+	{ GOT_ERR_BAD_BITMAP, "bad pack bitmap index file" },
+	{ GOT_ERR_BAD_MIDX, "bad multi-pack-index file" },
+	{ GOT_ERR_BAD_FILTER, "bad object filter specification" },
 };
 
 static struct got_custom_error {
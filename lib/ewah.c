@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "got_compat.h"
+
+#include "got_error.h"
+
+#include "got_lib_ewah.h"
+
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
+
+/* Layout of an EWAH run-length word. */
+#define EWAH_RUN_BIT		0x1ULL
+#define EWAH_RUN_LEN_SHIFT	1
+#define EWAH_RUN_LEN_MAX	0xffffffffULL
+#define EWAH_NLIT_SHIFT		33
+#define EWAH_NLIT_MAX		0x7fffffffULL
+
+/* Size of the bit count, word count, and last run-length word fields. */
+#define EWAH_HDR_SIZE		8
+#define EWAH_TRAILER_SIZE	4
+
+const struct got_error *
+got_bitmap_alloc(struct got_bitmap **b, size_t nbits)
+{
+	*b = calloc(1, sizeof(**b));
+	if (*b == NULL)
+		return got_error_from_errno("calloc");
+
+	(*b)->nwords = (nbits + 63) / 64;
+	if ((*b)->nwords == 0)
+		(*b)->nwords = 1;
+	(*b)->words = calloc((*b)->nwords, sizeof((*b)->words[0]));
+	if ((*b)->words == NULL) {
+		free(*b);
+		*b = NULL;
+		return got_error_from_errno("calloc");
+	}
+
+	return NULL;
+}
+
+void
+got_bitmap_free(struct got_bitmap *b)
+{
+	if (b == NULL)
+		return;
+	free(b->words);
+	free(b);
+}
+
+void
+got_bitmap_or(struct got_bitmap *dst, struct got_bitmap *src)
+{
+	size_t i, n = MIN(dst->nwords, src->nwords);
+
+	for (i = 0; i < n; i++)
+		dst->words[i] |= src->words[i];
+}
+
+void
+got_bitmap_andnot(struct got_bitmap *dst, struct got_bitmap *src)
+{
+	size_t i, n = MIN(dst->nwords, src->nwords);
+
+	for (i = 0; i < n; i++)
+		dst->words[i] &= ~src->words[i];
+}
+
+void
+got_bitmap_xor(struct got_bitmap *dst, struct got_bitmap *src)
+{
+	size_t i, n = MIN(dst->nwords, src->nwords);
+
+	for (i = 0; i < n; i++)
+		dst->words[i] ^= src->words[i];
+}
+
+void
+got_bitmap_clear(struct got_bitmap *b)
+{
+	memset(b->words, 0, b->nwords * sizeof(b->words[0]));
+}
+
+size_t
+got_bitmap_count(struct got_bitmap *b)
+{
+	size_t i, n = 0;
+	uint64_t w;
+
+	for (i = 0; i < b->nwords; i++) {
+		for (w = b->words[i]; w != 0; w &= w - 1)
+			n++;
+	}
+
+	return n;
+}
+
+int
+got_bitmap_next(size_t *pos, struct got_bitmap *b, size_t start)
+{
+	size_t i = start / 64;
+	uint64_t w;
+
+	if (i >= b->nwords)
+		return 0;
+
+	w = b->words[i] & (~0ULL << (start % 64));
+	for (;;) {
+		if (w != 0) {
+			size_t bit = 0;
+
+			while ((w & 1) == 0) {
+				w >>= 1;
+				bit++;
+			}
+			*pos = i * 64 + bit;
+			return 1;
+		}
+		if (++i >= b->nwords)
+			return 0;
+		w = b->words[i];
+	}
+}
+
+static uint32_t
+get_be32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be32toh(val);
+}
+
+static uint64_t
+get_be64(const uint8_t *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be64toh(val);
+}
+
+const struct got_error *
+got_ewah_size(size_t *size, const uint8_t *buf, size_t len)
+{
+	uint32_t nwords;
+
+	*size = 0;
+
+	if (len < EWAH_HDR_SIZE)
+		return got_error(GOT_ERR_BAD_BITMAP);
+
+	nwords = get_be32(buf + 4);
+	if ((len - EWAH_HDR_SIZE - EWAH_TRAILER_SIZE) / sizeof(uint64_t) <
+	    nwords || len < EWAH_HDR_SIZE + EWAH_TRAILER_SIZE)
+		return got_error(GOT_ERR_BAD_BITMAP);
+
+	*size = EWAH_HDR_SIZE + (size_t)nwords * sizeof(uint64_t) +
+	    EWAH_TRAILER_SIZE;
+	return NULL;
+}
+
+const struct got_error *
+got_ewah_decode(struct got_bitmap *b, const uint8_t *buf, size_t len,
+    size_t *consumed)
+{
+	const struct got_error *err;
+	const uint8_t *words;
+	uint32_t nwords, i = 0;
+	uint64_t rlw, w, run_len, nlit, j;
+	size_t size, out = 0;
+
+	*consumed = 0;
+
+	err = got_ewah_size(&size, buf, len);
+	if (err)
+		return err;
+
+	nwords = get_be32(buf + 4);
+	words = buf + EWAH_HDR_SIZE;
+
+	got_bitmap_clear(b);
+
+	while (i < nwords) {
+		rlw = get_be64(words + i * sizeof(uint64_t));
+		i++;
+
+		run_len = (rlw >> EWAH_RUN_LEN_SHIFT) & EWAH_RUN_LEN_MAX;
+		nlit = rlw >> EWAH_NLIT_SHIFT;
+
+		if (rlw & EWAH_RUN_BIT) {
+			if (run_len > b->nwords - out)
+				return got_error(GOT_ERR_BAD_BITMAP);
+			for (j = 0; j < run_len; j++)
+				b->words[out++] = ~0ULL;
+		} else {
+			/* Trailing runs of zero bits are harmless. */
+			if (run_len > b->nwords - out)
+				out = b->nwords;
+			else
+				out += run_len;
+		}
+
+		if (nlit > nwords - i)
+			return got_error(GOT_ERR_BAD_BITMAP);
+		for (j = 0; j < nlit; j++) {
+			w = get_be64(words + i * sizeof(uint64_t));
+			i++;
+			if (w != 0) {
+				if (out >= b->nwords)
+					return got_error(GOT_ERR_BAD_BITMAP);
+				b->words[out] = w;
+			}
+			if (out < b->nwords)
+				out++;
+		}
+	}
+
+	*consumed = size;
+	return NULL;
+}
+
+static void
+put_be32(uint8_t *p, uint32_t val)
+{
+	val = htobe32(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static void
+put_be64(uint8_t *p, uint64_t val)
+{
+	val = htobe64(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+const struct got_error *
+got_ewah_encode(uint8_t **buf, size_t *len, struct got_bitmap *b)
+{
+	uint64_t *out, run_bit = 0, run_len = 0, nlit = 0, w;
+	size_t i, nout = 0, rlw = 0, nwords;
+	uint8_t *p;
+
+	*buf = NULL;
+	*len = 0;
+
+	/* Trailing words without any bits set need not be stored. */
+	nwords = b->nwords;
+	while (nwords > 0 && b->words[nwords - 1] == 0)
+		nwords--;
+
+	/* Worst case: One run-length word per literal word. */
+	out = calloc(2 * nwords + 1, sizeof(*out));
+	if (out == NULL)
+		return got_error_from_errno("calloc");
+
+	nout = 1;
+	for (i = 0; i < nwords; i++) {
+		w = b->words[i];
+		if (w == 0 || w == ~0ULL) {
+			uint64_t bit = (w != 0);
+
+			if (nlit > 0 || (run_len > 0 && run_bit != bit) ||
+			    run_len == EWAH_RUN_LEN_MAX) {
+				out[rlw] = run_bit |
+				    (run_len << EWAH_RUN_LEN_SHIFT) |
+				    (nlit << EWAH_NLIT_SHIFT);
+				rlw = nout++;
+				run_len = 0;
+				nlit = 0;
+			}
+			run_bit = bit;
+			run_len++;
+		} else {
+			if (nlit == EWAH_NLIT_MAX) {
+				out[rlw] = run_bit |
+				    (run_len << EWAH_RUN_LEN_SHIFT) |
+				    (nlit << EWAH_NLIT_SHIFT);
+				rlw = nout++;
+				run_bit = 0;
+				run_len = 0;
+				nlit = 0;
+			}
+			out[nout++] = w;
+			nlit++;
+		}
+	}
+	out[rlw] = run_bit | (run_len << EWAH_RUN_LEN_SHIFT) |
+	    (nlit << EWAH_NLIT_SHIFT);
+
+	*len = EWAH_HDR_SIZE + nout * sizeof(uint64_t) + EWAH_TRAILER_SIZE;
+	*buf = malloc(*len);
+	if (*buf == NULL) {
+		free(out);
+		*len = 0;
+		return got_error_from_errno("malloc");
+	}
+
+	p = *buf;
+	put_be32(p, nwords * 64);
+	put_be32(p + 4, nout);
+	p += EWAH_HDR_SIZE;
+	for (i = 0; i < nout; i++) {
+		put_be64(p, out[i]);
+		p += sizeof(uint64_t);
+	}
+	put_be32(p, rlw);
+
+	free(out);
+	return NULL;
+}
@@ -56,6 +56,8 @@
 #include "got_lib_pack.h"
 #include "got_lib_privsep.h"
 #include "got_lib_object_cache.h"
+#include "got_lib_object_idset.h"
+#include "got_lib_object_qid.h"
 #include "got_lib_repository.h"
 #include "got_lib_dial.h"
 #include "got_lib_pkt.h"
@@ -100,15 +102,539 @@ got_fetch_connect(pid_t *fetchpid, int *fetchfd, const char *proto,
 	return err;
 }
 
-const struct got_error *
-got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
-    struct got_pathlist_head *symrefs, const char *remote_name,
-    int mirror_references, int fetch_all_branches,
+/*
+ * Smart HTTP is stateless: each request sent by got-fetch-pack is
+ * forwarded in a separate HTTP request.
+ */
+static int
+is_stateless_proto(const char *proto)
+{
+	return (strcmp(proto, "http") == 0 ||
+	    strcmp(proto, "git+http") == 0 ||
+	    strcmp(proto, "https") == 0 ||
+	    strcmp(proto, "git+https") == 0);
+}
+
+/*
+ * Send a delta base requested by got-index-pack, which is completing
+ * a thin pack file, or tell it that the object does not exist.
+ */
+static const struct got_error *
+send_delta_base(struct imsgbuf *ibuf, struct got_object_id *id,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_raw_object *raw = NULL;
+	uint8_t buf[8192];
+	off_t remain;
+	size_t n;
+	ssize_t w;
+	int obj_type, fd = -1, outfd = -1;
+
+	err = got_object_get_type(&obj_type, repo, id);
+	if (err == NULL)
+		err = got_object_raw_open(&raw, &outfd, repo, id);
+	if (err) {
+		if (err->code == GOT_ERR_NO_OBJ) {
+			got_privsep_send_error(ibuf, err);
+			err = NULL;
+		}
+		goto done;
+	}
+
+	fd = got_opentempfd();
+	if (fd == -1) {
+		err = got_error_from_errno("got_opentempfd");
+		goto done;
+	}
+
+	if (raw->f == NULL) {
+		w = write(fd, raw->data + raw->hdrlen, raw->size);
+		if (w == -1) {
+			err = got_error_from_errno("write");
+			goto done;
+		}
+		if (w != raw->size) {
+			err = got_error(GOT_ERR_IO);
+			goto done;
+		}
+	} else {
+		if (fseeko(raw->f, raw->hdrlen, SEEK_SET) == -1) {
+			err = got_error_from_errno("fseeko");
+			goto done;
+		}
+		remain = raw->size;
+		while (remain > 0) {
+			n = fread(buf, 1, MIN(sizeof(buf), remain), raw->f);
+			if (n == 0) {
+				err = got_ferror(raw->f, GOT_ERR_IO);
+				goto done;
+			}
+			w = write(fd, buf, n);
+			if (w == -1) {
+				err = got_error_from_errno("write");
+				goto done;
+			}
+			if (w != n) {
+				err = got_error(GOT_ERR_IO);
+				goto done;
+			}
+			remain -= n;
+		}
+	}
+
+	err = got_privsep_send_index_pack_base(ibuf, obj_type, raw->size, fd);
+	fd = -1;
+done:
+	if (raw)
+		got_object_raw_close(raw);
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (outfd != -1 && close(outfd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	return err;
+}
+
+struct shallow_ids_arg {
+	struct got_object_idset *shallow;
+	struct got_object_id *ids;
+	size_t nids;
+};
+
+static const struct got_error *
+copy_shallow_id(struct got_object_id *id, void *data, void *arg)
+{
+	struct shallow_ids_arg *a = arg;
+
+	memcpy(&a->ids[a->nids++], id, sizeof(*id));
+	return got_object_idset_add(a->shallow, id, NULL);
+}
+
+/*
+ * Copy the shallow commits of a repository into a new set which can be
+ * updated while fetching, and into an array which is sent to the server.
+ */
+static const struct got_error *
+get_shallow_ids(struct got_object_idset **shallow,
+    struct got_object_id **ids, size_t *nids, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_object_idset *repo_shallow;
+	struct shallow_ids_arg arg;
+	int n;
+
+	*shallow = NULL;
+	*ids = NULL;
+	*nids = 0;
+
+	err = got_repo_get_shallow_commits(&repo_shallow, repo);
+	if (err)
+		return err;
+
+	*shallow = got_object_idset_alloc();
+	if (*shallow == NULL)
+		return got_error_from_errno("got_object_idset_alloc");
+	if (repo_shallow == NULL)
+		return NULL;
+
+	n = got_object_idset_num_elements(repo_shallow);
+	if (n == 0)
+		return NULL;
+	arg.shallow = *shallow;
+	arg.ids = calloc(n, sizeof(arg.ids[0]));
+	if (arg.ids == NULL)
+		return got_error_from_errno("calloc");
+	arg.nids = 0;
+
+	err = got_object_idset_for_each(repo_shallow, copy_shallow_id, &arg);
+	if (err) {
+		free(arg.ids);
+		return err;
+	}
+
+	*ids = arg.ids;
+	*nids = arg.nids;
+	return NULL;
+}
+
+/*
+ * Mark a pack file as a promisor pack. Objects referenced by objects in
+ * this pack file may be missing and can be fetched from the promisor remote.
+ */
+static const struct got_error *
+write_promisor_file(struct got_repository *repo, const char *id_str)
+{
+	const struct got_error *err;
+	char *path;
+
+	if (asprintf(&path, "%s/%s/pack-%s.promisor",
+	    got_repo_get_path_git_dir(repo), GOT_OBJECTS_PACK_DIR,
+	    id_str) == -1)
+		return got_error_from_errno("asprintf");
+
+	err = got_path_create_file(path, NULL);
+	if (err && err->code == GOT_ERR_ERRNO && errno == EEXIST)
+		err = NULL;
+	free(path);
+	return err;
+}
+
+/*
+ * Commits are announced to the server as "have" lines with exponentially
+ * growing gaps while walking our history, such that a common base can be
+ * found within a few round trips even if our history has diverged from
+ * the server's by many commits. Once the server acknowledges a commit,
+ * its ancestors are known to be common and will not be announced.
+ */
+#define GOT_FETCH_COMMIT_SEEN		0x01
+#define GOT_FETCH_COMMIT_POPPED		0x02
+#define GOT_FETCH_COMMIT_COMMON		0x04
+#define GOT_FETCH_COMMIT_ADVERTISED	0x08
+
+struct got_fetch_commit {
+	TAILQ_ENTRY(got_fetch_commit) entry;
+	struct got_object_id id;
+	time_t committer_time;
+	int flags;
+	int ttl;		/* commits left to skip before sending one */
+	int original_ttl;	/* gap which ttl was last reset to */
+};
+TAILQ_HEAD(got_fetch_commit_queue, got_fetch_commit);
+
+struct got_fetch_negotiator {
+	struct got_object_idset *commits;
+	struct got_fetch_commit_queue queue; /* ordered by committer time */
+	int non_common_revs;
+	struct got_object_idset *shallow;
+	struct got_repository *repo;
+};
+
+static const struct got_error *
+negotiator_init(struct got_fetch_negotiator *neg,
+    struct got_object_idset *shallow, struct got_repository *repo)
+{
+	memset(neg, 0, sizeof(*neg));
+	TAILQ_INIT(&neg->queue);
+	neg->shallow = shallow;
+	neg->repo = repo;
+
+	neg->commits = got_object_idset_alloc();
+	if (neg->commits == NULL)
+		return got_error_from_errno("got_object_idset_alloc");
+
+	return NULL;
+}
+
+static const struct got_error *
+free_fetch_commit(struct got_object_id *id, void *data, void *arg)
+{
+	free(data);
+	return NULL;
+}
+
+static void
+negotiator_free(struct got_fetch_negotiator *neg)
+{
+	if (neg->commits == NULL)
+		return;
+	got_object_idset_for_each(neg->commits, free_fetch_commit, NULL);
+	got_object_idset_free(neg->commits);
+	neg->commits = NULL;
+}
+
+/*
+ * Add a commit to the queue unless it has been seen already.
+ * Commits missing from the repository are ignored.
+ */
+static const struct got_error *
+negotiator_push(struct got_fetch_commit **new,
+    struct got_fetch_negotiator *neg, struct got_object_id *id)
+{
+	const struct got_error *err;
+	struct got_commit_object *commit;
+	struct got_fetch_commit *c, *c2;
+
+	*new = got_object_idset_get(neg->commits, id);
+	if (*new != NULL)
+		return NULL;
+
+	err = got_object_open_as_commit(&commit, neg->repo, id);
+	if (err) {
+		if (err->code == GOT_ERR_NO_OBJ)
+			return NULL;
+		return err;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) {
+		err = got_error_from_errno("calloc");
+		got_object_commit_close(commit);
+		return err;
+	}
+	memcpy(&c->id, id, sizeof(c->id));
+	c->committer_time = got_object_commit_get_committer_time(commit);
+	c->flags = GOT_FETCH_COMMIT_SEEN;
+	got_object_commit_close(commit);
+
+	err = got_object_idset_add(neg->commits, &c->id, c);
+	if (err) {
+		free(c);
+		return err;
+	}
+
+	TAILQ_FOREACH(c2, &neg->queue, entry) {
+		if (c2->committer_time < c->committer_time)
+			break;
+	}
+	if (c2)
+		TAILQ_INSERT_BEFORE(c2, c, entry);
+	else
+		TAILQ_INSERT_TAIL(&neg->queue, c, entry);
+
+	neg->non_common_revs++;
+	*new = c;
+	return NULL;
+}
+
+/*
+ * Mark a commit and all of its ancestors which we have seen as common.
+ */
+static const struct got_error *
+negotiator_mark_common(struct got_fetch_negotiator *neg,
+    struct got_fetch_commit *c)
+{
+	const struct got_error *err = NULL;
+	struct got_object_id_queue ids;
+	struct got_object_qid *qid, *pid;
+	struct got_commit_object *commit;
+	const struct got_object_id_queue *parent_ids;
+
+	STAILQ_INIT(&ids);
+
+	err = got_object_qid_alloc_partial(&qid);
+	if (err)
+		return err;
+	memcpy(&qid->id, &c->id, sizeof(qid->id));
+	STAILQ_INSERT_TAIL(&ids, qid, entry);
+
+	while (!STAILQ_EMPTY(&ids)) {
+		qid = STAILQ_FIRST(&ids);
+		STAILQ_REMOVE_HEAD(&ids, entry);
+		c = got_object_idset_get(neg->commits, &qid->id);
+		got_object_qid_free(qid);
+		if (c == NULL || (c->flags & GOT_FETCH_COMMIT_COMMON))
+			continue;
+
+		c->flags |= GOT_FETCH_COMMIT_COMMON;
+		if ((c->flags & GOT_FETCH_COMMIT_POPPED) == 0)
+			neg->non_common_revs--;
+
+		if (neg->shallow &&
+		    got_object_idset_contains(neg->shallow, &c->id))
+			continue;
+
+		err = got_object_open_as_commit(&commit, neg->repo, &c->id);
+		if (err)
+			goto done;
+		parent_ids = got_object_commit_get_parent_ids(commit);
+		STAILQ_FOREACH(pid, parent_ids, entry) {
+			struct got_fetch_commit *p;
+
+			p = got_object_idset_get(neg->commits, &pid->id);
+			if (p == NULL || (p->flags & GOT_FETCH_COMMIT_COMMON))
+				continue;
+			err = got_object_qid_alloc_partial(&qid);
+			if (err)
+				break;
+			memcpy(&qid->id, &pid->id, sizeof(qid->id));
+			STAILQ_INSERT_TAIL(&ids, qid, entry);
+		}
+		got_object_commit_close(commit);
+		if (err)
+			goto done;
+	}
+done:
+	got_object_id_queue_free(&ids);
+	return err;
+}
+
+/*
+ * Add a reference tip, peeling tags, to the set of commits to announce.
+ * Tips advertised by the server are announced but their ancestors are not.
+ */
+static const struct got_error *
+negotiator_add_tip(struct got_fetch_negotiator *neg,
+    struct got_object_id *id, int advertised)
+{
+	const struct got_error *err;
+	struct got_tag_object *tag = NULL;
+	struct got_fetch_commit *c;
+	int obj_type;
+
+	err = got_object_get_type(&obj_type, neg->repo, id);
+	if (err) {
+		if (err->code == GOT_ERR_NO_OBJ)
+			return NULL;
+		return err;
+	}
+
+	if (obj_type == GOT_OBJ_TYPE_TAG) {
+		err = got_object_open_as_tag(&tag, neg->repo, id);
+		if (err)
+			return err;
+		if (got_object_tag_get_object_type(tag) !=
+		    GOT_OBJ_TYPE_COMMIT)
+			goto done;
+		id = got_object_tag_get_object_id(tag);
+	} else if (obj_type != GOT_OBJ_TYPE_COMMIT)
+		return NULL;
+
+	if (advertised && got_object_idset_contains(neg->commits, id))
+		goto done;
+
+	err = negotiator_push(&c, neg, id);
+	if (err == NULL && c != NULL && advertised)
+		c->flags |= GOT_FETCH_COMMIT_ADVERTISED;
+done:
+	if (tag)
+		got_object_tag_close(tag);
+	return err;
+}
+
+static const struct got_error *
+negotiator_push_parent(struct got_fetch_negotiator *neg,
+    struct got_fetch_commit *c, struct got_object_id *parent_id)
+{
+	const struct got_error *err;
+	struct got_fetch_commit *p;
+	int ttl, original_ttl;
+
+	err = negotiator_push(&p, neg, parent_id);
+	if (err || p == NULL || (p->flags & GOT_FETCH_COMMIT_POPPED))
+		return err;
+
+	if (c->flags & (GOT_FETCH_COMMIT_COMMON | GOT_FETCH_COMMIT_ADVERTISED))
+		return negotiator_mark_common(neg, p);
+
+	/* Grow the gap between announced commits by half each time. */
+	original_ttl = c->ttl ? c->original_ttl : c->original_ttl * 3 / 2 + 1;
+	ttl = c->ttl ? c->ttl - 1 : original_ttl;
+	if (p->original_ttl < original_ttl) {
+		p->original_ttl = original_ttl;
+		p->ttl = ttl;
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the next commit to announce to the server, or NULL if the
+ * walk has only common commits left.
+ */
+static const struct got_error *
+negotiator_next(struct got_object_id **id, struct got_fetch_negotiator *neg)
+{
+	const struct got_error *err;
+	struct got_fetch_commit *c;
+	struct got_commit_object *commit;
+	const struct got_object_id_queue *parent_ids;
+	struct got_object_qid *pid;
+	int send;
+
+	*id = NULL;
+
+	while (neg->non_common_revs > 0 &&
+	    (c = TAILQ_FIRST(&neg->queue)) != NULL) {
+		TAILQ_REMOVE(&neg->queue, c, entry);
+		c->flags |= GOT_FETCH_COMMIT_POPPED;
+		if ((c->flags & GOT_FETCH_COMMIT_COMMON) == 0)
+			neg->non_common_revs--;
+
+		send = ((c->flags & GOT_FETCH_COMMIT_COMMON) == 0 &&
+		    c->ttl == 0);
+
+		if (neg->shallow == NULL ||
+		    !got_object_idset_contains(neg->shallow, &c->id)) {
+			err = got_object_open_as_commit(&commit, neg->repo,
+			    &c->id);
+			if (err)
+				return err;
+			parent_ids = got_object_commit_get_parent_ids(commit);
+			STAILQ_FOREACH(pid, parent_ids, entry) {
+				err = negotiator_push_parent(neg, c, &pid->id);
+				if (err)
+					break;
+			}
+			got_object_commit_close(commit);
+			if (err)
+				return err;
+		}
+
+		if (send) {
+			*id = &c->id;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Answer a request from got-fetch-pack for the next batch of commits
+ * to announce to the server. The walk starts at our reference tips.
+ */
+static const struct got_error *
+send_haves(struct imsgbuf *ibuf, struct got_fetch_negotiator *neg,
+    int *negotiating, struct got_pathlist_head *have_refs,
+    struct got_pathlist_head *refs, int max_haves)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_entry *pe;
+	struct got_object_id **ids;
+	int nids = 0;
+
+	if (!*negotiating) {
+		RB_FOREACH(pe, got_pathlist_head, refs) {
+			err = negotiator_add_tip(neg, pe->data, 1);
+			if (err)
+				return err;
+		}
+		RB_FOREACH(pe, got_pathlist_head, have_refs) {
+			err = negotiator_add_tip(neg, pe->data, 0);
+			if (err)
+				return err;
+		}
+		*negotiating = 1;
+	}
+
+	ids = calloc(max_haves, sizeof(ids[0]));
+	if (ids == NULL)
+		return got_error_from_errno("calloc");
+
+	while (nids < max_haves) {
+		err = negotiator_next(&ids[nids], neg);
+		if (err || ids[nids] == NULL)
+			break;
+		nids++;
+	}
+
+	if (err == NULL)
+		err = got_privsep_send_object_idlist(ibuf, ids, nids);
+	if (err == NULL)
+		err = got_privsep_send_object_idlist_done(ibuf);
+	free(ids);
+	return err;
+}
+
+static const struct got_error *
+fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
+    struct got_pathlist_head *symrefs, int fetch_all_branches,
     struct got_pathlist_head *wanted_branches,
     struct got_pathlist_head *wanted_refs, int list_refs_only, int verbosity,
-    int fetchfd, struct got_repository *repo, const char *worktree_refname,
-    const char *remote_head, int no_head, got_fetch_progress_cb progress_cb,
-    void *progress_arg)
+    int fetchfd, const char *proto, struct got_repository *repo,
+    const char *worktree_refname, const char *remote_head, int no_head,
+    int depth, const char *filter, struct got_object_id *wanted_ids,
+    size_t nwanted_ids, got_fetch_progress_cb progress_cb, void *progress_arg)
 {
 	size_t i;
 	int imsg_fetchfds[2], imsg_idxfds[2];
@@ -130,6 +656,12 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 	uint32_t nobj = 0;
 	char *path;
 	char *progress = NULL;
+	struct got_object_idset *shallow = NULL;
+	struct got_object_id *shallow_ids = NULL;
+	size_t nshallow = 0;
+	int shallow_changed = 0;
+	struct got_fetch_negotiator neg;
+	int negotiating = 0;
 
 	*pack_hash = NULL;
 	memset(&fetchibuf, 0, sizeof(fetchibuf));
@@ -152,6 +684,10 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 			return got_error_path(refname, GOT_ERR_FETCH_BAD_REF);
 	}
 
+	if (filter && (filter[0] == '\0' ||
+	    filter[strcspn(filter, " \t\r\n")] != '\0'))
+		return got_error_path(filter, GOT_ERR_BAD_FILTER);
+
 	if (!list_refs_only)
 		repo_path = got_repo_get_path_git_dir(repo);
 
@@ -160,8 +696,13 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 
 	RB_INIT(&have_refs);
 	TAILQ_INIT(&my_refs);
+	memset(&neg, 0, sizeof(neg));
 
-	if (!list_refs_only) {
+	/*
+	 * Objects missing from a partial clone are requested as such.
+	 * Announcing our references could cause the server to omit them.
+	 */
+	if (!list_refs_only && nwanted_ids == 0) {
 		err = got_ref_list(&my_refs, repo, NULL,
 		    got_ref_cmp_by_name, NULL);
 		if (err)
@@ -193,6 +734,18 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 
 	}
 
+	if (!list_refs_only && nwanted_ids == 0) {
+		err = get_shallow_ids(&shallow, &shallow_ids, &nshallow, repo);
+		if (err)
+			goto done;
+	}
+
+	if (!list_refs_only) {
+		err = negotiator_init(&neg, shallow, repo);
+		if (err)
+			goto done;
+	}
+
 	if (list_refs_only) {
 		packfd = got_opentempfd();
 		if (packfd == -1) {
@@ -279,7 +832,9 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 	}
 	err = got_privsep_send_fetch_req(&fetchibuf, nfetchfd, &have_refs,
 	    fetch_all_branches, wanted_branches, wanted_refs,
-	    list_refs_only, worktree_refname, remote_head, no_head, verbosity);
+	    list_refs_only, worktree_refname, remote_head, no_head, verbosity,
+	    depth, shallow_ids, nshallow, filter, wanted_ids, nwanted_ids,
+	    is_stateless_proto(proto));
 	if (err != NULL)
 		goto done;
 	nfetchfd = -1;
@@ -307,16 +862,62 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 	}
 
 	while (!done) {
-		struct got_object_id *id = NULL;
+		struct got_object_id *id = NULL, *shallow_id = NULL;
+		struct got_object_id *common_id = NULL;
 		char *refname = NULL;
 		char *server_progress = NULL;
 		off_t packfile_size_cur = 0;
+		int unshallow = 0, max_haves = 0;
 
 		err = got_privsep_recv_fetch_progress(&done,
 		    &id, &refname, symrefs, &server_progress,
-		    &packfile_size_cur, (*pack_hash)->hash, &fetchibuf);
+		    &packfile_size_cur, (*pack_hash)->hash, &shallow_id,
+		    &unshallow, &common_id, &max_haves, &fetchibuf);
 		if (err != NULL)
 			goto done;
+		if (max_haves > 0) {
+			if (list_refs_only) {
+				err = got_error(GOT_ERR_PRIVSEP_MSG);
+				goto done;
+			}
+			err = send_haves(&fetchibuf, &neg, &negotiating,
+			    &have_refs, refs, max_haves);
+			if (err)
+				goto done;
+			continue;
+		}
+		if (common_id) {
+			struct got_fetch_commit *c = NULL;
+
+			if (negotiating)
+				c = got_object_idset_get(neg.commits,
+				    common_id);
+			free(common_id);
+			if (c) {
+				err = negotiator_mark_common(&neg, c);
+				if (err)
+					goto done;
+			}
+			continue;
+		}
+		if (shallow_id) {
+			if (shallow == NULL)
+				err = got_error(GOT_ERR_PRIVSEP_MSG);
+			else if (unshallow) {
+				if (got_object_idset_contains(shallow,
+				    shallow_id))
+					err = got_object_idset_remove(NULL,
+					    shallow, shallow_id);
+			} else if (!got_object_idset_contains(shallow,
+			    shallow_id))
+				err = got_object_idset_add(shallow,
+				    shallow_id, NULL);
+			free(shallow_id);
+			if (err)
+				goto done;
+			shallow_changed = 1;
+			continue;
+		}
 		/* Don't report size progress for an empty pack file. */
 		if (packfile_size_cur <= ssizeof(pack_hdr) + SHA1_DIGEST_LENGTH)
 			packfile_size_cur = 0;
@@ -475,7 +1076,8 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 		err = got_error_from_errno("dup");
 		goto done;
 	}
-	err = got_privsep_send_index_pack_req(&idxibuf, *pack_hash, npackfd);
+	err = got_privsep_send_index_pack_req(&idxibuf, *pack_hash, 1, 0,
+	    npackfd);
 	if (err != NULL)
 		goto done;
 	npackfd = -1;
@@ -492,12 +1094,21 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 	done = 0;
 	while (!done) {
 		int nobj_total, nobj_indexed, nobj_loose, nobj_resolved;
+		struct got_object_id *base_id;
 
+		/* The pack hash changes if a thin pack gets completed. */
 		err = got_privsep_recv_index_progress(&done, &nobj_total,
 		    &nobj_indexed, &nobj_loose, &nobj_resolved,
-		    &idxibuf);
+		    *pack_hash, &base_id, &idxibuf);
 		if (err != NULL)
 			goto done;
+		if (base_id) {
+			err = send_delta_base(&idxibuf, base_id, repo);
+			free(base_id);
+			if (err)
+				goto done;
+			continue;
+		}
 		if (nobj_indexed != 0) {
 			err = progress_cb(progress_arg, NULL,
 			    packfile_size, nobj_total,
@@ -518,6 +1129,12 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 	err = got_object_id_str(&id_str, *pack_hash);
 	if (err)
 		goto done;
+	if (filter != NULL || nwanted_ids > 0) {
+		/* Must exist before the pack file becomes visible. */
+		err = write_promisor_file(repo, id_str);
+		if (err)
+			goto done;
+	}
 	if (asprintf(&packpath, "%s/%s/pack-%s.pack",
 	    repo_path, GOT_OBJECTS_PACK_DIR, id_str) == -1) {
 		err = got_error_from_errno("asprintf");
@@ -545,7 +1162,15 @@ got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
 	free(tmpidxpath);
 	tmpidxpath = NULL;
 
+	err = got_repo_write_packidx_bloom_filter(repo, *pack_hash);
+	if (err)
+		goto done;
+	err = got_repo_write_packidx_reverse_index(repo, *pack_hash);
+
 done:
+	/* Record the new shallow boundary once all objects are in place. */
+	if (err == NULL && shallow_changed)
+		err = got_repo_write_shallow_commits(repo, shallow);
 	if (fetchibuf.w)
 		imsgbuf_clear(&fetchibuf);
 	if (idxibuf.w)
@@ -572,6 +1197,10 @@ done:
 	free(id_str);
 	free(packpath);
 	free(progress);
+	negotiator_free(&neg);
+	if (shallow)
+		got_object_idset_free(shallow);
+	free(shallow_ids);
 
 	got_pathlist_free(&have_refs, GOT_PATHLIST_FREE_ALL);
 	got_ref_list_free(&my_refs);
@@ -583,3 +1212,46 @@ done:
 	}
 	return err;
 }
+
+const struct got_error *
+got_fetch_pack(struct got_object_id **pack_hash, struct got_pathlist_head *refs,
+    struct got_pathlist_head *symrefs, const char *remote_name,
+    int mirror_references, int fetch_all_branches,
+    struct got_pathlist_head *wanted_branches,
+    struct got_pathlist_head *wanted_refs, int list_refs_only, int verbosity,
+    int fetchfd, const char *proto, struct got_repository *repo,
+    const char *worktree_refname, const char *remote_head, int no_head,
+    int depth, const char *filter, got_fetch_progress_cb progress_cb,
+    void *progress_arg)
+{
+	return fetch_pack(pack_hash, refs, symrefs, fetch_all_branches,
+	    wanted_branches, wanted_refs, list_refs_only, verbosity, fetchfd,
+	    proto, repo, worktree_refname, remote_head, no_head, depth, filter,
+	    NULL, 0, progress_cb, progress_arg);
+}
+
+const struct got_error *
+got_fetch_objects(struct got_object_id **pack_hash,
+    struct got_object_id *ids, int nids, const char *filter, int verbosity,
+    int fetchfd, const char *proto, struct got_repository *repo,
+    got_fetch_progress_cb progress_cb, void *progress_arg)
+{
+	const struct got_error *err;
+	struct got_pathlist_head refs, symrefs, wanted_branches, wanted_refs;
+
+	RB_INIT(&refs);
+	RB_INIT(&symrefs);
+	RB_INIT(&wanted_branches);
+	RB_INIT(&wanted_refs);
+
+	*pack_hash = NULL;
+	if (nids <= 0)
+		return NULL;
+
+	err = fetch_pack(pack_hash, &refs, &symrefs, 0, &wanted_branches,
+	    &wanted_refs, 0, verbosity, fetchfd, proto, repo, NULL, NULL, 1, 0,
+	    filter, ids, nids, progress_cb, progress_arg);
+	got_pathlist_free(&refs, GOT_PATHLIST_FREE_ALL);
+	got_pathlist_free(&symrefs, GOT_PATHLIST_FREE_ALL);
+	return err;
+}
@@ -35,6 +35,8 @@
 
 #include "got_lib_hash.h"
 #include "got_lib_fileindex.h"
+#include "got_lib_delta.h"
+#include "got_lib_object.h"
 #include "got_lib_worktree.h"
 
 /* got_fileindex_entry flags */
@@ -820,6 +822,40 @@ walk_fileindex(struct got_fileindex *fileindex, struct got_fileindex_entry *ie)
 	return next;
 }
 
+/*
+ * Load all subtrees of a tree in one batch, rather than requesting them
+ * one at a time while the tree is being walked.
+ */
+static const struct got_error *
+prefetch_subtrees(struct got_tree_object *tree, struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_object_id **ids;
+	struct got_tree_entry *te;
+	int i, nentries, nids = 0;
+
+	nentries = got_object_tree_get_nentries(tree);
+	if (nentries < 2)
+		return NULL;
+
+	ids = calloc(nentries, sizeof(*ids));
+	if (ids == NULL)
+		return got_error_from_errno("calloc");
+
+	for (i = 0; i < nentries; i++) {
+		te = got_object_tree_get_entry(tree, i);
+		if (got_object_tree_entry_is_submodule(te) ||
+		    !S_ISDIR(got_tree_entry_get_mode(te)))
+			continue;
+		ids[nids++] = got_tree_entry_get_id(te);
+	}
+
+	if (nids > 1)
+		err = got_object_prefetch_trees(repo, ids, nids);
+	free(ids);
+	return err;
+}
+
 static const struct got_error *
 diff_fileindex_tree(struct got_fileindex *, struct got_fileindex_entry **ie,
     struct got_tree_object *tree, const char *, const char *,
@@ -876,6 +912,12 @@ diff_fileindex_tree(struct got_fileindex *fileindex,
 	struct got_fileindex_entry *next;
 	int tidx = 0;
 
+	if (entry_name == NULL) {
+		err = prefetch_subtrees(tree, repo);
+		if (err)
+			return err;
+	}
+
 	te = got_object_tree_get_entry(tree, tidx);
 	while ((*ie && got_path_is_child((*ie)->path, path, path_len)) || te) {
 		if (te && *ie) {
@@ -119,6 +119,52 @@ got_gitproto_parse_refline(char **id_str, char **refname,
 	return NULL;
 }
 
+/*
+ * Parse a line sent by a protocol version 2 server in response to the
+ * ls-refs command: "<id> <refname>[ <attribute>]...".
+ */
+const struct got_error *
+got_gitproto_parse_ls_refs_line(char **id_str, char **refname,
+    char **symref_target, char *line, int len)
+{
+	const struct got_error *err = NULL;
+	char *tokens[3];
+	char *attrs, *attr;
+	size_t targetlen = strlen(GOT_LS_REFS_SYMREF_TARGET);
+
+	*id_str = NULL;
+	*refname = NULL;
+	*symref_target = NULL;
+
+	err = tokenize_line(tokens, line, len, 2, nitems(tokens));
+	if (err)
+		return err;
+
+	if (tokens[0] == NULL || tokens[1] == NULL) {
+		free_tokens(tokens, nitems(tokens));
+		return got_error_msg(GOT_ERR_BAD_PACKET, "empty ls-refs line");
+	}
+
+	attrs = tokens[2];
+	while (attrs && (attr = strsep(&attrs, " \n")) != NULL) {
+		if (strncmp(attr, GOT_LS_REFS_SYMREF_TARGET, targetlen) != 0 ||
+		    attr[targetlen] == '\0')
+			continue; /* ignore unknown attributes */
+		free(*symref_target);
+		*symref_target = strdup(attr + targetlen);
+		if (*symref_target == NULL) {
+			err = got_error_from_errno("strdup");
+			free_tokens(tokens, nitems(tokens));
+			return err;
+		}
+	}
+	free(tokens[2]);
+
+	*id_str = tokens[0];
+	*refname = tokens[1];
+	return NULL;
+}
+
 const struct got_error *
 got_gitproto_parse_want_line(char **id_str,
     char **capabilities, char *line, int len)
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Git's commit-graph file, stored at objects/info/commit-graph.
+ *
+ * The file stores parent positions, root tree IDs, commit timestamps,
+ * and generation numbers of commits, sorted by commit ID. This allows
+ * history traversal without inflating and parsing commit objects.
+ * Optionally, the file stores a changed-path bloom filter for each commit,
+ * which allows path-limited history traversal to skip commits which did
+ * not change a given path without comparing trees.
+ * The on-disk format is compatible with Git's, such that Git and Got
+ * can use the same file.
+ */
+
+#define GOT_COMMIT_GRAPH_FILE	"objects/info/commit-graph"
+
+#define GOT_COMMIT_GRAPH_SIGNATURE	0x43475048 /* 'C' 'G' 'P' 'H' */
+#define GOT_COMMIT_GRAPH_VERSION	1
+#define GOT_COMMIT_GRAPH_HASH_SHA1	1
+#define GOT_COMMIT_GRAPH_HASH_SHA256	2
+
+#define GOT_COMMIT_GRAPH_HDR_SIZE	8
+#define GOT_COMMIT_GRAPH_CHUNK_ENTRY_SIZE 12 /* 4 byte ID, 8 byte offset */
+
+#define GOT_COMMIT_GRAPH_CHUNK_OIDF	0x4f494446 /* 'O' 'I' 'D' 'F' */
+#define GOT_COMMIT_GRAPH_CHUNK_OIDL	0x4f49444c /* 'O' 'I' 'D' 'L' */
+#define GOT_COMMIT_GRAPH_CHUNK_CDAT	0x43444154 /* 'C' 'D' 'A' 'T' */
+#define GOT_COMMIT_GRAPH_CHUNK_EDGE	0x45444745 /* 'E' 'D' 'G' 'E' */
+#define GOT_COMMIT_GRAPH_CHUNK_BIDX	0x42494458 /* 'B' 'I' 'D' 'X' */
+#define GOT_COMMIT_GRAPH_CHUNK_BDAT	0x42444154 /* 'B' 'D' 'A' 'T' */
+
+/* Parent position values used in the CDAT and EDGE chunks. */
+#define GOT_COMMIT_GRAPH_PARENT_NONE		0x70000000
+#define GOT_COMMIT_GRAPH_PARENT_OCTOPUS		0x80000000
+#define GOT_COMMIT_GRAPH_PARENT_LAST		0x80000000
+#define GOT_COMMIT_GRAPH_PARENT_POS_MASK	0x7fffffff
+
+/* Commit data size, excluding the tree ID. */
+#define GOT_COMMIT_GRAPH_CDAT_SIZE	16
+
+/* Generation numbers are stored in the upper 30 bits of a 64-bit field. */
+#define GOT_COMMIT_GRAPH_GENERATION_MAX	0x3fffffff
+
+/*
+ * Generation number used for commits which are not listed in the
+ * commit-graph file. Such commits cannot be ancestors of listed commits.
+ */
+#define GOT_COMMIT_GRAPH_GENERATION_INFINITY 0xffffffff
+
+/* Generation number written by versions of Git which did not compute it. */
+#define GOT_COMMIT_GRAPH_GENERATION_ZERO 0
+
+/* Commit timestamps are stored in the lower 34 bits of a 64-bit field. */
+#define GOT_COMMIT_GRAPH_TIME_MAX	0x3ffffffffLL
+
+/*
+ * Changed-path bloom filters, as written by Git. Each commit's filter
+ * contains the paths of files which differ between the commit and its
+ * first parent, as well as the leading directories of such paths.
+ * The BDAT chunk begins with a header of three 32-bit fields: the hash
+ * version, the number of hashes per path, and the number of bits per path.
+ * Version 1 hashes are computed as by Git, which treats path bytes as
+ * signed characters. Version 2 hashes use unsigned characters.
+ */
+#define GOT_COMMIT_GRAPH_BLOOM_HDR_SIZE		12
+#define GOT_COMMIT_GRAPH_BLOOM_VERSION		1
+#define GOT_COMMIT_GRAPH_BLOOM_NHASHES		7
+#define GOT_COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY	10
+
+/* Commits which change more paths get a filter which matches any path. */
+#define GOT_COMMIT_GRAPH_BLOOM_MAX_PATHS	512
+
+struct got_commit_graph_file {
+	int fd;
+	enum got_hash_algorithm algo;
+	uint8_t *map;
+	size_t len;
+	int mapped;		/* map was obtained via mmap(2) */
+
+	uint32_t ncommits;
+
+	/* Convenient pointers into map. */
+	uint32_t *fanout;	/* big endian */
+	uint8_t *oids;
+	uint8_t *cdat;
+	uint32_t *edges;	/* big endian; may be NULL */
+	size_t nedges;
+	uint32_t *bloom_idx;	/* big endian; may be NULL */
+	uint8_t *bloom_data;
+	size_t bloom_data_len;
+	uint32_t bloom_version;
+	uint32_t bloom_nhashes;
+	uint32_t bloom_bits_per_entry;
+};
+
+/*
+ * Open a commit-graph file. Ownership of the file descriptor passes
+ * to the commit-graph file and will be closed by
+ * got_commit_graph_file_close().
+ */
+const struct got_error *got_commit_graph_file_open(
+    struct got_commit_graph_file **, int, enum got_hash_algorithm);
+const struct got_error *got_commit_graph_file_close(
+    struct got_commit_graph_file *);
+
+/*
+ * Look up a commit in the commit-graph file. Return 1 and the commit's
+ * position if the commit was found. Otherwise, return zero.
+ */
+int got_commit_graph_file_lookup(uint32_t *, struct got_commit_graph_file *,
+    struct got_object_id *);
+
+/* Get the ID of the commit stored at the given position. */
+void got_commit_graph_file_get_id(struct got_object_id *,
+    struct got_commit_graph_file *, uint32_t);
+
+/* Get the generation number of the commit stored at the given position. */
+uint32_t got_commit_graph_file_get_generation(struct got_commit_graph_file *,
+    uint32_t);
+
+/* Get the committer time of the commit stored at the given position. */
+time_t got_commit_graph_file_get_committer_time(
+    struct got_commit_graph_file *, uint32_t);
+
+/*
+ * Get the positions of parents of the commit stored at the given position.
+ * The parent positions array is allocated and must be freed by the caller.
+ */
+const struct got_error *got_commit_graph_file_get_parents(uint32_t **,
+    int *, struct got_commit_graph_file *, uint32_t);
+
+/*
+ * Allocate a partial commit object for the commit stored at the given
+ * position. Only the tree ID, parent IDs, and the committer timestamp
+ * are filled in. Such commit objects suffice for history traversal but
+ * must never be added to an object cache.
+ */
+const struct got_error *got_commit_graph_file_get_commit(
+    struct got_commit_object **, struct got_commit_graph_file *, uint32_t);
+
+/*
+ * Check a path against the changed-path bloom filter of the commit stored
+ * at the given position. Return zero if the commit certainly did not change
+ * the path relative to its first parent. Otherwise, return 1. The path must
+ * not refer to the root directory.
+ */
+int got_commit_graph_file_path_maybe_changed(struct got_commit_graph_file *,
+    uint32_t, const char *);
+
+/*
+ * Get the changed-path bloom filter of the commit stored at the given
+ * position, if the filter is compatible with filters created by
+ * got_commit_graph_file_create_bloom_filter(). The filter points into
+ * the commit-graph file's memory. Return zero if no filter is available.
+ */
+int got_commit_graph_file_get_bloom_filter(const uint8_t **, size_t *,
+    struct got_commit_graph_file *, uint32_t);
+
+/*
+ * Create a changed-path bloom filter for a commit, given a list of changed
+ * paths which includes leading directories of changed files. If the list
+ * is NULL, the commit changed too many paths and the filter will match
+ * any path. The filter is allocated and must be freed by the caller.
+ */
+const struct got_error *got_commit_graph_file_create_bloom_filter(uint8_t **,
+    size_t *, struct got_pathlist_head *);
+
+/* A commit to be written to a new commit-graph file. */
+struct got_commit_graph_file_entry {
+	struct got_object_id id;
+	struct got_object_id tree_id;
+	time_t committer_time;
+	int nparents;
+	struct got_object_id *parent_ids;
+
+	/*
+	 * Changed-path bloom filter. Bloom filters will only be written
+	 * if all commits have one.
+	 */
+	uint8_t *bloom;
+	size_t bloom_len;
+
+	/* Used internally while writing. */
+	uint32_t generation;
+};
+
+/*
+ * Write a commit-graph file containing the given commits to a file
+ * descriptor. The set of commits must be closed under the parent
+ * relation. The array of commits will be sorted by commit ID.
+ */
+const struct got_error *got_commit_graph_file_write(int,
+    struct got_commit_graph_file_entry *, size_t, enum got_hash_algorithm);
@@ -14,9 +14,17 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/*
+ * Default amount of memory, in bytes, which a delta cache may use for
+ * storing deltas and delta base fulltexts. Least recently used entries
+ * are evicted once this limit is exceeded.
+ */
+#define GOT_DELTA_CACHE_DEFAULT_SIZE	(32 * 1024 * 1024)
+
 struct got_delta_cache;
 
-const struct got_error *got_delta_cache_alloc(struct got_delta_cache **);
+const struct got_error *got_delta_cache_alloc(struct got_delta_cache **,
+    size_t);
 void got_delta_cache_free(struct got_delta_cache *);
 
 const struct got_error *got_delta_cache_add(struct got_delta_cache *, off_t,
@@ -33,6 +33,13 @@ struct got_delta_table {
 	uint32_t		*offs;
 	int			 len;
 	int			 size;
+
+	/*
+	 * Mapping of a file-backed delta base, created by got_deltify_init()
+	 * so that blocks can be compared without seeking in the base file.
+	 */
+	uint8_t			*data;
+	size_t			 mapsize;
 };
 
 struct got_delta_instruction {
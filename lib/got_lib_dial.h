@@ -18,6 +18,10 @@
 #define GOT_DIAL_CMD_SEND	"git-receive-pack"
 #define GOT_DIAL_CMD_FETCH	"git-upload-pack"
 
+/* Environment variable and value used to request protocol version 2. */
+#define GOT_DIAL_PROTOCOL_ENV	"GIT_PROTOCOL"
+#define GOT_DIAL_PROTOCOL_V2	"version=2"
+
 const struct got_error *got_dial_git(int *newfd, const char *host,
     const char *port, const char *path, const char *command);
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Uncompressed bitmaps, and their serialization in the compressed EWAH
+ * (Enhanced Word-Aligned Hybrid) format used by Git's bitmap index files.
+ *
+ * A serialized EWAH bitmap consists of a 32-bit bit count, a 32-bit word
+ * count, the given number of 64-bit words, and the 32-bit position of the
+ * last run-length word. All values are stored in big-endian byte order.
+ * Each run-length word encodes a run of words which are either all zero
+ * or all one bits, followed by a count of literal words which follow.
+ */
+
+struct got_bitmap {
+	uint64_t *words;
+	size_t nwords;
+};
+
+/* Allocate a bitmap with all bits cleared which can hold nbits bits. */
+const struct got_error *got_bitmap_alloc(struct got_bitmap **, size_t);
+void got_bitmap_free(struct got_bitmap *);
+
+static inline void
+got_bitmap_set(struct got_bitmap *b, size_t pos)
+{
+	b->words[pos / 64] |= (1ULL << (pos % 64));
+}
+
+static inline int
+got_bitmap_get(struct got_bitmap *b, size_t pos)
+{
+	if (pos / 64 >= b->nwords)
+		return 0;
+	return (b->words[pos / 64] & (1ULL << (pos % 64))) != 0;
+}
+
+/* dst |= src */
+void got_bitmap_or(struct got_bitmap *, struct got_bitmap *);
+
+/* dst &= ~src */
+void got_bitmap_andnot(struct got_bitmap *, struct got_bitmap *);
+
+/* dst ^= src */
+void got_bitmap_xor(struct got_bitmap *, struct got_bitmap *);
+
+void got_bitmap_clear(struct got_bitmap *);
+size_t got_bitmap_count(struct got_bitmap *);
+
+/*
+ * Iterate over set bits. Set *pos to the position of the next set bit at
+ * or after the given position and return 1, or return zero if no more
+ * bits are set.
+ */
+int got_bitmap_next(size_t *, struct got_bitmap *, size_t);
+
+/*
+ * Decode an EWAH bitmap stored in the provided buffer into an uncompressed
+ * bitmap. Bits beyond the size of the uncompressed bitmap must not be set.
+ * Return the number of bytes consumed in the last argument.
+ */
+const struct got_error *got_ewah_decode(struct got_bitmap *,
+    const uint8_t *, size_t, size_t *);
+
+/* Determine the size of an EWAH bitmap stored in the provided buffer. */
+const struct got_error *got_ewah_size(size_t *, const uint8_t *, size_t);
+
+/*
+ * Encode an uncompressed bitmap in EWAH format. The resulting buffer is
+ * allocated and must be freed by the caller.
+ */
+const struct got_error *got_ewah_encode(uint8_t **, size_t *,
+    struct got_bitmap *);
@@ -21,6 +21,17 @@
 #define GOT_CAPA_REPORT_STATUS		"report-status"
 #define GOT_CAPA_DELETE_REFS		"delete-refs"
 #define GOT_CAPA_NO_THIN		"no-thin"
+#define GOT_CAPA_THIN_PACK		"thin-pack"
+#define GOT_CAPA_SHALLOW		"shallow"
+#define GOT_CAPA_FILTER			"filter"
+#define GOT_CAPA_MULTI_ACK_DETAILED	"multi_ack_detailed"
+
+/* Protocol version 2 capabilities and commands. */
+#define GOT_PROTOCOL_V2			"version 2"
+#define GOT_CAPA_LS_REFS		"ls-refs"
+#define GOT_CAPA_FETCH			"fetch"
+#define GOT_CAPA_OBJECT_FORMAT		"object-format"
+#define GOT_LS_REFS_SYMREF_TARGET	"symref-target:"
 
 #define GOT_SIDEBAND_PACKFILE_DATA	1
 #define GOT_SIDEBAND_PROGRESS_INFO	2
@@ -37,6 +48,8 @@ struct got_pathlist_head;
 
 const struct got_error *got_gitproto_parse_refline(char **id_str,
     char **refname, char **server_capabilities, char *line, int len);
+const struct got_error *got_gitproto_parse_ls_refs_line(char **id_str,
+    char **refname, char **symref_target, char *line, int len);
 const struct got_error *got_gitproto_parse_want_line(char **id_str,
     char **capabilities, char *line, int len);
 const struct got_error *got_gitproto_parse_have_line(char **id_str,
@@ -23,6 +23,9 @@ struct got_gotconfig {
 	char *allowed_signers_file;
 	char *revoked_signers_file;
 	char *signer_id;
+	int pack_window;
+	int pack_depth;
+	size_t pack_memsize;
 };
 
 const struct got_error *got_gotconfig_read(struct got_gotconfig **,
@@ -56,7 +56,9 @@ const struct got_error *got_inflate_to_mem(uint8_t **, size_t *, size_t *,
 const struct got_error *got_inflate_to_mem_fd(uint8_t **, size_t *, size_t *,
     struct got_inflate_checksum *, size_t, int);
 const struct got_error *got_inflate_to_mem_mmap(uint8_t **, size_t *, size_t *,
-    struct got_inflate_checksum *, uint8_t *, size_t, size_t);
+    struct got_inflate_checksum *, size_t, uint8_t *, size_t, size_t);
+const struct got_error *got_inflate_to_buf_mmap(uint8_t *, size_t, size_t *,
+    uint8_t *, size_t, size_t);
 const struct got_error *got_inflate_to_file(size_t *, FILE *,
     struct got_inflate_checksum *, FILE *);
 const struct got_error *got_inflate_to_file_fd(size_t *, size_t *,
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Git's multi-pack-index file, stored at objects/pack/multi-pack-index.
+ * See Documentation/technical/multi-pack-index.txt in Git.
+ *
+ * The file contains a sorted table of the IDs of objects stored in any
+ * of the listed pack files, along with the pack file which contains each
+ * object. This allows objects to be found with a single binary search
+ * regardless of the number of pack files in the repository.
+ */
+
+#define GOT_MIDX_FILE		"objects/pack/multi-pack-index"
+
+#define GOT_MIDX_SIGNATURE	0x4d494458 /* 'M' 'I' 'D' 'X' */
+#define GOT_MIDX_VERSION	1
+#define GOT_MIDX_HASH_SHA1	1
+#define GOT_MIDX_HASH_SHA256	2
+
+#define GOT_MIDX_HDR_SIZE	12
+#define GOT_MIDX_CHUNK_ENTRY_SIZE 12 /* 4 byte ID, 8 byte offset */
+
+#define GOT_MIDX_CHUNK_PNAM	0x504e414d /* 'P' 'N' 'A' 'M' */
+#define GOT_MIDX_CHUNK_OIDF	0x4f494446 /* 'O' 'I' 'D' 'F' */
+#define GOT_MIDX_CHUNK_OIDL	0x4f49444c /* 'O' 'I' 'D' 'L' */
+#define GOT_MIDX_CHUNK_OOFF	0x4f4f4646 /* 'O' 'O' 'F' 'F' */
+#define GOT_MIDX_CHUNK_LOFF	0x4c4f4646 /* 'L' 'O' 'F' 'F' */
+
+/* Offsets with this bit set are indices into the large offset table. */
+#define GOT_MIDX_OFFSET_IS_LARGE_IDX	0x80000000
+
+struct got_multi_pack_index {
+	int fd;
+	enum got_hash_algorithm algo;
+	uint8_t *map;
+	size_t len;
+	int mapped;		/* map was obtained via mmap(2) */
+
+	uint32_t npacks;
+	uint32_t nobjects;
+	const char **pack_names; /* pack index file names, sorted */
+
+	/* Convenient pointers into map. */
+	uint32_t *fanout;	/* big endian */
+	uint8_t *oids;
+	uint32_t *offsets;	/* big endian; pack ID and offset pairs */
+	uint64_t *large_offsets; /* big endian; may be NULL */
+	size_t nlarge_offsets;
+};
+
+/*
+ * Open a multi-pack-index file. Ownership of the file descriptor passes
+ * to the multi-pack-index and will be closed by
+ * got_multi_pack_index_close().
+ */
+const struct got_error *got_multi_pack_index_open(
+    struct got_multi_pack_index **, int, enum got_hash_algorithm);
+const struct got_error *got_multi_pack_index_close(
+    struct got_multi_pack_index *);
+
+/*
+ * Look up an object in the multi-pack-index. Return the name of the
+ * pack index file which lists the object, relative to objects/pack/.
+ * Return NULL if the object is not listed.
+ */
+const char *got_multi_pack_index_lookup(struct got_multi_pack_index *,
+    struct got_object_id *);
+
+/*
+ * Write a multi-pack-index file covering the given pack index files to a
+ * file descriptor. Pack index file names must be relative to objects/pack/.
+ * If an object is stored in more than one pack file, the pack file which
+ * appears first in the array of pack indices is preferred.
+ */
+const struct got_error *got_multi_pack_index_write(int,
+    struct got_packidx **, const char **, uint32_t, enum got_hash_algorithm);
@@ -64,6 +64,7 @@ struct got_commit_object {
 
 	int flags;
 #define GOT_COMMIT_FLAG_PACKED		0x01
+#define GOT_COMMIT_FLAG_PARTIAL		0x02 /* read from commit-graph */
 };
 
 struct got_tree_entry {
@@ -131,6 +132,8 @@ const struct got_error *got_object_commit_open(struct got_commit_object **,
     struct got_repository *, struct got_object *);
 const struct got_error *got_object_tree_open(struct got_tree_object **,
     struct got_repository *, struct got_object *);
+const struct got_error *got_object_prefetch_trees(struct got_repository *,
+    struct got_object_id **, int);
 const struct got_error *got_object_blob_open(struct got_blob_object **,
     struct got_repository *, struct got_object *, size_t, int);
 char *got_object_blob_id_str(struct got_blob_object*, char *, size_t);
@@ -22,8 +22,16 @@ enum got_object_cache_type {
 	GOT_OBJECT_CACHE_TYPE_RAW,
 };
 
+/*
+ * Default amount of memory, in bytes, shared among the object caches of
+ * a repository. Each cache type receives a fixed share of this budget.
+ */
+#define GOT_OBJECT_CACHE_DEFAULT_SIZE	(64 * 1024 * 1024)
+
 struct got_object_cache_entry {
+	TAILQ_ENTRY(got_object_cache_entry) entry;
 	struct got_object_id id;
+	size_t size;
 	union {
 		struct got_object *obj;
 		struct got_tree_object *tree;
@@ -33,10 +41,18 @@ struct got_object_cache_entry {
 	} data;
 };
 
+TAILQ_HEAD(got_object_cache_lru, got_object_cache_entry);
+
+struct got_object_cache_stats;
+
 struct got_object_cache {
 	enum got_object_cache_type type;
 	struct got_object_idset *idset;
+	struct got_object_cache_lru lru;	/* most recently used first */
+	int maxelem;
 	size_t size;
+	size_t maxsize;
+	size_t max_elem_size;
 	int cache_searches;
 	int cache_hit;
 	int cache_miss;
@@ -47,7 +63,10 @@ struct got_object_cache {
 
 const struct got_error *got_object_cache_init(struct got_object_cache *,
     enum got_object_cache_type);
+void got_object_cache_set_size(struct got_object_cache *, size_t);
 const struct got_error *got_object_cache_add(struct got_object_cache *,
     struct got_object_id *, void *);
 void *got_object_cache_get(struct got_object_cache *, struct got_object_id *);
+void got_object_cache_get_stats(struct got_object_cache_stats *,
+    struct got_object_cache *);
 void got_object_cache_close(struct got_object_cache *);
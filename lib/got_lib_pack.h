@@ -18,6 +18,10 @@ struct got_pack_privsep_child {
 	int imsg_fd;
 	pid_t pid;
 	struct imsgbuf *ibuf;
+
+	/* Shared memory the child writes object data to, if any. */
+	uint8_t *shm;
+	size_t shm_size;
 };
 
 /* An open pack file. */
@@ -32,6 +36,8 @@ struct got_pack {
 	int accumfd;
 	int child_has_tempfiles;
 	int child_has_delta_outfd;
+	int child_has_commit_graph;
+	int child_has_shm;
 	struct got_delta_cache *delta_cache;
 };
 
@@ -54,6 +60,7 @@ const struct got_error *got_pack_parse_object_type_and_size(uint8_t *,
 #define GOT_PACK_PREFIX		"pack-"
 #define GOT_PACKFILE_SUFFIX	".pack"
 #define GOT_PACKIDX_SUFFIX	".idx"
+#define GOT_PACKIDX_REV_SUFFIX	".rev"
 #define GOT_PACKFILE_NAMELEN	(strlen(GOT_PACK_PREFIX) + \
 				SHA1_DIGEST_STRING_LENGTH - 1 + \
 				strlen(GOT_PACKFILE_SUFFIX))
@@ -114,6 +121,25 @@ struct got_pack_large_offset_index {
 	uint32_t idx;
 };
 
+/*
+ * Git's pack reverse index, stored in a .rev file next to the pack index.
+ * See Documentation/gitformat-pack.txt in Git.
+ *
+ * The header is followed by one big endian 32-bit index into the pack
+ * index for each object, sorted by the offset of the object in the pack
+ * file. The file ends with the checksums of the pack file and of the
+ * reverse index itself.
+ */
+struct got_packidx_rev_hdr {
+	uint32_t	signature;	/* big endian */
+#define GOT_PACKIDX_REV_SIGNATURE	0x52494458	/* 'R' 'I' 'D' 'X' */
+	uint32_t	version;	/* big endian */
+#define GOT_PACKIDX_REV_VERSION		1
+	uint32_t	hash_id;	/* big endian */
+#define GOT_PACKIDX_REV_HASH_SHA1	1
+#define GOT_PACKIDX_REV_HASH_SHA256	2
+} __attribute__((__packed__));
+
 /* An open pack index file. */
 struct got_packidx {
 	char *path_packidx; /* actual on-disk path */
@@ -122,9 +148,17 @@ struct got_packidx {
 	uint8_t *map;
 	size_t len;
 	size_t nlargeobj;
+	off_t packfile_size;
 	struct got_packidx_v2_hdr hdr; /* convenient pointers into map */
 	struct got_pack_offset_index *sorted_offsets;
 	struct got_pack_large_offset_index *sorted_large_offsets;
+
+	/* Reverse index read from a .rev file, if any. */
+	int rev_fd;
+	uint8_t *rev_map;
+	size_t rev_len;
+	int rev_mapped;		/* rev_map was obtained via mmap(2) */
+	uint32_t *rev;		/* values are big endian */
 };
 
 struct got_packfile_hdr {
@@ -160,10 +194,40 @@ const struct got_error *got_packidx_open(struct got_packidx **,
     int, const char *, int, enum got_hash_algorithm);
 const struct got_error *got_packidx_close(struct got_packidx *);
 const struct got_error *got_packidx_get_packfile_path(char **, const char *);
+const struct got_error *got_packidx_get_reverse_index_path(char **,
+    const char *);
+
+/*
+ * Use the reverse index file open on the given file descriptor, which is
+ * closed by got_packidx_close(). Reverse index files which do not match
+ * the pack index are ignored and the file descriptor is closed.
+ */
+const struct got_error *got_packidx_open_reverse_index(struct got_packidx *,
+    int);
 off_t got_packidx_get_object_offset(struct got_packidx *, int idx);
 int got_packidx_get_object_idx(struct got_packidx *, struct got_object_id *);
 const struct got_error *got_packidx_get_offset_idx(int *, struct got_packidx *,
     off_t);
+
+/*
+ * Return an array which maps positions in pack file order to the
+ * corresponding object indices in the pack index.
+ */
+const struct got_error *got_packidx_get_pack_order(uint32_t **,
+    struct got_packidx *);
+
+/*
+ * Return the size of the packed representation of an object, including
+ * its type and size header and any delta base offset or ID, as stored in
+ * the pack file. This is the distance to the offset of the next object in
+ * the pack file and is cheap to obtain if a reverse index exists.
+ */
+const struct got_error *got_packidx_get_packed_size(off_t *,
+    struct got_packidx *, int);
+
+/* Write a reverse index for a pack index to a file descriptor. */
+const struct got_error *got_packidx_write_reverse_index(int,
+    struct got_packidx *);
 const struct got_error *got_packidx_get_object_id(struct got_object_id *,
     struct got_packidx *, int);
 const struct got_error *got_packidx_match_id_str_prefix(
@@ -183,6 +247,8 @@ const struct got_error *got_packfile_extract_object(struct got_pack *,
     struct got_object *, FILE *, FILE *, FILE *);
 const struct got_error *got_packfile_extract_object_to_mem(uint8_t **, size_t *,
     struct got_object *, struct got_pack *);
+const struct got_error *got_packfile_extract_object_to_buf(uint8_t *,
+    size_t, size_t *, struct got_object *, struct got_pack *);
 const struct got_error *got_packfile_extract_raw_delta(uint8_t **, size_t *,
     size_t *, off_t *, off_t *, off_t *, struct got_object_id *, uint64_t *,
     uint64_t *, struct got_pack *, struct got_packidx *, int);
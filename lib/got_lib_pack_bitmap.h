@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Pack reachability bitmaps, stored in a .bitmap file next to a pack file.
+ * See Documentation/technical/bitmap-format.txt in Git.
+ *
+ * Bit N in a bitmap corresponds to the Nth object of the pack file, with
+ * objects sorted by pack file offset. For a selection of commits, the file
+ * stores the set of objects reachable from each commit. The file also
+ * stores one bitmap per object type, and optionally a name hash for each
+ * object which is used to find good delta bases.
+ */
+
+#define GOT_PACK_BITMAP_SUFFIX		".bitmap"
+
+#define GOT_PACK_BITMAP_SIGNATURE	0x4249544d /* 'B' 'I' 'T' 'M' */
+#define GOT_PACK_BITMAP_VERSION		1
+#define GOT_PACK_BITMAP_HDR_SIZE	12
+
+#define GOT_PACK_BITMAP_OPT_FULL_DAG	0x0001	/* required */
+#define GOT_PACK_BITMAP_OPT_HASH_CACHE	0x0004
+#define GOT_PACK_BITMAP_OPT_LOOKUP_TABLE 0x0010
+
+/* Number of commits between selected commits along first-parent history. */
+#define GOT_PACK_BITMAP_COMMIT_INTERVAL	100
+
+struct got_pack_bitmap_entry {
+	uint32_t n;		/* position in the array of entries */
+	uint32_t idx;		/* pack index position of the commit */
+	uint8_t xor_offset;	/* XOR with bitmap of an earlier entry */
+	uint8_t flags;
+	const uint8_t *ewah;	/* EWAH-encoded bitmap */
+	size_t ewah_len;
+	uint8_t *ewah_buf;	/* ewah, if not pointing into the file */
+};
+
+struct got_pack_bitmap {
+	int fd;
+	uint8_t *map;
+	size_t len;
+	int mapped;		/* map was obtained via mmap(2) */
+
+	struct got_packidx *packidx;
+	int packidx_owned;	/* packidx must be closed along with bitmap */
+	int writing;		/* type bitmaps and name hashes are written */
+	uint32_t nobjects;
+	uint32_t *pack_order;	/* pack index positions in pack file order */
+	uint32_t *pack_pos;	/* pack file positions in pack index order */
+
+	/* Objects of a particular type. */
+	struct got_bitmap *commits;
+	struct got_bitmap *trees;
+	struct got_bitmap *blobs;
+	struct got_bitmap *tags;
+
+	/* Selected commits, in file order. */
+	struct got_pack_bitmap_entry **entries;
+	uint32_t nentries;
+	size_t entries_size;
+	struct got_object_idset *entry_ids; /* maps commit IDs to entries */
+
+	/* Name hashes in pack file order; big endian; may be NULL. */
+	const uint8_t *name_hashes;
+	uint8_t *name_hashes_buf; /* if not pointing into the file */
+};
+
+/*
+ * Open the bitmap file of the pack file with the given index.
+ * Ownership of the file descriptor passes to the bitmap and will be
+ * closed by got_pack_bitmap_close().
+ */
+const struct got_error *got_pack_bitmap_open(struct got_pack_bitmap **,
+    int, struct got_packidx *);
+void got_pack_bitmap_close(struct got_pack_bitmap *);
+
+/*
+ * Find a pack file in the repository which has a bitmap file and open
+ * this bitmap file. Set the bitmap to NULL if no suitable bitmap exists.
+ * Prefer the largest such pack file.
+ */
+const struct got_error *got_pack_bitmap_find(struct got_pack_bitmap **,
+    struct got_repository *);
+
+/*
+ * Add objects reachable from the given object to a bitmap. Stop traversal
+ * at objects which are already present in the bitmap. Return an error
+ * with code GOT_ERR_NO_OBJ if some reachable object is not present in
+ * the pack file covered by the bitmap file, or GOT_ERR_NOT_IMPL if a tag
+ * of another tag was encountered.
+ */
+const struct got_error *got_pack_bitmap_fill(struct got_bitmap *,
+    struct got_pack_bitmap *, struct got_object_id *,
+    struct got_repository *, got_cancel_cb, void *);
+
+/* Return the object type of an object at the given pack file position. */
+int got_pack_bitmap_get_type(struct got_pack_bitmap *, uint32_t);
+
+/*
+ * Hash a path for grouping objects during delta search. This is the same
+ * as pack_name_hash() in Git; only the last 16 characters matter, such that
+ * files with similar names sort next to each other.
+ */
+uint32_t got_pack_bitmap_name_hash(const char *);
+
+/* Return the name hash of an object at the given pack file position. */
+uint32_t got_pack_bitmap_get_name_hash(struct got_pack_bitmap *, uint32_t);
+
+/* Get the ID of an object at the given pack file position. */
+const struct got_error *got_pack_bitmap_get_object_id(struct got_object_id *,
+    struct got_pack_bitmap *, uint32_t);
+
+/*
+ * Write a bitmap file for the pack file with the given index to a file
+ * descriptor. The pack file must contain all objects reachable from the
+ * given commits and tags.
+ */
+const struct got_error *got_pack_bitmap_write(int, struct got_packidx *,
+    struct got_object_id **, int, struct got_repository *,
+    got_cancel_cb, void *);
@@ -14,18 +14,63 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/* Maximum number of threads used to search for deltas. */
+#define GOT_PACK_CREATE_MAX_THREADS	32
+
+/* Number of objects claimed by a delta search thread at a time. */
+#define GOT_PACK_CREATE_DELTA_CHUNK	1024
+
+/* Maximum number of their commits which provide delta bases for thin packs. */
+#define GOT_PACK_CREATE_THIN_COMMITS_MAX	16
+
+/* Amount of verbatim pack file data copied between progress reports. */
+#define GOT_PACK_CREATE_VERBATIM_CHUNK	(1024 * 1024)
+
+/* Object filter requested by clients which create a partial clone. */
+struct got_pack_filter {
+	int type;
+#define GOT_PACK_FILTER_BLOB_NONE	1	/* omit all blobs */
+#define GOT_PACK_FILTER_BLOB_LIMIT	2	/* omit blobs above limit */
+	off_t blob_limit;
+};
+
+/*
+ * Parse an object filter specification as used in the Git protocol,
+ * such as "blob:none" or "blob:limit=1m".
+ */
+const struct got_error *got_pack_parse_filter(struct got_pack_filter *,
+    const char *);
+
 /*
  * Write pack file data into the provided open packfile handle, for all
  * objects reachable via the commits listed in 'ours'.
  * Exclude any objects for commits listed in 'theirs' if 'theirs' is not NULL.
  * Return the hash digest of the resulting pack file in pack_hash which must
  * be pre-allocated by the caller with at least GOT_HASH_DIGEST_MAXLEN bytes.
+ * If thin is set, objects in the trees of commits listed in 'theirs' may
+ * serve as delta bases without being written to the pack file. Such deltas
+ * are written as reference deltas and the receiver must already have, or
+ * otherwise supply, their base objects.
+ * Deltas are searched according to delta_params, or according to settings
+ * in got.conf(5) if delta_params is NULL.
+ * Deltas are searched by up to nthreads threads, or by one thread per
+ * online CPU if nthreads is 0. The resulting pack file does not depend
+ * on the number of threads used.
+ * If shallow is not NULL, history traversal does not proceed beyond commits
+ * contained in this set. Parents of these commits are neither packed nor
+ * excluded from the pack file.
+ * If filter is not NULL, blobs which do not pass the filter are omitted
+ * unless they are listed in 'ours'. Blobs and trees listed in 'ours' are
+ * packed as well, such that missing objects can be requested by ID.
  */
 const struct got_error *got_pack_create(struct got_object_id *pack_hash,
     int packfd, FILE *delta_cache, struct got_object_id **theirs, int ntheirs,
     struct got_object_id **ours, int nours,
     struct got_repository *repo, int loose_obj_only, int allow_empty,
-    int force_refdelta, got_pack_progress_cb progress_cb, void *progress_arg,
+    int force_refdelta, int thin, struct got_object_idset *shallow,
+    const struct got_pack_filter *filter,
+    const struct got_pack_delta_params *delta_params, int nthreads,
+    got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *, got_cancel_cb cancel_cb, void *cancel_arg);
 
 const struct got_error *
@@ -84,6 +129,9 @@ struct got_pack_meta {
 	off_t	delta_compressed_len; /* encoded+compressed delta length */
 	int	nchain;
 
+	/* Depth of reused delta chains which use this object as a base. */
+	int	reused_child_depth;
+
 	off_t   reused_delta_offset; /* offset of delta in reused pack file */
 	struct got_object_id *base_obj_id;
 
@@ -92,6 +140,15 @@ struct got_pack_meta {
 
 	/* Only used for writing offset deltas */
 	off_t	off;
+
+	/* Object already known to the receiver; only used as a delta base. */
+	int	thin_base;
+
+	/* Object is copied as part of a verbatim slice of the reused pack. */
+	int	verbatim;
+
+	/* Object has already been written to the pack file. */
+	int	written;
 };
 
 const struct got_error *got_pack_add_meta(struct got_pack_meta *m,
@@ -115,7 +172,7 @@ const struct got_error *
 got_pack_load_packed_object_ids(int *found_all_objects,
     struct got_object_id **ours, int nours,
     struct got_object_id **theirs, int ntheirs,
-    int want_meta, uint32_t seed, struct got_object_idset *idset,
+    int want_meta, struct got_object_idset *idset,
     struct got_object_idset *idset_exclude, int loose_obj_only,
     struct got_repository *repo, struct got_packidx *packidx,
     int *ncolored, int *nfound, int *ntrees,
@@ -126,7 +183,7 @@ const struct got_error *
 got_pack_load_tree_entries(struct got_object_id_queue *ids, int want_meta,
     struct got_object_idset *idset, struct got_object_idset *idset_exclude,
     struct got_tree_object *tree,
-    const char *dpath, time_t mtime, uint32_t seed, struct got_repository *repo,
+    const char *dpath, time_t mtime, struct got_repository *repo,
     int loose_obj_only, int *ncolored, int *nfound, int *ntrees,
     got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg);
@@ -135,7 +192,7 @@ const struct got_error *
 got_pack_load_tree(int want_meta, struct got_object_idset *idset,
     struct got_object_idset *idset_exclude,
     struct got_object_id *tree_id, const char *dpath, time_t mtime,
-    uint32_t seed, struct got_repository *repo, int loose_obj_only,
+    struct got_repository *repo, int loose_obj_only,
     int *ncolored, int *nfound, int *ntrees,
     got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg);
@@ -143,7 +200,7 @@ got_pack_load_tree(int want_meta, struct got_object_idset *idset,
 const struct got_error *
 got_pack_add_object(int want_meta, struct got_object_idset *idset,
     struct got_object_id *id, const char *path, int obj_type,
-    time_t mtime, uint32_t seed, int loose_obj_only,
+    time_t mtime, int loose_obj_only,
     struct got_repository *repo, int *ncolored, int *nfound, int *ntrees,
     got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl);
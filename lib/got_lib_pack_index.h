@@ -18,11 +18,35 @@ typedef const struct got_error *(got_pack_index_progress_cb)(void *,
     uint32_t nobj_total, uint32_t nobj_indexed, uint32_t nobj_loose,
     uint32_t nobj_resolved);
 
+/*
+ * Provide a delta base which is missing from a thin pack file.
+ * The raw contents of the object, without object header, should be written
+ * to the output file. Return GOT_ERR_NO_OBJ if the object is not available.
+ */
+typedef const struct got_error *(got_pack_index_base_cb)(void *,
+    int *obj_type, off_t *size, FILE *outfile, struct got_object_id *id);
+
 const struct got_error *got_pack_hwrite(int, void *, int, struct got_hash *);
 
+/* Maximum number of threads used to resolve deltas. */
+#define GOT_PACK_INDEX_MAX_THREADS	8
+
+/* Number of objects claimed by a delta resolution thread at a time. */
+#define GOT_PACK_INDEX_THREAD_CHUNK	256
+
+/*
+ * Index a pack file and write the pack index to a file descriptor.
+ * If nthreads is greater than 1, offset deltas in memory-mapped pack files
+ * are resolved by up to nthreads threads. The resulting pack index does not
+ * depend on the number of threads used.
+ * If base_cb is not NULL, a thin pack file is completed by appending delta
+ * bases it provides. The pack file descriptor must then be writable, and
+ * the hash of the completed pack file is returned in pack_hash_expected.
+ */
 const struct got_error *
 got_pack_index(struct got_pack *pack, int idxfd,
     FILE *tmpfile, FILE *delta_base_file, FILE *delta_accum_file,
     struct got_object_id *pack_hash_expected,
+    got_pack_index_base_cb base_cb, void *base_arg,
     got_pack_index_progress_cb progress_cb, void *progress_arg,
-    struct got_ratelimit *rl);
+    struct got_ratelimit *rl, int nthreads);
@@ -17,13 +17,20 @@
 
 #define GOT_PKT_MAX	65536
 
+/* Special packet lengths used by protocol version 2. */
+#define GOT_PKT_DELIM		-1	/* "0001" delimiter packet */
+#define GOT_PKT_RESPONSE_END	-2	/* "0002" response-end packet */
+
 const struct got_error *got_pkt_readn(ssize_t *off, int fd, void *buf,
     size_t n, int timeout);
 const struct got_error *got_pkt_flushpkt(int fd, int chattygot);
+const struct got_error *got_pkt_delimpkt(int fd, int chattygot);
 const struct got_error *got_pkt_readlen(int *len, const char *str, int chattygot);
 const struct got_error *got_pkt_readhdr(int *datalen, int fd, int chattygot,
     int timeout);
 const struct got_error *got_pkt_readpkt(int *outlen, int fd, char *buf,
     int buflen, int chattygot, int timeout);
+const struct got_error *got_pkt_readpkt_v2(int *outlen, int fd, char *buf,
+    int buflen, int chattygot, int timeout);
 const struct got_error *got_pkt_writepkt(int fd, char *buf, int nbuf,
     int chattygot);
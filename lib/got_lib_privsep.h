@@ -116,16 +116,23 @@ enum got_imsg_type {
 	GOT_IMSG_FETCH_HAVE_REF,
 	GOT_IMSG_FETCH_WANTED_BRANCH,
 	GOT_IMSG_FETCH_WANTED_REF,
+	GOT_IMSG_FETCH_SHALLOW,
+	GOT_IMSG_FETCH_WANTED_OBJECT,
 	GOT_IMSG_FETCH_OUTFD,
 	GOT_IMSG_FETCH_SYMREFS,
 	GOT_IMSG_FETCH_REF,
 	GOT_IMSG_FETCH_SERVER_PROGRESS,
 	GOT_IMSG_FETCH_DOWNLOAD_PROGRESS,
+	GOT_IMSG_FETCH_SHALLOW_UPDATE,
+	GOT_IMSG_FETCH_HAVE_REQUEST,
+	GOT_IMSG_FETCH_COMMON,
 	GOT_IMSG_FETCH_DONE,
 	GOT_IMSG_IDXPACK_REQUEST,
 	GOT_IMSG_IDXPACK_OUTFD,
 	GOT_IMSG_IDXPACK_PROGRESS,
 	GOT_IMSG_IDXPACK_DONE,
+	GOT_IMSG_IDXPACK_BASE_REQUEST,
+	GOT_IMSG_IDXPACK_BASE,
 	GOT_IMSG_SEND_REQUEST,
 	GOT_IMSG_SEND_REF,
 	GOT_IMSG_SEND_REMOTE_REF,
@@ -148,6 +155,9 @@ enum got_imsg_type {
 	GOT_IMSG_TREE_ENUMERATION_DONE,
 	GOT_IMSG_OBJECT_ENUMERATION_DONE,
 	GOT_IMSG_OBJECT_ENUMERATION_INCOMPLETE,
+	GOT_IMSG_COMMIT_GRAPH,
+	GOT_IMSG_PACKIDX_REV,
+	GOT_IMSG_OBJECT_SHM,
 
 	/* Message sending file descriptor to a temporary file. */
 	GOT_IMSG_TMPFD,
@@ -174,6 +184,9 @@ enum got_imsg_type {
 	GOT_IMSG_GOTCONFIG_REVOKEDSIGNERS_REQUEST,
 	GOT_IMSG_GOTCONFIG_SIGNERID_REQUEST,
 	GOT_IMSG_GOTCONFIG_REMOTES_REQUEST,
+	GOT_IMSG_GOTCONFIG_PACK_WINDOW_REQUEST,
+	GOT_IMSG_GOTCONFIG_PACK_DEPTH_REQUEST,
+	GOT_IMSG_GOTCONFIG_PACK_MEMSIZE_REQUEST,
 	GOT_IMSG_GOTCONFIG_INT_VAL,
 	GOT_IMSG_GOTCONFIG_STR_VAL,
 	GOT_IMSG_GOTCONFIG_REMOTES,
@@ -283,8 +296,12 @@ struct got_imsg_tree_object {
 struct got_imsg_blob {
 	size_t size;
 	size_t hdrlen;
+	int flags;
+#define GOT_IMSG_BLOB_F_SHM	0x01
 
 	/*
+	 * If GOT_IMSG_BLOB_F_SHM is set, blob data has been written to
+	 * shared memory passed via the GOT_IMSG_OBJECT_SHM imsg.
 	 * If size <= GOT_PRIVSEP_INLINE_BLOB_DATA_MAX, blob data follows
 	 * in the imsg buffer. Otherwise, blob data has been written to a
 	 * file descriptor passed via the GOT_IMSG_BLOB_OUTFD imsg.
@@ -297,8 +314,12 @@ struct got_imsg_blob {
 struct got_imsg_raw_obj {
 	off_t size;
 	size_t hdrlen;
+	int flags;
+#define GOT_IMSG_RAW_OBJ_F_SHM	0x01
 
 	/*
+	 * If GOT_IMSG_RAW_OBJ_F_SHM is set, object data has been written to
+	 * shared memory passed via the GOT_IMSG_OBJECT_SHM imsg.
 	 * If size <= GOT_PRIVSEP_INLINE_OBJECT_DATA_MAX, object data follows
 	 * in the imsg buffer. Otherwise, object data has been written to a
 	 * file descriptor passed via the GOT_IMSG_RAW_OBJECT_OUTFD imsg.
@@ -307,6 +328,18 @@ struct got_imsg_raw_obj {
 	(MAX_IMSGSIZE - IMSG_HEADER_SIZE - sizeof(struct got_imsg_raw_obj))
 };
 
+/*
+ * Size of shared memory which a pack child may use to transfer object data.
+ * Objects which are larger than this are transferred via temporary files.
+ */
+#define GOT_PRIVSEP_SHM_SIZE	(1024 * 1024)
+
+/*
+ * Maximum number of object requests which may be sent to a pack child
+ * before its replies are read back.
+ */
+#define GOT_PRIVSEP_MAX_PIPELINED_REQUESTS	32
+
 /* Structure for GOT_IMSG_RAW_DELTA. */
 struct got_imsg_raw_delta {
 	struct got_object_id base_id;
@@ -410,11 +443,37 @@ struct got_imsg_fetch_request {
 	size_t n_have_refs;
 	size_t n_wanted_branches;
 	size_t n_wanted_refs;
+	int depth;
+	size_t n_shallow;
+	size_t filter_len;
+	size_t n_wanted_objects;
+	int stateless; /* transport cannot keep state across requests */
 	/* Followed by worktree_branch_len bytes of reference name. */
 	/* Followed by remote_head_len bytes of reference name. */
+	/* Followed by filter_len bytes of object filter specification. */
 	/* Followed by n_have_refs GOT_IMSG_FETCH_HAVE_REF messages. */
 	/* Followed by n_wanted_branches times GOT_IMSG_FETCH_WANTED_BRANCH. */
 	/* Followed by n_wanted_refs times GOT_IMSG_FETCH_WANTED_REF. */
+	/* Followed by n_shallow times GOT_IMSG_FETCH_SHALLOW. */
+	/* Followed by n_wanted_objects times GOT_IMSG_FETCH_WANTED_OBJECT. */
+} __attribute__((__packed__));
+
+/*
+ * Structure for GOT_IMSG_FETCH_SHALLOW data.
+ * Describes a shallow commit in the local repository.
+ */
+struct got_imsg_fetch_shallow {
+	struct got_object_id id;
+} __attribute__((__packed__));
+
+/*
+ * Structure for GOT_IMSG_FETCH_WANTED_OBJECT data.
+ * Describes an object missing from a partial clone. If any such objects
+ * are sent then references are not matched and only these objects are
+ * requested from the server.
+ */
+struct got_imsg_fetch_wanted_object {
+	struct got_object_id id;
 } __attribute__((__packed__));
 
 /* Structures for GOT_IMSG_FETCH_SYMREFS data. */
@@ -440,6 +499,31 @@ struct got_imsg_fetch_ref {
 	/* Followed by reference name in remaining data of imsg buffer. */
 };
 
+/* Structure for GOT_IMSG_FETCH_SHALLOW_UPDATE data. */
+struct got_imsg_fetch_shallow_update {
+	/* Commit which the server made shallow, or no longer shallow. */
+	struct got_object_id id;
+	int unshallow;
+};
+
+/*
+ * Structure for GOT_IMSG_FETCH_HAVE_REQUEST data.
+ * The parent process replies with up to max_haves commit IDs to announce
+ * to the server, using GOT_IMSG_OBJ_ID_LIST and GOT_IMSG_OBJ_ID_LIST_DONE.
+ * An empty list means that no further commits are left to announce.
+ */
+struct got_imsg_fetch_have_request {
+	int max_haves;
+};
+
+/*
+ * Structure for GOT_IMSG_FETCH_COMMON data.
+ * Announces a commit which the server has acknowledged as common.
+ */
+struct got_imsg_fetch_common {
+	struct got_object_id id;
+};
+
 /* Structure for GOT_IMSG_FETCH_DOWNLOAD_PROGRESS data. */
 struct got_imsg_fetch_download_progress {
 	/* Number of packfile data bytes downloaded so far. */
@@ -474,6 +558,11 @@ struct got_imsg_send_remote_ref {
 	/* Followed by name_len data bytes. */
 } __attribute__((__packed__));
 
+/* Structure for GOT_IMSG_SEND_PACK_REQUEST data. */
+struct got_imsg_send_pack_request {
+	int allow_thin;
+} __attribute__((__packed__));
+
 /* Structure for GOT_IMSG_SEND_REF_STATUS data. */
 struct got_imsg_send_ref_status {
 	int success;
@@ -486,6 +575,18 @@ struct got_imsg_send_ref_status {
 /* Structure for GOT_IMSG_IDXPACK_REQUEST data. */
 struct got_imsg_index_pack_request {
 	struct got_object_id id;
+	int fix_thin;
+	int nthreads; /* 0 means one thread per online CPU */
+} __attribute__((__packed__));
+
+/*
+ * Structure for GOT_IMSG_IDXPACK_BASE data, sent in response to
+ * GOT_IMSG_IDXPACK_BASE_REQUEST which contains a struct got_object_id.
+ */
+struct got_imsg_index_pack_base {
+	int obj_type;
+	off_t size;
+	/* Raw object contents are passed via a file descriptor. */
 } __attribute__((__packed__));
 
 /* Structure for GOT_IMSG_IDXPACK_PROGRESS data. */
@@ -615,9 +716,11 @@ struct got_imsg_remote {
 	int nfetch_branches;
 	int nsend_branches;
 	int nfetch_refs;
+	size_t fetch_filter_len;
 
 	/* Followed by name_len data bytes. */
 	/* Followed by fetch_url_len + send_url_len data bytes. */
+	/* Followed by fetch_filter_len data bytes. */
 	/* Followed by nfetch_branches GOT_IMSG_GITCONFIG_STR_VAL messages. */
 	/* Followed by nsend_branches GOT_IMSG_GITCONFIG_STR_VAL messages. */
 	/* Followed by nfetch_refs GOT_IMSG_GITCONFIG_STR_VAL messages. */
@@ -691,25 +794,33 @@ const struct got_error *got_privsep_send_blob_req(struct imsgbuf *, int,
     struct got_object_id *, int);
 const struct got_error *got_privsep_send_blob_outfd(struct imsgbuf *, int);
 const struct got_error *got_privsep_send_tmpfd(struct imsgbuf *, int);
+const struct got_error *got_privsep_send_commit_graph(struct imsgbuf *, int);
+const struct got_error *got_privsep_send_object_shm(struct imsgbuf *, int);
 const struct got_error *got_privsep_send_obj(struct imsgbuf *,
     struct got_object *);
 const struct got_error *got_privsep_send_index_pack_req(struct imsgbuf *,
-    struct got_object_id *, int);
+    struct got_object_id *, int, int, int);
 const struct got_error *got_privsep_send_index_pack_outfd(struct imsgbuf *,
     int);
 const struct got_error *got_privsep_recv_index_progress(int *, int *, int *,
-    int *, int *, struct imsgbuf *ibuf);
+    int *, int *, struct got_object_id *, struct got_object_id **,
+    struct imsgbuf *ibuf);
+const struct got_error *got_privsep_send_index_pack_base(struct imsgbuf *,
+    int, off_t, int);
 const struct got_error *got_privsep_send_fetch_req(struct imsgbuf *, int,
     struct got_pathlist_head *, int, struct got_pathlist_head *,
-    struct got_pathlist_head *, int, const char *, const char *, int, int);
+    struct got_pathlist_head *, int, const char *, const char *, int, int,
+    int, struct got_object_id *, size_t, const char *, struct got_object_id *,
+    size_t, int);
 const struct got_error *got_privsep_send_fetch_outfd(struct imsgbuf *, int);
 const struct got_error *got_privsep_recv_fetch_progress(int *,
     struct got_object_id **, char **, struct got_pathlist_head *, char **,
-    off_t *, uint8_t *, struct imsgbuf *);
+    off_t *, uint8_t *, struct got_object_id **, int *,
+    struct got_object_id **, int *, struct imsgbuf *);
 const struct got_error *got_privsep_send_send_req(struct imsgbuf *, int,
     struct got_pathlist_head *, struct got_pathlist_head *, int);
 const struct got_error *got_privsep_recv_send_remote_refs(
-    struct got_pathlist_head *, struct imsgbuf *);
+    struct got_pathlist_head *, int *, struct imsgbuf *);
 const struct got_error *got_privsep_send_packfd(struct imsgbuf *, int);
 const struct got_error *got_privsep_recv_send_progress(int *, off_t *,
     int *, char **, char **, struct imsgbuf *);
@@ -719,8 +830,10 @@ const struct got_error *got_privsep_recv_obj(struct got_object **,
     struct imsgbuf *);
 const struct got_error *got_privsep_send_raw_obj(struct imsgbuf *, off_t,
     size_t, uint8_t *);
+const struct got_error *got_privsep_send_raw_obj_shm(struct imsgbuf *, off_t,
+    size_t);
 const struct got_error *got_privsep_recv_raw_obj(uint8_t **, off_t *, size_t *,
-    struct imsgbuf *);
+    struct imsgbuf *, const uint8_t *, size_t);
 const struct got_error *got_privsep_send_commit(struct imsgbuf *,
     struct got_commit_object *);
 const struct got_error *got_privsep_recv_commit(struct got_commit_object **,
@@ -732,8 +845,10 @@ const struct got_error *got_privsep_send_tree(struct imsgbuf *,
     struct got_parsed_tree_entry *, int);
 const struct got_error *got_privsep_send_blob(struct imsgbuf *, size_t, size_t,
     const uint8_t *);
+const struct got_error *got_privsep_send_blob_shm(struct imsgbuf *, size_t,
+    size_t);
 const struct got_error *got_privsep_recv_blob(uint8_t **, size_t *, size_t *,
-    struct imsgbuf *);
+    struct imsgbuf *, const uint8_t *, size_t);
 const struct got_error *got_privsep_send_tag(struct imsgbuf *,
     struct got_tag_object *);
 const struct got_error *got_privsep_recv_tag(struct got_tag_object **,
@@ -778,8 +893,16 @@ const struct got_error *got_privsep_send_gotconfig_signer_id_req(
     struct imsgbuf *);
 const struct got_error *got_privsep_send_gotconfig_remotes_req(
     struct imsgbuf *);
+const struct got_error *got_privsep_send_gotconfig_pack_window_req(
+    struct imsgbuf *);
+const struct got_error *got_privsep_send_gotconfig_pack_depth_req(
+    struct imsgbuf *);
+const struct got_error *got_privsep_send_gotconfig_pack_memsize_req(
+    struct imsgbuf *);
 const struct got_error *got_privsep_recv_gotconfig_str(char **,
     struct imsgbuf *);
+const struct got_error *got_privsep_recv_gotconfig_int(int64_t *,
+    struct imsgbuf *);
 const struct got_error *got_privsep_recv_gotconfig_remotes(
     struct got_remote_repo **, int *, struct imsgbuf *);
 
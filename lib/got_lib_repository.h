@@ -27,6 +27,7 @@
 #define GOT_ORIG_HEAD_FILE	"ORIG_HEAD"
 #define GOT_OBJECTS_PACK_DIR	"objects/pack"
 #define GOT_PACKED_REFS_FILE	"packed-refs"
+#define GOT_SHALLOW_FILE	"shallow"
 
 #define GOT_PACK_CACHE_SIZE	32
 
@@ -41,9 +42,43 @@ struct got_packidx_bloom_filter {
 	RB_ENTRY(got_packidx_bloom_filter) entry;
 	char path[PATH_MAX]; /* on-disk path */
 	size_t path_len;
-	struct bloom *bloom;
+	struct bloom *bloom; /* NULL if this pack index must be searched */
+	uint8_t *map;	/* mapped bloom filter file, if any */
+	size_t maplen;
 };
 
+/*
+ * Bloom filters for pack index files are written to files which are stored
+ * alongside pack index files, with a .bloom extension instead of .idx.
+ * This avoids reading every object ID from each pack index file in order
+ * to build bloom filters in memory when a repository is opened.
+ *
+ * The file begins with a header which is followed by the filter's bit array.
+ * The bit positions depend on the host's byte order, which is recorded in
+ * the header. Files written on a host with a different byte order are ignored.
+ *
+ * The bit array is followed by the checksum of the pack file the filter
+ * was built for, and by a checksum of all preceding data in the file.
+ * Files which belong to a different pack file or which fail verification
+ * are ignored.
+ */
+#define GOT_PACKIDX_BLOOM_SIGNATURE	0x474f5442 /* 'G' 'O' 'T' 'B' */
+#define GOT_PACKIDX_BLOOM_VERSION	2
+#define GOT_PACKIDX_BLOOM_BYTE_ORDER	0x01020304 /* stored in host order */
+#define GOT_PACKIDX_BLOOM_ERROR_RATE	0.1
+
+struct got_packidx_bloom_hdr {
+	uint32_t signature;	/* big endian */
+	uint8_t version;
+	uint8_t digest_len;	/* length of object IDs in the filter */
+	uint8_t reserved[2];
+	uint32_t byte_order;	/* host order */
+	uint32_t nobjects;	/* big endian */
+	uint32_t bits;		/* big endian */
+	uint32_t hashes;	/* big endian */
+	uint32_t seed;		/* big endian */
+} __attribute__((__packed__));
+
 RB_HEAD(got_packidx_bloom_filter_tree, got_packidx_bloom_filter);
 
 static inline int
@@ -53,6 +88,10 @@ got_packidx_bloom_filter_cmp(const struct got_packidx_bloom_filter *f1,
 	return got_path_cmp(f1->path, f2->path, f1->path_len, f2->path_len);
 }
 
+struct got_commit_graph_file;
+struct got_multi_pack_index;
+struct got_object_idset;
+
 struct got_repo_privsep_child {
 	int imsg_fd;
 	pid_t pid;
@@ -137,6 +176,40 @@ struct got_repository {
 
 	/* cleanup lockfile */
 	struct got_lockfile *cleanup_lock;
+
+	/*
+	 * Commit-graph file, opened on demand. The commit_graph_checked
+	 * flag is set once we have tried to open this file.
+	 */
+	struct got_commit_graph_file *commit_graph;
+	int commit_graph_checked;
+
+	/*
+	 * Commits listed in the shallow file, read on demand. The parents
+	 * of these commits are missing from the repository. The
+	 * shallow_checked flag is set once we have tried to read this file.
+	 */
+	struct got_object_idset *shallow_commits;
+	int shallow_checked;
+
+	/*
+	 * If this repository is a partial clone, objects may be missing.
+	 * These can be obtained from the promisor remote via the callback.
+	 */
+	const char *promisor_remote;
+	const struct got_error *(*fetch_missing_cb)(void *,
+	    struct got_repository *, struct got_object_id *, int);
+	void *fetch_missing_arg;
+
+	/*
+	 * Multi-pack-index file, opened on demand and reopened whenever
+	 * the list of pack files changes. The midx_complete flag is set
+	 * if all pack files in the repository are covered by this file,
+	 * and is -1 if this has not been checked yet.
+	 */
+	struct got_multi_pack_index *midx;
+	int midx_checked;
+	int midx_complete;
 };
 
 const struct got_error*got_repo_cache_object(struct got_repository *,
@@ -162,6 +235,10 @@ struct got_raw_object *got_repo_get_cached_raw_object(struct got_repository *,
 int got_repo_is_packidx_filename(const char *, size_t, enum got_hash_algorithm);
 int got_repo_check_packidx_bloom_filter(struct got_repository *,
     const char *, struct got_object_id *);
+const struct got_error *got_repo_write_packidx_bloom_filter(
+    struct got_repository *, struct got_object_id *);
+const struct got_error *got_repo_write_packidx_reverse_index(
+    struct got_repository *, struct got_object_id *);
 const struct got_error *got_repo_search_packidx(struct got_packidx **, int *,
     struct got_repository *, struct got_object_id *);
 const struct got_error *got_repo_list_packidx(struct got_pathlist_head *,
@@ -187,3 +264,31 @@ void got_repo_temp_fds_put(int, struct got_repository *);
 
 const struct got_error *got_repo_find_object_id(struct got_object_id *,
     struct got_repository *);
+
+const struct got_error *got_repo_get_commit_graph_file(
+    struct got_commit_graph_file **, struct got_repository *);
+
+/*
+ * Obtain the set of shallow commits of a repository, or NULL if the
+ * repository has a complete history.
+ */
+const struct got_error *got_repo_get_shallow_commits(
+    struct got_object_idset **, struct got_repository *);
+
+/* Report whether history traversal must stop at the given commit. */
+const struct got_error *got_repo_is_shallow_commit(int *,
+    struct got_repository *, struct got_object_id *);
+
+/*
+ * Attempt to obtain objects which are missing from a partial clone.
+ * Return GOT_ERR_NO_OBJ for the first object if this is not possible.
+ */
+const struct got_error *got_repo_fetch_missing_objects(
+    struct got_repository *, struct got_object_id *, int);
+
+/*
+ * Replace the repository's list of shallow commits.
+ * The shallow file is removed if the set is empty.
+ */
+const struct got_error *got_repo_write_shallow_commits(
+    struct got_repository *, struct got_object_idset *);
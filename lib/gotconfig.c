@@ -85,3 +85,21 @@ got_gotconfig_get_signer_id(const struct got_gotconfig *conf)
 {
 	return conf->signer_id;
 }
+
+int
+got_gotconfig_get_pack_window(const struct got_gotconfig *conf)
+{
+	return conf->pack_window;
+}
+
+int
+got_gotconfig_get_pack_depth(const struct got_gotconfig *conf)
+{
+	return conf->pack_depth;
+}
+
+size_t
+got_gotconfig_get_pack_memsize(const struct got_gotconfig *conf)
+{
+	return conf->pack_memsize;
+}
@@ -372,22 +372,35 @@ got_inflate_to_mem_fd(uint8_t **outbuf, size_t *outlen,
 	size_t avail, consumed;
 	struct got_inflate_buf zb;
 	void *newbuf;
-	int nbuf = 1;
-	size_t bufsize = GOT_INFLATE_BUFSIZE;
+	size_t bufsize = GOT_INFLATE_BUFSIZE, outsize = GOT_INFLATE_BUFSIZE;
+
+	if (expected_size > UINT_MAX)
+		expected_size = 0;
 
 	/* Optimize buffer size in case short reads should suffice. */
 	if (expected_size > 0 && expected_size < bufsize)
 		bufsize = expected_size;
 
+	/* Inflate into a buffer of the expected size if it is known. */
+	if (expected_size > 0)
+		outsize = expected_size;
+
 	if (outbuf) {
-		*outbuf = malloc(bufsize);
+		*outbuf = malloc(outsize);
 		if (*outbuf == NULL)
 			return got_error_from_errno("malloc");
-		err = got_inflate_init(&zb, *outbuf, GOT_INFLATE_BUFSIZE, csum);
-	} else
+		err = got_inflate_init(&zb, *outbuf, bufsize, csum);
+		if (err) {
+			free(*outbuf);
+			*outbuf = NULL;
+			return err;
+		}
+		zb.outlen = outsize;
+	} else {
 		err = got_inflate_init(&zb, NULL, bufsize, csum);
-	if (err)
-		goto done;
+		if (err)
+			return err;
+	}
 
 	*outlen = 0;
 	if (consumed_total)
@@ -403,18 +416,23 @@ got_inflate_to_mem_fd(uint8_t **outbuf, size_t *outlen,
 		if (zb.flags & GOT_INFLATE_F_HAVE_MORE) {
 			if (outbuf == NULL)
 				continue;
-			newbuf = reallocarray(*outbuf, ++nbuf,
-			    GOT_INFLATE_BUFSIZE);
+			if (*outlen < outsize) {
+				zb.outbuf = *outbuf + *outlen;
+				zb.outlen = outsize - *outlen;
+				continue;
+			}
+			newbuf = realloc(*outbuf, outsize + GOT_INFLATE_BUFSIZE);
 			if (newbuf == NULL) {
-				err = got_error_from_errno("reallocarray");
+				err = got_error_from_errno("realloc");
 				free(*outbuf);
 				*outbuf = NULL;
 				*outlen = 0;
 				goto done;
 			}
 			*outbuf = newbuf;
+			outsize += GOT_INFLATE_BUFSIZE;
 			zb.outbuf = newbuf + *outlen;
-			zb.outlen = (nbuf * GOT_INFLATE_BUFSIZE) - *outlen;
+			zb.outlen = outsize - *outlen;
 		}
 	} while (zb.flags & GOT_INFLATE_F_HAVE_MORE);
 
@@ -423,10 +441,93 @@ done:
 	return err;
 }
 
+/*
+ * Inflate an object of known size from mapped memory. The whole input is
+ * available, so the object can be decoded with a single call to inflate(),
+ * straight into an output buffer of the expected size. The buffer is only
+ * grown if the object turns out to be larger than expected.
+ */
+static const struct got_error *
+inflate_to_mem_mmap_sized(uint8_t **outbuf, size_t *outlen,
+    size_t *consumed_total, struct got_inflate_checksum *csum,
+    size_t expected_size, uint8_t *map, size_t offset, size_t len)
+{
+	const struct got_error *err = NULL;
+	z_stream z;
+	uint8_t *buf, *newbuf;
+	size_t bufsize = expected_size, consumed = 0;
+	int zerr, ret;
+
+	*outbuf = NULL;
+	*outlen = 0;
+	if (consumed_total)
+		*consumed_total = 0;
+
+	buf = malloc(bufsize);
+	if (buf == NULL)
+		return got_error_from_errno("malloc");
+
+	memset(&z, 0, sizeof(z));
+	z.zalloc = Z_NULL;
+	z.zfree = Z_NULL;
+	zerr = inflateInit(&z);
+	if (zerr != Z_OK) {
+		free(buf);
+		return wrap_inflate_error(zerr, "inflateInit");
+	}
+
+	z.next_out = buf;
+	z.avail_out = bufsize;
+	for (;;) {
+		if (z.avail_in == 0) {
+			if (consumed == len) {
+				err = got_error(GOT_ERR_DECOMPRESSION);
+				goto done;
+			}
+			z.next_in = map + offset + consumed;
+			z.avail_in = MIN(len - consumed, UINT_MAX);
+			consumed += z.avail_in;
+		}
+		if (z.avail_out == 0) {
+			newbuf = realloc(buf, bufsize + GOT_INFLATE_BUFSIZE);
+			if (newbuf == NULL) {
+				err = got_error_from_errno("realloc");
+				goto done;
+			}
+			buf = newbuf;
+			z.next_out = buf + bufsize;
+			z.avail_out = GOT_INFLATE_BUFSIZE;
+			bufsize += GOT_INFLATE_BUFSIZE;
+		}
+
+		ret = inflate(&z, Z_FINISH);
+		if (ret == Z_STREAM_END)
+			break;
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			err = wrap_inflate_error(ret, "inflate");
+			goto done;
+		}
+	}
+
+	if (csum) {
+		csum_input(csum, map + offset, z.total_in);
+		csum_output(csum, buf, z.total_out);
+	}
+	*outbuf = buf;
+	*outlen = z.total_out;
+	if (consumed_total)
+		*consumed_total = z.total_in;
+done:
+	if (err)
+		free(buf);
+	inflateEnd(&z);
+	return err;
+}
+
 const struct got_error *
 got_inflate_to_mem_mmap(uint8_t **outbuf, size_t *outlen,
-    size_t *consumed_total, struct got_inflate_checksum *csum, uint8_t *map,
-    size_t offset, size_t len)
+    size_t *consumed_total, struct got_inflate_checksum *csum,
+    size_t expected_size, uint8_t *map, size_t offset, size_t len)
 {
 	const struct got_error *err;
 	size_t avail, consumed;
@@ -434,6 +535,11 @@ got_inflate_to_mem_mmap(uint8_t **outbuf, size_t *outlen,
 	void *newbuf;
 	int nbuf = 1;
 
+	if (outbuf && expected_size > 0 && expected_size <= UINT_MAX) {
+		return inflate_to_mem_mmap_sized(outbuf, outlen,
+		    consumed_total, csum, expected_size, map, offset, len);
+	}
+
 	if (outbuf) {
 		*outbuf = malloc(GOT_INFLATE_BUFSIZE);
 		if (*outbuf == NULL)
@@ -487,6 +593,63 @@ done:
 	return err;
 }
 
+/*
+ * Inflate data from a memory-mapped file into a caller-provided buffer.
+ * Return GOT_ERR_NO_SPACE if the inflated data does not fit into the buffer.
+ */
+const struct got_error *
+got_inflate_to_buf_mmap(uint8_t *buf, size_t bufsize, size_t *outlen,
+    uint8_t *map, size_t offset, size_t len)
+{
+	const struct got_error *err = NULL;
+	z_stream z;
+	size_t consumed = 0;
+	int zerr, ret;
+
+	*outlen = 0;
+
+	if (bufsize > UINT_MAX)
+		bufsize = UINT_MAX;
+
+	memset(&z, 0, sizeof(z));
+	z.zalloc = Z_NULL;
+	z.zfree = Z_NULL;
+	zerr = inflateInit(&z);
+	if (zerr != Z_OK)
+		return wrap_inflate_error(zerr, "inflateInit");
+
+	z.next_out = buf;
+	z.avail_out = bufsize;
+	for (;;) {
+		if (z.avail_in == 0) {
+			if (consumed == len) {
+				err = got_error(GOT_ERR_DECOMPRESSION);
+				goto done;
+			}
+			z.next_in = map + offset + consumed;
+			z.avail_in = MIN(len - consumed, UINT_MAX);
+			consumed += z.avail_in;
+		}
+
+		ret = inflate(&z, Z_FINISH);
+		if (ret == Z_STREAM_END)
+			break;
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			err = wrap_inflate_error(ret, "inflate");
+			goto done;
+		}
+		if (z.avail_out == 0) {
+			err = got_error(GOT_ERR_NO_SPACE);
+			goto done;
+		}
+	}
+
+	*outlen = z.total_out;
+done:
+	inflateEnd(&z);
+	return err;
+}
+
 const struct got_error *
 got_inflate_to_fd(size_t *outlen, FILE *infile,
     struct got_inflate_checksum *csum, int outfd)
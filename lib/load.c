@@ -485,7 +485,7 @@ got_repo_load(FILE *in, struct got_pathlist_head *refs_found,
 	}
 	imsgbuf_allow_fdpass(&idxibuf);
 
-	err = got_privsep_send_index_pack_req(&idxibuf, &id, packfd);
+	err = got_privsep_send_index_pack_req(&idxibuf, &id, 0, 0, packfd);
 	if (err)
 		goto done;
 	packfd = -1;
@@ -507,7 +507,8 @@ got_repo_load(FILE *in, struct got_pathlist_head *refs_found,
 		int nobj_total, nobj_indexed, nobj_loose, nobj_resolved;
 
 		err = got_privsep_recv_index_progress(&done, &nobj_total,
-		    &nobj_indexed, &nobj_loose, &nobj_resolved, &idxibuf);
+		    &nobj_indexed, &nobj_loose, &nobj_resolved, NULL, NULL,
+		    &idxibuf);
 		if (err)
 			goto done;
 		if (nobj_indexed != 0) {
@@ -561,6 +562,11 @@ got_repo_load(FILE *in, struct got_pathlist_head *refs_found,
 	free(tmpidxpath);
 	tmpidxpath = NULL;
 
+	err = got_repo_write_packidx_bloom_filter(repo, &id);
+	if (err)
+		goto done;
+	err = got_repo_write_packidx_reverse_index(repo, &id);
+
  done:
 	if (idxibuf.w)
 		imsgbuf_clear(&idxibuf);
@@ -0,0 +1,616 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "got_compat.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "got_error.h"
+#include "got_object.h"
+
+#include "got_lib_delta.h"
+#include "got_lib_hash.h"
+#include "got_lib_object.h"
+#include "got_lib_pack.h"
+#include "got_lib_multi_pack_index.h"
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+
+static uint32_t
+get_be32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be32toh(val);
+}
+
+static uint64_t
+get_be64(const uint8_t *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be64toh(val);
+}
+
+static const struct got_error *
+read_midx(uint8_t **buf, int fd, size_t len)
+{
+	ssize_t r;
+	size_t off = 0;
+
+	*buf = malloc(len);
+	if (*buf == NULL)
+		return got_error_from_errno("malloc");
+
+	while (off < len) {
+		r = read(fd, *buf + off, len - off);
+		if (r == -1) {
+			free(*buf);
+			*buf = NULL;
+			return got_error_from_errno("read");
+		}
+		if (r == 0) {
+			free(*buf);
+			*buf = NULL;
+			return got_error(GOT_ERR_BAD_MIDX);
+		}
+		off += r;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+parse_pack_names(struct got_multi_pack_index *midx, uint8_t *pnam,
+    uint64_t size)
+{
+	uint8_t *p = pnam, *end = pnam + size, *nul;
+	uint32_t i;
+
+	midx->pack_names = calloc(midx->npacks ? midx->npacks : 1,
+	    sizeof(*midx->pack_names));
+	if (midx->pack_names == NULL)
+		return got_error_from_errno("calloc");
+
+	for (i = 0; i < midx->npacks; i++) {
+		nul = memchr(p, '\0', end - p);
+		if (nul == NULL || nul == p)
+			return got_error(GOT_ERR_BAD_MIDX);
+
+		/* Pack names are used as path components. */
+		if (memchr(p, '/', nul - p) != NULL)
+			return got_error(GOT_ERR_BAD_MIDX);
+
+		midx->pack_names[i] = (const char *)p;
+		if (i > 0 && strcmp(midx->pack_names[i - 1],
+		    midx->pack_names[i]) >= 0)
+			return got_error(GOT_ERR_BAD_MIDX);
+		p = nul + 1;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+parse_chunks(struct got_multi_pack_index *midx)
+{
+	const struct got_error *err;
+	size_t digest_len = got_hash_digest_length(midx->algo);
+	uint8_t hash_version, nchunks;
+	uint64_t pnam_size = 0, oidl_size = 0, ooff_size = 0, loff_size = 0;
+	uint8_t *p, *pnam = NULL;
+	uint32_t i, pack_id;
+
+	if (midx->len < GOT_MIDX_HDR_SIZE + digest_len)
+		return got_error(GOT_ERR_BAD_MIDX);
+
+	p = midx->map;
+	if (get_be32(p) != GOT_MIDX_SIGNATURE)
+		return got_error(GOT_ERR_BAD_MIDX);
+	if (p[4] != GOT_MIDX_VERSION)
+		return got_error(GOT_ERR_BAD_MIDX);
+
+	hash_version = p[5];
+	switch (midx->algo) {
+	case GOT_HASH_SHA1:
+		if (hash_version != GOT_MIDX_HASH_SHA1)
+			return got_error(GOT_ERR_BAD_MIDX);
+		break;
+	case GOT_HASH_SHA256:
+		if (hash_version != GOT_MIDX_HASH_SHA256)
+			return got_error(GOT_ERR_BAD_MIDX);
+		break;
+	default:
+		return got_error(GOT_ERR_OBJECT_FORMAT);
+	}
+
+	nchunks = p[6];
+
+	/* We do not support incremental multi-pack-index chains. */
+	if (p[7] != 0)
+		return got_error(GOT_ERR_BAD_MIDX);
+
+	midx->npacks = get_be32(p + 8);
+
+	if (midx->len < GOT_MIDX_HDR_SIZE +
+	    (nchunks + 1) * GOT_MIDX_CHUNK_ENTRY_SIZE + digest_len)
+		return got_error(GOT_ERR_BAD_MIDX);
+
+	p = midx->map + GOT_MIDX_HDR_SIZE;
+	for (i = 0; i < nchunks; i++) {
+		uint32_t chunk_id = get_be32(p);
+		uint64_t offset = get_be64(p + 4);
+		uint64_t next_offset;
+		uint64_t size;
+
+		p += GOT_MIDX_CHUNK_ENTRY_SIZE;
+		next_offset = get_be64(p + 4);
+		if (offset > next_offset ||
+		    next_offset > midx->len - digest_len)
+			return got_error(GOT_ERR_BAD_MIDX);
+		size = next_offset - offset;
+
+		switch (chunk_id) {
+		case GOT_MIDX_CHUNK_PNAM:
+			pnam = midx->map + offset;
+			pnam_size = size;
+			break;
+		case GOT_MIDX_CHUNK_OIDF:
+			if (size != 256 * sizeof(uint32_t))
+				return got_error(GOT_ERR_BAD_MIDX);
+			midx->fanout = (uint32_t *)(midx->map + offset);
+			break;
+		case GOT_MIDX_CHUNK_OIDL:
+			midx->oids = midx->map + offset;
+			oidl_size = size;
+			break;
+		case GOT_MIDX_CHUNK_OOFF:
+			midx->offsets = (uint32_t *)(midx->map + offset);
+			ooff_size = size;
+			break;
+		case GOT_MIDX_CHUNK_LOFF:
+			midx->large_offsets = (uint64_t *)(midx->map + offset);
+			loff_size = size;
+			break;
+		default:
+			/* Ignore chunks we do not know about. */
+			break;
+		}
+	}
+
+	if (pnam == NULL || midx->fanout == NULL || midx->oids == NULL ||
+	    midx->offsets == NULL)
+		return got_error(GOT_ERR_BAD_MIDX);
+
+	for (i = 1; i < 256; i++) {
+		if (get_be32((uint8_t *)&midx->fanout[i]) <
+		    get_be32((uint8_t *)&midx->fanout[i - 1]))
+			return got_error(GOT_ERR_BAD_MIDX);
+	}
+
+	midx->nobjects = get_be32((uint8_t *)&midx->fanout[0xff]);
+	if (oidl_size != (uint64_t)midx->nobjects * digest_len ||
+	    ooff_size != (uint64_t)midx->nobjects * 2 * sizeof(uint32_t))
+		return got_error(GOT_ERR_BAD_MIDX);
+
+	if (loff_size % sizeof(uint64_t))
+		return got_error(GOT_ERR_BAD_MIDX);
+	midx->nlarge_offsets = loff_size / sizeof(uint64_t);
+
+	err = parse_pack_names(midx, pnam, pnam_size);
+	if (err)
+		return err;
+
+	/* Ensure that lookups will not have to check pack IDs. */
+	for (i = 0; i < midx->nobjects; i++) {
+		pack_id = get_be32((uint8_t *)&midx->offsets[i * 2]);
+		if (pack_id >= midx->npacks)
+			return got_error(GOT_ERR_BAD_MIDX);
+	}
+
+	return NULL;
+}
+
+const struct got_error *
+got_multi_pack_index_open(struct got_multi_pack_index **midxp, int fd,
+    enum got_hash_algorithm algo)
+{
+	const struct got_error *err = NULL;
+	struct got_multi_pack_index *midx;
+	struct stat sb;
+
+	*midxp = NULL;
+
+	midx = calloc(1, sizeof(*midx));
+	if (midx == NULL) {
+		err = got_error_from_errno("calloc");
+		close(fd);
+		return err;
+	}
+	midx->fd = fd;
+	midx->algo = algo;
+
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno("fstat");
+		goto done;
+	}
+	if (sb.st_size <= 0 || (uintmax_t)sb.st_size > SIZE_MAX) {
+		err = got_error(GOT_ERR_BAD_MIDX);
+		goto done;
+	}
+	midx->len = sb.st_size;
+
+#ifndef GOT_PACK_NO_MMAP
+	midx->map = mmap(NULL, midx->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (midx->map == MAP_FAILED) {
+		if (errno != ENOMEM) {
+			midx->map = NULL;
+			err = got_error_from_errno("mmap");
+			goto done;
+		}
+		midx->map = NULL; /* fall back to read(2) */
+	} else
+		midx->mapped = 1;
+#endif
+	if (midx->map == NULL) {
+		err = read_midx(&midx->map, fd, midx->len);
+		if (err)
+			goto done;
+	}
+
+	err = parse_chunks(midx);
+done:
+	if (err)
+		got_multi_pack_index_close(midx);
+	else
+		*midxp = midx;
+	return err;
+}
+
+const struct got_error *
+got_multi_pack_index_close(struct got_multi_pack_index *midx)
+{
+	const struct got_error *err = NULL;
+
+	free(midx->pack_names);
+	if (midx->map) {
+		if (midx->mapped) {
+			if (munmap(midx->map, midx->len) == -1)
+				err = got_error_from_errno("munmap");
+		} else
+			free(midx->map);
+	}
+	if (midx->fd != -1 && close(midx->fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	free(midx);
+	return err;
+}
+
+const char *
+got_multi_pack_index_lookup(struct got_multi_pack_index *midx,
+    struct got_object_id *id)
+{
+	size_t digest_len = got_hash_digest_length(midx->algo);
+	uint8_t id0 = id->hash[0];
+	int64_t left = 0, right, i;
+	uint32_t pack_id;
+	int cmp;
+
+	if (id->algo != midx->algo)
+		return NULL;
+
+	right = (int64_t)get_be32((uint8_t *)&midx->fanout[id0]) - 1;
+	if (id0 > 0)
+		left = get_be32((uint8_t *)&midx->fanout[id0 - 1]);
+
+	while (left <= right) {
+		i = left + (right - left) / 2;
+		cmp = memcmp(midx->oids + i * digest_len, id->hash, digest_len);
+		if (cmp == 0) {
+			pack_id = get_be32((uint8_t *)&midx->offsets[i * 2]);
+			return midx->pack_names[pack_id];
+		}
+		if (cmp < 0)
+			left = i + 1;
+		else
+			right = i - 1;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+hwrite(int fd, const void *buf, size_t len, struct got_hash *ctx)
+{
+	ssize_t w;
+
+	got_hash_update(ctx, buf, len);
+
+	w = write(fd, buf, len);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if (w != len)
+		return got_error(GOT_ERR_IO);
+
+	return NULL;
+}
+
+static const struct got_error *
+hwrite_be32(int fd, uint32_t val, struct got_hash *ctx)
+{
+	val = htobe32(val);
+	return hwrite(fd, &val, sizeof(val), ctx);
+}
+
+static const struct got_error *
+hwrite_be64(int fd, uint64_t val, struct got_hash *ctx)
+{
+	val = htobe64(val);
+	return hwrite(fd, &val, sizeof(val), ctx);
+}
+
+struct midx_pack {
+	struct got_packidx *packidx;
+	const char *name;
+	uint32_t pack_id;	/* position in sorted list of names */
+	uint32_t pref;		/* position in caller's array */
+};
+
+struct midx_object {
+	const uint8_t *hash;
+	struct midx_pack *pack;
+	off_t offset;
+};
+
+static size_t midx_digest_len;
+
+static int
+pack_name_cmp(const void *pa, const void *pb)
+{
+	const struct midx_pack *a = pa, *b = pb;
+
+	return strcmp(a->name, b->name);
+}
+
+static int
+object_cmp(const void *pa, const void *pb)
+{
+	const struct midx_object *a = pa, *b = pb;
+	int cmp;
+
+	cmp = memcmp(a->hash, b->hash, midx_digest_len);
+	if (cmp)
+		return cmp;
+
+	if (a->pack->pref < b->pack->pref)
+		return -1;
+	return a->pack->pref > b->pack->pref;
+}
+
+const struct got_error *
+got_multi_pack_index_write(int fd, struct got_packidx **packidx,
+    const char **names, uint32_t npacks, enum got_hash_algorithm algo)
+{
+	const struct got_error *err = NULL;
+	struct midx_pack *packs = NULL;
+	struct midx_object *objects = NULL;
+	struct got_hash ctx;
+	uint8_t hdr[GOT_MIDX_HDR_SIZE];
+	uint8_t digest[GOT_HASH_DIGEST_MAXLEN];
+	uint8_t pad[4] = { 0 };
+	size_t digest_len = got_hash_digest_length(algo);
+	size_t nobjects = 0, nunique, nlarge = 0, pnam_size = 0, i, j;
+	uint32_t chunk_ids[5], fanout[256], nobj, val;
+	uint64_t chunk_sizes[5], offset;
+	int k, nchunks;
+
+	packs = calloc(npacks ? npacks : 1, sizeof(*packs));
+	if (packs == NULL)
+		return got_error_from_errno("calloc");
+
+	for (i = 0; i < npacks; i++) {
+		packs[i].packidx = packidx[i];
+		packs[i].name = names[i];
+		packs[i].pref = i;
+		nobjects += be32toh(packidx[i]->hdr.fanout_table[0xff]);
+		pnam_size += strlen(names[i]) + 1;
+	}
+	if (pnam_size % 4)
+		pnam_size += 4 - (pnam_size % 4);
+
+	qsort(packs, npacks, sizeof(packs[0]), pack_name_cmp);
+	for (i = 0; i < npacks; i++) {
+		packs[i].pack_id = i;
+		if (i > 0 && strcmp(packs[i - 1].name, packs[i].name) == 0) {
+			err = got_error_path(packs[i].name, GOT_ERR_BAD_PATH);
+			goto done;
+		}
+	}
+
+	objects = calloc(nobjects ? nobjects : 1, sizeof(*objects));
+	if (objects == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+
+	nobjects = 0;
+	for (i = 0; i < npacks; i++) {
+		struct got_packidx *p = packs[i].packidx;
+
+		nobj = be32toh(p->hdr.fanout_table[0xff]);
+		for (j = 0; j < nobj; j++) {
+			struct midx_object *o = &objects[nobjects++];
+
+			o->hash = p->hdr.sorted_ids + j * digest_len;
+			o->pack = &packs[i];
+			o->offset = got_packidx_get_object_offset(p, j);
+			if (o->offset == -1) {
+				err = got_error(GOT_ERR_BAD_PACKIDX);
+				goto done;
+			}
+		}
+	}
+
+	midx_digest_len = digest_len;
+	qsort(objects, nobjects, sizeof(objects[0]), object_cmp);
+
+	/* Keep only the preferred copy of each object. */
+	nunique = 0;
+	for (i = 0; i < nobjects; i++) {
+		if (nunique > 0 && memcmp(objects[nunique - 1].hash,
+		    objects[i].hash, digest_len) == 0)
+			continue;
+		objects[nunique++] = objects[i];
+	}
+	if (nunique > UINT32_MAX) {
+		err = got_error(GOT_ERR_NO_SPACE);
+		goto done;
+	}
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < nunique; i++) {
+		fanout[objects[i].hash[0]]++;
+		if (objects[i].offset > 0x7fffffff)
+			nlarge++;
+	}
+	for (i = 1; i < nitems(fanout); i++)
+		fanout[i] += fanout[i - 1];
+
+	nchunks = 0;
+	chunk_ids[nchunks] = GOT_MIDX_CHUNK_PNAM;
+	chunk_sizes[nchunks++] = pnam_size;
+	chunk_ids[nchunks] = GOT_MIDX_CHUNK_OIDF;
+	chunk_sizes[nchunks++] = sizeof(fanout);
+	chunk_ids[nchunks] = GOT_MIDX_CHUNK_OIDL;
+	chunk_sizes[nchunks++] = (uint64_t)nunique * digest_len;
+	chunk_ids[nchunks] = GOT_MIDX_CHUNK_OOFF;
+	chunk_sizes[nchunks++] = (uint64_t)nunique * 2 * sizeof(uint32_t);
+	if (nlarge > 0) {
+		chunk_ids[nchunks] = GOT_MIDX_CHUNK_LOFF;
+		chunk_sizes[nchunks++] = (uint64_t)nlarge * sizeof(uint64_t);
+	}
+
+	got_hash_init(&ctx, algo);
+
+	hdr[0] = 'M';
+	hdr[1] = 'I';
+	hdr[2] = 'D';
+	hdr[3] = 'X';
+	hdr[4] = GOT_MIDX_VERSION;
+	hdr[5] = (algo == GOT_HASH_SHA256) ? GOT_MIDX_HASH_SHA256 :
+	    GOT_MIDX_HASH_SHA1;
+	hdr[6] = nchunks;
+	hdr[7] = 0; /* no base multi-pack-index files */
+	val = htobe32(npacks);
+	memcpy(&hdr[8], &val, sizeof(val));
+	err = hwrite(fd, hdr, sizeof(hdr), &ctx);
+	if (err)
+		goto done;
+
+	/* Chunk table of contents, terminated by a zero ID. */
+	offset = GOT_MIDX_HDR_SIZE + (nchunks + 1) * GOT_MIDX_CHUNK_ENTRY_SIZE;
+	for (k = 0; k < nchunks; k++) {
+		err = hwrite_be32(fd, chunk_ids[k], &ctx);
+		if (err)
+			goto done;
+		err = hwrite_be64(fd, offset, &ctx);
+		if (err)
+			goto done;
+		offset += chunk_sizes[k];
+	}
+	err = hwrite_be32(fd, 0, &ctx);
+	if (err)
+		goto done;
+	err = hwrite_be64(fd, offset, &ctx);
+	if (err)
+		goto done;
+
+	/* PNAM */
+	offset = 0;
+	for (i = 0; i < npacks; i++) {
+		size_t len = strlen(packs[i].name) + 1;
+
+		err = hwrite(fd, packs[i].name, len, &ctx);
+		if (err)
+			goto done;
+		offset += len;
+	}
+	if (offset < pnam_size) {
+		err = hwrite(fd, pad, pnam_size - offset, &ctx);
+		if (err)
+			goto done;
+	}
+
+	/* OIDF */
+	for (i = 0; i < nitems(fanout); i++) {
+		err = hwrite_be32(fd, fanout[i], &ctx);
+		if (err)
+			goto done;
+	}
+
+	/* OIDL */
+	for (i = 0; i < nunique; i++) {
+		err = hwrite(fd, objects[i].hash, digest_len, &ctx);
+		if (err)
+			goto done;
+	}
+
+	/* OOFF */
+	nlarge = 0;
+	for (i = 0; i < nunique; i++) {
+		err = hwrite_be32(fd, objects[i].pack->pack_id, &ctx);
+		if (err)
+			goto done;
+		if (objects[i].offset > 0x7fffffff)
+			val = GOT_MIDX_OFFSET_IS_LARGE_IDX | nlarge++;
+		else
+			val = objects[i].offset;
+		err = hwrite_be32(fd, val, &ctx);
+		if (err)
+			goto done;
+	}
+
+	/* LOFF */
+	for (i = 0; nlarge > 0 && i < nunique; i++) {
+		if (objects[i].offset <= 0x7fffffff)
+			continue;
+		err = hwrite_be64(fd, objects[i].offset, &ctx);
+		if (err)
+			goto done;
+	}
+
+	got_hash_final(&ctx, digest);
+	err = hwrite(fd, digest, digest_len, &ctx);
+done:
+	free(packs);
+	free(objects);
+	return err;
+}
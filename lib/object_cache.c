@@ -28,6 +28,7 @@
 #include "got_compat.h"
 #include "got_error.h"
 #include "got_object.h"
+#include "got_repository.h"
 
 #include "got_lib_delta.h"
 #include "got_lib_inflate.h"
@@ -36,15 +37,20 @@
 #include "got_lib_object_cache.h"
 
 /*
- * XXX This should be reworked to track cache size and usage in bytes,
- * rather than tracking N elements capped to a maximum element size.
+ * Share of the total cache size given to each cache type, in sixteenths.
+ * Trees and commits are read over and over during history traversal.
  */
-#define GOT_OBJECT_CACHE_SIZE_OBJ	256
-#define GOT_OBJECT_CACHE_SIZE_TREE	256
-#define GOT_OBJECT_CACHE_SIZE_COMMIT	64
-#define GOT_OBJECT_CACHE_SIZE_TAG	256
-#define GOT_OBJECT_CACHE_SIZE_RAW	16
-#define GOT_OBJECT_CACHE_MAX_ELEM_SIZE	1048576	/* 1 MB */
+#define GOT_OBJECT_CACHE_SHARE_OBJ	2
+#define GOT_OBJECT_CACHE_SHARE_TREE	6
+#define GOT_OBJECT_CACHE_SHARE_COMMIT	3
+#define GOT_OBJECT_CACHE_SHARE_TAG	1
+#define GOT_OBJECT_CACHE_SHARE_RAW	4
+
+/* Raw objects may keep a file open, so limit their number as well. */
+#define GOT_OBJECT_CACHE_MAXELEM_RAW	16
+
+/* A single element may use at most this fraction of a cache's size. */
+#define GOT_OBJECT_CACHE_MAX_ELEM_DIVISOR	4
 
 const struct got_error *
 got_object_cache_init(struct got_object_cache *cache,
@@ -58,29 +64,92 @@ got_object_cache_init(struct got_object_cache *cache,
 	if (cache->idset == NULL)
 		return got_error_from_errno("got_object_idset_alloc");
 
+	TAILQ_INIT(&cache->lru);
 	cache->type = type;
-	switch (type) {
+	cache->maxelem = INT_MAX;
+	if (type == GOT_OBJECT_CACHE_TYPE_RAW) {
+		if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+			return got_error_from_errno("getrlimit");
+		cache->maxelem = GOT_OBJECT_CACHE_MAXELEM_RAW;
+		if (cache->maxelem > rl.rlim_cur / 16)
+			cache->maxelem = rl.rlim_cur / 16;
+	}
+
+	got_object_cache_set_size(cache, GOT_OBJECT_CACHE_DEFAULT_SIZE);
+	return NULL;
+}
+
+static void
+close_entry(struct got_object_cache *cache, struct got_object_cache_entry *ce)
+{
+	switch (cache->type) {
 	case GOT_OBJECT_CACHE_TYPE_OBJ:
-		cache->size = GOT_OBJECT_CACHE_SIZE_OBJ;
+		got_object_close(ce->data.obj);
 		break;
 	case GOT_OBJECT_CACHE_TYPE_TREE:
-		cache->size = GOT_OBJECT_CACHE_SIZE_TREE;
+		got_object_tree_close(ce->data.tree);
 		break;
 	case GOT_OBJECT_CACHE_TYPE_COMMIT:
-		cache->size = GOT_OBJECT_CACHE_SIZE_COMMIT;
+		got_object_commit_close(ce->data.commit);
 		break;
 	case GOT_OBJECT_CACHE_TYPE_TAG:
-		cache->size = GOT_OBJECT_CACHE_SIZE_TAG;
+		got_object_tag_close(ce->data.tag);
 		break;
 	case GOT_OBJECT_CACHE_TYPE_RAW:
-		if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
-			return got_error_from_errno("getrlimit");
-		cache->size = GOT_OBJECT_CACHE_SIZE_RAW;
-		if (cache->size > rl.rlim_cur / 16)
-			cache->size = rl.rlim_cur / 16;
+		got_object_raw_close(ce->data.raw);
 		break;
 	}
-	return NULL;
+}
+
+/*
+ * Evict least recently used entries until an element of the given size
+ * fits into the cache.
+ */
+static void
+evict_entries(struct got_object_cache *cache, size_t size)
+{
+	struct got_object_cache_entry *ce;
+
+	while ((ce = TAILQ_LAST(&cache->lru, got_object_cache_lru)) != NULL) {
+		if (got_object_idset_num_elements(cache->idset) <
+		    cache->maxelem && cache->size + size <= cache->maxsize)
+			break;
+		TAILQ_REMOVE(&cache->lru, ce, entry);
+		got_object_idset_remove(NULL, cache->idset, &ce->id);
+		cache->size -= ce->size;
+		close_entry(cache, ce);
+		free(ce);
+		cache->cache_evict++;
+	}
+}
+
+void
+got_object_cache_set_size(struct got_object_cache *cache, size_t size)
+{
+	size_t share = 0;
+
+	switch (cache->type) {
+	case GOT_OBJECT_CACHE_TYPE_OBJ:
+		share = GOT_OBJECT_CACHE_SHARE_OBJ;
+		break;
+	case GOT_OBJECT_CACHE_TYPE_TREE:
+		share = GOT_OBJECT_CACHE_SHARE_TREE;
+		break;
+	case GOT_OBJECT_CACHE_TYPE_COMMIT:
+		share = GOT_OBJECT_CACHE_SHARE_COMMIT;
+		break;
+	case GOT_OBJECT_CACHE_TYPE_TAG:
+		share = GOT_OBJECT_CACHE_SHARE_TAG;
+		break;
+	case GOT_OBJECT_CACHE_TYPE_RAW:
+		share = GOT_OBJECT_CACHE_SHARE_RAW;
+		break;
+	}
+
+	cache->maxsize = size / 16 * share;
+	cache->max_elem_size = cache->maxsize /
+	    GOT_OBJECT_CACHE_MAX_ELEM_DIVISOR;
+	evict_entries(cache, 0);
 }
 
 static size_t
@@ -142,7 +211,16 @@ get_size_tag(struct got_tag_object *tag)
 static size_t
 get_size_raw(struct got_raw_object *raw)
 {
-	return sizeof(*raw);
+	size_t size = sizeof(*raw);
+
+	/* Count object data which is held in memory. */
+	if (raw->f == NULL && raw->data != NULL) {
+		if (raw->size > SIZE_MAX - size - raw->hdrlen)
+			return SIZE_MAX;
+		size += raw->hdrlen + raw->size;
+	}
+
+	return size;
 }
 
 const struct got_error *
@@ -151,7 +229,6 @@ got_object_cache_add(struct got_object_cache *cache, struct got_object_id *id,
 {
 	const struct got_error *err = NULL;
 	struct got_object_cache_entry *ce;
-	int nelem;
 	size_t size;
 
 	switch (cache->type) {
@@ -174,7 +251,7 @@ got_object_cache_add(struct got_object_cache *cache, struct got_object_id *id,
 		return got_error(GOT_ERR_OBJ_TYPE);
 	}
 
-	if (size > GOT_OBJECT_CACHE_MAX_ELEM_SIZE) {
+	if (size > cache->max_elem_size) {
 #ifdef GOT_OBJ_CACHE_DEBUG
 		char *id_str;
 		if (got_object_id_str(&id_str, id) != NULL)
@@ -205,38 +282,17 @@ got_object_cache_add(struct got_object_cache *cache, struct got_object_id *id,
 		return got_error(GOT_ERR_OBJ_TOO_LARGE);
 	}
 
-	nelem = got_object_idset_num_elements(cache->idset);
-	if (nelem >= cache->size) {
-		err = got_object_idset_remove((void **)&ce,
-		    cache->idset, NULL);
-		if (err)
-			return err;
-		switch (cache->type) {
-		case GOT_OBJECT_CACHE_TYPE_OBJ:
-			got_object_close(ce->data.obj);
-			break;
-		case GOT_OBJECT_CACHE_TYPE_TREE:
-			got_object_tree_close(ce->data.tree);
-			break;
-		case GOT_OBJECT_CACHE_TYPE_COMMIT:
-			got_object_commit_close(ce->data.commit);
-			break;
-		case GOT_OBJECT_CACHE_TYPE_TAG:
-			got_object_tag_close(ce->data.tag);
-			break;
-		case GOT_OBJECT_CACHE_TYPE_RAW:
-			got_object_raw_close(ce->data.raw);
-			break;
-		}
-		memset(ce, 0, sizeof(*ce));
-		cache->cache_evict++;
-	} else {
-		ce = malloc(sizeof(*ce));
-		if (ce == NULL)
-			return got_error_from_errno("malloc");
-	}
+	if (got_object_idset_contains(cache->idset, id))
+		return got_error(GOT_ERR_OBJ_EXISTS);
+
+	evict_entries(cache, size);
+
+	ce = malloc(sizeof(*ce));
+	if (ce == NULL)
+		return got_error_from_errno("malloc");
 
 	memcpy(&ce->id, id, sizeof(ce->id));
+	ce->size = size;
 	switch (cache->type) {
 	case GOT_OBJECT_CACHE_TYPE_OBJ:
 		ce->data.obj = (struct got_object *)item;
@@ -256,11 +312,15 @@ got_object_cache_add(struct got_object_cache *cache, struct got_object_id *id,
 	}
 
 	err = got_object_idset_add(cache->idset, id, ce);
-	if (err)
+	if (err) {
 		free(ce);
-	else if (size > cache->max_cached_size)
+		return err;
+	}
+	TAILQ_INSERT_HEAD(&cache->lru, ce, entry);
+	cache->size += size;
+	if (size > cache->max_cached_size)
 		cache->max_cached_size = size;
-	return err;
+	return NULL;
 }
 
 void *
@@ -272,6 +332,10 @@ got_object_cache_get(struct got_object_cache *cache, struct got_object_id *id)
 	ce = got_object_idset_get(cache->idset, id);
 	if (ce) {
 		cache->cache_hit++;
+		if (ce != TAILQ_FIRST(&cache->lru)) {
+			TAILQ_REMOVE(&cache->lru, ce, entry);
+			TAILQ_INSERT_HEAD(&cache->lru, ce, entry);
+		}
 		switch (cache->type) {
 		case GOT_OBJECT_CACHE_TYPE_OBJ:
 			return ce->data.obj;
@@ -290,15 +354,30 @@ got_object_cache_get(struct got_object_cache *cache, struct got_object_id *id)
 	return NULL;
 }
 
+void
+got_object_cache_get_stats(struct got_object_cache_stats *stats,
+    struct got_object_cache *cache)
+{
+	if (cache->idset)
+		stats->nelem += got_object_idset_num_elements(cache->idset);
+	stats->size += cache->size;
+	stats->maxsize += cache->maxsize;
+	stats->searches += cache->cache_searches;
+	stats->hits += cache->cache_hit;
+	stats->misses += cache->cache_miss;
+	stats->evicted += cache->cache_evict;
+	stats->toolarge += cache->cache_toolarge;
+}
+
 #ifdef GOT_OBJ_CACHE_DEBUG
 static void
 print_cache_stats(struct got_object_cache *cache, const char *name)
 {
-	fprintf(stderr, "%s: %s cache: %d elements, %d searches, %d hits, "
-	    "%d missed, %d evicted, %d too large, max cached %zd bytes\n",
-	    getprogname(), name,
+	fprintf(stderr, "%s: %s cache: %d elements, %zu bytes, %d searches, "
+	    "%d hits, %d missed, %d evicted, %d too large, "
+	    "max cached %zd bytes\n", getprogname(), name,
 	    cache->idset ? got_object_idset_num_elements(cache->idset) : -1,
-	    cache->cache_searches, cache->cache_hit,
+	    cache->size, cache->cache_searches, cache->cache_hit,
 	    cache->cache_miss, cache->cache_evict, cache->cache_toolarge,
 	    cache->max_cached_size);
 }
@@ -360,38 +439,11 @@ check_refcount(struct got_object_id *id, void *data, void *arg)
 }
 #endif
 
-static const struct got_error *
-free_entry(struct got_object_id *id, void *data, void *arg)
-{
-	struct got_object_cache *cache = arg;
-	struct got_object_cache_entry *ce = data;
-
-	switch (cache->type) {
-	case GOT_OBJECT_CACHE_TYPE_OBJ:
-		got_object_close(ce->data.obj);
-		break;
-	case GOT_OBJECT_CACHE_TYPE_TREE:
-		got_object_tree_close(ce->data.tree);
-		break;
-	case GOT_OBJECT_CACHE_TYPE_COMMIT:
-		got_object_commit_close(ce->data.commit);
-		break;
-	case GOT_OBJECT_CACHE_TYPE_TAG:
-		got_object_tag_close(ce->data.tag);
-		break;
-	case GOT_OBJECT_CACHE_TYPE_RAW:
-		got_object_raw_close(ce->data.raw);
-		break;
-	}
-
-	free(ce);
-
-	return NULL;
-}
-
 void
 got_object_cache_close(struct got_object_cache *cache)
 {
+	struct got_object_cache_entry *ce;
+
 #ifdef GOT_OBJ_CACHE_DEBUG
 	switch (cache->type) {
 	case GOT_OBJECT_CACHE_TYPE_OBJ:
@@ -415,8 +467,12 @@ got_object_cache_close(struct got_object_cache *cache)
 		got_object_idset_for_each(cache->idset, check_refcount, cache);
 #endif
 
+	while ((ce = TAILQ_FIRST(&cache->lru)) != NULL) {
+		TAILQ_REMOVE(&cache->lru, ce, entry);
+		close_entry(cache, ce);
+		free(ce);
+	}
 	if (cache->idset) {
-		got_object_idset_for_each(cache->idset, free_entry, cache);
 		got_object_idset_free(cache->idset);
 		cache->idset = NULL;
 	}
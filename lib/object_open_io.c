@@ -610,6 +610,14 @@ got_object_tree_open(struct got_tree_object **tree,
 	return open_tree(tree, repo, got_object_get_id(obj), 1);
 }
 
+const struct got_error *
+got_object_prefetch_trees(struct got_repository *repo,
+    struct got_object_id **ids, int nids)
+{
+	/* Trees are read directly from pack files; there is nothing to batch. */
+	return NULL;
+}
+
 static const struct got_error *
 read_packed_blob(uint8_t **outbuf, size_t *size, size_t *hdrlen,
     int outfd, struct got_pack *pack, struct got_packidx *packidx, int idx,
@@ -24,6 +24,7 @@
 #include <sys/uio.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <imsg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -46,6 +47,7 @@
 #include "got_lib_object_cache.h"
 #include "got_lib_pack.h"
 #include "got_lib_repository.h"
+#include "got_lib_commit_graph_file.h"
 
 static const struct got_error *
 request_packed_object(struct got_object **obj, struct got_pack *pack, int idx,
@@ -109,6 +111,102 @@ done:
 	return err;
 }
 
+/*
+ * Provide the child with shared memory for transferring object data.
+ * The child inflates objects straight into shared memory, and the parent
+ * copies them out once, rather than having object data copied through
+ * the imsg socket or written to a temporary file.
+ *
+ * The shared memory is a sealed memfd which cannot be resized. Otherwise,
+ * the child could truncate the underlying file and crash the parent with
+ * SIGBUS while the parent reads from its mapping. On systems without sealed
+ * memfds, object data is transferred via imsg and temporary files as usual.
+ */
+static const struct got_error *
+pack_child_send_shm(struct imsgbuf *ibuf, struct got_pack *pack)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS) && \
+    !defined(GOT_PACK_NO_MMAP)
+	const struct got_error *err;
+	struct got_pack_privsep_child *child = pack->privsep_child;
+	uint8_t *shm;
+	int fd;
+
+	if (pack->child_has_shm)
+		return NULL;
+	pack->child_has_shm = 1;
+
+	fd = memfd_create("got-object-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1)
+		return NULL; /* fall back to imsg and temporary files */
+
+	if (ftruncate(fd, GOT_PRIVSEP_SHM_SIZE) == -1) {
+		err = got_error_from_errno("ftruncate");
+		close(fd);
+		return err;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS,
+	    F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+		err = got_error_from_errno("fcntl F_ADD_SEALS");
+		close(fd);
+		return err;
+	}
+
+	shm = mmap(NULL, GOT_PRIVSEP_SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED) {
+		close(fd);
+		if (errno == ENOMEM)
+			return NULL;
+		return got_error_from_errno("mmap");
+	}
+
+	err = got_privsep_send_object_shm(ibuf, fd);
+	if (err) {
+		munmap(shm, GOT_PRIVSEP_SHM_SIZE);
+		return err;
+	}
+
+	child->shm = shm;
+	child->shm_size = GOT_PRIVSEP_SHM_SIZE;
+#endif
+	return NULL;
+}
+
+/*
+ * Provide the child with the repository's commit-graph file, if any.
+ * This allows the child to traverse commit history without inflating
+ * commit objects.
+ */
+static const struct got_error *
+pack_child_send_commit_graph(struct imsgbuf *ibuf, struct got_pack *pack,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_commit_graph_file *cg;
+	int fd;
+
+	if (pack->child_has_commit_graph)
+		return NULL;
+
+	err = got_repo_get_commit_graph_file(&cg, repo);
+	if (err)
+		return err;
+	if (cg == NULL)
+		return NULL;
+
+	fd = dup(cg->fd);
+	if (fd == -1)
+		return got_error_from_errno("dup");
+
+	err = got_privsep_send_commit_graph(ibuf, fd);
+	if (err)
+		return err;
+
+	pack->child_has_commit_graph = 1;
+	return NULL;
+}
+
 static const struct got_error *
 request_packed_object_raw(uint8_t **outbuf, off_t *size, size_t *hdrlen,
     int outfd, struct got_pack *pack, int idx, struct got_object_id *id)
@@ -121,6 +219,10 @@ request_packed_object_raw(uint8_t **outbuf, off_t *size, size_t *hdrlen,
 	if (err)
 		return err;
 
+	err = pack_child_send_shm(ibuf, pack);
+	if (err)
+		return err;
+
 	outfd_child = dup(outfd);
 	if (outfd_child == -1)
 		return got_error_from_errno("dup");
@@ -135,7 +237,8 @@ request_packed_object_raw(uint8_t **outbuf, off_t *size, size_t *hdrlen,
 	if (err)
 		return err;
 
-	err = got_privsep_recv_raw_obj(outbuf, size, hdrlen, ibuf);
+	err = got_privsep_recv_raw_obj(outbuf, size, hdrlen, ibuf,
+	    pack->privsep_child->shm, pack->privsep_child->shm_size);
 	if (err)
 		return err;
 
@@ -314,7 +417,7 @@ request_raw_object(uint8_t **outbuf, off_t *size, size_t *hdrlen, int outfd,
 	if (err)
 		return err;
 
-	return got_privsep_recv_raw_obj(outbuf, size, hdrlen, ibuf);
+	return got_privsep_recv_raw_obj(outbuf, size, hdrlen, ibuf, NULL, 0);
 }
 
 static const struct got_error *
@@ -815,6 +918,132 @@ got_object_tree_open(struct got_tree_object **tree,
 	return open_tree(tree, repo, got_object_get_id(obj), 1);
 }
 
+#ifndef GOT_NO_OBJ_CACHE
+/*
+ * Read tree replies from a pack child until no more than nwait requests
+ * remain outstanding, and add the received trees to the tree cache.
+ * Set *ipc_failed if communication with the child has failed, in which
+ * case no further replies can be read.
+ */
+static const struct got_error *
+recv_prefetched_trees(int *ipc_failed, int *nrecv, int nsent, int nwait,
+    struct got_object_id **sent, struct got_pack *pack,
+    struct got_repository *repo)
+{
+	const struct got_error *err = NULL, *cache_err = NULL;
+	struct got_tree_object *tree;
+	struct got_object_id *id;
+
+	while (nsent - *nrecv > nwait) {
+		err = got_privsep_recv_tree(&tree, pack->privsep_child->ibuf);
+		if (err) {
+			*ipc_failed = 1;
+			return err;
+		}
+		id = sent[*nrecv % GOT_PRIVSEP_MAX_PIPELINED_REQUESTS];
+		(*nrecv)++;
+
+		tree->refcnt++;
+		err = got_repo_cache_tree(repo, id, tree);
+		got_object_tree_close(tree);
+		if (err && cache_err == NULL)
+			cache_err = err;
+	}
+
+	return cache_err;
+}
+#endif /* GOT_NO_OBJ_CACHE */
+
+/*
+ * Load the given trees into the repository's tree cache. Requests for
+ * packed trees are pipelined to the pack child such that up to
+ * GOT_PRIVSEP_MAX_PIPELINED_REQUESTS trees are in flight at a time,
+ * instead of waiting for each reply before sending the next request.
+ * Trees which are already cached or stored as loose objects are skipped.
+ */
+const struct got_error *
+got_object_prefetch_trees(struct got_repository *repo,
+    struct got_object_id **ids, int nids)
+{
+#ifndef GOT_NO_OBJ_CACHE
+	const struct got_error *err = NULL, *drain_err;
+	struct got_object_id *sent[GOT_PRIVSEP_MAX_PIPELINED_REQUESTS];
+	struct got_packidx *packidx;
+	struct got_pack *pack = NULL, *p;
+	char *path_packfile = NULL;
+	int i, idx, nsent = 0, nrecv = 0, ipc_failed = 0;
+
+	for (i = 0; i < nids; i++) {
+		if (got_repo_get_cached_tree(repo, ids[i]) != NULL)
+			continue;
+
+		err = got_repo_search_packidx(&packidx, &idx, repo, ids[i]);
+		if (err) {
+			if (err->code != GOT_ERR_NO_OBJ)
+				break;
+			err = NULL;
+			continue;
+		}
+
+		free(path_packfile);
+		err = got_packidx_get_packfile_path(&path_packfile,
+		    packidx->path_packidx);
+		if (err)
+			break;
+
+		p = got_repo_get_cached_pack(repo, path_packfile);
+		if (p == NULL || p != pack) {
+			/* Collect all replies before switching packs. */
+			if (pack) {
+				err = recv_prefetched_trees(&ipc_failed,
+				    &nrecv, nsent, 0, sent, pack, repo);
+				if (err)
+					break;
+			}
+			pack = p;
+			if (pack == NULL) {
+				err = got_repo_cache_pack(&pack, repo,
+				    path_packfile, packidx);
+				if (err)
+					break;
+			}
+			if (pack->privsep_child == NULL) {
+				err = got_pack_start_privsep_child(pack,
+				    packidx);
+				if (err)
+					break;
+			}
+		}
+
+		err = recv_prefetched_trees(&ipc_failed, &nrecv, nsent,
+		    GOT_PRIVSEP_MAX_PIPELINED_REQUESTS - 1, sent, pack, repo);
+		if (err)
+			break;
+
+		err = got_privsep_send_tree_req(pack->privsep_child->ibuf, -1,
+		    ids[i], idx);
+		if (err) {
+			ipc_failed = 1;
+			break;
+		}
+		sent[nsent % GOT_PRIVSEP_MAX_PIPELINED_REQUESTS] = ids[i];
+		nsent++;
+	}
+
+	/* Keep the child's replies in sync with future requests. */
+	if (pack && !ipc_failed) {
+		drain_err = recv_prefetched_trees(&ipc_failed, &nrecv, nsent,
+		    0, sent, pack, repo);
+		if (drain_err && err == NULL)
+			err = drain_err;
+	}
+	free(path_packfile);
+	return err;
+#else
+	return NULL;
+#endif
+}
+
 static const struct got_error *
 request_packed_blob(uint8_t **outbuf, size_t *size, size_t *hdrlen, int outfd,
     struct got_pack *pack, struct got_packidx *packidx, int idx,
@@ -828,6 +1057,10 @@ request_packed_blob(uint8_t **outbuf, size_t *size, size_t *hdrlen, int outfd,
 	if (err)
 		return err;
 
+	err = pack_child_send_shm(ibuf, pack);
+	if (err)
+		return err;
+
 	outfd_child = dup(outfd);
 	if (outfd_child == -1)
 		return got_error_from_errno("dup");
@@ -843,7 +1076,8 @@ request_packed_blob(uint8_t **outbuf, size_t *size, size_t *hdrlen, int outfd,
 	}
 
 	err = got_privsep_recv_blob(outbuf, size, hdrlen,
-	    pack->privsep_child->ibuf);
+	    pack->privsep_child->ibuf, pack->privsep_child->shm,
+	    pack->privsep_child->shm_size);
 	if (err)
 		return err;
 
@@ -889,7 +1123,7 @@ request_blob(uint8_t **outbuf, size_t *size, size_t *hdrlen, int outfd,
 	if (err)
 		return err;
 
-	err = got_privsep_recv_blob(outbuf, size, hdrlen, ibuf);
+	err = got_privsep_recv_blob(outbuf, size, hdrlen, ibuf, NULL, 0);
 	if (err)
 		return err;
 
@@ -1040,6 +1274,18 @@ got_object_open_as_blob(struct got_blob_object **blob,
     struct got_repository *repo, struct got_object_id *id, size_t blocksize,
     int outfd)
 {
+	const struct got_error *err;
+
+	err = open_blob(blob, repo, id, blocksize, outfd);
+	if (err == NULL || err->code != GOT_ERR_NO_OBJ ||
+	    got_repo_get_promisor_remote(repo) == NULL)
+		return err;
+
+	/* The blob may have been omitted from a partial clone. */
+	err = got_repo_fetch_missing_objects(repo, id, 1);
+	if (err)
+		return err;
+
 	return open_blob(blob, repo, id, blocksize, outfd);
 }
 
@@ -1250,6 +1496,11 @@ got_traverse_packed_commits(struct got_object_id_queue *traversed_commits,
 			goto done;
 	}
 
+	err = pack_child_send_commit_graph(pack->privsep_child->ibuf,
+	    pack, repo);
+	if (err)
+		goto done;
+
 	err = got_privsep_send_commit_traversal_request(
 	    pack->privsep_child->ibuf, commit_id, idx, path);
 	if (err)
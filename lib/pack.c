@@ -79,6 +79,8 @@ got_packidx_init_hdr(struct got_packidx *p, int verify, off_t packfile_size)
 	ssize_t n;
 	int i;
 
+	p->packfile_size = packfile_size;
+
 	got_hash_init(&ctx, p->algo);
 	digest_string_len = got_hash_digest_length(p->algo);
 
@@ -343,8 +345,9 @@ got_packidx_open(struct got_packidx **packidx,
 {
 	const struct got_error *err = NULL;
 	struct got_packidx *p = NULL;
-	char *pack_relpath;
+	char *pack_relpath, *rev_relpath = NULL;
 	struct stat idx_sb, pack_sb;
+	int rev_fd = -1;
 
 	*packidx = NULL;
 
@@ -409,16 +412,152 @@ got_packidx_open(struct got_packidx **packidx,
 #endif
 
 	err = got_packidx_init_hdr(p, verify, pack_sb.st_size);
+	if (err)
+		goto done;
+
+	err = got_packidx_get_reverse_index_path(&rev_relpath, relpath);
+	if (err)
+		goto done;
+	rev_fd = openat(dir_fd, rev_relpath, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (rev_fd == -1) {
+		if (errno != ENOENT)
+			err = got_error_from_errno2("openat", rev_relpath);
+		goto done;
+	}
+	err = got_packidx_open_reverse_index(p, rev_fd);
+	rev_fd = -1;
 done:
 	if (err) {
 		if (p)
 			got_packidx_close(p);
 	} else
 		*packidx = p;
+	if (rev_fd != -1)
+		close(rev_fd);
+	free(rev_relpath);
 	free(pack_relpath);
 	return err;
 }
 
+const struct got_error *
+got_packidx_open_reverse_index(struct got_packidx *p, int fd)
+{
+	const struct got_error *err = NULL;
+	struct got_packidx_rev_hdr *hdr;
+	struct got_hash ctx;
+	struct stat sb;
+	uint8_t csum[GOT_HASH_DIGEST_MAXLEN];
+	uint32_t nobj = be32toh(p->hdr.fanout_table[0xff]);
+	size_t digest_len = got_hash_digest_length(p->algo);
+	uint32_t hash_id;
+	uint8_t *map = NULL;
+	size_t len;
+	int mapped = 0;
+
+	if (p->rev_map != NULL) {
+		close(fd);
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+	}
+
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno("fstat");
+		goto done;
+	}
+
+	/* Ignore reverse index files which do not match this pack index. */
+	len = sizeof(*hdr) + (size_t)nobj * sizeof(uint32_t) + 2 * digest_len;
+	if (sb.st_size != (off_t)len)
+		goto done;
+
+#ifndef GOT_PACK_NO_MMAP
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		if (errno != ENOMEM) {
+			err = got_error_from_errno("mmap");
+			map = NULL;
+			goto done;
+		}
+		map = NULL; /* fall back to read(2) */
+	} else
+		mapped = 1;
+#endif
+	if (map == NULL) {
+		ssize_t n;
+
+		map = malloc(len);
+		if (map == NULL) {
+			err = got_error_from_errno("malloc");
+			goto done;
+		}
+		n = pread(fd, map, len, 0);
+		if (n == -1) {
+			err = got_error_from_errno("pread");
+			goto done;
+		}
+		if ((size_t)n != len) {
+			err = got_error(GOT_ERR_BAD_PACKIDX);
+			goto done;
+		}
+	}
+
+	hdr = (struct got_packidx_rev_hdr *)map;
+	hash_id = (p->algo == GOT_HASH_SHA256) ? GOT_PACKIDX_REV_HASH_SHA256 :
+	    GOT_PACKIDX_REV_HASH_SHA1;
+	if (be32toh(hdr->signature) != GOT_PACKIDX_REV_SIGNATURE ||
+	    be32toh(hdr->version) != GOT_PACKIDX_REV_VERSION ||
+	    be32toh(hdr->hash_id) != hash_id ||
+	    memcmp(map + len - 2 * digest_len, p->hdr.trailer.packfile_hash,
+	    digest_len) != 0)
+		goto done;
+
+	/* Ignore corrupt reverse index files. */
+	got_hash_init(&ctx, p->algo);
+	got_hash_update(&ctx, map, len - digest_len);
+	got_hash_final(&ctx, csum);
+	if (memcmp(map + len - digest_len, csum, digest_len) != 0)
+		goto done;
+
+	p->rev_map = map;
+	p->rev_len = len;
+	p->rev_mapped = mapped;
+	p->rev_fd = fd;
+	p->rev = (uint32_t *)(map + sizeof(*hdr));
+	map = NULL;
+	fd = -1;
+done:
+	if (map) {
+		if (mapped)
+			munmap(map, len);
+		else
+			free(map);
+	}
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	return err;
+}
+
+const struct got_error *
+got_packidx_get_reverse_index_path(char **path_rev, const char *path_packidx)
+{
+	size_t len = strlen(path_packidx);
+
+	*path_rev = NULL;
+
+	if (len < strlen(GOT_PACKIDX_SUFFIX) ||
+	    strcmp(path_packidx + len - strlen(GOT_PACKIDX_SUFFIX),
+	    GOT_PACKIDX_SUFFIX) != 0)
+		return got_error_path(path_packidx, GOT_ERR_BAD_PATH);
+
+	if (asprintf(path_rev, "%.*s%s",
+	    (int)(len - strlen(GOT_PACKIDX_SUFFIX)), path_packidx,
+	    GOT_PACKIDX_REV_SUFFIX) == -1) {
+		*path_rev = NULL;
+		return got_error_from_errno("asprintf");
+	}
+
+	return NULL;
+}
+
 const struct got_error *
 got_packidx_close(struct got_packidx *packidx)
 {
@@ -439,6 +578,16 @@ got_packidx_close(struct got_packidx *packidx)
 	}
 	if (close(packidx->fd) == -1 && err == NULL)
 		err = got_error_from_errno("close");
+	if (packidx->rev_map) {
+		if (packidx->rev_mapped) {
+			if (munmap(packidx->rev_map, packidx->rev_len) == -1 &&
+			    err == NULL)
+				err = got_error_from_errno("munmap");
+		} else
+			free(packidx->rev_map);
+		if (close(packidx->rev_fd) == -1 && err == NULL)
+			err = got_error_from_errno("close");
+	}
 	free(packidx->sorted_offsets);
 	free(packidx->sorted_large_offsets);
 	free(packidx);
@@ -602,54 +751,231 @@ build_offset_index(struct got_packidx *p)
 	return NULL;
 }
 
+/*
+ * Return the pack index position of the object at the given position in
+ * pack file order, or -1 if the pack index is corrupt.
+ * The offset index must have been built if no reverse index exists.
+ */
+static int
+get_pack_order_idx(struct got_packidx *packidx, uint32_t pos)
+{
+	uint32_t totobj = be32toh(packidx->hdr.fanout_table[0xff]);
+	size_t nsmall = totobj - packidx->nlargeobj;
+	uint32_t idx;
+
+	if (pos >= totobj)
+		return -1;
+
+	if (packidx->rev)
+		idx = be32toh(packidx->rev[pos]);
+	else if (pos < nsmall)
+		idx = packidx->sorted_offsets[pos].idx;
+	else /* Large offsets always follow offsets which fit into 31 bits. */
+		idx = packidx->sorted_large_offsets[pos - nsmall].idx;
+
+	if (idx >= totobj)
+		return -1;
+	return idx;
+}
+
+static const struct got_error *
+get_offset_pos(uint32_t *pos, struct got_packidx *packidx, off_t offset)
+{
+	const struct got_error *err;
+	uint32_t totobj = be32toh(packidx->hdr.fanout_table[0xff]);
+	int left = 0, right = totobj - 1;
+
+	if (packidx->rev == NULL && packidx->sorted_offsets == NULL) {
+		err = build_offset_index(packidx);
+		if (err)
+			return err;
+	}
+
+	while (left <= right) {
+		int i = ((left + right) / 2);
+		int idx = get_pack_order_idx(packidx, i);
+		off_t o;
+
+		if (idx == -1)
+			return got_error(GOT_ERR_BAD_PACKIDX);
+		o = got_packidx_get_object_offset(packidx, idx);
+		if (o == -1)
+			return got_error(GOT_ERR_BAD_PACKIDX);
+		if (o == offset) {
+			*pos = i;
+			return NULL;
+		} else if (offset > o)
+			left = i + 1;
+		else
+			right = i - 1;
+	}
+
+	return got_error(GOT_ERR_NO_OBJ);
+}
+
 const struct got_error *
 got_packidx_get_offset_idx(int *idx, struct got_packidx *packidx, off_t offset)
 {
 	const struct got_error *err;
-	uint32_t totobj = be32toh(packidx->hdr.fanout_table[0xff]);
-	int i, left, right;
+	uint32_t pos;
 
 	*idx = -1;
 
-	if (packidx->sorted_offsets == NULL) {
+	err = get_offset_pos(&pos, packidx, offset);
+	if (err) {
+		if (err->code == GOT_ERR_NO_OBJ)
+			err = NULL;
+		return err;
+	}
+
+	*idx = get_pack_order_idx(packidx, pos);
+	return NULL;
+}
+
+const struct got_error *
+got_packidx_get_pack_order(uint32_t **order, struct got_packidx *packidx)
+{
+	const struct got_error *err;
+	uint32_t totobj = be32toh(packidx->hdr.fanout_table[0xff]);
+	uint32_t i;
+	off_t prev_offset = -1;
+
+	*order = NULL;
+
+	if (packidx->rev == NULL && packidx->sorted_offsets == NULL) {
 		err = build_offset_index(packidx);
 		if (err)
 			return err;
 	}
 
-	if (offset >= 0x7fffffff) {
-		uint64_t lo;
-		left = 0, right = packidx->nlargeobj - 1;
-		while (left <= right) {
-			i = ((left + right) / 2);
-			lo = packidx->sorted_large_offsets[i].offset;
-			if (lo == offset) {
-				*idx = packidx->sorted_large_offsets[i].idx;
-				break;
-			} else if (offset > lo)
-				left = i + 1;
-			else if (offset < lo)
-				right = i - 1;
-		}
+	*order = calloc(totobj ? totobj : 1, sizeof(**order));
+	if (*order == NULL)
+		return got_error_from_errno("calloc");
+
+	for (i = 0; i < totobj; i++) {
+		int idx = get_pack_order_idx(packidx, i);
+		off_t offset;
+
+		/* Callers rely on the order, so verify it. */
+		if (idx == -1)
+			break;
+		offset = got_packidx_get_object_offset(packidx, idx);
+		if (offset == -1 || offset <= prev_offset)
+			break;
+		prev_offset = offset;
+		(*order)[i] = idx;
+	}
+	if (i < totobj) {
+		free(*order);
+		*order = NULL;
+		return got_error(GOT_ERR_BAD_PACKIDX);
+	}
+
+	return NULL;
+}
+
+const struct got_error *
+got_packidx_get_packed_size(off_t *size, struct got_packidx *packidx, int idx)
+{
+	const struct got_error *err;
+	uint32_t totobj = be32toh(packidx->hdr.fanout_table[0xff]);
+	size_t digest_len = got_hash_digest_length(packidx->algo);
+	off_t offset, next_offset;
+	uint32_t pos;
+
+	*size = 0;
+
+	offset = got_packidx_get_object_offset(packidx, idx);
+	if (offset == -1)
+		return got_error(GOT_ERR_BAD_PACKIDX);
+
+	err = get_offset_pos(&pos, packidx, offset);
+	if (err) {
+		if (err->code == GOT_ERR_NO_OBJ)
+			err = got_error(GOT_ERR_BAD_PACKIDX);
+		return err;
+	}
+
+	if (pos + 1 < totobj) {
+		int next_idx = get_pack_order_idx(packidx, pos + 1);
+		if (next_idx == -1)
+			return got_error(GOT_ERR_BAD_PACKIDX);
+		next_offset = got_packidx_get_object_offset(packidx, next_idx);
+		if (next_offset == -1)
+			return got_error(GOT_ERR_BAD_PACKIDX);
 	} else {
-		uint32_t o;
-		left = 0, right = totobj - packidx->nlargeobj - 1;
-		while (left <= right) {
-			i = ((left + right) / 2);
-			o = packidx->sorted_offsets[i].offset;
-			if (o == offset) {
-				*idx = packidx->sorted_offsets[i].idx;
-				break;
-			} else if (offset > o)
-				left = i + 1;
-			else if (offset < o)
-				right = i - 1;
-		}
+		/* The last object is followed by the pack file checksum. */
+		next_offset = packidx->packfile_size - digest_len;
 	}
 
+	if (next_offset <= offset)
+		return got_error(GOT_ERR_BAD_PACKIDX);
+
+	*size = next_offset - offset;
+	return NULL;
+}
+
+static const struct got_error *
+write_reverse_index(int fd, const void *buf, size_t len, struct got_hash *ctx)
+{
+	ssize_t w;
+
+	if (ctx)
+		got_hash_update(ctx, buf, len);
+
+	w = write(fd, buf, len);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if ((size_t)w != len)
+		return got_error(GOT_ERR_IO);
+
 	return NULL;
 }
 
+const struct got_error *
+got_packidx_write_reverse_index(int fd, struct got_packidx *packidx)
+{
+	const struct got_error *err;
+	struct got_packidx_rev_hdr hdr;
+	struct got_hash ctx;
+	uint8_t hash[GOT_HASH_DIGEST_MAXLEN];
+	size_t digest_len = got_hash_digest_length(packidx->algo);
+	uint32_t *order = NULL, totobj, i;
+
+	err = got_packidx_get_pack_order(&order, packidx);
+	if (err)
+		return err;
+
+	got_hash_init(&ctx, packidx->algo);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.signature = htobe32(GOT_PACKIDX_REV_SIGNATURE);
+	hdr.version = htobe32(GOT_PACKIDX_REV_VERSION);
+	hdr.hash_id = htobe32(packidx->algo == GOT_HASH_SHA256 ?
+	    GOT_PACKIDX_REV_HASH_SHA256 : GOT_PACKIDX_REV_HASH_SHA1);
+	err = write_reverse_index(fd, &hdr, sizeof(hdr), &ctx);
+	if (err)
+		goto done;
+
+	totobj = be32toh(packidx->hdr.fanout_table[0xff]);
+	for (i = 0; i < totobj; i++)
+		order[i] = htobe32(order[i]);
+	err = write_reverse_index(fd, order, totobj * sizeof(order[0]), &ctx);
+	if (err)
+		goto done;
+
+	err = write_reverse_index(fd, packidx->hdr.trailer.packfile_hash,
+	    digest_len, &ctx);
+	if (err)
+		goto done;
+
+	got_hash_final(&ctx, hash);
+	err = write_reverse_index(fd, hash, digest_len, NULL);
+done:
+	free(order);
+	return err;
+}
+
 const struct got_error *
 got_packidx_get_object_id(struct got_object_id *id,
     struct got_packidx *packidx, int idx)
@@ -753,6 +1079,8 @@ got_pack_start_privsep_child(struct got_pack *pack, struct got_packidx *packidx)
 	}
 	pack->child_has_tempfiles = 0;
 	pack->child_has_delta_outfd = 0;
+	pack->child_has_commit_graph = 0;
+	pack->child_has_shm = 0;
 
 	if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, imsg_fds) == -1) {
 		err = got_error_from_errno("socketpair");
@@ -826,6 +1154,10 @@ pack_stop_privsep_child(struct got_pack *pack)
 		err = child_err;
 	imsgbuf_clear(pack->privsep_child->ibuf);
 	free(pack->privsep_child->ibuf);
+	if (pack->privsep_child->shm &&
+	    munmap(pack->privsep_child->shm,
+	    pack->privsep_child->shm_size) == -1 && err == NULL)
+		err = got_error_from_errno("munmap");
 	free(pack->privsep_child);
 	pack->privsep_child = NULL;
 	return err;
@@ -1021,7 +1353,7 @@ got_pack_parse_offset_delta(off_t *base_offset, size_t *len,
 static const struct got_error *
 read_delta_data(uint8_t **delta_buf, size_t *delta_len,
     size_t *delta_compressed_len, size_t delta_data_offset,
-    struct got_pack *pack)
+    size_t delta_size, struct got_pack *pack)
 {
 	const struct got_error *err = NULL;
 	size_t consumed = 0;
@@ -1030,7 +1362,7 @@ read_delta_data(uint8_t **delta_buf, size_t *delta_len,
 		if (delta_data_offset >= pack->filesize)
 			return got_error(GOT_ERR_PACK_OFFSET);
 		err = got_inflate_to_mem_mmap(delta_buf, delta_len,
-		    &consumed, NULL, pack->map, delta_data_offset,
+		    &consumed, NULL, delta_size, pack->map, delta_data_offset,
 		    pack->filesize - delta_data_offset);
 		if (err)
 			return err;
@@ -1038,7 +1370,7 @@ read_delta_data(uint8_t **delta_buf, size_t *delta_len,
 		if (lseek(pack->fd, delta_data_offset, SEEK_SET) == -1)
 			return got_error_from_errno("lseek");
 		err = got_inflate_to_mem_fd(delta_buf, delta_len,
-		    &consumed, NULL, 0, pack->fd);
+		    &consumed, NULL, delta_size, pack->fd);
 		if (err)
 			return err;
 	}
@@ -1344,7 +1676,7 @@ got_pack_get_delta_chain_max_size(uint64_t *max_size,
 			if (delta_buf == NULL) {
 				cached = 0;
 				err = read_delta_data(&delta_buf, &delta_len,
-				    NULL, delta->data_offset, pack);
+				    NULL, delta->data_offset, delta->size, pack);
 				if (err)
 					return err;
 			}
@@ -1385,13 +1717,52 @@ got_pack_get_max_delta_object_size(uint64_t *size, struct got_object *obj,
 	return got_pack_get_delta_chain_max_size(size, &obj->deltas, pack);
 }
 
+/*
+ * Find the last delta in the chain for which the delta cache holds a
+ * fulltext. Resolving the chain can resume from this point instead of
+ * starting over at the delta base. Return the number of chain entries
+ * which the cached fulltext covers in *nentries.
+ */
+static void
+get_cached_fulltext(struct got_delta **cached_delta, int *nentries,
+    uint8_t **fulltext, size_t *fulltext_len,
+    struct got_delta_chain *deltas, struct got_pack *pack)
+{
+	struct got_delta *delta;
+	int n = 0;
+
+	*cached_delta = NULL;
+	*nentries = 0;
+	*fulltext = NULL;
+	*fulltext_len = 0;
+
+	STAILQ_FOREACH(delta, &deltas->entries, entry) {
+		uint8_t *delta_buf, *buf;
+		size_t delta_len, len;
+		off_t offset;
+
+		if (n++ == 0)
+			offset = delta->offset + delta->tslen;
+		else
+			offset = delta->data_offset;
+		got_delta_cache_get(&delta_buf, &delta_len, &buf, &len,
+		    pack->delta_cache, offset);
+		if (buf == NULL)
+			continue;
+		*cached_delta = delta;
+		*nentries = n;
+		*fulltext = buf;
+		*fulltext_len = len;
+	}
+}
+
 const struct got_error *
 got_pack_dump_delta_chain_to_file(size_t *result_size,
     struct got_delta_chain *deltas, struct got_pack *pack, FILE *outfile,
     FILE *base_file, FILE *accum_file)
 {
 	const struct got_error *err = NULL;
-	struct got_delta *delta;
+	struct got_delta *delta = NULL;
 	uint8_t *base_buf = NULL, *accum_buf = NULL;
 	size_t base_bufsz = 0, accum_bufsz = 0, accum_size = 0;
 	/* We process small enough files entirely in memory for speed. */
@@ -1404,15 +1775,18 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 	if (STAILQ_EMPTY(&deltas->entries))
 		return got_error(GOT_ERR_BAD_DELTA_CHAIN);
 
+	if (fseeko(base_file, 0L, SEEK_SET) == -1)
+		return got_error_from_errno("fseeko");
+	if (fseeko(accum_file, 0L, SEEK_SET) == -1)
+		return got_error_from_errno("fseeko");
+
 	if (pack->delta_cache) {
-		uint8_t *delta_buf = NULL, *fulltext = NULL;
-		size_t delta_len, fulltext_len;
-
-		delta = STAILQ_LAST(&deltas->entries, got_delta, entry);
-		got_delta_cache_get(&delta_buf, &delta_len,
-		    &fulltext, &fulltext_len,
-		    pack->delta_cache, delta->data_offset);
-		if (fulltext) {
+		uint8_t *fulltext;
+		size_t fulltext_len;
+
+		get_cached_fulltext(&delta, &n, &fulltext, &fulltext_len,
+		    deltas, pack);
+		if (delta && n == deltas->nentries) {
 			size_t w;
 
 			w = fwrite(fulltext, 1, fulltext_len, outfile);
@@ -1423,17 +1797,32 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 			*result_size = fulltext_len;
 			return NULL;
 		}
+		if (delta) {
+			/* Resume from the cached intermediate fulltext. */
+			base_buf = malloc(fulltext_len);
+			if (base_buf == NULL) {
+				err = got_error_from_errno("malloc");
+				goto done;
+			}
+			memcpy(base_buf, fulltext, fulltext_len);
+			base_bufsz = fulltext_len;
+			accum_buf = malloc(fulltext_len);
+			if (accum_buf == NULL) {
+				err = got_error_from_errno("malloc");
+				goto done;
+			}
+			accum_bufsz = fulltext_len;
+			max_size = fulltext_len;
+			delta = STAILQ_NEXT(delta, entry);
+		}
 	}
-
-	if (fseeko(base_file, 0L, SEEK_SET) == -1)
-		return got_error_from_errno("fseeko");
-	if (fseeko(accum_file, 0L, SEEK_SET) == -1)
-		return got_error_from_errno("fseeko");
+	if (delta == NULL)
+		delta = STAILQ_FIRST(&deltas->entries);
 
 	/* Deltas are ordered in ascending order. */
-	STAILQ_FOREACH(delta, &deltas->entries, entry) {
-		uint8_t *delta_buf = NULL, *fulltext = NULL;
-		size_t delta_len, fulltext_len;
+	for (; delta; delta = STAILQ_NEXT(delta, entry)) {
+		uint8_t *delta_buf = NULL;
+		size_t delta_len;
 		uint64_t base_size, result_size = 0;
 		int cached = 1;
 		if (n == 0) {
@@ -1503,7 +1892,7 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 
 					mapoff = delta_data_offset;
 					err = got_inflate_to_mem_mmap(&base_buf,
-					    &base_bufsz, NULL, NULL,
+					    &base_bufsz, NULL, NULL, delta->size,
 					    pack->map, mapoff,
 					    pack->filesize - mapoff);
 				} else
@@ -1516,36 +1905,25 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 			n++;
 			if (base_buf == NULL)
 				rewind(base_file);
-			else if (pack->delta_cache && fulltext == NULL) {
-				err = got_delta_cache_add(pack->delta_cache,
-				    delta_data_offset, NULL, 0);
-				if (err) {
-					if (err->code != GOT_ERR_NO_SPACE)
-						goto done;
-					err = NULL;
-				} else {
-					err = got_delta_cache_add_fulltext(
-					    pack->delta_cache,
-					    delta_data_offset,
-					    base_buf, base_bufsz);
-					if (err &&
-					    err->code != GOT_ERR_NO_SPACE)
-						goto done;
-					err = NULL;
-				}
+			else if (pack->delta_cache) {
+				err = got_delta_cache_add_fulltext(
+				    pack->delta_cache, delta_data_offset,
+				    base_buf, base_bufsz);
+				if (err && err->code != GOT_ERR_NO_SPACE)
+					goto done;
+				err = NULL;
 			}
 			continue;
 		}
 
 		if (pack->delta_cache) {
 			got_delta_cache_get(&delta_buf, &delta_len,
-			    &fulltext, &fulltext_len,
-			    pack->delta_cache, delta->data_offset);
+			    NULL, NULL, pack->delta_cache, delta->data_offset);
 		}
 		if (delta_buf == NULL) {
 			cached = 0;
 			err = read_delta_data(&delta_buf, &delta_len, NULL,
-			    delta->data_offset, pack);
+			    delta->data_offset, delta->size, pack);
 			if (err)
 				goto done;
 		}
@@ -1571,8 +1949,6 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 			max_size = base_size;
 		if (result_size > max_size)
 			max_size = result_size;
-		if (fulltext_len > max_size)
-			max_size = fulltext_len;
 
 		if (base_buf && max_size > max_bufsize) {
 			/* Switch from buffers to temporary files. */
@@ -1615,21 +1991,15 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 		}
 
 		if (base_buf) {
-			if (fulltext) {
-				memcpy(accum_buf, fulltext, fulltext_len);
-				accum_size = fulltext_len;
-				err = NULL;
-			} else {
-				err = got_delta_apply_in_mem(base_buf,
-				    base_bufsz, delta_buf, delta_len,
-				    accum_buf, &accum_size, max_size);
-			}
+			err = got_delta_apply_in_mem(base_buf, base_bufsz,
+			    delta_buf, delta_len, accum_buf, &accum_size,
+			    max_size);
 			n++;
 			if (!cached)
 				free(delta_buf);
 			if (err)
 				goto done;
-			if (fulltext == NULL) {
+			if (pack->delta_cache) {
 				err = got_delta_cache_add_fulltext(
 				    pack->delta_cache, delta->data_offset,
 				    accum_buf, accum_size);
@@ -1688,12 +2058,17 @@ done:
 	return err;
 }
 
-const struct got_error *
-got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
-    struct got_delta_chain *deltas, struct got_pack *pack)
+/*
+ * Apply a delta chain in memory. If buf is not NULL, the result is written
+ * to buf, which is bufsize bytes large, and *outbuf is left NULL.
+ * Otherwise, the result is returned in a newly allocated *outbuf.
+ */
+static const struct got_error *
+dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen, uint8_t *buf,
+    size_t bufsize, struct got_delta_chain *deltas, struct got_pack *pack)
 {
 	const struct got_error *err = NULL;
-	struct got_delta *delta;
+	struct got_delta *delta = NULL;
 	uint8_t *base_buf = NULL, *accum_buf = NULL;
 	size_t base_bufsz = 0, accum_bufsz = 0, accum_size = 0;
 	uint64_t max_size = 0;
@@ -1706,27 +2081,40 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 		return got_error(GOT_ERR_BAD_DELTA_CHAIN);
 
 	if (pack->delta_cache) {
-		uint8_t *delta_buf = NULL, *fulltext = NULL;
-		size_t delta_len, fulltext_len;
-
-		delta = STAILQ_LAST(&deltas->entries, got_delta, entry);
-		got_delta_cache_get(&delta_buf, &delta_len,
-		    &fulltext, &fulltext_len,
-		    pack->delta_cache, delta->data_offset);
-		if (fulltext) {
-			*outbuf = malloc(fulltext_len);
-			if (*outbuf == NULL)
-				return got_error_from_errno("malloc");
-			memcpy(*outbuf, fulltext, fulltext_len);
+		uint8_t *fulltext;
+		size_t fulltext_len;
+
+		get_cached_fulltext(&delta, &n, &fulltext, &fulltext_len,
+		    deltas, pack);
+		if (delta && buf && n == deltas->nentries) {
+			if (fulltext_len > bufsize)
+				return got_error(GOT_ERR_NO_SPACE);
+			memcpy(buf, fulltext, fulltext_len);
 			*outlen = fulltext_len;
 			return NULL;
 		}
+		if (delta) {
+			base_buf = malloc(fulltext_len);
+			if (base_buf == NULL)
+				return got_error_from_errno("malloc");
+			memcpy(base_buf, fulltext, fulltext_len);
+			if (n == deltas->nentries) {
+				*outbuf = base_buf;
+				*outlen = fulltext_len;
+				return NULL;
+			}
+			base_bufsz = fulltext_len;
+			max_size = fulltext_len;
+			delta = STAILQ_NEXT(delta, entry);
+		}
 	}
+	if (delta == NULL)
+		delta = STAILQ_FIRST(&deltas->entries);
 
 	/* Deltas are ordered in ascending order. */
-	STAILQ_FOREACH(delta, &deltas->entries, entry) {
-		uint8_t *delta_buf = NULL, *fulltext = NULL;
-		size_t delta_len, fulltext_len = 0;
+	for (; delta; delta = STAILQ_NEXT(delta, entry)) {
+		uint8_t *delta_buf = NULL;
+		size_t delta_len;
 		uint64_t base_size, result_size = 0;
 		int cached = 1;
 		if (n == 0) {
@@ -1747,26 +2135,10 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 				goto done;
 			}
 
-			if (pack->delta_cache) {
-				got_delta_cache_get(&delta_buf, &delta_len,
-				    &fulltext, &fulltext_len,
-				    pack->delta_cache, delta_data_offset);
-			}
-
 			if (delta->size > max_size)
 				max_size = delta->size;
-			if (delta->size > fulltext_len)
-				max_size = fulltext_len;
 
-			if (fulltext) {
-				base_buf = malloc(fulltext_len);
-				if (base_buf == NULL) {
-					err = got_error_from_errno("malloc");
-					goto done;
-				}
-				memcpy(base_buf, fulltext, fulltext_len);
-				base_bufsz = fulltext_len;
-			} else if (pack->map) {
+			if (pack->map) {
 				size_t mapoff;
 
 				if (delta_data_offset > SIZE_MAX) {
@@ -1778,8 +2150,8 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 
 				mapoff = delta_data_offset;
 				err = got_inflate_to_mem_mmap(&base_buf,
-				    &base_bufsz, NULL, NULL, pack->map,
-				    mapoff, pack->filesize - mapoff);
+				    &base_bufsz, NULL, NULL, delta->size,
+				    pack->map, mapoff, pack->filesize - mapoff);
 			} else {
 				if (lseek(pack->fd, delta_data_offset, SEEK_SET)
 				    == -1) {
@@ -1794,36 +2166,25 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 				goto done;
 			n++;
 
-			if (pack->delta_cache && fulltext == NULL) {
-				err = got_delta_cache_add(pack->delta_cache,
-				    delta_data_offset, NULL, 0);
-				if (err) {
-					if (err->code != GOT_ERR_NO_SPACE)
-						goto done;
-					err = NULL;
-				} else {
-					err = got_delta_cache_add_fulltext(
-					    pack->delta_cache,
-					    delta_data_offset,
-					    base_buf, base_bufsz);
-					if (err &&
-					    err->code != GOT_ERR_NO_SPACE)
-						goto done;
-					err = NULL;
-				}
+			if (pack->delta_cache) {
+				err = got_delta_cache_add_fulltext(
+				    pack->delta_cache, delta_data_offset,
+				    base_buf, base_bufsz);
+				if (err && err->code != GOT_ERR_NO_SPACE)
+					goto done;
+				err = NULL;
 			}
 			continue;
 		}
 
 		if (pack->delta_cache) {
 			got_delta_cache_get(&delta_buf, &delta_len,
-			    &fulltext, &fulltext_len,
-			    pack->delta_cache, delta->data_offset);
+			    NULL, NULL, pack->delta_cache, delta->data_offset);
 		}
 		if (delta_buf == NULL) {
 			cached = 0;
 			err = read_delta_data(&delta_buf, &delta_len, NULL,
-			    delta->data_offset, pack);
+			    delta->data_offset, delta->size, pack);
 			if (err)
 				goto done;
 		}
@@ -1849,8 +2210,6 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 			max_size = base_size;
 		if (result_size > max_size)
 			max_size = result_size;
-		if (fulltext_len > max_size)
-			max_size = fulltext_len;
 
 		if (max_size > base_bufsz) {
 			uint8_t *p = realloc(base_buf, max_size);
@@ -1864,7 +2223,18 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 			base_bufsz = max_size;
 		}
 
-		if (max_size > accum_bufsz) {
+		if (buf && n + 1 == deltas->nentries) {
+			/* Write the final result to the caller's buffer. */
+			if (result_size > bufsize) {
+				err = got_error(GOT_ERR_NO_SPACE);
+				if (!cached)
+					free(delta_buf);
+				goto done;
+			}
+			free(accum_buf);
+			accum_buf = buf;
+			accum_bufsz = bufsize;
+		} else if (max_size > accum_bufsz) {
 			uint8_t *p = realloc(accum_buf, max_size);
 			if (p == NULL) {
 				err = got_error_from_errno("realloc");
@@ -1876,22 +2246,26 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 			accum_bufsz = max_size;
 		}
 
-		if (fulltext) {
-			memcpy(accum_buf, fulltext, fulltext_len);
-			accum_size = fulltext_len;
-			err = NULL;
-		} else {
-			err = got_delta_apply_in_mem(base_buf, base_bufsz,
-			    delta_buf, delta_len, accum_buf,
-			    &accum_size, max_size);
-		}
+		/*
+		 * The caller's buffer may be smaller than max_size. Never
+		 * allow the delta to write past the end of accum_buf.
+		 */
+		err = got_delta_apply_in_mem(base_buf, base_bufsz,
+		    delta_buf, delta_len, accum_buf,
+		    &accum_size, accum_bufsz);
 		if (!cached)
 			free(delta_buf);
 		n++;
 		if (err)
 			goto done;
 
-		if (fulltext == NULL) {
+		if (pack->delta_cache) {
+			/*
+			 * Cache intermediate results as well as the final
+			 * fulltext. Other objects which are deltified
+			 * against the same base can then skip the beginning
+			 * of the delta chain.
+			 */
 			err = got_delta_cache_add_fulltext(pack->delta_cache,
 			    delta->data_offset, accum_buf, accum_size);
 			if (err) {
@@ -1914,7 +2288,10 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 
 done:
 	free(base_buf);
-	if (err) {
+	if (accum_buf == buf) {
+		if (err == NULL)
+			*outlen = accum_size;
+	} else if (err) {
 		free(accum_buf);
 		*outbuf = NULL;
 		*outlen = 0;
@@ -1925,6 +2302,13 @@ done:
 	return err;
 }
 
+const struct got_error *
+got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
+    struct got_delta_chain *deltas, struct got_pack *pack)
+{
+	return dump_delta_chain_to_mem(outbuf, outlen, NULL, 0, deltas, pack);
+}
+
 const struct got_error *
 got_packfile_extract_object(struct got_pack *pack, struct got_object *obj,
     FILE *outfile, FILE *base_file, FILE *accum_file)
@@ -1964,6 +2348,52 @@ got_packfile_extract_object(struct got_pack *pack, struct got_object *obj,
 	return err;
 }
 
+const struct got_error *
+got_packfile_extract_object_to_buf(uint8_t *buf, size_t bufsize, size_t *len,
+    struct got_object *obj, struct got_pack *pack)
+{
+	const struct got_error *err;
+	uint8_t *outbuf = NULL;
+	size_t mapoff;
+
+	*len = 0;
+
+	if ((obj->flags & GOT_OBJ_FLAG_PACKED) == 0)
+		return got_error(GOT_ERR_OBJ_NOT_PACKED);
+
+	if (obj->flags & GOT_OBJ_FLAG_DELTIFIED) {
+		return dump_delta_chain_to_mem(&outbuf, len, buf, bufsize,
+		    &obj->deltas, pack);
+	}
+
+	if (obj->pack_offset >= pack->filesize)
+		return got_error(GOT_ERR_PACK_OFFSET);
+
+	if (pack->map == NULL) {
+		err = got_packfile_extract_object_to_mem(&outbuf, len,
+		    obj, pack);
+		if (err)
+			return err;
+		if (*len > bufsize) {
+			free(outbuf);
+			*len = 0;
+			return got_error(GOT_ERR_NO_SPACE);
+		}
+		memcpy(buf, outbuf, *len);
+		free(outbuf);
+		return NULL;
+	}
+
+	if (obj->pack_offset > SIZE_MAX) {
+		return got_error_fmt(GOT_ERR_RANGE,
+		    "pack offset %lld would overflow size_t",
+		    (long long)obj->pack_offset);
+	}
+	mapoff = obj->pack_offset;
+	return got_inflate_to_buf_mmap(buf, bufsize, len, pack->map, mapoff,
+	    pack->filesize - mapoff);
+}
+
 const struct got_error *
 got_packfile_extract_object_to_mem(uint8_t **buf, size_t *len,
     struct got_object *obj, struct got_pack *pack)
@@ -1987,7 +2417,8 @@ got_packfile_extract_object_to_mem(uint8_t **buf, size_t *len,
 
 			mapoff = obj->pack_offset;
 			err = got_inflate_to_mem_mmap(buf, len, NULL, NULL,
-			    pack->map, mapoff, pack->filesize - mapoff);
+			    obj->size, pack->map, mapoff,
+			    pack->filesize - mapoff);
 		} else {
 			if (lseek(pack->fd, obj->pack_offset, SEEK_SET) == -1)
 				return got_error_from_errno("lseek");
@@ -2010,7 +2441,7 @@ read_raw_delta_data(uint8_t **delta_buf, size_t *delta_len,
 
 	/* Validate decompression and obtain the decompressed size. */
 	err = read_delta_data(delta_buf, delta_len, delta_len_compressed,
-	    delta_data_offset, pack);
+	    delta_data_offset, 0, pack);
 	if (err)
 		return err;
 
@@ -2061,6 +2492,96 @@ done:
 	return err;
 }
 
+/*
+ * Read raw delta data of a known packed size from the pack file.
+ * The data is checked against the CRC32 stored in the pack index, and only
+ * the head of the delta stream is decompressed to obtain base/result sizes.
+ */
+static const struct got_error *
+read_packed_raw_delta_data(uint8_t **delta_buf, size_t *delta_len_compressed,
+    uint64_t *base_size, uint64_t *result_size, off_t offset,
+    off_t delta_data_offset, struct got_pack *pack,
+    struct got_packidx *packidx, int idx)
+{
+	const struct got_error *err = NULL;
+	struct got_inflate_buf zb;
+	uint8_t hdr[64], head[32];
+	size_t hdrlen, headlen, consumed;
+	off_t packed_size, end;
+	uint32_t crc;
+
+	err = got_packidx_get_packed_size(&packed_size, packidx, idx);
+	if (err)
+		return err;
+
+	end = offset + packed_size;
+	if (end < offset || end > pack->filesize || delta_data_offset >= end)
+		return got_error(GOT_ERR_PACK_OFFSET);
+	hdrlen = delta_data_offset - offset;
+	if (hdrlen > sizeof(hdr) || end - delta_data_offset > SIZE_MAX)
+		return got_error(GOT_ERR_BAD_DELTA);
+	*delta_len_compressed = end - delta_data_offset;
+
+	*delta_buf = malloc(*delta_len_compressed);
+	if (*delta_buf == NULL)
+		return got_error_from_errno("malloc");
+
+	if (pack->map) {
+		memcpy(hdr, pack->map + offset, hdrlen);
+		memcpy(*delta_buf, pack->map + delta_data_offset,
+		    *delta_len_compressed);
+	} else {
+		ssize_t n;
+
+		n = pread(pack->fd, hdr, hdrlen, offset);
+		if (n == -1) {
+			err = got_error_from_errno("pread");
+			goto done;
+		} else if ((size_t)n != hdrlen) {
+			err = got_error(GOT_ERR_IO);
+			goto done;
+		}
+		n = pread(pack->fd, *delta_buf, *delta_len_compressed,
+		    delta_data_offset);
+		if (n == -1) {
+			err = got_error_from_errno("pread");
+			goto done;
+		} else if ((size_t)n != *delta_len_compressed) {
+			err = got_error(GOT_ERR_IO);
+			goto done;
+		}
+	}
+
+	crc = crc32(0L, NULL, 0);
+	crc = crc32(crc, hdr, hdrlen);
+	crc = crc32(crc, *delta_buf, *delta_len_compressed);
+	if (crc != be32toh(packidx->hdr.crc32[idx])) {
+		err = got_error_msg(GOT_ERR_BAD_DELTA,
+		    "CRC32 mismatch in packed delta data");
+		goto done;
+	}
+
+	/* Read delta base/result sizes from head of delta stream. */
+	err = got_inflate_init(&zb, head, sizeof(head), NULL);
+	if (err)
+		goto done;
+	err = got_inflate_read_mmap(&zb, *delta_buf, 0, *delta_len_compressed,
+	    &headlen, &consumed);
+	got_inflate_end(&zb);
+	if (err)
+		goto done;
+	err = got_delta_get_sizes(base_size, result_size, head, headlen);
+done:
+	if (err) {
+		free(*delta_buf);
+		*delta_buf = NULL;
+		*delta_len_compressed = 0;
+		*base_size = 0;
+		*result_size = 0;
+	}
+	return err;
+}
+
 const struct got_error *
 got_packfile_extract_raw_delta(uint8_t **delta_buf, size_t *delta_size,
     size_t *delta_compressed_size, off_t *delta_offset,
@@ -2123,8 +2644,21 @@ got_packfile_extract_raw_delta(uint8_t **delta_buf, size_t *delta_size,
 		return got_error(GOT_ERR_BAD_DELTA);
 
 	*delta_data_offset = offset + tslen + delta_hdrlen;
-	err = read_raw_delta_data(delta_buf, delta_size, delta_compressed_size,
-	    base_size, result_size, *delta_data_offset, pack, packidx);
+	if (packidx->rev) {
+		/*
+		 * The reverse index provides the packed size of the delta.
+		 * There is no need to decompress all of the delta data.
+		 */
+		err = read_packed_raw_delta_data(delta_buf,
+		    delta_compressed_size, base_size, result_size, offset,
+		    *delta_data_offset, pack, packidx, idx);
+		if (err == NULL)
+			*delta_size = size;
+	} else {
+		err = read_raw_delta_data(delta_buf, delta_size,
+		    delta_compressed_size, base_size, result_size,
+		    *delta_data_offset, pack, packidx);
+	}
 	if (err)
 		return err;
 
@@ -0,0 +1,1166 @@
+/*
+ * Copyright (c) 2026 The Got Authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "got_compat.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <sys/tree.h>
+#include <sys/mman.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "got_error.h"
+#include "got_cancel.h"
+#include "got_object.h"
+#include "got_path.h"
+#include "got_repository.h"
+
+#include "got_lib_delta.h"
+#include "got_lib_hash.h"
+#include "got_lib_object.h"
+#include "got_lib_object_cache.h"
+#include "got_lib_object_idset.h"
+#include "got_lib_object_qid.h"
+#include "got_lib_pack.h"
+#include "got_lib_repository.h"
+#include "got_lib_ewah.h"
+#include "got_lib_pack_bitmap.h"
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+
+static uint16_t
+get_be16(const uint8_t *p)
+{
+	uint16_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be16toh(val);
+}
+
+static uint32_t
+get_be32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be32toh(val);
+}
+
+static void
+put_be32(uint8_t *p, uint32_t val)
+{
+	val = htobe32(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+uint32_t
+got_pack_bitmap_name_hash(const char *name)
+{
+	uint32_t c, hash = 0;
+
+	while ((c = (unsigned char)*name++) != 0) {
+		if (isspace(c))
+			continue;
+		hash = (hash >> 2) + (c << 24);
+	}
+
+	return hash;
+}
+
+static const struct got_error *
+alloc_bitmap(struct got_pack_bitmap **bmp, struct got_packidx *packidx)
+{
+	const struct got_error *err;
+	struct got_pack_bitmap *bm;
+	uint32_t i;
+
+	*bmp = NULL;
+
+	bm = calloc(1, sizeof(*bm));
+	if (bm == NULL)
+		return got_error_from_errno("calloc");
+	bm->fd = -1;
+	bm->packidx = packidx;
+	bm->nobjects = be32toh(packidx->hdr.fanout_table[0xff]);
+
+	err = got_packidx_get_pack_order(&bm->pack_order, packidx);
+	if (err)
+		goto done;
+
+	bm->pack_pos = calloc(bm->nobjects ? bm->nobjects : 1,
+	    sizeof(*bm->pack_pos));
+	if (bm->pack_pos == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < bm->nobjects; i++)
+		bm->pack_pos[bm->pack_order[i]] = i;
+
+	err = got_bitmap_alloc(&bm->commits, bm->nobjects);
+	if (err)
+		goto done;
+	err = got_bitmap_alloc(&bm->trees, bm->nobjects);
+	if (err)
+		goto done;
+	err = got_bitmap_alloc(&bm->blobs, bm->nobjects);
+	if (err)
+		goto done;
+	err = got_bitmap_alloc(&bm->tags, bm->nobjects);
+	if (err)
+		goto done;
+
+	bm->entry_ids = got_object_idset_alloc();
+	if (bm->entry_ids == NULL)
+		err = got_error_from_errno("got_object_idset_alloc");
+done:
+	if (err)
+		got_pack_bitmap_close(bm);
+	else
+		*bmp = bm;
+	return err;
+}
+
+static const struct got_error *
+add_entry(struct got_pack_bitmap *bm, struct got_pack_bitmap_entry *e)
+{
+	const struct got_error *err;
+	struct got_object_id id;
+
+	if (bm->nentries == bm->entries_size) {
+		struct got_pack_bitmap_entry **new;
+		size_t new_size = bm->entries_size ?
+		    bm->entries_size * 2 : 64;
+
+		new = reallocarray(bm->entries, new_size, sizeof(*new));
+		if (new == NULL)
+			return got_error_from_errno("reallocarray");
+		bm->entries = new;
+		bm->entries_size = new_size;
+	}
+
+	err = got_packidx_get_object_id(&id, bm->packidx, e->idx);
+	if (err)
+		return err;
+	err = got_object_idset_add(bm->entry_ids, &id, e);
+	if (err)
+		return err;
+
+	e->n = bm->nentries;
+	bm->entries[bm->nentries++] = e;
+	return NULL;
+}
+
+static const struct got_error *
+read_bitmap_file(uint8_t **buf, int fd, size_t len)
+{
+	ssize_t r;
+	size_t off = 0;
+
+	*buf = malloc(len);
+	if (*buf == NULL)
+		return got_error_from_errno("malloc");
+
+	while (off < len) {
+		r = read(fd, *buf + off, len - off);
+		if (r == -1) {
+			free(*buf);
+			*buf = NULL;
+			return got_error_from_errno("read");
+		}
+		if (r == 0) {
+			free(*buf);
+			*buf = NULL;
+			return got_error(GOT_ERR_BAD_BITMAP);
+		}
+		off += r;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+parse_bitmap(struct got_pack_bitmap *bm)
+{
+	const struct got_error *err;
+	size_t digest_len = got_hash_digest_length(bm->packidx->algo);
+	struct got_bitmap *type_bitmaps[] = {
+		bm->commits, bm->trees, bm->blobs, bm->tags
+	};
+	struct got_pack_bitmap_entry *e;
+	uint16_t options;
+	uint32_t nentries, i;
+	size_t off, end, consumed;
+
+	if (bm->len < GOT_PACK_BITMAP_HDR_SIZE + 2 * digest_len)
+		return got_error(GOT_ERR_BAD_BITMAP);
+
+	if (get_be32(bm->map) != GOT_PACK_BITMAP_SIGNATURE ||
+	    get_be16(bm->map + 4) != GOT_PACK_BITMAP_VERSION)
+		return got_error(GOT_ERR_BAD_BITMAP);
+
+	options = get_be16(bm->map + 6);
+	if ((options & GOT_PACK_BITMAP_OPT_FULL_DAG) == 0)
+		return got_error(GOT_ERR_BAD_BITMAP);
+	nentries = get_be32(bm->map + 8);
+
+	/* The bitmap must belong to this particular pack file. */
+	if (memcmp(bm->map + GOT_PACK_BITMAP_HDR_SIZE,
+	    bm->packidx->hdr.trailer.packfile_hash, digest_len) != 0)
+		return got_error(GOT_ERR_BAD_BITMAP);
+
+	off = GOT_PACK_BITMAP_HDR_SIZE + digest_len;
+	end = bm->len - digest_len;
+
+	for (i = 0; i < nitems(type_bitmaps); i++) {
+		err = got_ewah_decode(type_bitmaps[i], bm->map + off,
+		    end - off, &consumed);
+		if (err)
+			return err;
+		off += consumed;
+	}
+
+	for (i = 0; i < nentries; i++) {
+		if (end - off < 6)
+			return got_error(GOT_ERR_BAD_BITMAP);
+
+		e = calloc(1, sizeof(*e));
+		if (e == NULL)
+			return got_error_from_errno("calloc");
+		e->idx = get_be32(bm->map + off);
+		e->xor_offset = bm->map[off + 4];
+		e->flags = bm->map[off + 5];
+		off += 6;
+
+		if (e->idx >= bm->nobjects || e->xor_offset > i) {
+			free(e);
+			return got_error(GOT_ERR_BAD_BITMAP);
+		}
+
+		err = got_ewah_size(&e->ewah_len, bm->map + off, end - off);
+		if (err) {
+			free(e);
+			return err;
+		}
+		e->ewah = bm->map + off;
+		off += e->ewah_len;
+
+		err = add_entry(bm, e);
+		if (err) {
+			free(e);
+			return err;
+		}
+	}
+
+	if (options & GOT_PACK_BITMAP_OPT_HASH_CACHE) {
+		if ((end - off) / sizeof(uint32_t) < bm->nobjects)
+			return got_error(GOT_ERR_BAD_BITMAP);
+		bm->name_hashes = bm->map + off;
+	}
+
+	/* An optional lookup table may follow; we do not need it. */
+	return NULL;
+}
+
+const struct got_error *
+got_pack_bitmap_open(struct got_pack_bitmap **bmp, int fd,
+    struct got_packidx *packidx)
+{
+	const struct got_error *err = NULL;
+	struct got_pack_bitmap *bm;
+	struct stat sb;
+
+	*bmp = NULL;
+
+	err = alloc_bitmap(&bm, packidx);
+	if (err) {
+		close(fd);
+		return err;
+	}
+	bm->fd = fd;
+
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno("fstat");
+		goto done;
+	}
+	if (sb.st_size <= 0 || (uintmax_t)sb.st_size > SIZE_MAX) {
+		err = got_error(GOT_ERR_BAD_BITMAP);
+		goto done;
+	}
+	bm->len = sb.st_size;
+
+#ifndef GOT_PACK_NO_MMAP
+	bm->map = mmap(NULL, bm->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (bm->map == MAP_FAILED) {
+		if (errno != ENOMEM) {
+			bm->map = NULL;
+			err = got_error_from_errno("mmap");
+			goto done;
+		}
+		bm->map = NULL; /* fall back to read(2) */
+	} else
+		bm->mapped = 1;
+#endif
+	if (bm->map == NULL) {
+		err = read_bitmap_file(&bm->map, fd, bm->len);
+		if (err)
+			goto done;
+	}
+
+	err = parse_bitmap(bm);
+done:
+	if (err)
+		got_pack_bitmap_close(bm);
+	else
+		*bmp = bm;
+	return err;
+}
+
+void
+got_pack_bitmap_close(struct got_pack_bitmap *bm)
+{
+	uint32_t i;
+
+	for (i = 0; i < bm->nentries; i++) {
+		free(bm->entries[i]->ewah_buf);
+		free(bm->entries[i]);
+	}
+	free(bm->entries);
+	if (bm->entry_ids)
+		got_object_idset_free(bm->entry_ids);
+	got_bitmap_free(bm->commits);
+	got_bitmap_free(bm->trees);
+	got_bitmap_free(bm->blobs);
+	got_bitmap_free(bm->tags);
+	free(bm->pack_order);
+	free(bm->pack_pos);
+	free(bm->name_hashes_buf);
+	if (bm->map) {
+		if (bm->mapped)
+			munmap(bm->map, bm->len);
+		else
+			free(bm->map);
+	}
+	if (bm->fd != -1)
+		close(bm->fd);
+	if (bm->packidx_owned)
+		got_packidx_close(bm->packidx);
+	free(bm);
+}
+
+const struct got_error *
+got_pack_bitmap_find(struct got_pack_bitmap **bmp,
+    struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_entry *pe;
+	struct got_packidx *packidx = NULL;
+	const char *best_path_packidx = NULL;
+	char *path_bitmap = NULL;
+	size_t len;
+	int fd, best_fd = -1;
+	uint32_t nobj, best_nobj = 0;
+
+	*bmp = NULL;
+
+	RB_FOREACH(pe, got_pathlist_head, &repo->packidx_paths) {
+		const char *path_packidx = pe->path;
+
+		len = strlen(path_packidx);
+		if (len < strlen(GOT_PACKIDX_SUFFIX))
+			continue;
+		len -= strlen(GOT_PACKIDX_SUFFIX);
+		if (asprintf(&path_bitmap, "%.*s%s", (int)len, path_packidx,
+		    GOT_PACK_BITMAP_SUFFIX) == -1) {
+			err = got_error_from_errno("asprintf");
+			goto done;
+		}
+
+		fd = openat(got_repo_get_fd(repo), path_bitmap,
+		    O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd == -1) {
+			if (errno != ENOENT) {
+				err = got_error_from_errno2("openat",
+				    path_bitmap);
+				goto done;
+			}
+			free(path_bitmap);
+			path_bitmap = NULL;
+			continue;
+		}
+		free(path_bitmap);
+		path_bitmap = NULL;
+
+		err = got_repo_get_packidx(&packidx, path_packidx, repo);
+		if (err) {
+			close(fd);
+			goto done;
+		}
+		nobj = be32toh(packidx->hdr.fanout_table[0xff]);
+		if (nobj <= best_nobj) {
+			close(fd);
+			continue;
+		}
+
+		if (best_fd != -1)
+			close(best_fd);
+		best_fd = fd;
+		best_nobj = nobj;
+		best_path_packidx = pe->path;
+	}
+
+	if (best_fd == -1)
+		goto done;
+
+	/*
+	 * Open a private copy of the pack index since entries in the
+	 * repository's pack index cache may be closed at any time.
+	 */
+	err = got_packidx_open(&packidx, got_repo_get_fd(repo),
+	    best_path_packidx, 0, repo->algo);
+	if (err)
+		goto done;
+
+	err = got_pack_bitmap_open(bmp, best_fd, packidx);
+	best_fd = -1;
+	if (err) {
+		got_packidx_close(packidx);
+		/* Ignore bitmaps we cannot read; they are only a cache. */
+		if (err->code == GOT_ERR_BAD_BITMAP)
+			err = NULL;
+		goto done;
+	}
+	(*bmp)->packidx_owned = 1;
+done:
+	if (best_fd != -1)
+		close(best_fd);
+	free(path_bitmap);
+	return err;
+}
+
+int
+got_pack_bitmap_get_type(struct got_pack_bitmap *bm, uint32_t pos)
+{
+	if (got_bitmap_get(bm->commits, pos))
+		return GOT_OBJ_TYPE_COMMIT;
+	if (got_bitmap_get(bm->trees, pos))
+		return GOT_OBJ_TYPE_TREE;
+	if (got_bitmap_get(bm->blobs, pos))
+		return GOT_OBJ_TYPE_BLOB;
+	if (got_bitmap_get(bm->tags, pos))
+		return GOT_OBJ_TYPE_TAG;
+	return GOT_OBJ_TYPE_ANY;
+}
+
+uint32_t
+got_pack_bitmap_get_name_hash(struct got_pack_bitmap *bm, uint32_t pos)
+{
+	if (bm->name_hashes == NULL || pos >= bm->nobjects)
+		return 0;
+	return get_be32(bm->name_hashes + pos * sizeof(uint32_t));
+}
+
+const struct got_error *
+got_pack_bitmap_get_object_id(struct got_object_id *id,
+    struct got_pack_bitmap *bm, uint32_t pos)
+{
+	if (pos >= bm->nobjects)
+		return got_error(GOT_ERR_NO_OBJ);
+	return got_packidx_get_object_id(id, bm->packidx,
+	    bm->pack_order[pos]);
+}
+
+static const struct got_error *
+lookup_pos(uint32_t *pos, struct got_pack_bitmap *bm,
+    struct got_object_id *id)
+{
+	int idx;
+
+	*pos = 0;
+
+	idx = got_packidx_get_object_idx(bm->packidx, id);
+	if (idx == -1)
+		return got_error_no_obj(id);
+
+	*pos = bm->pack_pos[idx];
+	return NULL;
+}
+
+/*
+ * Decode the bitmap of a selected commit. Bitmaps may be stored as an XOR
+ * against the bitmap of an earlier entry, which in turn may be stored as an
+ * XOR against yet another entry. Decode such chains starting from the
+ * oldest entry.
+ */
+static const struct got_error *
+decode_entry(struct got_bitmap *out, struct got_bitmap *tmp,
+    struct got_pack_bitmap *bm, struct got_pack_bitmap_entry *e)
+{
+	const struct got_error *err = NULL;
+	uint32_t *chain = NULL, n;
+	size_t nchain = 0, i;
+	size_t consumed;
+
+	for (n = e->n; ; n -= bm->entries[n]->xor_offset) {
+		uint32_t *new;
+
+		new = reallocarray(chain, nchain + 1, sizeof(*chain));
+		if (new == NULL) {
+			err = got_error_from_errno("reallocarray");
+			goto done;
+		}
+		chain = new;
+		chain[nchain++] = n;
+		if (bm->entries[n]->xor_offset == 0)
+			break;
+	}
+
+	e = bm->entries[chain[nchain - 1]];
+	err = got_ewah_decode(out, e->ewah, e->ewah_len, &consumed);
+	if (err)
+		goto done;
+
+	for (i = nchain - 1; i > 0; i--) {
+		e = bm->entries[chain[i - 1]];
+		err = got_ewah_decode(tmp, e->ewah, e->ewah_len, &consumed);
+		if (err)
+			goto done;
+		got_bitmap_xor(out, tmp);
+	}
+done:
+	free(chain);
+	return err;
+}
+
+struct bitmap_walk {
+	struct got_pack_bitmap *bm;
+	struct got_bitmap *result;
+	struct got_bitmap *tmp;
+	struct got_bitmap *tmp2;
+	struct got_repository *repo;
+	got_cancel_cb cancel_cb;
+	void *cancel_arg;
+	char path[PATH_MAX];
+};
+
+static void
+add_object(struct bitmap_walk *w, uint32_t pos, int obj_type,
+    const char *path)
+{
+	struct got_pack_bitmap *bm = w->bm;
+
+	got_bitmap_set(w->result, pos);
+	if (!bm->writing)
+		return;
+
+	switch (obj_type) {
+	case GOT_OBJ_TYPE_COMMIT:
+		got_bitmap_set(bm->commits, pos);
+		break;
+	case GOT_OBJ_TYPE_TREE:
+		got_bitmap_set(bm->trees, pos);
+		break;
+	case GOT_OBJ_TYPE_BLOB:
+		got_bitmap_set(bm->blobs, pos);
+		break;
+	case GOT_OBJ_TYPE_TAG:
+		got_bitmap_set(bm->tags, pos);
+		break;
+	}
+
+	if (path && path[0] != '\0' && bm->name_hashes_buf &&
+	    get_be32(bm->name_hashes_buf + pos * sizeof(uint32_t)) == 0) {
+		put_be32(bm->name_hashes_buf + pos * sizeof(uint32_t),
+		    got_pack_bitmap_name_hash(path));
+	}
+}
+
+static const struct got_error *
+walk_tree(struct bitmap_walk *w, struct got_object_id *tree_id, size_t pathlen)
+{
+	const struct got_error *err;
+	struct got_tree_object *tree;
+	struct got_tree_entry *te;
+	uint32_t pos;
+	size_t len;
+	int i, nentries;
+
+	if (w->cancel_cb) {
+		err = (*w->cancel_cb)(w->cancel_arg);
+		if (err)
+			return err;
+	}
+
+	err = lookup_pos(&pos, w->bm, tree_id);
+	if (err)
+		return err;
+	if (got_bitmap_get(w->result, pos))
+		return NULL;
+	add_object(w, pos, GOT_OBJ_TYPE_TREE, w->path);
+
+	err = got_object_open_as_tree(&tree, w->repo, tree_id);
+	if (err)
+		return err;
+
+	nentries = got_object_tree_get_nentries(tree);
+	for (i = 0; i < nentries; i++) {
+		const char *name;
+		mode_t mode;
+
+		te = got_object_tree_get_entry(tree, i);
+		if (got_object_tree_entry_is_submodule(te))
+			continue;
+
+		name = got_tree_entry_get_name(te);
+		mode = got_tree_entry_get_mode(te);
+
+		len = strlcpy(w->path + pathlen, pathlen > 0 ? "/" : "",
+		    sizeof(w->path) - pathlen);
+		len += strlcpy(w->path + pathlen + len, name,
+		    sizeof(w->path) - pathlen - len);
+		if (pathlen + len >= sizeof(w->path)) {
+			err = got_error(GOT_ERR_NO_SPACE);
+			break;
+		}
+
+		if (S_ISDIR(mode)) {
+			err = walk_tree(w, got_tree_entry_get_id(te),
+			    pathlen + len);
+			if (err)
+				break;
+		} else {
+			err = lookup_pos(&pos, w->bm, got_tree_entry_get_id(te));
+			if (err)
+				break;
+			if (!got_bitmap_get(w->result, pos))
+				add_object(w, pos, GOT_OBJ_TYPE_BLOB, w->path);
+		}
+	}
+
+	w->path[pathlen] = '\0';
+	got_object_tree_close(tree);
+	return err;
+}
+
+/*
+ * Traverse commits first, such that we can make use of bitmaps stored for
+ * selected commits before traversing any trees. Trees which are reachable
+ * from such commits will then be skipped.
+ */
+static const struct got_error *
+walk_commits(struct bitmap_walk *w, struct got_object_id *commit_id)
+{
+	const struct got_error *err = NULL;
+	struct got_object_id_queue commits, trees;
+	struct got_object_qid *qid, *pid;
+	struct got_commit_object *commit = NULL;
+	const struct got_object_id_queue *parent_ids;
+	struct got_pack_bitmap_entry *e;
+	uint32_t pos;
+
+	STAILQ_INIT(&commits);
+	STAILQ_INIT(&trees);
+
+	err = got_object_qid_alloc(&qid, commit_id);
+	if (err)
+		return err;
+	STAILQ_INSERT_TAIL(&commits, qid, entry);
+
+	while (!STAILQ_EMPTY(&commits)) {
+		if (w->cancel_cb) {
+			err = (*w->cancel_cb)(w->cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		qid = STAILQ_FIRST(&commits);
+		STAILQ_REMOVE_HEAD(&commits, entry);
+
+		err = lookup_pos(&pos, w->bm, &qid->id);
+		if (err)
+			goto done;
+		if (got_bitmap_get(w->result, pos)) {
+			got_object_qid_free(qid);
+			continue;
+		}
+
+		e = got_object_idset_get(w->bm->entry_ids, &qid->id);
+		if (e) {
+			err = decode_entry(w->tmp, w->tmp2, w->bm, e);
+			if (err)
+				goto done;
+			got_bitmap_or(w->result, w->tmp);
+			got_object_qid_free(qid);
+			continue;
+		}
+
+		add_object(w, pos, GOT_OBJ_TYPE_COMMIT, NULL);
+
+		err = got_object_open_as_commit(&commit, w->repo, &qid->id);
+		if (err)
+			goto done;
+
+		got_object_qid_free(qid);
+		err = got_object_qid_alloc(&qid,
+		    got_object_commit_get_tree_id(commit));
+		if (err)
+			goto done;
+		STAILQ_INSERT_TAIL(&trees, qid, entry);
+
+		parent_ids = got_object_commit_get_parent_ids(commit);
+		STAILQ_FOREACH(pid, parent_ids, entry) {
+			err = got_object_qid_alloc(&qid, &pid->id);
+			if (err)
+				goto done;
+			STAILQ_INSERT_TAIL(&commits, qid, entry);
+		}
+
+		got_object_commit_close(commit);
+		commit = NULL;
+	}
+
+	STAILQ_FOREACH(qid, &trees, entry) {
+		w->path[0] = '\0';
+		err = walk_tree(w, &qid->id, 0);
+		if (err)
+			goto done;
+	}
+done:
+	if (commit)
+		got_object_commit_close(commit);
+	got_object_id_queue_free(&commits);
+	got_object_id_queue_free(&trees);
+	return err;
+}
+
+static const struct got_error *
+get_object_type(int *obj_type, struct got_pack_bitmap *bm, uint32_t pos,
+    struct got_object_id *id, struct got_repository *repo)
+{
+	*obj_type = got_pack_bitmap_get_type(bm, pos);
+	if (*obj_type != GOT_OBJ_TYPE_ANY)
+		return NULL;
+
+	return got_object_get_type(obj_type, repo, id);
+}
+
+static const struct got_error *
+fill(struct bitmap_walk *w, struct got_object_id *id)
+{
+	const struct got_error *err;
+	struct got_tag_object *tag;
+	struct got_object_id obj_id;
+	uint32_t pos;
+	int obj_type;
+
+	memcpy(&obj_id, id, sizeof(obj_id));
+
+	err = lookup_pos(&pos, w->bm, &obj_id);
+	if (err)
+		return err;
+	err = get_object_type(&obj_type, w->bm, pos, &obj_id, w->repo);
+	if (err)
+		return err;
+
+	if (obj_type == GOT_OBJ_TYPE_TAG) {
+		if (got_bitmap_get(w->result, pos))
+			return NULL;
+		add_object(w, pos, obj_type, NULL);
+
+		err = got_object_open_as_tag(&tag, w->repo, &obj_id);
+		if (err)
+			return err;
+		memcpy(&obj_id, got_object_tag_get_object_id(tag),
+		    sizeof(obj_id));
+		obj_type = got_object_tag_get_object_type(tag);
+		got_object_tag_close(tag);
+
+		/*
+		 * Pack file creation does not follow tags of tags.
+		 * Let the caller fall back to its own traversal.
+		 */
+		if (obj_type == GOT_OBJ_TYPE_TAG)
+			return got_error(GOT_ERR_NOT_IMPL);
+
+		err = lookup_pos(&pos, w->bm, &obj_id);
+		if (err)
+			return err;
+	}
+
+	switch (obj_type) {
+	case GOT_OBJ_TYPE_COMMIT:
+		return walk_commits(w, &obj_id);
+	case GOT_OBJ_TYPE_TREE:
+		w->path[0] = '\0';
+		return walk_tree(w, &obj_id, 0);
+	case GOT_OBJ_TYPE_BLOB:
+		add_object(w, pos, obj_type, NULL);
+		return NULL;
+	default:
+		return got_error(GOT_ERR_OBJ_TYPE);
+	}
+}
+
+static const struct got_error *
+walk_init(struct bitmap_walk *w, struct got_bitmap *result,
+    struct got_pack_bitmap *bm, struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err;
+
+	memset(w, 0, sizeof(*w));
+	w->bm = bm;
+	w->result = result;
+	w->repo = repo;
+	w->cancel_cb = cancel_cb;
+	w->cancel_arg = cancel_arg;
+
+	err = got_bitmap_alloc(&w->tmp, bm->nobjects);
+	if (err)
+		return err;
+	return got_bitmap_alloc(&w->tmp2, bm->nobjects);
+}
+
+static void
+walk_free(struct bitmap_walk *w)
+{
+	got_bitmap_free(w->tmp);
+	got_bitmap_free(w->tmp2);
+}
+
+const struct got_error *
+got_pack_bitmap_fill(struct got_bitmap *result, struct got_pack_bitmap *bm,
+    struct got_object_id *id, struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err;
+	struct bitmap_walk w;
+
+	err = walk_init(&w, result, bm, repo, cancel_cb, cancel_arg);
+	if (err == NULL)
+		err = fill(&w, id);
+	walk_free(&w);
+	return err;
+}
+
+/*
+ * Select commits along the first-parent history of the given commit which
+ * will get bitmaps stored in the bitmap file. Append selected commits to
+ * the list in order of increasing age, such that bitmaps of older commits
+ * can be used while computing bitmaps of younger commits.
+ */
+static const struct got_error *
+select_commits(struct got_object_id_queue *selected,
+    struct got_object_idset *visited, struct got_object_id *commit_id,
+    struct got_repository *repo, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_object_id_queue chain;
+	struct got_commit_object *commit = NULL;
+	struct got_object_qid *qid;
+	struct got_object_id id;
+	int n = 0;
+
+	STAILQ_INIT(&chain);
+
+	memcpy(&id, commit_id, sizeof(id));
+	while (!got_object_idset_contains(visited, &id)) {
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		err = got_object_idset_add(visited, &id, NULL);
+		if (err)
+			goto done;
+
+		if (n++ % GOT_PACK_BITMAP_COMMIT_INTERVAL == 0) {
+			err = got_object_qid_alloc(&qid, &id);
+			if (err)
+				goto done;
+			STAILQ_INSERT_HEAD(&chain, qid, entry);
+		}
+
+		err = got_object_open_as_commit(&commit, repo, &id);
+		if (err)
+			goto done;
+		qid = STAILQ_FIRST(got_object_commit_get_parent_ids(commit));
+		if (qid == NULL)
+			break;
+		memcpy(&id, &qid->id, sizeof(id));
+		got_object_commit_close(commit);
+		commit = NULL;
+	}
+
+	STAILQ_CONCAT(selected, &chain);
+done:
+	if (commit)
+		got_object_commit_close(commit);
+	got_object_id_queue_free(&chain);
+	return err;
+}
+
+static const struct got_error *
+hwrite(int fd, const void *buf, size_t len, struct got_hash *ctx)
+{
+	ssize_t w;
+
+	got_hash_update(ctx, buf, len);
+
+	w = write(fd, buf, len);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if (w != len)
+		return got_error(GOT_ERR_IO);
+
+	return NULL;
+}
+
+static const struct got_error *
+hwrite_ewah(int fd, struct got_bitmap *b, struct got_hash *ctx)
+{
+	const struct got_error *err;
+	uint8_t *buf;
+	size_t len;
+
+	err = got_ewah_encode(&buf, &len, b);
+	if (err)
+		return err;
+	err = hwrite(fd, buf, len, ctx);
+	free(buf);
+	return err;
+}
+
+static const struct got_error *
+write_bitmap_file(int fd, struct got_pack_bitmap *bm)
+{
+	const struct got_error *err;
+	size_t digest_len = got_hash_digest_length(bm->packidx->algo);
+	struct got_bitmap *type_bitmaps[] = {
+		bm->commits, bm->trees, bm->blobs, bm->tags
+	};
+	struct got_pack_bitmap_entry *e;
+	struct got_hash ctx;
+	uint8_t hdr[GOT_PACK_BITMAP_HDR_SIZE];
+	uint8_t hash[GOT_HASH_DIGEST_MAXLEN];
+	uint8_t ehdr[6];
+	uint16_t val16;
+	uint32_t i;
+
+	got_hash_init(&ctx, bm->packidx->algo);
+
+	put_be32(hdr, GOT_PACK_BITMAP_SIGNATURE);
+	val16 = htobe16(GOT_PACK_BITMAP_VERSION);
+	memcpy(hdr + 4, &val16, sizeof(val16));
+	val16 = htobe16(GOT_PACK_BITMAP_OPT_FULL_DAG |
+	    GOT_PACK_BITMAP_OPT_HASH_CACHE);
+	memcpy(hdr + 6, &val16, sizeof(val16));
+	put_be32(hdr + 8, bm->nentries);
+	err = hwrite(fd, hdr, sizeof(hdr), &ctx);
+	if (err)
+		return err;
+
+	err = hwrite(fd, bm->packidx->hdr.trailer.packfile_hash, digest_len,
+	    &ctx);
+	if (err)
+		return err;
+
+	for (i = 0; i < nitems(type_bitmaps); i++) {
+		err = hwrite_ewah(fd, type_bitmaps[i], &ctx);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < bm->nentries; i++) {
+		e = bm->entries[i];
+		put_be32(ehdr, e->idx);
+		ehdr[4] = e->xor_offset;
+		ehdr[5] = e->flags;
+		err = hwrite(fd, ehdr, sizeof(ehdr), &ctx);
+		if (err)
+			return err;
+		err = hwrite(fd, e->ewah, e->ewah_len, &ctx);
+		if (err)
+			return err;
+	}
+
+	err = hwrite(fd, bm->name_hashes_buf,
+	    (size_t)bm->nobjects * sizeof(uint32_t), &ctx);
+	if (err)
+		return err;
+
+	got_hash_final(&ctx, hash);
+	return hwrite(fd, hash, digest_len, &ctx);
+}
+
+const struct got_error *
+got_pack_bitmap_write(int fd, struct got_packidx *packidx,
+    struct got_object_id **tips, int ntips, struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err;
+	struct got_pack_bitmap *bm = NULL;
+	struct got_pack_bitmap_entry *e;
+	struct got_object_id_queue selected;
+	struct got_object_idset *visited = NULL;
+	struct got_object_qid *qid;
+	struct got_bitmap *result = NULL;
+	struct got_object_id id;
+	struct bitmap_walk w;
+	uint32_t pos;
+	int i, obj_type, idx;
+
+	STAILQ_INIT(&selected);
+	memset(&w, 0, sizeof(w));
+
+	err = alloc_bitmap(&bm, packidx);
+	if (err)
+		return err;
+	bm->writing = 1;
+
+	bm->name_hashes_buf = calloc(bm->nobjects ? bm->nobjects : 1,
+	    sizeof(uint32_t));
+	if (bm->name_hashes_buf == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	bm->name_hashes = bm->name_hashes_buf;
+
+	visited = got_object_idset_alloc();
+	if (visited == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+
+	for (i = 0; i < ntips; i++) {
+		struct got_tag_object *tag;
+
+		memcpy(&id, tips[i], sizeof(id));
+		err = got_object_get_type(&obj_type, repo, &id);
+		if (err)
+			goto done;
+		while (obj_type == GOT_OBJ_TYPE_TAG) {
+			err = got_object_open_as_tag(&tag, repo, &id);
+			if (err)
+				goto done;
+			memcpy(&id, got_object_tag_get_object_id(tag),
+			    sizeof(id));
+			obj_type = got_object_tag_get_object_type(tag);
+			got_object_tag_close(tag);
+		}
+		if (obj_type != GOT_OBJ_TYPE_COMMIT)
+			continue;
+
+		err = select_commits(&selected, visited, &id, repo,
+		    cancel_cb, cancel_arg);
+		if (err)
+			goto done;
+	}
+
+	err = got_bitmap_alloc(&result, bm->nobjects);
+	if (err)
+		goto done;
+	err = walk_init(&w, result, bm, repo, cancel_cb, cancel_arg);
+	if (err)
+		goto done;
+
+	/*
+	 * Skip commits which reach objects outside of the pack file.
+	 * A bitmap must cover all objects reachable from its commit.
+	 */
+	STAILQ_FOREACH(qid, &selected, entry) {
+		idx = got_packidx_get_object_idx(packidx, &qid->id);
+		if (idx == -1)
+			continue;
+
+		got_bitmap_clear(result);
+		err = fill(&w, &qid->id);
+		if (err) {
+			if (err->code != GOT_ERR_NO_OBJ)
+				goto done;
+			err = NULL;
+			continue;
+		}
+
+		e = calloc(1, sizeof(*e));
+		if (e == NULL) {
+			err = got_error_from_errno("calloc");
+			goto done;
+		}
+		e->idx = idx;
+		err = got_ewah_encode(&e->ewah_buf, &e->ewah_len, result);
+		if (err) {
+			free(e);
+			goto done;
+		}
+		e->ewah = e->ewah_buf;
+		err = add_entry(bm, e);
+		if (err) {
+			free(e->ewah_buf);
+			free(e);
+			goto done;
+		}
+	}
+
+	/* Record the types of tags and their targets. */
+	for (i = 0; i < ntips; i++) {
+		got_bitmap_clear(result);
+		err = fill(&w, tips[i]);
+		if (err) {
+			if (err->code != GOT_ERR_NO_OBJ &&
+			    err->code != GOT_ERR_NOT_IMPL)
+				goto done;
+			err = NULL;
+		}
+	}
+
+	/* Objects we did not traverse still need to appear in type bitmaps. */
+	for (pos = 0; pos < bm->nobjects; pos++) {
+		if (got_pack_bitmap_get_type(bm, pos) != GOT_OBJ_TYPE_ANY)
+			continue;
+		err = got_pack_bitmap_get_object_id(&id, bm, pos);
+		if (err)
+			goto done;
+		err = got_object_get_type(&obj_type, repo, &id);
+		if (err)
+			goto done;
+		got_bitmap_set(result, pos);
+		add_object(&w, pos, obj_type, NULL);
+	}
+
+	err = write_bitmap_file(fd, bm);
+done:
+	walk_free(&w);
+	got_bitmap_free(result);
+	if (visited)
+		got_object_idset_free(visited);
+	got_object_id_queue_free(&selected);
+	if (bm)
+		got_pack_bitmap_close(bm);
+	return err;
+}
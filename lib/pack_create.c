@@ -24,10 +24,12 @@
 #include <sys/time.h>
 #include <sys/mman.h>
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,6 +45,7 @@
 #include "got_reference.h"
 #include "got_repository.h"
 #include "got_repository_admin.h"
+#include "got_gotconfig.h"
 
 #include "got_lib_deltify.h"
 #include "got_lib_delta.h"
@@ -54,12 +57,12 @@
 #include "got_lib_ratelimit.h"
 #include "got_lib_pack.h"
 #include "got_lib_pack_create.h"
+#include "got_lib_ewah.h"
+#include "got_lib_pack_bitmap.h"
 #include "got_lib_repository.h"
 #include "got_lib_inflate.h"
 #include "got_lib_poll.h"
 
-#include "murmurhash2.h"
-
 #ifndef MIN
 #define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
 #endif
@@ -74,7 +77,7 @@
 
 static const struct got_error *
 alloc_meta(struct got_pack_meta **new, struct got_object_id *id,
-    const char *path, int obj_type, time_t mtime, uint32_t seed)
+    const char *path, int obj_type, time_t mtime)
 {
 	struct got_pack_meta *m;
 
@@ -86,7 +89,7 @@ alloc_meta(struct got_pack_meta **new, struct got_object_id *id,
 
 	memcpy(&m->id, id, sizeof(m->id));
 
-	m->path_hash = murmurhash2(path, strlen(path), seed);
+	m->path_hash = got_pack_bitmap_name_hash(path);
 	m->obj_type = obj_type;
 	m->mtime = mtime;
 	*new = m;
@@ -534,172 +537,378 @@ done:
 	return err;
 }
 
+struct pick_deltas_arg {
+	pthread_mutex_t mutex;
+	struct got_pack_meta **meta;
+	int nmeta;
+	int next_idx;		/* first object of the next unclaimed chunk */
+	int ndone;
+	size_t delta_memsize;
+	int window;
+	int depth;
+	size_t max_delta_memsize;
+	FILE *delta_cache;
+	struct got_repository *repo;
+	uint32_t delta_seed;
+	const struct got_error *err;
+};
+
+struct pick_deltas_thread {
+	pthread_t thread;
+	int started;
+	int outfd;
+	struct pick_deltas_arg *a;
+};
+
+/*
+ * Claim the next chunk of objects. Chunk boundaries depend only on the
+ * sorted list of objects, never on the number of threads, and the delta
+ * window does not extend across them. This keeps the resulting pack file
+ * independent of the number of threads used.
+ * Return 0 once all objects have been claimed or an error has occurred.
+ */
+static int
+claim_delta_chunk(int *start, int *end, struct pick_deltas_arg *a)
+{
+	struct got_pack_meta **meta = a->meta;
+	int s, e, max;
+
+	pthread_mutex_lock(&a->mutex);
+	if (a->err || a->next_idx >= a->nmeta) {
+		pthread_mutex_unlock(&a->mutex);
+		return 0;
+	}
+
+	s = a->next_idx;
+	e = MIN(a->nmeta, s + GOT_PACK_CREATE_DELTA_CHUNK);
+
+	/* Try to avoid separating versions of the same file. */
+	max = MIN(a->nmeta, e + GOT_PACK_CREATE_DELTA_CHUNK);
+	while (e > s && e < max &&
+	    meta[e]->obj_type == meta[e - 1]->obj_type &&
+	    meta[e]->path_hash == meta[e - 1]->path_hash)
+		e++;
+
+	a->next_idx = e;
+	pthread_mutex_unlock(&a->mutex);
+
+	*start = s;
+	*end = e;
+	return 1;
+}
+
+/*
+ * Find the best delta base for meta[i] among the objects preceding it
+ * within the current chunk, which begins at meta[first].
+ * Repository access and the delta cache file are shared between threads
+ * and must only be used while the mutex is held.
+ */
 static const struct got_error *
-pick_deltas(struct got_pack_meta **meta, int nmeta, int ncolored,
-    int nfound, int ntrees, int ncommits, int nreused, FILE *delta_cache,
-    struct got_repository *repo,
-    got_pack_progress_cb progress_cb, void *progress_arg,
-    struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
+pick_delta(struct pick_deltas_thread *t, int i, int first)
 {
 	const struct got_error *err = NULL;
-	struct got_pack_meta *m = NULL, *base = NULL;
+	struct pick_deltas_arg *a = t->a;
+	struct got_pack_meta *m = a->meta[i], *base = NULL;
 	struct got_raw_object *raw = NULL, *base_raw = NULL;
 	struct got_delta_instruction *deltas = NULL, *best_deltas = NULL;
-	int i, j, ndeltas, best_ndeltas;
-	off_t size, best_size;
-	const int max_base_candidates = 3;
-	size_t delta_memsize = 0;
-	const size_t max_delta_memsize = 4 * GOT_DELTA_RESULT_SIZE_CACHED_MAX;
-	int outfd = -1;
-	uint32_t delta_seed;
+	int j, ndeltas, best_ndeltas;
+	off_t size, best_size, max_size;
+	uint32_t delta_seed = a->delta_seed;
+	int in_mem = 0;
 
-	delta_seed = arc4random();
+	if (m->obj_type == GOT_OBJ_TYPE_COMMIT ||
+	    m->obj_type == GOT_OBJ_TYPE_TAG)
+		goto done;
 
-	qsort(meta, nmeta, sizeof(struct got_pack_meta *), delta_order_cmp);
-	for (i = 0; i < nmeta; i++) {
-		if (cancel_cb) {
-			err = (*cancel_cb)(cancel_arg);
-			if (err)
-				break;
-		}
-		err = got_pack_report_progress(progress_cb, progress_arg, rl,
-		    ncolored, nfound, ntrees, 0L, ncommits, nreused + nmeta,
-		    nreused + i, 0, 0);
-		if (err)
-			goto done;
-		m = meta[i];
+	pthread_mutex_lock(&a->mutex);
+	if (a->err)
+		err = a->err;
+	else
+		err = got_object_raw_open(&raw, &t->outfd, a->repo, &m->id);
+	pthread_mutex_unlock(&a->mutex);
+	if (err)
+		goto done;
+	m->size = raw->size;
+
+	if (raw->f == NULL) {
+		err = got_deltify_init_mem(&m->dtab, raw->data,
+		    raw->hdrlen, raw->size + raw->hdrlen, delta_seed);
+	} else {
+		err = got_deltify_init(&m->dtab, raw->f, raw->hdrlen,
+		    raw->size + raw->hdrlen, delta_seed);
+	}
+	if (err)
+		goto done;
+
+	if (i - first > a->window) {
+		struct got_pack_meta *n = NULL;
+		n = a->meta[i - (a->window + 1)];
+		got_deltify_free(n->dtab);
+		n->dtab = NULL;
+	}
 
-		if (m->obj_type == GOT_OBJ_TYPE_COMMIT ||
-		    m->obj_type == GOT_OBJ_TYPE_TAG)
+	/* Objects known to the receiver only serve as delta bases. */
+	if (m->thin_base)
+		goto done;
+
+	best_size = raw->size;
+	best_ndeltas = 0;
+	for (j = MAX(first, i - a->window); j < i; j++) {
+		base = a->meta[j];
+		/*
+		 * Long chains make unpacking slow, avoid such bases.
+		 * Reused deltas based on this object extend its chain.
+		 */
+		if (base->nchain + m->reused_child_depth >= a->depth ||
+		    base->obj_type != m->obj_type)
 			continue;
 
-		err = got_object_raw_open(&raw, &outfd, repo, &m->id);
+		pthread_mutex_lock(&a->mutex);
+		if (a->err)
+			err = a->err;
+		else {
+			err = got_object_raw_open(&base_raw, &t->outfd,
+			    a->repo, &base->id);
+		}
+		pthread_mutex_unlock(&a->mutex);
 		if (err)
 			goto done;
-		m->size = raw->size;
 
-		if (raw->f == NULL) {
-			err = got_deltify_init_mem(&m->dtab, raw->data,
-			    raw->hdrlen, raw->size + raw->hdrlen, delta_seed);
+		if (raw->f == NULL && base_raw->f == NULL) {
+			err = got_deltify_mem_mem(&deltas, &ndeltas,
+			    raw->data, raw->hdrlen,
+			    raw->size + raw->hdrlen, delta_seed,
+			    base->dtab, base_raw->data,
+			    base_raw->hdrlen,
+			    base_raw->size + base_raw->hdrlen);
+		} else if (raw->f == NULL) {
+			err = got_deltify_mem_file(&deltas, &ndeltas,
+			    raw->data, raw->hdrlen,
+			    raw->size + raw->hdrlen, delta_seed,
+			    base->dtab, base_raw->f,
+			    base_raw->hdrlen,
+			    base_raw->size + base_raw->hdrlen);
+		} else if (base_raw->f == NULL) {
+			err = got_deltify_file_mem(&deltas, &ndeltas,
+			    raw->f, raw->hdrlen,
+			    raw->size + raw->hdrlen, delta_seed,
+			    base->dtab, base_raw->data,
+			    base_raw->hdrlen,
+			    base_raw->size + base_raw->hdrlen);
 		} else {
-			err = got_deltify_init(&m->dtab, raw->f, raw->hdrlen,
-			    raw->size + raw->hdrlen, delta_seed);
+			err = got_deltify(&deltas, &ndeltas,
+			    raw->f, raw->hdrlen,
+			    raw->size + raw->hdrlen, delta_seed,
+			    base->dtab, base_raw->f, base_raw->hdrlen,
+			    base_raw->size + base_raw->hdrlen);
 		}
+		pthread_mutex_lock(&a->mutex);
+		got_object_raw_close(base_raw);
+		pthread_mutex_unlock(&a->mutex);
+		base_raw = NULL;
 		if (err)
 			goto done;
 
-		if (i > max_base_candidates) {
-			struct got_pack_meta *n = NULL;
-			n = meta[i - (max_base_candidates + 1)];
-			got_deltify_free(n->dtab);
-			n->dtab = NULL;
+		/*
+		 * As in Git, deltas against bases which are deep within
+		 * a delta chain must be proportionally smaller. This makes
+		 * chains branch out instead of growing to the depth limit.
+		 */
+		max_size = best_size * (a->depth - base->nchain) /
+		    (a->depth - (best_ndeltas > 0 ? m->nchain : 1) + 1);
+		size = delta_size(deltas, ndeltas);
+		if (size + 32 < max_size) {
+			/*
+			 * if we already picked a best delta,
+			 * replace it.
+			 */
+			best_size = size;
+			free(best_deltas);
+			best_deltas = deltas;
+			best_ndeltas = ndeltas;
+			deltas = NULL;
+			m->nchain = base->nchain + 1;
+			m->prev = base;
+			m->head = base->head;
+			if (m->head == NULL)
+				m->head = base;
+		} else {
+			free(deltas);
+			deltas = NULL;
+			ndeltas = 0;
 		}
+	}
 
-		best_size = raw->size;
-		best_ndeltas = 0;
-		for (j = MAX(0, i - max_base_candidates); j < i; j++) {
-			if (cancel_cb) {
-				err = (*cancel_cb)(cancel_arg);
-				if (err)
-					goto done;
-			}
-			base = meta[j];
-			/* long chains make unpacking slow, avoid such bases */
-			if (base->nchain >= 128 ||
-			    base->obj_type != m->obj_type)
-				continue;
+	if (best_ndeltas > 0) {
+		pthread_mutex_lock(&a->mutex);
+		if (best_size <= GOT_DELTA_RESULT_SIZE_CACHED_MAX &&
+		    a->delta_memsize + best_size <= a->max_delta_memsize) {
+			a->delta_memsize += best_size;
+			in_mem = 1;
+		} else {
+			m->delta_offset = ftello(a->delta_cache);
+			err = encode_delta(m, raw, best_deltas,
+			    best_ndeltas, m->prev->size, a->delta_cache);
+		}
+		pthread_mutex_unlock(&a->mutex);
+		if (err == NULL && in_mem) {
+			err = encode_delta_in_mem(m, raw, best_deltas,
+			    best_ndeltas, best_size, m->prev->size);
+		}
+	}
+done:
+	pthread_mutex_lock(&a->mutex);
+	if (raw)
+		got_object_raw_close(raw);
+	if (base_raw)
+		got_object_raw_close(base_raw);
+	a->ndone++;
+	pthread_mutex_unlock(&a->mutex);
+	free(deltas);
+	free(best_deltas);
+	return err;
+}
 
-			err = got_object_raw_open(&base_raw, &outfd, repo,
-			    &base->id);
-			if (err)
-				goto done;
+static void
+free_delta_window(struct pick_deltas_arg *a, int start, int end)
+{
+	int i;
 
-			if (raw->f == NULL && base_raw->f == NULL) {
-				err = got_deltify_mem_mem(&deltas, &ndeltas,
-				    raw->data, raw->hdrlen,
-				    raw->size + raw->hdrlen, delta_seed,
-				    base->dtab, base_raw->data,
-				    base_raw->hdrlen,
-				    base_raw->size + base_raw->hdrlen);
-			} else if (raw->f == NULL) {
-				err = got_deltify_mem_file(&deltas, &ndeltas,
-				    raw->data, raw->hdrlen,
-				    raw->size + raw->hdrlen, delta_seed,
-				    base->dtab, base_raw->f,
-				    base_raw->hdrlen,
-				    base_raw->size + base_raw->hdrlen);
-			} else if (base_raw->f == NULL) {
-				err = got_deltify_file_mem(&deltas, &ndeltas,
-				    raw->f, raw->hdrlen,
-				    raw->size + raw->hdrlen, delta_seed,
-				    base->dtab, base_raw->data,
-				    base_raw->hdrlen,
-				    base_raw->size + base_raw->hdrlen);
-			} else {
-				err = got_deltify(&deltas, &ndeltas,
-				    raw->f, raw->hdrlen,
-				    raw->size + raw->hdrlen, delta_seed,
-				    base->dtab, base_raw->f, base_raw->hdrlen,
-				    base_raw->size + base_raw->hdrlen);
-			}
-			got_object_raw_close(base_raw);
-			base_raw = NULL;
+	for (i = start; i < end; i++) {
+		got_deltify_free(a->meta[i]->dtab);
+		a->meta[i]->dtab = NULL;
+	}
+}
+
+static void *
+pick_deltas_thread_main(void *arg)
+{
+	const struct got_error *err = NULL;
+	struct pick_deltas_thread *t = arg;
+	struct pick_deltas_arg *a = t->a;
+	int i, start, end;
+
+	while (err == NULL && claim_delta_chunk(&start, &end, a)) {
+		for (i = start; i < end; i++) {
+			err = pick_delta(t, i, start);
 			if (err)
-				goto done;
+				break;
+		}
+		free_delta_window(a, start, end);
+	}
 
-			size = delta_size(deltas, ndeltas);
-			if (size + 32 < best_size){
-				/*
-				 * if we already picked a best delta,
-				 * replace it.
-				 */
-				best_size = size;
-				free(best_deltas);
-				best_deltas = deltas;
-				best_ndeltas = ndeltas;
-				deltas = NULL;
-				m->nchain = base->nchain + 1;
-				m->prev = base;
-				m->head = base->head;
-				if (m->head == NULL)
-					m->head = base;
-			} else {
-				free(deltas);
-				deltas = NULL;
-				ndeltas = 0;
-			}
+	if (err) {
+		pthread_mutex_lock(&a->mutex);
+		if (a->err == NULL)
+			a->err = err;
+		pthread_mutex_unlock(&a->mutex);
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+pick_deltas(struct got_pack_meta **meta, int nmeta, int ncolored,
+    int nfound, int ntrees, int ncommits, int nreused, FILE *delta_cache,
+    struct got_repository *repo, const struct got_pack_delta_params *params,
+    int nthreads, got_pack_progress_cb progress_cb, void *progress_arg,
+    struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct pick_deltas_arg a;
+	struct pick_deltas_thread *threads;
+	int i, start, end, ndone, error;
+
+	qsort(meta, nmeta, sizeof(struct got_pack_meta *), delta_order_cmp);
+
+	/* Don't start threads which would have nothing to do. */
+	nthreads = MIN(nthreads, (nmeta + GOT_PACK_CREATE_DELTA_CHUNK - 1) /
+	    GOT_PACK_CREATE_DELTA_CHUNK);
+	if (nthreads < 1)
+		nthreads = 1;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (threads == NULL)
+		return got_error_from_errno("calloc");
+
+	memset(&a, 0, sizeof(a));
+	error = pthread_mutex_init(&a.mutex, NULL);
+	if (error) {
+		free(threads);
+		return got_error_set_errno(error, "pthread_mutex_init");
+	}
+	a.meta = meta;
+	a.nmeta = nmeta;
+	a.window = params->window;
+	a.depth = params->depth;
+	a.max_delta_memsize = params->memsize;
+	a.delta_cache = delta_cache;
+	a.repo = repo;
+	a.delta_seed = arc4random();
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i].outfd = -1;
+		threads[i].a = &a;
+	}
+
+	/*
+	 * The main thread does its share of the work, reports progress,
+	 * and checks for cancellation.
+	 */
+	for (i = 1; i < nthreads; i++) {
+		error = pthread_create(&threads[i].thread, NULL,
+		    pick_deltas_thread_main, &threads[i]);
+		if (error) {
+			err = got_error_set_errno(error, "pthread_create");
+			goto done;
 		}
+		threads[i].started = 1;
+	}
 
-		if (best_ndeltas > 0) {
-			if (best_size <= GOT_DELTA_RESULT_SIZE_CACHED_MAX &&
-			    delta_memsize + best_size <= max_delta_memsize) {
-				delta_memsize += best_size;
-				err = encode_delta_in_mem(m, raw, best_deltas,
-				    best_ndeltas, best_size, m->prev->size);
-			} else {
-				m->delta_offset = ftello(delta_cache);
-				err = encode_delta(m, raw, best_deltas,
-				    best_ndeltas, m->prev->size, delta_cache);
+	while (err == NULL && claim_delta_chunk(&start, &end, &a)) {
+		for (i = start; i < end; i++) {
+			if (cancel_cb) {
+				err = (*cancel_cb)(cancel_arg);
+				if (err)
+					break;
 			}
-			free(best_deltas);
-			best_deltas = NULL;
-			best_ndeltas = 0;
+			pthread_mutex_lock(&a.mutex);
+			ndone = a.ndone;
+			pthread_mutex_unlock(&a.mutex);
+			err = got_pack_report_progress(progress_cb,
+			    progress_arg, rl, ncolored, nfound, ntrees, 0L,
+			    ncommits, nreused + nmeta, nreused + ndone, 0, 0);
 			if (err)
-				goto done;
+				break;
+			err = pick_delta(&threads[0], i, start);
+			if (err)
+				break;
 		}
-
-		got_object_raw_close(raw);
-		raw = NULL;
+		free_delta_window(&a, start, end);
 	}
 done:
-	if (raw)
-		got_object_raw_close(raw);
-	if (base_raw)
-		got_object_raw_close(base_raw);
-	if (outfd != -1 && close(outfd) == -1 && err == NULL)
-		err = got_error_from_errno("close");
-	free(deltas);
-	free(best_deltas);
+	if (err) {
+		/* Make other threads stop early. */
+		pthread_mutex_lock(&a.mutex);
+		if (a.err == NULL)
+			a.err = err;
+		pthread_mutex_unlock(&a.mutex);
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (threads[i].started) {
+			error = pthread_join(threads[i].thread, NULL);
+			if (error && err == NULL)
+				err = got_error_set_errno(error,
+				    "pthread_join");
+		}
+		if (threads[i].outfd != -1 && close(threads[i].outfd) == -1 &&
+		    err == NULL)
+			err = got_error_from_errno("close");
+	}
+	if (err == NULL)
+		err = a.err;
+	pthread_mutex_destroy(&a.mutex);
+	free(threads);
 	return err;
 }
 
@@ -724,7 +933,7 @@ search_packidx(int *found, struct got_object_id *id,
 const struct got_error *
 got_pack_add_object(int want_meta, struct got_object_idset *idset,
     struct got_object_id *id, const char *path, int obj_type,
-    time_t mtime, uint32_t seed, int loose_obj_only,
+    time_t mtime, int loose_obj_only,
     struct got_repository *repo, int *ncolored, int *nfound, int *ntrees,
     got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl)
@@ -742,7 +951,7 @@ got_pack_add_object(int want_meta, struct got_object_idset *idset,
 	}
 
 	if (want_meta) {
-		err = alloc_meta(&m, id, path, obj_type, mtime, seed);
+		err = alloc_meta(&m, id, path, obj_type, mtime);
 		if (err)
 			return err;
 
@@ -768,7 +977,7 @@ const struct got_error *
 got_pack_load_tree_entries(struct got_object_id_queue *ids, int want_meta,
     struct got_object_idset *idset, struct got_object_idset *idset_exclude,
     struct got_tree_object *tree,
-    const char *dpath, time_t mtime, uint32_t seed, struct got_repository *repo,
+    const char *dpath, time_t mtime, struct got_repository *repo,
     int loose_obj_only, int *ncolored, int *nfound, int *ntrees,
     got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
@@ -824,7 +1033,7 @@ got_pack_load_tree_entries(struct got_object_id_queue *ids, int want_meta,
 		} else if (S_ISREG(mode) || S_ISLNK(mode)) {
 			err = got_pack_add_object(want_meta,
 			    want_meta ? idset : idset_exclude, id, p,
-			    GOT_OBJ_TYPE_BLOB, mtime, seed, loose_obj_only,
+			    GOT_OBJ_TYPE_BLOB, mtime, loose_obj_only,
 			    repo, ncolored, nfound, ntrees,
 			    progress_cb, progress_arg, rl);
 			if (err)
@@ -845,7 +1054,7 @@ const struct got_error *
 got_pack_load_tree(int want_meta, struct got_object_idset *idset,
     struct got_object_idset *idset_exclude,
     struct got_object_id *tree_id, const char *dpath, time_t mtime,
-    uint32_t seed, struct got_repository *repo, int loose_obj_only,
+    struct got_repository *repo, int loose_obj_only,
     int *ncolored, int *nfound, int *ntrees,
     got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
@@ -894,7 +1103,7 @@ got_pack_load_tree(int want_meta, struct got_object_idset *idset,
 		err = got_pack_add_object(want_meta,
 		    want_meta ? idset : idset_exclude,
 		    &qid->id, path, GOT_OBJ_TYPE_TREE,
-		    mtime, seed, loose_obj_only, repo,
+		    mtime, loose_obj_only, repo,
 		    ncolored, nfound, ntrees, progress_cb, progress_arg, rl);
 		if (err) {
 			free(qid->data);
@@ -910,7 +1119,7 @@ got_pack_load_tree(int want_meta, struct got_object_idset *idset,
 		}
 
 		err = got_pack_load_tree_entries(&tree_ids, want_meta, idset,
-		    idset_exclude, tree, path, mtime, seed, repo,
+		    idset_exclude, tree, path, mtime, repo,
 		    loose_obj_only, ncolored, nfound, ntrees,
 		    progress_cb, progress_arg, rl,
 		    cancel_cb, cancel_arg);
@@ -934,7 +1143,7 @@ got_pack_load_tree(int want_meta, struct got_object_idset *idset,
 static const struct got_error *
 load_commit(int want_meta, struct got_object_idset *idset,
     struct got_object_idset *idset_exclude,
-    struct got_object_id *id, struct got_repository *repo, uint32_t seed,
+    struct got_object_id *id, struct got_repository *repo,
     int loose_obj_only, int *ncolored, int *nfound, int *ntrees,
     got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
@@ -961,7 +1170,7 @@ load_commit(int want_meta, struct got_object_idset *idset,
 
 	err = got_pack_add_object(want_meta,
 	    want_meta ? idset : idset_exclude, id, "", GOT_OBJ_TYPE_COMMIT,
-	    got_object_commit_get_committer_time(commit), seed,
+	    got_object_commit_get_committer_time(commit),
 	    loose_obj_only, repo,
 	    ncolored, nfound, ntrees, progress_cb, progress_arg, rl);
 	if (err)
@@ -969,7 +1178,7 @@ load_commit(int want_meta, struct got_object_idset *idset,
 
 	err = got_pack_load_tree(want_meta, idset, idset_exclude,
 	    got_object_commit_get_tree_id(commit),
-	    "", got_object_commit_get_committer_time(commit), seed,
+	    "", got_object_commit_get_committer_time(commit),
 	    repo, loose_obj_only, ncolored, nfound, ntrees,
 	    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
 done:
@@ -980,7 +1189,7 @@ done:
 static const struct got_error *
 load_tag(int want_meta, struct got_object_idset *idset,
     struct got_object_idset *idset_exclude,
-    struct got_object_id *id, struct got_repository *repo, uint32_t seed,
+    struct got_object_id *id, struct got_repository *repo,
     int loose_obj_only, int *ncolored, int *nfound, int *ntrees,
     got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
@@ -1007,7 +1216,7 @@ load_tag(int want_meta, struct got_object_idset *idset,
 
 	err = got_pack_add_object(want_meta,
 	    want_meta ? idset : idset_exclude, id, "", GOT_OBJ_TYPE_TAG,
-	    got_object_tag_get_tagger_time(tag), seed, loose_obj_only, repo,
+	    got_object_tag_get_tagger_time(tag), loose_obj_only, repo,
 	    ncolored, nfound, ntrees, progress_cb, progress_arg, rl);
 	if (err)
 		goto done;
@@ -1015,14 +1224,14 @@ load_tag(int want_meta, struct got_object_idset *idset,
 	switch (got_object_tag_get_object_type(tag)) {
 	case GOT_OBJ_TYPE_COMMIT:
 		err = load_commit(want_meta, idset, idset_exclude,
-		    got_object_tag_get_object_id(tag), repo, seed,
+		    got_object_tag_get_object_id(tag), repo,
 		    loose_obj_only, ncolored, nfound, ntrees,
 		    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
 		break;
 	case GOT_OBJ_TYPE_TREE:
 		err = got_pack_load_tree(want_meta, idset, idset_exclude,
 		    got_object_tag_get_object_id(tag), "",
-		    got_object_tag_get_tagger_time(tag), seed, repo,
+		    got_object_tag_get_tagger_time(tag), repo,
 		    loose_obj_only, ncolored, nfound, ntrees,
 		    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
 		break;
@@ -1330,6 +1539,160 @@ done:
 	return err;
 }
 
+/*
+ * Add commits reachable from the given tips to a set, without traversing
+ * the parents of shallow commits, and without traversing commits which
+ * are contained in the stop set.
+ */
+static const struct got_error *
+paint_commits_shallow(struct got_object_idset *set,
+    struct got_object_idset *stop, struct got_object_id **tips, int ntips,
+    struct got_object_idset *shallow, int *ncolored,
+    struct got_repository *repo,
+    got_pack_progress_cb progress_cb, void *progress_arg,
+    struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_object_id_queue ids;
+	struct got_object_qid *qid = NULL, *pid;
+	struct got_commit_object *commit;
+	int i;
+
+	STAILQ_INIT(&ids);
+
+	for (i = 0; i < ntips; i++) {
+		if (tips[i] == NULL)
+			continue;
+		err = queue_commit_or_tag_id(tips[i], COLOR_KEEP, &ids, repo);
+		if (err)
+			goto done;
+	}
+
+	while (!STAILQ_EMPTY(&ids)) {
+		if (cancel_cb) {
+			err = cancel_cb(cancel_arg);
+			if (err)
+				break;
+		}
+
+		qid = STAILQ_FIRST(&ids);
+		STAILQ_REMOVE_HEAD(&ids, entry);
+
+		if (got_object_idset_contains(set, &qid->id) ||
+		    (stop && got_object_idset_contains(stop, &qid->id))) {
+			got_object_qid_free(qid);
+			qid = NULL;
+			continue;
+		}
+
+		err = got_object_idset_add(set, &qid->id, NULL);
+		if (err)
+			break;
+
+		(*ncolored)++;
+		err = got_pack_report_progress(progress_cb, progress_arg, rl,
+		    *ncolored, 0, 0, 0L, 0, 0, 0, 0, 0);
+		if (err)
+			break;
+
+		if (!got_object_idset_contains(shallow, &qid->id)) {
+			err = got_object_open_as_commit(&commit, repo,
+			    &qid->id);
+			if (err)
+				break;
+			STAILQ_FOREACH(pid,
+			    got_object_commit_get_parent_ids(commit), entry) {
+				if (got_object_idset_contains(set, &pid->id))
+					continue;
+				err = got_pack_queue_commit_id(&ids, &pid->id,
+				    COLOR_KEEP, repo);
+				if (err)
+					break;
+			}
+			got_object_commit_close(commit);
+			if (err)
+				break;
+		}
+
+		got_object_qid_free(qid);
+		qid = NULL;
+	}
+done:
+	got_object_qid_free(qid);
+	got_object_id_queue_free(&ids);
+	return err;
+}
+
+/*
+ * Like findtwixt(), but history traversal stops at shallow commits.
+ * The parents of shallow commits are missing from the repository of
+ * the receiving side and possibly from our own repository as well.
+ */
+static const struct got_error *
+findtwixt_shallow(struct got_object_id ***res, int *nres, int *ncolored,
+    struct got_object_id **head, int nhead,
+    struct got_object_id **tail, int ntail,
+    struct got_object_idset *shallow, struct got_repository *repo,
+    got_pack_progress_cb progress_cb, void *progress_arg,
+    struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_object_idset *keep, *drop = NULL;
+	struct append_id_arg arg;
+	int nkeep;
+
+	*res = NULL;
+	*nres = 0;
+	*ncolored = 0;
+
+	keep = got_object_idset_alloc();
+	if (keep == NULL)
+		return got_error_from_errno("got_object_idset_alloc");
+
+	drop = got_object_idset_alloc();
+	if (drop == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+
+	err = paint_commits_shallow(drop, NULL, tail, ntail, shallow,
+	    ncolored, repo, progress_cb, progress_arg, rl,
+	    cancel_cb, cancel_arg);
+	if (err)
+		goto done;
+
+	err = paint_commits_shallow(keep, drop, head, nhead, shallow,
+	    ncolored, repo, progress_cb, progress_arg, rl,
+	    cancel_cb, cancel_arg);
+	if (err)
+		goto done;
+
+	nkeep = got_object_idset_num_elements(keep);
+	if (nkeep == 0)
+		goto done;
+
+	arg.array = calloc(nkeep, sizeof(struct got_object_id *));
+	if (arg.array == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	arg.idx = -1;
+	arg.skip = drop;
+	arg.drop = drop;
+	err = got_object_idset_for_each(keep, append_id, &arg);
+	if (err) {
+		free(arg.array);
+		goto done;
+	}
+	*res = arg.array;
+	*nres = arg.idx + 1;
+done:
+	got_object_idset_free(keep);
+	if (drop)
+		got_object_idset_free(drop);
+	return err;
+}
+
 static const struct got_error *
 find_pack_for_enumeration(struct got_packidx **best_packidx,
     struct got_object_id **ids, int nids, struct got_repository *repo)
@@ -1379,14 +1742,121 @@ find_pack_for_enumeration(struct got_packidx **best_packidx,
 	return err;
 }
 
+/*
+ * Try to find objects to pack with the help of a pack bitmap file.
+ * Set *found to zero if some objects involved are not covered by the
+ * bitmap, in which case the caller must find objects via traversal.
+ */
 static const struct got_error *
-load_object_ids(int *ncolored, int *nfound, int *ntrees,
+load_object_ids_bitmap(int *found, int *ncolored, int *nfound, int *ntrees,
     struct got_object_idset *idset, struct got_object_id **theirs, int ntheirs,
     struct got_object_id **ours, int nours, struct got_repository *repo,
-    uint32_t seed, int loose_obj_only, got_pack_progress_cb progress_cb,
-    void *progress_arg, struct got_ratelimit *rl, got_cancel_cb cancel_cb,
-    void *cancel_arg)
-{
+    got_pack_progress_cb progress_cb, void *progress_arg,
+    struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_pack_bitmap *bm = NULL;
+	struct got_bitmap *want = NULL, *have = NULL;
+	struct got_pack_meta *m;
+	struct got_object_id id;
+	size_t pos;
+	int i, obj_type;
+
+	*found = 0;
+
+	err = got_pack_bitmap_find(&bm, repo);
+	if (err || bm == NULL)
+		return err;
+
+	err = got_bitmap_alloc(&want, bm->nobjects);
+	if (err)
+		goto done;
+	err = got_bitmap_alloc(&have, bm->nobjects);
+	if (err)
+		goto done;
+
+	for (i = 0; i < nours; i++) {
+		if (ours[i] == NULL)
+			continue;
+		err = got_pack_bitmap_fill(want, bm, ours[i], repo,
+		    cancel_cb, cancel_arg);
+		if (err)
+			goto done;
+	}
+
+	for (i = 0; i < ntheirs; i++) {
+		if (theirs[i] == NULL)
+			continue;
+		err = got_pack_bitmap_fill(have, bm, theirs[i], repo,
+		    cancel_cb, cancel_arg);
+		if (err)
+			goto done;
+	}
+
+	got_bitmap_andnot(want, have);
+
+	pos = 0;
+	while (got_bitmap_next(&pos, want, pos)) {
+		err = got_pack_bitmap_get_object_id(&id, bm, pos);
+		if (err)
+			goto done;
+
+		obj_type = got_pack_bitmap_get_type(bm, pos);
+		if (obj_type == GOT_OBJ_TYPE_ANY) {
+			err = got_object_get_type(&obj_type, repo, &id);
+			if (err)
+				goto done;
+		}
+
+		err = alloc_meta(&m, &id, "", obj_type, 0);
+		if (err)
+			goto done;
+		/* Group objects by path name for delta search. */
+		m->path_hash = got_pack_bitmap_get_name_hash(bm, pos);
+
+		err = got_object_idset_add(idset, &id, m);
+		if (err) {
+			clear_meta(m);
+			free(m);
+			goto done;
+		}
+
+		if (obj_type == GOT_OBJ_TYPE_COMMIT)
+			(*ncolored)++;
+		else if (obj_type == GOT_OBJ_TYPE_TREE)
+			(*ntrees)++;
+		(*nfound)++;
+		err = got_pack_report_progress(progress_cb, progress_arg, rl,
+		    *ncolored, *nfound, *ntrees, 0L, 0, 0, 0, 0, 0);
+		if (err)
+			goto done;
+		pos++;
+	}
+
+	*found = 1;
+done:
+	got_bitmap_free(want);
+	got_bitmap_free(have);
+	got_pack_bitmap_close(bm);
+	/*
+	 * Some objects are not covered by the bitmap. This can only happen
+	 * before any objects were added to the idset.
+	 */
+	if (err && (err->code == GOT_ERR_NO_OBJ ||
+	    err->code == GOT_ERR_NOT_IMPL) &&
+	    got_object_idset_num_elements(idset) == 0)
+		err = NULL;
+	return err;
+}
+
+static const struct got_error *
+load_object_ids(int *ncolored, int *nfound, int *ntrees,
+    struct got_object_idset *idset, struct got_object_id **theirs, int ntheirs,
+    struct got_object_id **ours, int nours, struct got_repository *repo,
+    int loose_obj_only, struct got_object_idset *shallow,
+    got_pack_progress_cb progress_cb, void *progress_arg,
+    struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
+{
 	const struct got_error *err = NULL;
 	struct got_object_id **ids = NULL;
 	struct got_packidx *packidx = NULL;
@@ -1401,17 +1871,44 @@ load_object_ids(int *ncolored, int *nfound, int *ntrees,
 	*nfound = 0;
 	*ntrees = 0;
 
-	err = findtwixt(&ids, &nobj, ncolored, ours, nours, theirs, ntheirs,
-	    repo, progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
-	if (err)
-		goto done;
+	/*
+	 * Pack bitmaps and object enumeration in got-read-pack cover
+	 * the complete history of commits.
+	 */
+	if (!loose_obj_only && shallow == NULL) {
+		int found;
+
+		err = load_object_ids_bitmap(&found, ncolored, nfound, ntrees,
+		    idset, theirs, ntheirs, ours, nours, repo,
+		    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
+		if (err || found)
+			goto done;
+		*ncolored = 0;
+		*nfound = 0;
+		*ntrees = 0;
+	}
 
-	err = find_pack_for_enumeration(&packidx, theirs, ntheirs, repo);
+	if (shallow) {
+		err = findtwixt_shallow(&ids, &nobj, ncolored, ours, nours,
+		    theirs, ntheirs, shallow, repo, progress_cb, progress_arg,
+		    rl, cancel_cb, cancel_arg);
+	} else {
+		err = findtwixt(&ids, &nobj, ncolored, ours, nours,
+		    theirs, ntheirs, repo, progress_cb, progress_arg, rl,
+		    cancel_cb, cancel_arg);
+	}
 	if (err)
 		goto done;
+
+	if (shallow == NULL) {
+		err = find_pack_for_enumeration(&packidx, theirs, ntheirs,
+		    repo);
+		if (err)
+			goto done;
+	}
 	if (packidx) {
 		err = got_pack_load_packed_object_ids(&found_all_objects,
-		    theirs, ntheirs, NULL, 0, 0, seed, idset, idset_exclude,
+		    theirs, ntheirs, NULL, 0, 0, idset, idset_exclude,
 		    loose_obj_only, repo, packidx, ncolored, nfound, ntrees,
 		    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
 		if (err)
@@ -1428,7 +1925,7 @@ load_object_ids(int *ncolored, int *nfound, int *ntrees,
 		if (obj_type == GOT_OBJ_TYPE_COMMIT) {
 			if (!found_all_objects) {
 				err = load_commit(0, idset, idset_exclude,
-				    id, repo, seed, loose_obj_only,
+				    id, repo, loose_obj_only,
 				    ncolored, nfound, ntrees,
 				    progress_cb, progress_arg, rl,
 				    cancel_cb, cancel_arg);
@@ -1437,7 +1934,7 @@ load_object_ids(int *ncolored, int *nfound, int *ntrees,
 			}
 		} else if (obj_type == GOT_OBJ_TYPE_TAG) {
 			err = load_tag(0, idset, idset_exclude, id, repo,
-			    seed, loose_obj_only, ncolored, nfound, ntrees,
+			    loose_obj_only, ncolored, nfound, ntrees,
 			    progress_cb, progress_arg, rl,
 			    cancel_cb, cancel_arg);
 			if (err)
@@ -1446,12 +1943,14 @@ load_object_ids(int *ncolored, int *nfound, int *ntrees,
 	}
 
 	found_all_objects = 0;
-	err = find_pack_for_enumeration(&packidx, ids, nobj, repo);
-	if (err)
-		goto done;
+	if (shallow == NULL) {
+		err = find_pack_for_enumeration(&packidx, ids, nobj, repo);
+		if (err)
+			goto done;
+	}
 	if (packidx) {
 		err = got_pack_load_packed_object_ids(&found_all_objects, ids,
-		    nobj, theirs, ntheirs, 1, seed, idset, idset_exclude,
+		    nobj, theirs, ntheirs, 1, idset, idset_exclude,
 		    loose_obj_only, repo, packidx, ncolored, nfound, ntrees,
 		    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
 		if (err)
@@ -1461,40 +1960,474 @@ load_object_ids(int *ncolored, int *nfound, int *ntrees,
 	if (!found_all_objects) {
 		for (i = 0; i < nobj; i++) {
 			err = load_commit(1, idset, idset_exclude, ids[i],
-			    repo, seed, loose_obj_only, ncolored, nfound,
+			    repo, loose_obj_only, ncolored, nfound,
 			    ntrees, progress_cb, progress_arg, rl,
 			    cancel_cb, cancel_arg);
 			if (err)
 				goto done;
 		}
-	}
+	}
+
+	for (i = 0; i < nours; i++) {
+		struct got_object_id *id = ours[i];
+		struct got_pack_meta *m;
+		if (id == NULL)
+			continue;
+		m = got_object_idset_get(idset, id);
+		if (m == NULL) {
+			err = got_object_get_type(&obj_type, repo, id);
+			if (err)
+				goto done;
+		} else
+			obj_type = m->obj_type;
+		switch (obj_type) {
+		case GOT_OBJ_TYPE_TAG:
+			err = load_tag(1, idset, idset_exclude, id, repo,
+			    loose_obj_only, ncolored, nfound, ntrees,
+			    progress_cb, progress_arg, rl,
+			    cancel_cb, cancel_arg);
+			break;
+		case GOT_OBJ_TYPE_TREE:
+			/* Trees and blobs may be wanted by partial clones. */
+			err = got_pack_load_tree(1, idset, idset_exclude, id,
+			    "", 0, repo, loose_obj_only, ncolored, nfound,
+			    ntrees, progress_cb, progress_arg, rl,
+			    cancel_cb, cancel_arg);
+			break;
+		case GOT_OBJ_TYPE_BLOB:
+			if (m != NULL)
+				break;
+			err = got_pack_add_object(1, idset, id, "",
+			    GOT_OBJ_TYPE_BLOB, 0, loose_obj_only, repo,
+			    ncolored, nfound, ntrees, progress_cb, progress_arg,
+			    rl);
+			break;
+		default:
+			break;
+		}
+		if (err)
+			goto done;
+	}
+done:
+	for (i = 0; i < nobj; i++) {
+		free(ids[i]);
+	}
+	free(ids);
+	got_object_idset_free(idset_exclude);
+	return err;
+}
+
+const struct got_error *
+got_pack_parse_filter(struct got_pack_filter *filter, const char *spec)
+{
+	const char *limit;
+	char *ep;
+	long long n, unit = 1;
+
+	memset(filter, 0, sizeof(*filter));
+
+	if (strcmp(spec, "blob:none") == 0) {
+		filter->type = GOT_PACK_FILTER_BLOB_NONE;
+		return NULL;
+	}
+
+	if (strncmp(spec, "blob:limit=", 11) != 0)
+		return got_error_path(spec, GOT_ERR_BAD_FILTER);
+	limit = spec + 11;
+	if (!isdigit((unsigned char)limit[0]))
+		return got_error_path(spec, GOT_ERR_BAD_FILTER);
+
+	errno = 0;
+	n = strtoll(limit, &ep, 10);
+	if (errno == ERANGE)
+		return got_error_path(spec, GOT_ERR_BAD_FILTER);
+	switch (ep[0]) {
+	case '\0':
+		break;
+	case 'k':
+	case 'K':
+		unit = 1024;
+		break;
+	case 'm':
+	case 'M':
+		unit = 1024 * 1024;
+		break;
+	case 'g':
+	case 'G':
+		unit = 1024 * 1024 * 1024;
+		break;
+	default:
+		return got_error_path(spec, GOT_ERR_BAD_FILTER);
+	}
+	if (ep[0] != '\0' && ep[1] != '\0')
+		return got_error_path(spec, GOT_ERR_BAD_FILTER);
+	if (n > LLONG_MAX / unit)
+		return got_error_path(spec, GOT_ERR_BAD_FILTER);
+
+	filter->type = GOT_PACK_FILTER_BLOB_LIMIT;
+	filter->blob_limit = n * unit;
+	return NULL;
+}
+
+static const struct got_error *
+get_blob_size(off_t *size, int *outfd, struct got_object_id *id,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_object *obj;
+	struct got_raw_object *raw;
+
+	err = got_object_open(&obj, repo, id);
+	if (err)
+		return err;
+	if ((obj->flags & GOT_OBJ_FLAG_DELTIFIED) == 0) {
+		/* The size is known without applying any deltas. */
+		*size = obj->size;
+		got_object_close(obj);
+		return NULL;
+	}
+	got_object_close(obj);
+
+	err = got_object_raw_open(&raw, outfd, repo, id);
+	if (err)
+		return err;
+	*size = raw->size;
+	return got_object_raw_close(raw);
+}
+
+struct filter_objects_arg {
+	const struct got_pack_filter *filter;
+	struct got_object_idset *wanted;
+	struct got_object_idset *omit;
+	struct got_repository *repo;
+	int outfd;
+	got_cancel_cb cancel_cb;
+	void *cancel_arg;
+};
+
+static const struct got_error *
+find_filtered_object(struct got_object_id *id, void *data, void *arg)
+{
+	const struct got_error *err;
+	struct filter_objects_arg *a = arg;
+	struct got_pack_meta *m = data;
+	off_t size;
+
+	if (a->cancel_cb) {
+		err = (*a->cancel_cb)(a->cancel_arg);
+		if (err)
+			return err;
+	}
+
+	if (m == NULL || m->obj_type != GOT_OBJ_TYPE_BLOB ||
+	    got_object_idset_contains(a->wanted, id))
+		return NULL;
+
+	if (a->filter->type == GOT_PACK_FILTER_BLOB_LIMIT) {
+		err = get_blob_size(&size, &a->outfd, id, a->repo);
+		if (err)
+			return err;
+		if (size <= a->filter->blob_limit)
+			return NULL;
+	}
+
+	return got_object_idset_add(a->omit, id, m);
+}
+
+static const struct got_error *
+remove_filtered_object(struct got_object_id *id, void *data, void *arg)
+{
+	struct got_object_idset *idset = arg;
+	struct got_pack_meta *m = data;
+
+	clear_meta(m);
+	free(m);
+	return got_object_idset_remove(NULL, idset, id);
+}
+
+/*
+ * Remove blobs which do not pass the filter from the set of objects
+ * to pack. Blobs which were explicitly requested are always packed.
+ */
+static const struct got_error *
+filter_objects(int *nfound, struct got_object_idset *idset,
+    const struct got_pack_filter *filter,
+    struct got_object_id **ours, int nours, struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct filter_objects_arg arg;
+	int i;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.filter = filter;
+	arg.repo = repo;
+	arg.outfd = -1;
+	arg.cancel_cb = cancel_cb;
+	arg.cancel_arg = cancel_arg;
+
+	arg.wanted = got_object_idset_alloc();
+	if (arg.wanted == NULL)
+		return got_error_from_errno("got_object_idset_alloc");
+	arg.omit = got_object_idset_alloc();
+	if (arg.omit == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+
+	for (i = 0; i < nours; i++) {
+		if (ours[i] == NULL ||
+		    got_object_idset_contains(arg.wanted, ours[i]))
+			continue;
+		err = got_object_idset_add(arg.wanted, ours[i], NULL);
+		if (err)
+			goto done;
+	}
+
+	err = got_object_idset_for_each(idset, find_filtered_object, &arg);
+	if (err)
+		goto done;
+
+	*nfound -= got_object_idset_num_elements(arg.omit);
+	err = got_object_idset_for_each(arg.omit, remove_filtered_object,
+	    idset);
+done:
+	got_object_idset_free(arg.wanted);
+	if (arg.omit)
+		got_object_idset_free(arg.omit);
+	if (arg.outfd != -1 && close(arg.outfd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	return err;
+}
+
+static int
+path_hash_cmp(const void *pa, const void *pb)
+{
+	uint32_t a = *(const uint32_t *)pa;
+	uint32_t b = *(const uint32_t *)pb;
+
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return 0;
+}
+
+static int
+has_path_hash(uint32_t *hashes, int nhashes, const char *path)
+{
+	uint32_t h = got_pack_bitmap_name_hash(path);
+
+	return bsearch(&h, hashes, nhashes, sizeof(h), path_hash_cmp) != NULL;
+}
+
+static const struct got_error *
+add_thin_base(struct got_pack_metavec *v, struct got_object_idset *seen,
+    struct got_object_id *id, const char *path, int obj_type)
+{
+	const struct got_error *err;
+	struct got_pack_meta *m;
+
+	err = got_object_idset_add(seen, id, NULL);
+	if (err)
+		return err;
+
+	err = alloc_meta(&m, id, path, obj_type, 0);
+	if (err)
+		return err;
+	m->thin_base = 1;
+
+	err = got_pack_add_meta(m, v);
+	if (err) {
+		clear_meta(m);
+		free(m);
+	}
+	return err;
+}
+
+/*
+ * Find delta base candidates for a thin pack in the trees of commits the
+ * receiver already has. Only paths where blobs or trees are being deltified
+ * are considered, and unchanged subtrees are not traversed.
+ */
+static const struct got_error *
+load_thin_bases(struct got_pack_metavec *v, struct got_pack_meta **meta,
+    int nmeta, struct got_object_idset *idset,
+    struct got_object_id **theirs, int ntheirs, struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	uint32_t *hashes;
+	int nhashes = 0;
+	struct got_object_idset *seen = NULL;
+	struct got_object_id_queue tree_ids;
+	struct got_object_qid *qid;
+	struct got_tree_object *tree = NULL;
+	char *p = NULL;
+	int i, ncommits = 0;
+
+	STAILQ_INIT(&tree_ids);
+
+	hashes = calloc(nmeta, sizeof(*hashes));
+	if (hashes == NULL)
+		return got_error_from_errno("calloc");
+	for (i = 0; i < nmeta; i++) {
+		if (meta[i]->obj_type == GOT_OBJ_TYPE_BLOB ||
+		    meta[i]->obj_type == GOT_OBJ_TYPE_TREE)
+			hashes[nhashes++] = meta[i]->path_hash;
+	}
+	if (nhashes == 0)
+		goto done;
+	qsort(hashes, nhashes, sizeof(*hashes), path_hash_cmp);
+
+	seen = got_object_idset_alloc();
+	if (seen == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+
+	for (i = 0; i < ntheirs &&
+	    ncommits < GOT_PACK_CREATE_THIN_COMMITS_MAX; i++) {
+		struct got_object_id *id = theirs[i];
+		struct got_commit_object *commit;
+		struct got_tag_object *tag;
+		int obj_type;
+
+		if (id == NULL)
+			continue;
+		err = got_object_get_type(&obj_type, repo, id);
+		if (err) {
+			if (err->code != GOT_ERR_NO_OBJ)
+				goto done;
+			err = NULL;
+			continue;
+		}
+		if (obj_type == GOT_OBJ_TYPE_TAG) {
+			err = got_object_open_as_tag(&tag, repo, id);
+			if (err)
+				goto done;
+			obj_type = got_object_tag_get_object_type(tag);
+			if (obj_type == GOT_OBJ_TYPE_COMMIT) {
+				err = got_object_open_as_commit(&commit, repo,
+				    got_object_tag_get_object_id(tag));
+			}
+			got_object_tag_close(tag);
+		} else if (obj_type == GOT_OBJ_TYPE_COMMIT)
+			err = got_object_open_as_commit(&commit, repo, id);
+		if (err)
+			goto done;
+		if (obj_type != GOT_OBJ_TYPE_COMMIT)
+			continue;
+
+		err = got_object_qid_alloc(&qid,
+		    got_object_commit_get_tree_id(commit));
+		got_object_commit_close(commit);
+		if (err)
+			goto done;
+		qid->data = strdup("");
+		if (qid->data == NULL) {
+			err = got_error_from_errno("strdup");
+			got_object_qid_free(qid);
+			goto done;
+		}
+		STAILQ_INSERT_TAIL(&tree_ids, qid, entry);
+		ncommits++;
+	}
+
+	while (!STAILQ_EMPTY(&tree_ids)) {
+		const char *path;
+
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				break;
+		}
+
+		qid = STAILQ_FIRST(&tree_ids);
+		STAILQ_REMOVE_HEAD(&tree_ids, entry);
+		path = qid->data;
+
+		if (got_object_idset_contains(seen, &qid->id) ||
+		    got_object_idset_contains(idset, &qid->id) ||
+		    !has_path_hash(hashes, nhashes, path)) {
+			free(qid->data);
+			got_object_qid_free(qid);
+			continue;
+		}
+
+		err = add_thin_base(v, seen, &qid->id, path,
+		    GOT_OBJ_TYPE_TREE);
+		if (err == NULL)
+			err = got_object_open_as_tree(&tree, repo, &qid->id);
+		if (err) {
+			free(qid->data);
+			got_object_qid_free(qid);
+			break;
+		}
+
+		for (i = 0; i < got_object_tree_get_nentries(tree); i++) {
+			struct got_tree_entry *e;
+			struct got_object_id *id;
+			mode_t mode;
+
+			e = got_object_tree_get_entry(tree, i);
+			id = got_tree_entry_get_id(e);
+			mode = got_tree_entry_get_mode(e);
+
+			if (got_object_tree_entry_is_submodule(e) ||
+			    got_object_idset_contains(seen, id) ||
+			    got_object_idset_contains(idset, id))
+				continue;
+
+			if (asprintf(&p, "%s%s%s", path,
+			    got_path_is_root_dir(path) ? "" : "/",
+			    got_tree_entry_get_name(e)) == -1) {
+				err = got_error_from_errno("asprintf");
+				break;
+			}
+
+			if (!has_path_hash(hashes, nhashes, p)) {
+				free(p);
+				p = NULL;
+				continue;
+			}
+
+			if (S_ISDIR(mode)) {
+				struct got_object_qid *subqid;
+
+				err = got_object_qid_alloc(&subqid, id);
+				if (err)
+					break;
+				subqid->data = p;
+				p = NULL;
+				STAILQ_INSERT_TAIL(&tree_ids, subqid, entry);
+			} else if (S_ISREG(mode) || S_ISLNK(mode)) {
+				err = add_thin_base(v, seen, id, p,
+				    GOT_OBJ_TYPE_BLOB);
+				if (err)
+					break;
+			}
+			free(p);
+			p = NULL;
+		}
 
-	for (i = 0; i < nours; i++) {
-		struct got_object_id *id = ours[i];
-		struct got_pack_meta *m;
-		if (id == NULL)
-			continue;
-		m = got_object_idset_get(idset, id);
-		if (m == NULL) {
-			err = got_object_get_type(&obj_type, repo, id);
-			if (err)
-				goto done;
-		} else
-			obj_type = m->obj_type;
-		if (obj_type != GOT_OBJ_TYPE_TAG)
-			continue;
-		err = load_tag(1, idset, idset_exclude, id, repo,
-		    seed, loose_obj_only, ncolored, nfound, ntrees,
-		    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
+		free(qid->data);
+		got_object_qid_free(qid);
+		got_object_tree_close(tree);
+		tree = NULL;
 		if (err)
-			goto done;
+			break;
 	}
 done:
-	for (i = 0; i < nobj; i++) {
-		free(ids[i]);
-	}
-	free(ids);
-	got_object_idset_free(idset_exclude);
+	free(p);
+	STAILQ_FOREACH(qid, &tree_ids, entry)
+		free(qid->data);
+	got_object_id_queue_free(&tree_ids);
+	if (tree)
+		got_object_tree_close(tree);
+	if (seen)
+		got_object_idset_free(seen);
+	free(hashes);
 	return err;
 }
 
@@ -1761,11 +2694,40 @@ done:
 	return err;
 }
 
+/*
+ * State of a pack file which is written in two steps, before and after
+ * the delta search.
+ */
+struct got_pack_writer {
+	struct got_hash ctx;
+	off_t packfile_size;
+	int nobj;
+	int nwritten;
+	int outfd;
+	FILE *packfile;
+};
+
+static void
+pack_writer_init(struct got_pack_writer *w, struct got_repository *repo)
+{
+	memset(w, 0, sizeof(*w));
+	got_hash_init(&w->ctx, got_repo_get_object_format(repo));
+	w->outfd = -1;
+}
+
+/*
+ * Write all objects whose encoding is known before the delta search:
+ * The pack file header, the verbatim part of the reused pack file,
+ * commits and tags, which are never deltified, and reused deltas whose
+ * base has already been written.
+ * This allows pack file data to reach a reader early.
+ */
 static const struct got_error *
-genpack(struct got_object_id *pack_hash, int packfd,
-    struct got_pack *reuse_pack, FILE *delta_cache,
+genpack_start(struct got_pack_writer *w, int packfd,
+    struct got_pack *reuse_pack,
     struct got_pack_meta **deltify, int ndeltify,
     struct got_pack_meta **reuse, int nreuse,
+    int nverbatim, off_t verbatim_end,
     int ncolored, int nfound, int ntrees, int nours,
     struct got_repository *repo, int force_refdelta,
     got_pack_progress_cb progress_cb, void *progress_arg,
@@ -1773,22 +2735,142 @@ genpack(struct got_object_id *pack_hash, int packfd,
     got_cancel_cb cancel_cb, void *cancel_arg)
 {
 	const struct got_error *err = NULL;
-	int i;
-	struct got_hash ctx;
+	int i, ndone = nreuse + nverbatim;
 	struct got_pack_meta *m;
 	char buf[32];
-	off_t packfile_size = 0;
-	int outfd = -1;
+	off_t off;
+
+	w->nobj = ndeltify + nreuse + nverbatim;
+
+	err = hwrite(packfd, "PACK", 4, &w->ctx);
+	if (err)
+		return err;
+	putbe32(buf, GOT_PACKFILE_VERSION);
+	err = hwrite(packfd, buf, 4, &w->ctx);
+	if (err)
+		return err;
+	putbe32(buf, w->nobj);
+	err = hwrite(packfd, buf, 4, &w->ctx);
+	if (err)
+		return err;
+
+	if ((nreuse > 0 || nverbatim > 0) && reuse_pack->map == NULL) {
+		int fd = dup(reuse_pack->fd);
+		if (fd == -1)
+			return got_error_from_errno("dup");
+		w->packfile = fdopen(fd, "r");
+		if (w->packfile == NULL) {
+			err = got_error_from_errno("fdopen");
+			close(fd);
+			return err;
+		}
+	}
+
+	/*
+	 * Copy the leading part of the reused pack file which contains only
+	 * objects we want to send. Object offsets in this part are the same
+	 * in both pack files.
+	 */
+	off = sizeof(struct got_packfile_hdr);
+	if (w->packfile && nverbatim > 0 &&
+	    fseeko(w->packfile, off, SEEK_SET) == -1)
+		return got_error_from_errno("fseeko");
+	while (nverbatim > 0 && off < verbatim_end) {
+		off_t len = MIN(verbatim_end - off,
+		    GOT_PACK_CREATE_VERBATIM_CHUNK);
+
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				return err;
+		}
+		err = got_pack_report_progress(progress_cb, progress_arg, rl,
+		    ncolored, nfound, ntrees, w->packfile_size, nours,
+		    w->nobj, ndone, 0, 0);
+		if (err)
+			return err;
+		if (w->packfile)
+			err = hcopy(w->packfile, packfd, len, &w->ctx);
+		else {
+			err = hcopy_mmap(reuse_pack->map, off,
+			    reuse_pack->filesize, packfd, len, &w->ctx);
+		}
+		if (err)
+			return err;
+		w->packfile_size += len;
+		off += len;
+	}
+	w->nwritten = nverbatim;
+
+	qsort(deltify, ndeltify, sizeof(struct got_pack_meta *),
+	    write_order_cmp);
+	for (i = 0; i < ndeltify; i++) {
+		m = deltify[i];
+		if (m->obj_type != GOT_OBJ_TYPE_COMMIT &&
+		    m->obj_type != GOT_OBJ_TYPE_TAG)
+			continue;
+		err = got_pack_report_progress(progress_cb, progress_arg, rl,
+		    ncolored, nfound, ntrees, w->packfile_size, nours,
+		    w->nobj, ndone, w->nwritten, 0);
+		if (err)
+			return err;
+		err = write_packed_object(&w->packfile_size, packfd,
+		    NULL, NULL, 0, m, &w->outfd, &w->ctx, repo,
+		    force_refdelta);
+		if (err)
+			return err;
+		m->written = 1;
+		w->nwritten++;
+	}
+
+	qsort(reuse, nreuse, sizeof(struct got_pack_meta *),
+	    reuse_write_order_cmp);
+	for (i = 0; i < nreuse; i++) {
+		m = reuse[i];
+		if (!m->prev->verbatim && !m->prev->written)
+			continue;
+		err = got_pack_report_progress(progress_cb, progress_arg, rl,
+		    ncolored, nfound, ntrees, w->packfile_size, nours,
+		    w->nobj, ndone, w->nwritten, 0);
+		if (err)
+			return err;
+		err = write_packed_object(&w->packfile_size, packfd,
+		    w->packfile, reuse_pack->map, reuse_pack->filesize,
+		    m, &w->outfd, &w->ctx, repo, force_refdelta);
+		if (err)
+			return err;
+		m->written = 1;
+		w->nwritten++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Write all objects which remain after the delta search, followed by
+ * the pack file checksum.
+ */
+static const struct got_error *
+genpack_finish(struct got_object_id *pack_hash, struct got_pack_writer *w,
+    int packfd, struct got_pack *reuse_pack, FILE *delta_cache,
+    struct got_pack_meta **deltify, int ndeltify,
+    struct got_pack_meta **reuse, int nreuse,
+    int ncolored, int nfound, int ntrees, int nours,
+    struct got_repository *repo, int force_refdelta,
+    got_pack_progress_cb progress_cb, void *progress_arg,
+    struct got_ratelimit *rl)
+{
+	const struct got_error *err = NULL;
+	int i;
+	struct got_pack_meta *m;
 	int delta_cache_fd = -1;
 	uint8_t *delta_cache_map = NULL;
 	size_t delta_cache_size = 0;
-	FILE *packfile = NULL;
 	enum got_hash_algorithm algo;
 	size_t digest_len;
 
 	algo = got_repo_get_object_format(repo);
 	digest_len = got_hash_digest_length(algo);
-	got_hash_init(&ctx, algo);
 
 	memset(pack_hash, 0, sizeof(*pack_hash));
 	pack_hash->algo = algo;
@@ -1815,85 +2897,63 @@ genpack(struct got_object_id *pack_hash, int packfd,
 		}
 	}
 #endif
-	err = hwrite(packfd, "PACK", 4, &ctx);
-	if (err)
-		goto done;
-	putbe32(buf, GOT_PACKFILE_VERSION);
-	err = hwrite(packfd, buf, 4, &ctx);
-	if (err)
-		goto done;
-	putbe32(buf, ndeltify + nreuse);
-	err = hwrite(packfd, buf, 4, &ctx);
-	if (err)
-		goto done;
 
 	qsort(deltify, ndeltify, sizeof(struct got_pack_meta *),
 	    write_order_cmp);
 	for (i = 0; i < ndeltify; i++) {
+		m = deltify[i];
+		if (m->written)
+			continue;
 		err = got_pack_report_progress(progress_cb, progress_arg, rl,
-		    ncolored, nfound, ntrees, packfile_size, nours,
-		    ndeltify + nreuse, ndeltify + nreuse, i, 0);
+		    ncolored, nfound, ntrees, w->packfile_size, nours,
+		    w->nobj, w->nobj, w->nwritten, 0);
 		if (err)
 			goto done;
-		m = deltify[i];
-		err = write_packed_object(&packfile_size, packfd,
+		err = write_packed_object(&w->packfile_size, packfd,
 		    delta_cache, delta_cache_map, delta_cache_size,
-		    m, &outfd, &ctx, repo, force_refdelta);
+		    m, &w->outfd, &w->ctx, repo, force_refdelta);
 		if (err)
 			goto done;
+		m->written = 1;
+		w->nwritten++;
 	}
 
-	qsort(reuse, nreuse, sizeof(struct got_pack_meta *),
-	    reuse_write_order_cmp);
-	if (nreuse > 0 && reuse_pack->map == NULL) {
-		int fd = dup(reuse_pack->fd);
-		if (fd == -1) {
-			err = got_error_from_errno("dup");
-			goto done;
-		}
-		packfile = fdopen(fd, "r");
-		if (packfile == NULL) {
-			err = got_error_from_errno("fdopen");
-			close(fd);
-			goto done;
-		}
-	}
+	/* Reused deltas were sorted by genpack_start(). */
 	for (i = 0; i < nreuse; i++) {
+		m = reuse[i];
+		if (m->written)
+			continue;
 		err = got_pack_report_progress(progress_cb, progress_arg, rl,
-		    ncolored, nfound, ntrees, packfile_size, nours,
-		    ndeltify + nreuse, ndeltify + nreuse, ndeltify + i, 0);
+		    ncolored, nfound, ntrees, w->packfile_size, nours,
+		    w->nobj, w->nobj, w->nwritten, 0);
 		if (err)
 			goto done;
-		m = reuse[i];
-		err = write_packed_object(&packfile_size, packfd,
-		    packfile, reuse_pack->map, reuse_pack->filesize,
-		    m, &outfd, &ctx, repo, force_refdelta);
+		err = write_packed_object(&w->packfile_size, packfd,
+		    w->packfile, reuse_pack->map, reuse_pack->filesize,
+		    m, &w->outfd, &w->ctx, repo, force_refdelta);
 		if (err)
 			goto done;
+		m->written = 1;
+		w->nwritten++;
 	}
 
-	got_hash_final_object_id(&ctx, pack_hash);
+	got_hash_final_object_id(&w->ctx, pack_hash);
 	err = got_poll_write_full(packfd, pack_hash->hash, digest_len);
 	if (err)
 		goto done;
-	packfile_size += digest_len;
-	packfile_size += sizeof(struct got_packfile_hdr);
+	w->packfile_size += digest_len;
+	w->packfile_size += sizeof(struct got_packfile_hdr);
 	if (progress_cb) {
 		err = progress_cb(progress_arg, ncolored, nfound, ntrees,
-		    packfile_size, nours, ndeltify + nreuse,
-		    ndeltify + nreuse, ndeltify + nreuse, 1);
+		    w->packfile_size, nours, w->nobj, w->nobj, w->nobj, 1);
 		if (err)
 			goto done;
 	}
 done:
-	if (outfd != -1 && close(outfd) == -1 && err == NULL)
-		err = got_error_from_errno("close");
 	if (delta_cache_map && munmap(delta_cache_map, delta_cache_size) == -1)
 		err = got_error_from_errno("munmap");
 	if (delta_cache_fd != -1 && close(delta_cache_fd) == -1 && err == NULL)
 		err = got_error_from_errno("close");
-	if (packfile && fclose(packfile) == EOF && err == NULL)
-		err = got_error_from_errno("fclose");
 	return err;
 }
 
@@ -1903,44 +2963,242 @@ add_meta_idset_cb(struct got_object_id *id, void *data, void *arg)
 	struct got_pack_meta *m = data;
 	struct got_pack_metavec *v = arg;
 
-	if (m->reused_delta_offset != 0)
+	if (m->reused_delta_offset != 0 || m->verbatim)
 		return NULL;
 
 	return got_pack_add_meta(m, v);
 }
 
+/*
+ * Determine delta search parameters. Parameters passed by the caller
+ * take precedence over got.conf(5) settings, which take precedence
+ * over defaults.
+ */
+static void
+get_delta_params(struct got_pack_delta_params *params,
+    const struct got_pack_delta_params *req, struct got_repository *repo)
+{
+	const struct got_gotconfig *gotconfig;
+
+	params->window = GOT_PACK_DELTA_WINDOW_DEFAULT;
+	params->depth = GOT_PACK_DELTA_DEPTH_DEFAULT;
+	params->memsize = GOT_PACK_DELTA_MEMSIZE_DEFAULT;
+
+	gotconfig = got_repo_get_gotconfig(repo);
+	if (gotconfig) {
+		int window, depth;
+		size_t memsize;
+
+		window = got_gotconfig_get_pack_window(gotconfig);
+		if (window > 0)
+			params->window = window;
+		depth = got_gotconfig_get_pack_depth(gotconfig);
+		if (depth > 0)
+			params->depth = depth;
+		memsize = got_gotconfig_get_pack_memsize(gotconfig);
+		if (memsize > 0)
+			params->memsize = memsize;
+	}
+
+	if (req) {
+		if (req->window > 0)
+			params->window = req->window;
+		if (req->depth > 0)
+			params->depth = req->depth;
+		if (req->memsize > 0)
+			params->memsize = req->memsize;
+	}
+
+	params->window = MIN(params->window, GOT_PACK_DELTA_WINDOW_MAX);
+	params->depth = MIN(params->depth, GOT_PACK_DELTA_DEPTH_MAX);
+}
+
+/*
+ * Compute the position of a reused delta within its delta chain.
+ * Reused deltas which would exceed the maximum chain depth are
+ * left to the delta search instead.
+ */
+static void
+limit_reused_delta_chain(struct got_pack_meta *m, int depth)
+{
+	struct got_pack_meta *base = m->prev, *root;
+
+	if (m->reused_delta_offset == 0 || m->nchain != 0)
+		return;
+
+	m->nchain = -1; /* detect cycles */
+	limit_reused_delta_chain(base, depth);
+	if (base->nchain < 0 || base->nchain >= depth) {
+		free(m->base_obj_id);
+		m->base_obj_id = NULL;
+		m->prev = NULL;
+		m->reused_delta_offset = 0;
+		m->delta_len = 0;
+		m->delta_compressed_len = 0;
+		m->nchain = 0;
+		return;
+	}
+
+	m->nchain = base->nchain + 1;
+	for (root = base; root->reused_delta_offset != 0; root = root->prev)
+		;
+	if (root->reused_child_depth < m->nchain)
+		root->reused_child_depth = m->nchain;
+}
+
+/*
+ * Find the longest leading part of the reused pack file which contains only
+ * objects we are going to send. This part can be copied to the new pack file
+ * as is, with a new header and trailer, without decompressing or encoding
+ * any of its objects. Offset deltas within it remain valid since their base
+ * objects are stored at smaller offsets. Reference deltas are included only
+ * if their base object will be sent as well.
+ */
+static const struct got_error *
+find_verbatim_objects(int *nverbatim, off_t *verbatim_end,
+    struct got_object_idset *idset, struct got_packidx *packidx,
+    struct got_pack *pack, int force_refdelta,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	uint32_t *order = NULL;
+	uint32_t i, totobj = be32toh(packidx->hdr.fanout_table[0xff]);
+	size_t digest_len = got_hash_digest_length(packidx->algo);
+	struct got_object_id id, base_id;
+	struct got_pack_meta *m;
+	uint8_t type;
+	uint64_t size;
+	size_t tslen;
+	off_t offset = sizeof(struct got_packfile_hdr);
+
+	*nverbatim = 0;
+	*verbatim_end = 0;
+
+	err = got_packidx_get_pack_order(&order, packidx);
+	if (err)
+		return err;
+
+	for (i = 0; i < totobj; i++) {
+		if (cancel_cb && (i & 0xfff) == 0) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		offset = got_packidx_get_object_offset(packidx, order[i]);
+		if (offset == -1) {
+			err = got_error(GOT_ERR_BAD_PACKIDX);
+			goto done;
+		}
+		err = got_packidx_get_object_id(&id, packidx, order[i]);
+		if (err)
+			goto done;
+		m = got_object_idset_get(idset, &id);
+		if (m == NULL)
+			break;
+
+		err = got_pack_parse_object_type_and_size(&type, &size,
+		    &tslen, pack, offset);
+		if (err)
+			goto done;
+		if (type == GOT_OBJ_TYPE_OFFSET_DELTA && force_refdelta)
+			break;
+		/* Deltas which exceed the chain depth limit are not reused. */
+		if ((type == GOT_OBJ_TYPE_OFFSET_DELTA ||
+		    type == GOT_OBJ_TYPE_REF_DELTA) &&
+		    m->reused_delta_offset == 0)
+			break;
+		if (type == GOT_OBJ_TYPE_REF_DELTA) {
+			err = got_pack_parse_ref_delta(&base_id, pack, offset,
+			    tslen);
+			if (err)
+				goto done;
+			if (!got_object_idset_contains(idset, &base_id))
+				break;
+		}
+
+		m->verbatim = 1;
+		m->off = offset - sizeof(struct got_packfile_hdr);
+		(*nverbatim)++;
+	}
+
+	if (i == totobj)
+		offset = pack->filesize - digest_len;
+	if (*nverbatim > 0)
+		*verbatim_end = offset;
+done:
+	free(order);
+	return err;
+}
+
 const struct got_error *
 got_pack_create(struct got_object_id *packhash, int packfd, FILE *delta_cache,
     struct got_object_id **theirs, int ntheirs,
     struct got_object_id **ours, int nours,
     struct got_repository *repo, int loose_obj_only, int allow_empty,
-    int force_refdelta, got_pack_progress_cb progress_cb, void *progress_arg,
+    int force_refdelta, int thin, struct got_object_idset *shallow,
+    const struct got_pack_filter *filter,
+    const struct got_pack_delta_params *delta_params, int nthreads,
+    got_pack_progress_cb progress_cb, void *progress_arg,
     struct got_ratelimit *rl, got_cancel_cb cancel_cb, void *cancel_arg)
 {
 	const struct got_error *err;
 	struct got_object_idset *idset;
 	struct got_packidx *reuse_packidx = NULL;
 	struct got_pack *reuse_pack = NULL;
-	struct got_pack_metavec deltify, reuse;
-	int ncolored = 0, nfound = 0, ntrees = 0;
+	struct got_pack_metavec deltify, reuse, thin_bases;
+	struct got_pack_meta **delta_meta = NULL;
+	struct got_pack_delta_params params;
+	struct got_pack_writer w;
+	int i, j, ncolored = 0, nfound = 0, ntrees = 0, nverbatim = 0;
+	off_t verbatim_end = 0;
 	size_t ndeltify;
-	uint32_t seed;
 
-	seed = arc4random();
+	get_delta_params(&params, delta_params, repo);
+	pack_writer_init(&w, repo);
+
+	if (nthreads <= 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		if (ncpu > GOT_PACK_CREATE_MAX_THREADS)
+			nthreads = GOT_PACK_CREATE_MAX_THREADS;
+		else if (ncpu > 0)
+			nthreads = ncpu;
+		else
+			nthreads = 1;
+	} else if (nthreads > GOT_PACK_CREATE_MAX_THREADS)
+		nthreads = GOT_PACK_CREATE_MAX_THREADS;
 
 	memset(&deltify, 0, sizeof(deltify));
 	memset(&reuse, 0, sizeof(reuse));
+	memset(&thin_bases, 0, sizeof(thin_bases));
+
+	if (shallow && got_object_idset_num_elements(shallow) == 0)
+		shallow = NULL;
+
+	/*
+	 * The receiver of a filtered pack file may lack blobs which
+	 * would otherwise serve as bases of thin deltas.
+	 */
+	if (filter)
+		thin = 0;
 
 	idset = got_object_idset_alloc();
 	if (idset == NULL)
 		return got_error_from_errno("got_object_idset_alloc");
 
 	err = load_object_ids(&ncolored, &nfound, &ntrees, idset, theirs,
-	    ntheirs, ours, nours, repo, seed, loose_obj_only,
+	    ntheirs, ours, nours, repo, loose_obj_only, shallow,
 	    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
 	if (err)
 		goto done;
 
+	if (filter) {
+		err = filter_objects(&nfound, idset, filter, ours, nours,
+		    repo, cancel_cb, cancel_arg);
+		if (err)
+			goto done;
+	}
+
 	if (progress_cb) {
 		err = progress_cb(progress_arg, ncolored, nfound, ntrees,
 		    0L, nours, got_object_idset_num_elements(idset), 0, 0, 0);
@@ -1967,10 +3225,31 @@ got_pack_create(struct got_object_id *packhash, int packfd, FILE *delta_cache,
 	if (err)
 		goto done;
 
+	for (i = 0; i < reuse.nmeta; i++)
+		limit_reused_delta_chain(reuse.meta[i], params.depth);
+	for (i = 0, j = 0; i < reuse.nmeta; i++) {
+		if (reuse.meta[i]->reused_delta_offset != 0)
+			reuse.meta[j++] = reuse.meta[i];
+	}
+	reuse.nmeta = j;
+
 	if (reuse_packidx && reuse_pack) {
 		err = got_repo_pin_pack(repo, reuse_packidx, reuse_pack);
 		if (err)
 			goto done;
+
+		err = find_verbatim_objects(&nverbatim, &verbatim_end, idset,
+		    reuse_packidx, reuse_pack, force_refdelta,
+		    cancel_cb, cancel_arg);
+		if (err)
+			goto done;
+
+		/* Reused deltas within the verbatim part are copied along. */
+		for (i = 0, j = 0; i < reuse.nmeta; i++) {
+			if (!reuse.meta[i]->verbatim)
+				reuse.meta[j++] = reuse.meta[i];
+		}
+		reuse.nmeta = j;
 	}
 
 	if (fseeko(delta_cache, 0L, SEEK_END) == -1) {
@@ -1978,7 +3257,8 @@ got_pack_create(struct got_object_id *packhash, int packfd, FILE *delta_cache,
 		goto done;
 	}
 
-	ndeltify = got_object_idset_num_elements(idset) - reuse.nmeta;
+	ndeltify = got_object_idset_num_elements(idset) - reuse.nmeta -
+	    nverbatim;
 	if (ndeltify > 0) {
 		deltify.meta = calloc(ndeltify, sizeof(struct got_pack_meta *));
 		if (deltify.meta == NULL) {
@@ -1991,21 +3271,22 @@ got_pack_create(struct got_object_id *packhash, int packfd, FILE *delta_cache,
 		    &deltify);
 		if (err)
 			goto done;
-		if (deltify.nmeta > 0) {
-			err = pick_deltas(deltify.meta, deltify.nmeta,
-			    ncolored, nfound, ntrees, nours, reuse.nmeta,
-			    delta_cache, repo, progress_cb, progress_arg, rl,
+		if (deltify.nmeta > 0 && thin && ntheirs > 0) {
+			thin_bases.metasz = 64;
+			thin_bases.meta = calloc(thin_bases.metasz,
+			    sizeof(struct got_pack_meta *));
+			if (thin_bases.meta == NULL) {
+				err = got_error_from_errno("calloc");
+				goto done;
+			}
+			err = load_thin_bases(&thin_bases, deltify.meta,
+			    deltify.nmeta, idset, theirs, ntheirs, repo,
 			    cancel_cb, cancel_arg);
 			if (err)
 				goto done;
 		}
 	}
 
-	if (fflush(delta_cache) == EOF) {
-		err = got_error_from_errno("fflush");
-		goto done;
-	}
-
 	if (progress_cb) {
 		/*
 		 * Report a 1-byte packfile write to indicate we are about
@@ -2014,7 +3295,7 @@ got_pack_create(struct got_object_id *packhash, int packfd, FILE *delta_cache,
 		err = progress_cb(progress_arg, ncolored, nfound, ntrees,
 		    1 /* packfile_size */, nours,
 		    got_object_idset_num_elements(idset),
-		    deltify.nmeta + reuse.nmeta, 0, 0);
+		    reuse.nmeta + nverbatim, 0, 0);
 		if (err)
 			goto done;
 	}
@@ -2022,15 +3303,68 @@ got_pack_create(struct got_object_id *packhash, int packfd, FILE *delta_cache,
 	/* Pinned pack may have moved to different cache slot. */
 	reuse_pack = got_repo_get_pinned_pack(repo);
 
-	err = genpack(packhash, packfd, reuse_pack, delta_cache, deltify.meta,
-	    deltify.nmeta, reuse.meta, reuse.nmeta, ncolored, nfound, ntrees,
-	    nours, repo, force_refdelta, progress_cb, progress_arg, rl,
-	    cancel_cb, cancel_arg);
+	err = genpack_start(&w, packfd, reuse_pack, deltify.meta,
+	    deltify.nmeta, reuse.meta, reuse.nmeta, nverbatim, verbatim_end,
+	    ncolored, nfound, ntrees, nours, repo, force_refdelta,
+	    progress_cb, progress_arg, rl, cancel_cb, cancel_arg);
+	if (err)
+		goto done;
+
+	if (deltify.nmeta > 0) {
+		/*
+		 * Thin bases take part in the delta search but
+		 * are not written to the pack file.
+		 */
+		delta_meta = calloc(deltify.nmeta + thin_bases.nmeta,
+		    sizeof(struct got_pack_meta *));
+		if (delta_meta == NULL) {
+			err = got_error_from_errno("calloc");
+			goto done;
+		}
+		memcpy(delta_meta, deltify.meta,
+		    deltify.nmeta * sizeof(struct got_pack_meta *));
+		if (thin_bases.nmeta > 0) {
+			memcpy(delta_meta + deltify.nmeta,
+			    thin_bases.meta, thin_bases.nmeta *
+			    sizeof(struct got_pack_meta *));
+		}
+		err = pick_deltas(delta_meta,
+		    deltify.nmeta + thin_bases.nmeta,
+		    ncolored, nfound, ntrees, nours,
+		    reuse.nmeta + nverbatim, delta_cache, repo,
+		    &params, nthreads, progress_cb, progress_arg, rl,
+		    cancel_cb, cancel_arg);
+		if (err)
+			goto done;
+	}
+
+	if (fflush(delta_cache) == EOF) {
+		err = got_error_from_errno("fflush");
+		goto done;
+	}
+
+	/* Pinned pack may have moved to different cache slot. */
+	reuse_pack = got_repo_get_pinned_pack(repo);
+
+	err = genpack_finish(packhash, &w, packfd, reuse_pack, delta_cache,
+	    deltify.meta, deltify.nmeta, reuse.meta, reuse.nmeta,
+	    ncolored, nfound, ntrees, nours, repo, force_refdelta,
+	    progress_cb, progress_arg, rl);
 	if (err)
 		goto done;
 done:
+	if (w.outfd != -1 && close(w.outfd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (w.packfile && fclose(w.packfile) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	free(delta_meta);
 	free_nmeta(deltify.meta, deltify.nmeta);
 	free_nmeta(reuse.meta, reuse.nmeta);
+	for (i = 0; i < thin_bases.nmeta; i++) {
+		clear_meta(thin_bases.meta[i]);
+		free(thin_bases.meta[i]);
+	}
+	free(thin_bases.meta);
 	got_object_idset_for_each(idset, free_meta, NULL);
 	got_object_idset_free(idset);
 	got_repo_unpin_pack(repo);
@@ -210,7 +210,7 @@ const struct got_error *
 got_pack_load_packed_object_ids(int *found_all_objects,
     struct got_object_id **ours, int nours,
     struct got_object_id **theirs, int ntheirs,
-    int want_meta, uint32_t seed, struct got_object_idset *idset,
+    int want_meta, struct got_object_idset *idset,
     struct got_object_idset *idset_exclude, int loose_obj_only,
     struct got_repository *repo, struct got_packidx *packidx,
     int *ncolored, int *nfound, int *ntrees,
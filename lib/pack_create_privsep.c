@@ -633,7 +633,6 @@ struct load_packed_obj_arg {
 	time_t mtime;
 
 	/* input parameters: */
-	uint32_t seed;
 	int want_meta;
 	struct got_object_idset *idset;
 	struct got_object_idset *idset_exclude;
@@ -660,7 +659,7 @@ load_packed_commit_id(void *arg, time_t mtime, struct got_object_id *id,
 
 	return got_pack_add_object(a->want_meta,
 	    a->want_meta ? a->idset : a->idset_exclude,
-	    id, "", GOT_OBJ_TYPE_COMMIT, mtime, a->seed, a->loose_obj_only,
+	    id, "", GOT_OBJ_TYPE_COMMIT, mtime, a->loose_obj_only,
 	    repo, a->ncolored, a->nfound, a->ntrees,
 	    a->progress_cb, a->progress_arg, a->rl);
 }
@@ -712,14 +711,14 @@ load_packed_tree_ids(void *arg, struct got_tree_object *tree, time_t mtime,
 
 	err = got_pack_add_object(a->want_meta,
 	    a->want_meta ? a->idset : a->idset_exclude,
-	    id, relpath, GOT_OBJ_TYPE_TREE, mtime, a->seed,
+	    id, relpath, GOT_OBJ_TYPE_TREE, mtime,
 	    a->loose_obj_only, repo, a->ncolored, a->nfound, a->ntrees,
 	    a->progress_cb, a->progress_arg, a->rl);
 	if (err)
 		return err;
 
 	return got_pack_load_tree_entries(NULL, a->want_meta, a->idset,
-	    a->idset_exclude, tree, dpath, mtime, a->seed, repo,
+	    a->idset_exclude, tree, dpath, mtime, repo,
 	    a->loose_obj_only, a->ncolored, a->nfound, a->ntrees,
 	    a->progress_cb, a->progress_arg, a->rl,
 	    a->cancel_cb, a->cancel_arg);
@@ -729,7 +728,7 @@ const struct got_error *
 got_pack_load_packed_object_ids(int *found_all_objects,
     struct got_object_id **ours, int nours,
     struct got_object_id **theirs, int ntheirs,
-    int want_meta, uint32_t seed, struct got_object_idset *idset,
+    int want_meta, struct got_object_idset *idset,
     struct got_object_idset *idset_exclude, int loose_obj_only,
     struct got_repository *repo, struct got_packidx *packidx,
     int *ncolored, int *nfound, int *ntrees,
@@ -740,7 +739,6 @@ got_pack_load_packed_object_ids(int *found_all_objects,
 	struct load_packed_obj_arg lpa;
 
 	memset(&lpa, 0, sizeof(lpa));
-	lpa.seed = seed;
 	lpa.want_meta = want_meta;
 	lpa.idset = idset;
 	lpa.idset_exclude = idset_exclude;
@@ -770,7 +768,7 @@ got_pack_load_packed_object_ids(int *found_all_objects,
 	 * Continue loading trees the slow way.
 	 */
 	err = got_pack_load_tree(want_meta, idset, idset_exclude,
-	    lpa.id, lpa.dpath, lpa.mtime, seed, repo, loose_obj_only,
+	    lpa.id, lpa.dpath, lpa.mtime, repo, loose_obj_only,
 	    ncolored, nfound, ntrees, progress_cb, progress_arg, rl,
 	    cancel_cb, cancel_arg);
 	free(lpa.id);
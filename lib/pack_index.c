@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <imsg.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +46,7 @@
 
 #include "got_lib_hash.h"
 #include "got_lib_delta.h"
+#include "got_lib_deflate.h"
 #include "got_lib_inflate.h"
 #include "got_lib_object.h"
 #include "got_lib_object_parse.h"
@@ -204,8 +206,8 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 		} else {
 			if (pack->map) {
 				err = got_inflate_to_mem_mmap(&data, &datalen,
-				    &obj->len, &csum, pack->map, mapoff,
-				    pack->filesize - mapoff);
+				    &obj->len, &csum, obj->size, pack->map,
+				    mapoff, pack->filesize - mapoff);
 			} else {
 				err = got_inflate_to_mem_fd(&data, &datalen,
 				    &obj->len, &csum, obj->size, pack->fd);
@@ -256,7 +258,7 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 			    digest_len);
 			mapoff += digest_len;
 			err = got_inflate_to_mem_mmap(NULL, &datalen,
-			    &obj->len, &csum, pack->map, mapoff,
+			    &obj->len, &csum, 0, pack->map, mapoff,
 			    pack->filesize - mapoff);
 			if (err)
 				break;
@@ -313,7 +315,7 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 			    obj->delta.ofs.base_offsetlen);
 			mapoff += obj->delta.ofs.base_offsetlen;
 			err = got_inflate_to_mem_mmap(NULL, &datalen,
-			    &obj->len, &csum, pack->map, mapoff,
+			    &obj->len, &csum, 0, pack->map, mapoff,
 			    pack->filesize - mapoff);
 			if (err)
 				break;
@@ -393,6 +395,11 @@ resolve_deltified_object(struct got_pack *pack, struct got_packidx *packidx,
 	if (err)
 		goto done;
 	if (max_size > GOT_DELTA_RESULT_SIZE_CACHED_MAX) {
+		/* Without temporary files only small objects can be resolved. */
+		if (tmpfile == NULL) {
+			err = got_error(GOT_ERR_OBJ_TOO_LARGE);
+			goto done;
+		}
 		rewind(tmpfile);
 		rewind(delta_base_file);
 		rewind(delta_accum_file);
@@ -587,6 +594,245 @@ update_packidx(struct got_packidx *packidx, uint32_t nobj,
 	add_indexed_object(packidx, idx, obj);
 }
 
+static const struct got_error *
+remap_pack(struct got_pack *pack, off_t oldsize)
+{
+#ifndef GOT_PACK_NO_MMAP
+	if (pack->map == NULL)
+		return NULL;
+
+	if (munmap(pack->map, oldsize) == -1)
+		return got_error_from_errno("munmap");
+	pack->map = NULL;
+
+	if (pack->filesize > 0 && pack->filesize <= SIZE_MAX) {
+		pack->map = mmap(NULL, pack->filesize, PROT_READ, MAP_PRIVATE,
+		    pack->fd, 0);
+		if (pack->map == MAP_FAILED)
+			pack->map = NULL; /* fall back to read(2) */
+	}
+#endif
+	return NULL;
+}
+
+/*
+ * Write an object provided by base_cb to the pack file at the given offset
+ * and fill in its indexed object.
+ */
+static const struct got_error *
+write_delta_base(struct got_indexed_object *obj, struct got_pack *pack,
+    off_t off, struct got_object_id *id, FILE *tmpfile,
+    got_pack_index_base_cb base_cb, void *base_arg)
+{
+	const struct got_error *err;
+	struct got_deflate_checksum csum;
+	uint8_t buf[16];
+	uint64_t size;
+	off_t datalen, outlen;
+	ssize_t w;
+	int obj_type, n = 0;
+
+	if (fseeko(tmpfile, 0L, SEEK_SET) == -1)
+		return got_error_from_errno("fseeko");
+
+	err = base_cb(base_arg, &obj_type, &datalen, tmpfile, id);
+	if (err)
+		return err;
+
+	if (obj_type != GOT_OBJ_TYPE_BLOB && obj_type != GOT_OBJ_TYPE_TREE &&
+	    obj_type != GOT_OBJ_TYPE_COMMIT && obj_type != GOT_OBJ_TYPE_TAG)
+		return got_error(GOT_ERR_OBJ_TYPE);
+
+	if (fflush(tmpfile) == EOF)
+		return got_error_from_errno("fflush");
+	if (fseeko(tmpfile, 0L, SEEK_SET) == -1)
+		return got_error_from_errno("fseeko");
+
+	size = datalen;
+	buf[0] = (obj_type << 4) | (size & 0x0f);
+	size >>= 4;
+	while (size > 0) {
+		buf[n++] |= 0x80;
+		buf[n] = size & 0x7f;
+		size >>= 7;
+	}
+	n++;
+
+	if (lseek(pack->fd, off, SEEK_SET) == -1)
+		return got_error_from_errno("lseek");
+	w = write(pack->fd, buf, n);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if (w != n)
+		return got_error(GOT_ERR_IO);
+
+	memset(obj, 0, sizeof(*obj));
+	obj->crc = crc32(0L, buf, n);
+
+	memset(&csum, 0, sizeof(csum));
+	csum.output_crc = &obj->crc;
+	err = got_deflate_to_fd(&outlen, tmpfile, datalen, pack->fd, &csum);
+	if (err)
+		return err;
+
+	memcpy(&obj->id, id, sizeof(obj->id));
+	obj->valid = 1;
+	obj->off = off;
+	obj->type = obj_type;
+	obj->size = datalen;
+	obj->tslen = n;
+	obj->len = outlen;
+	return NULL;
+}
+
+/*
+ * Complete a thin pack file by appending delta bases of ref deltas which
+ * cannot be found in the pack file. Appended objects replace the pack file
+ * trailer and are added to the in-progress pack index. The object count in
+ * the pack file header and the trailer are updated once indexing is done.
+ */
+static const struct got_error *
+append_delta_bases(uint32_t *nappended, off_t *packend,
+    struct got_pack *pack, struct got_packidx *packidx,
+    struct got_indexed_object **objects, uint32_t *nobj, FILE *tmpfile,
+    got_pack_index_base_cb base_cb, void *base_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_indexed_object *obj, *p;
+	struct got_object_id base_id;
+	uint32_t i, nobj_orig = *nobj;
+	size_t digest_len = got_hash_digest_length(pack->algo);
+	uint8_t zero[GOT_HASH_DIGEST_MAXLEN];
+	off_t oldsize = pack->filesize;
+	ssize_t w;
+	void *q;
+
+	*nappended = 0;
+
+	for (i = 0; i < nobj_orig; i++) {
+		obj = &(*objects)[i];
+		if (obj->valid || obj->type != GOT_OBJ_TYPE_REF_DELTA)
+			continue;
+		if (find_object_idx(packidx, obj->delta.ref.ref_id.hash) == -1)
+			continue; /* base is in the pack file */
+		memcpy(&base_id, &obj->delta.ref.ref_id, sizeof(base_id));
+		base_id.algo = pack->algo;
+
+		p = reallocarray(*objects, *nobj + 1, sizeof(**objects));
+		if (p == NULL)
+			return got_error_from_errno("reallocarray");
+		*objects = p;
+		q = reallocarray(packidx->hdr.sorted_ids, *nobj + 1,
+		    digest_len);
+		if (q == NULL)
+			return got_error_from_errno("reallocarray");
+		packidx->hdr.sorted_ids = q;
+		q = reallocarray(packidx->hdr.crc32, *nobj + 1,
+		    sizeof(uint32_t));
+		if (q == NULL)
+			return got_error_from_errno("reallocarray");
+		packidx->hdr.crc32 = q;
+		q = reallocarray(packidx->hdr.offsets, *nobj + 1,
+		    sizeof(uint32_t));
+		if (q == NULL)
+			return got_error_from_errno("reallocarray");
+		packidx->hdr.offsets = q;
+		if (packidx->hdr.large_offsets != NULL ||
+		    *packend >= GOT_PACKIDX_OFFSET_VAL_IS_LARGE_IDX) {
+			q = reallocarray(packidx->hdr.large_offsets,
+			    *nobj + 1, sizeof(uint64_t));
+			if (q == NULL)
+				return got_error_from_errno("reallocarray");
+			packidx->hdr.large_offsets = q;
+		}
+
+		obj = &(*objects)[*nobj];
+		err = write_delta_base(obj, pack, *packend, &base_id,
+		    tmpfile, base_cb, base_arg);
+		if (err) {
+			if (err->code != GOT_ERR_NO_OBJ)
+				return err;
+			/* Report the unresolved delta later on. */
+			err = NULL;
+			continue;
+		}
+
+		*packend += obj->tslen + obj->len;
+		(*nobj)++;
+		(*nappended)++;
+		update_packidx(packidx, *nobj, obj);
+	}
+
+	if (*nappended == 0)
+		return NULL;
+
+	/* Keep space for the trailer which will be written later. */
+	memset(zero, 0, sizeof(zero));
+	if (lseek(pack->fd, *packend, SEEK_SET) == -1)
+		return got_error_from_errno("lseek");
+	w = write(pack->fd, zero, digest_len);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if (w != digest_len)
+		return got_error(GOT_ERR_IO);
+	pack->filesize = *packend + digest_len;
+
+	return remap_pack(pack, oldsize);
+}
+
+/*
+ * Update the object count in the header of a completed thin pack file
+ * and write the new pack file trailer.
+ */
+static const struct got_error *
+finish_thin_pack(struct got_object_id *pack_hash, struct got_pack *pack,
+    off_t packend, uint32_t nobj)
+{
+	struct got_hash ctx;
+	uint8_t buf[8192];
+	size_t digest_len = got_hash_digest_length(pack->algo);
+	off_t oldsize = pack->filesize, off = 0;
+	ssize_t r, w;
+
+	putbe32(buf, nobj);
+	if (lseek(pack->fd, 8, SEEK_SET) == -1)
+		return got_error_from_errno("lseek");
+	w = write(pack->fd, buf, 4);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if (w != 4)
+		return got_error(GOT_ERR_IO);
+
+	if (lseek(pack->fd, 0, SEEK_SET) == -1)
+		return got_error_from_errno("lseek");
+	got_hash_init(&ctx, pack->algo);
+	while (off < packend) {
+		size_t len = sizeof(buf);
+
+		if (packend - off < len)
+			len = packend - off;
+		r = read(pack->fd, buf, len);
+		if (r == -1)
+			return got_error_from_errno("read");
+		if (r == 0)
+			return got_error(GOT_ERR_EOF);
+		got_hash_update(&ctx, buf, r);
+		off += r;
+	}
+	got_hash_final_object_id(&ctx, pack_hash);
+
+	w = write(pack->fd, pack_hash->hash, digest_len);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if (w != digest_len)
+		return got_error(GOT_ERR_IO);
+	if (ftruncate(pack->fd, packend + digest_len) == -1)
+		return got_error_from_errno("ftruncate");
+	pack->filesize = packend + digest_len;
+
+	return remap_pack(pack, oldsize);
+}
+
 static const struct got_error *
 report_progress(uint32_t nobj_total, uint32_t nobj_indexed, uint32_t nobj_loose,
     uint32_t nobj_resolved, struct got_ratelimit *rl,
@@ -605,25 +851,202 @@ report_progress(uint32_t nobj_total, uint32_t nobj_indexed, uint32_t nobj_loose,
 	    nobj_resolved);
 }
 
+struct resolve_deltas_arg {
+	pthread_mutex_t mutex;
+	struct got_packidx *packidx;
+	struct got_indexed_object *objects;
+	uint32_t next_idx;	/* next object to be claimed by a thread */
+	uint32_t nobj;
+	uint32_t nresolved;
+	const struct got_error *err;
+};
+
+struct resolve_deltas_thread {
+	pthread_t thread;
+	int started;
+	struct got_pack pack;	/* private copy with its own delta cache */
+	struct resolve_deltas_arg *a;
+};
+
+/*
+ * Claim a range of objects and resolve the deltified objects among them.
+ * Return 0 once all objects have been claimed or an error has occurred.
+ */
+static int
+resolve_deltas_chunk(struct resolve_deltas_thread *t)
+{
+	const struct got_error *err = NULL;
+	struct resolve_deltas_arg *a = t->a;
+	struct got_indexed_object *obj;
+	uint32_t i, start, end, n = 0;
+
+	pthread_mutex_lock(&a->mutex);
+	if (a->err || a->next_idx >= a->nobj) {
+		pthread_mutex_unlock(&a->mutex);
+		return 0;
+	}
+	start = a->next_idx;
+	end = start + GOT_PACK_INDEX_THREAD_CHUNK;
+	if (end > a->nobj || end < start)
+		end = a->nobj;
+	a->next_idx = end;
+	pthread_mutex_unlock(&a->mutex);
+
+	for (i = start; i < end; i++) {
+		obj = &a->objects[i];
+		if (obj->valid || obj->type != GOT_OBJ_TYPE_OFFSET_DELTA)
+			continue;
+
+		err = resolve_deltified_object(&t->pack, a->packidx, obj,
+		    NULL, NULL, NULL);
+		if (err) {
+			/* Leave large objects to the sequential pass. */
+			if (err->code != GOT_ERR_OBJ_TOO_LARGE)
+				break;
+			err = NULL;
+			continue;
+		}
+		obj->valid = 1;
+		n++;
+	}
+
+	pthread_mutex_lock(&a->mutex);
+	a->nresolved += n;
+	if (err && a->err == NULL)
+		a->err = err;
+	pthread_mutex_unlock(&a->mutex);
+
+	return err == NULL;
+}
+
+static void *
+resolve_deltas_thread_main(void *arg)
+{
+	struct resolve_deltas_thread *t = arg;
+
+	while (resolve_deltas_chunk(t))
+		;
+
+	return NULL;
+}
+
+/*
+ * Resolve offset deltas in parallel. Objects are resolved independently
+ * of each other by walking their delta chains within the memory-mapped
+ * pack file, so each thread only needs its own delta cache.
+ * Objects which are too large to be resolved in memory are left for the
+ * sequential pass.
+ */
+static const struct got_error *
+resolve_deltas_threaded(uint32_t *nresolved, struct got_pack *pack,
+    struct got_packidx *packidx, struct got_indexed_object *objects,
+    uint32_t first_delta_idx, uint32_t nobj, uint32_t nloose, int nthreads,
+    struct got_ratelimit *rl, got_pack_index_progress_cb progress_cb,
+    void *progress_arg)
+{
+	const struct got_error *err = NULL;
+	struct resolve_deltas_arg a;
+	struct resolve_deltas_thread *threads;
+	int i, error;
+
+	*nresolved = 0;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (threads == NULL)
+		return got_error_from_errno("calloc");
+
+	memset(&a, 0, sizeof(a));
+	error = pthread_mutex_init(&a.mutex, NULL);
+	if (error) {
+		free(threads);
+		return got_error_set_errno(error, "pthread_mutex_init");
+	}
+	a.packidx = packidx;
+	a.objects = objects;
+	a.next_idx = first_delta_idx;
+	a.nobj = nobj;
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i].a = &a;
+		memcpy(&threads[i].pack, pack, sizeof(threads[i].pack));
+		/* Threads share the memory budget of a single cache. */
+		err = got_delta_cache_alloc(&threads[i].pack.delta_cache,
+		    GOT_DELTA_CACHE_DEFAULT_SIZE / nthreads);
+		if (err)
+			goto done;
+	}
+
+	/* The main thread does its share of the work and reports progress. */
+	for (i = 1; i < nthreads; i++) {
+		error = pthread_create(&threads[i].thread, NULL,
+		    resolve_deltas_thread_main, &threads[i]);
+		if (error) {
+			err = got_error_set_errno(error, "pthread_create");
+			goto done;
+		}
+		threads[i].started = 1;
+	}
+
+	while (resolve_deltas_chunk(&threads[0])) {
+		uint32_t n;
+
+		pthread_mutex_lock(&a.mutex);
+		n = a.nresolved;
+		pthread_mutex_unlock(&a.mutex);
+
+		err = report_progress(nobj, nobj, nloose, n, rl,
+		    progress_cb, progress_arg);
+		if (err)
+			break;
+	}
+done:
+	if (err) {
+		/* Make other threads stop early. */
+		pthread_mutex_lock(&a.mutex);
+		if (a.err == NULL)
+			a.err = err;
+		pthread_mutex_unlock(&a.mutex);
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (threads[i].started) {
+			error = pthread_join(threads[i].thread, NULL);
+			if (error && err == NULL)
+				err = got_error_set_errno(error,
+				    "pthread_join");
+		}
+		if (threads[i].pack.delta_cache)
+			got_delta_cache_free(threads[i].pack.delta_cache);
+	}
+	if (err == NULL)
+		err = a.err;
+	*nresolved = a.nresolved;
+	pthread_mutex_destroy(&a.mutex);
+	free(threads);
+	return err;
+}
+
 const struct got_error *
 got_pack_index(struct got_pack *pack, int idxfd, FILE *tmpfile,
     FILE *delta_base_file, FILE *delta_accum_file,
     struct got_object_id *pack_hash_expected,
+    got_pack_index_base_cb base_cb, void *base_arg,
     got_pack_index_progress_cb progress_cb, void *progress_arg,
-    struct got_ratelimit *rl)
+    struct got_ratelimit *rl, int nthreads)
 {
 	const struct got_error *err;
 	struct got_packfile_hdr hdr;
 	struct got_packidx packidx;
 	char buf[8];
 	struct got_object_id pack_hash;
-	uint32_t nobj, nvalid, nloose, nresolved = 0, i;
+	uint32_t nobj, nvalid, nloose, nresolved = 0, nappended = 0, i;
 	struct got_indexed_object *objects = NULL, *obj;
 	struct got_hash ctx;
 	uint8_t packidx_hash[GOT_HASH_DIGEST_MAXLEN];
 	ssize_t r, w;
 	int pass, have_ref_deltas = 0, first_delta_idx = -1;
 	size_t mapoff = 0;
+	off_t packend;
+	struct stat sb;
 	int p_indexed = 0, last_p_indexed = -1;
 	int p_resolved = 0, last_p_resolved = -1;
 	ssize_t digest_len;
@@ -828,10 +1251,39 @@ got_pack_index(struct got_pack *pack, int idxfd, FILE *tmpfile,
 	if (first_delta_idx == -1)
 		first_delta_idx = 0;
 
+	/*
+	 * Objects which complete a thin pack replace the trailer.
+	 * Callers do not agree on whether pack->filesize includes
+	 * the trailer, so look at the file itself.
+	 */
+	if (fstat(pack->fd, &sb) == -1) {
+		err = got_error_from_errno("fstat");
+		goto done;
+	}
+	packend = sb.st_size - digest_len;
+
 	/* In order to resolve ref deltas we need an in-progress pack index. */
 	if (have_ref_deltas)
 		make_packidx(&packidx, nobj, objects);
 
+	/*
+	 * Offset deltas can be resolved in parallel if the pack file is
+	 * memory-mapped. Ref deltas require updates to the in-progress pack
+	 * index and are always resolved sequentially.
+	 */
+	if (nthreads > 1 && pack->map != NULL && !have_ref_deltas &&
+	    nvalid != nobj) {
+		uint32_t n;
+
+		err = resolve_deltas_threaded(&n, pack, &packidx, objects,
+		    first_delta_idx, nobj, nloose, nthreads, rl,
+		    progress_cb, progress_arg);
+		if (err)
+			goto done;
+		nresolved += n;
+		nvalid += n;
+	}
+
 	/*
 	 * Second pass: We can now resolve deltas to compute the IDs of
 	 * objects which appear in deltified form. Because deltas can be
@@ -891,6 +1343,21 @@ got_pack_index(struct got_pack *pack, int idxfd, FILE *tmpfile,
 			}
 
 		}
+		if (n == 0 && base_cb != NULL && have_ref_deltas) {
+			uint32_t nbases;
+
+			err = append_delta_bases(&nbases, &packend, pack,
+			    &packidx, &objects, &nobj, tmpfile,
+			    base_cb, base_arg);
+			if (err)
+				goto done;
+			if (nbases > 0) {
+				nappended += nbases;
+				nloose += nbases;
+				nvalid += nbases;
+				continue;
+			}
+		}
 		if (pass++ > 3 && n == 0) {
 			err = got_error_msg(GOT_ERR_BAD_PACKFILE,
 			    "could not resolve any of deltas; packfile could "
@@ -914,6 +1381,14 @@ got_pack_index(struct got_pack *pack, int idxfd, FILE *tmpfile,
 	if (err)
 		goto done;
 
+	if (nappended > 0) {
+		err = finish_thin_pack(&pack_hash, pack, packend, nobj);
+		if (err)
+			goto done;
+		memcpy(pack_hash_expected, &pack_hash,
+		    sizeof(*pack_hash_expected));
+	}
+
 	make_packidx(&packidx, nobj, objects);
 
 	free(objects);
@@ -967,6 +1442,7 @@ done:
 	free(packidx.hdr.version);
 	free(packidx.hdr.fanout_table);
 	free(packidx.hdr.sorted_ids);
+	free(packidx.hdr.crc32);
 	free(packidx.hdr.offsets);
 	free(packidx.hdr.large_offsets);
 	return err;
@@ -85,16 +85,32 @@ got_pkt_readlen(int *len, const char *str, int chattygot)
 	return NULL;
 }
 
+const struct got_error *
+got_pkt_delimpkt(int fd, int chattygot)
+{
+	ssize_t w;
+
+	if (chattygot > 1)
+		fprintf(stderr, "%s: writepkt: 0001\n", getprogname());
+
+	w = write(fd, "0001", 4);
+	if (w == -1)
+		return got_error_from_errno("write");
+	if (w != 4)
+		return got_error(GOT_ERR_IO);
+	return NULL;
+}
+
 /*
  * Packet header contains a 4-byte hexstring which specifies the length
  * of data which follows.
  */
-const struct got_error *
-got_pkt_readhdr(int *datalen, int fd, int chattygot, int timeout)
+static const struct got_error *
+readhdr(int *datalen, int fd, int chattygot, int timeout, int v2)
 {
 	static const struct got_error *err;
 	char lenstr[4];
-	ssize_t r;
+	ssize_t r = 0;
 	int n;
 
 	*datalen = 0;
@@ -115,6 +131,14 @@ got_pkt_readhdr(int *datalen, int fd, int chattygot, int timeout)
 	err = got_pkt_readlen(&n, lenstr, chattygot);
 	if (n == 0)
 		return err;
+	if (v2 && (n == 1 || n == 2)) {
+		/* protocol version 2 delimiter or response-end packet */
+		if (chattygot > 1)
+			fprintf(stderr, "%s: readpkt: %.4s\n", getprogname(),
+			    lenstr);
+		*datalen = (n == 1 ? GOT_PKT_DELIM : GOT_PKT_RESPONSE_END);
+		return NULL;
+	}
 	if (n <= 4)
 		return got_error_msg(GOT_ERR_BAD_PACKET, "packet too short");
 	n -= 4;
@@ -124,16 +148,28 @@ got_pkt_readhdr(int *datalen, int fd, int chattygot, int timeout)
 }
 
 const struct got_error *
-got_pkt_readpkt(int *outlen, int fd, char *buf, int buflen, int chattygot,
-    int timeout)
+got_pkt_readhdr(int *datalen, int fd, int chattygot, int timeout)
+{
+	return readhdr(datalen, fd, chattygot, timeout, 0);
+}
+
+static const struct got_error *
+readpkt(int *outlen, int fd, char *buf, int buflen, int chattygot,
+    int timeout, int v2)
 {
 	const struct got_error *err = NULL;
 	int datalen, i;
 	ssize_t n;
 
-	err = got_pkt_readhdr(&datalen, fd, chattygot, timeout);
+	*outlen = 0;
+
+	err = readhdr(&datalen, fd, chattygot, timeout, v2);
 	if (err)
 		return err;
+	if (datalen < 0) {
+		*outlen = datalen;
+		return NULL;
+	}
 
 	if (datalen > buflen)
 		return got_error(GOT_ERR_NO_SPACE);
@@ -159,6 +195,25 @@ got_pkt_readpkt(int *outlen, int fd, char *buf, int buflen, int chattygot,
 	return NULL;
 }
 
+const struct got_error *
+got_pkt_readpkt(int *outlen, int fd, char *buf, int buflen, int chattygot,
+    int timeout)
+{
+	return readpkt(outlen, fd, buf, buflen, chattygot, timeout, 0);
+}
+
+/*
+ * Like got_pkt_readpkt() but also accept the special packets used by
+ * protocol version 2. A delimiter packet is returned with length
+ * GOT_PKT_DELIM and a response-end packet with GOT_PKT_RESPONSE_END.
+ */
+const struct got_error *
+got_pkt_readpkt_v2(int *outlen, int fd, char *buf, int buflen, int chattygot,
+    int timeout)
+{
+	return readpkt(outlen, fd, buf, buflen, chattygot, timeout, 1);
+}
+
 const struct got_error *
 got_pkt_writepkt(int fd, char *buf, int nbuf, int chattygot)
 {
@@ -303,9 +303,26 @@ got_privsep_send_raw_obj(struct imsgbuf *ibuf, off_t size, size_t hdrlen,
 	return flush_imsg(ibuf);
 }
 
+const struct got_error *
+got_privsep_send_raw_obj_shm(struct imsgbuf *ibuf, off_t size, size_t hdrlen)
+{
+	struct got_imsg_raw_obj iobj;
+
+	memset(&iobj, 0, sizeof(iobj));
+	iobj.hdrlen = hdrlen;
+	iobj.size = size;
+	iobj.flags = GOT_IMSG_RAW_OBJ_F_SHM;
+
+	if (imsg_compose(ibuf, GOT_IMSG_RAW_OBJECT, 0, 0, -1,
+	    &iobj, sizeof(iobj)) == -1)
+		return got_error_from_errno("imsg_compose RAW_OBJECT");
+
+	return flush_imsg(ibuf);
+}
+
 const struct got_error *
 got_privsep_recv_raw_obj(uint8_t **outbuf, off_t *size, size_t *hdrlen,
-    struct imsgbuf *ibuf)
+    struct imsgbuf *ibuf, const uint8_t *shm, size_t shm_size)
 {
 	const struct got_error *err = NULL;
 	struct imsg imsg;
@@ -330,6 +347,28 @@ got_privsep_recv_raw_obj(uint8_t **outbuf, off_t *size, size_t *hdrlen,
 		*size = iobj->size;
 		*hdrlen = iobj->hdrlen;
 
+		if (iobj->flags & GOT_IMSG_RAW_OBJ_F_SHM) {
+			if (datalen != sizeof(*iobj) || shm == NULL ||
+			    *size < 0 || *hdrlen > shm_size ||
+			    *size > shm_size - *hdrlen) {
+				err = got_error(GOT_ERR_PRIVSEP_LEN);
+				break;
+			}
+			if (*size + *hdrlen == 0)
+				break;
+			/*
+			 * Copy data out of shared memory before using it.
+			 * The child may overwrite shared memory at any time.
+			 */
+			*outbuf = malloc(*size + *hdrlen);
+			if (*outbuf == NULL) {
+				err = got_error_from_errno("malloc");
+				break;
+			}
+			memcpy(*outbuf, shm, *size + *hdrlen);
+			break;
+		}
+
 		if (datalen == sizeof(*iobj)) {
 			/* Data has been written to file descriptor. */
 			break;
@@ -527,6 +566,18 @@ got_privsep_send_tmpfd(struct imsgbuf *ibuf, int fd)
 	return send_fd(ibuf, GOT_IMSG_TMPFD, fd);
 }
 
+const struct got_error *
+got_privsep_send_commit_graph(struct imsgbuf *ibuf, int fd)
+{
+	return send_fd(ibuf, GOT_IMSG_COMMIT_GRAPH, fd);
+}
+
+const struct got_error *
+got_privsep_send_object_shm(struct imsgbuf *ibuf, int fd)
+{
+	return send_fd(ibuf, GOT_IMSG_OBJECT_SHM, fd);
+}
+
 const struct got_error *
 got_privsep_send_obj(struct imsgbuf *ibuf, struct got_object *obj)
 {
@@ -557,13 +608,17 @@ got_privsep_send_fetch_req(struct imsgbuf *ibuf, int fd,
     struct got_pathlist_head *wanted_branches,
     struct got_pathlist_head *wanted_refs, int list_refs_only,
     const char *worktree_branch, const char *remote_head,
-    int no_head, int verbosity)
+    int no_head, int verbosity, int depth, struct got_object_id *shallow_ids,
+    size_t nshallow, const char *filter, struct got_object_id *wanted_ids,
+    size_t nwanted_ids, int stateless)
 {
 	const struct got_error *err = NULL;
 	struct ibuf *wbuf;
 	struct got_pathlist_entry *pe;
 	struct got_imsg_fetch_request fetchreq;
 	size_t remote_head_len, worktree_branch_len, len = sizeof(fetchreq);
+	size_t filter_len;
+	size_t i;
 
 	if (worktree_branch) {
 		worktree_branch_len = strlen(worktree_branch);
@@ -573,6 +628,10 @@ got_privsep_send_fetch_req(struct imsgbuf *ibuf, int fd,
 		remote_head_len = strlen(remote_head);
 		len += remote_head_len;
 	}
+	if (filter) {
+		filter_len = strlen(filter);
+		len += filter_len;
+	}
 
 	if (len >= MAX_IMSGSIZE - IMSG_HEADER_SIZE) {
 		close(fd);
@@ -591,10 +650,16 @@ got_privsep_send_fetch_req(struct imsgbuf *ibuf, int fd,
 	fetchreq.fetch_all_branches = fetch_all_branches;
 	fetchreq.list_refs_only = list_refs_only;
 	fetchreq.verbosity = verbosity;
+	fetchreq.depth = depth;
+	fetchreq.n_shallow = nshallow;
+	fetchreq.n_wanted_objects = nwanted_ids;
+	fetchreq.stateless = stateless;
 	if (worktree_branch != NULL)
 		fetchreq.worktree_branch_len = worktree_branch_len;
 	if (remote_head != NULL)
 		fetchreq.remote_head_len = remote_head_len;
+	if (filter != NULL)
+		fetchreq.filter_len = filter_len;
 	RB_FOREACH(pe, got_pathlist_head, have_refs)
 		fetchreq.n_have_refs++;
 	RB_FOREACH(pe, got_pathlist_head, wanted_branches)
@@ -618,6 +683,13 @@ got_privsep_send_fetch_req(struct imsgbuf *ibuf, int fd,
 			return err;
 		}
 	}
+	if (filter) {
+		if (imsg_add(wbuf, filter, filter_len) == -1) {
+			err = got_error_from_errno("imsg_add FETCH_REQUEST");
+			close(fd);
+			return err;
+		}
+	}
 	ibuf_fd_set(wbuf, fd);
 	fd = -1;
 	imsg_close(ibuf, wbuf);
@@ -700,6 +772,32 @@ got_privsep_send_fetch_req(struct imsgbuf *ibuf, int fd,
 			return err;
 	}
 
+	for (i = 0; i < nshallow; i++) {
+		struct got_imsg_fetch_shallow ishallow;
+
+		memcpy(&ishallow.id, &shallow_ids[i], sizeof(ishallow.id));
+		if (imsg_compose(ibuf, GOT_IMSG_FETCH_SHALLOW, 0, 0, -1,
+		    &ishallow, sizeof(ishallow)) == -1)
+			return got_error_from_errno(
+			    "imsg_compose FETCH_SHALLOW");
+		err = flush_imsg(ibuf);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < nwanted_ids; i++) {
+		struct got_imsg_fetch_wanted_object iwanted;
+
+		memcpy(&iwanted.id, &wanted_ids[i], sizeof(iwanted.id));
+		if (imsg_compose(ibuf, GOT_IMSG_FETCH_WANTED_OBJECT, 0, 0, -1,
+		    &iwanted, sizeof(iwanted)) == -1)
+			return got_error_from_errno(
+			    "imsg_compose FETCH_WANTED_OBJECT");
+		err = flush_imsg(ibuf);
+		if (err)
+			return err;
+	}
+
 	return NULL;
 }
 
@@ -712,12 +810,17 @@ got_privsep_send_fetch_outfd(struct imsgbuf *ibuf, int fd)
 const struct got_error *
 got_privsep_recv_fetch_progress(int *done, struct got_object_id **id,
     char **refname, struct got_pathlist_head *symrefs, char **server_progress,
-    off_t *packfile_size, uint8_t *pack_sha1, struct imsgbuf *ibuf)
+    off_t *packfile_size, uint8_t *pack_sha1, struct got_object_id **shallow_id,
+    int *unshallow, struct got_object_id **common_id, int *max_haves,
+    struct imsgbuf *ibuf)
 {
 	const struct got_error *err = NULL;
 	struct imsg imsg;
 	size_t datalen;
 	struct got_imsg_fetch_symrefs *isymrefs = NULL;
+	struct got_imsg_fetch_shallow_update iupdate;
+	struct got_imsg_fetch_have_request ihavereq;
+	struct got_imsg_fetch_common icommon;
 	size_t n, remain;
 	struct got_pathlist_entry *new;
 	off_t off;
@@ -729,6 +832,10 @@ got_privsep_recv_fetch_progress(int *done, struct got_object_id **id,
 	*server_progress = NULL;
 	*packfile_size = 0;
 	memset(pack_sha1, 0, SHA1_DIGEST_LENGTH);
+	*shallow_id = NULL;
+	*unshallow = 0;
+	*common_id = NULL;
+	*max_haves = 0;
 
 	err = got_privsep_recv_imsg(&imsg, ibuf, 0);
 	if (err)
@@ -836,6 +943,43 @@ got_privsep_recv_fetch_progress(int *done, struct got_object_id **id,
 		}
 		memcpy(packfile_size, imsg.data, sizeof(*packfile_size));
 		break;
+	case GOT_IMSG_FETCH_SHALLOW_UPDATE:
+		if (datalen != sizeof(iupdate)) {
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			break;
+		}
+		memcpy(&iupdate, imsg.data, sizeof(iupdate));
+		*shallow_id = got_object_id_dup(&iupdate.id);
+		if (*shallow_id == NULL) {
+			err = got_error_from_errno("got_object_id_dup");
+			break;
+		}
+		*unshallow = iupdate.unshallow;
+		break;
+	case GOT_IMSG_FETCH_HAVE_REQUEST:
+		if (datalen != sizeof(ihavereq)) {
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			break;
+		}
+		memcpy(&ihavereq, imsg.data, sizeof(ihavereq));
+		if (ihavereq.max_haves <= 0) {
+			err = got_error(GOT_ERR_PRIVSEP_MSG);
+			break;
+		}
+		*max_haves = ihavereq.max_haves;
+		break;
+	case GOT_IMSG_FETCH_COMMON:
+		if (datalen != sizeof(icommon)) {
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			break;
+		}
+		memcpy(&icommon, imsg.data, sizeof(icommon));
+		*common_id = got_object_id_dup(&icommon.id);
+		if (*common_id == NULL) {
+			err = got_error_from_errno("got_object_id_dup");
+			break;
+		}
+		break;
 	case GOT_IMSG_FETCH_DONE:
 		if (datalen != SHA1_DIGEST_LENGTH) {
 			err = got_error(GOT_ERR_PRIVSEP_MSG);
@@ -939,16 +1083,19 @@ done:
 
 const struct got_error *
 got_privsep_recv_send_remote_refs(struct got_pathlist_head *remote_refs,
-    struct imsgbuf *ibuf)
+    int *allow_thin, struct imsgbuf *ibuf)
 {
 	const struct got_error *err = NULL;
 	struct imsg imsg;
 	size_t datalen;
 	struct got_imsg_send_remote_ref iremote_ref;
+	struct got_imsg_send_pack_request ireq;
 	struct got_object_id *id = NULL;
 	char *refname = NULL;
 	struct got_pathlist_entry *new;
 
+	*allow_thin = 0;
+
 	while (1) {
 		err = got_privsep_recv_imsg(&imsg, ibuf, 0);
 		if (err)
@@ -991,10 +1138,12 @@ got_privsep_recv_send_remote_refs(struct got_pathlist_head *remote_refs,
 			imsg_free(&imsg);
 			break;
 		case GOT_IMSG_SEND_PACK_REQUEST:
-			if (datalen != 0) {
+			if (datalen != sizeof(ireq)) {
 				err = got_error(GOT_ERR_PRIVSEP_MSG);
 				goto done;
 			}
+			memcpy(&ireq, imsg.data, sizeof(ireq));
+			*allow_thin = ireq.allow_thin;
 			/* got-send-pack is now waiting for a pack file. */
 			goto done;
 		default:
@@ -1080,13 +1229,18 @@ got_privsep_recv_send_progress(int *done, off_t *bytes_sent,
 
 const struct got_error *
 got_privsep_send_index_pack_req(struct imsgbuf *ibuf, struct got_object_id *id,
-    int fd)
+    int fix_thin, int nthreads, int fd)
 {
 	const struct got_error *err = NULL;
+	struct got_imsg_index_pack_request ireq;
+
+	memset(&ireq, 0, sizeof(ireq));
+	memcpy(&ireq.id, id, sizeof(ireq.id));
+	ireq.fix_thin = fix_thin;
+	ireq.nthreads = nthreads;
 
-	/* Keep in sync with struct got_imsg_index_pack_request */
 	if (imsg_compose(ibuf, GOT_IMSG_IDXPACK_REQUEST, 0, 0, fd,
-	    id, sizeof(*id)) == -1) {
+	    &ireq, sizeof(ireq)) == -1) {
 		err = got_error_from_errno("imsg_compose INDEX_REQUEST");
 		close(fd);
 		return err;
@@ -1103,6 +1257,7 @@ got_privsep_send_index_pack_outfd(struct imsgbuf *ibuf, int fd)
 const struct got_error *
 got_privsep_recv_index_progress(int *done, int *nobj_total,
     int *nobj_indexed, int *nobj_loose, int *nobj_resolved,
+    struct got_object_id *pack_hash, struct got_object_id **base_id,
     struct imsgbuf *ibuf)
 {
 	const struct got_error *err = NULL;
@@ -1114,6 +1269,8 @@ got_privsep_recv_index_progress(int *done, int *nobj_total,
 	*nobj_total = 0;
 	*nobj_indexed = 0;
 	*nobj_resolved = 0;
+	if (base_id)
+		*base_id = NULL;
 
 	err = got_privsep_recv_imsg(&imsg, ibuf, 0);
 	if (err)
@@ -1138,12 +1295,30 @@ got_privsep_recv_index_progress(int *done, int *nobj_total,
 		*nobj_resolved = iprogress->nobj_resolved;
 		break;
 	case GOT_IMSG_IDXPACK_DONE:
-		if (datalen != 0) {
+		if (datalen != sizeof(struct got_object_id)) {
 			err = got_error(GOT_ERR_PRIVSEP_LEN);
 			break;
 		}
+		if (pack_hash)
+			memcpy(pack_hash, imsg.data, sizeof(*pack_hash));
 		*done = 1;
 		break;
+	case GOT_IMSG_IDXPACK_BASE_REQUEST:
+		if (base_id == NULL) {
+			err = got_error(GOT_ERR_PRIVSEP_MSG);
+			break;
+		}
+		if (datalen != sizeof(**base_id)) {
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			break;
+		}
+		*base_id = malloc(sizeof(**base_id));
+		if (*base_id == NULL) {
+			err = got_error_from_errno("malloc");
+			break;
+		}
+		memcpy(*base_id, imsg.data, sizeof(**base_id));
+		break;
 	default:
 		err = got_error(GOT_ERR_PRIVSEP_MSG);
 		break;
@@ -1153,6 +1328,26 @@ got_privsep_recv_index_progress(int *done, int *nobj_total,
 	return err;
 }
 
+const struct got_error *
+got_privsep_send_index_pack_base(struct imsgbuf *ibuf, int obj_type,
+    off_t size, int fd)
+{
+	const struct got_error *err;
+	struct got_imsg_index_pack_base ibase;
+
+	memset(&ibase, 0, sizeof(ibase));
+	ibase.obj_type = obj_type;
+	ibase.size = size;
+
+	if (imsg_compose(ibuf, GOT_IMSG_IDXPACK_BASE, 0, 0, fd,
+	    &ibase, sizeof(ibase)) == -1) {
+		err = got_error_from_errno("imsg_compose IDXPACK_BASE");
+		close(fd);
+		return err;
+	}
+	return flush_imsg(ibuf);
+}
+
 const struct got_error *
 got_privsep_get_imsg_obj(struct got_object **obj, struct imsg *imsg,
     struct imsgbuf *ibuf)
@@ -1720,9 +1915,26 @@ got_privsep_send_blob(struct imsgbuf *ibuf, size_t size, size_t hdrlen,
 	return flush_imsg(ibuf);
 }
 
+const struct got_error *
+got_privsep_send_blob_shm(struct imsgbuf *ibuf, size_t size, size_t hdrlen)
+{
+	struct got_imsg_blob iblob;
+
+	memset(&iblob, 0, sizeof(iblob));
+	iblob.size = size;
+	iblob.hdrlen = hdrlen;
+	iblob.flags = GOT_IMSG_BLOB_F_SHM;
+
+	if (imsg_compose(ibuf, GOT_IMSG_BLOB, 0, 0, -1, &iblob,
+	    sizeof(iblob)) == -1)
+		return got_error_from_errno("imsg_compose BLOB");
+
+	return flush_imsg(ibuf);
+}
+
 const struct got_error *
 got_privsep_recv_blob(uint8_t **outbuf, size_t *size, size_t *hdrlen,
-    struct imsgbuf *ibuf)
+    struct imsgbuf *ibuf, const uint8_t *shm, size_t shm_size)
 {
 	const struct got_error *err = NULL;
 	struct imsg imsg;
@@ -1747,6 +1959,27 @@ got_privsep_recv_blob(uint8_t **outbuf, size_t *size, size_t *hdrlen,
 		*size = iblob->size;
 		*hdrlen = iblob->hdrlen;
 
+		if (iblob->flags & GOT_IMSG_BLOB_F_SHM) {
+			if (datalen != sizeof(*iblob) || shm == NULL ||
+			    *size > shm_size) {
+				err = got_error(GOT_ERR_PRIVSEP_LEN);
+				break;
+			}
+			if (*size == 0)
+				break;
+			/*
+			 * Copy data out of shared memory before using it.
+			 * The child may overwrite shared memory at any time.
+			 */
+			*outbuf = malloc(*size);
+			if (*outbuf == NULL) {
+				err = got_error_from_errno("malloc");
+				break;
+			}
+			memcpy(*outbuf, shm, *size);
+			break;
+		}
+
 		if (datalen == sizeof(*iblob)) {
 			/* Data has been written to file descriptor. */
 			break;
@@ -1999,6 +2232,18 @@ got_privsep_init_pack_child(struct imsgbuf *ibuf, struct got_pack *pack,
 		return err;
 	}
 
+	if (packidx->rev_map) {
+		fd = dup(packidx->rev_fd);
+		if (fd == -1)
+			return got_error_from_errno("dup");
+		if (imsg_compose(ibuf, GOT_IMSG_PACKIDX_REV, 0, 0, fd,
+		    NULL, 0) == -1) {
+			err = got_error_from_errno("imsg_compose PACKIDX_REV");
+			close(fd);
+			return err;
+		}
+	}
+
 	return flush_imsg(ibuf);
 }
 
@@ -2250,6 +2495,7 @@ free_remote_data(struct got_remote_repo *remote)
 	free(remote->name);
 	free(remote->fetch_url);
 	free(remote->send_url);
+	free(remote->fetch_filter);
 	for (i = 0; i < remote->nfetch_branches; i++)
 		free(remote->fetch_branches[i]);
 	free(remote->fetch_branches);
@@ -2324,7 +2570,8 @@ got_privsep_recv_gitconfig_remotes(struct got_remote_repo **remotes,
 			    iremote.fetch_url_len == 0 ||
 			    iremote.send_url_len == 0 ||
 			    (sizeof(iremote) + iremote.name_len +
-			    iremote.fetch_url_len + iremote.send_url_len) > datalen) {
+			    iremote.fetch_url_len + iremote.send_url_len +
+			    iremote.fetch_filter_len) > datalen) {
 				err = got_error(GOT_ERR_PRIVSEP_LEN);
 				break;
 			}
@@ -2349,6 +2596,18 @@ got_privsep_recv_gitconfig_remotes(struct got_remote_repo **remotes,
 				free_remote_data(remote);
 				break;
 			}
+			if (iremote.fetch_filter_len > 0) {
+				remote->fetch_filter = strndup(imsg.data +
+				    sizeof(iremote) + iremote.name_len +
+				    iremote.fetch_url_len +
+				    iremote.send_url_len,
+				    iremote.fetch_filter_len);
+				if (remote->fetch_filter == NULL) {
+					err = got_error_from_errno("strndup");
+					free_remote_data(remote);
+					break;
+				}
+			}
 			remote->mirror_references = iremote.mirror_references;
 			remote->fetch_all_branches = iremote.fetch_all_branches;
 			remote->nfetch_branches = 0;
@@ -2451,6 +2710,39 @@ got_privsep_send_gotconfig_remotes_req(struct imsgbuf *ibuf)
 	return flush_imsg(ibuf);
 }
 
+const struct got_error *
+got_privsep_send_gotconfig_pack_window_req(struct imsgbuf *ibuf)
+{
+	if (imsg_compose(ibuf,
+	    GOT_IMSG_GOTCONFIG_PACK_WINDOW_REQUEST, 0, 0, -1, NULL, 0) == -1)
+		return got_error_from_errno("imsg_compose "
+		    "GOTCONFIG_PACK_WINDOW_REQUEST");
+
+	return flush_imsg(ibuf);
+}
+
+const struct got_error *
+got_privsep_send_gotconfig_pack_depth_req(struct imsgbuf *ibuf)
+{
+	if (imsg_compose(ibuf,
+	    GOT_IMSG_GOTCONFIG_PACK_DEPTH_REQUEST, 0, 0, -1, NULL, 0) == -1)
+		return got_error_from_errno("imsg_compose "
+		    "GOTCONFIG_PACK_DEPTH_REQUEST");
+
+	return flush_imsg(ibuf);
+}
+
+const struct got_error *
+got_privsep_send_gotconfig_pack_memsize_req(struct imsgbuf *ibuf)
+{
+	if (imsg_compose(ibuf,
+	    GOT_IMSG_GOTCONFIG_PACK_MEMSIZE_REQUEST, 0, 0, -1, NULL, 0) == -1)
+		return got_error_from_errno("imsg_compose "
+		    "GOTCONFIG_PACK_MEMSIZE_REQUEST");
+
+	return flush_imsg(ibuf);
+}
+
 const struct got_error *
 got_privsep_recv_gotconfig_str(char **str, struct imsgbuf *ibuf)
 {
@@ -2484,6 +2776,38 @@ got_privsep_recv_gotconfig_str(char **str, struct imsgbuf *ibuf)
 	return err;
 }
 
+const struct got_error *
+got_privsep_recv_gotconfig_int(int64_t *val, struct imsgbuf *ibuf)
+{
+	const struct got_error *err = NULL;
+	struct imsg imsg;
+	size_t datalen;
+	const size_t min_datalen = sizeof(*val);
+
+	*val = 0;
+
+	err = got_privsep_recv_imsg(&imsg, ibuf, min_datalen);
+	if (err)
+		return err;
+	datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
+
+	switch (imsg.hdr.type) {
+	case GOT_IMSG_GOTCONFIG_INT_VAL:
+		if (datalen != sizeof(*val)) {
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			break;
+		}
+		memcpy(val, imsg.data, sizeof(*val));
+		break;
+	default:
+		err = got_error(GOT_ERR_PRIVSEP_MSG);
+		break;
+	}
+
+	imsg_free(&imsg);
+	return err;
+}
+
 const struct got_error *
 got_privsep_recv_gotconfig_remotes(struct got_remote_repo **remotes,
     int *nremotes, struct imsgbuf *ibuf)
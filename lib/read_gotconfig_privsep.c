@@ -50,6 +50,7 @@ got_gotconfig_read(struct got_gotconfig **conf, const char *gotconfig_path)
 	int imsg_fds[2] = { -1, -1 };
 	pid_t pid;
 	struct imsgbuf ibuf;
+	int64_t val;
 
 	memset(&ibuf, 0, sizeof(ibuf));
 
@@ -138,6 +139,33 @@ got_gotconfig_read(struct got_gotconfig **conf, const char *gotconfig_path)
 	    &(*conf)->nremotes, &ibuf);
 	if (err)
 		goto wait;
+
+	err = got_privsep_send_gotconfig_pack_window_req(&ibuf);
+	if (err)
+		goto wait;
+
+	err = got_privsep_recv_gotconfig_int(&val, &ibuf);
+	if (err)
+		goto wait;
+	(*conf)->pack_window = val;
+
+	err = got_privsep_send_gotconfig_pack_depth_req(&ibuf);
+	if (err)
+		goto wait;
+
+	err = got_privsep_recv_gotconfig_int(&val, &ibuf);
+	if (err)
+		goto wait;
+	(*conf)->pack_depth = val;
+
+	err = got_privsep_send_gotconfig_pack_memsize_req(&ibuf);
+	if (err)
+		goto wait;
+
+	err = got_privsep_recv_gotconfig_int(&val, &ibuf);
+	if (err)
+		goto wait;
+	(*conf)->pack_memsize = val;
 wait:
 	if (imsg_fds[0] != -1)
 		got_privsep_send_stop(imsg_fds[0]);
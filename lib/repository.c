@@ -54,6 +54,7 @@
 #include "got_lib_hash.h"
 #include "got_lib_inflate.h"
 #include "got_lib_object.h"
+#include "got_lib_object_idset.h"
 #include "got_lib_object_parse.h"
 #include "got_lib_object_create.h"
 #include "got_lib_pack.h"
@@ -61,6 +62,8 @@
 #include "got_lib_object_cache.h"
 #include "got_lib_repository.h"
 #include "got_lib_gotconfig.h"
+#include "got_lib_commit_graph_file.h"
+#include "got_lib_multi_pack_index.h"
 
 #ifndef nitems
 #define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
@@ -160,6 +163,38 @@ got_repo_has_extension(struct got_repository *repo, const char *ext)
 	return 0;
 }
 
+const char *
+got_repo_get_promisor_remote(struct got_repository *repo)
+{
+	return repo->promisor_remote;
+}
+
+void
+got_repo_set_fetch_missing_cb(struct got_repository *repo,
+    got_repo_fetch_missing_cb cb, void *arg)
+{
+	repo->fetch_missing_cb = cb;
+	repo->fetch_missing_arg = arg;
+}
+
+const struct got_error *
+got_repo_fetch_missing_objects(struct got_repository *repo,
+    struct got_object_id *ids, int nids)
+{
+	const struct got_error *err;
+
+	if (repo->promisor_remote == NULL || repo->fetch_missing_cb == NULL)
+		return got_error_no_obj(&ids[0]);
+
+	err = repo->fetch_missing_cb(repo->fetch_missing_arg, repo, ids, nids);
+	if (err)
+		return err;
+
+	/* Ensure that the new pack file will be found. */
+	memset(&repo->pack_path_mtime, 0, sizeof(repo->pack_path_mtime));
+	return NULL;
+}
+
 int
 got_repo_is_bare(struct got_repository *repo)
 {
@@ -545,6 +580,28 @@ got_repo_get_cached_raw_object(struct got_repository *repo,
 	return (struct got_raw_object *)got_object_cache_get(&repo->rawcache, id);
 }
 
+void
+got_repo_set_object_cache_size(struct got_repository *repo, size_t size)
+{
+	got_object_cache_set_size(&repo->objcache, size);
+	got_object_cache_set_size(&repo->treecache, size);
+	got_object_cache_set_size(&repo->commitcache, size);
+	got_object_cache_set_size(&repo->tagcache, size);
+	got_object_cache_set_size(&repo->rawcache, size);
+}
+
+void
+got_repo_get_object_cache_stats(struct got_object_cache_stats *stats,
+    struct got_repository *repo)
+{
+	memset(stats, 0, sizeof(*stats));
+	got_object_cache_get_stats(stats, &repo->objcache);
+	got_object_cache_get_stats(stats, &repo->treecache);
+	got_object_cache_get_stats(stats, &repo->commitcache);
+	got_object_cache_get_stats(stats, &repo->tagcache);
+	got_object_cache_get_stats(stats, &repo->rawcache);
+}
+
 
 static const struct got_error *
 open_repo(struct got_repository *repo, const char *path)
@@ -808,6 +865,13 @@ got_repo_open(struct got_repository **repop, const char *path,
 			goto done;
 		}
 
+		/* The value names the remote which promises missing objects. */
+		if (repo->gitconfig_repository_format_version == 1 &&
+		    strcasecmp(ext, "partialclone") == 0) {
+			repo->promisor_remote = val;
+			continue;
+		}
+
 		if (!is_boolean_val(val)) {
 			err = got_error_path(ext, GOT_ERR_GIT_REPO_EXT);
 			goto done;
@@ -838,6 +902,19 @@ done:
 	return err;
 }
 
+static void
+free_packidx_bloom_filter(struct got_packidx_bloom_filter *bf)
+{
+	if (bf->bloom) {
+		if (bf->map == NULL)
+			bloom_free(bf->bloom);
+		free(bf->bloom);
+	}
+	if (bf->map)
+		munmap(bf->map, bf->maplen);
+	free(bf);
+}
+
 const struct got_error *
 got_repo_close(struct got_repository *repo)
 {
@@ -855,9 +932,7 @@ got_repo_close(struct got_repository *repo)
 	    &repo->packidx_bloom_filters))) {
 		RB_REMOVE(got_packidx_bloom_filter_tree,
 		    &repo->packidx_bloom_filters, bf);
-		bloom_free(bf->bloom);
-		free(bf->bloom);
-		free(bf);
+		free_packidx_bloom_filter(bf);
 	}
 
 	for (i = 0; i < repo->pack_cache_size; i++)
@@ -865,6 +940,23 @@ got_repo_close(struct got_repository *repo)
 			if (repo->packs[i].path_packfile)
 				got_pack_close(&repo->packs[i]);
 
+	if (repo->commit_graph) {
+		const struct got_error *cg_err;
+		cg_err = got_commit_graph_file_close(repo->commit_graph);
+		if (cg_err && err == NULL)
+			err = cg_err;
+	}
+
+	if (repo->shallow_commits)
+		got_object_idset_free(repo->shallow_commits);
+
+	if (repo->midx) {
+		const struct got_error *midx_err;
+		midx_err = got_multi_pack_index_close(repo->midx);
+		if (midx_err && err == NULL)
+			err = midx_err;
+	}
+
 	free(repo->path);
 	free(repo->path_git_dir);
 
@@ -951,6 +1043,14 @@ got_repo_remote_repo_dup(struct got_remote_repo **newp,
 		}
 	}
 
+	if (repo->fetch_filter) {
+		new->fetch_filter = strdup(repo->fetch_filter);
+		if (new->fetch_filter == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+	}
+
 	new->mirror_references = repo->mirror_references;
 
 	new->fetch_all_branches = repo->fetch_all_branches;
@@ -1032,6 +1132,8 @@ got_repo_free_remote_repo_data(struct got_remote_repo *repo)
 	repo->fetch_url = NULL;
 	free(repo->send_url);
 	repo->send_url = NULL;
+	free(repo->fetch_filter);
+	repo->fetch_filter = NULL;
 	for (i = 0; i < repo->nfetch_branches; i++)
 		free(repo->fetch_branches[i]);
 	free(repo->fetch_branches);
@@ -1224,6 +1326,239 @@ get_packidx_bloom_filter(struct got_repository *repo,
 	    &repo->packidx_bloom_filters, &key);
 }
 
+static const struct got_error *
+get_packidx_bloom_path(char *path, size_t size, const char *path_packidx)
+{
+	size_t len;
+
+	len = strlcpy(path, path_packidx, size);
+	if (len >= size)
+		return got_error(GOT_ERR_NO_SPACE);
+	if (len < 4 || strcmp(path + len - 4, ".idx") != 0)
+		return got_error_path(path_packidx, GOT_ERR_BAD_PATH);
+	path[len - 4] = '\0';
+	if (strlcat(path, ".bloom", size) >= size)
+		return got_error(GOT_ERR_NO_SPACE);
+
+	return NULL;
+}
+
+static const struct got_error *
+read_bloom_file(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t r;
+	size_t off = 0;
+
+	while (off < len) {
+		r = pread(fd, (uint8_t *)buf + off, len - off, offset + off);
+		if (r == -1)
+			return got_error_from_errno("pread");
+		if (r == 0)
+			return got_error(GOT_ERR_EOF);
+		off += r;
+	}
+
+	return NULL;
+}
+
+/*
+ * Open the bloom filter file which was written for a pack index file.
+ * Set *bloom to NULL if no usable bloom filter file exists.
+ */
+static const struct got_error *
+open_packidx_bloom_file(struct bloom **bloom, uint8_t **map, size_t *maplen,
+    struct got_repository *repo, const char *path_packidx)
+{
+	const struct got_error *err = NULL;
+	struct got_packidx_bloom_hdr hdr;
+	struct bloom *b = NULL;
+	struct got_hash ctx;
+	struct stat sb;
+	char path[PATH_MAX];
+	const char *name;
+	uint8_t *buf = NULL;
+	uint8_t pack_hash[GOT_HASH_DIGEST_MAXLEN];
+	uint8_t trailer[GOT_HASH_DIGEST_MAXLEN * 2];
+	uint8_t csum[GOT_HASH_DIGEST_MAXLEN];
+	uint32_t nobjects, bits, hashes;
+	size_t len, bytes, digest_len = got_hash_digest_length(repo->algo);
+	int fd;
+
+	*bloom = NULL;
+	*map = NULL;
+	*maplen = 0;
+
+	err = get_packidx_bloom_path(path, sizeof(path), path_packidx);
+	if (err)
+		return err;
+
+	/* The pack file's checksum is part of the pack index file name. */
+	name = strrchr(path_packidx, '/');
+	name = name ? name + 1 : path_packidx;
+	if (strncmp(name, "pack-", 5) != 0 ||
+	    !got_parse_hash_digest(pack_hash, name + 5, repo->algo))
+		return NULL;
+
+	fd = openat(got_repo_get_fd(repo), path,
+	    O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return NULL;
+		return got_error_from_errno2("openat", path);
+	}
+
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno2("fstat", path);
+		goto done;
+	}
+	if (sb.st_size < (off_t)sizeof(hdr) ||
+	    (uintmax_t)sb.st_size > SIZE_MAX)
+		goto done; /* ignore bad file */
+	len = sb.st_size;
+
+	err = read_bloom_file(fd, &hdr, sizeof(hdr), 0);
+	if (err)
+		goto done;
+
+	nobjects = be32toh(hdr.nobjects);
+	bits = be32toh(hdr.bits);
+	hashes = be32toh(hdr.hashes);
+	bytes = bits / 8 + (bits % 8 ? 1 : 0);
+	if (be32toh(hdr.signature) != GOT_PACKIDX_BLOOM_SIGNATURE ||
+	    hdr.version != GOT_PACKIDX_BLOOM_VERSION ||
+	    hdr.digest_len != digest_len ||
+	    hdr.byte_order != GOT_PACKIDX_BLOOM_BYTE_ORDER ||
+	    nobjects == 0 || nobjects > INT_MAX ||
+	    bits == 0 || bits > INT_MAX || hashes == 0 || hashes > 64 ||
+	    len != sizeof(hdr) + bytes + 2 * digest_len)
+		goto done; /* ignore bad file */
+
+	/* Ignore a stale file which was written for a different pack file. */
+	err = read_bloom_file(fd, trailer, 2 * digest_len,
+	    sizeof(hdr) + bytes);
+	if (err)
+		goto done;
+	if (memcmp(trailer, pack_hash, digest_len) != 0)
+		goto done;
+
+	b = calloc(1, sizeof(*b));
+	if (b == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+
+#ifndef GOT_PACK_NO_MMAP
+	buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		buf = NULL;
+		if (errno != ENOMEM) {
+			err = got_error_from_errno2("mmap", path);
+			goto done;
+		}
+		/* fall back to read(2) */
+	} else {
+		*map = buf;
+		*maplen = len;
+		b->bf = buf + sizeof(hdr);
+	}
+#endif
+	if (buf == NULL) {
+		b->bf = malloc(bytes);
+		if (b->bf == NULL) {
+			err = got_error_from_errno("malloc");
+			goto done;
+		}
+		err = read_bloom_file(fd, b->bf, bytes, sizeof(hdr));
+		if (err) {
+			free(b->bf);
+			goto done;
+		}
+	}
+
+	/* Ignore a corrupt file. */
+	got_hash_init(&ctx, repo->algo);
+	got_hash_update(&ctx, &hdr, sizeof(hdr));
+	got_hash_update(&ctx, b->bf, bytes);
+	got_hash_update(&ctx, trailer, digest_len);
+	got_hash_final(&ctx, csum);
+	if (memcmp(csum, trailer + digest_len, digest_len) != 0) {
+		if (*map) {
+			munmap(*map, *maplen);
+			*map = NULL;
+			*maplen = 0;
+		} else
+			free(b->bf);
+		goto done;
+	}
+
+	b->entries = nobjects;
+	b->error = GOT_PACKIDX_BLOOM_ERROR_RATE;
+	b->bits = bits;
+	b->bytes = bytes;
+	b->hashes = hashes;
+	b->seed = be32toh(hdr.seed);
+	b->bpe = (double)bits / nobjects;
+	b->ready = 1;
+	*bloom = b;
+	b = NULL;
+done:
+	free(b);
+	if (close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", path);
+	if (err) {
+		if (*bloom) {
+			if (*map == NULL)
+				bloom_free(*bloom);
+			free(*bloom);
+			*bloom = NULL;
+		}
+		if (*map)
+			munmap(*map, *maplen);
+		*map = NULL;
+		*maplen = 0;
+	}
+	return err;
+}
+
+/*
+ * Add an entry for a pack index to the bloom filter tree, using the bloom
+ * filter file of this pack index if one exists. Otherwise, the entry will
+ * have no bloom filter and the pack index will have to be searched.
+ */
+static const struct got_error *
+load_packidx_bloom_filter(struct got_packidx_bloom_filter **bfp,
+    struct got_repository *repo, const char *path_packidx)
+{
+	const struct got_error *err;
+	struct got_packidx_bloom_filter *bf;
+	size_t len;
+
+	*bfp = NULL;
+
+	bf = calloc(1, sizeof(*bf));
+	if (bf == NULL)
+		return got_error_from_errno("calloc");
+
+	len = strlcpy(bf->path, path_packidx, sizeof(bf->path));
+	if (len >= sizeof(bf->path)) {
+		free(bf);
+		return got_error(GOT_ERR_NO_SPACE);
+	}
+	bf->path_len = len;
+
+	err = open_packidx_bloom_file(&bf->bloom, &bf->map, &bf->maplen,
+	    repo, path_packidx);
+	if (err) {
+		free(bf);
+		return err;
+	}
+
+	RB_INSERT(got_packidx_bloom_filter_tree,
+	    &repo->packidx_bloom_filters, bf);
+	*bfp = bf;
+	return NULL;
+}
+
 int
 got_repo_check_packidx_bloom_filter(struct got_repository *repo,
     const char *path_packidx, struct got_object_id *id)
@@ -1231,7 +1566,10 @@ got_repo_check_packidx_bloom_filter(struct got_repository *repo,
 	struct got_packidx_bloom_filter *bf;
 
 	bf = get_packidx_bloom_filter(repo, path_packidx, strlen(path_packidx));
-	if (bf)
+	if (bf == NULL &&
+	    load_packidx_bloom_filter(&bf, repo, path_packidx) != NULL)
+		return 1;
+	if (bf && bf->bloom)
 		return bloom_check(bf->bloom, id->hash,
 		    got_hash_digest_length(id->algo));
 
@@ -1243,14 +1581,26 @@ static const struct got_error *
 add_packidx_bloom_filter(struct got_repository *repo,
     struct got_packidx *packidx, const char *path_packidx)
 {
+	const struct got_error *err;
 	int i, nobjects = be32toh(packidx->hdr.fanout_table[0xff]);
 	struct got_packidx_bloom_filter *bf;
-	size_t len, digest_len;
+	size_t digest_len;
 
 	digest_len = got_hash_digest_length(repo->algo);
 
+	/* Do we already have a filter for this pack index? */
+	bf = get_packidx_bloom_filter(repo, path_packidx,
+	    strlen(path_packidx));
+	if (bf == NULL) {
+		err = load_packidx_bloom_filter(&bf, repo, path_packidx);
+		if (err)
+			return err;
+	}
+	if (bf->bloom != NULL)
+		return NULL;
+
 	/*
-	 * Don't use bloom filters for very large pack index files.
+	 * Don't build bloom filters for very large pack index files.
 	 * Large pack files will contain a relatively large fraction
 	 * of our objects so we will likely need to visit them anyway.
 	 * The more objects a pack file contains the higher the probability
@@ -1260,38 +1610,229 @@ add_packidx_bloom_filter(struct got_repository *repo,
 	if (nobjects > 100000) /* cut-off at about 2MB, at 20 bytes per ID */
 		return NULL;
 
-	/* Do we already have a filter for this pack index? */
-	if (get_packidx_bloom_filter(repo, path_packidx,
-	    strlen(path_packidx)) != NULL)
-		return NULL;
-
-	bf = calloc(1, sizeof(*bf));
-	if (bf == NULL)
-		return got_error_from_errno("calloc");
 	bf->bloom = calloc(1, sizeof(*bf->bloom));
-	if (bf->bloom == NULL) {
-		free(bf);
+	if (bf->bloom == NULL)
 		return got_error_from_errno("calloc");
+
+	/* Minimum size supported by our bloom filter is 1000 entries. */
+	bloom_init(bf->bloom, nobjects < 1000 ? 1000 : nobjects,
+	    GOT_PACKIDX_BLOOM_ERROR_RATE);
+	for (i = 0; i < nobjects; i++) {
+		uint8_t *id = packidx->hdr.sorted_ids + i * digest_len;
+		bloom_add(bf->bloom, id, digest_len);
 	}
 
-	len = strlcpy(bf->path, path_packidx, sizeof(bf->path));
-	if (len >= sizeof(bf->path)) {
-		free(bf->bloom);
-		free(bf);
-		return got_error(GOT_ERR_NO_SPACE);
+	return NULL;
+}
+
+static const struct got_error *
+write_bloom_file(int fd, const void *buf, size_t len, const char *path)
+{
+	ssize_t w;
+
+	w = write(fd, buf, len);
+	if (w == -1)
+		return got_error_from_errno2("write", path);
+	if ((size_t)w != len)
+		return got_error(GOT_ERR_IO);
+
+	return NULL;
+}
+
+const struct got_error *
+got_repo_write_packidx_bloom_filter(struct got_repository *repo,
+    struct got_object_id *pack_hash)
+{
+	const struct got_error *err = NULL;
+	struct got_packidx *packidx;
+	struct got_packidx_bloom_hdr hdr;
+	struct bloom bloom;
+	struct got_hash ctx;
+	uint8_t csum[GOT_HASH_DIGEST_MAXLEN];
+	char *id_str = NULL, *path_packidx = NULL, *base = NULL;
+	char *tmppath = NULL, *path = NULL;
+	char bloom_path[PATH_MAX];
+	size_t digest_len = got_hash_digest_length(repo->algo);
+	uint32_t i, nobjects;
+	int fd = -1;
+
+	memset(&bloom, 0, sizeof(bloom));
+
+	err = got_object_id_str(&id_str, pack_hash);
+	if (err)
+		return err;
+
+	if (asprintf(&path_packidx, "%s/pack-%s.idx",
+	    GOT_OBJECTS_PACK_DIR, id_str) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
 	}
-	bf->path_len = len;
+
+	err = got_repo_get_packidx(&packidx, path_packidx, repo);
+	if (err)
+		goto done;
+
+	/* Bit positions are computed with int in bloom.c. */
+	nobjects = be32toh(packidx->hdr.fanout_table[0xff]);
+	if (nobjects > INT_MAX / 8)
+		goto done;
 
 	/* Minimum size supported by our bloom filter is 1000 entries. */
-	bloom_init(bf->bloom, nobjects < 1000 ? 1000 : nobjects, 0.1);
+	if (bloom_init(&bloom, nobjects < 1000 ? 1000 : nobjects,
+	    GOT_PACKIDX_BLOOM_ERROR_RATE) != 0) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
 	for (i = 0; i < nobjects; i++) {
 		uint8_t *id = packidx->hdr.sorted_ids + i * digest_len;
-		bloom_add(bf->bloom, id, digest_len);
+		bloom_add(&bloom, id, digest_len);
 	}
 
-	RB_INSERT(got_packidx_bloom_filter_tree,
-	    &repo->packidx_bloom_filters, bf);
-	return NULL;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.signature = htobe32(GOT_PACKIDX_BLOOM_SIGNATURE);
+	hdr.version = GOT_PACKIDX_BLOOM_VERSION;
+	hdr.digest_len = digest_len;
+	hdr.byte_order = GOT_PACKIDX_BLOOM_BYTE_ORDER;
+	hdr.nobjects = htobe32(bloom.entries);
+	hdr.bits = htobe32(bloom.bits);
+	hdr.hashes = htobe32(bloom.hashes);
+	hdr.seed = htobe32(bloom.seed);
+
+	err = get_packidx_bloom_path(bloom_path, sizeof(bloom_path),
+	    path_packidx);
+	if (err)
+		goto done;
+
+	if (asprintf(&base, "%s/%s/bloom", got_repo_get_path_git_dir(repo),
+	    GOT_OBJECTS_PACK_DIR) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	if (asprintf(&path, "%s/%s", got_repo_get_path_git_dir(repo),
+	    bloom_path) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	err = got_opentemp_named_fd(&tmppath, &fd, base, "");
+	if (err)
+		goto done;
+
+	err = write_bloom_file(fd, &hdr, sizeof(hdr), tmppath);
+	if (err)
+		goto done;
+	err = write_bloom_file(fd, bloom.bf, bloom.bytes, tmppath);
+	if (err)
+		goto done;
+	err = write_bloom_file(fd, packidx->hdr.trailer.packfile_hash,
+	    digest_len, tmppath);
+	if (err)
+		goto done;
+
+	got_hash_init(&ctx, repo->algo);
+	got_hash_update(&ctx, &hdr, sizeof(hdr));
+	got_hash_update(&ctx, bloom.bf, bloom.bytes);
+	got_hash_update(&ctx, packidx->hdr.trailer.packfile_hash, digest_len);
+	got_hash_final(&ctx, csum);
+	err = write_bloom_file(fd, csum, digest_len, tmppath);
+	if (err)
+		goto done;
+
+	if (fchmod(fd, GOT_DEFAULT_PACK_MODE) == -1) {
+		err = got_error_from_errno2("fchmod", tmppath);
+		goto done;
+	}
+
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+done:
+	bloom_free(&bloom);
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	free(tmppath);
+	free(path);
+	free(base);
+	free(path_packidx);
+	free(id_str);
+	return err;
+}
+
+const struct got_error *
+got_repo_write_packidx_reverse_index(struct got_repository *repo,
+    struct got_object_id *pack_hash)
+{
+	const struct got_error *err = NULL;
+	struct got_packidx *packidx;
+	char *id_str = NULL, *path_packidx = NULL, *rev_relpath = NULL;
+	char *base = NULL, *tmppath = NULL, *path = NULL;
+	int fd = -1;
+
+	err = got_object_id_str(&id_str, pack_hash);
+	if (err)
+		return err;
+
+	if (asprintf(&path_packidx, "%s/pack-%s.idx",
+	    GOT_OBJECTS_PACK_DIR, id_str) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	err = got_repo_get_packidx(&packidx, path_packidx, repo);
+	if (err)
+		goto done;
+
+	err = got_packidx_get_reverse_index_path(&rev_relpath, path_packidx);
+	if (err)
+		goto done;
+
+	if (asprintf(&base, "%s/%s/rev", got_repo_get_path_git_dir(repo),
+	    GOT_OBJECTS_PACK_DIR) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	if (asprintf(&path, "%s/%s", got_repo_get_path_git_dir(repo),
+	    rev_relpath) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	err = got_opentemp_named_fd(&tmppath, &fd, base, "");
+	if (err)
+		goto done;
+
+	err = got_packidx_write_reverse_index(fd, packidx);
+	if (err)
+		goto done;
+
+	if (fchmod(fd, GOT_DEFAULT_PACK_MODE) == -1) {
+		err = got_error_from_errno2("fchmod", tmppath);
+		goto done;
+	}
+
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+done:
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	free(tmppath);
+	free(path);
+	free(base);
+	free(rev_relpath);
+	free(path_packidx);
+	free(id_str);
+	return err;
 }
 
 static void
@@ -1330,12 +1871,142 @@ refresh_packidx_paths(struct got_repository *repo)
 		err = got_repo_list_packidx(&repo->packidx_paths, repo);
 		if (err)
 			goto done;
+
+		/* The multi-pack-index file may have changed as well. */
+		if (repo->midx) {
+			err = got_multi_pack_index_close(repo->midx);
+			repo->midx = NULL;
+			if (err)
+				goto done;
+		}
+		repo->midx_checked = 0;
+		repo->midx_complete = -1;
 	}
 done:
 	free(objects_pack_dir);
 	return err;
 }
 
+static const struct got_error *
+get_multi_pack_index(struct got_multi_pack_index **midx,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	int fd;
+
+	*midx = NULL;
+
+	if (repo->midx_checked) {
+		*midx = repo->midx;
+		return NULL;
+	}
+
+	fd = openat(got_repo_get_fd(repo), GOT_MIDX_FILE,
+	    O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			return got_error_from_errno2("openat", GOT_MIDX_FILE);
+		repo->midx_checked = 1;
+		return NULL;
+	}
+
+	err = got_multi_pack_index_open(&repo->midx, fd, repo->algo);
+	if (err) {
+		/* Fall back to searching pack index files one by one. */
+		if (err->code != GOT_ERR_BAD_MIDX)
+			return err;
+		repo->midx = NULL;
+	}
+
+	repo->midx_checked = 1;
+	repo->midx_complete = -1;
+	*midx = repo->midx;
+	return NULL;
+}
+
+static int
+midx_name_cmp(const void *pa, const void *pb)
+{
+	const char *a = pa;
+	const char * const *b = pb;
+
+	return strcmp(a, *b);
+}
+
+/*
+ * Check whether every pack index file in the repository is listed in
+ * the multi-pack-index. If so, objects not found in the multi-pack-index
+ * cannot be found in any pack file.
+ */
+static int
+midx_is_complete(struct got_repository *repo)
+{
+	struct got_multi_pack_index *midx = repo->midx;
+	struct got_pathlist_entry *pe;
+	const char *name;
+
+	if (repo->midx_complete != -1)
+		return repo->midx_complete;
+
+	repo->midx_complete = 1;
+	RB_FOREACH(pe, got_pathlist_head, &repo->packidx_paths) {
+		name = strrchr(pe->path, '/');
+		name = name ? name + 1 : pe->path;
+		if (bsearch(name, midx->pack_names, midx->npacks,
+		    sizeof(midx->pack_names[0]), midx_name_cmp) == NULL) {
+			repo->midx_complete = 0;
+			break;
+		}
+	}
+
+	return repo->midx_complete;
+}
+
+/*
+ * Search for an object via the multi-pack-index, if one exists.
+ * Set *packidx to NULL if the object could not be found this way.
+ */
+static const struct got_error *
+search_multi_pack_index(struct got_packidx **packidx, int *idx,
+    struct got_repository *repo, struct got_object_id *id)
+{
+	const struct got_error *err;
+	struct got_multi_pack_index *midx;
+	const char *name;
+	char path_packidx[PATH_MAX];
+	int ret;
+
+	*packidx = NULL;
+
+	err = get_multi_pack_index(&midx, repo);
+	if (err || midx == NULL)
+		return err;
+
+	name = got_multi_pack_index_lookup(midx, id);
+	if (name == NULL)
+		return NULL;
+
+	ret = snprintf(path_packidx, sizeof(path_packidx), "%s/%s",
+	    GOT_OBJECTS_PACK_DIR, name);
+	if (ret < 0 || (size_t)ret >= sizeof(path_packidx))
+		return got_error(GOT_ERR_NO_SPACE);
+
+	err = got_repo_get_packidx(packidx, path_packidx, repo);
+	if (err) {
+		/* The multi-pack-index may list pack files which are gone. */
+		if (err->code == GOT_ERR_LONELY_PACKIDX ||
+		    (err->code == GOT_ERR_ERRNO && errno == ENOENT))
+			err = NULL;
+		*packidx = NULL;
+		return err;
+	}
+
+	*idx = got_packidx_get_object_idx(*packidx, id);
+	if (*idx == -1)
+		*packidx = NULL;
+	return NULL;
+}
+
 const struct got_error *
 got_repo_search_packidx(struct got_packidx **packidx, int *idx,
     struct got_repository *repo, struct got_object_id *id)
@@ -1344,6 +2015,10 @@ got_repo_search_packidx(struct got_packidx **packidx, int *idx,
 	struct got_pathlist_entry *pe;
 	size_t i;
 
+	err = search_multi_pack_index(packidx, idx, repo, id);
+	if (err || *packidx)
+		return err;
+
 	/* Search pack index cache. */
 	for (i = 0; i < repo->pack_cache_size; i++) {
 		if (repo->packidx_cache[i] == NULL)
@@ -1378,6 +2053,9 @@ got_repo_search_packidx(struct got_packidx **packidx, int *idx,
 	if (err)
 		return err;
 
+	if (repo->midx && midx_is_complete(repo))
+		return got_error_no_obj(id);
+
 	RB_FOREACH(pe, got_pathlist_head, &repo->packidx_paths) {
 		const char *path_packidx = pe->path;
 		int is_cached = 0;
@@ -1638,7 +2316,8 @@ got_repo_cache_pack(struct got_pack **packp, struct got_repository *repo,
 
 	pack->privsep_child = NULL;
 
-	err = got_delta_cache_alloc(&pack->delta_cache);
+	err = got_delta_cache_alloc(&pack->delta_cache,
+	    GOT_DELTA_CACHE_DEFAULT_SIZE);
 	if (err)
 		goto done;
 
@@ -2143,6 +2822,227 @@ got_repo_find_object_id(struct got_object_id *id, struct got_repository *repo)
 	return err;
 }
 
+const struct got_error *
+got_repo_get_commit_graph_file(struct got_commit_graph_file **cg,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_object_idset *shallow;
+	int fd;
+
+	*cg = NULL;
+
+	if (repo->commit_graph_checked) {
+		*cg = repo->commit_graph;
+		return NULL;
+	}
+
+	/* Like Git, ignore the commit-graph in a shallow repository. */
+	err = got_repo_get_shallow_commits(&shallow, repo);
+	if (err)
+		return err;
+	if (shallow) {
+		repo->commit_graph_checked = 1;
+		return NULL;
+	}
+
+	fd = openat(got_repo_get_fd(repo), GOT_COMMIT_GRAPH_FILE,
+	    O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			return got_error_from_errno2("openat",
+			    GOT_COMMIT_GRAPH_FILE);
+		repo->commit_graph_checked = 1;
+		return NULL;
+	}
+
+	err = got_commit_graph_file_open(&repo->commit_graph, fd, repo->algo);
+	if (err) {
+		/*
+		 * A commit-graph file we cannot use is not fatal.
+		 * Fall back to reading commit objects instead.
+		 */
+		if (err->code != GOT_ERR_BAD_COMMIT_GRAPH)
+			return err;
+		repo->commit_graph = NULL;
+	}
+
+	repo->commit_graph_checked = 1;
+	*cg = repo->commit_graph;
+	return NULL;
+}
+
+const struct got_error *
+got_repo_get_shallow_commits(struct got_object_idset **shallow,
+    struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_object_idset *idset = NULL;
+	struct got_object_id id;
+	FILE *f = NULL;
+	char *line = NULL;
+	size_t linesize = 0;
+	ssize_t linelen;
+	int fd;
+
+	*shallow = NULL;
+
+	if (repo->shallow_checked) {
+		*shallow = repo->shallow_commits;
+		return NULL;
+	}
+
+	fd = openat(got_repo_get_fd(repo), GOT_SHALLOW_FILE,
+	    O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			return got_error_from_errno2("openat",
+			    GOT_SHALLOW_FILE);
+		repo->shallow_checked = 1;
+		return NULL;
+	}
+
+	f = fdopen(fd, "r");
+	if (f == NULL) {
+		err = got_error_from_errno2("fdopen", GOT_SHALLOW_FILE);
+		close(fd);
+		return err;
+	}
+
+	idset = got_object_idset_alloc();
+	if (idset == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+
+	while ((linelen = getline(&line, &linesize, f)) != -1) {
+		if (linelen > 0 && line[linelen - 1] == '\n')
+			line[--linelen] = '\0';
+		if (linelen == 0)
+			continue;
+		if (!got_parse_object_id(&id, line, repo->algo)) {
+			err = got_error_path(GOT_SHALLOW_FILE,
+			    GOT_ERR_BAD_OBJ_ID_STR);
+			goto done;
+		}
+		if (got_object_idset_contains(idset, &id))
+			continue;
+		err = got_object_idset_add(idset, &id, NULL);
+		if (err)
+			goto done;
+	}
+	if (ferror(f)) {
+		err = got_error_from_errno2("getline", GOT_SHALLOW_FILE);
+		goto done;
+	}
+
+	if (got_object_idset_num_elements(idset) > 0) {
+		repo->shallow_commits = idset;
+		idset = NULL;
+	}
+	repo->shallow_checked = 1;
+	*shallow = repo->shallow_commits;
+done:
+	if (idset)
+		got_object_idset_free(idset);
+	free(line);
+	if (fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno2("fclose", GOT_SHALLOW_FILE);
+	return err;
+}
+
+const struct got_error *
+got_repo_is_shallow_commit(int *is_shallow, struct got_repository *repo,
+    struct got_object_id *id)
+{
+	const struct got_error *err;
+	struct got_object_idset *shallow;
+
+	*is_shallow = 0;
+
+	err = got_repo_get_shallow_commits(&shallow, repo);
+	if (err)
+		return err;
+
+	if (shallow)
+		*is_shallow = got_object_idset_contains(shallow, id);
+	return NULL;
+}
+
+static const struct got_error *
+write_shallow_commit(struct got_object_id *id, void *data, void *arg)
+{
+	FILE *f = arg;
+	char hex[GOT_HASH_DIGEST_STRING_MAXLEN];
+
+	if (got_object_id_hex(id, hex, sizeof(hex)) == NULL)
+		return got_error(GOT_ERR_BAD_OBJ_ID);
+
+	if (fprintf(f, "%s\n", hex) < 0)
+		return got_ferror(f, GOT_ERR_IO);
+
+	return NULL;
+}
+
+const struct got_error *
+got_repo_write_shallow_commits(struct got_repository *repo,
+    struct got_object_idset *shallow)
+{
+	const struct got_error *err = NULL;
+	char *path = NULL, *tmppath = NULL;
+	FILE *f = NULL;
+
+	path = get_path_git_child(repo, GOT_SHALLOW_FILE);
+	if (path == NULL)
+		return got_error_from_errno("get_path_git_child");
+
+	if (shallow == NULL || got_object_idset_num_elements(shallow) == 0) {
+		if (unlink(path) == -1 && errno != ENOENT)
+			err = got_error_from_errno2("unlink", path);
+		goto done;
+	}
+
+	err = got_opentemp_named(&tmppath, &f, path, "");
+	if (err)
+		goto done;
+
+	err = got_object_idset_for_each(shallow, write_shallow_commit, f);
+	if (err)
+		goto done;
+
+	if (fflush(f) == EOF) {
+		err = got_error_from_errno2("fflush", tmppath);
+		goto done;
+	}
+
+	if (fchmod(fileno(f), GOT_DEFAULT_FILE_MODE) == -1) {
+		err = got_error_from_errno2("fchmod", tmppath);
+		goto done;
+	}
+
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+done:
+	if (f && fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	free(tmppath);
+	free(path);
+
+	/* Re-read the shallow file when it is needed next time. */
+	if (repo->shallow_commits) {
+		got_object_idset_free(repo->shallow_commits);
+		repo->shallow_commits = NULL;
+	}
+	repo->shallow_checked = 0;
+	return err;
+}
+
 static const struct got_error *
 alloc_added_blob_tree_entry(struct got_tree_entry **new_te,
     const char *name, mode_t mode, struct got_object_id *blob_id)
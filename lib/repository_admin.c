@@ -53,6 +53,11 @@
 #include "got_lib_ratelimit.h"
 #include "got_lib_pack_create.h"
 #include "got_lib_lockfile.h"
+#include "got_lib_object_qid.h"
+#include "got_lib_commit_graph_file.h"
+#include "got_lib_ewah.h"
+#include "got_lib_pack_bitmap.h"
+#include "got_lib_multi_pack_index.h"
 
 #ifndef nitems
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
@@ -170,6 +175,36 @@ done:
 	return err;
 }
 
+static const struct got_error *
+packfile_exists(int *exists, struct got_object_id *pack_hash,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	char *hash_str, *path = NULL;
+	struct stat sb;
+
+	*exists = 0;
+
+	err = got_object_id_str(&hash_str, pack_hash);
+	if (err)
+		return err;
+
+	if (asprintf(&path, "%s/pack-%s.pack", GOT_OBJECTS_PACK_DIR,
+	    hash_str) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	if (fstatat(got_repo_get_fd(repo), path, &sb, 0) == 0)
+		*exists = 1;
+	else if (errno != ENOENT)
+		err = got_error_from_errno2("fstatat", path);
+done:
+	free(hash_str);
+	free(path);
+	return err;
+}
+
 static const struct got_error *
 install_packfile(FILE **packfile, int *packfd, char **packfile_path,
     char **tmpfile_path, struct got_object_id *pack_hash,
@@ -219,6 +254,7 @@ got_repo_pack_objects(FILE **packfile, struct got_object_id **pack_hash,
     struct got_reflist_head *include_refs,
     struct got_reflist_head *exclude_refs, struct got_repository *repo,
     int loose_obj_only, int force_refdelta,
+    const struct got_pack_delta_params *delta_params,
     got_pack_progress_cb progress_cb, void *progress_arg,
     got_cancel_cb cancel_cb, void *cancel_arg)
 {
@@ -228,12 +264,17 @@ got_repo_pack_objects(FILE **packfile, struct got_object_id **pack_hash,
 	char *tmpfile_path = NULL, *packfile_path = NULL;
 	FILE *delta_cache = NULL;
 	struct got_ratelimit rl;
+	struct got_object_idset *shallow;
 
 	*packfile = NULL;
 	*pack_hash = NULL;
 
 	got_ratelimit_init(&rl, 0, 500);
 
+	err = got_repo_get_shallow_commits(&shallow, repo);
+	if (err)
+		return err;
+
 	err = create_temp_packfile(&packfd, &tmpfile_path, repo);
 	if (err)
 		return err;
@@ -271,8 +312,8 @@ got_repo_pack_objects(FILE **packfile, struct got_object_id **pack_hash,
 	}
 	err = got_pack_create(*pack_hash, packfd, delta_cache,
 	    theirs, ntheirs, ours, nours, repo, loose_obj_only,
-	    0, force_refdelta, progress_cb, progress_arg, &rl,
-	    cancel_cb, cancel_arg);
+	    0, force_refdelta, 0, shallow, NULL, delta_params, 0,
+	    progress_cb, progress_arg, &rl, cancel_cb, cancel_arg);
 	if (err)
 		goto done;
 
@@ -306,7 +347,7 @@ done:
 
 const struct got_error *
 got_repo_index_pack(char **idxpath, FILE *packfile,
-    struct got_object_id *pack_hash, struct got_repository *repo,
+    struct got_object_id *pack_hash, struct got_repository *repo, int nthreads,
     got_pack_index_progress_cb progress_cb, void *progress_arg,
     got_cancel_cb cancel_cb, void *cancel_arg)
 {
@@ -406,7 +447,8 @@ got_repo_index_pack(char **idxpath, FILE *packfile,
 		err = got_error_from_errno("dup");
 		goto done;
 	}
-	err = got_privsep_send_index_pack_req(&idxibuf, pack_hash, npackfd);
+	err = got_privsep_send_index_pack_req(&idxibuf, pack_hash, 0, nthreads,
+	    npackfd);
 	if (err != NULL)
 		goto done;
 	npackfd = -1;
@@ -430,7 +472,7 @@ got_repo_index_pack(char **idxpath, FILE *packfile,
 
 		err = got_privsep_recv_index_progress(&done, &nobj_total,
 		    &nobj_indexed, &nobj_loose, &nobj_resolved,
-		    &idxibuf);
+		    NULL, NULL, &idxibuf);
 		if (err != NULL)
 			goto done;
 		if (nobj_indexed != 0) {
@@ -464,6 +506,11 @@ got_repo_index_pack(char **idxpath, FILE *packfile,
 	free(tmpidxpath);
 	tmpidxpath = NULL;
 
+	err = got_repo_write_packidx_bloom_filter(repo, pack_hash);
+	if (err)
+		goto done;
+	err = got_repo_write_packidx_reverse_index(repo, pack_hash);
+
 done:
 	if (idxibuf.w)
 		imsgbuf_clear(&idxibuf);
@@ -608,7 +655,7 @@ got_repo_list_pack(FILE *packfile, struct got_object_id *pack_hash,
 	for (i = 0; i < nobj; i++) {
 		uint8_t *oid;
 		struct got_object_id id, base_id;
-		off_t offset, base_offset = 0;
+		off_t offset, packed_size, base_offset = 0;
 		uint8_t type;
 		uint64_t size;
 		size_t tslen, len;
@@ -633,6 +680,10 @@ got_repo_list_pack(FILE *packfile, struct got_object_id *pack_hash,
 		if (err)
 			goto done;
 
+		err = got_packidx_get_packed_size(&packed_size, packidx, i);
+		if (err)
+			goto done;
+
 		switch (type) {
 		case GOT_OBJ_TYPE_OFFSET_DELTA:
 			err = got_pack_parse_offset_delta(&base_offset, &len,
@@ -648,7 +699,7 @@ got_repo_list_pack(FILE *packfile, struct got_object_id *pack_hash,
 			break;
 		}
 		err = (*list_cb)(list_arg, &id, type, offset, size,
-		    base_offset, &base_id);
+		    packed_size, base_offset, &base_id);
 		if (err)
 			goto done;
 	}
@@ -946,10 +997,10 @@ load_commit_or_tag(int *ncommits, struct got_object_idset *traversed_ids,
 	const struct got_error *err;
 	struct got_commit_object *commit = NULL;
 	struct got_tag_object *tag = NULL;
-	struct got_object_id *tree_id = NULL;
+	struct got_object_id *tree_id = NULL, *commit_id = NULL;
 	struct got_object_id_queue ids;
 	struct got_object_qid *qid;
-	int obj_type;
+	int obj_type, shallow;
 
 	err = got_object_qid_alloc(&qid, id);
 	if (err)
@@ -987,6 +1038,7 @@ load_commit_or_tag(int *ncommits, struct got_object_idset *traversed_ids,
 			    &qid->id);
 			if (err)
 				goto done;
+			commit_id = &qid->id;
 			tree_id = got_object_commit_get_tree_id(commit);
 			break;
 		case GOT_OBJ_TYPE_TAG:
@@ -1039,6 +1091,7 @@ load_commit_or_tag(int *ncommits, struct got_object_idset *traversed_ids,
 				    id);
 				if (err)
 					goto done;
+				commit_id = id;
 				tree_id = got_object_commit_get_tree_id(commit);
 				break;
 			case GOT_OBJ_TYPE_TREE:
@@ -1082,10 +1135,17 @@ load_commit_or_tag(int *ncommits, struct got_object_idset *traversed_ids,
 		if (commit) {
 			/* Find parent commits to scan. */
 			const struct got_object_id_queue *parent_ids;
-			parent_ids = got_object_commit_get_parent_ids(commit);
-			err = got_object_id_queue_copy(parent_ids, &ids);
+			err = got_repo_is_shallow_commit(&shallow, repo,
+			    commit_id);
 			if (err)
 				break;
+			parent_ids = got_object_commit_get_parent_ids(commit);
+			if (!shallow) {
+				err = got_object_id_queue_copy(parent_ids,
+				    &ids);
+				if (err)
+					break;
+			}
 			got_object_commit_close(commit);
 			commit = NULL;
 		}
@@ -1276,7 +1336,7 @@ purge_redundant_pack(struct got_repository *repo, const char *packidx_path,
     int *remove, off_t *size_before, off_t *size_after)
 {
 	static const char *ext[] = {".idx", ".pack", ".rev", ".bitmap",
-	    ".promisor", ".mtimes"};
+	    ".bloom", ".promisor", ".mtimes"};
 	struct stat sb;
 	char *dot, path[PATH_MAX];
 	size_t i;
@@ -1500,12 +1560,13 @@ got_repo_cleanup(struct got_repository *repo,
 	struct got_lockfile *lk = NULL;
 	struct got_ratelimit rl;
 	struct got_reflist_head refs;
-	struct got_object_idset *traversed_ids = NULL;
+	struct got_object_idset *traversed_ids = NULL, *shallow;
 	struct got_reflist_entry *re;
 	struct got_object_id **referenced_ids;
 	int i, nreferenced;
-	int npurged = 0, packfd = -1;
+	int npurged = 0, packfd = -1, pack_existed = 0;
 	char *tmpfile_path = NULL, *packfile_path = NULL, *idxpath = NULL;
+	char *bloompath = NULL, *revpath = NULL;
 	FILE *delta_cache = NULL, *packfile = NULL;
 	struct got_object_id pack_hash;
 	time_t max_mtime = 0;
@@ -1573,10 +1634,23 @@ got_repo_cleanup(struct got_repository *repo,
 			goto done;
 	}
 
+	err = got_repo_get_shallow_commits(&shallow, repo);
+	if (err)
+		goto done;
+
 	err = got_pack_create(&pack_hash, packfd, delta_cache,
 	    NULL, 0, referenced_ids, nreferenced, repo, 0,
-	    0, 0, pack_progress_cb, pack_progress_arg,
-	    &rl, cancel_cb, cancel_arg);
+	    0, 0, 0, shallow, NULL, NULL, 0, pack_progress_cb,
+	    pack_progress_arg, &rl, cancel_cb, cancel_arg);
+	if (err)
+		goto done;
+
+	/*
+	 * If all objects were copied verbatim from an existing pack file
+	 * the new pack file is identical to it and must not be removed
+	 * in dry-run mode.
+	 */
+	err = packfile_exists(&pack_existed, &pack_hash, repo);
 	if (err)
 		goto done;
 
@@ -1585,7 +1659,7 @@ got_repo_cleanup(struct got_repository *repo,
 	if (err)
 		goto done;
 
-	err = got_repo_index_pack(&idxpath, packfile, &pack_hash, repo,
+	err = got_repo_index_pack(&idxpath, packfile, &pack_hash, repo, 0,
 	    index_progress_cb, index_progress_arg,
 	    cancel_cb, cancel_arg);
 	if (err)
@@ -1595,6 +1669,13 @@ got_repo_cleanup(struct got_repository *repo,
 	if (err)
 		goto done;
 
+	if (!dry_run) {
+		err = got_repo_write_pack_bitmap(repo, &pack_hash, &refs,
+		    cancel_cb, cancel_arg);
+		if (err)
+			goto done;
+	}
+
 	err = repo_purge_unreferenced_loose_objects(repo, traversed_ids,
 	    loose_before, loose_after, *ncommits, nloose, npacked, &npurged,
 	    dry_run, ignore_mtime, max_mtime, &rl, progress_cb, progress_arg,
@@ -1609,11 +1690,29 @@ got_repo_cleanup(struct got_repository *repo,
 	if (err)
 		goto done;
 
-	if (dry_run) {
+	if (dry_run && !pack_existed) {
 		if (idxpath && unlink(idxpath) == -1)
 			err = got_error_from_errno2("unlink", idxpath);
 		if (packfile_path && unlink(packfile_path) == -1 && err == NULL)
 			err = got_error_from_errno2("unlink", packfile_path);
+		if (idxpath && err == NULL) {
+			/* Also remove the bloom filter of the pack index. */
+			if (asprintf(&bloompath, "%.*s.bloom",
+			    (int)strlen(idxpath) - 4, idxpath) == -1) {
+				err = got_error_from_errno("asprintf");
+				goto done;
+			}
+			if (unlink(bloompath) == -1 && errno != ENOENT)
+				err = got_error_from_errno2("unlink", bloompath);
+		}
+		if (idxpath && err == NULL) {
+			err = got_packidx_get_reverse_index_path(&revpath,
+			    idxpath);
+			if (err)
+				goto done;
+			if (unlink(revpath) == -1 && errno != ENOENT)
+				err = got_error_from_errno2("unlink", revpath);
+		}
 	}
  done:
 	if (lk) {
@@ -1633,6 +1732,8 @@ got_repo_cleanup(struct got_repository *repo,
 	free(tmpfile_path);
 	free(packfile_path);
 	free(idxpath);
+	free(bloompath);
+	free(revpath);
 	return err;
 }
 
@@ -1724,3 +1825,750 @@ done:
 	free(pack_relpath);
 	return err;
 }
+
+static const struct got_error *
+queue_ref_commit(struct got_object_id_queue *ids, struct got_reference *ref,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_object_id *id = NULL;
+	struct got_object_qid *qid;
+	struct got_tag_object *tag;
+	int obj_type;
+
+	err = got_ref_resolve(&id, repo, ref);
+	if (err)
+		return err;
+
+	/* Peel tags until we find a commit. */
+	for (;;) {
+		err = got_object_get_type(&obj_type, repo, id);
+		if (err) {
+			if (err->code == GOT_ERR_NO_OBJ)
+				err = NULL; /* ignore dangling references */
+			goto done;
+		}
+		if (obj_type != GOT_OBJ_TYPE_TAG)
+			break;
+
+		err = got_object_open_as_tag(&tag, repo, id);
+		if (err)
+			goto done;
+		free(id);
+		id = got_object_id_dup(got_object_tag_get_object_id(tag));
+		got_object_tag_close(tag);
+		if (id == NULL) {
+			err = got_error_from_errno("got_object_id_dup");
+			goto done;
+		}
+	}
+
+	if (obj_type != GOT_OBJ_TYPE_COMMIT)
+		goto done;
+
+	err = got_object_qid_alloc(&qid, id);
+	if (err)
+		goto done;
+	STAILQ_INSERT_TAIL(ids, qid, entry);
+done:
+	free(id);
+	return err;
+}
+
+static const struct got_error *
+add_commit_graph_entry(struct got_commit_graph_file_entry **entries,
+    size_t *nentries, size_t *nalloc, struct got_object_id *id,
+    struct got_commit_object *commit)
+{
+	struct got_commit_graph_file_entry *e;
+	const struct got_object_id_queue *parent_ids;
+	struct got_object_qid *pid;
+	int i;
+
+	if (*nentries >= *nalloc) {
+		struct got_commit_graph_file_entry *new;
+		size_t newalloc = *nalloc ? *nalloc * 2 : 1024;
+
+		new = reallocarray(*entries, newalloc, sizeof(**entries));
+		if (new == NULL)
+			return got_error_from_errno("reallocarray");
+		*entries = new;
+		*nalloc = newalloc;
+	}
+
+	e = &(*entries)[*nentries];
+	memset(e, 0, sizeof(*e));
+	memcpy(&e->id, id, sizeof(e->id));
+	memcpy(&e->tree_id, got_object_commit_get_tree_id(commit),
+	    sizeof(e->tree_id));
+	e->committer_time = got_object_commit_get_committer_time(commit);
+	e->nparents = got_object_commit_get_nparents(commit);
+	if (e->nparents > 0) {
+		e->parent_ids = calloc(e->nparents, sizeof(*e->parent_ids));
+		if (e->parent_ids == NULL)
+			return got_error_from_errno("calloc");
+		parent_ids = got_object_commit_get_parent_ids(commit);
+		i = 0;
+		STAILQ_FOREACH(pid, parent_ids, entry)
+			memcpy(&e->parent_ids[i++], &pid->id, sizeof(pid->id));
+	}
+
+	(*nentries)++;
+	return NULL;
+}
+
+/*
+ * Add a changed path and its leading directories to a list of paths
+ * for a changed-path bloom filter.
+ */
+static const struct got_error *
+add_changed_path(struct got_pathlist_head *paths, const char *path)
+{
+	const struct got_error *err;
+	struct got_pathlist_entry *new;
+	char *p, *slash;
+
+	p = strdup(path);
+	if (p == NULL)
+		return got_error_from_errno("strdup");
+
+	for (;;) {
+		err = got_pathlist_insert(&new, paths, p, NULL);
+		if (err || new == NULL) {
+			/* Leading directories are already present. */
+			free(p);
+			return err;
+		}
+
+		slash = strrchr(p, '/');
+		if (slash == NULL)
+			break;
+		p = strndup(p, slash - p);
+		if (p == NULL)
+			return got_error_from_errno("strndup");
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+add_changed_file(struct got_pathlist_head *paths, int *nfiles,
+    const char *path)
+{
+	if (*nfiles == -1)
+		return NULL;
+
+	if (++(*nfiles) > GOT_COMMIT_GRAPH_BLOOM_MAX_PATHS) {
+		*nfiles = -1;
+		return NULL;
+	}
+
+	return add_changed_path(paths, path);
+}
+
+/*
+ * Collect paths of files which differ between two trees, along with the
+ * leading directories of such paths. Either tree may be NULL. Set *nfiles
+ * to -1 if too many files were changed for a changed-path bloom filter.
+ */
+static const struct got_error *
+collect_changed_paths(struct got_pathlist_head *paths, int *nfiles,
+    struct got_tree_object *tree1, struct got_tree_object *tree2,
+    const char *parent_path, struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_tree_object *subtree1 = NULL, *subtree2 = NULL;
+	struct got_tree_entry *te1, *te2;
+	char *path = NULL;
+	int i, n, dir1, dir2;
+
+	n = tree1 ? got_object_tree_get_nentries(tree1) : 0;
+	for (i = 0; i < n && *nfiles != -1; i++) {
+		te1 = got_object_tree_get_entry(tree1, i);
+		te2 = tree2 ? got_object_tree_find_entry(tree2,
+		    got_tree_entry_get_name(te1)) : NULL;
+		if (te2 && got_tree_entry_get_mode(te1) ==
+		    got_tree_entry_get_mode(te2) &&
+		    got_object_id_cmp(got_tree_entry_get_id(te1),
+		    got_tree_entry_get_id(te2)) == 0)
+			continue;
+
+		if (asprintf(&path, "%s%s%s", parent_path,
+		    parent_path[0] ? "/" : "",
+		    got_tree_entry_get_name(te1)) == -1) {
+			err = got_error_from_errno("asprintf");
+			goto done;
+		}
+
+		dir1 = S_ISDIR(got_tree_entry_get_mode(te1));
+		dir2 = te2 && S_ISDIR(got_tree_entry_get_mode(te2));
+		if (dir1) {
+			err = got_object_open_as_tree(&subtree1, repo,
+			    got_tree_entry_get_id(te1));
+			if (err)
+				goto done;
+		}
+		if (dir2) {
+			err = got_object_open_as_tree(&subtree2, repo,
+			    got_tree_entry_get_id(te2));
+			if (err)
+				goto done;
+		}
+		if (dir1 || dir2) {
+			err = collect_changed_paths(paths, nfiles,
+			    subtree1, subtree2, path, repo);
+			if (err)
+				goto done;
+		}
+		if (!dir1 || (te2 && !dir2)) {
+			err = add_changed_file(paths, nfiles, path);
+			if (err)
+				goto done;
+		}
+
+		if (subtree1) {
+			got_object_tree_close(subtree1);
+			subtree1 = NULL;
+		}
+		if (subtree2) {
+			got_object_tree_close(subtree2);
+			subtree2 = NULL;
+		}
+		free(path);
+		path = NULL;
+	}
+
+	/* Handle entries which only exist in the second tree. */
+	n = tree2 ? got_object_tree_get_nentries(tree2) : 0;
+	for (i = 0; i < n && *nfiles != -1; i++) {
+		te2 = got_object_tree_get_entry(tree2, i);
+		if (tree1 && got_object_tree_find_entry(tree1,
+		    got_tree_entry_get_name(te2)) != NULL)
+			continue;
+
+		if (asprintf(&path, "%s%s%s", parent_path,
+		    parent_path[0] ? "/" : "",
+		    got_tree_entry_get_name(te2)) == -1) {
+			err = got_error_from_errno("asprintf");
+			goto done;
+		}
+
+		if (S_ISDIR(got_tree_entry_get_mode(te2))) {
+			err = got_object_open_as_tree(&subtree2, repo,
+			    got_tree_entry_get_id(te2));
+			if (err)
+				goto done;
+			err = collect_changed_paths(paths, nfiles,
+			    NULL, subtree2, path, repo);
+			got_object_tree_close(subtree2);
+			subtree2 = NULL;
+		} else
+			err = add_changed_file(paths, nfiles, path);
+		if (err)
+			goto done;
+
+		free(path);
+		path = NULL;
+	}
+done:
+	if (subtree1)
+		got_object_tree_close(subtree1);
+	if (subtree2)
+		got_object_tree_close(subtree2);
+	free(path);
+	return err;
+}
+
+/*
+ * Create a changed-path bloom filter for a commit. Reuse the filter
+ * stored in the current commit-graph file, if available.
+ */
+static const struct got_error *
+add_commit_graph_bloom_filter(struct got_commit_graph_file_entry *e,
+    struct got_commit_object *commit, struct got_commit_graph_file *cg,
+    struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_head paths;
+	struct got_commit_object *pcommit = NULL;
+	struct got_tree_object *tree = NULL, *ptree = NULL;
+	struct got_object_qid *pid;
+	const uint8_t *filter;
+	size_t len;
+	uint32_t pos;
+	int nfiles = 0;
+
+	RB_INIT(&paths);
+
+	if (cg && got_commit_graph_file_lookup(&pos, cg, &e->id) &&
+	    got_commit_graph_file_get_bloom_filter(&filter, &len, cg, pos)) {
+		e->bloom = malloc(len);
+		if (e->bloom == NULL)
+			return got_error_from_errno("malloc");
+		memcpy(e->bloom, filter, len);
+		e->bloom_len = len;
+		return NULL;
+	}
+
+	err = got_object_open_as_tree(&tree, repo,
+	    got_object_commit_get_tree_id(commit));
+	if (err)
+		goto done;
+
+	pid = STAILQ_FIRST(got_object_commit_get_parent_ids(commit));
+	if (pid) {
+		err = got_object_open_as_commit(&pcommit, repo, &pid->id);
+		if (err)
+			goto done;
+		err = got_object_open_as_tree(&ptree, repo,
+		    got_object_commit_get_tree_id(pcommit));
+		if (err)
+			goto done;
+	}
+
+	err = collect_changed_paths(&paths, &nfiles, tree, ptree, "", repo);
+	if (err)
+		goto done;
+
+	err = got_commit_graph_file_create_bloom_filter(&e->bloom,
+	    &e->bloom_len, nfiles == -1 ? NULL : &paths);
+done:
+	if (pcommit)
+		got_object_commit_close(pcommit);
+	if (tree)
+		got_object_tree_close(tree);
+	if (ptree)
+		got_object_tree_close(ptree);
+	got_pathlist_free(&paths, GOT_PATHLIST_FREE_PATH);
+	return err;
+}
+
+const struct got_error *
+got_repo_write_commit_graph(struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_reflist_head refs;
+	struct got_reflist_entry *re;
+	struct got_object_id_queue ids;
+	struct got_object_qid *qid, *pid;
+	struct got_object_idset *traversed = NULL;
+	struct got_commit_object *commit;
+	struct got_commit_graph_file_entry *entries = NULL;
+	struct got_commit_graph_file *cg;
+	struct got_object_idset *shallow;
+	size_t nentries = 0, nalloc = 0, i;
+	char *path = NULL, *infodir = NULL, *tmppath = NULL;
+	int fd = -1;
+
+	TAILQ_INIT(&refs);
+	STAILQ_INIT(&ids);
+
+	/*
+	 * Like Git, do not write a commit-graph in a shallow repository.
+	 * Parents of shallow commits are missing, and a commit-graph left
+	 * over from before the repository became shallow is removed.
+	 */
+	err = got_repo_get_shallow_commits(&shallow, repo);
+	if (err)
+		return err;
+	if (shallow) {
+		if (unlinkat(got_repo_get_fd(repo), GOT_COMMIT_GRAPH_FILE,
+		    0) == -1 && errno != ENOENT)
+			return got_error_from_errno2("unlinkat",
+			    GOT_COMMIT_GRAPH_FILE);
+		return NULL;
+	}
+
+	/* Bloom filters can be reused from the current commit-graph file. */
+	err = got_repo_get_commit_graph_file(&cg, repo);
+	if (err)
+		return err;
+
+	traversed = got_object_idset_alloc();
+	if (traversed == NULL)
+		return got_error_from_errno("got_object_idset_alloc");
+
+	err = got_ref_list(&refs, repo, "", got_ref_cmp_by_name, NULL);
+	if (err)
+		goto done;
+
+	TAILQ_FOREACH(re, &refs, entry) {
+		err = queue_ref_commit(&ids, re->ref, repo);
+		if (err)
+			goto done;
+	}
+
+	while (!STAILQ_EMPTY(&ids)) {
+		if (cancel_cb) {
+			err = cancel_cb(cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		qid = STAILQ_FIRST(&ids);
+		STAILQ_REMOVE_HEAD(&ids, entry);
+
+		if (got_object_idset_contains(traversed, &qid->id)) {
+			got_object_qid_free(qid);
+			continue;
+		}
+
+		err = got_object_idset_add(traversed, &qid->id, NULL);
+		if (err) {
+			got_object_qid_free(qid);
+			goto done;
+		}
+
+		err = got_object_open_as_commit(&commit, repo, &qid->id);
+		if (err) {
+			got_object_qid_free(qid);
+			goto done;
+		}
+
+		err = add_commit_graph_entry(&entries, &nentries, &nalloc,
+		    &qid->id, commit);
+		got_object_qid_free(qid);
+		if (err) {
+			got_object_commit_close(commit);
+			goto done;
+		}
+
+		err = add_commit_graph_bloom_filter(&entries[nentries - 1],
+		    commit, cg, repo);
+		if (err) {
+			got_object_commit_close(commit);
+			goto done;
+		}
+
+		STAILQ_FOREACH(pid, got_object_commit_get_parent_ids(commit),
+		    entry) {
+			struct got_object_qid *new;
+
+			if (got_object_idset_contains(traversed, &pid->id))
+				continue;
+			err = got_object_qid_alloc(&new, &pid->id);
+			if (err)
+				break;
+			STAILQ_INSERT_TAIL(&ids, new, entry);
+		}
+		got_object_commit_close(commit);
+		if (err)
+			goto done;
+	}
+
+	if (nentries == 0)
+		goto done;
+
+	if (asprintf(&infodir, "%s/objects/info",
+	    got_repo_get_path_git_dir(repo)) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	if (mkdir(infodir, GOT_DEFAULT_DIR_MODE) == -1 && errno != EEXIST) {
+		err = got_error_from_errno2("mkdir", infodir);
+		goto done;
+	}
+
+	if (asprintf(&path, "%s/%s", got_repo_get_path_git_dir(repo),
+	    GOT_COMMIT_GRAPH_FILE) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	err = got_opentemp_named_fd(&tmppath, &fd, path, "");
+	if (err)
+		goto done;
+
+	err = got_commit_graph_file_write(fd, entries, nentries, repo->algo);
+	if (err)
+		goto done;
+
+	if (fchmod(fd, GOT_DEFAULT_PACK_MODE) == -1) {
+		err = got_error_from_errno2("fchmod", tmppath);
+		goto done;
+	}
+
+	if (close(fd) == -1) {
+		err = got_error_from_errno2("close", tmppath);
+		fd = -1;
+		goto done;
+	}
+	fd = -1;
+
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+
+	/* Make the new commit-graph file visible to this process. */
+	if (repo->commit_graph) {
+		err = got_commit_graph_file_close(repo->commit_graph);
+		repo->commit_graph = NULL;
+	}
+	repo->commit_graph_checked = 0;
+done:
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", tmppath);
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	for (i = 0; i < nentries; i++) {
+		free(entries[i].parent_ids);
+		free(entries[i].bloom);
+	}
+	free(entries);
+	got_object_id_queue_free(&ids);
+	got_object_idset_free(traversed);
+	got_ref_list_free(&refs);
+	free(infodir);
+	free(path);
+	free(tmppath);
+	return err;
+}
+
+const struct got_error *
+got_repo_write_pack_bitmap(struct got_repository *repo,
+    struct got_object_id *pack_hash, struct got_reflist_head *refs,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_packidx *packidx = NULL;
+	struct got_object_id **ids = NULL;
+	struct got_object_idset *shallow;
+	int nids = 0, i, fd = -1;
+	char *id_str = NULL, *relpath = NULL, *path = NULL, *tmppath = NULL;
+
+	/*
+	 * Like Git, do not write bitmaps in a shallow repository, where
+	 * history cannot be traversed beyond shallow commits. Existing
+	 * bitmaps are not used for packing objects in such repositories.
+	 */
+	err = got_repo_get_shallow_commits(&shallow, repo);
+	if (err)
+		return err;
+	if (shallow)
+		return NULL;
+
+	err = get_reflist_object_ids(&ids, &nids,
+	    (1 << GOT_OBJ_TYPE_COMMIT) | (1 << GOT_OBJ_TYPE_TAG),
+	    refs, repo, cancel_cb, cancel_arg);
+	if (err)
+		return err;
+	if (nids == 0)
+		goto done;
+
+	err = got_object_id_str(&id_str, pack_hash);
+	if (err)
+		goto done;
+
+	if (asprintf(&relpath, "%s/%s%s%s", GOT_OBJECTS_PACK_DIR,
+	    GOT_PACK_PREFIX, id_str, GOT_PACKIDX_SUFFIX) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	err = got_packidx_open(&packidx, got_repo_get_fd(repo), relpath, 0,
+	    repo->algo);
+	if (err)
+		goto done;
+
+	if (asprintf(&path, "%s/%s/%s%s%s", got_repo_get_path_git_dir(repo),
+	    GOT_OBJECTS_PACK_DIR, GOT_PACK_PREFIX, id_str,
+	    GOT_PACK_BITMAP_SUFFIX) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	err = got_opentemp_named_fd(&tmppath, &fd, path, "");
+	if (err)
+		goto done;
+
+	err = got_pack_bitmap_write(fd, packidx, ids, nids, repo,
+	    cancel_cb, cancel_arg);
+	if (err)
+		goto done;
+
+	if (fchmod(fd, GOT_DEFAULT_PACK_MODE) == -1) {
+		err = got_error_from_errno2("fchmod", tmppath);
+		goto done;
+	}
+
+	if (close(fd) == -1) {
+		err = got_error_from_errno2("close", tmppath);
+		fd = -1;
+		goto done;
+	}
+	fd = -1;
+
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+done:
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", tmppath);
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	if (packidx) {
+		const struct got_error *close_err;
+
+		close_err = got_packidx_close(packidx);
+		if (err == NULL)
+			err = close_err;
+	}
+	for (i = 0; i < nids; i++)
+		free(ids[i]);
+	free(ids);
+	free(id_str);
+	free(relpath);
+	free(path);
+	free(tmppath);
+	return err;
+}
+
+static int
+packidx_nobj_cmp(const void *pa, const void *pb)
+{
+	struct got_packidx *a = *(struct got_packidx **)pa;
+	struct got_packidx *b = *(struct got_packidx **)pb;
+	uint32_t na = be32toh(a->hdr.fanout_table[0xff]);
+	uint32_t nb = be32toh(b->hdr.fanout_table[0xff]);
+
+	/* Prefer big pack files. */
+	if (na > nb)
+		return -1;
+	if (na < nb)
+		return 1;
+	return strcmp(a->path_packidx, b->path_packidx);
+}
+
+const struct got_error *
+got_repo_write_multi_pack_index(struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_entry *pe;
+	struct got_packidx **packidx = NULL, *p;
+	const char **names = NULL, *name;
+	char *path = NULL, *tmppath = NULL;
+	int fd = -1;
+	size_t npacks = 0, nalloc = 0, i;
+
+	err = got_repo_list_packidx(&repo->packidx_paths, repo);
+	if (err)
+		return err;
+
+	RB_FOREACH(pe, got_pathlist_head, &repo->packidx_paths) {
+		if (cancel_cb) {
+			err = cancel_cb(cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		err = got_packidx_open(&p, got_repo_get_fd(repo), pe->path, 0,
+		    repo->algo);
+		if (err) {
+			/* Skip pack files which have been removed. */
+			if (err->code == GOT_ERR_LONELY_PACKIDX ||
+			    (err->code == GOT_ERR_ERRNO && errno == ENOENT)) {
+				err = NULL;
+				continue;
+			}
+			goto done;
+		}
+
+		if (npacks >= nalloc) {
+			struct got_packidx **new;
+			size_t newalloc = nalloc ? nalloc * 2 : 32;
+
+			new = reallocarray(packidx, newalloc, sizeof(*new));
+			if (new == NULL) {
+				err = got_error_from_errno("reallocarray");
+				got_packidx_close(p);
+				goto done;
+			}
+			packidx = new;
+			nalloc = newalloc;
+		}
+		packidx[npacks++] = p;
+	}
+
+	if (asprintf(&path, "%s/%s", got_repo_get_path_git_dir(repo),
+	    GOT_MIDX_FILE) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	if (npacks == 0) {
+		if (unlink(path) == -1 && errno != ENOENT)
+			err = got_error_from_errno2("unlink", path);
+		goto done;
+	}
+
+	qsort(packidx, npacks, sizeof(packidx[0]), packidx_nobj_cmp);
+
+	names = calloc(npacks, sizeof(*names));
+	if (names == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < npacks; i++) {
+		name = strrchr(packidx[i]->path_packidx, '/');
+		names[i] = name ? name + 1 : packidx[i]->path_packidx;
+	}
+
+	err = got_opentemp_named_fd(&tmppath, &fd, path, "");
+	if (err)
+		goto done;
+
+	err = got_multi_pack_index_write(fd, packidx, names, npacks,
+	    repo->algo);
+	if (err)
+		goto done;
+
+	if (fchmod(fd, GOT_DEFAULT_PACK_MODE) == -1) {
+		err = got_error_from_errno2("fchmod", tmppath);
+		goto done;
+	}
+
+	if (close(fd) == -1) {
+		err = got_error_from_errno2("close", tmppath);
+		fd = -1;
+		goto done;
+	}
+	fd = -1;
+
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+done:
+	/* Make the new multi-pack-index file visible to this process. */
+	if (repo->midx) {
+		const struct got_error *close_err;
+
+		close_err = got_multi_pack_index_close(repo->midx);
+		if (err == NULL)
+			err = close_err;
+		repo->midx = NULL;
+	}
+	repo->midx_checked = 0;
+	repo->midx_complete = -1;
+
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", tmppath);
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	for (i = 0; i < npacks; i++)
+		got_packidx_close(packidx[i]);
+	free(packidx);
+	free(names);
+	free(path);
+	free(tmppath);
+	return err;
+}
@@ -350,7 +350,7 @@ got_send_pack(const char *remote_name, struct got_pathlist_head *branch_names,
 	struct got_object_id **their_ids = NULL;
 	int nours = 0, ntheirs = 0;
 	size_t nalloc_ours = 0, nalloc_theirs = 0;
-	int refs_to_send = 0, refs_to_delete = 0;
+	int refs_to_send = 0, refs_to_delete = 0, allow_thin = 0;
 	off_t bytes_sent = 0, bytes_sent_cur = 0;
 	struct pack_progress_arg ppa;
 	struct got_object_id packhash;
@@ -502,7 +502,8 @@ got_send_pack(const char *remote_name, struct got_pathlist_head *branch_names,
 		goto done;
 	nsendfd = -1;
 
-	err = got_privsep_recv_send_remote_refs(&their_refs, &sendibuf);
+	err = got_privsep_recv_send_remote_refs(&their_refs, &allow_thin,
+	    &sendibuf);
 	if (err)
 		goto done;
 	/*
@@ -625,14 +626,19 @@ got_send_pack(const char *remote_name, struct got_pathlist_head *branch_names,
 
 	if (refs_to_send > 0) {
 		struct got_ratelimit rl;
+		struct got_object_idset *shallow;
 		got_ratelimit_init(&rl, 0, 500);
 		memset(&ppa, 0, sizeof(ppa));
 		ppa.progress_cb = progress_cb;
 		ppa.progress_arg = progress_arg;
 		ppa.sendfd = sendfd;
+		err = got_repo_get_shallow_commits(&shallow, repo);
+		if (err)
+			goto done;
 		err = got_pack_create(&packhash, packfd, delta_cache,
 		    their_ids, ntheirs, our_ids, nours, repo, 0, 1, 0,
-		    pack_progress, &ppa, &rl, cancel_cb, cancel_arg);
+		    allow_thin, shallow, NULL, NULL, 0, pack_progress, &ppa,
+		    &rl, cancel_cb, cancel_arg);
 		if (err)
 			goto done;
 
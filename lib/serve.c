@@ -56,17 +56,22 @@
  */
 static const int timeout = 60;
 
+/* Maximum number of ls-refs prefixes used for filtering the ref list. */
+#define GOT_SERVE_MAX_REF_PREFIXES	1024
+
 static const struct got_capability read_capabilities[] = {
 	{ GOT_CAPA_AGENT, "got/" GOT_VERSION_STR },
 	{ GOT_CAPA_OFS_DELTA, NULL },
 	{ GOT_CAPA_SIDE_BAND_64K, NULL },
+	{ GOT_CAPA_THIN_PACK, NULL },
+	{ GOT_CAPA_SHALLOW, NULL },
+	{ GOT_CAPA_FILTER, NULL },
 };
 
 static const struct got_capability write_capabilities[] = {
 	{ GOT_CAPA_AGENT, "got/" GOT_VERSION_STR },
 	{ GOT_CAPA_OFS_DELTA, NULL },
 	{ GOT_CAPA_REPORT_STATUS, NULL },
-	{ GOT_CAPA_NO_THIN, NULL },
 	{ GOT_CAPA_DELETE_REFS, NULL },
 };
 
@@ -171,9 +176,52 @@ echo_error(const struct got_error *err, int outfd, int chattygot)
 	got_pkt_writepkt(outfd, buf, len, chattygot);
 }
 
+/* A reference listed in response to the protocol version 2 ls-refs command. */
+struct ls_ref {
+	uint8_t id[SHA1_DIGEST_LENGTH];
+	char *target;	/* symbolic reference target, or NULL */
+};
+
+static const struct got_error *
+add_ls_ref(struct got_pathlist_head *refs, const char *name, size_t name_len,
+    uint8_t *id, const char *target, size_t target_len)
+{
+	const struct got_error *err;
+	struct got_pathlist_entry *new;
+	struct ls_ref *lsref;
+	char *refname;
+
+	refname = strndup(name, name_len);
+	if (refname == NULL)
+		return got_error_from_errno("strndup");
+
+	lsref = calloc(1, sizeof(*lsref) + (target ? target_len + 1 : 0));
+	if (lsref == NULL) {
+		err = got_error_from_errno("calloc");
+		free(refname);
+		return err;
+	}
+	memcpy(lsref->id, id, sizeof(lsref->id));
+	if (target) {
+		lsref->target = (char *)(lsref + 1);
+		memcpy(lsref->target, target, target_len);
+	}
+
+	err = got_pathlist_insert(&new, refs, refname, lsref);
+	if (err || new == NULL) {
+		free(refname);
+		free(lsref);
+	}
+	return err;
+}
+
+/*
+ * Announce references to the client. If refs is not NULL, collect
+ * references in this list instead, for use with protocol version 2.
+ */
 static const struct got_error *
 announce_refs(int outfd, struct imsgbuf *ibuf, int client_is_reading,
-    const char *repo_path, int chattygot)
+    const char *repo_path, struct got_pathlist_head *refs, int chattygot)
 {
 	const struct got_error *err = NULL;
 	struct imsg imsg;
@@ -224,7 +272,7 @@ announce_refs(int outfd, struct imsgbuf *ibuf, int client_is_reading,
 			memcpy(&ireflist, imsg.data, sizeof(ireflist));
 			nrefs = ireflist.nrefs;
 			have_nrefs = 1;
-			if (nrefs == 0)
+			if (nrefs == 0 && refs == NULL)
 				err = send_zero_refs(outfd, client_is_reading,
 				    chattygot);
 			break;
@@ -242,6 +290,15 @@ announce_refs(int outfd, struct imsgbuf *ibuf, int client_is_reading,
 				err = got_error(GOT_ERR_PRIVSEP_LEN);
 				goto done;
 			}
+			if (refs) {
+				err = add_ls_ref(refs, imsg.data + sizeof(iref),
+				    iref.name_len, iref.id, NULL, 0);
+				if (err)
+					goto done;
+				if (nrefs > 0)
+					nrefs--;
+				break;
+			}
 			refname = strndup(imsg.data + sizeof(iref),
 			    iref.name_len);
 			if (refname == NULL) {
@@ -275,6 +332,19 @@ announce_refs(int outfd, struct imsgbuf *ibuf, int client_is_reading,
 				goto done;
 			}
 
+			if (refs) {
+				err = add_ls_ref(refs,
+				    imsg.data + sizeof(isymref),
+				    isymref.name_len, isymref.target_id,
+				    imsg.data + sizeof(isymref) +
+				    isymref.name_len, isymref.target_len);
+				if (err)
+					goto done;
+				if (nrefs > 0)
+					nrefs--;
+				break;
+			}
+
 			/*
 			 * For now, we only announce one symbolic ref,
 			 * as part of our capability advertisement.
@@ -322,9 +392,8 @@ announce_refs(int outfd, struct imsgbuf *ibuf, int client_is_reading,
 		imsg_free(&imsg);
 	}
 
-	err = got_pkt_flushpkt(outfd, chattygot);
-	if (err)
-		goto done;
+	if (refs == NULL)
+		err = got_pkt_flushpkt(outfd, chattygot);
 done:
 	free(symrefstr);
 	free(symrefname);
@@ -382,6 +451,81 @@ done:
 	return err;
 }
 
+static const struct got_error *
+parse_shallow_line(uint8_t *id, char *buf, size_t len)
+{
+	char id_str[SHA1_DIGEST_STRING_LENGTH];
+
+	if (len > 0 && buf[len - 1] == '\n')
+		len--;
+	if (len != 8 + sizeof(id_str) - 1 || strncmp(buf, "shallow ", 8) != 0)
+		return got_error_msg(GOT_ERR_BAD_PACKET, "bad shallow-line");
+
+	memcpy(id_str, buf + 8, sizeof(id_str) - 1);
+	id_str[sizeof(id_str) - 1] = '\0';
+	if (!got_parse_hash_digest(id, id_str, GOT_HASH_SHA1))
+		return got_error_msg(GOT_ERR_BAD_PACKET,
+		    "shallow-line with bad object ID");
+
+	return NULL;
+}
+
+static const struct got_error *
+parse_deepen_line(int *depth, char *buf, size_t len)
+{
+	char num[16];
+	const char *errstr;
+
+	if (len > 0 && buf[len - 1] == '\n')
+		len--;
+	if (len <= 7 || len - 7 >= sizeof(num) ||
+	    strncmp(buf, "deepen ", 7) != 0)
+		return got_error_msg(GOT_ERR_BAD_PACKET, "bad deepen-line");
+
+	memcpy(num, buf + 7, len - 7);
+	num[len - 7] = '\0';
+	*depth = strtonum(num, 1, INT_MAX, &errstr);
+	if (errstr != NULL)
+		return got_error_msg(GOT_ERR_BAD_PACKET, "bad deepen-line");
+
+	return NULL;
+}
+
+static const struct got_error *
+parse_filter_line(char **spec, char *buf, size_t len)
+{
+	*spec = NULL;
+
+	if (len > 0 && buf[len - 1] == '\n')
+		len--;
+	if (len <= 7 || strncmp(buf, "filter ", 7) != 0)
+		return got_error_msg(GOT_ERR_BAD_PACKET, "bad filter-line");
+
+	*spec = strndup(buf + 7, len - 7);
+	if (*spec == NULL)
+		return got_error_from_errno("strndup");
+
+	return NULL;
+}
+
+static const struct got_error *
+append_id(uint8_t **ids, size_t *nids, size_t *nalloc, uint8_t *id)
+{
+	uint8_t *p;
+
+	if (*nids >= *nalloc) {
+		p = reallocarray(*ids, *nalloc + 64, SHA1_DIGEST_LENGTH);
+		if (p == NULL)
+			return got_error_from_errno("reallocarray");
+		*ids = p;
+		*nalloc += 64;
+	}
+
+	memcpy(*ids + *nids * SHA1_DIGEST_LENGTH, id, SHA1_DIGEST_LENGTH);
+	(*nids)++;
+	return NULL;
+}
+
 static const struct got_error *
 send_capability(struct got_capability *capa, struct imsgbuf *ibuf)
 {
@@ -501,44 +645,25 @@ recv_nak(struct imsg *imsg, uint8_t *expected_id)
 
 
 static const struct got_error *
-recv_want(int *use_sidebands, int outfd, struct imsgbuf *ibuf,
-    char *buf, size_t len, int expect_capabilities, int chattygot)
+send_want(struct imsgbuf *ibuf, uint8_t *id)
 {
 	const struct got_error *err;
 	struct gotd_imsg_want iwant;
-	char *capabilities_str;
 	int done = 0;
 	struct imsg imsg;
 
 	memset(&iwant, 0, sizeof(iwant));
 	memset(&imsg, 0, sizeof(imsg));
 
-	err = parse_want_line(&capabilities_str, iwant.object_id, buf, len);
-	if (err)
-		return err;
-
-	if (capabilities_str) {
-		if (!expect_capabilities) {
-			err = got_error_msg(GOT_ERR_BAD_PACKET,
-			    "unexpected capability announcement received");
-			goto done;
-		}
-		err = send_capabilities(use_sidebands, NULL, capabilities_str,
-		    ibuf);
-		if (err)
-			goto done;
-
-	}
+	memcpy(iwant.object_id, id, sizeof(iwant.object_id));
 
 	if (imsg_compose(ibuf, GOTD_IMSG_WANT, 0, 0, -1,
-	    &iwant, sizeof(iwant)) == -1) {
-		err = got_error_from_errno("imsg_compose WANT");
-		goto done;
-	}
+	    &iwant, sizeof(iwant)) == -1)
+		return got_error_from_errno("imsg_compose WANT");
 
 	err = gotd_imsg_flush(ibuf);
 	if (err)
-		goto done;
+		return err;
 
 	/*
 	 * Wait for an ACK, or an error in case the desired object
@@ -565,6 +690,38 @@ recv_want(int *use_sidebands, int outfd, struct imsgbuf *ibuf,
 
 		imsg_free(&imsg);
 	}
+
+	return err;
+}
+
+static const struct got_error *
+recv_want(int *use_sidebands, int outfd, struct imsgbuf *ibuf,
+    char *buf, size_t len, int expect_capabilities, int chattygot)
+{
+	const struct got_error *err;
+	struct gotd_imsg_want iwant;
+	char *capabilities_str;
+
+	memset(&iwant, 0, sizeof(iwant));
+
+	err = parse_want_line(&capabilities_str, iwant.object_id, buf, len);
+	if (err)
+		return err;
+
+	if (capabilities_str) {
+		if (!expect_capabilities) {
+			err = got_error_msg(GOT_ERR_BAD_PACKET,
+			    "unexpected capability announcement received");
+			goto done;
+		}
+		err = send_capabilities(use_sidebands, NULL, capabilities_str,
+		    ibuf);
+		if (err)
+			goto done;
+
+	}
+
+	err = send_want(ibuf, iwant.object_id);
 done:
 	free(capabilities_str);
 	return err;
@@ -600,21 +757,24 @@ send_nak(int outfd, int chattygot)
 	return got_pkt_writepkt(outfd, buf, len, chattygot);
 }
 
+/*
+ * Forward a have-line to gotd(8) and report whether the object
+ * is known to the server.
+ */
 static const struct got_error *
-recv_have(int *have_ack, int outfd, struct imsgbuf *ibuf, char *buf,
-    size_t len, int chattygot)
+send_have(int *acked, struct imsgbuf *ibuf, uint8_t *id)
 {
 	const struct got_error *err;
 	struct gotd_imsg_have ihave;
 	int done = 0;
 	struct imsg imsg;
 
+	*acked = 0;
+
 	memset(&ihave, 0, sizeof(ihave));
 	memset(&imsg, 0, sizeof(imsg));
 
-	err = parse_have_line(ihave.object_id, buf, len);
-	if (err)
-		return err;
+	memcpy(ihave.object_id, id, sizeof(ihave.object_id));
 
 	if (imsg_compose(ibuf, GOTD_IMSG_HAVE, 0, 0, -1,
 	    &ihave, sizeof(ihave)) == -1)
@@ -640,13 +800,7 @@ recv_have(int *have_ack, int outfd, struct imsgbuf *ibuf, char *buf,
 			err = recv_ack(&imsg, ihave.object_id);
 			if (err)
 				break;
-			if (!*have_ack) {
-				err = send_ack(outfd, ihave.object_id,
-				    chattygot);
-				if (err)
-					return err;
-				*have_ack = 1;
-			}
+			*acked = 1;
 			done = 1;
 			break;
 		case GOTD_IMSG_NAK:
@@ -666,6 +820,206 @@ recv_have(int *have_ack, int outfd, struct imsgbuf *ibuf, char *buf,
 	return err;
 }
 
+static const struct got_error *
+recv_have(int *have_ack, int outfd, struct imsgbuf *ibuf, char *buf,
+    size_t len, int chattygot)
+{
+	const struct got_error *err;
+	uint8_t id[SHA1_DIGEST_LENGTH];
+	int acked;
+
+	err = parse_have_line(id, buf, len);
+	if (err)
+		return err;
+
+	err = send_have(&acked, ibuf, id);
+	if (err)
+		return err;
+
+	if (acked && !*have_ack) {
+		err = send_ack(outfd, id, chattygot);
+		if (err)
+			return err;
+		*have_ack = 1;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+send_shallow(struct imsgbuf *ibuf, uint8_t *id)
+{
+	struct gotd_imsg_shallow ishallow;
+
+	memset(&ishallow, 0, sizeof(ishallow));
+	memcpy(ishallow.object_id, id, sizeof(ishallow.object_id));
+
+	if (imsg_compose(ibuf, GOTD_IMSG_SHALLOW, 0, 0, -1,
+	    &ishallow, sizeof(ishallow)) == -1)
+		return got_error_from_errno("imsg_compose SHALLOW");
+
+	return gotd_imsg_flush(ibuf);
+}
+
+static const struct got_error *
+send_deepen(struct imsgbuf *ibuf, int depth)
+{
+	struct gotd_imsg_deepen ideepen;
+
+	memset(&ideepen, 0, sizeof(ideepen));
+	ideepen.depth = depth;
+
+	if (imsg_compose(ibuf, GOTD_IMSG_DEEPEN, 0, 0, -1,
+	    &ideepen, sizeof(ideepen)) == -1)
+		return got_error_from_errno("imsg_compose DEEPEN");
+
+	return gotd_imsg_flush(ibuf);
+}
+
+static const struct got_error *
+send_filter(struct imsgbuf *ibuf, const char *spec)
+{
+	struct gotd_imsg_filter ifilter;
+	struct ibuf *wbuf;
+	size_t len = strlen(spec);
+
+	memset(&ifilter, 0, sizeof(ifilter));
+	ifilter.spec_len = len;
+
+	wbuf = imsg_create(ibuf, GOTD_IMSG_FILTER, 0, 0,
+	    sizeof(ifilter) + len);
+	if (wbuf == NULL)
+		return got_error_from_errno("imsg_create FILTER");
+	if (imsg_add(wbuf, &ifilter, sizeof(ifilter)) == -1)
+		return got_error_from_errno("imsg_add FILTER");
+	if (imsg_add(wbuf, spec, len) == -1)
+		return got_error_from_errno("imsg_add FILTER");
+	imsg_close(ibuf, wbuf);
+
+	return gotd_imsg_flush(ibuf);
+}
+
+/*
+ * Receive the commits which become shallow or unshallow on the client
+ * because of a deepen request. gotd(8) sends them once it has seen the
+ * flush packet which ends the client's list of want-lines.
+ */
+static const struct got_error *
+recv_shallow_info(uint8_t **shallow, size_t *nshallow, uint8_t **unshallow,
+    size_t *nunshallow, struct imsgbuf *ibuf)
+{
+	const struct got_error *err = NULL;
+	struct gotd_imsg_shallow ishallow;
+	struct imsg imsg;
+	size_t datalen, nshallow_alloc = 0, nunshallow_alloc = 0;
+	int done = 0;
+
+	*shallow = NULL;
+	*nshallow = 0;
+	*unshallow = NULL;
+	*nunshallow = 0;
+
+	while (!done && err == NULL) {
+		err = gotd_imsg_poll_recv(&imsg, ibuf, 0);
+		if (err)
+			break;
+
+		datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
+		switch (imsg.hdr.type) {
+		case GOTD_IMSG_ERROR:
+			err = gotd_imsg_recv_error(NULL, &imsg);
+			break;
+		case GOTD_IMSG_SHALLOW:
+		case GOTD_IMSG_UNSHALLOW:
+			if (datalen != sizeof(ishallow)) {
+				err = got_error(GOT_ERR_PRIVSEP_LEN);
+				break;
+			}
+			memcpy(&ishallow, imsg.data, sizeof(ishallow));
+			if (imsg.hdr.type == GOTD_IMSG_SHALLOW)
+				err = append_id(shallow, nshallow,
+				    &nshallow_alloc, ishallow.object_id);
+			else
+				err = append_id(unshallow, nunshallow,
+				    &nunshallow_alloc, ishallow.object_id);
+			break;
+		case GOTD_IMSG_DEEPEN_DONE:
+			done = 1;
+			break;
+		default:
+			err = got_error(GOT_ERR_PRIVSEP_MSG);
+			break;
+		}
+
+		imsg_free(&imsg);
+	}
+
+	if (err) {
+		free(*shallow);
+		*shallow = NULL;
+		*nshallow = 0;
+		free(*unshallow);
+		*unshallow = NULL;
+		*nunshallow = 0;
+	}
+	return err;
+}
+
+static const struct got_error *
+send_shallow_lines(int outfd, const char *prefix, uint8_t *ids, size_t nids,
+    int chattygot)
+{
+	const struct got_error *err;
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	char buf[GOT_PKT_MAX];
+	size_t i;
+	int len;
+
+	for (i = 0; i < nids; i++) {
+		if (got_sha1_digest_to_str(ids + i * SHA1_DIGEST_LENGTH,
+		    hex, sizeof(hex)) == NULL)
+			return got_error(GOT_ERR_BAD_OBJ_ID);
+
+		len = snprintf(buf, sizeof(buf), "%s %s\n", prefix, hex);
+		if (len < 0 || (size_t)len >= sizeof(buf))
+			return got_error(GOT_ERR_NO_SPACE);
+
+		err = got_pkt_writepkt(outfd, buf, len, chattygot);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+send_shallow_info(int outfd, struct imsgbuf *ibuf, int chattygot)
+{
+	const struct got_error *err;
+	uint8_t *shallow = NULL, *unshallow = NULL;
+	size_t nshallow, nunshallow;
+
+	err = recv_shallow_info(&shallow, &nshallow, &unshallow, &nunshallow,
+	    ibuf);
+	if (err)
+		return err;
+
+	err = send_shallow_lines(outfd, "shallow", shallow, nshallow,
+	    chattygot);
+	if (err)
+		goto done;
+	err = send_shallow_lines(outfd, "unshallow", unshallow, nunshallow,
+	    chattygot);
+	if (err)
+		goto done;
+
+	err = got_pkt_flushpkt(outfd, chattygot);
+done:
+	free(shallow);
+	free(unshallow);
+	return err;
+}
+
 static const struct got_error *
 recv_done(int *packfd, int outfd, struct imsgbuf *ibuf, int chattygot)
 {
@@ -777,28 +1131,70 @@ relay_progress_reports(struct imsgbuf *ibuf, int outfd, int chattygot)
 }
 
 static const struct got_error *
-serve_read(int infd, int outfd, int gotd_sock, const char *repo_path,
-    int chattygot)
+send_pack_data(int outfd, int packfd, int use_sidebands, int chattygot)
 {
 	const struct got_error *err = NULL;
 	char buf[GOT_PKT_MAX];
-	struct imsgbuf ibuf;
-	enum protostate {
-		STATE_EXPECT_WANT,
-		STATE_EXPECT_MORE_WANT,
-		STATE_EXPECT_HAVE_OR_DONE,
-		STATE_DONE,
-	};
-	enum protostate curstate = STATE_EXPECT_WANT;
-	int have_ack = 0, use_sidebands = 0, seen_have = 0;
-	int packfd = -1;
 	size_t pack_chunksize;
 
-	if (imsgbuf_init(&ibuf, gotd_sock) == -1)
-		return got_error_from_errno("imsgbuf_init");
-	imsgbuf_allow_fdpass(&ibuf);
+	if (use_sidebands)
+		pack_chunksize = GOT_SIDEBAND_64K_PACKFILE_DATA_MAX;
+	else
+		pack_chunksize = sizeof(buf);
+
+	for (;;) {
+		ssize_t r;
+
+		r = read(packfd, use_sidebands ? &buf[1] : buf,
+		    pack_chunksize);
+		if (r == -1) {
+			err = got_error_from_errno("read");
+			break;
+		} else if (r == 0) {
+			err = got_pkt_flushpkt(outfd, chattygot);
+			break;
+		}
+
+		if (use_sidebands) {
+			buf[0] = GOT_SIDEBAND_PACKFILE_DATA;
+			err = got_pkt_writepkt(outfd, buf, 1 + r, chattygot);
+			if (err)
+				break;
+		} else {
+			err = got_poll_write_full(outfd, buf, r);
+			if (err) {
+				if (err->code == GOT_ERR_EOF)
+					err = NULL;
+				break;
+			}
+		}
+	}
+
+	return err;
+}
 
-	err = announce_refs(outfd, &ibuf, 1, repo_path, chattygot);
+static const struct got_error *
+serve_read(int infd, int outfd, int gotd_sock, const char *repo_path,
+    int chattygot)
+{
+	const struct got_error *err = NULL;
+	char buf[GOT_PKT_MAX];
+	struct imsgbuf ibuf;
+	enum protostate {
+		STATE_EXPECT_WANT,
+		STATE_EXPECT_MORE_WANT,
+		STATE_EXPECT_HAVE_OR_DONE,
+		STATE_DONE,
+	};
+	enum protostate curstate = STATE_EXPECT_WANT;
+	int have_ack = 0, use_sidebands = 0;
+	int packfd = -1, depth = 0, have_filter = 0;
+
+	if (imsgbuf_init(&ibuf, gotd_sock) == -1)
+		return got_error_from_errno("imsgbuf_init");
+	imsgbuf_allow_fdpass(&ibuf);
+
+	err = announce_refs(outfd, &ibuf, 1, repo_path, NULL, chattygot);
 	if (err)
 		goto done;
 
@@ -846,6 +1242,12 @@ serve_read(int infd, int outfd, int gotd_sock, const char *repo_path,
 				if (err)
 					goto done;
 			}
+			if (curstate == STATE_EXPECT_MORE_WANT && depth > 0) {
+				err = send_shallow_info(outfd, &ibuf,
+				    chattygot);
+				if (err)
+					goto done;
+			}
 			if (curstate == STATE_EXPECT_HAVE_OR_DONE &&
 			    !have_ack) {
 				err = send_nak(outfd, chattygot);
@@ -867,6 +1269,49 @@ serve_read(int infd, int outfd, int gotd_sock, const char *repo_path,
 				goto done;
 			if (curstate == STATE_EXPECT_WANT)
 				curstate = STATE_EXPECT_MORE_WANT;
+		} else if (n >= 8 && strncmp(buf, "shallow ", 8) == 0) {
+			uint8_t id[SHA1_DIGEST_LENGTH];
+
+			if (curstate != STATE_EXPECT_MORE_WANT) {
+				err = got_error_msg(GOT_ERR_BAD_PACKET,
+				    "unexpected 'shallow' packet");
+				goto done;
+			}
+			err = parse_shallow_line(id, buf, n);
+			if (err)
+				goto done;
+			err = send_shallow(&ibuf, id);
+			if (err)
+				goto done;
+		} else if (n >= 7 && strncmp(buf, "deepen ", 7) == 0) {
+			if (curstate != STATE_EXPECT_MORE_WANT || depth > 0) {
+				err = got_error_msg(GOT_ERR_BAD_PACKET,
+				    "unexpected 'deepen' packet");
+				goto done;
+			}
+			err = parse_deepen_line(&depth, buf, n);
+			if (err)
+				goto done;
+			err = send_deepen(&ibuf, depth);
+			if (err)
+				goto done;
+		} else if (n >= 7 && strncmp(buf, "filter ", 7) == 0) {
+			char *spec;
+
+			if (curstate != STATE_EXPECT_MORE_WANT ||
+			    have_filter) {
+				err = got_error_msg(GOT_ERR_BAD_PACKET,
+				    "unexpected 'filter' packet");
+				goto done;
+			}
+			err = parse_filter_line(&spec, buf, n);
+			if (err)
+				goto done;
+			err = send_filter(&ibuf, spec);
+			free(spec);
+			if (err)
+				goto done;
+			have_filter = 1;
 		} else if (n >= 5 && strncmp(buf, "have ", 5) == 0) {
 			if (curstate != STATE_EXPECT_HAVE_OR_DONE) {
 				err = got_error_msg(GOT_ERR_BAD_PACKET,
@@ -877,7 +1322,6 @@ serve_read(int infd, int outfd, int gotd_sock, const char *repo_path,
 			    buf, n, chattygot);
 			if (err)
 				goto done;
-			seen_have = 1;
 		} else if (n == 5 && strncmp(buf, "done\n", 5) == 0) {
 			if (curstate != STATE_EXPECT_HAVE_OR_DONE) {
 				err = got_error_msg(GOT_ERR_BAD_PACKET,
@@ -895,7 +1339,7 @@ serve_read(int infd, int outfd, int gotd_sock, const char *repo_path,
 		}
 	}
 
-	if (!seen_have) {
+	if (!have_ack) {
 		err = send_nak(outfd, chattygot);
 		if (err)
 			goto done;
@@ -905,41 +1349,526 @@ serve_read(int infd, int outfd, int gotd_sock, const char *repo_path,
 		err = relay_progress_reports(&ibuf, outfd, chattygot);
 		if (err)
 			goto done;
-		pack_chunksize = GOT_SIDEBAND_64K_PACKFILE_DATA_MAX;
-	} else
-		pack_chunksize = sizeof(buf);
+	}
 
-	for (;;) {
-		ssize_t r;
+	err = send_pack_data(outfd, packfd, use_sidebands, chattygot);
+done:
+	imsgbuf_clear(&ibuf);
+	if (packfd != -1 && close(packfd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (err)
+		echo_error(err, outfd, chattygot);
+	return err;
+}
 
-		r = read(packfd, use_sidebands ? &buf[1] : buf,
-		    pack_chunksize);
-		if (r == -1) {
-			err = got_error_from_errno("read");
+static const struct got_error *
+send_capabilities_v2(int outfd, int chattygot)
+{
+	const struct got_error *err;
+	const char *capabilities[] = {
+		GOT_PROTOCOL_V2,
+		GOT_CAPA_AGENT "=got/" GOT_VERSION_STR,
+		GOT_CAPA_LS_REFS,
+		GOT_CAPA_FETCH "=" GOT_CAPA_SHALLOW " " GOT_CAPA_FILTER,
+		GOT_CAPA_OBJECT_FORMAT "=sha1",
+	};
+	char buf[GOT_PKT_MAX];
+	size_t i;
+	int len;
+
+	for (i = 0; i < nitems(capabilities); i++) {
+		len = snprintf(buf, sizeof(buf), "%s\n", capabilities[i]);
+		if (len < 0 || (size_t)len >= sizeof(buf))
+			return got_error(GOT_ERR_NO_SPACE);
+		err = got_pkt_writepkt(outfd, buf, len, chattygot);
+		if (err)
+			return err;
+	}
+
+	return got_pkt_flushpkt(outfd, chattygot);
+}
+
+/*
+ * Read a protocol version 2 pkt-line into a NUL-terminated buffer and
+ * strip the trailing newline, if any. A flush packet is returned as *n
+ * being zero.
+ */
+static const struct got_error *
+recv_line_v2(int *n, int *delim, char *buf, size_t bufsize, int infd,
+    int chattygot)
+{
+	const struct got_error *err;
+
+	if (delim)
+		*delim = 0;
+	buf[0] = '\0';
+
+	err = got_pkt_readpkt_v2(n, infd, buf, bufsize - 1, chattygot,
+	    timeout);
+	if (err)
+		return err;
+	if (*n == GOT_PKT_DELIM && delim) {
+		*delim = 1;
+		*n = 0;
+		return NULL;
+	}
+	if (*n < 0)
+		return got_error_msg(GOT_ERR_BAD_PACKET,
+		    "unexpected special packet received");
+
+	buf[*n] = '\0';
+	if (*n > 0 && buf[*n - 1] == '\n')
+		buf[*n - 1] = '\0';
+	return NULL;
+}
+
+/*
+ * Read the command and capabilities sent at the beginning of a protocol
+ * version 2 command request. Return a NULL command if the client has no
+ * further requests. Command arguments follow if *have_args is set.
+ */
+static const struct got_error *
+recv_command_v2(char **command, int *have_args, int infd, int chattygot)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX];
+	char *value;
+	int n, delim;
+
+	*command = NULL;
+	*have_args = 0;
+
+	err = recv_line_v2(&n, NULL, buf, sizeof(buf), infd, chattygot);
+	if (err)
+		return err;
+	if (n == 0)
+		return NULL;
+
+	if (strncmp(buf, "command=", 8) != 0 || buf[8] == '\0')
+		return got_error_msg(GOT_ERR_BAD_PACKET,
+		    "bad command request");
+	*command = strdup(buf + 8);
+	if (*command == NULL)
+		return got_error_from_errno("strdup");
+
+	for (;;) {
+		err = recv_line_v2(&n, &delim, buf, sizeof(buf), infd,
+		    chattygot);
+		if (err)
+			goto done;
+		if (delim) {
+			*have_args = 1;
 			break;
-		} else if (r == 0) {
-			err = got_pkt_flushpkt(outfd, chattygot);
+		}
+		if (n == 0)
 			break;
+
+		value = strchr(buf, '=');
+		if (value)
+			*value++ = '\0';
+		if (strcmp(buf, GOT_CAPA_OBJECT_FORMAT) == 0 &&
+		    (value == NULL || strcmp(value, "sha1") != 0)) {
+			err = got_error(GOT_ERR_OBJECT_FORMAT);
+			goto done;
 		}
+		/* Ignore other capabilities, such as the client's agent. */
+	}
+done:
+	if (err) {
+		free(*command);
+		*command = NULL;
+	}
+	return err;
+}
 
-		if (use_sidebands) {
-			buf[0] = GOT_SIDEBAND_PACKFILE_DATA;
-			err = got_pkt_writepkt(outfd, buf, 1 + r, chattygot);
+static int
+match_ref_prefix(const char *refname, struct got_pathlist_head *prefixes)
+{
+	struct got_pathlist_entry *pe;
+
+	RB_FOREACH(pe, got_pathlist_head, prefixes) {
+		if (strncmp(refname, pe->path, pe->path_len) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static const struct got_error *
+serve_ls_refs(int infd, int outfd, struct got_pathlist_head *refs,
+    int have_args, int chattygot)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_head prefixes;
+	struct got_pathlist_entry *pe, *new;
+	struct ls_ref *lsref;
+	char buf[GOT_PKT_MAX];
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	char *prefix;
+	int n, symrefs = 0, nprefixes = 0;
+
+	RB_INIT(&prefixes);
+
+	while (have_args) {
+		err = recv_line_v2(&n, NULL, buf, sizeof(buf), infd,
+		    chattygot);
+		if (err)
+			goto done;
+		if (n == 0)
+			break;
+
+		if (strcmp(buf, "symrefs") == 0)
+			symrefs = 1;
+		else if (strcmp(buf, "peel") == 0 ||
+		    strcmp(buf, "unborn") == 0)
+			continue; /* not supported; clients must cope */
+		else if (strncmp(buf, "ref-prefix ", 11) == 0) {
+			/* Like git(1), list all refs if there are too many. */
+			if (++nprefixes > GOT_SERVE_MAX_REF_PREFIXES)
+				continue;
+			prefix = strdup(buf + 11);
+			if (prefix == NULL) {
+				err = got_error_from_errno("strdup");
+				goto done;
+			}
+			err = got_pathlist_insert(&new, &prefixes, prefix,
+			    NULL);
+			if (err || new == NULL)
+				free(prefix);
 			if (err)
-				break;
+				goto done;
 		} else {
-			err = got_poll_write_full(outfd, buf, r);
-			if (err) {
-				if (err->code == GOT_ERR_EOF)
-					err = NULL;
-				break;
+			err = got_error_msg(GOT_ERR_BAD_PACKET,
+			    "unexpected ls-refs argument");
+			goto done;
+		}
+	}
+
+	RB_FOREACH(pe, got_pathlist_head, refs) {
+		lsref = pe->data;
+
+		if (nprefixes > 0 && nprefixes <= GOT_SERVE_MAX_REF_PREFIXES &&
+		    !match_ref_prefix(pe->path, &prefixes))
+			continue;
+
+		if (got_sha1_digest_to_str(lsref->id, hex,
+		    sizeof(hex)) == NULL) {
+			err = got_error(GOT_ERR_BAD_OBJ_ID);
+			goto done;
+		}
+
+		if (symrefs && lsref->target) {
+			n = snprintf(buf, sizeof(buf), "%s %s %s%s\n", hex,
+			    pe->path, GOT_LS_REFS_SYMREF_TARGET,
+			    lsref->target);
+		} else
+			n = snprintf(buf, sizeof(buf), "%s %s\n", hex,
+			    pe->path);
+		if (n < 0 || (size_t)n >= sizeof(buf)) {
+			err = got_error(GOT_ERR_NO_SPACE);
+			goto done;
+		}
+		err = got_pkt_writepkt(outfd, buf, n, chattygot);
+		if (err)
+			goto done;
+	}
+
+	err = got_pkt_flushpkt(outfd, chattygot);
+done:
+	got_pathlist_free(&prefixes, GOT_PATHLIST_FREE_PATH);
+	return err;
+}
+
+/*
+ * Serve the protocol version 2 fetch command. The client's arguments are
+ * translated into the sequence of want, have, and done messages which
+ * gotd(8) expects from protocol version 0 clients. We are ready to send a
+ * pack file once any of the client's haves has been acknowledged. Until
+ * then the client may announce more haves in further fetch commands, of
+ * which only the haves are passed on to gotd(8). Deepening requests are
+ * always answered in a single round.
+ */
+static const struct got_error *
+serve_fetch(int *pack_sent, int *negotiating, int infd, int outfd,
+    struct imsgbuf *ibuf, int have_args, int chattygot)
+{
+	const struct got_error *err = NULL;
+	char buf[GOT_PKT_MAX];
+	char *capabilities_str = NULL, *filter = NULL;
+	uint8_t id[SHA1_DIGEST_LENGTH];
+	uint8_t *wants = NULL, *haves = NULL, *shallows = NULL;
+	uint8_t *new_shallows = NULL, *unshallows = NULL;
+	size_t nwants = 0, nwants_alloc = 0, nhaves = 0, nhaves_alloc = 0;
+	size_t nshallows = 0, nshallows_alloc = 0;
+	size_t nnew_shallows = 0, nunshallows = 0;
+	size_t i;
+	int n, done = 0, thin = 0, ofs_delta = 0, no_progress = 0, depth = 0;
+	int acked, have_ack = 0, use_sidebands = 0, packfd = -1;
+
+	while (have_args) {
+		err = recv_line_v2(&n, NULL, buf, sizeof(buf), infd,
+		    chattygot);
+		if (err)
+			goto done;
+		if (n == 0)
+			break;
+
+		if (strncmp(buf, "want ", 5) == 0) {
+			err = parse_want_line(&capabilities_str, id, buf,
+			    strlen(buf));
+			if (err)
+				goto done;
+			if (capabilities_str) {
+				err = got_error_msg(GOT_ERR_BAD_PACKET,
+				    "bad want-line");
+				goto done;
+			}
+			err = append_id(&wants, &nwants, &nwants_alloc, id);
+		} else if (strncmp(buf, "have ", 5) == 0) {
+			err = parse_have_line(id, buf, strlen(buf));
+			if (err)
+				goto done;
+			err = append_id(&haves, &nhaves, &nhaves_alloc, id);
+		} else if (strncmp(buf, "shallow ", 8) == 0) {
+			err = parse_shallow_line(id, buf, strlen(buf));
+			if (err)
+				goto done;
+			err = append_id(&shallows, &nshallows,
+			    &nshallows_alloc, id);
+		} else if (strncmp(buf, "deepen ", 7) == 0) {
+			if (depth > 0) {
+				err = got_error_msg(GOT_ERR_BAD_PACKET,
+				    "unexpected fetch argument");
+				goto done;
+			}
+			err = parse_deepen_line(&depth, buf, strlen(buf));
+		} else if (strncmp(buf, "filter ", 7) == 0) {
+			if (filter != NULL) {
+				err = got_error_msg(GOT_ERR_BAD_PACKET,
+				    "unexpected fetch argument");
+				goto done;
+			}
+			err = parse_filter_line(&filter, buf, strlen(buf));
+		} else if (strcmp(buf, "done") == 0)
+			done = 1;
+		else if (strcmp(buf, GOT_CAPA_THIN_PACK) == 0)
+			thin = 1;
+		else if (strcmp(buf, GOT_CAPA_OFS_DELTA) == 0)
+			ofs_delta = 1;
+		else if (strcmp(buf, "no-progress") == 0)
+			no_progress = 1;
+		else if (strcmp(buf, "include-tag") == 0)
+			continue; /* tags are fetched via ls-refs */
+		else {
+			err = got_error_msg(GOT_ERR_BAD_PACKET,
+			    "unexpected fetch argument");
+		}
+		if (err)
+			goto done;
+	}
+
+	*pack_sent = 0;
+
+	if (nwants == 0) {
+		err = got_error_msg(GOT_ERR_BAD_PACKET,
+		    "no want-lines received");
+		goto done;
+	}
+
+	/* Arguments other than haves were passed on in the first round. */
+	if (*negotiating)
+		goto haves;
+
+	/* Progress reports require side-band-64k in gotd(8). */
+	if (asprintf(&capabilities_str, "%s=got/%s%s%s%s", GOT_CAPA_AGENT,
+	    GOT_VERSION_STR, no_progress ? "" : " " GOT_CAPA_SIDE_BAND_64K,
+	    ofs_delta ? " " GOT_CAPA_OFS_DELTA : "",
+	    thin ? " " GOT_CAPA_THIN_PACK : "") == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	err = send_capabilities(&use_sidebands, NULL, capabilities_str, ibuf);
+	if (err)
+		goto done;
+
+	for (i = 0; i < nwants; i++) {
+		err = send_want(ibuf, wants + i * SHA1_DIGEST_LENGTH);
+		if (err)
+			goto done;
+	}
+
+	for (i = 0; i < nshallows; i++) {
+		err = send_shallow(ibuf, shallows + i * SHA1_DIGEST_LENGTH);
+		if (err)
+			goto done;
+	}
+
+	if (depth > 0) {
+		err = send_deepen(ibuf, depth);
+		if (err)
+			goto done;
+	}
+
+	if (filter) {
+		err = send_filter(ibuf, filter);
+		if (err)
+			goto done;
+	}
+
+	err = forward_flushpkt(ibuf);
+	if (err)
+		goto done;
+
+	if (depth > 0) {
+		err = recv_shallow_info(&new_shallows, &nnew_shallows,
+		    &unshallows, &nunshallows, ibuf);
+		if (err)
+			goto done;
+	}
+
+haves:
+	if (!done) {
+		n = strlcpy(buf, "acknowledgments\n", sizeof(buf));
+		err = got_pkt_writepkt(outfd, buf, n, chattygot);
+		if (err)
+			goto done;
+	}
+
+	for (i = 0; i < nhaves; i++) {
+		err = send_have(&acked, ibuf, haves + i * SHA1_DIGEST_LENGTH);
+		if (err)
+			goto done;
+		if (acked && !done) {
+			err = send_ack(outfd, haves + i * SHA1_DIGEST_LENGTH,
+			    chattygot);
+			if (err)
+				goto done;
+			have_ack = 1;
+		}
+	}
+
+	if (!done) {
+		if (!have_ack) {
+			err = send_nak(outfd, chattygot);
+			if (err)
+				goto done;
+			if (nhaves > 0 && depth == 0) {
+				/* Wait for the client to send more haves. */
+				*negotiating = 1;
+				err = got_pkt_flushpkt(outfd, chattygot);
+				goto done;
 			}
 		}
+		n = strlcpy(buf, "ready\n", sizeof(buf));
+		err = got_pkt_writepkt(outfd, buf, n, chattygot);
+		if (err)
+			goto done;
+		err = got_pkt_delimpkt(outfd, chattygot);
+		if (err)
+			goto done;
+	}
+
+	if (depth > 0) {
+		n = strlcpy(buf, "shallow-info\n", sizeof(buf));
+		err = got_pkt_writepkt(outfd, buf, n, chattygot);
+		if (err)
+			goto done;
+		err = send_shallow_lines(outfd, "shallow", new_shallows,
+		    nnew_shallows, chattygot);
+		if (err)
+			goto done;
+		err = send_shallow_lines(outfd, "unshallow", unshallows,
+		    nunshallows, chattygot);
+		if (err)
+			goto done;
+		err = got_pkt_delimpkt(outfd, chattygot);
+		if (err)
+			goto done;
 	}
+
+	err = recv_done(&packfd, outfd, ibuf, chattygot);
+	if (err)
+		goto done;
+
+	n = strlcpy(buf, "packfile\n", sizeof(buf));
+	err = got_pkt_writepkt(outfd, buf, n, chattygot);
+	if (err)
+		goto done;
+
+	if (use_sidebands) {
+		err = relay_progress_reports(ibuf, outfd, chattygot);
+		if (err)
+			goto done;
+	}
+
+	/* Protocol version 2 always uses side-band framing for pack data. */
+	err = send_pack_data(outfd, packfd, 1, chattygot);
+	if (err == NULL)
+		*pack_sent = 1;
 done:
-	imsgbuf_clear(&ibuf);
+	free(capabilities_str);
+	free(filter);
+	free(wants);
+	free(haves);
+	free(shallows);
+	free(new_shallows);
+	free(unshallows);
 	if (packfd != -1 && close(packfd) == -1 && err == NULL)
 		err = got_error_from_errno("close");
+	return err;
+}
+
+static const struct got_error *
+serve_read_v2(int infd, int outfd, int gotd_sock, const char *repo_path,
+    int chattygot)
+{
+	const struct got_error *err = NULL;
+	struct imsgbuf ibuf;
+	struct got_pathlist_head refs;
+	char *command = NULL;
+	int have_args, pack_sent = 0, negotiating = 0;
+
+	RB_INIT(&refs);
+
+	if (imsgbuf_init(&ibuf, gotd_sock) == -1)
+		return got_error_from_errno("imsgbuf_init");
+	imsgbuf_allow_fdpass(&ibuf);
+
+	err = announce_refs(outfd, &ibuf, 1, repo_path, &refs, chattygot);
+	if (err)
+		goto done;
+
+	err = send_capabilities_v2(outfd, chattygot);
+	if (err)
+		goto done;
+
+	for (;;) {
+		err = recv_command_v2(&command, &have_args, infd, chattygot);
+		if (err || command == NULL)
+			break;
+
+		if (strcmp(command, GOT_CAPA_LS_REFS) == 0) {
+			err = serve_ls_refs(infd, outfd, &refs, have_args,
+			    chattygot);
+		} else if (strcmp(command, GOT_CAPA_FETCH) == 0) {
+			err = serve_fetch(&pack_sent, &negotiating, infd,
+			    outfd, &ibuf, have_args, chattygot);
+			/* gotd(8) sends one pack file per session. */
+			if (err || pack_sent)
+				break;
+		} else
+			err = got_error_msg(GOT_ERR_BAD_PACKET,
+			    "unknown command");
+		if (err)
+			break;
+
+		free(command);
+		command = NULL;
+	}
+done:
+	free(command);
+	got_pathlist_free(&refs, GOT_PATHLIST_FREE_ALL);
+	imsgbuf_clear(&ibuf);
 	if (err)
 		echo_error(err, outfd, chattygot);
 	return err;
@@ -1272,7 +2201,7 @@ serve_write(int infd, int outfd, int gotd_sock, const char *repo_path,
 
 	memset(&imsg, 0, sizeof(imsg));
 
-	err = announce_refs(outfd, &ibuf, 0, repo_path, chattygot);
+	err = announce_refs(outfd, &ibuf, 0, repo_path, NULL, chattygot);
 	if (err)
 		goto done;
 
@@ -1395,11 +2324,14 @@ done:
 
 const struct got_error *
 got_serve(int infd, int outfd, const char *command, const char *repo_path,
-    int gotd_sock, int chattygot)
+    int gotd_sock, int protocol_version, int chattygot)
 {
 	const struct got_error *err = NULL;
 
-	if (strcmp(command, GOT_DIAL_CMD_FETCH) == 0)
+	if (strcmp(command, GOT_DIAL_CMD_FETCH) == 0 && protocol_version == 2)
+		err = serve_read_v2(infd, outfd, gotd_sock, repo_path,
+		    chattygot);
+	else if (strcmp(command, GOT_DIAL_CMD_FETCH) == 0)
 		err = serve_read(infd, outfd, gotd_sock, repo_path, chattygot);
 	else if (strcmp(command, GOT_DIAL_CMD_SEND) == 0)
 		err = serve_write(infd, outfd, gotd_sock, repo_path,
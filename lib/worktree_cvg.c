@@ -2800,7 +2800,8 @@ fetch_updated_remote(const char *proto, const char *host, const char *port,
 
 	err = got_fetch_pack(&pack_hash, &learned_refs, &symrefs,
 	    remote->name, 1, 0, &wanted_branches, &wanted_refs, 0, verbosity,
-	    fetchfd, repo, head_refname, NULL, 0, fetch_progress, &fpa);
+	    fetchfd, proto, repo, head_refname, NULL, 0, 0, NULL,
+	    fetch_progress, &fpa);
 	if (err)
 		goto done;
 
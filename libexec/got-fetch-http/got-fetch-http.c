@@ -36,6 +36,7 @@
 #include "got_path.h"
 #include "got_version.h"
 
+#include "got_lib_dial.h"
 #include "got_lib_pkt.h"
 
 #include "bufio.h"
@@ -44,6 +45,10 @@
 #define UPLOAD_PACK_REQ "application/x-git-upload-pack-request"
 #define UPLOAD_PACK_RES "application/x-git-upload-pack-result"
 
+/* The "done" line which ends negotiation, and its pkt-line length. */
+#define DONE_PKT	"done\n"
+#define DONE_PKT_LEN	(4 + sizeof(DONE_PKT) - 1)
+
 #define	GOT_USERAGENT	"got/" GOT_VERSION_STR
 #define MINIMUM(a, b)	((a) < (b) ? (a) : (b))
 #define hasprfx(str, p)	(strncasecmp(str, p, strlen(p)) == 0)
@@ -51,6 +56,7 @@
 FILE *tmp;
 
 static int	verbose;
+static int	protocol_v2;
 
 static char *
 bufio_getdelim_sync(struct bufio *bio, const char *nl, size_t *len)
@@ -178,8 +184,9 @@ http_open(struct bufio *bio, int https, const char *method, const char *host, co
 	    "Host: %s\r\n"
 	    "Connection: close\r\n"
 	    "User-agent: %s\r\n"
+	    "Git-Protocol: %s\r\n"
 	    "%s%s%s\r\n",
-	    method, p, host, GOT_USERAGENT,
+	    method, p, host, GOT_USERAGENT, GOT_DIAL_PROTOCOL_V2,
 	    chdr ? chdr : "", ctype ? ctype : "", te);
 	if (r == -1)
 		err(1, "asprintf");
@@ -321,6 +328,61 @@ http_read(struct bufio *bio, int chunked, size_t *chunksz, char *buf, size_t buf
 	return ret;
 }
 
+static ssize_t
+http_read_full(struct bufio *bio, int chunked, size_t *chunksz, char *buf,
+    size_t bufsz)
+{
+	ssize_t		 r, ret = 0;
+
+	while (bufsz > 0) {
+		r = http_read(bio, chunked, chunksz, buf, bufsz);
+		if (r == -1)
+			return -1;
+		if (r == 0)
+			break;
+		ret += r;
+		buf += r;
+		bufsz -= r;
+	}
+
+	return ret;
+}
+
+/*
+ * Read a pkt-line from the server, including its header.
+ * Return the length of the pkt-line, or zero for a flush packet.
+ */
+static int
+http_read_pkt(struct bufio *bio, int chunked, size_t *chunksz, char *buf,
+    size_t bufsz)
+{
+	const struct got_error	*e;
+	ssize_t			 r;
+	int			 len;
+
+	r = http_read_full(bio, chunked, chunksz, buf, 4);
+	if (r != 4)
+		return -1;
+
+	e = got_pkt_readlen(&len, buf, verbose);
+	if (e) {
+		warnx("%s", e->msg);
+		return -1;
+	}
+	if (len == 0)
+		return 0;
+	if (len <= 4 || len > bufsz) {
+		warnx("bad pktline length");
+		return -1;
+	}
+
+	r = http_read_full(bio, chunked, chunksz, buf + 4, len - 4);
+	if (r != len - 4)
+		return -1;
+
+	return len;
+}
+
 static int
 http_chunk(struct bufio *bio, const void *buf, size_t len)
 {
@@ -345,10 +407,9 @@ get_refs(int https, const char *host, const char *port, const char *path)
 {
 	struct bufio		 bio;
 	char			 buf[GOT_PKT_MAX];
-	const struct got_error	*e;
 	size_t			 chunksz = 0;
 	ssize_t			 r;
-	int			 skip;
+	int			 len;
 	int			 chunked;
 	int			 sock;
 	int			 ret = -1;
@@ -374,26 +435,31 @@ get_refs(int https, const char *host, const char *port, const char *path)
 	if (http_parse_reply(&bio, &chunked, UPLOAD_PACK_ADV) == -1)
 		goto err;
 
-	/* skip first pack; why git over http is like this? */
-	r = http_read(&bio, chunked, &chunksz, buf, 4);
-	if (r <= 0)
-		goto err;
-
-	e = got_pkt_readlen(&skip, buf, verbose);
-	if (e) {
-		warnx("%s", e->msg);
+	len = http_read_pkt(&bio, chunked, &chunksz, buf, sizeof(buf));
+	if (len <= 0)
 		goto err;
-	}
 
-	/* TODO: validate it's # service=git-upload-pack\n */
-	while (skip > 0) {
-		r = http_read(&bio, chunked, &chunksz, buf,
-		    MINIMUM(skip, sizeof(buf)));
-		if (r <= 0)
+	/*
+	 * Skip the "# service=git-upload-pack" line and the flush packet
+	 * which follows it. Servers speaking protocol version 2 may omit
+	 * this line.
+	 */
+	if (len - 4 >= 10 && strncmp(buf + 4, "# service=", 10) == 0) {
+		if (http_read_pkt(&bio, chunked, &chunksz, buf,
+		    sizeof(buf)) != 0)
 			goto err;
-		skip -= r;
+		len = http_read_pkt(&bio, chunked, &chunksz, buf,
+		    sizeof(buf));
+		if (len == -1)
+			goto err;
+		if (len == 0)
+			memcpy(buf, "0000", 4);
 	}
 
+	if (len - 4 >= 9 && strncmp(buf + 4, "version 2", 9) == 0)
+		protocol_v2 = 1;
+	fwrite(buf, 1, len == 0 ? 4 : len, stdout);
+
 	for (;;) {
 		r = http_read(&bio, chunked, &chunksz, buf, sizeof(buf));
 		if (r == -1)
@@ -413,20 +479,62 @@ err:
 	return ret;
 }
 
+/*
+ * Read a pkt-line generated by got-fetch-pack, including its header.
+ * Flush and delimiter packets are returned as length 0 and 1.
+ */
+static int
+read_pkt(FILE *in, char *buf, int *len)
+{
+	const struct got_error	*e;
+	ssize_t			 r;
+	int			 t;
+
+	r = fread(buf, 1, 4, in);
+	if (r != 4)
+		return -1;
+
+	e = got_pkt_readlen(&t, buf, verbose);
+	if (e) {
+		warnx("%s", e->msg);
+		return -1;
+	}
+
+	if (t == 0 || (t == 1 && protocol_v2)) {
+		*len = t;
+		return 0;
+	}
+
+	if (t < 6) {
+		warnx("pktline len is too small");
+		return -1;
+	}
+
+	r = fread(buf + 4, 1, t - 4, in);
+	if (r != t - 4)
+		return -1;
+
+	*len = t;
+	return 0;
+}
+
 static int
 upload_request(int https, const char *host, const char *port, const char *path,
     FILE *in)
 {
 	struct bufio		 bio;
 	char			 buf[GOT_PKT_MAX];
-	const struct got_error	*e;
 	ssize_t			 r;
 	size_t			 chunksz = 0;
 	int			 t;
 	int			 chunked;
 	int			 sock;
+	int			 sent_done = 0;
 	int			 ret = -1;
 
+	if (read_pkt(in, buf, &t) == -1)
+		return -1;
+
 	if ((sock = dial(https, host, port)) == -1)
 		return -1;
 
@@ -439,11 +547,6 @@ upload_request(int https, const char *host, const char *port, const char *path,
 		warnx("bufio_starttls");
 		goto err;
 	}
-#ifndef PROFILE
-	/* TODO: can we push this upwards such that get_refs() is covered? */
-	if (pledge("stdio", NULL) == -1)
-		err(1, "pledge");
-#endif
 	if (http_open(&bio, https, "POST", host, port, path, "git-upload-pack",
 	    NULL, UPLOAD_PACK_REQ) == -1)
 		goto err;
@@ -453,50 +556,57 @@ upload_request(int https, const char *host, const char *port, const char *path,
 	 * them to the server in the POST request body.
 	 */
 	for (;;) {
-		r = fread(buf, 1, 4, in);
-		if (r != 4)
-			goto err;
-
-		e = got_pkt_readlen(&t, buf, verbose);
-		if (e) {
-			warnx("%s", e->msg);
-			goto err;
-		}
-
 		if (t == 0) {
 			const char *flushpkt = "0000";
 			if (http_chunk(&bio, flushpkt, strlen(flushpkt)))
 				goto err;
-			continue; /* got-fetch-pack will send "done" */
-		}
+			/* A version 2 command request ends with a flush. */
+			if (protocol_v2) {
+				if (http_chunk(&bio, NULL, 0))
+					goto err;
+				break;
+			}
+			/* got-fetch-pack will send "done" */
+		} else if (t == 1) {
+			const char *delimpkt = "0001";
+			if (http_chunk(&bio, delimpkt, strlen(delimpkt)))
+				goto err;
+		} else {
+			if (http_chunk(&bio, buf, t))
+				goto err;
 
-		if (t < 6) {
-			warnx("pktline len is too small");
-			goto err;
+			/*
+			 * Once got-fetch-pack is done the server will
+			 * send pack file data.
+			 */
+			if (t == DONE_PKT_LEN &&
+			    strncmp(buf + 4, DONE_PKT, t - 4) == 0) {
+				sent_done = 1;
+				if (!protocol_v2) {
+					if (http_chunk(&bio, NULL, 0))
+						goto err;
+					break;
+				}
+			}
 		}
 
-		r = fread(buf + 4, 1, t - 4, in);
-		if (r != t - 4)
-			goto err;
-
-		if (http_chunk(&bio, buf, t))
+		if (read_pkt(in, buf, &t) == -1)
 			goto err;
-
-		/*
-		 * Once got-fetch-pack is done the server will
-		 * send pack file data.
-		 */
-		if (t == 9 && strncmp(buf + 4, "done\n", 5) == 0) {
-			if (http_chunk(&bio, NULL, 0))
-				goto err;
-			break;
-		}
 	}
 
+#ifndef PROFILE
+	/*
+	 * TODO: can we push this upwards such that get_refs() is covered?
+	 * No further requests will be made once "done" has been sent.
+	 */
+	if (sent_done && pledge("stdio", NULL) == -1)
+		err(1, "pledge");
+#endif
+
 	if (http_parse_reply(&bio, &chunked, UPLOAD_PACK_RES) == -1)
 		goto err;
 
-	/* Fetch pack file data from server. */
+	/* Fetch the response, such as pack file data, from server. */
 	for (;;) {
 		r = http_read(&bio, chunked, &chunksz, buf, sizeof(buf));
 		if (r == -1)
@@ -508,6 +618,7 @@ upload_request(int https, const char *host, const char *port, const char *path,
 		fwrite(buf, 1, r, stdout);
 	}
 
+	fflush(stdout);
 	ret = 0;
 err:
 	bufio_close_sync(&bio);
@@ -585,14 +696,20 @@ main(int argc, char **argv)
 	if (poll(&pfd, 1, INFTIM) == -1)
 		err(1, "poll");
 
-	if ((ch = fgetc(stdin)) == EOF)
-		return 0;
+	/*
+	 * With protocol version 2 got-fetch-pack sends one request per
+	 * command, each of which is made via a separate POST request.
+	 */
+	do {
+		if ((ch = fgetc(stdin)) == EOF)
+			return 0;
 
-	ungetc(ch, stdin);
-	if (upload_request(https, host, port, path, stdin) == -1) {
-		fflush(tmp);
-		errx(1, "failed to upload request");
-	}
+		ungetc(ch, stdin);
+		if (upload_request(https, host, port, path, stdin) == -1) {
+			fflush(tmp);
+			errx(1, "failed to upload request");
+		}
+	} while (protocol_v2);
 
 	return 0;
 }
@@ -69,6 +69,10 @@ static const struct got_capability got_capabilities[] = {
 	{ GOT_CAPA_AGENT, "got/" GOT_VERSION_STR },
 	{ GOT_CAPA_OFS_DELTA, NULL },
 	{ GOT_CAPA_SIDE_BAND_64K, NULL },
+	{ GOT_CAPA_THIN_PACK, NULL },
+	{ GOT_CAPA_SHALLOW, NULL },
+	{ GOT_CAPA_FILTER, NULL },
+	{ GOT_CAPA_MULTI_ACK_DETAILED, NULL },
 };
 
 static void
@@ -328,28 +332,810 @@ done:
 	return err;
 }
 
+static const struct got_error *
+send_shallow_request(int fd, int depth, struct got_object_id *shallow,
+    size_t nshallow)
+{
+	const struct got_error *err;
+	char buf[64];
+	char hashstr[SHA1_DIGEST_STRING_LENGTH];
+	size_t i;
+	int n;
+
+	for (i = 0; i < nshallow; i++) {
+		got_object_id_hex(&shallow[i], hashstr, sizeof(hashstr));
+		n = snprintf(buf, sizeof(buf), "shallow %s\n", hashstr);
+		if (n < 0 || (size_t)n >= sizeof(buf))
+			return got_error(GOT_ERR_NO_SPACE);
+		err = got_pkt_writepkt(fd, buf, n, chattygot);
+		if (err)
+			return err;
+	}
+
+	if (depth > 0) {
+		n = snprintf(buf, sizeof(buf), "deepen %d\n", depth);
+		if (n < 0 || (size_t)n >= sizeof(buf))
+			return got_error(GOT_ERR_NO_SPACE);
+		err = got_pkt_writepkt(fd, buf, n, chattygot);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+send_want(int fd, struct got_object_id *id, const char *capabilities)
+{
+	char buf[GOT_PKT_MAX];
+	char hashstr[SHA1_DIGEST_STRING_LENGTH];
+	int n;
+
+	got_object_id_hex(id, hashstr, sizeof(hashstr));
+	n = snprintf(buf, sizeof(buf), "want %s%s\n", hashstr,
+	    capabilities == NULL ? "" : capabilities);
+	if (n < 0 || (size_t)n >= sizeof(buf))
+		return got_error(GOT_ERR_NO_SPACE);
+
+	return got_pkt_writepkt(fd, buf, n, chattygot);
+}
+
+/*
+ * Parse a "shallow" or "unshallow" line sent by the server and pass
+ * the new shallow state of the commit on to the parent process.
+ */
+static const struct got_error *
+recv_shallow_update(struct imsgbuf *ibuf, char *buf, int n)
+{
+	struct got_imsg_fetch_shallow_update iupdate;
+	char *id_str;
+
+	memset(&iupdate, 0, sizeof(iupdate));
+
+	if (n > 0 && buf[n - 1] == '\n')
+		n--;
+	buf[n] = '\0';
+
+	if (strncmp(buf, "shallow ", 8) == 0)
+		id_str = buf + 8;
+	else if (strncmp(buf, "unshallow ", 10) == 0) {
+		id_str = buf + 10;
+		iupdate.unshallow = 1;
+	} else
+		return got_error_msg(GOT_ERR_BAD_PACKET,
+		    "unexpected message from server");
+
+	if (!got_parse_object_id(&iupdate.id, id_str, GOT_HASH_SHA1))
+		return got_error_msg(GOT_ERR_BAD_PACKET,
+		    "bad object ID in shallow packet from server");
+
+	if (imsg_compose(ibuf, GOT_IMSG_FETCH_SHALLOW_UPDATE, 0, 0, -1,
+	    &iupdate, sizeof(iupdate)) == -1)
+		return got_error_from_errno("imsg_compose FETCH_SHALLOW_UPDATE");
+
+	return got_privsep_flush_imsg(ibuf);
+}
+
+/*
+ * Receive the list of new shallow commits which a protocol v0 server
+ * announces in response to a depth request.
+ */
+static const struct got_error *
+recv_shallow_updates(int fd, struct imsgbuf *ibuf)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX];
+	int n;
+
+	for (;;) {
+		err = got_pkt_readpkt(&n, fd, buf, sizeof(buf) - 1,
+		    chattygot, INFTIM);
+		if (err)
+			return err;
+		if (n == 0)
+			break;
+		if (n >= 4 && strncmp(buf, "ERR ", 4) == 0)
+			return fetch_error(&buf[4], n - 4);
+		err = recv_shallow_update(ibuf, buf, n);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+static int
+has_value(const char *values, const char *value)
+{
+	size_t len = strlen(value);
+	const char *p = values;
+
+	while ((p = strstr(p, value)) != NULL) {
+		if ((p == values || p[-1] == ' ') &&
+		    (p[len] == '\0' || p[len] == ' '))
+			return 1;
+		p += len;
+	}
+
+	return 0;
+}
+
+static const struct got_error *
+recv_capabilities_v2(int *object_format, int *fetch_shallow, int *fetch_filter,
+    int fd)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX + 1];
+	char *key, *value;
+	int n, have_ls_refs = 0, have_fetch = 0;
+
+	*object_format = 0;
+	*fetch_shallow = 0;
+	*fetch_filter = 0;
+
+	for (;;) {
+		err = got_pkt_readpkt(&n, fd, buf, sizeof(buf) - 1,
+		    chattygot, INFTIM);
+		if (err)
+			return err;
+		if (n == 0)
+			break;
+		buf[n] = '\0';
+		if (buf[n - 1] == '\n')
+			buf[n - 1] = '\0';
+		if (chattygot)
+			fprintf(stderr, "%s: server capability: %s\n",
+			    getprogname(), buf);
+
+		key = buf;
+		value = strchr(buf, '=');
+		if (value)
+			*value++ = '\0';
+
+		if (strcmp(key, GOT_CAPA_LS_REFS) == 0)
+			have_ls_refs = 1;
+		else if (strcmp(key, GOT_CAPA_FETCH) == 0) {
+			have_fetch = 1;
+			if (value && has_value(value, GOT_CAPA_SHALLOW))
+				*fetch_shallow = 1;
+			if (value && has_value(value, GOT_CAPA_FILTER))
+				*fetch_filter = 1;
+		}
+		else if (strcmp(key, GOT_CAPA_OBJECT_FORMAT) == 0) {
+			if (value == NULL || strcmp(value, "sha1") != 0)
+				return got_error(GOT_ERR_OBJECT_FORMAT);
+			*object_format = 1;
+		}
+	}
+
+	if (!have_ls_refs || !have_fetch)
+		return got_error_msg(GOT_ERR_BAD_PACKET,
+		    "server does not support the ls-refs and fetch commands");
+
+	return NULL;
+}
+
+static const struct got_error *
+send_command_v2(int fd, const char *command, int object_format)
+{
+	const struct got_error *err;
+	char buf[64];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "command=%s\n", command);
+	if (n < 0 || (size_t)n >= sizeof(buf))
+		return got_error(GOT_ERR_NO_SPACE);
+	err = got_pkt_writepkt(fd, buf, n, chattygot);
+	if (err)
+		return err;
+
+	n = snprintf(buf, sizeof(buf), "%s=got/%s\n", GOT_CAPA_AGENT,
+	    GOT_VERSION_STR);
+	if (n < 0 || (size_t)n >= sizeof(buf))
+		return got_error(GOT_ERR_NO_SPACE);
+	err = got_pkt_writepkt(fd, buf, n, chattygot);
+	if (err)
+		return err;
+
+	if (object_format) {
+		n = snprintf(buf, sizeof(buf), "%s=sha1\n",
+		    GOT_CAPA_OBJECT_FORMAT);
+		if (n < 0 || (size_t)n >= sizeof(buf))
+			return got_error(GOT_ERR_NO_SPACE);
+		err = got_pkt_writepkt(fd, buf, n, chattygot);
+		if (err)
+			return err;
+	}
+
+	return got_pkt_delimpkt(fd, chattygot);
+}
+
+static const struct got_error *
+send_ref_prefix(int fd, const char *prefix, const char *name)
+{
+	char buf[PATH_MAX + 32];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "ref-prefix %s%s\n", prefix, name);
+	if (n < 0 || (size_t)n >= sizeof(buf))
+		return got_error(GOT_ERR_NO_SPACE);
+
+	return got_pkt_writepkt(fd, buf, n, chattygot);
+}
+
+/*
+ * Use the protocol version 2 ls-refs command to list remote references.
+ * Only references which could match the request are listed by the server.
+ * The remote HEAD symref is returned via symrefs and head_id_str rather
+ * than in the list of references.
+ */
+static const struct got_error *
+list_refs_v2(struct got_pathlist_head *refs, struct got_pathlist_head *symrefs,
+    char **head_id_str, int fd, int object_format, int fetch_all_branches,
+    struct got_pathlist_head *wanted_branches,
+    struct got_pathlist_head *wanted_refs, int list_refs_only,
+    const char *worktree_branch)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX];
+	char *id_str = NULL, *refname = NULL, *symref_target = NULL;
+	struct got_pathlist_entry *pe, *new;
+	const char *name;
+	int n;
+
+	*head_id_str = NULL;
+
+	err = send_command_v2(fd, GOT_CAPA_LS_REFS, object_format);
+	if (err)
+		return err;
+
+	n = strlcpy(buf, "symrefs\n", sizeof(buf));
+	err = got_pkt_writepkt(fd, buf, n, chattygot);
+	if (err)
+		return err;
+
+	/* Without any ref-prefix arguments all references are listed. */
+	if (!list_refs_only) {
+		err = send_ref_prefix(fd, "", GOT_REF_HEAD);
+		if (err)
+			return err;
+		err = send_ref_prefix(fd, "refs/tags/", "");
+		if (err)
+			return err;
+		if (fetch_all_branches) {
+			err = send_ref_prefix(fd, "refs/heads/", "");
+			if (err)
+				return err;
+		} else {
+			RB_FOREACH(pe, got_pathlist_head, wanted_branches) {
+				name = pe->path;
+				if (strncmp(name, "refs/heads/", 11) == 0)
+					name += 11;
+				err = send_ref_prefix(fd, "refs/heads/", name);
+				if (err)
+					return err;
+			}
+			if (worktree_branch) {
+				name = worktree_branch;
+				if (strncmp(name, "refs/heads/", 11) == 0)
+					name += 11;
+				err = send_ref_prefix(fd, "refs/heads/", name);
+				if (err)
+					return err;
+			}
+		}
+		RB_FOREACH(pe, got_pathlist_head, wanted_refs) {
+			name = pe->path;
+			if (strncmp(name, "refs/", 5) == 0)
+				name += 5;
+			err = send_ref_prefix(fd, "refs/", name);
+			if (err)
+				return err;
+		}
+	}
+
+	err = got_pkt_flushpkt(fd, chattygot);
+	if (err)
+		return err;
+
+	for (;;) {
+		err = got_pkt_readpkt(&n, fd, buf, sizeof(buf), chattygot,
+		    INFTIM);
+		if (err)
+			goto done;
+		if (n == 0)
+			break;
+		if (n >= 4 && strncmp(buf, "ERR ", 4) == 0) {
+			err = fetch_error(&buf[4], n - 4);
+			goto done;
+		}
+
+		err = got_gitproto_parse_ls_refs_line(&id_str, &refname,
+		    &symref_target, buf, n);
+		if (err)
+			goto done;
+
+		if (symref_target && strcmp(refname, GOT_REF_HEAD) == 0) {
+			if (*head_id_str == NULL) {
+				err = got_pathlist_insert(&new, symrefs,
+				    refname, symref_target);
+				if (err)
+					goto done;
+				if (new) {
+					*head_id_str = id_str;
+					refname = NULL;
+					symref_target = NULL;
+					id_str = NULL;
+				}
+			}
+		} else {
+			err = got_pathlist_insert(&new, refs, refname, id_str);
+			if (err)
+				goto done;
+			if (new) {
+				refname = NULL;
+				id_str = NULL;
+			}
+		}
+
+		free(id_str);
+		free(refname);
+		free(symref_target);
+		id_str = NULL;
+		refname = NULL;
+		symref_target = NULL;
+	}
+done:
+	free(id_str);
+	free(refname);
+	free(symref_target);
+	return err;
+}
+
+static const struct got_error *
+send_fetch_request_v2(int fd, int object_format)
+{
+	const struct got_error *err;
+	char buf[32];
+	int n;
+
+	err = send_command_v2(fd, GOT_CAPA_FETCH, object_format);
+	if (err)
+		return err;
+
+	n = snprintf(buf, sizeof(buf), "%s\n", GOT_CAPA_THIN_PACK);
+	if (n < 0 || (size_t)n >= sizeof(buf))
+		return got_error(GOT_ERR_NO_SPACE);
+	err = got_pkt_writepkt(fd, buf, n, chattygot);
+	if (err)
+		return err;
+
+	n = snprintf(buf, sizeof(buf), "%s\n", GOT_CAPA_OFS_DELTA);
+	if (n < 0 || (size_t)n >= sizeof(buf))
+		return got_error(GOT_ERR_NO_SPACE);
+	return got_pkt_writepkt(fd, buf, n, chattygot);
+}
+
+/*
+ * Skip sections of a protocol version 2 fetch response which precede
+ * the pack file data. Shallow commit updates are passed on to the
+ * parent process.
+ */
+static const struct got_error *
+recv_packfile_section_v2(int fd, struct imsgbuf *ibuf)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX + 1];
+	int n, in_shallow_info = 0;
+
+	for (;;) {
+		err = got_pkt_readpkt_v2(&n, fd, buf, sizeof(buf) - 1,
+		    chattygot, INFTIM);
+		if (err)
+			return err;
+		if (n == 0 || n == GOT_PKT_RESPONSE_END)
+			return got_error_msg(GOT_ERR_BAD_PACKET,
+			    "no pack file sent by server");
+		if (n == GOT_PKT_DELIM) {
+			in_shallow_info = 0;
+			continue;
+		}
+		if (n >= 4 && strncmp(buf, "ERR ", 4) == 0)
+			return fetch_error(&buf[4], n - 4);
+		if (n >= 8 && strncmp(buf, "packfile", 8) == 0 &&
+		    (n == 8 || (n == 9 && buf[8] == '\n')))
+			return NULL;
+		if (in_shallow_info) {
+			err = recv_shallow_update(ibuf, buf, n);
+			if (err)
+				return err;
+			continue;
+		}
+		if (n >= 12 && strncmp(buf, "shallow-info", 12) == 0 &&
+		    (n == 12 || (n == 13 && buf[12] == '\n')))
+			in_shallow_info = 1;
+		/* Ignore other sections and their contents. */
+	}
+}
+
+static int
+is_version_2(const char *buf, int n)
+{
+	size_t len = strlen(GOT_PROTOCOL_V2);
+
+	return (n >= len && strncmp(buf, GOT_PROTOCOL_V2, len) == 0 &&
+	    (n == len || (n == len + 1 && buf[len] == '\n')));
+}
+
+/*
+ * Number of "have" lines announced in the first negotiation round.
+ * The number doubles with every following round up to the maximum.
+ */
+#define GOT_FETCH_INITIAL_HAVES	16
+#define GOT_FETCH_MAX_HAVES	256
+
+/*
+ * Stop negotiating once this many "have" lines have been announced
+ * without the server acknowledging another common commit.
+ */
+#define GOT_FETCH_MAX_IN_VAIN	256
+
+static const struct got_error *
+send_fetch_args(int *nwant, int fd, struct got_object_id *have,
+    struct got_object_id *want, int nref, struct got_object_id *wanted_objects,
+    size_t nwanted_objects, int depth, struct got_object_id *shallow,
+    size_t nshallow, const char *filter, const char *my_capabilities)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX];
+	int i, n, sent_my_capabilites = 0;
+
+	*nwant = 0;
+
+	for (i = 0; i < nref; i++) {
+		/* Deepening history requires wanting up-to-date refs. */
+		if (depth == 0 && got_object_id_cmp(&have[i], &want[i]) == 0)
+			continue;
+		err = send_want(fd, &want[i], sent_my_capabilites ?
+		    NULL : my_capabilities);
+		if (err)
+			return err;
+		sent_my_capabilites = 1;
+		(*nwant)++;
+	}
+	for (i = 0; i < nwanted_objects; i++) {
+		err = send_want(fd, &wanted_objects[i], sent_my_capabilites ?
+		    NULL : my_capabilities);
+		if (err)
+			return err;
+		sent_my_capabilites = 1;
+		(*nwant)++;
+	}
+	if (*nwant == 0)
+		return NULL;
+
+	err = send_shallow_request(fd, depth, shallow, nshallow);
+	if (err)
+		return err;
+	if (filter) {
+		n = snprintf(buf, sizeof(buf), "filter %s\n", filter);
+		if (n < 0 || (size_t)n >= sizeof(buf))
+			return got_error(GOT_ERR_NO_SPACE);
+		err = got_pkt_writepkt(fd, buf, n, chattygot);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+send_have_lines(int fd, struct got_object_id *ids, size_t nids)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX];
+	char hashstr[SHA1_DIGEST_STRING_LENGTH];
+	size_t i;
+	int n;
+
+	for (i = 0; i < nids; i++) {
+		got_object_id_hex(&ids[i], hashstr, sizeof(hashstr));
+		n = snprintf(buf, sizeof(buf), "have %s\n", hashstr);
+		if (n < 0 || (size_t)n >= sizeof(buf))
+			return got_error(GOT_ERR_NO_SPACE);
+		err = got_pkt_writepkt(fd, buf, n, chattygot);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+/*
+ * Ask the parent process for the next batch of commits to announce.
+ * An empty batch means that our history has been exhausted.
+ */
+static const struct got_error *
+request_haves(struct got_object_id **haves, size_t *nhaves, int max_haves,
+    struct imsgbuf *ibuf)
+{
+	const struct got_error *err;
+	struct got_imsg_fetch_have_request ihavereq;
+	struct got_object_id *ids, *h;
+	size_t nids;
+	int done = 0;
+
+	*haves = NULL;
+	*nhaves = 0;
+
+	memset(&ihavereq, 0, sizeof(ihavereq));
+	ihavereq.max_haves = max_haves;
+
+	if (imsg_compose(ibuf, GOT_IMSG_FETCH_HAVE_REQUEST, 0, 0, -1,
+	    &ihavereq, sizeof(ihavereq)) == -1)
+		return got_error_from_errno("imsg_compose FETCH_HAVE_REQUEST");
+	err = got_privsep_flush_imsg(ibuf);
+	if (err)
+		return err;
+
+	while (!done) {
+		err = got_privsep_recv_object_idlist(&done, &ids, &nids, ibuf);
+		if (err)
+			break;
+		if (done)
+			break;
+		if (nids > max_haves - *nhaves) {
+			free(ids);
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			break;
+		}
+		h = reallocarray(*haves, *nhaves + nids, sizeof(**haves));
+		if (h == NULL) {
+			err = got_error_from_errno("reallocarray");
+			free(ids);
+			break;
+		}
+		*haves = h;
+		memcpy(&h[*nhaves], ids, nids * sizeof(*ids));
+		*nhaves += nids;
+		free(ids);
+	}
+
+	if (err) {
+		free(*haves);
+		*haves = NULL;
+		*nhaves = 0;
+	}
+	return err;
+}
+
+static const struct got_error *
+send_fetch_common(struct imsgbuf *ibuf, struct got_object_id *id)
+{
+	struct got_imsg_fetch_common icommon;
+
+	memset(&icommon, 0, sizeof(icommon));
+	memcpy(&icommon.id, id, sizeof(icommon.id));
+
+	if (imsg_compose(ibuf, GOT_IMSG_FETCH_COMMON, 0, 0, -1,
+	    &icommon, sizeof(icommon)) == -1)
+		return got_error_from_errno("imsg_compose FETCH_COMMON");
+
+	return got_privsep_flush_imsg(ibuf);
+}
+
+/*
+ * Parse an "ACK" line sent by the server. The status is empty for the
+ * final ACK of protocol version 0, or one of "common", "ready", or
+ * "continue" while negotiating.
+ */
+static const struct got_error *
+parse_ack(struct got_object_id *id, const char **status, char *buf, int n)
+{
+	if (n > 0 && buf[n - 1] == '\n')
+		n--;
+	buf[n] = '\0';
+
+	if (n < 4 + SHA1_DIGEST_STRING_LENGTH - 1 ||
+	    strncmp(buf, "ACK ", 4) != 0 ||
+	    (buf[4 + SHA1_DIGEST_STRING_LENGTH - 1] != '\0' &&
+	    buf[4 + SHA1_DIGEST_STRING_LENGTH - 1] != ' '))
+		return got_error_msg(GOT_ERR_BAD_PACKET,
+		    "unexpected message from server");
+
+	*status = &buf[4 + SHA1_DIGEST_STRING_LENGTH - 1];
+	if (**status == ' ')
+		(*status)++;
+	buf[4 + SHA1_DIGEST_STRING_LENGTH - 1] = '\0';
+
+	if (!got_parse_object_id(id, buf + 4, GOT_HASH_SHA1))
+		return got_error_msg(GOT_ERR_BAD_PACKET,
+		    "bad object ID in ACK packet from server");
+
+	return NULL;
+}
+
+/*
+ * Record a commit acknowledged as common by the server, unless the
+ * server has acknowledged it before.
+ */
+static const struct got_error *
+add_common(int *is_new, struct got_object_id **commons, size_t *ncommons,
+    struct got_object_id *id, struct imsgbuf *ibuf)
+{
+	struct got_object_id *c;
+	size_t i;
+
+	*is_new = 0;
+
+	for (i = 0; i < *ncommons; i++) {
+		if (got_object_id_cmp(&(*commons)[i], id) == 0)
+			return NULL;
+	}
+
+	c = reallocarray(*commons, *ncommons + 1, sizeof(**commons));
+	if (c == NULL)
+		return got_error_from_errno("reallocarray");
+	*commons = c;
+	memcpy(&c[*ncommons], id, sizeof(*id));
+	(*ncommons)++;
+	*is_new = 1;
+
+	return send_fetch_common(ibuf, id);
+}
+
+/*
+ * Read the server's response to one round of negotiation.
+ * Newly found common commits are passed on to the parent process.
+ */
+static const struct got_error *
+recv_acks(int *ready, int *nnew, struct got_object_id **commons,
+    size_t *ncommons, int protocol_v2, int fd, struct imsgbuf *ibuf)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX + 1];
+	struct got_object_id id;
+	const char *status;
+	int n, is_new;
+
+	*ready = 0;
+	*nnew = 0;
+
+	if (protocol_v2) {
+		err = got_pkt_readpkt_v2(&n, fd, buf, sizeof(buf) - 1,
+		    chattygot, INFTIM);
+		if (err)
+			return err;
+		if (n >= 4 && strncmp(buf, "ERR ", 4) == 0)
+			return fetch_error(&buf[4], n - 4);
+		if (n < 15 || strncmp(buf, "acknowledgments", 15) != 0 ||
+		    (n != 15 && (n != 16 || buf[15] != '\n')))
+			return got_error_msg(GOT_ERR_BAD_PACKET,
+			    "unexpected message from server");
+	}
+
+	for (;;) {
+		if (protocol_v2) {
+			err = got_pkt_readpkt_v2(&n, fd, buf, sizeof(buf) - 1,
+			    chattygot, INFTIM);
+			if (err)
+				return err;
+			/* A delimiter precedes the pack file once ready. */
+			if (n == GOT_PKT_DELIM && *ready)
+				return NULL;
+			if (n == 0 && !*ready)
+				return NULL;
+			if (n < 0)
+				return got_error_msg(GOT_ERR_BAD_PACKET,
+				    "unexpected message from server");
+		} else {
+			err = got_pkt_readpkt(&n, fd, buf, sizeof(buf) - 1,
+			    chattygot, INFTIM);
+			if (err)
+				return err;
+		}
+		if (n >= 4 && strncmp(buf, "ERR ", 4) == 0)
+			return fetch_error(&buf[4], n - 4);
+		if (n >= 3 && strncmp(buf, "NAK", 3) == 0 &&
+		    (n == 3 || (n == 4 && buf[3] == '\n'))) {
+			/* Protocol version 0 rounds end with NAK. */
+			if (!protocol_v2)
+				return NULL;
+			continue;
+		}
+		if (protocol_v2 && n >= 5 && strncmp(buf, "ready", 5) == 0 &&
+		    (n == 5 || (n == 6 && buf[5] == '\n'))) {
+			*ready = 1;
+			continue;
+		}
+
+		err = parse_ack(&id, &status, buf, n);
+		if (err)
+			return err;
+		if (!protocol_v2 && strcmp(status, "common") != 0 &&
+		    strcmp(status, "ready") != 0 &&
+		    strcmp(status, "continue") != 0)
+			return got_error_msg(GOT_ERR_BAD_PACKET,
+			    "unexpected message from server");
+		if (strcmp(status, "ready") == 0)
+			*ready = 1;
+		err = add_common(&is_new, commons, ncommons, &id, ibuf);
+		if (err)
+			return err;
+		if (is_new)
+			(*nnew)++;
+	}
+}
+
+/*
+ * Read the server's final response to our "done" line in protocol
+ * version 0, which is an ACK if a common commit was found, else NAK.
+ */
+static const struct got_error *
+recv_final_ack(int fd, struct got_object_id **commons, size_t *ncommons,
+    struct imsgbuf *ibuf)
+{
+	const struct got_error *err;
+	char buf[GOT_PKT_MAX + 1];
+	struct got_object_id id;
+	const char *status;
+	int n, is_new;
+
+	for (;;) {
+		err = got_pkt_readpkt(&n, fd, buf, sizeof(buf) - 1, chattygot,
+		    INFTIM);
+		if (err)
+			return err;
+		if (n >= 4 && strncmp(buf, "ERR ", 4) == 0)
+			return fetch_error(&buf[4], n - 4);
+		if (n >= 3 && strncmp(buf, "NAK", 3) == 0 &&
+		    (n == 3 || (n == 4 && buf[3] == '\n'))) {
+			/*
+			 * Server could not find a common ancestor.
+			 * Perhaps it is an out-of-date mirror, or there
+			 * is a repository with unrelated history.
+			 */
+			return NULL;
+		}
+		err = parse_ack(&id, &status, buf, n);
+		if (err)
+			return err;
+		err = add_common(&is_new, commons, ncommons, &id, ibuf);
+		if (err)
+			return err;
+		/* ACKs with a status may precede the final ACK. */
+		if (status[0] == '\0')
+			return NULL;
+	}
+}
+
 static const struct got_error *
 fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
     struct got_pathlist_head *have_refs, int fetch_all_branches,
     struct got_pathlist_head *wanted_branches,
     struct got_pathlist_head *wanted_refs, int list_refs_only,
     const char *worktree_branch, const char *remote_head,
-    int no_head, struct imsgbuf *ibuf)
+    int no_head, int depth, struct got_object_id *shallow, size_t nshallow,
+    const char *filter, struct got_object_id *wanted_objects,
+    size_t nwanted_objects, int stateless, struct imsgbuf *ibuf)
 {
 	const struct got_error *err = NULL;
 	char buf[GOT_PKT_MAX];
-	char hashstr[SHA1_DIGEST_STRING_LENGTH];
 	struct got_object_id *have, *want;
+	struct got_object_id *haves = NULL, *commons = NULL;
+	size_t nhaves = 0, ncommons = 0;
 	int is_firstpkt = 1, nref = 0, refsz = 16;
-	int i, n, nwant = 0, nhave = 0, acked = 0, eof = 0;
+	int i, n, nwant = 0, nhave = 0, eof = 0;
+	int multi_ack = 0, max_haves, in_vain = 0, ready = 0;
 	off_t packsz = 0, last_reported_packsz = 0;
 	char *id_str = NULL, *default_id_str = NULL, *refname = NULL;
 	char *server_capabilities = NULL, *my_capabilities = NULL;
 	const char *default_branch = NULL;
-	struct got_pathlist_head symrefs;
-	struct got_pathlist_entry *pe;
-	int sent_my_capabilites = 0, have_sidebands = 0;
-	int found_branch = 0;
+	struct got_pathlist_head symrefs, v2_refs;
+	struct got_pathlist_entry *pe, *v2_pe = NULL;
+	int have_sidebands = 0;
+	int found_branch = 0, protocol_v2 = 0, object_format = 0;
+	int server_shallow = 0, server_filter = 0;
 	struct got_hash ctx;
 	uint8_t sha1_buf[SHA1_DIGEST_LENGTH];
 	size_t sha1_buf_len = 0;
@@ -357,6 +1143,7 @@ fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
 	struct got_ratelimit rl;
 
 	RB_INIT(&symrefs);
+	RB_INIT(&v2_refs);
 	got_hash_init(&ctx, GOT_HASH_SHA1);
 	got_ratelimit_init(&rl, 0, 500);
 
@@ -368,23 +1155,77 @@ fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
 		err = got_error_from_errno("malloc");
 		goto done;
 	}
-	while (1) {
-		err = got_pkt_readpkt(&n, fd, buf, sizeof(buf), chattygot,
-		    INFTIM);
+
+	err = got_pkt_readpkt(&n, fd, buf, sizeof(buf), chattygot, INFTIM);
+	if (err)
+		goto done;
+	if (is_version_2(buf, n)) {
+		protocol_v2 = 1;
+		is_firstpkt = 0;
+		have_sidebands = 1;
+
+		err = recv_capabilities_v2(&object_format, &server_shallow,
+		    &server_filter, fd);
 		if (err)
 			goto done;
-		if (n == 0)
-			break;
-		if (n >= 4 && strncmp(buf, "ERR ", 4) == 0) {
-			err = fetch_error(&buf[4], n - 4);
-			goto done;
+		/* Missing objects are requested without listing references. */
+		if (nwanted_objects == 0) {
+			err = list_refs_v2(&v2_refs, &symrefs, &default_id_str,
+			    fd, object_format, fetch_all_branches,
+			    wanted_branches, wanted_refs, list_refs_only,
+			    worktree_branch);
+			if (err)
+				goto done;
+			err = send_fetch_symrefs(ibuf, &symrefs);
+			if (err)
+				goto done;
+		}
+		if (!fetch_all_branches) {
+			pe = RB_MIN(got_pathlist_head, &symrefs);
+			if (pe != NULL)
+				default_branch = pe->data;
+		}
+		v2_pe = RB_MIN(got_pathlist_head, &v2_refs);
+	}
+
+	while (1) {
+		if (protocol_v2) {
+			if (v2_pe == NULL)
+				break;
+			free(id_str);
+			free(refname);
+			refname = NULL;
+			id_str = strdup(v2_pe->data);
+			if (id_str == NULL) {
+				err = got_error_from_errno("strdup");
+				goto done;
+			}
+			refname = strdup(v2_pe->path);
+			if (refname == NULL) {
+				err = got_error_from_errno("strdup");
+				goto done;
+			}
+			v2_pe = RB_NEXT(got_pathlist_head, &v2_refs, v2_pe);
+		} else {
+			if (!is_firstpkt) {
+				err = got_pkt_readpkt(&n, fd, buf, sizeof(buf),
+				    chattygot, INFTIM);
+				if (err)
+					goto done;
+			}
+			if (n == 0)
+				break;
+			if (n >= 4 && strncmp(buf, "ERR ", 4) == 0) {
+				err = fetch_error(&buf[4], n - 4);
+				goto done;
+			}
+			free(id_str);
+			free(refname);
+			err = got_gitproto_parse_refline(&id_str, &refname,
+			    &server_capabilities, buf, n);
+			if (err)
+				goto done;
 		}
-		free(id_str);
-		free(refname);
-		err = got_gitproto_parse_refline(&id_str, &refname,
-		    &server_capabilities, buf, n);
-		if (err)
-			goto done;
 
 		if (refsz == nref + 1) {
 			struct got_object_id *h, *w;
@@ -417,10 +1258,16 @@ fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
 				fprintf(stderr, "%s: my capabilities:%s\n",
 				    getprogname(), my_capabilities != NULL ?
 				    my_capabilities : "");
+			server_shallow = (my_capabilities != NULL &&
+			    has_value(my_capabilities, GOT_CAPA_SHALLOW));
+			server_filter = (my_capabilities != NULL &&
+			    has_value(my_capabilities, GOT_CAPA_FILTER));
+			is_firstpkt = 0;
+			if (nwanted_objects > 0)
+				continue;
 			err = send_fetch_symrefs(ibuf, &symrefs);
 			if (err)
 				goto done;
-			is_firstpkt = 0;
 			if (!fetch_all_branches) {
 				RB_FOREACH(pe, got_pathlist_head, &symrefs) {
 					const char *name = pe->path;
@@ -434,6 +1281,8 @@ fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
 			if (default_branch)
 				continue;
 		}
+		if (nwanted_objects > 0)
+			continue;
 		if (strstr(refname, "^{}")) {
 			if (chattygot) {
 				fprintf(stderr, "%s: ignoring %s\n",
@@ -508,7 +1357,8 @@ fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
 	 * (got.conf, worktree) were found or the client already has the
 	 * remote HEAD symref but its target changed, fetch remote's HEAD.
 	 */
-	if (!no_head && default_branch && default_id_str &&
+	if (!no_head && nwanted_objects == 0 &&
+	    default_branch && default_id_str &&
 	    strncmp(default_branch, "refs/heads/", 11) == 0) {
 		int remote_head_changed = 0;
 
@@ -527,7 +1377,7 @@ fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
 	}
 
 	/* Abort if we haven't found anything to fetch. */
-	if (nref == 0) {
+	if (nref == 0 && nwanted_objects == 0) {
 		struct got_pathlist_entry *pe;
 		static char msg[PATH_MAX + 33];
 
@@ -551,85 +1401,149 @@ fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
 		goto done;
 	}
 
-	for (i = 0; i < nref; i++) {
-		if (got_object_id_cmp(&have[i], &want[i]) == 0)
-			continue;
-		got_object_id_hex(&want[i], hashstr, sizeof(hashstr));
-		n = snprintf(buf, sizeof(buf), "want %s%s\n", hashstr,
-		    sent_my_capabilites || my_capabilities == NULL ?
-		    "" : my_capabilities);
-		if (n < 0 || (size_t)n >= sizeof(buf)) {
-			err = got_error(GOT_ERR_NO_SPACE);
-			goto done;
-		}
-		err = got_pkt_writepkt(fd, buf, n, chattygot);
-		if (err)
-			goto done;
-		sent_my_capabilites = 1;
-		nwant++;
-	}
-	err = got_pkt_flushpkt(fd, chattygot);
-	if (err)
+	if ((depth > 0 || nshallow > 0) && !server_shallow) {
+		err = got_error_msg(GOT_ERR_BAD_PACKET,
+		    "server does not support shallow fetches");
 		goto done;
+	}
 
-	if (nwant == 0)
+	if (filter && !server_filter) {
+		err = got_error_msg(GOT_ERR_BAD_PACKET,
+		    "server does not support object filters");
 		goto done;
+	}
 
-	RB_FOREACH(pe, got_pathlist_head, have_refs) {
-		struct got_object_id *id = pe->data;
-		got_object_id_hex(id, hashstr, sizeof(hashstr));
-		n = snprintf(buf, sizeof(buf), "have %s\n", hashstr);
-		if (n < 0 || (size_t)n >= sizeof(buf)) {
-			err = got_error(GOT_ERR_NO_SPACE);
-			goto done;
+	if (protocol_v2) {
+		for (i = 0; i < nref; i++) {
+			if (got_object_id_cmp(&have[i], &want[i]) != 0)
+				break;
 		}
-		err = got_pkt_writepkt(fd, buf, n, chattygot);
+		if (i == nref && depth == 0 && nwanted_objects == 0)
+			goto done; /* everything is up-to-date */
+		multi_ack = 1;
+	} else {
+		err = send_fetch_args(&nwant, fd, have, want, nref,
+		    wanted_objects, nwanted_objects, depth, shallow, nshallow,
+		    filter, my_capabilities);
+		if (err)
+			goto done;
+		err = got_pkt_flushpkt(fd, chattygot);
 		if (err)
 			goto done;
-		nhave++;
+		if (nwant == 0)
+			goto done;
+		if (depth > 0 && !stateless) {
+			/* The server announces new shallow commits first. */
+			err = recv_shallow_updates(fd, ibuf);
+			if (err)
+				goto done;
+		}
+		/*
+		 * A stateless transport such as smart HTTP only sends our
+		 * request to the server once "done" has been written.
+		 * Protocol v0 cannot repeat wants in a new request so the
+		 * whole negotiation must fit into this single request.
+		 */
+		multi_ack = (!stateless && my_capabilities != NULL &&
+		    has_value(my_capabilities, GOT_CAPA_MULTI_ACK_DETAILED));
 	}
 
-	n = strlcpy(buf, "done\n", sizeof(buf));
-	err = got_pkt_writepkt(fd, buf, n, chattygot);
-	if (err)
-		goto done;
-
-	while (nhave > 0 && !acked) {
-		struct got_object_id common_id;
+	/*
+	 * Announce our history in rounds of growing size until the server
+	 * is ready to send a pack file or we run out of commits to announce.
+	 * Without multi_ack support only one round can be used.
+	 */
+	max_haves = multi_ack ? GOT_FETCH_INITIAL_HAVES : GOT_FETCH_MAX_HAVES;
+	for (;;) {
+		int last_round, nnew;
 
-		/* The server should ACK the object IDs we need. */
-		err = got_pkt_readpkt(&n, fd, buf, sizeof(buf), chattygot,
-		    INFTIM);
+		err = request_haves(&haves, &nhaves, max_haves, ibuf);
 		if (err)
 			goto done;
-		if (n >= 4 && strncmp(buf, "ERR ", 4) == 0) {
-			err = fetch_error(&buf[4], n - 4);
+		last_round = (!multi_ack || nhaves == 0 ||
+		    (ncommons > 0 && in_vain >= GOT_FETCH_MAX_IN_VAIN));
+
+		if (protocol_v2) {
+			/* Each request repeats wants and common commits. */
+			err = send_fetch_request_v2(fd, object_format);
+			if (err)
+				goto done;
+			err = send_fetch_args(&nwant, fd, have, want, nref,
+			    wanted_objects, nwanted_objects, depth, shallow,
+			    nshallow, filter, NULL);
+			if (err)
+				goto done;
+			if (nwant == 0) {
+				err = got_error_msg(GOT_ERR_BAD_PACKET,
+				    "no objects to fetch");
+				goto done;
+			}
+			err = send_have_lines(fd, commons, ncommons);
+			if (err)
+				goto done;
+		}
+		err = send_have_lines(fd, haves, nhaves);
+		if (err)
 			goto done;
+		nhave += nhaves;
+		in_vain += nhaves;
+		free(haves);
+		haves = NULL;
+
+		if (last_round) {
+			n = strlcpy(buf, "done\n", sizeof(buf));
+			err = got_pkt_writepkt(fd, buf, n, chattygot);
+			if (err)
+				goto done;
 		}
-		if (n >= 4 && strncmp(buf, "NAK\n", 4) == 0) {
-			/*
-			 * Server could not find a common ancestor.
-			 * Perhaps it is an out-of-date mirror, or there
-			 * is a repository with unrelated history.
-			 */
-			break;
+		if (protocol_v2 || !last_round) {
+			err = got_pkt_flushpkt(fd, chattygot);
+			if (err)
+				goto done;
 		}
-		if (n < 4 + SHA1_DIGEST_STRING_LENGTH ||
-		    strncmp(buf, "ACK ", 4) != 0) {
-			err = got_error_msg(GOT_ERR_BAD_PACKET,
-			    "unexpected message from server");
+		if (last_round)
+			break;
+
+		err = recv_acks(&ready, &nnew, &commons, &ncommons,
+		    protocol_v2, fd, ibuf);
+		if (err)
 			goto done;
+		if (nnew > 0)
+			in_vain = 0;
+		if (ready) {
+			if (!protocol_v2) {
+				n = strlcpy(buf, "done\n", sizeof(buf));
+				err = got_pkt_writepkt(fd, buf, n, chattygot);
+				if (err)
+					goto done;
+			}
+			break;
 		}
-		if (!got_parse_object_id(&common_id, buf + 4,
-		    GOT_HASH_SHA1)) {
-			err = got_error_msg(GOT_ERR_BAD_PACKET,
-			    "bad object ID in ACK packet from server");
+		if (max_haves < GOT_FETCH_MAX_HAVES)
+			max_haves *= 2;
+	}
+
+	if (!protocol_v2 && depth > 0 && stateless) {
+		/* Shallow commits precede the response to our haves. */
+		err = recv_shallow_updates(fd, ibuf);
+		if (err)
 			goto done;
-		}
-		acked++;
 	}
 
-	if (nhave == 0) {
+	if (protocol_v2) {
+		/*
+		 * Having sent "done", or having been told that the server
+		 * is ready, we will receive the pack file without any
+		 * further negotiation.
+		 */
+		err = recv_packfile_section_v2(fd, ibuf);
+		if (err)
+			goto done;
+	} else if (nhave > 0 || multi_ack) {
+		err = recv_final_ack(fd, &commons, &ncommons, ibuf);
+		if (err)
+			goto done;
+	} else {
 		err = got_pkt_readpkt(&n, fd, buf, sizeof(buf), chattygot,
 		    INFTIM);
 		if (err)
@@ -838,8 +1752,11 @@ fetch_pack(int fd, int packfd, uint8_t *pack_sha1,
 	}
 done:
 	got_pathlist_free(&symrefs, GOT_PATHLIST_FREE_ALL);
+	got_pathlist_free(&v2_refs, GOT_PATHLIST_FREE_ALL);
 	free(have);
 	free(want);
+	free(haves);
+	free(commons);
 	free(id_str);
 	free(default_id_str);
 	free(refname);
@@ -863,9 +1780,12 @@ main(int argc, char **argv)
 	struct got_imsg_fetch_have_ref href;
 	struct got_imsg_fetch_wanted_branch wbranch;
 	struct got_imsg_fetch_wanted_ref wref;
+	struct got_imsg_fetch_shallow ishallow;
+	struct got_imsg_fetch_wanted_object iwanted;
+	struct got_object_id *shallow = NULL, *wanted_objects = NULL;
 	size_t datalen, i;
 	struct got_pathlist_entry *new;
-	char *remote_head = NULL, *worktree_branch = NULL;
+	char *remote_head = NULL, *worktree_branch = NULL, *filter = NULL;
 #if 0
 	static int attached;
 	while (!attached)
@@ -923,8 +1843,8 @@ main(int argc, char **argv)
 	memcpy(&fetch_req, imsg.data, sizeof(fetch_req));
 	fetchfd = imsg_get_fd(&imsg);
 
-	if (datalen != sizeof(fetch_req) +
-	    fetch_req.worktree_branch_len + fetch_req.remote_head_len) {
+	if (datalen != sizeof(fetch_req) + fetch_req.worktree_branch_len +
+	    fetch_req.remote_head_len + fetch_req.filter_len) {
 		err = got_error(GOT_ERR_PRIVSEP_LEN);
 		goto done;
 	}
@@ -947,6 +1867,16 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (fetch_req.filter_len != 0) {
+		filter = strndup(imsg.data + sizeof(fetch_req) +
+		    fetch_req.worktree_branch_len + fetch_req.remote_head_len,
+		    fetch_req.filter_len);
+		if (filter == NULL) {
+			err = got_error_from_errno("strndup");
+			goto done;
+		}
+	}
+
 	imsg_free(&imsg);
 
 	if (fetch_req.verbosity > 0)
@@ -1084,6 +2014,72 @@ main(int argc, char **argv)
 		imsg_free(&imsg);
 	}
 
+	if (fetch_req.n_shallow > 0) {
+		shallow = calloc(fetch_req.n_shallow, sizeof(*shallow));
+		if (shallow == NULL) {
+			err = got_error_from_errno("calloc");
+			goto done;
+		}
+	}
+
+	for (i = 0; i < fetch_req.n_shallow; i++) {
+		err = got_privsep_recv_imsg(&imsg, &ibuf, 0);
+		if (err) {
+			if (err->code == GOT_ERR_PRIVSEP_PIPE)
+				err = NULL;
+			goto done;
+		}
+		if (imsg.hdr.type == GOT_IMSG_STOP)
+			goto done;
+		if (imsg.hdr.type != GOT_IMSG_FETCH_SHALLOW) {
+			err = got_error(GOT_ERR_PRIVSEP_MSG);
+			goto done;
+		}
+		datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
+		if (datalen != sizeof(ishallow)) {
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			goto done;
+		}
+		memcpy(&ishallow, imsg.data, sizeof(ishallow));
+		memcpy(&shallow[i], &ishallow.id, sizeof(shallow[i]));
+
+		imsg_free(&imsg);
+	}
+
+	if (fetch_req.n_wanted_objects > 0) {
+		wanted_objects = calloc(fetch_req.n_wanted_objects,
+		    sizeof(*wanted_objects));
+		if (wanted_objects == NULL) {
+			err = got_error_from_errno("calloc");
+			goto done;
+		}
+	}
+
+	for (i = 0; i < fetch_req.n_wanted_objects; i++) {
+		err = got_privsep_recv_imsg(&imsg, &ibuf, 0);
+		if (err) {
+			if (err->code == GOT_ERR_PRIVSEP_PIPE)
+				err = NULL;
+			goto done;
+		}
+		if (imsg.hdr.type == GOT_IMSG_STOP)
+			goto done;
+		if (imsg.hdr.type != GOT_IMSG_FETCH_WANTED_OBJECT) {
+			err = got_error(GOT_ERR_PRIVSEP_MSG);
+			goto done;
+		}
+		datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
+		if (datalen != sizeof(iwanted)) {
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			goto done;
+		}
+		memcpy(&iwanted, imsg.data, sizeof(iwanted));
+		memcpy(&wanted_objects[i], &iwanted.id,
+		    sizeof(wanted_objects[i]));
+
+		imsg_free(&imsg);
+	}
+
 	err = got_privsep_recv_imsg(&imsg, &ibuf, 0);
 	if (err) {
 		if (err->code == GOT_ERR_PRIVSEP_PIPE)
@@ -1105,8 +2101,14 @@ main(int argc, char **argv)
 	err = fetch_pack(fetchfd, packfd, pack_sha1, &have_refs,
 	    fetch_req.fetch_all_branches, &wanted_branches,
 	    &wanted_refs, fetch_req.list_refs_only,
-	    worktree_branch, remote_head, fetch_req.no_head, &ibuf);
+	    worktree_branch, remote_head, fetch_req.no_head,
+	    fetch_req.depth, shallow, fetch_req.n_shallow, filter,
+	    wanted_objects, fetch_req.n_wanted_objects, fetch_req.stateless,
+	    &ibuf);
 done:
+	free(shallow);
+	free(wanted_objects);
+	free(filter);
 	free(worktree_branch);
 	free(remote_head);
 	got_pathlist_free(&have_refs, GOT_PATHLIST_FREE_ALL);
@@ -68,13 +68,88 @@ send_index_pack_progress(void *arg, uint32_t nobj_total, uint32_t nobj_indexed,
 }
 
 static const struct got_error *
-send_index_pack_done(struct imsgbuf *ibuf)
+send_index_pack_done(struct imsgbuf *ibuf, struct got_object_id *pack_hash)
 {
-	if (imsg_compose(ibuf, GOT_IMSG_IDXPACK_DONE, 0, 0, -1, NULL, 0) == -1)
+	if (imsg_compose(ibuf, GOT_IMSG_IDXPACK_DONE, 0, 0, -1,
+	    pack_hash, sizeof(*pack_hash)) == -1)
 		return got_error_from_errno("imsg_compose FETCH");
 	return got_privsep_flush_imsg(ibuf);
 }
 
+/* Ask our parent for a delta base which is missing from a thin pack. */
+static const struct got_error *
+request_delta_base(void *arg, int *obj_type, off_t *size, FILE *outfile,
+    struct got_object_id *id)
+{
+	const struct got_error *err = NULL;
+	struct imsgbuf *ibuf = arg;
+	struct imsg imsg;
+	struct got_imsg_index_pack_base ibase;
+	uint8_t buf[8192];
+	off_t remain;
+	ssize_t r;
+	int fd = -1;
+
+	if (imsg_compose(ibuf, GOT_IMSG_IDXPACK_BASE_REQUEST, 0, 0, -1,
+	    id, sizeof(*id)) == -1)
+		return got_error_from_errno("imsg_compose IDXPACK_BASE_REQUEST");
+	err = got_privsep_flush_imsg(ibuf);
+	if (err)
+		return err;
+
+	err = got_privsep_recv_imsg(&imsg, ibuf, 0);
+	if (err)
+		return err;
+	if (imsg.hdr.type != GOT_IMSG_IDXPACK_BASE) {
+		err = got_error(GOT_ERR_PRIVSEP_MSG);
+		goto done;
+	}
+	if (imsg.hdr.len - IMSG_HEADER_SIZE != sizeof(ibase)) {
+		err = got_error(GOT_ERR_PRIVSEP_LEN);
+		goto done;
+	}
+	memcpy(&ibase, imsg.data, sizeof(ibase));
+	if (ibase.size < 0) {
+		err = got_error(GOT_ERR_PRIVSEP_MSG);
+		goto done;
+	}
+	fd = imsg_get_fd(&imsg);
+	if (fd == -1) {
+		err = got_error(GOT_ERR_PRIVSEP_NO_FD);
+		goto done;
+	}
+
+	if (lseek(fd, 0L, SEEK_SET) == -1) {
+		err = got_error_from_errno("lseek");
+		goto done;
+	}
+	remain = ibase.size;
+	while (remain > 0) {
+		r = read(fd, buf, remain < sizeof(buf) ? remain : sizeof(buf));
+		if (r == -1) {
+			err = got_error_from_errno("read");
+			goto done;
+		}
+		if (r == 0) {
+			err = got_error(GOT_ERR_EOF);
+			goto done;
+		}
+		if (fwrite(buf, 1, r, outfile) != r) {
+			err = got_ferror(outfile, GOT_ERR_IO);
+			goto done;
+		}
+		remain -= r;
+	}
+
+	*obj_type = ibase.obj_type;
+	*size = ibase.size;
+done:
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	imsg_free(&imsg);
+	return err;
+}
+
 
 int
 main(int argc, char **argv)
@@ -82,6 +157,7 @@ main(int argc, char **argv)
 	const struct got_error *err = NULL, *close_err;
 	struct imsgbuf ibuf;
 	struct imsg imsg;
+	struct got_imsg_index_pack_request ireq;
 	struct got_object_id pack_hash;
 	size_t i;
 	int idxfd = -1, tmpfd = -1;
@@ -89,6 +165,8 @@ main(int argc, char **argv)
 	struct got_pack pack;
 	off_t packfile_size;
 	struct got_ratelimit rl;
+	long ncpu;
+	int nthreads = 1;
 #if 0
 	static int attached;
 	while (!attached)
@@ -108,9 +186,17 @@ main(int argc, char **argv)
 
 	memset(&pack, 0, sizeof(pack));
 	pack.fd = -1;
-	err = got_delta_cache_alloc(&pack.delta_cache);
+	err = got_delta_cache_alloc(&pack.delta_cache,
+	    GOT_DELTA_CACHE_DEFAULT_SIZE);
 	if (err)
 		goto done;
+
+	/* Resolve deltas with one thread per online CPU by default. */
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu > GOT_PACK_INDEX_MAX_THREADS)
+		nthreads = GOT_PACK_INDEX_MAX_THREADS;
+	else if (ncpu > 1)
+		nthreads = ncpu;
 #ifndef PROFILE
 	/* revoke access to most system calls */
 	if (pledge("stdio recvfd", NULL) == -1) {
@@ -141,11 +227,16 @@ main(int argc, char **argv)
 		err = got_error(GOT_ERR_PRIVSEP_MSG);
 		goto done;
 	}
-	if (imsg.hdr.len - IMSG_HEADER_SIZE != sizeof(pack_hash)) {
+	if (imsg.hdr.len - IMSG_HEADER_SIZE != sizeof(ireq)) {
 		err = got_error(GOT_ERR_PRIVSEP_LEN);
 		goto done;
 	}
-	memcpy(&pack_hash, imsg.data, sizeof(pack_hash));
+	memcpy(&ireq, imsg.data, sizeof(ireq));
+	memcpy(&pack_hash, &ireq.id, sizeof(pack_hash));
+	if (ireq.nthreads > GOT_PACK_INDEX_MAX_THREADS)
+		nthreads = GOT_PACK_INDEX_MAX_THREADS;
+	else if (ireq.nthreads > 0)
+		nthreads = ireq.nthreads;
 	pack.fd = imsg_get_fd(&imsg);
 	pack.algo = pack_hash.algo;
 
@@ -212,7 +303,9 @@ main(int argc, char **argv)
 	}
 #endif
 	err = got_pack_index(&pack, idxfd, tmpfiles[0], tmpfiles[1],
-	    tmpfiles[2], &pack_hash, send_index_pack_progress, &ibuf, &rl);
+	    tmpfiles[2], &pack_hash,
+	    ireq.fix_thin ? request_delta_base : NULL, &ibuf,
+	    send_index_pack_progress, &ibuf, &rl, nthreads);
 done:
 	close_err = got_pack_close(&pack);
 	if (close_err && err == NULL)
@@ -228,7 +321,7 @@ done:
 	}
 
 	if (err == NULL)
-		err = send_index_pack_done(&ibuf);
+		err = send_index_pack_done(&ibuf, &pack_hash);
 	if (err) {
 		got_privsep_send_error(&ibuf, err);
 		fprintf(stderr, "%s: %s\n", getprogname(), err->msg);
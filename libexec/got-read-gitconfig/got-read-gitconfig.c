@@ -148,6 +148,7 @@ send_gitconfig_remotes(struct imsgbuf *ibuf, struct got_remote_repo *remotes,
 		size_t len = sizeof(iremote);
 		struct ibuf *wbuf;
 
+		memset(&iremote, 0, sizeof(iremote));
 		iremote.mirror_references = remotes[i].mirror_references;
 		iremote.name_len = strlen(remotes[i].name);
 		len += iremote.name_len;
@@ -155,6 +156,11 @@ send_gitconfig_remotes(struct imsgbuf *ibuf, struct got_remote_repo *remotes,
 		len += iremote.fetch_url_len;
 		iremote.send_url_len = strlen(remotes[i].send_url);
 		len += iremote.send_url_len;
+		if (remotes[i].fetch_filter) {
+			iremote.fetch_filter_len =
+			    strlen(remotes[i].fetch_filter);
+			len += iremote.fetch_filter_len;
+		}
 
 		wbuf = imsg_create(ibuf, GOT_IMSG_GITCONFIG_REMOTE, 0, 0, len);
 		if (wbuf == NULL)
@@ -174,6 +180,11 @@ send_gitconfig_remotes(struct imsgbuf *ibuf, struct got_remote_repo *remotes,
 		if (imsg_add(wbuf, remotes[i].send_url, iremote.send_url_len) == -1)
 			return got_error_from_errno(
 			    "imsg_add GITCONFIG_REMOTE");
+		if (iremote.fetch_filter_len > 0 &&
+		    imsg_add(wbuf, remotes[i].fetch_filter,
+		    iremote.fetch_filter_len) == -1)
+			return got_error_from_errno(
+			    "imsg_add GITCONFIG_REMOTE");
 
 		imsg_close(ibuf, wbuf);
 		err = got_privsep_flush_imsg(ibuf);
@@ -268,6 +279,9 @@ gitconfig_remotes_request(struct imsgbuf *ibuf, struct got_gitconfig *gitconfig)
 		if (mirror != NULL && get_boolean_val(mirror))
 			remotes[i].mirror_references = 1;
 
+		remotes[i].fetch_filter = got_gitconfig_get_str(gitconfig,
+		    node->field, "partialclonefilter");
+
 		i++;
 	}
 
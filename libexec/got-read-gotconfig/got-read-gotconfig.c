@@ -230,6 +230,16 @@ send_gotconfig_str(struct imsgbuf *ibuf, const char *value)
 	return got_privsep_flush_imsg(ibuf);
 }
 
+static const struct got_error *
+send_gotconfig_int(struct imsgbuf *ibuf, int64_t value)
+{
+	if (imsg_compose(ibuf, GOT_IMSG_GOTCONFIG_INT_VAL, 0, 0, -1,
+	    &value, sizeof(value)) == -1)
+		return got_error_from_errno("imsg_compose GOTCONFIG_INT_VAL");
+
+	return got_privsep_flush_imsg(ibuf);
+}
+
 static const struct got_error *
 send_gotconfig_remotes(struct imsgbuf *ibuf,
     struct gotconfig_remote_repo_list *remotes, int nremotes)
@@ -285,6 +295,7 @@ send_gotconfig_remotes(struct imsgbuf *ibuf,
 		iremote.nfetch_refs = nfetch_refs;
 		iremote.mirror_references = repo->mirror_references;
 		iremote.fetch_all_branches = repo->fetch_all_branches;
+		iremote.fetch_filter_len = 0;
 
 		iremote.name_len = strlen(repo->name);
 		len += iremote.name_len;
@@ -604,6 +615,27 @@ main(int argc, char *argv[])
 			err = send_gotconfig_remotes(&ibuf,
 			    &gotconfig->remotes, gotconfig->nremotes);
 			break;
+		case GOT_IMSG_GOTCONFIG_PACK_WINDOW_REQUEST:
+			if (gotconfig == NULL) {
+				err = got_error(GOT_ERR_PRIVSEP_MSG);
+				break;
+			}
+			err = send_gotconfig_int(&ibuf, gotconfig->pack_window);
+			break;
+		case GOT_IMSG_GOTCONFIG_PACK_DEPTH_REQUEST:
+			if (gotconfig == NULL) {
+				err = got_error(GOT_ERR_PRIVSEP_MSG);
+				break;
+			}
+			err = send_gotconfig_int(&ibuf, gotconfig->pack_depth);
+			break;
+		case GOT_IMSG_GOTCONFIG_PACK_MEMSIZE_REQUEST:
+			if (gotconfig == NULL) {
+				err = got_error(GOT_ERR_PRIVSEP_MSG);
+				break;
+			}
+			err = send_gotconfig_int(&ibuf, gotconfig->pack_memsize);
+			break;
 		default:
 			err = got_error(GOT_ERR_PRIVSEP_MSG);
 			break;
@@ -70,6 +70,9 @@ struct gotconfig {
 	char	*allowed_signers_file;
 	char	*revoked_signers_file;
 	char	*signer_id;
+	int	pack_window;
+	int	pack_depth;
+	long long pack_memsize;
 };
 
 /*
@@ -39,6 +39,12 @@
 #include <string.h>
 
 #include "got_error.h"
+#include "got_cancel.h"
+#include "got_object.h"
+#include "got_reference.h"
+#include "got_repository.h"
+#include "got_repository_admin.h"
+
 #include "gotconfig.h"
 
 static struct file {
@@ -106,7 +112,7 @@ typedef struct {
 %token	ERROR
 %token	REMOTE REPOSITORY SERVER PORT PROTOCOL MIRROR_REFERENCES BRANCH
 %token	AUTHOR ALLOWED_SIGNERS REVOKED_SIGNERS SIGNER_ID FETCH_ALL_BRANCHES
-%token	REFERENCE FETCH SEND
+%token	REFERENCE FETCH SEND PACK_WINDOW PACK_DEPTH PACK_MEMORY
 %token	<v.string>	STRING
 %token	<v.number>	NUMBER
 %type	<v.number>	boolean portplain
@@ -123,6 +129,9 @@ grammar		: /* empty */
 		| grammar allowed_signers '\n'
 		| grammar revoked_signers '\n'
 		| grammar signer_id '\n'
+		| grammar pack_window '\n'
+		| grammar pack_depth '\n'
+		| grammar pack_memory '\n'
 		;
 boolean		: STRING {
 			if (strcasecmp($1, "true") == 0 ||
@@ -328,6 +337,36 @@ signer_id	: SIGNER_ID STRING {
 			gotconfig.signer_id = $2;
 		}
 		;
+pack_window	: PACK_WINDOW NUMBER {
+			if ($2 < 1 || $2 > GOT_PACK_DELTA_WINDOW_MAX) {
+				yyerror("pack_window must be between 1 and %d",
+				    GOT_PACK_DELTA_WINDOW_MAX);
+				YYERROR;
+			}
+			gotconfig.pack_window = $2;
+		}
+		;
+pack_depth	: PACK_DEPTH NUMBER {
+			if ($2 < 1 || $2 > GOT_PACK_DELTA_DEPTH_MAX) {
+				yyerror("pack_depth must be between 1 and %d",
+				    GOT_PACK_DELTA_DEPTH_MAX);
+				YYERROR;
+			}
+			gotconfig.pack_depth = $2;
+		}
+		;
+pack_memory	: PACK_MEMORY numberstring {
+			long long size;
+
+			if (scan_scaled($2, &size) == -1 || size < 1) {
+				yyerror("invalid pack_memory size: %s", $2);
+				free($2);
+				YYERROR;
+			}
+			free($2);
+			gotconfig.pack_memsize = size;
+		}
+		;
 optnl		: '\n' optnl
 		| /* empty */
 		;
@@ -384,6 +423,9 @@ lookup(char *s)
 		{"fetch_all_branches",	FETCH_ALL_BRANCHES},
 		{"mirror-references",	MIRROR_REFERENCES}, /* deprecated */
 		{"mirror_references",	MIRROR_REFERENCES},
+		{"pack_depth",		PACK_DEPTH},
+		{"pack_memory",		PACK_MEMORY},
+		{"pack_window",		PACK_WINDOW},
 		{"port",		PORT},
 		{"protocol",		PROTOCOL},
 		{"reference",		REFERENCE},
@@ -47,6 +47,7 @@
 #include "got_lib_object_idset.h"
 #include "got_lib_privsep.h"
 #include "got_lib_pack.h"
+#include "got_lib_commit_graph_file.h"
 
 #ifndef nitems
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
@@ -327,10 +328,92 @@ receive_tempfile(FILE **f, const char *mode, struct imsg *imsg,
 	return NULL;
 }
 
+static const struct got_error *
+receive_object_shm(uint8_t **shm, size_t *shm_size, struct imsg *imsg)
+{
+	const struct got_error *err = NULL;
+	size_t datalen;
+	struct stat sb;
+	uint8_t *p;
+	int fd;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != 0)
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+
+	fd = imsg_get_fd(imsg);
+	if (fd == -1)
+		return got_error(GOT_ERR_PRIVSEP_NO_FD);
+
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno("fstat");
+		goto done;
+	}
+	if (sb.st_size <= 0 || (uint64_t)sb.st_size > SIZE_MAX) {
+		err = got_error(GOT_ERR_PRIVSEP_LEN);
+		goto done;
+	}
+
+	p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		/* Keep going without shared memory. */
+		goto done;
+	}
+
+	*shm = p;
+	*shm_size = sb.st_size;
+done:
+	if (close(fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	return err;
+}
+
+static const struct got_error *
+receive_commit_graph(struct got_commit_graph_file **cg, struct imsg *imsg,
+    enum got_hash_algorithm algo)
+{
+	const struct got_error *err;
+	size_t datalen;
+	int fd;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != 0)
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+
+	fd = imsg_get_fd(imsg);
+	if (fd == -1)
+		return got_error(GOT_ERR_PRIVSEP_NO_FD);
+
+	err = got_commit_graph_file_open(cg, fd, algo);
+	if (err && err->code == GOT_ERR_BAD_COMMIT_GRAPH) {
+		/* Keep going without the commit-graph. */
+		*cg = NULL;
+		err = NULL;
+	}
+	return err;
+}
+
+static const struct got_error *
+receive_packidx_rev(struct got_packidx *packidx, struct imsg *imsg)
+{
+	size_t datalen;
+	int fd;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != 0)
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+
+	fd = imsg_get_fd(imsg);
+	if (fd == -1)
+		return got_error(GOT_ERR_PRIVSEP_NO_FD);
+
+	return got_packidx_open_reverse_index(packidx, fd);
+}
+
 static const struct got_error *
 blob_request(struct imsg *imsg, struct imsgbuf *ibuf, struct got_pack *pack,
     struct got_packidx *packidx, struct got_object_cache *objcache,
-    FILE *basefile, FILE *accumfile)
+    FILE *basefile, FILE *accumfile, uint8_t *shm, size_t shm_size)
 {
 	const struct got_error *err = NULL;
 	struct got_imsg_packed_object iobj;
@@ -340,6 +423,7 @@ blob_request(struct imsg *imsg, struct imsgbuf *ibuf, struct got_pack *pack,
 	size_t datalen;
 	uint64_t blob_size;
 	uint8_t *buf = NULL;
+	int use_shm = 0;
 
 	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
 	if (datalen != sizeof(iobj))
@@ -368,7 +452,13 @@ blob_request(struct imsg *imsg, struct imsgbuf *ibuf, struct got_pack *pack,
 	} else
 		blob_size = obj->size;
 
-	if (blob_size <= GOT_PRIVSEP_INLINE_BLOB_DATA_MAX)
+	if (shm && blob_size <= shm_size)
+		use_shm = 1;
+
+	if (use_shm)
+		err = got_packfile_extract_object_to_buf(shm, shm_size,
+		    &obj->size, obj, pack);
+	else if (blob_size <= GOT_PRIVSEP_INLINE_BLOB_DATA_MAX)
 		err = got_packfile_extract_object_to_mem(&buf, &obj->size,
 		    obj, pack);
 	else
@@ -377,7 +467,10 @@ blob_request(struct imsg *imsg, struct imsgbuf *ibuf, struct got_pack *pack,
 	if (err)
 		goto done;
 
-	err = got_privsep_send_blob(ibuf, obj->size, obj->hdrlen, buf);
+	if (use_shm)
+		err = got_privsep_send_blob_shm(ibuf, obj->size, obj->hdrlen);
+	else
+		err = got_privsep_send_blob(ibuf, obj->size, obj->hdrlen, buf);
 done:
 	free(buf);
 	if (outfile && fclose(outfile) == EOF && err == NULL)
@@ -636,10 +729,33 @@ send_commit_traversal_done(struct imsgbuf *ibuf)
 	return got_privsep_flush_imsg(ibuf);
 }
 
+/*
+ * Open a commit for traversal. Prefer the commit-graph file, if we have
+ * one, since this avoids inflating and parsing the commit object.
+ */
+static const struct got_error *
+open_traversed_commit(struct got_commit_object **commit,
+    struct got_pack *pack, struct got_packidx *packidx,
+    struct got_object_id *id, struct got_object_cache *objcache,
+    struct got_commit_graph_file *cg)
+{
+	uint32_t pos;
+	int idx;
+
+	if (cg && got_commit_graph_file_lookup(&pos, cg, id))
+		return got_commit_graph_file_get_commit(commit, cg, pos);
+
+	idx = got_packidx_get_object_idx(packidx, id);
+	if (idx == -1)
+		return got_error_no_obj(id);
+
+	return open_commit(commit, pack, packidx, idx, id, objcache);
+}
+
 static const struct got_error *
 commit_traversal_request(struct imsg *imsg, struct imsgbuf *ibuf,
     struct got_pack *pack, struct got_packidx *packidx,
-    struct got_object_cache *objcache)
+    struct got_object_cache *objcache, struct got_commit_graph_file *cg)
 {
 	const struct got_error *err = NULL;
 	struct got_imsg_commit_traversal_request ctreq;
@@ -650,6 +766,8 @@ commit_traversal_request(struct imsg *imsg, struct imsgbuf *ibuf,
 	char *path = NULL;
 	const int min_alloc = 64;
 	int changed = 0, ncommits = 0, nallocated = 0;
+	int path_present = 0;
+	uint32_t pos;
 	struct got_object_id *commit_ids = NULL;
 
 	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
@@ -682,11 +800,8 @@ commit_traversal_request(struct imsg *imsg, struct imsgbuf *ibuf,
 		}
 
 		if (commit == NULL) {
-			idx = got_packidx_get_object_idx(packidx, &id);
-			if (idx == -1)
-				break;
-			err = open_commit(&commit, pack, packidx,
-			    idx, &id, objcache);
+			err = open_traversed_commit(&commit, pack, packidx,
+			    &id, objcache, cg);
 			if (err) {
 				if (err->code != GOT_ERR_NO_OBJ)
 					goto done;
@@ -721,12 +836,8 @@ commit_traversal_request(struct imsg *imsg, struct imsgbuf *ibuf,
 		if (pid == NULL)
 			break;
 
-		idx = got_packidx_get_object_idx(packidx, &pid->id);
-		if (idx == -1)
-			break;
-
-		err = open_commit(&pcommit, pack, packidx, idx, &pid->id,
-		    objcache);
+		err = open_traversed_commit(&pcommit, pack, packidx,
+		    &pid->id, objcache, cg);
 		if (err) {
 			if (err->code != GOT_ERR_NO_OBJ)
 				goto done;
@@ -740,6 +851,14 @@ commit_traversal_request(struct imsg *imsg, struct imsgbuf *ibuf,
 				changed = 1;
 				break;
 			}
+		} else if (path_present && cg &&
+		    got_commit_graph_file_lookup(&pos, cg, &id) &&
+		    !got_commit_graph_file_path_maybe_changed(cg, pos, path)) {
+			/*
+			 * The bloom filter rules out changes to the path,
+			 * which is known to exist in this commit.
+			 */
+			changed = 0;
 		} else {
 			int pidx;
 			uint8_t *buf = NULL, *pbuf = NULL;
@@ -785,6 +904,7 @@ commit_traversal_request(struct imsg *imsg, struct imsgbuf *ibuf,
 			got_object_commit_close(commit);
 			commit = pcommit;
 			pcommit = NULL;
+			path_present = 1;
 		}
 	} while (!changed);
 
@@ -793,7 +913,25 @@ commit_traversal_request(struct imsg *imsg, struct imsgbuf *ibuf,
 		if (err)
 			goto done;
 
-		if (changed) {
+		/*
+		 * The changed commit will be cached by the main process.
+		 * A partial commit read from the commit-graph file will not
+		 * do; open the actual commit object instead, if possible.
+		 */
+		if (changed && (commit->flags & GOT_COMMIT_FLAG_PARTIAL)) {
+			int idx;
+
+			got_object_commit_close(commit);
+			commit = NULL;
+			idx = got_packidx_get_object_idx(packidx, &id);
+			if (idx != -1) {
+				err = open_commit(&commit, pack, packidx,
+				    idx, &id, objcache);
+				if (err)
+					goto done;
+			}
+		}
+		if (changed && commit) {
 			err = got_privsep_send_commit(ibuf, commit);
 			if (err)
 				goto done;
@@ -820,7 +958,8 @@ done:
 static const struct got_error *
 raw_object_request(struct imsg *imsg, struct imsgbuf *ibuf,
     struct got_pack *pack, struct got_packidx *packidx,
-    struct got_object_cache *objcache, FILE *basefile, FILE *accumfile)
+    struct got_object_cache *objcache, FILE *basefile, FILE *accumfile,
+    uint8_t *shm, size_t shm_size)
 {
 	const struct got_error *err = NULL;
 	uint8_t *buf = NULL;
@@ -830,6 +969,7 @@ raw_object_request(struct imsg *imsg, struct imsgbuf *ibuf,
 	struct got_object *obj;
 	struct got_object_id id;
 	size_t datalen;
+	int use_shm = 0;
 
 	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
 	if (datalen != sizeof(iobj))
@@ -858,7 +998,13 @@ raw_object_request(struct imsg *imsg, struct imsgbuf *ibuf,
 	} else
 		size = obj->size;
 
-	if (size <= GOT_PRIVSEP_INLINE_OBJECT_DATA_MAX)
+	if (shm && size <= shm_size)
+		use_shm = 1;
+
+	if (use_shm)
+		err = got_packfile_extract_object_to_buf(shm, shm_size,
+		    &obj->size, obj, pack);
+	else if (size <= GOT_PRIVSEP_INLINE_OBJECT_DATA_MAX)
 		err = got_packfile_extract_object_to_mem(&buf, &obj->size,
 		    obj, pack);
 	else
@@ -867,7 +1013,12 @@ raw_object_request(struct imsg *imsg, struct imsgbuf *ibuf,
 	if (err)
 		goto done;
 
-	err = got_privsep_send_raw_obj(ibuf, obj->size, obj->hdrlen, buf);
+	if (use_shm) {
+		/* Packed objects have no header. */
+		err = got_privsep_send_raw_obj_shm(ibuf, obj->size, 0);
+	} else
+		err = got_privsep_send_raw_obj(ibuf, obj->size, obj->hdrlen,
+		    buf);
 done:
 	free(buf);
 	if (outfile && fclose(outfile) == EOF && err == NULL)
@@ -2129,7 +2280,8 @@ receive_pack(struct got_pack **packp, struct imsgbuf *ibuf)
 		goto done;
 	}
 
-	err = got_delta_cache_alloc(&pack->delta_cache);
+	err = got_delta_cache_alloc(&pack->delta_cache,
+	    GOT_DELTA_CACHE_DEFAULT_SIZE);
 	if (err)
 		goto done;
 
@@ -2164,6 +2316,9 @@ main(int argc, char *argv[])
 	struct got_object_idset *keep = NULL, *drop = NULL, *skip = NULL;
 	struct got_parsed_tree_entry *entries = NULL;
 	size_t nentries = 0, nentries_alloc = 0;
+	struct got_commit_graph_file *cgraph = NULL;
+	uint8_t *shm = NULL;
+	size_t shm_size = 0;
 
 	//static int attached;
 	//while (!attached) sleep(1);
@@ -2249,6 +2404,23 @@ main(int argc, char *argv[])
 			} else
 				err = got_error(GOT_ERR_PRIVSEP_MSG);
 			break;
+		case GOT_IMSG_COMMIT_GRAPH:
+			if (cgraph != NULL) {
+				err = got_error(GOT_ERR_PRIVSEP_MSG);
+				break;
+			}
+			err = receive_commit_graph(&cgraph, &imsg, pack->algo);
+			break;
+		case GOT_IMSG_PACKIDX_REV:
+			err = receive_packidx_rev(packidx, &imsg);
+			break;
+		case GOT_IMSG_OBJECT_SHM:
+			if (shm != NULL) {
+				err = got_error(GOT_ERR_PRIVSEP_MSG);
+				break;
+			}
+			err = receive_object_shm(&shm, &shm_size, &imsg);
+			break;
 		case GOT_IMSG_PACKED_OBJECT_REQUEST:
 			err = object_request(&imsg, &ibuf, pack, packidx,
 			    &objcache);
@@ -2259,7 +2431,7 @@ main(int argc, char *argv[])
 				break;
 			}
 			err = raw_object_request(&imsg, &ibuf, pack, packidx,
-			    &objcache, basefile, accumfile);
+			    &objcache, basefile, accumfile, shm, shm_size);
 			break;
 		case GOT_IMSG_RAW_DELTA_OUTFD:
 			if (delta_outfile != NULL) {
@@ -2294,7 +2466,7 @@ main(int argc, char *argv[])
 				break;
 			}
 			err = blob_request(&imsg, &ibuf, pack, packidx,
-			    &objcache, basefile, accumfile);
+			    &objcache, basefile, accumfile, shm, shm_size);
 			break;
 		case GOT_IMSG_TAG_REQUEST:
 			err = tag_request(&imsg, &ibuf, pack, packidx,
@@ -2302,7 +2474,7 @@ main(int argc, char *argv[])
 			break;
 		case GOT_IMSG_COMMIT_TRAVERSAL_REQUEST:
 			err = commit_traversal_request(&imsg, &ibuf, pack,
-			    packidx, &objcache);
+			    packidx, &objcache, cgraph);
 			break;
 		case GOT_IMSG_OBJECT_ENUMERATION_REQUEST:
 			err = enumeration_request(&imsg, &ibuf, pack,
@@ -2334,7 +2506,11 @@ main(int argc, char *argv[])
 	}
 
 	free(entries);
+	if (shm && munmap(shm, shm_size) == -1 && err == NULL)
+		err = got_error_from_errno("munmap");
 	commit_painting_free(&keep, &drop, &skip);
+	if (cgraph)
+		got_commit_graph_file_close(cgraph);
 	if (packidx)
 		got_packidx_close(packidx);
 	if (pack) {
@@ -93,11 +93,31 @@ send_upload_progress(struct imsgbuf *ibuf, off_t bytes,
 	return got_privsep_flush_imsg(ibuf);
 }
 
+static int
+server_has_capability(const char *capabilities, const char *capastr)
+{
+	size_t len = strlen(capastr);
+	const char *p = capabilities;
+
+	while ((p = strstr(p, capastr)) != NULL) {
+		if ((p == capabilities || p[-1] == ' ') &&
+		    (p[len] == '\0' || p[len] == ' '))
+			return 1;
+		p += len;
+	}
+
+	return 0;
+}
+
 static const struct got_error *
-send_pack_request(struct imsgbuf *ibuf)
+send_pack_request(struct imsgbuf *ibuf, int allow_thin)
 {
+	struct got_imsg_send_pack_request ireq;
+
+	memset(&ireq, 0, sizeof(ireq));
+	ireq.allow_thin = allow_thin;
 	if (imsg_compose(ibuf, GOT_IMSG_SEND_PACK_REQUEST, 0, 0, -1,
-	    NULL, 0) == -1)
+	    &ireq, sizeof(ireq)) == -1)
 		return got_error_from_errno("imsg_compose SEND_PACK_REQUEST");
 	return got_privsep_flush_imsg(ibuf);
 }
@@ -355,6 +375,7 @@ send_pack(int fd, struct got_pathlist_head *refs,
 	char *server_capabilities = NULL, *my_capabilities = NULL;
 	struct got_pathlist_entry *pe;
 	int sent_my_capabilites = 0;
+	int allow_thin = 0;
 
 	RB_INIT(&their_refs);
 
@@ -389,6 +410,9 @@ send_pack(int fd, struct got_pathlist_head *refs,
 			if (chattygot && server_capabilities[0] != '\0')
 				fprintf(stderr, "%s: server capabilities: %s\n",
 				    getprogname(), server_capabilities);
+			/* Servers must opt out of receiving thin packs. */
+			allow_thin = !server_has_capability(
+			    server_capabilities, GOT_CAPA_NO_THIN);
 			err = got_gitproto_match_capabilities(&my_capabilities,
 			    NULL, server_capabilities, got_capabilities,
 			    nitems(got_capabilities));
@@ -540,7 +564,7 @@ send_pack(int fd, struct got_pathlist_head *refs,
 	if (err)
 		goto done;
 
-	err = send_pack_request(ibuf);
+	err = send_pack_request(ibuf, allow_thin);
 	if (err)
 		goto done;
 
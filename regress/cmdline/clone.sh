@@ -1007,6 +1007,247 @@ EOF
 	test_done "$testroot" "$ret"
 }
 
+test_clone_shallow() {
+	local testroot=`test_init clone_shallow`
+	local testurl=ssh://127.0.0.1/$testroot
+
+	echo "modified alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "modified alpha"
+	local commit_id1=`git_show_head $testroot/repo`
+	echo "modified beta" > $testroot/repo/beta
+	git_commit $testroot/repo -m "modified beta"
+	local commit_id2=`git_show_head $testroot/repo`
+
+	got clone -q -D 2 $testurl/repo $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "$commit_id1" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/repo-clone/shallow
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/repo-clone/shallow
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got log -r $testroot/repo-clone -l0 | grep ^commit \
+		> $testroot/stdout
+	echo "commit $commit_id2 (master, origin/master)" \
+		> $testroot/stdout.expected
+	echo "commit $commit_id1" >> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo-clone"
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# fetching the full history makes the repository complete again
+	got fetch -q -D 10 -r $testroot/repo-clone > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got fetch command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if [ -e $testroot/repo-clone/shallow ]; then
+		echo "shallow file exists after fetching full history" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	got log -l0 -r $testroot/repo | grep ^commit \
+		> $testroot/stdout.expected
+	got log -l0 -r $testroot/repo-clone | grep ^commit | \
+		sed 's@master, origin/master@master@g' > $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo-clone"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_clone_partial() {
+	local testroot=`test_init clone_partial`
+	local testurl=ssh://127.0.0.1/$testroot
+
+	git -C $testroot/repo config uploadpack.allowFilter true
+	git -C $testroot/repo config uploadpack.allowAnySHA1InWant true
+
+	echo "modified alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "modified alpha"
+
+	got clone -q -F blob:none $testurl/repo $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if ! ls $testroot/repo-clone/objects/pack/*.promisor >/dev/null; then
+		echo "partial clone lacks a promisor pack" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	local blob_id=`get_blob_id $testroot/repo "" alpha`
+	got cat -r $testroot/repo-clone $blob_id > /dev/null 2>&1
+	ret=$?
+	if [ $ret -eq 0 ]; then
+		echo "blob was not omitted from partial clone" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# missing blobs are fetched on demand
+	got checkout -q $testroot/repo-clone $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got checkout command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "modified alpha" > $testroot/content.expected
+	cmp -s $testroot/content.expected $testroot/wt/alpha
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/content.expected $testroot/wt/alpha
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo-clone"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_clone_v2_http() {
+	local testroot=`test_init clone_v2_http`
+	local testurl=http://127.0.0.1:${GOT_TEST_HTTP_PORT}
+	local commit_id=`git_show_head $testroot/repo`
+
+	got branch -r $testroot/repo -c $commit_id foo
+	got branch -r $testroot/repo -c $commit_id bar
+	got ref -r $testroot/repo -c $commit_id refs/hoo/boo/zoo
+	got tag -r $testroot/repo -c $commit_id -m tag "1.0" >/dev/null
+	local tag_id=`got ref -r $testroot/repo -l \
+		| grep "^refs/tags/1.0" | tr -d ' ' | cut -d: -f2`
+
+	# Record the packets seen by git-upload-pack on the server side.
+	GIT_TRACE_PACKET=$testroot/packet.log \
+	    timeout 20 ./http-server -p $GOT_TEST_HTTP_PORT $testroot \
+	    > $testroot/http-server.log &
+
+	sleep 1 # server starts up
+	for i in 1 2 3 4; do
+		if grep -q ': ready' $testroot/http-server.log; then
+			break
+		fi
+		if [ $i -eq 4 ]; then
+			echo "http-server startup timeout" >&2
+			test_done "$testroot" "1"
+			# timeout(1) will kill the server eventually
+			return 1
+		fi
+		sleep 1 # server is still starting up
+	done
+
+	http_pid=`head -n 1 $testroot/http-server.log | cut -d ':' -f1`
+	trap "kill -9 $http_pid; wait $http_pid" HUP INT QUIT PIPE TERM
+
+	got clone -q -b foo $testurl/repo $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	kill $http_pid
+	wait $http_pid
+
+	if ! grep -q 'upload-pack> version 2$' $testroot/packet.log; then
+		echo "server did not use protocol version 2" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# Refs must be listed with ls-refs, limited to the wanted prefixes.
+	sed -n 's/^.*upload-pack< \(command=.*\|ref-prefix .*\)$/\1/p' \
+		$testroot/packet.log > $testroot/stdout
+	cat > $testroot/stdout.expected <<EOF
+command=ls-refs
+ref-prefix HEAD
+ref-prefix refs/tags/
+ref-prefix refs/heads/foo
+command=fetch
+EOF
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# refs/heads/bar and refs/hoo/boo/zoo must not be advertised
+	sed -n 's/^.*upload-pack> [0-9a-f]\{40\} \([^ ]*\).*$/\1/p' \
+		$testroot/packet.log > $testroot/stdout
+	cat > $testroot/stdout.expected <<EOF
+HEAD
+refs/heads/foo
+refs/tags/1.0
+EOF
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -l -r $testroot/repo-clone > $testroot/stdout
+
+	echo "HEAD: refs/heads/foo" > $testroot/stdout.expected
+	echo "refs/heads/foo: $commit_id" >> $testroot/stdout.expected
+	echo "refs/remotes/origin/foo: $commit_id" >> $testroot/stdout.expected
+	echo "refs/tags/1.0: $tag_id" >> $testroot/stdout.expected
+
+	cmp -s $testroot/stdout $testroot/stdout.expected
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo-clone"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_clone_basic			no-sha256
 run_test test_clone_quoting			no-sha256
@@ -1021,3 +1262,6 @@ run_test test_clone_reference_mirror		no-sha256
 run_test test_clone_multiple_branches		no-sha256
 run_test test_clone_dangling_headref		no-sha256
 run_test test_clone_basic_http			no-sha256
+run_test test_clone_v2_http			no-sha256
+run_test test_clone_shallow			no-sha256
+run_test test_clone_partial			no-sha256
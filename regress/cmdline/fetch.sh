@@ -2020,6 +2020,64 @@ EOF
 
 }
 
+test_fetch_thin_pack() {
+	local testroot=`test_init fetch_thin_pack`
+	local testurl=ssh://127.0.0.1/$testroot
+
+	seq 2000 > $testroot/repo/numbers
+	git -C $testroot/repo add numbers
+	git_commit $testroot/repo -m "add numbers"
+	local blob_id=`get_blob_id $testroot/repo "" numbers`
+
+	got clone -q $testurl/repo $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	ls $testroot/repo-clone/objects/pack/*.pack > $testroot/packs.clone
+
+	sed -i -e 's/^1000$/one thousand/' $testroot/repo/numbers
+	git_commit $testroot/repo -m "modified numbers"
+	local commit_id2=`git_show_head $testroot/repo`
+
+	got fetch -q -r $testroot/repo-clone > $testroot/stdout \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got fetch command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# The server sends a delta against the blob we already have.
+	# It must have been appended to the fetched pack file.
+	ls $testroot/repo-clone/objects/pack/*.pack > $testroot/packs.fetch
+	local pack=`comm -13 $testroot/packs.clone $testroot/packs.fetch`
+	gotadmin listpack $pack | grep -q "^$blob_id blob"
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "blob $blob_id not found in fetched pack file" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	got cat -r $testroot/repo-clone -c $commit_id2 numbers \
+		> $testroot/stdout
+	cmp -s $testroot/repo/numbers $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/repo/numbers $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck $testroot $testroot/repo-clone
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
 test_fetch_basic_http() {
 	local testroot=`test_init fetch_basic_http`
 	local testurl=http://127.0.0.1:$GOT_TEST_HTTP_PORT
@@ -2151,6 +2209,331 @@ test_fetch_basic_http() {
 	test_done "$testroot" "$ret"
 }
 
+test_fetch_rewritten_history() {
+	local testroot=`test_init fetch_rewritten_history`
+	local testurl=ssh://127.0.0.1/$testroot
+	local commit_id=`git_show_head $testroot/repo`
+
+	for i in `seq 20`; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "alpha $i"
+	done
+
+	got clone -q $testurl/repo $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	ls $testroot/repo-clone/objects/pack/*.pack > $testroot/packs.clone
+
+	# The tip of our remote branch will be unknown to the server.
+	git -C $testroot/repo reset -q --hard HEAD~10
+	echo "rewritten alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "rewritten alpha"
+	local commit_id2=`git_show_head $testroot/repo`
+	git -C $testroot/repo reflog expire --expire=now --all
+	git -C $testroot/repo gc -q --prune=now
+
+	got fetch -q -r $testroot/repo-clone > $testroot/stdout \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got fetch command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -r $testroot/repo-clone -l refs/remotes/origin/master \
+		> $testroot/stdout
+	echo "refs/remotes/origin/master: $commit_id2" \
+		> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Negotiation should have found a common commit in our history.
+	ls $testroot/repo-clone/objects/pack/*.pack > $testroot/packs.fetch
+	local pack=`comm -13 $testroot/packs.clone $testroot/packs.fetch`
+	gotadmin listpack $pack | grep -q "^$commit_id commit"
+	ret=$?
+	if [ $ret -eq 0 ]; then
+		echo "commit $commit_id was fetched again" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	git_fsck $testroot $testroot/repo-clone
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_fetch_v2_http() {
+	local testroot=`test_init fetch_v2_http`
+	local testurl=http://127.0.0.1:$GOT_TEST_HTTP_PORT
+	local commit_id=`git_show_head $testroot/repo`
+
+	# Record the packets seen by git-upload-pack on the server side.
+	GIT_TRACE_PACKET=$testroot/packet.log \
+	    timeout 20 ./http-server -p $GOT_TEST_HTTP_PORT $testroot \
+	    > $testroot/http-server.log &
+
+	sleep 1 # server starts up
+	for i in 1 2 3 4; do
+		if grep -q ': ready' $testroot/http-server.log; then
+			break
+		fi
+		if [ $i -eq 4 ]; then
+			echo "http-server startup timeout" >&2
+			test_done "$testroot" "1"
+			# timeout(1) will kill the server eventually
+			return 1
+		fi
+		sleep 1 # server is still starting up
+	done
+
+	http_pid=`head -n 1 $testroot/http-server.log | cut -d ':' -f1`
+	trap "kill -9 $http_pid; wait $http_pid" HUP INT QUIT PIPE TERM
+
+	got clone -q $testurl/repo $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got branch -r $testroot/repo -c $commit_id foo
+	got ref -r $testroot/repo -c $commit_id refs/hoo/boo/zoo
+	got tag -r $testroot/repo -c $commit_id -m tag "1.0" >/dev/null
+	local tag_id=`got ref -r $testroot/repo -l \
+		| grep "^refs/tags/1.0" | tr -d ' ' | cut -d: -f2`
+
+	echo "modified alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "modified alpha"
+	local commit_id2=`git_show_head $testroot/repo`
+
+	: > $testroot/packet.log
+	got fetch -q -r $testroot/repo-clone -R refs/hoo
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got fetch command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if ! grep -q 'upload-pack> version 2$' $testroot/packet.log; then
+		echo "server did not use protocol version 2" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# Refs must be listed with ls-refs, limited to the wanted prefixes.
+	sed -n 's/^.*upload-pack< \(command=.*\|ref-prefix .*\)$/\1/p' \
+		$testroot/packet.log > $testroot/stdout
+	cat > $testroot/stdout.expected <<EOF
+command=ls-refs
+ref-prefix HEAD
+ref-prefix refs/tags/
+ref-prefix refs/heads/master
+ref-prefix refs/hoo
+command=fetch
+EOF
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# refs/heads/foo must not be advertised
+	sed -n 's/^.*upload-pack> [0-9a-f]\{40\} \([^ ]*\).*$/\1/p' \
+		$testroot/packet.log > $testroot/stdout
+	cat > $testroot/stdout.expected <<EOF
+HEAD
+refs/heads/master
+refs/hoo/boo/zoo
+refs/tags/1.0
+EOF
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -l -r $testroot/repo-clone > $testroot/stdout
+
+	echo "HEAD: refs/heads/master" > $testroot/stdout.expected
+	echo "refs/heads/master: $commit_id" >> $testroot/stdout.expected
+	echo "refs/remotes/origin/HEAD: refs/remotes/origin/master" \
+		>> $testroot/stdout.expected
+	echo "refs/remotes/origin/hoo/boo/zoo: $commit_id" \
+		>> $testroot/stdout.expected
+	echo "refs/remotes/origin/master: $commit_id2" \
+		>> $testroot/stdout.expected
+	echo "refs/tags/1.0: $tag_id" >> $testroot/stdout.expected
+
+	cmp -s $testroot/stdout $testroot/stdout.expected
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Listing refs must not send any ref-prefix arguments.
+	: > $testroot/packet.log
+	got fetch -q -l -r $testroot/repo-clone > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got fetch command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	kill $http_pid
+	wait $http_pid
+
+	if grep -q 'upload-pack< ref-prefix' $testroot/packet.log; then
+		echo "ref-prefix sent while listing refs" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	got ref -l -r $testroot/repo > $testroot/stdout.expected
+
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck $testroot $testroot/repo-clone
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_fetch_v0_http() {
+	local testroot=`test_init fetch_v0_http`
+	local testurl=http://127.0.0.1:$GOT_TEST_HTTP_PORT
+	local commit_id=`git_show_head $testroot/repo`
+
+	# Make the server ignore Git-Protocol to force protocol version 0.
+	GIT_TRACE_PACKET=$testroot/packet.log \
+	    timeout 20 ./http-server -n -p $GOT_TEST_HTTP_PORT $testroot \
+	    > $testroot/http-server.log &
+
+	sleep 1 # server starts up
+	for i in 1 2 3 4; do
+		if grep -q ': ready' $testroot/http-server.log; then
+			break
+		fi
+		if [ $i -eq 4 ]; then
+			echo "http-server startup timeout" >&2
+			test_done "$testroot" "1"
+			# timeout(1) will kill the server eventually
+			return 1
+		fi
+		sleep 1 # server is still starting up
+	done
+
+	http_pid=`head -n 1 $testroot/http-server.log | cut -d ':' -f1`
+	trap "kill -9 $http_pid; wait $http_pid" HUP INT QUIT PIPE TERM
+
+	got clone -q $testurl/repo $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Local commits unknown to the server require more than one
+	# round of have lines when negotiating over a stateful transport.
+	got checkout -q $testroot/repo-clone $testroot/wt > /dev/null
+	for i in `seq 1 40`; do
+		echo "local change $i" > $testroot/wt/alpha
+		(cd $testroot/wt && got commit -m "local $i" > /dev/null)
+	done
+
+	echo "modified alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "modified alpha"
+	local commit_id2=`git_show_head $testroot/repo`
+
+	: > $testroot/packet.log
+	got fetch -q -r $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got fetch command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if grep -q 'upload-pack> version 2$' $testroot/packet.log; then
+		echo "server used protocol version 2" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# All have lines must be sent in a single request.
+	grep -c 'upload-pack< done$' $testroot/packet.log > $testroot/stdout
+	echo 1 > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -l -r $testroot/repo-clone refs/remotes/origin/master \
+		> $testroot/stdout
+	echo "refs/remotes/origin/master: $commit_id2" \
+		> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# New shallow commits are announced in the same response.
+	got clone -q -D 1 $testurl/repo $testroot/repo-shallow
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	kill $http_pid
+	wait $http_pid
+
+	echo "$commit_id2" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/repo-shallow/shallow
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/repo-shallow/shallow
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck $testroot $testroot/repo-clone
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_fetch_basic			no-sha256
 run_test test_fetch_list			no-sha256
@@ -2169,4 +2552,8 @@ run_test test_fetch_gitconfig_remote_repo	no-sha256
 run_test test_fetch_delete_remote_refs		no-sha256
 run_test test_fetch_honor_wt_conf_bflag		no-sha256
 run_test test_fetch_from_out_of_date_remote	no-sha256
+run_test test_fetch_thin_pack			no-sha256
+run_test test_fetch_rewritten_history		no-sha256
 run_test test_fetch_basic_http			no-sha256
+run_test test_fetch_v2_http			no-sha256
+run_test test_fetch_v0_http			no-sha256
@@ -1303,6 +1303,113 @@ EOF
 }
 
 
+test_log_git_commit_graph() {
+	local testroot=`test_init log_git_commit_graph`
+	local paths="alpha epsilon epsilon/zeta new"
+
+	for i in 1 2 3 4; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+		echo "zeta $i" > $testroot/repo/epsilon/zeta
+		git_commit $testroot/repo -m "edit zeta $i"
+	done
+
+	# create a merge commit
+	git -C $testroot/repo checkout -q -b side master~3
+	echo "new file" > $testroot/repo/new
+	git -C $testroot/repo add new
+	git_commit $testroot/repo -m "add new"
+	git -C $testroot/repo checkout -q master
+	git -C $testroot/repo merge -q --no-edit side
+
+	got log -r $testroot/repo > $testroot/stdout.expected
+	for p in $paths; do
+		got log -r $testroot/repo $p >> $testroot/stdout.expected
+	done
+
+	git -C $testroot/repo commit-graph write --reachable --changed-paths
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git commit-graph write failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got log -r $testroot/repo > $testroot/stdout
+	for p in $paths; do
+		got log -r $testroot/repo $p >> $testroot/stdout
+	done
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_log_corrupt_commit_graph() {
+	local testroot=`test_init log_corrupt_commit_graph`
+	local cg=$testroot/repo/.git/objects/info/commit-graph
+	local digest_len=20
+
+	if [ "${GOT_TEST_ALGO}" = sha256 ]; then
+		digest_len=32
+	fi
+
+	for i in 1 2 3 4; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+	done
+
+	got log -r $testroot/repo > $testroot/stdout.expected
+
+	gotadmin pack -a -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	if [ ! -f $cg ]; then
+		echo "commit-graph file was not written" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# Find the commit data chunk via the chunk table after the header.
+	local pos=`grep -obUa CDAT $cg | head -n 1 | cut -d: -f1`
+	local cdat=`dd if=$cg bs=1 skip=$((pos + 8)) count=4 2> /dev/null \
+		| od -An -t u1 \
+		| awk '{ print $1 * 16777216 + $2 * 65536 + $3 * 256 + $4 }'`
+
+	# Make every commit appear to have no parents but keep the checksum.
+	for i in 0 1 2 3 4; do
+		printf '\160\000\000\000' | dd of=$cg bs=1 \
+			seek=$((cdat + i * (digest_len + 16) + digest_len)) \
+			conv=notrunc 2> /dev/null
+	done
+
+	got log -r $testroot/repo > $testroot/stdout 2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got log failed unexpectedly" >&2
+		cat $testroot/stderr >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# git fsck would complain about the corrupt file
+	rm $cg
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_log_in_repo
 run_test test_log_in_bare_repo
@@ -1322,3 +1429,5 @@ run_test test_log_submodule
 run_test test_log_diffstat
 run_test test_log_commit_keywords
 run_test test_log_toposort
+run_test test_log_git_commit_graph
+run_test test_log_corrupt_commit_graph
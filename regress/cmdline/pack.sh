@@ -857,6 +857,995 @@ test_pack_exclude_via_ancestor_commit_packed() {
 
 	test_done "$testroot" "$ret"
 }
+
+test_pack_delta_depth() {
+	local testroot=`test_init pack_delta_depth`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	for i in 1 2 3 4 5 6 7 8; do
+		seq 1 $((i * 100)) >> $testroot/wt/alpha
+		(cd $testroot/wt && got commit -m "edit alpha $i" >/dev/null)
+	done
+
+	gotadmin pack -w 0 -r $testroot/repo > $testroot/stdout \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -eq 0 ]; then
+		echo "gotadmin pack succeeded unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	echo "gotadmin: delta window size is too small: 0" \
+		> $testroot/stderr.expected
+	cmp -s $testroot/stderr.expected $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stderr.expected $testroot/stderr
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	printf "pack_window 10\npack_depth 1\n" > $testroot/repo/.git/got.conf
+
+	gotadmin pack -r $testroot/repo > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	packname=`grep ^Wrote $testroot/stdout | cut -d ' ' -f2`
+	gotadmin listpack $testroot/repo/.git/objects/pack/pack-$packname \
+		> $testroot/stdout
+
+	if ! grep -q offset-delta $testroot/stdout; then
+		echo "no deltified objects found in pack file" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# The base of a delta must not be a delta itself.
+	awk '$2 == "offset-delta" { delta[$4] = 1; base[$10] = 1 }
+	    END { for (off in base) if (off in delta) exit 1 }' \
+	    $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "delta chain exceeds configured depth" >&2
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_pack_reused_delta_depth() {
+	local testroot=`test_init pack_reused_delta_depth`
+	local packdir=$testroot/repo/.git/objects/pack
+
+	# Each version of alpha makes a good delta base for its predecessor.
+	for i in `seq 0 12`; do
+		seq 1 2000 | awk -v n=$i \
+		    '{ print } NR % 150 == 0 && NR / 150 <= n { print "line" }' \
+		    > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+	done
+
+	git -C $testroot/repo repack -q -a -d -f --depth=50
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git repack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Print the length of the longest delta chain in a pack file.
+	local max_depth='$2 == "offset-delta" {
+		depth[$4] = depth[$10] + 1
+		if (depth[$4] > max) max = depth[$4]
+	    } END { print max + 0 }'
+
+	gotadmin listpack $packdir/pack-*.pack | sort -n -k4 \
+		| awk "$max_depth" > $testroot/depth
+	if [ "`cat $testroot/depth`" -le 2 ]; then
+		echo "git repack did not create long delta chains" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# Deltas reused from Git's pack file must respect the limit, too.
+	gotadmin pack -a -d 2 -r $testroot/repo > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	packname=`grep ^Wrote $testroot/stdout | cut -d ' ' -f2`
+	gotadmin listpack $packdir/pack-$packname > $testroot/stdout
+
+	if ! grep -q offset-delta $testroot/stdout; then
+		echo "no deltified objects found in pack file" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	sort -n -k4 $testroot/stdout | awk "$max_depth" > $testroot/depth
+	if [ "`cat $testroot/depth`" -gt 2 ]; then
+		echo "delta chain exceeds configured depth:" \
+			"`cat $testroot/depth`" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	gotadmin cleanup -a -q -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin cleanup failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_pack_reuse_verbatim() {
+	local testroot=`test_init pack_reuse_verbatim`
+	local trailer_len=20
+
+	if [ "${GOT_TEST_ALGO}" = sha256 ]; then
+		trailer_len=32
+	fi
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	for i in 1 2 3 4 5 6 7 8; do
+		seq 1 $((i * 100)) >> $testroot/wt/alpha
+		(cd $testroot/wt && got commit -m "edit alpha $i" >/dev/null)
+	done
+
+	gotadmin pack -a -r $testroot/repo > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	packname1=`grep ^Wrote $testroot/stdout | cut -d ' ' -f2`
+	packfile1=$testroot/repo/.git/objects/pack/pack-$packname1
+	packsize1=`wc -c < $packfile1`
+
+	echo "modified beta" > $testroot/wt/beta
+	(cd $testroot/wt && got commit -m "edit beta" >/dev/null)
+
+	gotadmin pack -a -r $testroot/repo > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	packname2=`grep ^Wrote $testroot/stdout | cut -d ' ' -f2`
+	packfile2=$testroot/repo/.git/objects/pack/pack-$packname2
+
+	# Objects of the first pack file should have been copied as is,
+	# following the 12-byte pack file header.
+	cmp -s -i 12 -n $((packsize1 - 12 - trailer_len)) \
+		$packfile1 $packfile2
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "objects were not copied verbatim" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	nobj1=`gotadmin listpack $packfile1 | grep -c '^[0-9a-f]'`
+	nobj2=`gotadmin listpack $packfile2 | grep -c '^[0-9a-f]'`
+	if [ "$nobj2" -ne $((nobj1 + 3)) ]; then
+		echo "unexpected number of objects: $nobj2" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	gotadmin cleanup -a -q -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin cleanup failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_pack_commit_graph() {
+	local testroot=`test_init pack_commit_graph`
+	local paths="alpha epsilon/zeta new"
+
+	for i in 1 2 3 4; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+		echo "zeta $i" > $testroot/repo/epsilon/zeta
+		git_commit $testroot/repo -m "edit zeta $i"
+	done
+
+	# create a merge commit
+	git -C $testroot/repo checkout -q -b side master~3
+	echo "new file" > $testroot/repo/new
+	git -C $testroot/repo add new
+	git_commit $testroot/repo -m "add new"
+	git -C $testroot/repo checkout -q master
+	git -C $testroot/repo merge -q --no-edit side
+
+	got log -r $testroot/repo > $testroot/log.expected
+	for p in $paths; do
+		got log -r $testroot/repo $p >> $testroot/log.expected
+	done
+
+	gotadmin pack -a -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if [ ! -f $testroot/repo/.git/objects/info/commit-graph ]; then
+		echo "commit-graph file was not written" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	git -C $testroot/repo commit-graph verify > $testroot/stdout \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git commit-graph verify failed" >&2
+		cat $testroot/stderr >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got log -r $testroot/repo > $testroot/stdout
+	for p in $paths; do
+		got log -r $testroot/repo $p >> $testroot/stdout
+	done
+	cmp -s $testroot/log.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/log.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# The commit-graph file should be rewritten by cleanup.
+	rm $testroot/repo/.git/objects/info/commit-graph
+	gotadmin cleanup -a -q -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin cleanup failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git -C $testroot/repo commit-graph verify > $testroot/stdout \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git commit-graph verify failed after cleanup" >&2
+		cat $testroot/stderr >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got log -r $testroot/repo > $testroot/stdout
+	for p in $paths; do
+		got log -r $testroot/repo $p >> $testroot/stdout
+	done
+	cmp -s $testroot/log.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/log.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_pack_bitmap() {
+	local testroot=`test_init pack_bitmap`
+
+	for i in 1 2 3 4; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+	done
+	got branch -r $testroot/repo foo
+	for i in 1 2 3 4; do
+		echo "zeta $i" > $testroot/repo/epsilon/zeta
+		echo "new $i" > $testroot/repo/new
+		git -C $testroot/repo add new
+		git_commit $testroot/repo -m "edit zeta $i"
+	done
+	got tag -r $testroot/repo -m "tag" 1.0 > /dev/null
+
+	gotadmin pack -a -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	gotadmin cleanup -a -q -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin cleanup failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	ls $testroot/repo/.git/objects/pack/*.bitmap > /dev/null 2>&1
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "bitmap file was not written" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Objects in a pack created with the help of our bitmap...
+	gotadmin pack -a -r $testroot/repo -x foo master 1.0 > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	packname=`grep ^Wrote $testroot/stdout | cut -d ' ' -f2`
+	gotadmin listpack $testroot/repo/.git/objects/pack/pack-$packname | \
+		grep '^[0-9a-f]' | cut -d ' ' -f1 | sort > $testroot/objects
+	rm $testroot/repo/.git/objects/pack/pack-$packname
+	rm $testroot/repo/.git/objects/pack/pack-${packname%.pack}.*
+
+	# ...should match objects in a pack created without a bitmap...
+	rm $testroot/repo/.git/objects/pack/*.bitmap
+	gotadmin pack -a -r $testroot/repo -x foo master 1.0 > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	packname=`grep ^Wrote $testroot/stdout | cut -d ' ' -f2`
+	gotadmin listpack $testroot/repo/.git/objects/pack/pack-$packname | \
+		grep '^[0-9a-f]' | cut -d ' ' -f1 | sort \
+		> $testroot/objects.expected
+	rm $testroot/repo/.git/objects/pack/pack-$packname
+	rm $testroot/repo/.git/objects/pack/pack-${packname%.pack}.*
+
+	git -C $testroot/repo rev-list --objects foo..master 1.0 | \
+		cut -d ' ' -f1 | sort > $testroot/objects.git
+	cmp -s $testroot/objects.git $testroot/objects.expected
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/objects.git $testroot/objects.expected
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cmp -s $testroot/objects.expected $testroot/objects
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/objects.expected $testroot/objects
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# ...and objects in a pack created with a bitmap written by Git.
+	git -C $testroot/repo repack -q -a -d -b
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git repack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	gotadmin pack -a -r $testroot/repo -x foo master 1.0 > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	packname=`grep ^Wrote $testroot/stdout | cut -d ' ' -f2`
+	gotadmin listpack $testroot/repo/.git/objects/pack/pack-$packname | \
+		grep '^[0-9a-f]' | cut -d ' ' -f1 | sort > $testroot/objects
+	cmp -s $testroot/objects.expected $testroot/objects
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/objects.expected $testroot/objects
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_pack_multi_pack_index() {
+	local testroot=`test_init pack_multi_pack_index`
+	local midx=$testroot/repo/.git/objects/pack/multi-pack-index
+
+	for i in 1 2; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+	done
+	gotadmin pack -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	for i in 3 4; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+	done
+	gotadmin pack -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	git -C $testroot/repo prune-packed
+
+	if [ ! -f $midx ]; then
+		echo "multi-pack-index file was not written" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	git -C $testroot/repo multi-pack-index verify > /dev/null \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git multi-pack-index verify failed" >&2
+		cat $testroot/stderr >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got log -r $testroot/repo -p | grep -c '^+alpha [0-9]' > $testroot/stdout
+	echo 4 > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Objects should be found via a multi-pack-index written by Git.
+	rm $midx
+	git -C $testroot/repo multi-pack-index write
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git multi-pack-index write failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got log -r $testroot/repo -p | grep -c '^+alpha [0-9]' > $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Objects in a pack file which is missing from the multi-pack-index
+	# should be found as well.
+	echo "alpha 5" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "edit alpha 5"
+	git -C $testroot/repo rev-list --objects master~1..master | \
+		git -C $testroot/repo pack-objects -q .git/objects/pack/pack \
+		> /dev/null
+	git -C $testroot/repo prune-packed
+
+	got log -r $testroot/repo -p | grep -c '^+alpha [0-9]' > $testroot/stdout
+	echo 5 > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got cat -r $testroot/repo -c master -P alpha > $testroot/stdout
+	echo "alpha 5" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_pack_bloom_filter() {
+	local testroot=`test_init pack_bloom_filter`
+	local packdir=$testroot/repo/.git/objects/pack
+	local digest_len=20
+
+	if [ "$GOT_TEST_ALGO" = "sha256" ]; then
+		digest_len=32
+	fi
+
+	gotadmin pack -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	local bloom1=`ls $packdir/pack-*.bloom`
+
+	echo "alpha 1" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "edit alpha"
+	gotadmin pack -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	git -C $testroot/repo prune-packed
+
+	# Make got search each pack index file via its bloom filter.
+	rm -f $packdir/multi-pack-index
+
+	local bloom2=`ls $packdir/pack-*.bloom | grep -v $bloom1`
+	if [ ! -f "$bloom1" -o ! -f "$bloom2" ]; then
+		echo "bloom filter files were not written" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	cp $bloom2 $testroot/bloom.orig
+	echo "alpha 1" > $testroot/stdout.expected
+
+	for corruption in stale garbage truncated; do
+		cp $testroot/bloom.orig $bloom2
+		case $corruption in
+		stale)
+			# filter file of a different pack file
+			cp $bloom1 $bloom2
+			;;
+		garbage)
+			# clear all bits, keeping the header and trailer intact
+			local size=`wc -c < $bloom2`
+			local nbytes=$((size - 28 - 2 * digest_len))
+			dd if=/dev/zero of=$bloom2 bs=1 seek=28 \
+				count=$nbytes conv=notrunc 2> /dev/null
+			;;
+		truncated)
+			dd if=$testroot/bloom.orig of=$bloom2 bs=1 count=40 \
+				2> /dev/null
+			;;
+		esac
+
+		got cat -r $testroot/repo -c master -P alpha \
+			> $testroot/stdout 2> $testroot/stderr
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got cat failed with $corruption bloom file" >&2
+			cat $testroot/stderr >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+		cmp -s $testroot/stdout.expected $testroot/stdout
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			diff -u $testroot/stdout.expected $testroot/stdout
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	test_done "$testroot" "$ret"
+}
+
+test_pack_reverse_index() {
+	local testroot=`test_init pack_reverse_index`
+	local packdir=$testroot/repo/.git/objects/pack
+
+	for i in 1 2 3; do
+		seq 1 $((i * 200)) > $testroot/repo/numbers
+		git -C $testroot/repo add numbers
+		git_commit $testroot/repo -m "numbers $i"
+	done
+	gotadmin pack -a -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	local pack=`ls $packdir/pack-*.pack`
+	local rev=`ls $packdir/pack-*.rev`
+	if [ ! -f "$rev" ]; then
+		echo "reverse index file was not written" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	mv $rev $testroot/rev.got
+
+	gotadmin listpack $pack > $testroot/stdout.expected
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin listpack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Our reverse index should match the one written by Git.
+	git -C $testroot/repo index-pack --rev-index $pack > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git index-pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	cmp -s $testroot/rev.got $rev
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "reverse index files differ" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	cp $rev $testroot/rev.orig
+
+	# Write a second pack file for a stale reverse index file.
+	echo "new file" > $testroot/repo/new
+	git -C $testroot/repo add new
+	git_commit $testroot/repo -m "add new"
+	gotadmin pack -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	local rev2=`ls $packdir/pack-*.rev | grep -v $rev`
+
+	for corruption in none stale corrupt truncated; do
+		cp $testroot/rev.orig $rev
+		case $corruption in
+		stale)
+			cp $rev2 $rev
+			;;
+		corrupt)
+			# swap the first two entries, keeping the checksum
+			dd if=$testroot/rev.orig of=$rev bs=1 skip=12 seek=16 \
+				count=4 conv=notrunc 2> /dev/null
+			dd if=$testroot/rev.orig of=$rev bs=1 skip=16 seek=12 \
+				count=4 conv=notrunc 2> /dev/null
+			;;
+		truncated)
+			dd if=$testroot/rev.orig of=$rev bs=1 count=16 \
+				2> /dev/null
+			;;
+		esac
+
+		gotadmin listpack $pack > $testroot/stdout \
+			2> $testroot/stderr
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "gotadmin listpack failed with $corruption" \
+				"reverse index file" >&2
+			cat $testroot/stderr >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+		cmp -s $testroot/stdout.expected $testroot/stdout
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			diff -u $testroot/stdout.expected $testroot/stdout
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	test_done "$testroot" "$ret"
+}
+
+test_pack_index_threads() {
+	local testroot=`test_init pack_index_threads`
+	local packdir=$testroot/repo/.git/objects/pack
+
+	# Create enough offset deltas to keep several threads busy.
+	seq 1 500 > $testroot/base
+	mkdir $testroot/repo/files
+	for i in `seq 1 1200`; do
+		(cat $testroot/base; echo "file $i") \
+			> $testroot/repo/files/file$i
+	done
+	git -C $testroot/repo add files
+	git_commit $testroot/repo -m "add files"
+	git -C $testroot/repo repack -q -a -d -f
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git repack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	local pack=`ls $packdir/pack-*.pack`
+	local idx=`ls $packdir/pack-*.idx`
+	mv $idx $testroot/idx.git
+
+	for n in 1 4; do
+		gotadmin indexpack -j $n $pack > /dev/null
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "gotadmin indexpack -j $n failed unexpectedly" >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+		mv $idx $testroot/idx.$n
+	done
+
+	# The pack index must not depend on the number of threads.
+	cmp -s $testroot/idx.1 $testroot/idx.4
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "pack index files differ" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cmp -s $testroot/idx.git $testroot/idx.4
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "pack index differs from Git's pack index" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cp $testroot/idx.4 $idx
+	git_fsck "$testroot" "$testroot/repo"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_pack_shallow() {
+	local testroot=`test_init pack_shallow`
+
+	for i in 1 2 3 4; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+	done
+	local commit_id=`git_show_head $testroot/repo`
+
+	# write a commit-graph covering the full history
+	gotadmin pack -a -r $testroot/repo > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git clone -q --bare --depth 1 file://$testroot/repo \
+		$testroot/repo-shallow
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git clone failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Parents of the shallow commit are missing. Packing used to fail
+	# while writing the commit-graph and bitmap files.
+	gotadmin pack -a -r $testroot/repo-shallow > $testroot/stdout \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		cat $testroot/stderr >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if [ -e $testroot/repo-shallow/objects/info/commit-graph ]; then
+		echo "commit-graph file written in shallow repository" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	if ls $testroot/repo-shallow/objects/pack/ | grep -q '\.bitmap$'; then
+		echo "bitmap file written in shallow repository" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	got log -r $testroot/repo-shallow | grep '^commit' > $testroot/stdout
+	echo "commit $commit_id (master)" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# A stale commit-graph file must be ignored and removed by cleanup.
+	cp $testroot/repo/.git/objects/info/commit-graph \
+		$testroot/repo-shallow/objects/info/commit-graph
+
+	got log -r $testroot/repo-shallow | grep '^commit' > $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	gotadmin cleanup -q -r $testroot/repo-shallow > $testroot/stdout \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin cleanup failed unexpectedly" >&2
+		cat $testroot/stderr >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if [ -e $testroot/repo-shallow/objects/info/commit-graph ]; then
+		echo "stale commit-graph file was not removed" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo-shallow"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
+test_pack_reused_and_new_deltas() {
+	local testroot=`test_init pack_reused_and_new_deltas`
+	local packdir=$testroot/repo/.git/objects/pack
+
+	# Create deltas which Git stores against full bases.
+	seq 1 500 > $testroot/base
+	mkdir $testroot/repo/files
+	for i in `seq 1 20`; do
+		(cat $testroot/base; echo "file $i") \
+			> $testroot/repo/files/file$i
+	done
+	git -C $testroot/repo add files
+	git_commit $testroot/repo -m "add files"
+
+	# Git stores the newest commit first. Once this commit has become
+	# unreachable, the leading part of the pack file cannot be copied
+	# verbatim and Git's deltas must be reused one by one.
+	git -C $testroot/repo checkout -q -b side
+	echo "side" > $testroot/repo/side
+	git -C $testroot/repo add side
+	git_commit $testroot/repo -m "add side"
+	git -C $testroot/repo checkout -q master
+	git -C $testroot/repo repack -q -a -d -f
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git repack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	git -C $testroot/repo branch -q -D side
+
+	# Add loose objects which must be deltified by gotadmin.
+	for i in `seq 21 40`; do
+		(cat $testroot/base; echo "file $i") \
+			> $testroot/repo/files/file$i
+	done
+	git -C $testroot/repo add files
+	git_commit $testroot/repo -m "add more files"
+
+	# Bases of Git's deltas are searched for deltas again, so the
+	# reused deltas must be written after them, following the new deltas.
+	gotadmin pack -a -r $testroot/repo > $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	packname=`grep ^Wrote $testroot/stdout | cut -d ' ' -f2`
+	local pack=$packdir/pack-$packname
+	local idx=`echo $pack | sed -e 's/\.pack$/.idx/'`
+
+	gotadmin listpack $pack > $testroot/stdout
+	ndeltas=`grep -c offset-delta $testroot/stdout`
+	if [ "$ndeltas" -lt 38 ]; then
+		echo "unexpected number of deltas: $ndeltas" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# Every delta must follow its base in the pack file.
+	awk '{ off[$1] = $4 }
+	    $2 == "offset-delta" && $10 >= $4 { exit 1 }
+	    $2 == "ref-delta" { ref[$1] = $10 }
+	    END { for (id in ref) if (off[ref[id]] >= off[id]) exit 1 }' \
+	    $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "delta was written before its base" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cp $pack $testroot/check.pack
+	git -C $testroot/repo index-pack --strict \
+		-o $testroot/idx.git $testroot/check.pack > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git index-pack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	mv $idx $testroot/idx.got
+	gotadmin indexpack $pack > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin indexpack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cmp -s $testroot/idx.got $idx
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin indexpack produced a different index" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cmp -s $testroot/idx.git $idx
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "pack index differs from Git's pack index" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_pack_all_loose_objects
 run_test test_pack_exclude
@@ -869,3 +1858,14 @@ run_test test_pack_bad_ref
 run_test test_pack_tagged_tag
 run_test test_pack_exclude_via_ancestor_commit
 run_test test_pack_exclude_via_ancestor_commit_packed
+run_test test_pack_delta_depth
+run_test test_pack_reused_delta_depth
+run_test test_pack_reuse_verbatim
+run_test test_pack_commit_graph
+run_test test_pack_bitmap
+run_test test_pack_multi_pack_index
+run_test test_pack_bloom_filter
+run_test test_pack_reverse_index
+run_test test_pack_index_threads
+run_test test_pack_shallow
+run_test test_pack_reused_and_new_deltas
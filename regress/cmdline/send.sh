@@ -1829,6 +1829,79 @@ test_send_with_unknown_ref_on_server() {
 	test_done "$testroot" "$ret"
 }
 
+test_send_bitmap() {
+	local testroot=`test_init send_bitmap`
+
+	for i in 1 2 3; do
+		echo "alpha $i" > $testroot/repo/alpha
+		git_commit $testroot/repo -m "edit alpha $i"
+	done
+	got branch -r $testroot/repo foo
+	for i in 1 2 3; do
+		echo "zeta $i" > $testroot/repo/epsilon/zeta
+		echo "new $i" > $testroot/repo/new
+		git -C $testroot/repo add new
+		git_commit $testroot/repo -m "edit zeta $i"
+	done
+
+	git -C $testroot/repo repack -q -a -d -b
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git repack failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git -C $testroot/repo rev-list --objects foo..master | \
+		cut -d ' ' -f1 | sort > $testroot/objects.expected
+
+	# Send master with the help of Git's bitmap to repo2, and
+	# without a bitmap to repo3. Both only contain branch foo.
+	for r in repo2 repo3; do
+		git clone -q --bare --no-local --single-branch -b foo \
+			$testroot/repo $testroot/$r
+		if [ "$r" = repo3 ]; then
+			rm $testroot/repo/.git/objects/pack/*.bitmap
+		fi
+
+		cat > $testroot/repo/.git/got.conf <<EOF
+remote "origin" {
+	protocol ssh
+	server 127.0.0.1
+	repository "$testroot/$r"
+}
+EOF
+		got send -q -r $testroot/repo -b master > $testroot/stdout \
+			2> $testroot/stderr
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got send command failed unexpectedly" >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+
+		# Received objects are stored as loose objects.
+		(cd $testroot/$r/objects && find ?? -type f | tr -d / | \
+			sort > $testroot/objects)
+		cmp -s $testroot/objects.expected $testroot/objects
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			diff -u $testroot/objects.expected $testroot/objects
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+
+		git_fsck "$testroot" "$testroot/$r"
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	test_done "$testroot" "0"
+}
+
 test_parseargs "$@"
 run_test test_send_basic			no-sha256
 run_test test_send_rebase_required		no-sha256
@@ -1847,3 +1920,4 @@ run_test test_send_gitconfig			no-sha256
 run_test test_send_rejected			no-sha256
 run_test test_send_basic_http			no-sha256
 run_test test_send_with_unknown_ref_on_server	no-sha256
+run_test test_send_bitmap			no-sha256
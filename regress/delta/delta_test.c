@@ -54,7 +54,11 @@ const struct delta_test {
 	  16, "\x10\x10\xff\xff\xff\xff\xff\x10\00\00", 10 , NULL, 0 },
 	/* libgit2 9844d38be delta: fix out-of-bounds read of delta */
 	{ "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
-	  16, "\x10\x70\xff", 3, NULL, 0}
+	  16, "\x10\x70\xff", 3, NULL, 0},
+	/* target len 4, copy 8 bytes at offset 0 from base */
+	{ "aabbccdd", 8, "\x08\x04\x90\x08", 4, NULL, 0 },
+	/* target len 4, copy 4 bytes from base, append 4 'x' */
+	{ "aabbccdd", 8, "\x08\x04\x90\x04\x04xxxx", 9, NULL, 0 },
 };
 
 static int
@@ -120,6 +124,59 @@ delta_apply(void)
 	return (err == NULL);
 }
 
+static int
+delta_apply_in_mem(void)
+{
+	const struct got_error *err = NULL;
+	size_t i;
+
+	for (i = 0; i < nitems(delta_tests); i++) {
+		const struct delta_test *dt = &delta_tests[i];
+		uint8_t base[32], buf[64];
+		uint64_t base_size, result_size = 0;
+		size_t j, result_len;
+
+		/*
+		 * Allow for more output than the declared result size.
+		 * Bytes beyond the declared result must remain untouched.
+		 */
+		if (got_delta_get_sizes(&base_size, &result_size,
+		    dt->delta, dt->delta_len) != NULL)
+			result_size = 0;
+		memcpy(base, dt->base, dt->base_len);
+		memset(buf, 0xff, sizeof(buf));
+		err = got_delta_apply_in_mem(base, dt->base_len,
+		    dt->delta, dt->delta_len, buf, &result_len, sizeof(buf));
+		if (dt->expected == NULL) {
+			/* Invalid delta, expect an error. */
+			if (err == NULL)
+				err = got_error(GOT_ERR_EXPECTED);
+			else if (err->code == GOT_ERR_BAD_DELTA)
+				err = NULL;
+			if (err)
+				break;
+		} else {
+			if (err)
+				break;
+			if (result_len != dt->result_len ||
+			    memcmp(buf, dt->expected, result_len) != 0) {
+				err = got_error(GOT_ERR_BAD_DELTA);
+				break;
+			}
+		}
+		for (j = result_size; j < sizeof(buf); j++) {
+			if (buf[j] != 0xff) {
+				err = got_error(GOT_ERR_BAD_DELTA);
+				break;
+			}
+		}
+		if (err)
+			break;
+	}
+
+	return (err == NULL);
+}
+
 static int quiet;
 
 #define RUN_TEST(expr, name) \
@@ -170,6 +227,7 @@ main(int argc, char *argv[])
 		err(1, "unveil");
 
 	RUN_TEST(delta_apply(), "delta_apply");
+	RUN_TEST(delta_apply_in_mem(), "delta_apply_in_mem");
 
 	return failure ? 1 : 0;
 }
@@ -172,7 +172,99 @@ test_send_to_read_only_repo() {
 	test_done "$testroot" "$ret"
 }
 
+test_fetch_blob_with_filter() {
+	local testroot=`test_init fetch_blob_with_filter 1`
+
+	git -c protocol.version=2 clone -q --filter=blob:none --no-checkout \
+		${GOTD_TEST_REPO_URL} $testroot/repo-clone 2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git clone failed unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	local blob_id=`git -C $testroot/repo-clone rev-parse HEAD:alpha`
+	git -C $testroot/repo-clone rev-list --objects --missing=print HEAD \
+		> $testroot/stdout
+	if ! grep -q "^?$blob_id" $testroot/stdout; then
+		echo "blob $blob_id was not omitted from pack file" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# Without a filter, only commits and tags may be requested.
+	git init -q $testroot/repo-empty
+	git -c protocol.version=2 -C $testroot/repo-empty fetch -q \
+		${GOTD_TEST_REPO_URL} $blob_id 2> $testroot/stderr
+	ret=$?
+	if [ $ret -eq 0 ]; then
+		echo "git fetch succeeded unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	git -c protocol.version=2 -C $testroot/repo-clone fetch -q \
+		--filter=blob:none origin $blob_id 2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git fetch failed unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	git -C $testroot/repo-clone rev-list --objects --missing=print HEAD \
+		> $testroot/stdout
+	if grep -q "^?$blob_id" $testroot/stdout; then
+		echo "blob $blob_id was not fetched" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# Filters gotd cannot apply must be reported to the client.
+	git clone -q --filter=tree:0 ${GOTD_TEST_REPO_URL} \
+		$testroot/repo-clone2 2> $testroot/stderr
+	ret=$?
+	if [ $ret -eq 0 ]; then
+		echo "git clone succeeded unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	if ! grep -q 'bad object filter specification' $testroot/stderr; then
+		echo "unexpected error from git clone:" >&2
+		cat $testroot/stderr >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# got fetches missing blobs on demand with a filter, too.
+	got clone -q -F blob:none ${GOTD_TEST_REPO_URL} $testroot/repo-clone3
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone failed unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	got checkout -q $testroot/repo-clone3 $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got checkout failed unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	echo "alpha" > $testroot/content.expected
+	cmp -s $testroot/content.expected $testroot/wt/alpha
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/content.expected $testroot/wt/alpha
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_clone_basic
 run_test test_clone_basic_git
 run_test test_send_to_read_only_repo
+run_test test_fetch_blob_with_filter
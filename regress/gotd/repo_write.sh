@@ -554,9 +554,119 @@ EOF
 	test_done "$testroot" 0
 }
 
+test_clone_cached_pack() {
+	local testroot=`test_init clone_cached_pack 1`
+
+	# The first clone may populate gotd's pack cache, and the second
+	# clone should be served from it.
+	got clone -q ${GOTD_TEST_REPO_URL} $testroot/repo-clone
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone failed unexpectedly" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	got clone -q ${GOTD_TEST_REPO_URL} $testroot/repo-clone2
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone failed unexpectedly" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	got tree -R -r $testroot/repo-clone > $testroot/stdout.expected
+	got tree -R -r $testroot/repo-clone2 > $testroot/stdout
+	if ! cmp -s $testroot/stdout.expected $testroot/stdout; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	got log -r $testroot/repo-clone > $testroot/stdout.expected
+	got log -r $testroot/repo-clone2 > $testroot/stdout
+	if ! cmp -s $testroot/stdout.expected $testroot/stdout; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	got checkout -q $testroot/repo-clone $testroot/wt >/dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got checkout failed unexpectedly" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	echo "cached" > $testroot/wt/cached
+	(cd $testroot/wt && got add cached > /dev/null)
+	(cd $testroot/wt && got commit -m 'add cached' > /dev/null)
+	local commit_id=`git_show_head $testroot/repo-clone`
+
+	# Simulate temporary files left behind by a crashed session process.
+	# Recently modified files might not have been locked yet.
+	local cachedir=${GOTD_TEST_REPO}/gotd-pack-cache
+	touch -t 202001010000 $cachedir/packing-stale
+	touch $cachedir/packing-fresh
+
+	if ! got send -q -r $testroot/repo-clone; then
+		echo "got send failed unexpectedly" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	if [ -e $cachedir/packing-stale ]; then
+		echo "stale temporary file was not removed" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+	if [ ! -e $cachedir/packing-fresh ]; then
+		echo "recent temporary file was removed" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+	rm $cachedir/packing-fresh
+
+	# A clone after the push must not be served a stale cached pack.
+	got clone -q ${GOTD_TEST_REPO_URL} $testroot/repo-clone3
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone failed unexpectedly" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	local head_id=`git_show_head $testroot/repo-clone3`
+	if [ "$head_id" != "$commit_id" ]; then
+		echo "head is $head_id; expected $commit_id" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	got tree -R -r $testroot/repo-clone > $testroot/stdout.expected
+	got tree -R -r $testroot/repo-clone3 > $testroot/stdout
+	if ! cmp -s $testroot/stdout.expected $testroot/stdout; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	got cat -r $testroot/repo-clone3 -P cached > $testroot/stdout
+	echo "cached" > $testroot/stdout.expected
+	if ! cmp -s $testroot/stdout.expected $testroot/stdout; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	test_done "$testroot" 0
+}
+
 test_parseargs "$@"
 run_test test_send_basic
 run_test test_fetch_more_history
 run_test test_send_new_empty_branch
 run_test test_delete_branch
 run_test test_rewind_branch
+run_test test_clone_cached_pack
@@ -31,7 +31,7 @@ test_request_bad_commit() {
 	# off the initial capabilities advertisement header.
 	tr '\0' '\n' < $testroot/stdout | tail -n 1 > $testroot/stdout.filtered
 
-	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k0000" \
+	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k thin-pack0000" \
 		> $testroot/stdout.expected
 	echo -n "0041ERR object $dummy_commit not found" \
 		>> $testroot/stdout.expected
@@ -68,7 +68,7 @@ test_request_bad_length_zero() {
 
 	tr '\0' '\n' < $testroot/stdout | tail -n 1 > $testroot/stdout.filtered
 
-	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k0000" \
+	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k thin-pack0000" \
 		> $testroot/stdout.expected
 	echo -n "0028ERR unexpected flush packet received" \
 		>> $testroot/stdout.expected
@@ -105,7 +105,7 @@ test_request_bad_length_empty() {
 
 	tr '\0' '\n' < $testroot/stdout | tail -n 1 > $testroot/stdout.filtered
 
-	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k0000" \
+	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k thin-pack0000" \
 		> $testroot/stdout.expected
 	echo -n '0018ERR packet too short' >> $testroot/stdout.expected
 
@@ -140,7 +140,7 @@ test_request_bad_length_small() {
 
 	tr '\0' '\n' < $testroot/stdout | tail -n 1 > $testroot/stdout.filtered
 
-	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k0000" \
+	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k thin-pack0000" \
 		> $testroot/stdout.expected
 	echo -n '0018ERR packet too short' >> $testroot/stdout.expected
 
@@ -175,7 +175,7 @@ test_request_bad_length_large() {
 
 	tr '\0' '\n' < $testroot/stdout | tail -n 1 > $testroot/stdout.filtered
 
-	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k0000" \
+	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k thin-pack0000" \
 		> $testroot/stdout.expected
 	echo -n '001eERR unexpected end of file' \
 		>> $testroot/stdout.expected
@@ -211,7 +211,7 @@ test_request_bad_capabilities() {
 
 	tr '\0' '\n' < $testroot/stdout | tail -n 1 > $testroot/stdout.filtered
 
-	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k0000" \
+	echo -n " agent=got/${GOT_VERSION_STR} ofs-delta side-band-64k thin-pack0000" \
 		> $testroot/stdout.expected
 	echo -n "0025ERR unexpected want-line received" \
 		>> $testroot/stdout.expected
@@ -89,4 +89,110 @@ test_fetch_with_git_history_walk() {
 	test_done "$testroot" "0"
 }
 
+test_fetch_v2_with_git() {
+	local testroot=`test_init fetch_v2_with_git 1`
+
+	# Protocol version 2 requires that sshd accepts GIT_PROTOCOL
+	# from the client and passes it on to gotsh; see README.
+	GIT_TRACE_PACKET=$testroot/packet.log git -c protocol.version=2 \
+		clone -q ${GOTD_TEST_REPO_URL} $testroot/repo-clone \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git clone failed unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	if ! grep -q '< version 2$' $testroot/packet.log; then
+		echo "gotsh did not use protocol version 2" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	if ! grep -q '> command=ls-refs$' $testroot/packet.log; then
+		echo "git did not send an ls-refs command" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	echo "v2" > $testroot/repo-clone/v2file
+	git -C $testroot/repo-clone add v2file
+	git_commit $testroot/repo-clone -m "add v2file"
+	local commit_id=`git_show_head $testroot/repo-clone`
+	git -C $testroot/repo-clone branch v2branch
+	git -C $testroot/repo-clone push -q origin main v2branch
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git push failed unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# gotsh must only list references which match a ref-prefix.
+	rm $testroot/packet.log
+	GIT_TRACE_PACKET=$testroot/packet.log git -c protocol.version=2 \
+		-C $testroot/repo-clone fetch -q origin main \
+		2> $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git fetch failed unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	if ! grep -q '> ref-prefix refs/heads/main$' $testroot/packet.log; then
+		echo "git did not send a ref-prefix argument" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	sed -n 's/^.*< [0-9a-f]\{40,\} \([^ ]*\).*$/\1/p' \
+		$testroot/packet.log > $testroot/stdout
+	echo "refs/heads/main" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# got clients request protocol version 2 as well.
+	got clone -q -b v2branch ${GOTD_TEST_REPO_URL} $testroot/repo-clone2
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got clone failed unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	got ref -l -r $testroot/repo-clone2 refs/remotes > $testroot/stdout
+	echo "refs/remotes/origin/v2branch: $commit_id" \
+		> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got cat -r $testroot/repo-clone2 -c v2branch -P v2file \
+		> $testroot/stdout
+	echo "v2" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	git_fsck "$testroot" "$testroot/repo-clone2"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
 run_test test_fetch_with_git_history_walk
+run_test test_fetch_v2_with_git